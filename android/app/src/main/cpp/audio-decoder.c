@@ -13,7 +13,7 @@
 
 static void *android_chiaki_audio_decoder_output_thread_func(void *user);
 static void android_chiaki_audio_decoder_header(ChiakiAudioHeader *header, void *user);
-static void android_chiaki_audio_decoder_frame(uint8_t *buf, size_t buf_size, void *user);
+static void android_chiaki_audio_decoder_frame(uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index, void *user);
 
 ChiakiErrorCode android_chiaki_audio_decoder_init(AndroidChiakiAudioDecoder *decoder, ChiakiLog *log)
 {
@@ -147,17 +147,17 @@ static void android_chiaki_audio_decoder_header(ChiakiAudioHeader *header, void
 	opus_id_head[0x11] = (uint8_t)(output_gain >> 8);
 	opus_id_head[0x12] = 0; // channel map
 	//AMediaFormat_setBuffer(format, AMEDIAFORMAT_KEY_CSD_0, opus_id_head, sizeof(opus_id_head));
-	android_chiaki_audio_decoder_frame(opus_id_head, sizeof(opus_id_head), decoder);
+	android_chiaki_audio_decoder_frame(opus_id_head, sizeof(opus_id_head), 0, decoder);
 
 	uint64_t pre_skip_ns = 0;
 	uint8_t csd1[8] = { (uint8_t)(pre_skip_ns & 0xff), (uint8_t)((pre_skip_ns >> 0x8) & 0xff), (uint8_t)((pre_skip_ns >> 0x10) & 0xff), (uint8_t)((pre_skip_ns >> 0x18) & 0xff),
 						(uint8_t)((pre_skip_ns >> 0x20) & 0xff), (uint8_t)((pre_skip_ns >> 0x28) & 0xff), (uint8_t)((pre_skip_ns >> 0x30) & 0xff), (uint8_t)(pre_skip_ns >> 0x38)};
-	android_chiaki_audio_decoder_frame(csd1, sizeof(csd1), decoder);
+	android_chiaki_audio_decoder_frame(csd1, sizeof(csd1), 0, decoder);
 
 	uint64_t pre_roll_ns = 0;
 	uint8_t csd2[8] = { (uint8_t)(pre_roll_ns & 0xff), (uint8_t)((pre_roll_ns >> 0x8) & 0xff), (uint8_t)((pre_roll_ns >> 0x10) & 0xff), (uint8_t)((pre_roll_ns >> 0x18) & 0xff),
 						(uint8_t)((pre_roll_ns >> 0x20) & 0xff), (uint8_t)((pre_roll_ns >> 0x28) & 0xff), (uint8_t)((pre_roll_ns >> 0x30) & 0xff), (uint8_t)(pre_roll_ns >> 0x38)};
-	android_chiaki_audio_decoder_frame(csd2, sizeof(csd2), decoder);
+	android_chiaki_audio_decoder_frame(csd2, sizeof(csd2), 0, decoder);
 
 	if(decoder->settings_cb)
 		decoder->settings_cb(header->channels, header->rate, decoder->cb_user);
@@ -166,7 +166,7 @@ beach:
 	chiaki_mutex_unlock(&decoder->codec_mutex);
 }
 
-static void android_chiaki_audio_decoder_frame(uint8_t *buf, size_t buf_size, void *user)
+static void android_chiaki_audio_decoder_frame(uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index, void *user)
 {
 	AndroidChiakiAudioDecoder *decoder = user;
 	chiaki_mutex_lock(&decoder->codec_mutex);
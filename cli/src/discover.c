@@ -4,27 +4,34 @@
 
 #include <chiaki/discovery.h>
 
+#include "fleet.h"
+
 #include <argp.h>
 
-#include <netdb.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <netinet/in.h>
 
-static char doc[] = "Send a PS4 or PS5 discovery request.";
+static char doc[] = "Send a PS4 or PS5 discovery request."
+	"\v"
+	"--host may be given multiple times and combined with --file to query many consoles at once. "
+	"All requests are sent concurrently and retransmitted until each console answered or the timeout passed.";
 
 #define ARG_KEY_HOST 'h'
+#define ARG_KEY_FILE 'f'
 #define ARG_KEY_TIMEOUT 't'
 
 static struct argp_option options[] = {
-	{ "host", ARG_KEY_HOST, "Host", 0, "Host to send discovery request to", 0 },
+	{ "host", ARG_KEY_HOST, "Host", 0, "Host to send discovery request to, may be repeated", 0 },
+	{ "file", ARG_KEY_FILE, "File", 0, "File with one host per line", 0 },
 	{ "timeout", ARG_KEY_TIMEOUT, "Timeout", 0, "Number of seconds to wait for request to return (default=2)", 0},
 	{ 0 }
 };
 
 typedef struct arguments
 {
-	const char *host;
+	CliFleet fleet;
+	bool fleet_error;
 	const char *timeout;
 } Arguments;
 
@@ -35,7 +42,12 @@ static int parse_opt(int key, char *arg, struct argp_state *state)
 	switch(key)
 	{
 		case ARG_KEY_HOST:
-			arguments->host = arg;
+			if(!cli_fleet_add(&arguments->fleet, arg, true, 0))
+				arguments->fleet_error = true;
+			break;
+		case ARG_KEY_FILE:
+			if(!cli_fleet_load_file(&arguments->fleet, arg, true, 0, false))
+				arguments->fleet_error = true;
 			break;
 		case ARG_KEY_TIMEOUT:
 			arguments->timeout = arg;
@@ -52,12 +64,12 @@ static int parse_opt(int key, char *arg, struct argp_state *state)
 
 static struct argp argp = { options, parse_opt, 0, doc, 0, 0, 0 };
 
-static void discovery_cb(ChiakiDiscoveryHost *host, void *user)
+static void discovery_cb(ChiakiDiscoveryFleetHost *fleet_host, ChiakiDiscoveryHost *host, void *user)
 {
 	ChiakiLog *log = user;
 
 	CHIAKI_LOGI(log, "--");
-	CHIAKI_LOGI(log, "Discovered Host:");
+	CHIAKI_LOGI(log, "Discovered Host:                   %s", fleet_host->host);
 	CHIAKI_LOGI(log, "State:                             %s", chiaki_discovery_host_state_string(host->state));
 
 	if(host->system_version)
@@ -90,15 +102,17 @@ static void discovery_cb(ChiakiDiscoveryHost *host, void *user)
 CHIAKI_EXPORT int chiaki_cli_cmd_discover(ChiakiLog *log, int argc, char *argv[])
 {
 	Arguments arguments = { 0 };
+	cli_fleet_init(&arguments.fleet);
 	float timeout_sec = 2;
+	int r = 1;
 	error_t argp_r = argp_parse(&argp, argc, argv, ARGP_IN_ORDER, NULL, &arguments);
-	if(argp_r != 0)
-		return 1;
+	if(argp_r != 0 || arguments.fleet_error)
+		goto cleanup;
 
-	if(!arguments.host)
+	if(!arguments.fleet.hosts_count)
 	{
 		fprintf(stderr, "No host specified, see --help.\n");
-		return 1;
+		goto cleanup;
 	}
 
 	if(arguments.timeout)
@@ -106,100 +120,33 @@ CHIAKI_EXPORT int chiaki_cli_cmd_discover(ChiakiLog *log, int argc, char *argv[]
 		timeout_sec = atof(arguments.timeout);
 	}
 
-	struct addrinfo *host_addrinfos;
-	// make hostname use ipv4 for now
-	struct addrinfo hints;
-	memset(&hints, 0, sizeof(hints));
-	hints.ai_socktype = SOCK_DGRAM;
-	char *ipv6 = strchr(arguments.host, ':');
-	if(ipv6)
-		hints.ai_family = AF_INET6;
-	else
-		hints.ai_family = AF_INET;
-	int r = getaddrinfo(arguments.host, NULL, &hints, &host_addrinfos);
-	if(r != 0)
-	{
-		CHIAKI_LOGE(log, "getaddrinfo failed");
-		return 1;
-	}
-
-	struct sockaddr *host_addr = NULL;
-	socklen_t host_addr_len = 0;
-	for(struct addrinfo *ai=host_addrinfos; ai; ai=ai->ai_next)
-	{
-		if(ai->ai_protocol != IPPROTO_UDP)
-			continue;
-		if(ai->ai_family != AF_INET && ai->ai_family != AF_INET6)
-			continue;
-
-		host_addr_len = ai->ai_addrlen;
-		host_addr = (struct sockaddr *)malloc(host_addr_len);
-		if(!host_addr)
-			break;
-		memcpy(host_addr, ai->ai_addr, host_addr_len);
-		break;
-	}
-	freeaddrinfo(host_addrinfos);
-
-	if(!host_addr)
-	{
-		CHIAKI_LOGE(log, "Failed to get addr for hostname");
-		return 1;
-	}
-
-	ChiakiDiscoveryPacket packet;
-	memset(&packet, 0, sizeof(packet));
-	packet.cmd = CHIAKI_DISCOVERY_CMD_SRCH;
-	packet.protocol_version = CHIAKI_DISCOVERY_PROTOCOL_VERSION_PS4;
-	if(host_addr->sa_family == AF_INET)
-		((struct sockaddr_in *)host_addr)->sin_port = htons(CHIAKI_DISCOVERY_PORT_PS4);
-	else
-		((struct sockaddr_in6 *)host_addr)->sin6_port = htons(CHIAKI_DISCOVERY_PORT_PS4);
-
-	ChiakiDiscovery discovery;
-	ChiakiErrorCode err = chiaki_discovery_init(&discovery, log, host_addr->sa_family);
-	if(err != CHIAKI_ERR_SUCCESS)
-	{
-		CHIAKI_LOGE(log, "Discovery init failed");
-		goto cleanup_host_addr;
-	}
+	ChiakiDiscoveryFleetOptions options;
+	chiaki_discovery_fleet_options_default(&options);
+	options.cmd = CHIAKI_DISCOVERY_CMD_SRCH;
+	options.timeout_ms = (uint64_t)(timeout_sec * 1000);
+	options.cb = discovery_cb;
+	options.cb_user = log;
 
-	ChiakiDiscoveryThread thread;
-	err = chiaki_discovery_thread_start_oneshot(&thread, &discovery, discovery_cb, NULL);
+	ChiakiErrorCode err = chiaki_discovery_fleet_run(log, arguments.fleet.hosts, arguments.fleet.hosts_count, &options);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
-		CHIAKI_LOGE(log, "Discovery thread init failed");
+		CHIAKI_LOGE(log, "Discovery failed: %s", chiaki_error_string(err));
 		goto cleanup;
 	}
-	err = chiaki_discovery_send(&discovery, &packet, host_addr, host_addr_len);
-	if(err != CHIAKI_ERR_SUCCESS)
-		CHIAKI_LOGE(log, "Failed to send discovery packet for PS4: %s", chiaki_error_string(err));
-	packet.protocol_version = CHIAKI_DISCOVERY_PROTOCOL_VERSION_PS5;
-	if(host_addr->sa_family == AF_INET)
-		((struct sockaddr_in *)host_addr)->sin_port = htons(CHIAKI_DISCOVERY_PORT_PS5);
+
+	size_t responded;
+	if(arguments.fleet.hosts_count > 1)
+		responded = cli_fleet_print_summary(&arguments.fleet);
 	else
-		((struct sockaddr_in6 *)host_addr)->sin6_port = htons(CHIAKI_DISCOVERY_PORT_PS5);
-	err = chiaki_discovery_send(&discovery, &packet, host_addr, host_addr_len);
-	if(err != CHIAKI_ERR_SUCCESS)
-		CHIAKI_LOGE(log, "Failed to send discovery packet for PS5: %s", chiaki_error_string(err));
-	uint64_t timeout_ms=(timeout_sec * 1000);
-	err = chiaki_thread_timedjoin(&thread.thread, NULL, timeout_ms);
-	if(err != CHIAKI_ERR_SUCCESS)
 	{
-		if(err == CHIAKI_ERR_TIMEOUT)
-		{
+		ChiakiDiscoveryFleetHost *host = &arguments.fleet.hosts[0];
+		responded = host->state == CHIAKI_DISCOVERY_FLEET_STATE_RESPONDED ? 1 : 0;
+		if(!responded)
 			CHIAKI_LOGE(log, "Discovery request timed out after timeout: %.*f seconds", 1, timeout_sec);
-			chiaki_discovery_thread_stop(&thread);
-		}
-		goto cleanup;
 	}
-	chiaki_discovery_fini(&discovery);
-	free(host_addr);
-	return 0;
+	r = responded == arguments.fleet.hosts_count ? 0 : 1;
 
 cleanup:
-	chiaki_discovery_fini(&discovery);
-cleanup_host_addr:
-	free(host_addr);
-	return 1;
+	cli_fleet_fini(&arguments.fleet);
+	return r;
 }
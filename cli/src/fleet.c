@@ -0,0 +1,182 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include "fleet.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void cli_fleet_init(CliFleet *fleet)
+{
+	fleet->hosts = NULL;
+	fleet->hosts_count = 0;
+	fleet->hosts_size = 0;
+}
+
+void cli_fleet_fini(CliFleet *fleet)
+{
+	for(size_t i=0; i<fleet->hosts_count; i++)
+		free((char *)fleet->hosts[i].host);
+	free(fleet->hosts);
+}
+
+bool cli_fleet_add(CliFleet *fleet, const char *host, bool ps5, uint64_t user_credential)
+{
+	if(fleet->hosts_count == fleet->hosts_size)
+	{
+		size_t size = fleet->hosts_size ? fleet->hosts_size * 2 : 8;
+		ChiakiDiscoveryFleetHost *hosts = realloc(fleet->hosts, size * sizeof(ChiakiDiscoveryFleetHost));
+		if(!hosts)
+			return false;
+		fleet->hosts = hosts;
+		fleet->hosts_size = size;
+	}
+
+	ChiakiDiscoveryFleetHost *fleet_host = &fleet->hosts[fleet->hosts_count];
+	memset(fleet_host, 0, sizeof(*fleet_host));
+	fleet_host->host = strdup(host);
+	if(!fleet_host->host)
+		return false;
+	fleet_host->ps5 = ps5;
+	fleet_host->user_credential = user_credential;
+	fleet->hosts_count++;
+	return true;
+}
+
+bool cli_fleet_parse_registkey(const char *registkey, uint64_t *user_credential)
+{
+	size_t len = strlen(registkey);
+	if(!len || len > 8)
+		return false;
+	char *end;
+	errno = 0;
+	unsigned long long v = strtoull(registkey, &end, 16);
+	if(errno || *end)
+		return false;
+	*user_credential = (uint64_t)v;
+	return true;
+}
+
+bool cli_fleet_load_file(CliFleet *fleet, const char *path, bool ps5, uint64_t user_credential, bool registkey_required)
+{
+	FILE *f = fopen(path, "r");
+	if(!f)
+	{
+		fprintf(stderr, "Failed to open host file %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	bool r = true;
+	char line[512];
+	unsigned int line_number = 0;
+	while(fgets(line, sizeof(line), f))
+	{
+		line_number++;
+		char *comment = strchr(line, '#');
+		if(comment)
+			*comment = '\0';
+
+		char *save = NULL;
+		char *host = strtok_r(line, " \t\r\n", &save);
+		if(!host)
+			continue;
+
+		bool line_ps5 = ps5;
+		uint64_t line_credential = user_credential;
+		bool line_registkey = false;
+		char *token;
+		while((token = strtok_r(NULL, " \t\r\n", &save)))
+		{
+			if(strcmp(token, "ps4") == 0)
+				line_ps5 = false;
+			else if(strcmp(token, "ps5") == 0)
+				line_ps5 = true;
+			else if(cli_fleet_parse_registkey(token, &line_credential))
+				line_registkey = true;
+			else
+			{
+				fprintf(stderr, "%s:%u: Invalid registkey or console type \"%s\"\n", path, line_number, token);
+				r = false;
+				goto beach;
+			}
+		}
+
+		if(registkey_required && !line_registkey)
+		{
+			fprintf(stderr, "%s:%u: No registkey for %s and none given with --registkey\n", path, line_number, host);
+			r = false;
+			goto beach;
+		}
+
+		if(!cli_fleet_add(fleet, host, line_ps5, line_credential))
+		{
+			r = false;
+			goto beach;
+		}
+	}
+
+beach:
+	fclose(f);
+	return r;
+}
+
+size_t cli_fleet_print_summary(CliFleet *fleet)
+{
+	size_t responded = 0;
+	size_t timeout = 0;
+	size_t invalid = 0;
+	uint64_t rtt_sum_us = 0;
+	size_t rtt_count = 0;
+	uint64_t response_max_us = 0;
+
+	printf("%-24s %-12s %-8s %-8s %-14s %-20s %5s %9s\n", "HOST", "RESULT", "CONSOLE", "STATE", "ID", "NAME", "TRIES", "RTT");
+	for(size_t i=0; i<fleet->hosts_count; i++)
+	{
+		ChiakiDiscoveryFleetHost *host = &fleet->hosts[i];
+		char rtt[16] = "-";
+		switch(host->state)
+		{
+			case CHIAKI_DISCOVERY_FLEET_STATE_RESPONDED:
+				responded++;
+				if(host->response_us > response_max_us)
+					response_max_us = host->response_us;
+				if(host->rtt_us)
+				{
+					rtt_sum_us += host->rtt_us;
+					rtt_count++;
+					snprintf(rtt, sizeof(rtt), "%.1fms", host->rtt_us / 1000.0);
+				}
+				break;
+			case CHIAKI_DISCOVERY_FLEET_STATE_TIMEOUT:
+				timeout++;
+				break;
+			case CHIAKI_DISCOVERY_FLEET_STATE_INVALID_HOST:
+				invalid++;
+				break;
+			default:
+				break;
+		}
+
+		bool responded_host = host->state == CHIAKI_DISCOVERY_FLEET_STATE_RESPONDED;
+		printf("%-24s %-12s %-8s %-8s %-14s %-20s %5u %9s\n",
+				host->host,
+				chiaki_discovery_fleet_state_string(host->state),
+				responded_host ? (host->host_ps5 ? "PS5" : "PS4") : "-",
+				responded_host ? chiaki_discovery_host_state_string(host->host_state) : "-",
+				host->host_id[0] ? host->host_id : "-",
+				host->host_name[0] ? host->host_name : "-",
+				host->attempts,
+				rtt);
+	}
+
+	printf("%zu hosts: %zu responded, %zu timed out, %zu invalid", fleet->hosts_count, responded, timeout, invalid);
+	if(rtt_count)
+		printf(", mean RTT %.1fms", (double)rtt_sum_us / rtt_count / 1000.0);
+	if(responded)
+		printf(", slowest response %.1fms", response_max_us / 1000.0);
+	printf("\n");
+
+	return responded;
+}
@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_CLI_FLEET_H
+#define CHIAKI_CLI_FLEET_H
+
+#include <chiaki/discovery.h>
+
+#include <stdbool.h>
+
+/**
+ * List of hosts collected from repeated --host arguments and host files.
+ */
+typedef struct cli_fleet_t
+{
+	ChiakiDiscoveryFleetHost *hosts;
+	size_t hosts_count;
+	size_t hosts_size;
+} CliFleet;
+
+void cli_fleet_init(CliFleet *fleet);
+void cli_fleet_fini(CliFleet *fleet);
+bool cli_fleet_add(CliFleet *fleet, const char *host, bool ps5, uint64_t user_credential);
+
+/**
+ * Parse a plaintext registration key as given on the command line.
+ */
+bool cli_fleet_parse_registkey(const char *registkey, uint64_t *user_credential);
+
+/**
+ * Add all hosts from a file with one "host [registkey] [ps4|ps5]" per line.
+ * Empty lines and lines starting with '#' are ignored.
+ * @param ps5 default console type for lines that do not specify it
+ * @param registkey_required fail on lines without a registkey instead of using user_credential for them
+ */
+bool cli_fleet_load_file(CliFleet *fleet, const char *path, bool ps5, uint64_t user_credential, bool registkey_required);
+
+/**
+ * Print one line per host and the totals to stdout.
+ * @return number of hosts that responded
+ */
+size_t cli_fleet_print_summary(CliFleet *fleet);
+
+#endif // CHIAKI_CLI_FLEET_H
@@ -0,0 +1,137 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include "oggopus.h"
+
+#include <string.h>
+
+#define OGG_HEADER_TYPE_BOS 0x02
+#define OGG_PAGE_HEADER_SIZE 27
+#define OGG_SEGMENTS_MAX 255
+
+static uint32_t ogg_crc_table[0x100];
+
+static void ogg_crc_table_init()
+{
+	if(ogg_crc_table[1])
+		return;
+	for(uint32_t i=0; i<0x100; i++)
+	{
+		uint32_t r = i << 24;
+		for(int j=0; j<8; j++)
+			r = (r & 0x80000000) ? (r << 1) ^ 0x04c11db7 : (r << 1);
+		ogg_crc_table[i] = r;
+	}
+}
+
+static uint32_t ogg_crc(uint32_t crc, const uint8_t *buf, size_t buf_size)
+{
+	for(size_t i=0; i<buf_size; i++)
+		crc = (crc << 8) ^ ogg_crc_table[((crc >> 24) ^ buf[i]) & 0xff];
+	return crc;
+}
+
+static void write_le16(uint8_t *buf, uint16_t v)
+{
+	buf[0] = v & 0xff;
+	buf[1] = (v >> 8) & 0xff;
+}
+
+static void write_le32(uint8_t *buf, uint32_t v)
+{
+	for(int i=0; i<4; i++)
+		buf[i] = (v >> (8 * i)) & 0xff;
+}
+
+static void write_le64(uint8_t *buf, uint64_t v)
+{
+	for(int i=0; i<8; i++)
+		buf[i] = (v >> (8 * i)) & 0xff;
+}
+
+static bool ogg_write_page(CliOggOpus *ogg, uint8_t header_type, const uint8_t *buf, size_t buf_size)
+{
+	// a packet is split into 255 byte segments and ends with a shorter one, which may be empty
+	size_t segments = buf_size / 255 + 1;
+	if(segments > OGG_SEGMENTS_MAX)
+		return false;
+
+	uint8_t header[OGG_PAGE_HEADER_SIZE + OGG_SEGMENTS_MAX];
+	memcpy(header, "OggS", 4);
+	header[4] = 0; // version
+	header[5] = header_type;
+	write_le64(header + 6, ogg->granule);
+	write_le32(header + 14, ogg->serial);
+	write_le32(header + 18, ogg->page_seq++);
+	write_le32(header + 22, 0); // crc, calculated with this zeroed
+	header[26] = (uint8_t)segments;
+	memset(header + OGG_PAGE_HEADER_SIZE, 255, segments - 1);
+	header[OGG_PAGE_HEADER_SIZE + segments - 1] = (uint8_t)(buf_size % 255);
+
+	size_t header_size = OGG_PAGE_HEADER_SIZE + segments;
+	uint32_t crc = ogg_crc(0, header, header_size);
+	crc = ogg_crc(crc, buf, buf_size);
+	write_le32(header + 22, crc);
+
+	if(fwrite(header, 1, header_size, ogg->file) != header_size)
+		return false;
+	if(buf_size && fwrite(buf, 1, buf_size, ogg->file) != buf_size)
+		return false;
+	return fflush(ogg->file) == 0;
+}
+
+void cli_ogg_opus_init(CliOggOpus *ogg, FILE *file, uint32_t serial)
+{
+	ogg_crc_table_init();
+	ogg->file = file;
+	ogg->serial = serial;
+	ogg->page_seq = 0;
+	ogg->granule = 0;
+	ogg->granule_per_frame = 0;
+	ogg->frame_index_prev = 0;
+	ogg->frame_index_valid = false;
+}
+
+bool cli_ogg_opus_write_header(CliOggOpus *ogg, ChiakiAudioHeader *header)
+{
+	if(!header->rate)
+		return false;
+	ogg->granule_per_frame = (uint64_t)header->frame_size * 48000 / header->rate;
+
+	uint8_t head[19];
+	memcpy(head, "OpusHead", 8);
+	head[8] = 1; // version
+	head[9] = header->channels;
+	write_le16(head + 10, 0); // pre-skip, the stream is joined while already running
+	write_le32(head + 12, header->rate);
+	write_le16(head + 16, 0); // output gain
+	head[18] = 0; // mapping family
+	if(!ogg_write_page(ogg, OGG_HEADER_TYPE_BOS, head, sizeof(head)))
+		return false;
+
+	static const char vendor[] = "chiaki";
+	uint8_t tags[8 + 4 + sizeof(vendor) - 1 + 4];
+	memcpy(tags, "OpusTags", 8);
+	write_le32(tags + 8, sizeof(vendor) - 1);
+	memcpy(tags + 12, vendor, sizeof(vendor) - 1);
+	write_le32(tags + 12 + sizeof(vendor) - 1, 0); // no comments
+	return ogg_write_page(ogg, 0, tags, sizeof(tags));
+}
+
+bool cli_ogg_opus_write_frame(CliOggOpus *ogg, const uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index)
+{
+	ChiakiSeqNum16 frames = 1;
+	if(ogg->frame_index_valid)
+	{
+		if(frame_index == ogg->frame_index_prev)
+			return true;
+		// e.g. restarted after resuming, the granule must not go back
+		if(chiaki_seq_num_16_gt(frame_index, ogg->frame_index_prev))
+			frames = frame_index - ogg->frame_index_prev;
+	}
+	ogg->frame_index_prev = frame_index;
+	ogg->frame_index_valid = true;
+
+	// granule of a page is the position at the end of its last packet
+	ogg->granule += frames * ogg->granule_per_frame;
+	return ogg_write_page(ogg, 0, buf, buf_size);
+}
@@ -0,0 +1,40 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_CLI_OGGOPUS_H
+#define CHIAKI_CLI_OGGOPUS_H
+
+#include <chiaki/audio.h>
+#include <chiaki/seqnum.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Minimal Ogg Opus writer with one packet per page, so every frame reaches a pipe as soon as it is written.
+ */
+typedef struct cli_ogg_opus_t
+{
+	FILE *file;
+	uint32_t serial;
+	uint32_t page_seq;
+	uint64_t granule; // always in 48kHz samples for Opus
+	uint64_t granule_per_frame;
+	ChiakiSeqNum16 frame_index_prev;
+	bool frame_index_valid; // false until the first frame
+} CliOggOpus;
+
+void cli_ogg_opus_init(CliOggOpus *ogg, FILE *file, uint32_t serial);
+
+/**
+ * Write the OpusHead and OpusTags pages, must be called once before any frame.
+ */
+bool cli_ogg_opus_write_header(CliOggOpus *ogg, ChiakiAudioHeader *header);
+
+/**
+ * The granule advances by the distance to the previous frame_index, so lost frames leave a gap in the timeline.
+ * Duplicates are skipped, an index behind the previous one continues right after it.
+ */
+bool cli_ogg_opus_write_frame(CliOggOpus *ogg, const uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index);
+
+#endif // CHIAKI_CLI_OGGOPUS_H
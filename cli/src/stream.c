@@ -0,0 +1,545 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki-cli.h>
+
+#include <chiaki/config.h>
+#include <chiaki/session.h>
+#include <chiaki/time.h>
+#include <chiaki/atomic.h>
+#if CHIAKI_LIB_ENABLE_FFMPEG_DECODER
+#include <chiaki/ffmpegdecoder.h>
+#endif
+#include "../../lib/src/utils.h"
+
+#include "oggopus.h"
+
+#include <argp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char doc[] = "Stream from a registered PS4 or PS5 and write the received video and audio without a GUI."
+	"\v"
+	"The video is written as raw H.264 or H.265 Annex B, the audio as Ogg Opus, "
+	"\"-\" writes to stdout, e.g. to pipe into ffplay or ffmpeg. "
+	"--registkey and --morning are the RP-RegistKey and RP-Key of the registration. "
+	"Files are written on the receiving threads, so a reader that does not keep up stalls the stream. "
+	"Streams until interrupted, the console quits or --duration passed.";
+
+#define ARG_KEY_HOST 'h'
+#define ARG_KEY_REGISTKEY 'r'
+#define ARG_KEY_MORNING 'm'
+#define ARG_KEY_PS4 '4'
+#define ARG_KEY_PS5 '5'
+#define ARG_KEY_VIDEO 'o'
+#define ARG_KEY_AUDIO 'a'
+#define ARG_KEY_RESOLUTION 'R'
+#define ARG_KEY_FPS 'F'
+#define ARG_KEY_CODEC 'c'
+#define ARG_KEY_DURATION 'd'
+#define ARG_KEY_LOGIN_PIN 'p'
+#define ARG_KEY_DECODE 'D'
+
+static struct argp_option options[] = {
+	{ "host", ARG_KEY_HOST, "Host", 0, "Host to stream from", 0 },
+	{ "registkey", ARG_KEY_REGISTKEY, "RegistKey", 0, "Remote Play registration key (plaintext)", 0 },
+	{ "morning", ARG_KEY_MORNING, "Morning", 0, "Remote Play key of the registration (32 hex digits)", 0 },
+	{ "ps4", ARG_KEY_PS4, NULL, 0, "PlayStation 4", 0 },
+	{ "ps5", ARG_KEY_PS5, NULL, 0, "PlayStation 5 (default)", 0 },
+	{ "video", ARG_KEY_VIDEO, "File", 0, "Write the video bitstream to File, - for stdout", 0 },
+	{ "audio", ARG_KEY_AUDIO, "File", 0, "Write the audio as Ogg Opus to File, - for stdout", 0 },
+	{ "resolution", ARG_KEY_RESOLUTION, "Resolution", 0, "360, 540, 720 (default) or 1080", 0 },
+	{ "fps", ARG_KEY_FPS, "FPS", 0, "30 or 60 (default)", 0 },
+	{ "codec", ARG_KEY_CODEC, "Codec", 0, "h264 (default), h265 or h265_hdr, PS5 only", 0 },
+	{ "duration", ARG_KEY_DURATION, "Seconds", 0, "Stop after the given number of seconds", 0 },
+	{ "login-pin", ARG_KEY_LOGIN_PIN, "Pin", 0, "Login pin to enter if the console asks for one", 0 },
+#if CHIAKI_LIB_ENABLE_FFMPEG_DECODER
+	{ "decode", ARG_KEY_DECODE, NULL, 0, "Decode the video with FFmpeg and report decoded frames", 0 },
+#endif
+	{ 0 }
+};
+
+typedef struct arguments
+{
+	const char *host;
+	const char *registkey;
+	const char *morning;
+	const char *video;
+	const char *audio;
+	const char *resolution;
+	const char *fps;
+	const char *codec;
+	const char *duration;
+	const char *login_pin;
+	bool ps5;
+	bool decode;
+} Arguments;
+
+static int parse_opt(int key, char *arg, struct argp_state *state)
+{
+	Arguments *arguments = state->input;
+
+	switch(key)
+	{
+		case ARG_KEY_HOST:
+			arguments->host = arg;
+			break;
+		case ARG_KEY_REGISTKEY:
+			arguments->registkey = arg;
+			break;
+		case ARG_KEY_MORNING:
+			arguments->morning = arg;
+			break;
+		case ARG_KEY_VIDEO:
+			arguments->video = arg;
+			break;
+		case ARG_KEY_AUDIO:
+			arguments->audio = arg;
+			break;
+		case ARG_KEY_RESOLUTION:
+			arguments->resolution = arg;
+			break;
+		case ARG_KEY_FPS:
+			arguments->fps = arg;
+			break;
+		case ARG_KEY_CODEC:
+			arguments->codec = arg;
+			break;
+		case ARG_KEY_DURATION:
+			arguments->duration = arg;
+			break;
+		case ARG_KEY_LOGIN_PIN:
+			arguments->login_pin = arg;
+			break;
+		case ARG_KEY_DECODE:
+			arguments->decode = true;
+			break;
+		case ARG_KEY_PS4:
+			arguments->ps5 = false;
+			break;
+		case ARG_KEY_PS5:
+			arguments->ps5 = true;
+			break;
+		case ARGP_KEY_ARG:
+			argp_usage(state);
+			break;
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+
+	return 0;
+}
+
+static struct argp argp = { options, parse_opt, 0, doc, 0, 0, 0 };
+
+typedef struct stream_context_t
+{
+	ChiakiLog *log;
+	ChiakiSession session;
+	const char *login_pin;
+	FILE *video_file;
+	FILE *audio_file;
+	CliOggOpus ogg;
+	bool ogg_header_written;
+	chiaki_atomic_uint32_t write_failed; // set from both the video and the audio thread
+	uint64_t video_frames;
+	uint64_t video_bytes;
+	uint64_t audio_frames;
+#if CHIAKI_LIB_ENABLE_FFMPEG_DECODER
+	ChiakiFfmpegDecoder *decoder;
+	uint64_t decoded_frames;
+#endif
+
+	ChiakiMutex mutex; // protects everything below
+	ChiakiCond cond;
+	bool quit;
+	ChiakiQuitReason quit_reason;
+} StreamContext;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void stop_signal_handler(int sig)
+{
+	(void)sig;
+	stop_requested = 1;
+}
+
+static void log_cb_stderr(ChiakiLogLevel level, const char *msg, void *user)
+{
+	(void)user;
+	fprintf(stderr, "[%c] %s\n", chiaki_log_level_char(level), msg);
+}
+
+static FILE *stream_file_open(const char *path)
+{
+	if(strcmp(path, "-") == 0)
+		return stdout;
+	return fopen(path, "wb");
+}
+
+static void stream_file_close(FILE *file)
+{
+	if(file && file != stdout)
+		fclose(file);
+}
+
+static void stream_write_failed(StreamContext *ctx)
+{
+	if(!chiaki_atomic_cas_u32(&ctx->write_failed, 0, 1))
+		return;
+	CHIAKI_LOGE(ctx->log, "Writing failed, stopping");
+	chiaki_session_stop(&ctx->session);
+}
+
+static bool video_sample_cb(uint8_t *buf, size_t buf_size, int32_t frames_lost, bool frame_recovered, void *user)
+{
+	StreamContext *ctx = user;
+	if(ctx->video_file && !chiaki_atomic_load_u32(&ctx->write_failed))
+	{
+		if(fwrite(buf, 1, buf_size, ctx->video_file) != buf_size || fflush(ctx->video_file) != 0)
+			stream_write_failed(ctx);
+	}
+	ctx->video_frames++;
+	ctx->video_bytes += buf_size;
+#if CHIAKI_LIB_ENABLE_FFMPEG_DECODER
+	if(ctx->decoder)
+		return chiaki_ffmpeg_decoder_video_sample_cb(buf, buf_size, frames_lost, frame_recovered, ctx->decoder);
+#endif
+	return true;
+}
+
+#if CHIAKI_LIB_ENABLE_FFMPEG_DECODER
+static void frame_available_cb(ChiakiFfmpegDecoder *decoder, void *user)
+{
+	StreamContext *ctx = user;
+	int32_t frames_lost;
+	AVFrame *frame = chiaki_ffmpeg_decoder_pull_frame(decoder, &frames_lost);
+	if(!frame)
+		return;
+	if(!ctx->decoded_frames)
+		CHIAKI_LOGI(ctx->log, "First frame decoded, %dx%d, %llu ms after connecting", frame->width, frame->height,
+				(unsigned long long)chiaki_ffmpeg_decoder_get_first_frame_latency_us(decoder) / 1000);
+	ctx->decoded_frames++;
+	av_frame_free(&frame);
+}
+#endif
+
+static void audio_header_cb(ChiakiAudioHeader *header, void *user)
+{
+	StreamContext *ctx = user;
+	CHIAKI_LOGI(ctx->log, "Audio: %u channels, %u Hz, %u samples per frame",
+			(unsigned int)header->channels, (unsigned int)header->rate, (unsigned int)header->frame_size);
+	// a new header after resuming continues the same file
+	if(!ctx->audio_file || ctx->ogg_header_written || chiaki_atomic_load_u32(&ctx->write_failed))
+		return;
+	if(!cli_ogg_opus_write_header(&ctx->ogg, header))
+	{
+		stream_write_failed(ctx);
+		return;
+	}
+	ctx->ogg_header_written = true;
+}
+
+static void audio_frame_cb(uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index, void *user)
+{
+	StreamContext *ctx = user;
+	ctx->audio_frames++;
+	if(!ctx->ogg_header_written || chiaki_atomic_load_u32(&ctx->write_failed))
+		return;
+	if(!cli_ogg_opus_write_frame(&ctx->ogg, buf, buf_size, frame_index))
+		stream_write_failed(ctx);
+}
+
+static void event_cb(ChiakiEvent *event, void *user)
+{
+	StreamContext *ctx = user;
+	switch(event->type)
+	{
+		case CHIAKI_EVENT_CONNECTED:
+			CHIAKI_LOGI(ctx->log, "Connected");
+#if CHIAKI_LIB_ENABLE_FFMPEG_DECODER
+			if(ctx->decoder)
+				chiaki_ffmpeg_decoder_stream_connected(ctx->decoder);
+#endif
+			break;
+		case CHIAKI_EVENT_STARTUP_TIMELINE:
+			CHIAKI_LOGI(ctx->log, "First frame %llu ms after starting", (unsigned long long)event->startup_timeline.total_us / 1000);
+			break;
+		case CHIAKI_EVENT_LOGIN_PIN_REQUEST:
+			if(ctx->login_pin && !event->login_pin_request.pin_incorrect)
+			{
+				chiaki_session_set_login_pin(&ctx->session, (const uint8_t *)ctx->login_pin, strlen(ctx->login_pin));
+				break;
+			}
+			CHIAKI_LOGE(ctx->log, ctx->login_pin ? "Login pin is incorrect" : "Console requires a login pin, see --login-pin");
+			chiaki_session_stop(&ctx->session);
+			break;
+		case CHIAKI_EVENT_QUIT:
+			chiaki_mutex_lock(&ctx->mutex);
+			ctx->quit = true;
+			ctx->quit_reason = event->quit.reason;
+			chiaki_cond_signal(&ctx->cond);
+			chiaki_mutex_unlock(&ctx->mutex);
+			if(chiaki_quit_reason_is_error(event->quit.reason))
+				CHIAKI_LOGE(ctx->log, "Session quit: %s%s%s", chiaki_quit_reason_string(event->quit.reason),
+						event->quit.reason_str ? ", " : "", event->quit.reason_str ? event->quit.reason_str : "");
+			else
+				CHIAKI_LOGI(ctx->log, "Session quit: %s", chiaki_quit_reason_string(event->quit.reason));
+			break;
+		default:
+			break;
+	}
+}
+
+static bool parse_video_profile(Arguments *arguments, ChiakiConnectVideoProfile *profile)
+{
+	ChiakiVideoResolutionPreset resolution = CHIAKI_VIDEO_RESOLUTION_PRESET_720p;
+	if(arguments->resolution)
+	{
+		int v = atoi(arguments->resolution);
+		switch(v)
+		{
+			case 360: resolution = CHIAKI_VIDEO_RESOLUTION_PRESET_360p; break;
+			case 540: resolution = CHIAKI_VIDEO_RESOLUTION_PRESET_540p; break;
+			case 720: resolution = CHIAKI_VIDEO_RESOLUTION_PRESET_720p; break;
+			case 1080: resolution = CHIAKI_VIDEO_RESOLUTION_PRESET_1080p; break;
+			default:
+				fprintf(stderr, "Invalid resolution, see --help.\n");
+				return false;
+		}
+	}
+
+	ChiakiVideoFPSPreset fps = CHIAKI_VIDEO_FPS_PRESET_60;
+	if(arguments->fps)
+	{
+		int v = atoi(arguments->fps);
+		if(v == 30)
+			fps = CHIAKI_VIDEO_FPS_PRESET_30;
+		else if(v != 60)
+		{
+			fprintf(stderr, "Invalid fps, see --help.\n");
+			return false;
+		}
+	}
+
+	chiaki_connect_video_profile_preset(profile, resolution, fps);
+
+	if(arguments->codec)
+	{
+		if(strcmp(arguments->codec, "h264") == 0)
+			profile->codec = CHIAKI_CODEC_H264;
+		else if(strcmp(arguments->codec, "h265") == 0)
+			profile->codec = CHIAKI_CODEC_H265;
+		else if(strcmp(arguments->codec, "h265_hdr") == 0)
+			profile->codec = CHIAKI_CODEC_H265_HDR;
+		else
+		{
+			fprintf(stderr, "Invalid codec, see --help.\n");
+			return false;
+		}
+		if(!arguments->ps5 && profile->codec != CHIAKI_CODEC_H264)
+		{
+			fprintf(stderr, "PS4 only supports h264.\n");
+			return false;
+		}
+	}
+	return true;
+}
+
+CHIAKI_EXPORT int chiaki_cli_cmd_stream(ChiakiLog *log, int argc, char *argv[])
+{
+	Arguments arguments = { 0 };
+	arguments.ps5 = true;
+	error_t argp_r = argp_parse(&argp, argc, argv, ARGP_IN_ORDER, NULL, &arguments);
+	if(argp_r != 0)
+		return 1;
+
+	if(!arguments.host)
+	{
+		fprintf(stderr, "No host specified, see --help.\n");
+		return 1;
+	}
+	if(!arguments.registkey || !arguments.morning)
+	{
+		fprintf(stderr, "No registration key or morning specified, see --help.\n");
+		return 1;
+	}
+	if(arguments.video && arguments.audio && strcmp(arguments.video, "-") == 0 && strcmp(arguments.audio, "-") == 0)
+	{
+		fprintf(stderr, "Only one of video and audio can be written to stdout.\n");
+		return 1;
+	}
+
+	ChiakiConnectInfo connect_info = { 0 };
+	connect_info.ps5 = arguments.ps5;
+	connect_info.host = arguments.host;
+	if(strlen(arguments.registkey) > sizeof(connect_info.regist_key))
+	{
+		fprintf(stderr, "Given registkey is too long.\n");
+		return 1;
+	}
+	strncpy(connect_info.regist_key, arguments.registkey, sizeof(connect_info.regist_key));
+	size_t morning_size = sizeof(connect_info.morning);
+	if(parse_hex(connect_info.morning, &morning_size, arguments.morning, strlen(arguments.morning)) != CHIAKI_ERR_SUCCESS
+			|| morning_size != sizeof(connect_info.morning))
+	{
+		fprintf(stderr, "Given morning is invalid.\n");
+		return 1;
+	}
+	if(!parse_video_profile(&arguments, &connect_info.video_profile))
+		return 1;
+	connect_info.video_profile_auto_downgrade = true;
+	connect_info.enable_dualsense = arguments.ps5;
+	connect_info.packet_loss_max = 0.05;
+	connect_info.session_resume = true;
+	connect_info.thread_pool = true;
+	if(!arguments.video && !arguments.decode)
+		connect_info.audio_video_disabled |= CHIAKI_VIDEO_DISABLED;
+	if(!arguments.audio)
+		connect_info.audio_video_disabled |= CHIAKI_AUDIO_DISABLED;
+
+	// keep stdout clean for the stream
+	ChiakiLog log_stderr;
+	if((arguments.video && strcmp(arguments.video, "-") == 0) || (arguments.audio && strcmp(arguments.audio, "-") == 0))
+	{
+		chiaki_log_init(&log_stderr, log->level_mask, log_cb_stderr, NULL);
+		log = &log_stderr;
+	}
+
+	ChiakiErrorCode err = chiaki_lib_init();
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(log, "Chiaki lib init failed: %s", chiaki_error_string(err));
+		return 1;
+	}
+
+	StreamContext ctx = { 0 };
+	ctx.log = log;
+	ctx.login_pin = arguments.login_pin;
+	int r = 1;
+
+	err = chiaki_mutex_init(&ctx.mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return 1;
+	err = chiaki_cond_init(&ctx.cond);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_mutex;
+
+	if(arguments.video)
+	{
+		ctx.video_file = stream_file_open(arguments.video);
+		if(!ctx.video_file)
+		{
+			CHIAKI_LOGE(log, "Failed to open %s", arguments.video);
+			goto error_files;
+		}
+	}
+	if(arguments.audio)
+	{
+		ctx.audio_file = stream_file_open(arguments.audio);
+		if(!ctx.audio_file)
+		{
+			CHIAKI_LOGE(log, "Failed to open %s", arguments.audio);
+			goto error_files;
+		}
+		cli_ogg_opus_init(&ctx.ogg, ctx.audio_file, (uint32_t)chiaki_time_now_monotonic_us());
+	}
+
+#if CHIAKI_LIB_ENABLE_FFMPEG_DECODER
+	if(arguments.decode)
+	{
+		ctx.decoder = malloc(sizeof(ChiakiFfmpegDecoder));
+		if(!ctx.decoder)
+			goto error_files;
+		err = chiaki_ffmpeg_decoder_init_warm(ctx.decoder, log,
+				arguments.ps5 ? connect_info.video_profile.codec : CHIAKI_CODEC_H264,
+				NULL, NULL, frame_available_cb, &ctx, true);
+		if(err != CHIAKI_ERR_SUCCESS)
+		{
+			CHIAKI_LOGE(log, "Failed to initialize the FFmpeg decoder: %s", chiaki_error_string(err));
+			free(ctx.decoder);
+			ctx.decoder = NULL;
+			goto error_files;
+		}
+		connect_info.video_warm_start = true;
+	}
+#endif
+
+	err = chiaki_session_init(&ctx.session, &connect_info, log);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(log, "Session init failed: %s", chiaki_error_string(err));
+		goto error_decoder;
+	}
+	chiaki_session_set_event_cb(&ctx.session, event_cb, &ctx);
+	chiaki_session_set_video_sample_cb(&ctx.session, video_sample_cb, &ctx);
+	ChiakiAudioSink audio_sink = { 0 };
+	audio_sink.user = &ctx;
+	audio_sink.header_cb = audio_header_cb;
+	audio_sink.frame_cb = audio_frame_cb;
+	chiaki_session_set_audio_sink(&ctx.session, &audio_sink);
+
+	signal(SIGINT, stop_signal_handler);
+	signal(SIGTERM, stop_signal_handler);
+#ifdef SIGPIPE
+	// a closed pipe is reported by fwrite instead
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	uint64_t start_us = chiaki_time_now_monotonic_us();
+	uint64_t duration_us = arguments.duration ? (uint64_t)(atof(arguments.duration) * 1000000) : 0;
+	err = chiaki_session_start(&ctx.session);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(log, "Session start failed: %s", chiaki_error_string(err));
+		goto error_session;
+	}
+
+	chiaki_mutex_lock(&ctx.mutex);
+	while(!ctx.quit)
+	{
+		// signals can't wake the cond, so check every now and then
+		chiaki_cond_timedwait(&ctx.cond, &ctx.mutex, 100);
+		if(ctx.quit)
+			break;
+		if(stop_requested || (duration_us && chiaki_time_now_monotonic_us() - start_us >= duration_us))
+		{
+			chiaki_mutex_unlock(&ctx.mutex);
+			chiaki_session_stop(&ctx.session);
+			chiaki_mutex_lock(&ctx.mutex);
+			break;
+		}
+	}
+	chiaki_mutex_unlock(&ctx.mutex);
+
+	chiaki_session_join(&ctx.session);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	CHIAKI_LOGI(log, "Received %llu video frames (%llu bytes) and %llu audio frames",
+			(unsigned long long)ctx.video_frames, (unsigned long long)ctx.video_bytes, (unsigned long long)ctx.audio_frames);
+#if CHIAKI_LIB_ENABLE_FFMPEG_DECODER
+	if(ctx.decoder)
+		CHIAKI_LOGI(log, "Decoded %llu frames", (unsigned long long)ctx.decoded_frames);
+#endif
+	r = (ctx.quit && chiaki_quit_reason_is_error(ctx.quit_reason)) || chiaki_atomic_load_u32(&ctx.write_failed) ? 1 : 0;
+
+error_session:
+	chiaki_session_fini(&ctx.session);
+error_decoder:
+#if CHIAKI_LIB_ENABLE_FFMPEG_DECODER
+	if(ctx.decoder)
+	{
+		chiaki_ffmpeg_decoder_fini(ctx.decoder);
+		free(ctx.decoder);
+	}
+#endif
+error_files:
+	stream_file_close(ctx.audio_file);
+	stream_file_close(ctx.video_file);
+	chiaki_cond_fini(&ctx.cond);
+error_mutex:
+	chiaki_mutex_fini(&ctx.mutex);
+	return r;
+}
@@ -4,29 +4,48 @@
 
 #include <chiaki/discovery.h>
 
+#include "fleet.h"
+
 #include <argp.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-static char doc[] = "Send a PS4 or PS5 wakeup packet.";
+static char doc[] = "Send a PS4 or PS5 wakeup packet."
+	"\v"
+	"--host may be given multiple times and combined with --file to wake up many consoles at once, "
+	"--registkey and --ps4/--ps5 apply to all of them unless a line of the file overrides them. "
+	"Every wakeup is followed by a discovery request and retransmitted until the console answered or the timeout passed.";
 
 #define ARG_KEY_HOST 'h'
+#define ARG_KEY_FILE 'f'
 #define ARG_KEY_REGISTKEY 'r'
 #define ARG_KEY_PS4 '4'
 #define ARG_KEY_PS5 '5'
+#define ARG_KEY_TIMEOUT 't'
+#define ARG_KEY_WAIT_READY 'w'
 
 static struct argp_option options[] = {
-	{ "host", ARG_KEY_HOST, "Host", 0, "Host to send wakeup packet to", 0 },
+	{ "host", ARG_KEY_HOST, "Host", 0, "Host to send wakeup packet to, may be repeated", 0 },
+	{ "file", ARG_KEY_FILE, "File", 0, "File with one \"host [registkey] [ps4|ps5]\" per line", 0 },
 	{ "registkey", ARG_KEY_REGISTKEY, "RegistKey", 0, "Remote Play registration key (plaintext)", 0 },
 	{ "ps4", ARG_KEY_PS4, NULL, 0, "PlayStation 4", 0 },
 	{ "ps5", ARG_KEY_PS5, NULL, 0, "PlayStation 5 (default)", 0 },
+	{ "timeout", ARG_KEY_TIMEOUT, "Timeout", 0, "Number of seconds to wait for the consoles to answer (default=2)", 0 },
+	{ "wait-ready", ARG_KEY_WAIT_READY, NULL, 0, "Wait until the consoles report ready instead of standby", 0 },
 	{ 0 }
 };
 
 typedef struct arguments
 {
-	const char *host;
+	const char **hosts;
+	size_t hosts_count;
+	const char **files;
+	size_t files_count;
 	const char *registkey;
+	const char *timeout;
 	bool ps5;
+	bool wait_ready;
 } Arguments;
 
 static int parse_opt(int key, char *arg, struct argp_state *state)
@@ -36,11 +55,20 @@ static int parse_opt(int key, char *arg, struct argp_state *state)
 	switch(key)
 	{
 		case ARG_KEY_HOST:
-			arguments->host = arg;
+			arguments->hosts[arguments->hosts_count++] = arg;
+			break;
+		case ARG_KEY_FILE:
+			arguments->files[arguments->files_count++] = arg;
 			break;
 		case ARG_KEY_REGISTKEY:
 			arguments->registkey = arg;
 			break;
+		case ARG_KEY_TIMEOUT:
+			arguments->timeout = arg;
+			break;
+		case ARG_KEY_WAIT_READY:
+			arguments->wait_ready = true;
+			break;
 		case ARGP_KEY_ARG:
 			argp_usage(state);
 			break;
@@ -59,31 +87,104 @@ static int parse_opt(int key, char *arg, struct argp_state *state)
 
 static struct argp argp = { options, parse_opt, 0, doc, 0, 0, 0 };
 
+static void wakeup_cb(ChiakiDiscoveryFleetHost *fleet_host, ChiakiDiscoveryHost *host, void *user)
+{
+	ChiakiLog *log = user;
+	CHIAKI_LOGI(log, "%s (%s) is %s", fleet_host->host,
+			host->host_name ? host->host_name : "unknown",
+			chiaki_discovery_host_state_string(host->state));
+}
+
 CHIAKI_EXPORT int chiaki_cli_cmd_wakeup(ChiakiLog *log, int argc, char *argv[])
 {
 	Arguments arguments = { 0 };
 	arguments.ps5 = true;
+	// every option takes at most one argv entry
+	arguments.hosts = calloc(argc, sizeof(const char *));
+	arguments.files = calloc(argc, sizeof(const char *));
+	CliFleet fleet;
+	cli_fleet_init(&fleet);
+	int r = 1;
+	if(!arguments.hosts || !arguments.files)
+		goto cleanup;
+
 	error_t argp_r = argp_parse(&argp, argc, argv, ARGP_IN_ORDER, NULL, &arguments);
 	if(argp_r != 0)
-		return 1;
+		goto cleanup;
 
-	if(!arguments.host)
+	if(!arguments.hosts_count && !arguments.files_count)
 	{
 		fprintf(stderr, "No host specified, see --help.\n");
-		return 1;
+		goto cleanup;
+	}
+
+	uint64_t credential = 0;
+	if(arguments.registkey)
+	{
+		if(strlen(arguments.registkey) > 8)
+		{
+			fprintf(stderr, "Given registkey is too long.\n");
+			goto cleanup;
+		}
+		if(!cli_fleet_parse_registkey(arguments.registkey, &credential))
+		{
+			fprintf(stderr, "Given registkey is invalid.\n");
+			goto cleanup;
+		}
 	}
-	if(!arguments.registkey)
+	else if(arguments.hosts_count)
 	{
 		fprintf(stderr, "No registration key specified, see --help.\n");
-		return 1;
+		goto cleanup;
+	}
+
+	for(size_t i=0; i<arguments.hosts_count; i++)
+	{
+		if(!cli_fleet_add(&fleet, arguments.hosts[i], arguments.ps5, credential))
+			goto cleanup;
+	}
+	for(size_t i=0; i<arguments.files_count; i++)
+	{
+		if(!cli_fleet_load_file(&fleet, arguments.files[i], arguments.ps5, credential, !arguments.registkey))
+			goto cleanup;
+	}
+
+	if(!fleet.hosts_count)
+	{
+		fprintf(stderr, "No host specified, see --help.\n");
+		goto cleanup;
 	}
-	if(strlen(arguments.registkey) > 8)
+
+	ChiakiDiscoveryFleetOptions options;
+	chiaki_discovery_fleet_options_default(&options);
+	options.cmd = CHIAKI_DISCOVERY_CMD_WAKEUP;
+	if(arguments.timeout)
+		options.timeout_ms = (uint64_t)(atof(arguments.timeout) * 1000);
+	options.wait_ready = arguments.wait_ready;
+	options.cb = wakeup_cb;
+	options.cb_user = log;
+
+	ChiakiErrorCode err = chiaki_discovery_fleet_run(log, fleet.hosts, fleet.hosts_count, &options);
+	if(err != CHIAKI_ERR_SUCCESS)
 	{
-		fprintf(stderr, "Given registkey is too long.\n");
-		return 1;
+		CHIAKI_LOGE(log, "Wakeup failed: %s", chiaki_error_string(err));
+		goto cleanup;
 	}
 
-	uint64_t credential = (uint64_t)strtoull(arguments.registkey, NULL, 16);
+	size_t responded;
+	if(fleet.hosts_count > 1)
+		responded = cli_fleet_print_summary(&fleet);
+	else
+	{
+		responded = fleet.hosts[0].state == CHIAKI_DISCOVERY_FLEET_STATE_RESPONDED ? 1 : 0;
+		if(!responded)
+			CHIAKI_LOGE(log, "%s did not answer the wakeup", fleet.hosts[0].host);
+	}
+	r = responded == fleet.hosts_count ? 0 : 1;
 
-	return chiaki_discovery_wakeup(log, NULL, arguments.host, credential, arguments.ps5);
+cleanup:
+	cli_fleet_fini(&fleet);
+	free(arguments.files);
+	free(arguments.hosts);
+	return r;
 }
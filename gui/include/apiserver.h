@@ -51,6 +51,8 @@ private:
     QJsonDocument handlePostDisconnect();
     QJsonDocument handlePostWakeup(const QJsonObject &body);
     QJsonDocument handleGetStreamStatus();
+    QJsonDocument handlePostStreamTrace();
+    QJsonDocument handlePostStreamReplay();
     
     // API Handlers - Settings
     QJsonDocument handleGetSettings();
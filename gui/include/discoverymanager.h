@@ -48,15 +48,13 @@ class DiscoveryManager : public QObject
 		ChiakiLog log;
 		QList<ChiakiDiscoveryService> services;
 		ChiakiDiscoveryService service;
-		ChiakiDiscoveryService service_ipv6;
 		bool service_active;
-		bool service_active_ipv6;
 		QList<DiscoveryHost> hosts;
 		Settings *settings = {};
 		QHash<QString, ManualService*> manual_services;
 
 	private slots:
-		void DiscoveryServiceHosts(QList<DiscoveryHost> hosts);
+		void DiscoveryServiceHostDelta(int delta, DiscoveryHost host);
 		void UpdateManualServices();
 
 	public:
@@ -16,6 +16,12 @@ class QmlSettings : public QObject
     Q_PROPERTY(int disconnectAction READ disconnectAction WRITE setDisconnectAction NOTIFY disconnectActionChanged)
     Q_PROPERTY(int suspendAction READ suspendAction WRITE setSuspendAction NOTIFY suspendActionChanged)
     Q_PROPERTY(bool logVerbose READ logVerbose WRITE setLogVerbose NOTIFY logVerboseChanged)
+    Q_PROPERTY(bool logAsync READ logAsync WRITE setLogAsync NOTIFY logAsyncChanged)
+    Q_PROPERTY(bool packetTrace READ packetTrace WRITE setPacketTrace NOTIFY packetTraceChanged)
+    Q_PROPERTY(bool recordStream READ recordStream WRITE setRecordStream NOTIFY recordStreamChanged)
+    Q_PROPERTY(int replayBufferSeconds READ replayBufferSeconds WRITE setReplayBufferSeconds NOTIFY replayBufferSecondsChanged)
+    Q_PROPERTY(bool threadRealtime READ threadRealtime WRITE setThreadRealtime NOTIFY threadRealtimeChanged)
+    Q_PROPERTY(bool threadLockMemory READ threadLockMemory WRITE setThreadLockMemory NOTIFY threadLockMemoryChanged)
     Q_PROPERTY(int rumbleHapticsIntensity READ rumbleHapticsIntensity WRITE setRumbleHapticsIntensity NOTIFY rumbleHapticsIntensityChanged)
 #ifdef CHIAKI_GUI_ENABLE_STEAMDECK_NATIVE
     Q_PROPERTY(bool steamDeckHaptics READ steamDeckHaptics WRITE setSteamDeckHaptics NOTIFY steamDeckHapticsChanged)
@@ -49,6 +55,7 @@ class QmlSettings : public QObject
     Q_PROPERTY(int codecLocalPS5 READ codecLocalPS5 WRITE setCodecLocalPS5 NOTIFY codecLocalPS5Changed)
     Q_PROPERTY(int codecRemotePS5 READ codecRemotePS5 WRITE setCodecRemotePS5 NOTIFY codecRemotePS5Changed)
     Q_PROPERTY(int audioBufferSize READ audioBufferSize WRITE setAudioBufferSize NOTIFY audioBufferSizeChanged)
+    Q_PROPERTY(int audioTargetLatency READ audioTargetLatency WRITE setAudioTargetLatency NOTIFY audioTargetLatencyChanged)
     Q_PROPERTY(int audioVolume READ audioVolume WRITE setAudioVolume NOTIFY audioVolumeChanged)
     Q_PROPERTY(QString audioInDevice READ audioInDevice WRITE setAudioInDevice NOTIFY audioInDeviceChanged)
     Q_PROPERTY(QString audioOutDevice READ audioOutDevice WRITE setAudioOutDevice NOTIFY audioOutDeviceChanged)
@@ -59,6 +66,10 @@ class QmlSettings : public QObject
     Q_PROPERTY(int videoPreset READ videoPreset WRITE setVideoPreset NOTIFY videoPresetChanged)
     Q_PROPERTY(float sZoomFactor READ sZoomFactor WRITE setSZoomFactor NOTIFY sZoomFactorChanged)
     Q_PROPERTY(int packetLossMax READ packetLossMax WRITE setPacketLossMax NOTIFY packetLossMaxChanged)
+    Q_PROPERTY(int congestionControlPolicy READ congestionControlPolicy WRITE setCongestionControlPolicy NOTIFY congestionControlPolicyChanged)
+    Q_PROPERTY(bool videoWarmStartEnabled READ videoWarmStartEnabled WRITE setVideoWarmStartEnabled NOTIFY videoWarmStartEnabledChanged)
+    Q_PROPERTY(bool sessionResumeEnabled READ sessionResumeEnabled WRITE setSessionResumeEnabled NOTIFY sessionResumeEnabledChanged)
+    Q_PROPERTY(bool networkProfileCacheEnabled READ networkProfileCacheEnabled WRITE setNetworkProfileCacheEnabled NOTIFY networkProfileCacheEnabledChanged)
     Q_PROPERTY(QString autoConnectMac READ autoConnectMac WRITE setAutoConnectMac NOTIFY autoConnectMacChanged)
     Q_PROPERTY(bool allowJoystickBackgroundEvents READ allowJoystickBackgroundEvents WRITE setAllowJoystickBackgroundEvents NOTIFY allowJoystickBackgroundEventsChanged)
     Q_PROPERTY(QString logDirectory READ logDirectory CONSTANT)
@@ -198,6 +209,24 @@ public:
     bool logVerbose() const;
     void setLogVerbose(bool verbose);
 
+    bool logAsync() const;
+    void setLogAsync(bool enabled);
+
+    bool packetTrace() const;
+    void setPacketTrace(bool enabled);
+
+    bool recordStream() const;
+    void setRecordStream(bool enabled);
+
+    int replayBufferSeconds() const;
+    void setReplayBufferSeconds(int seconds);
+
+    bool threadRealtime() const;
+    void setThreadRealtime(bool enabled);
+
+    bool threadLockMemory() const;
+    void setThreadLockMemory(bool enabled);
+
     int rumbleHapticsIntensity() const;
     void setRumbleHapticsIntensity(int intensity);
 
@@ -269,6 +298,9 @@ public:
     int audioBufferSize() const;
     void setAudioBufferSize(int size);
 
+    int audioTargetLatency() const;
+    void setAudioTargetLatency(int ms);
+
     int audioVolume() const;
     void setAudioVolume(int volume);
 
@@ -296,6 +328,18 @@ public:
     int packetLossMax() const;
     void setPacketLossMax(int packet_loss_max);
 
+    int congestionControlPolicy() const;
+    void setCongestionControlPolicy(int policy);
+
+    bool videoWarmStartEnabled() const;
+    void setVideoWarmStartEnabled(bool enabled);
+
+    bool sessionResumeEnabled() const;
+    void setSessionResumeEnabled(bool enabled);
+
+    bool networkProfileCacheEnabled() const;
+    void setNetworkProfileCacheEnabled(bool enabled);
+
     int videoPreset() const;
     void setVideoPreset(int preset);
 
@@ -578,6 +622,12 @@ signals:
     void disconnectActionChanged();
     void suspendActionChanged();
     void logVerboseChanged();
+    void logAsyncChanged();
+    void packetTraceChanged();
+    void recordStreamChanged();
+    void replayBufferSecondsChanged();
+    void threadRealtimeChanged();
+    void threadLockMemoryChanged();
     void rumbleHapticsIntensityChanged();
     void buttonsByPositionChanged();
     void allowJoystickBackgroundEventsChanged();
@@ -616,6 +666,7 @@ signals:
     void displayTargetPrimChanged();
     void displayTargetTrcChanged();
     void audioBufferSizeChanged();
+    void audioTargetLatencyChanged();
     void audioVolumeChanged();
     void audioOutDeviceChanged();
     void audioInDeviceChanged();
@@ -648,6 +699,10 @@ signals:
     void streamMenuShortcut4Changed();
     void controllerMappingChanged();
     void packetLossMaxChanged();
+    void congestionControlPolicyChanged();
+    void videoWarmStartEnabledChanged();
+    void sessionResumeEnabledChanged();
+    void networkProfileCacheEnabledChanged();
     void currentProfileChanged();
     void profilesChanged();
     void placeboUpscalerChanged();
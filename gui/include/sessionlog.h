@@ -4,10 +4,12 @@
 #define CHIAKI_SESSIONLOG_H
 
 #include <chiaki/log.h>
+#include <chiaki/logasync.h>
 
 #include <QString>
 #include <QDir>
 #include <QMutex>
+#include <QDateTime>
 
 class QFile;
 class StreamSession;
@@ -19,16 +21,21 @@ class SessionLog
 	private:
 		StreamSession *session;
 		ChiakiLog log;
+		ChiakiLogAsync log_async;
+		bool async;
 		QFile *file;
 		QMutex file_mutex;
 
-		void Log(ChiakiLogLevel level, const char *msg);
+		void Log(ChiakiLogLevel level, const char *msg, const QDateTime &time);
 
 	public:
-		SessionLog(StreamSession *session, uint32_t level_mask, const QString &filename);
+		/**
+		 * @param async format and write messages on a background thread, see ChiakiLogAsync
+		 */
+		SessionLog(StreamSession *session, uint32_t level_mask, const QString &filename, bool async);
 		~SessionLog();
 
-		ChiakiLog *GetChiakiLog()	{ return &log; }
+		ChiakiLog *GetChiakiLog()	{ return async ? chiaki_log_async_get_log(&log_async) : &log; }
 };
 
 QString GetLogBaseDir();
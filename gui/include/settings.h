@@ -239,6 +239,43 @@ class Settings : public QObject
 		void SetLogVerbose(bool enabled)		{ settings.setValue("settings/log_verbose", enabled); }
 		uint32_t GetLogLevelMask();
 
+		/**
+		 * Write the session log from a background thread instead of the threads that log
+		 */
+		bool GetLogAsync() const 				{ return settings.value("settings/log_async", true).toBool(); }
+		void SetLogAsync(bool enabled)			{ settings.setValue("settings/log_async", enabled); }
+
+		/**
+		 * Keep a binary trace of the last received packets, written next to the session log on quit
+		 */
+		bool GetPacketTrace() const 			{ return settings.value("settings/packet_trace", false).toBool(); }
+		void SetPacketTrace(bool enabled)		{ settings.setValue("settings/packet_trace", enabled); }
+
+		/**
+		 * Remux every stream into a file in the movies folder, without re-encoding
+		 */
+		bool GetRecordStream() const 			{ return settings.value("settings/record_stream", false).toBool(); }
+		void SetRecordStream(bool enabled)		{ settings.setValue("settings/record_stream", enabled); }
+
+		/**
+		 * Keep the last seconds of every stream in memory to save them on demand, 0 to disable
+		 */
+		unsigned int GetReplayBufferSeconds() const			{ return settings.value("settings/replay_buffer_seconds", 0).toUInt(); }
+		void SetReplayBufferSeconds(unsigned int seconds)	{ settings.setValue("settings/replay_buffer_seconds", seconds); }
+		unsigned int GetReplayBufferMegabytes() const			{ return settings.value("settings/replay_buffer_megabytes", 256).toUInt(); }
+		void SetReplayBufferMegabytes(unsigned int megabytes)	{ settings.setValue("settings/replay_buffer_megabytes", megabytes); }
+
+		/**
+		 * Cpu list like "2-3,8" the streaming threads of role are pinned to, empty for no pinning
+		 */
+		QString GetThreadCpus(ChiakiThreadRole role) const;
+		void SetThreadCpus(ChiakiThreadRole role, const QString &cpus);
+		ChiakiThreadPriority GetThreadPriority(ChiakiThreadRole role) const;
+		void SetThreadPriority(ChiakiThreadRole role, ChiakiThreadPriority priority);
+		bool GetThreadLockMemory() const		{ return settings.value("settings/thread_lock_memory", false).toBool(); }
+		void SetThreadLockMemory(bool enabled)	{ settings.setValue("settings/thread_lock_memory", enabled); }
+		ChiakiThreadPlacementConfig GetThreadPlacement() const;
+
 		bool GetHideCursor() const				{ return settings.value("settings/hide_cursor", true).toBool(); }
 		void SetHideCursor(bool enabled)		{ settings.setValue("settings/hide_cursor", enabled); }
 
@@ -357,6 +394,37 @@ class Settings : public QObject
 		float GetPacketLossMax() const;
 		void SetPacketLossMax(float factor);
 
+		ChiakiCongestionControlPolicy GetCongestionControlPolicy() const;
+		void SetCongestionControlPolicy(ChiakiCongestionControlPolicy policy);
+
+		bool GetVideoWarmStartEnabled() const;
+		void SetVideoWarmStartEnabled(bool enabled);
+
+		bool GetSessionResumeEnabled() const;
+		void SetSessionResumeEnabled(bool enabled);
+
+		bool GetNetworkProfileCacheEnabled() const;
+		/**
+		 * Disabling also forgets all cached network profiles
+		 */
+		void SetNetworkProfileCacheEnabled(bool enabled);
+
+		/**
+		 * Cached senkusha results, see ChiakiNetworkProfile
+		 */
+		QMap<QString, ChiakiNetworkProfile> GetNetworkProfiles();
+		/**
+		 * @param profile nullptr to remove the profile for key
+		 */
+		void SetNetworkProfile(const QString &key, const ChiakiNetworkProfile *profile);
+
+		/**
+		 * Winner of the last holepunch candidate race per console
+		 * @return false if none is stored for duid
+		 */
+		bool GetHolepunchCandidateHint(const QString &duid, ChiakiHolepunchCandidateHint *hint);
+		void SetHolepunchCandidateHint(const QString &duid, const ChiakiHolepunchCandidateHint &hint);
+
 		RegisteredHost GetAutoConnectHost() const;
 		void SetAutoConnectHost(const QByteArray &mac);
 
@@ -375,6 +443,13 @@ class Settings : public QObject
 		 */
 		unsigned int GetAudioBufferSize() const;
 		void SetAudioBufferSize(unsigned int size);
+
+		/**
+		 * Audio decoded ahead of the output device.
+		 * @return 0 if set to "automatic", i.e. one audio buffer
+		 */
+		unsigned int GetAudioTargetLatencyMs() const;
+		void SetAudioTargetLatencyMs(unsigned int ms);
 		
 		QString GetAudioOutDevice() const;
 		void SetAudioOutDevice(QString device_name);
@@ -6,7 +6,10 @@
 #include <chiaki/session.h>
 #include <chiaki/opusdecoder.h>
 #include <chiaki/opusencoder.h>
+#include <chiaki/audioring.h>
 #include <chiaki/ffmpegdecoder.h>
+#include <chiaki/recorder.h>
+#include <chiaki/replay.h>
 
 #if CHIAKI_LIB_ENABLE_PI_DECODER
 #include <chiaki/pidecoder.h>
@@ -38,6 +41,13 @@
 #include <QTimer>
 #include <QQueue>
 #include <QElapsedTimer>
+#include <QFutureSynchronizer>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
 #if CHIAKI_GUI_ENABLE_SPEEX
 #include <QQueue>
 #include <speex/speex_echo.h>
@@ -68,10 +78,18 @@ struct StreamSessionConnectInfo
 	Decoder decoder;
 	QString hw_decoder;
 	AVBufferRef *hw_device_ctx;
+	bool video_warm_start;
+	bool session_resume;
 	QString audio_out_device;
 	QString audio_in_device;
 	uint32_t log_level_mask;
 	QString log_file;
+	bool log_async;
+	size_t trace_events;
+	QString record_file; // empty if recording is disabled
+	unsigned int replay_seconds; // 0 if the replay buffer is disabled
+	size_t replay_bytes;
+	ChiakiThreadPlacementConfig thread_placement;
 	ChiakiTarget target;
 	QString host;
 	QString nickname;
@@ -80,7 +98,11 @@ struct StreamSessionConnectInfo
 	QString initial_login_pin;
 	ChiakiConnectVideoProfile video_profile;
 	double packet_loss_max;
+	ChiakiCongestionControlPolicy congestion_control_policy;
+	bool network_profile_cache_enabled;
+	QMap<QString, ChiakiNetworkProfile> network_profiles;
 	unsigned int audio_buffer_size;
+	unsigned int audio_target_latency_ms;
 	int audio_volume;
 	bool fullscreen;
 	bool zoom;
@@ -129,13 +151,35 @@ struct StreamSessionConnectInfo
 			bool stretch);
 };
 
-struct MicBuf
+struct AudioOutStats
+{
+	double fill_ms; // buffered ahead of the device at its last callback
+	double fill_min_ms; // lowest fill since the last call to GetAudioOutStats()
+	double target_ms;
+	uint64_t underrun_frames; // silence inserted because nothing was buffered
+	uint64_t overflow_frames; // decoded audio dropped because the buffer was full
+};
+
+#if CHIAKI_GUI_ENABLE_SPEEX
+struct AecStats
 {
-	int16_t *buf;
-	uint32_t size_bytes;
-	uint32_t current_byte;
+	uint64_t frames; // mic frames processed
+	uint64_t frames_without_echo; // processed without a matching echo reference
+	uint64_t echo_frames_skipped; // echo references that did not match any mic frame
+	double process_avg_us; // echo cancellation and preprocessing per frame
+	double process_max_us;
 };
 
+// echo reference frames buffered between the audio output and the mic thread, must be a power of 2
+#define ECHO_RING_FRAMES 32
+
+struct EchoFrame
+{
+	uint64_t play_us; // monotonic time when the first sample is played out
+	std::vector<int16_t> samples; // mono, preallocated
+};
+#endif
+
 class StreamSession : public QObject
 {
 	friend class StreamSessionPrivate;
@@ -143,6 +187,7 @@ class StreamSession : public QObject
 	Q_OBJECT
 	Q_PROPERTY(QString host READ GetHost CONSTANT)
 	Q_PROPERTY(bool connected READ GetConnected NOTIFY ConnectedChanged)
+	Q_PROPERTY(bool resuming READ GetResuming NOTIFY ResumingChanged)
 	Q_PROPERTY(double measuredBitrate READ GetMeasuredBitrate NOTIFY MeasuredBitrateChanged)
 	Q_PROPERTY(double averagePacketLoss READ GetAveragePacketLoss NOTIFY AveragePacketLossChanged)
 	Q_PROPERTY(bool muted READ GetMuted WRITE SetMuted NOTIFY MutedChanged)
@@ -151,10 +196,13 @@ class StreamSession : public QObject
 	private:
 		SessionLog log;
 		ChiakiSession session;
+		QString trace_file_base; // empty if tracing is disabled
+		unsigned int trace_dumps;
+		bool thread_placement_logged;
 		ChiakiOpusDecoder opus_decoder;
 		ChiakiOpusEncoder opus_encoder;
 		bool connected;
-		bool muted;
+		std::atomic<bool> muted; // also read by mic_thread
 		bool mic_connected;
 #ifdef Q_OS_MACOS
 		bool mic_authorization;
@@ -162,11 +210,16 @@ class StreamSession : public QObject
 		bool allow_unmute;
 		int input_block;
 		QString host;
-		int audio_volume;
+		std::atomic<int> audio_volume;
 		double measured_bitrate = 0;
 		double average_packet_loss = 0;
-		QList<double> packet_loss_history;
 		bool cant_display = false;
+		ChiakiSessionTimeline startup_timeline = {};
+		bool has_startup_timeline = false;
+		bool resuming = false;
+		Settings *settings;
+		// snapshot from the start of the session, only read by the session thread afterwards
+		QMap<QString, ChiakiNetworkProfile> network_profiles;
 		int haptics_handheld;
 		float rumble_multiplier;
 		int ps5_rumble_intensity;
@@ -230,6 +283,15 @@ class StreamSession : public QObject
 
 		ChiakiFfmpegDecoder *ffmpeg_decoder;
 		void TriggerFfmpegFrameAvailable();
+		ChiakiRecorder *recorder;
+		ChiakiReplay *replay;
+		ChiakiCodec record_codec;
+		unsigned int record_fps;
+		QFutureSynchronizer<void> replay_saves;
+		void PushRecordVideoHeader(uint8_t *buf, size_t buf_size, unsigned int width, unsigned int height);
+		void PushRecordVideoFrame(uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index, bool keyframe);
+		void PushRecordAudioHeader(ChiakiAudioHeader *header);
+		void PushRecordAudioFrame(uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index);
 #if CHIAKI_LIB_ENABLE_PI_DECODER
 		ChiakiPiDecoder *pi_decoder;
 #endif
@@ -239,24 +301,71 @@ class StreamSession : public QObject
 		SDL_AudioDeviceID audio_out;
 		SDL_AudioDeviceID audio_in;
 		size_t audio_out_sample_size;
-		bool audio_out_drain_queue;
+		unsigned int audio_out_rate;
+		ChiakiAudioRing audio_out_ring;
+		bool audio_out_ring_initialized;
+		size_t audio_out_target_frames;
+		std::atomic<size_t> audio_out_fill;
+		std::atomic<size_t> audio_out_fill_min;
 		size_t haptics_buffer_size;
 		unsigned int audio_buffer_size;
+		unsigned int audio_target_latency_ms;
 		ChiakiHolepunchSession holepunch_session;
+		uint64_t audio_out_device_latency_us;
+
+		// microphone, SDL captures into mic_ring and mic_thread processes and encodes it
+		ChiakiAudioRing mic_ring;
+		bool mic_ring_initialized;
+		unsigned int mic_rate;
+		std::atomic<uint64_t> mic_capture_us; // time of the last capture callback
+		std::thread mic_thread;
+		std::mutex mic_mutex;
+		std::condition_variable mic_cond;
+		bool mic_thread_stop;
+		bool mic_drain; // set on mute so mic_thread drops what was captured before
+		std::vector<int16_t> mic_frame;
 #if CHIAKI_GUI_ENABLE_SPEEX
 		SpeexEchoState *echo_state;
 		SpeexPreprocessState *preprocess_state;
 		bool speech_processing_enabled;
-		uint8_t *echo_resampler_buf, *mic_resampler_buf;
-		QQueue<int16_t *> echo_to_cancel;
+		SDL_AudioCVT mic_cvt; // processed mono to stereo for the encoder
+		std::vector<uint8_t> mic_cvt_buf;
+		std::vector<int16_t> aec_frame;
+		std::vector<int16_t> aec_echo_frame;
+
+		// echo reference, produced by the audio output callback and consumed by mic_thread
+		EchoFrame echo_frames[ECHO_RING_FRAMES];
+		std::atomic<uint32_t> echo_write;
+		std::atomic<uint32_t> echo_read;
+		std::atomic<bool> echo_capture;
+		SDL_AudioCVT echo_cvt; // output channels to mono
+		std::vector<int16_t> echo_accum;
+		size_t echo_accum_frames;
+		uint64_t echo_accum_play_us;
+
+		std::atomic<uint64_t> aec_frames;
+		std::atomic<uint64_t> aec_frames_without_echo;
+		std::atomic<uint64_t> aec_echo_skipped;
+		std::atomic<uint64_t> aec_process_us_total;
+		std::atomic<uint64_t> aec_process_us_max;
 #endif
 		SDL_AudioDeviceID haptics_output;
 		uint8_t *haptics_resampler_buf;
-		MicBuf mic_buf;
 		QMap<Qt::Key, int> key_map;
 		QElapsedTimer connect_timer;
 
 		void PushAudioFrame(int16_t *buf, size_t samples_count);
+		void PullAudio(uint8_t *stream, size_t len);
+		size_t GetQueuedAudioSamples();
+		void PushMic(const uint8_t *stream, size_t len);
+		void MicThreadFunc();
+		void LogThreadPlacement();
+		void ProcessMicFrame();
+		void StopMic();
+#if CHIAKI_GUI_ENABLE_SPEEX
+		void PushEchoReference(const int16_t *buf, size_t frames, uint64_t play_us);
+		bool PopEchoReference(uint64_t capture_us);
+#endif
 		void PushHapticsFrame(uint8_t *buf, size_t buf_size);
 		void CantDisplayMessage(bool cant_display);
 		ChiakiErrorCode InitiatePsnConnection(QString psn_token);
@@ -271,6 +380,8 @@ class StreamSession : public QObject
 #endif
 		void AdjustAdaptiveTriggerPacket(uint8_t *buf, uint8_t type);
 		void WaitHaptics();
+		bool LoadNetworkProfile(const char *key, ChiakiNetworkProfile *profile);
+		void StoreNetworkProfile(const char *key, const ChiakiNetworkProfile *profile);
 
 	private slots:
 		void InitAudio(unsigned int channels, unsigned int rate);
@@ -301,12 +412,35 @@ class StreamSession : public QObject
 		void GoHome();
 		QString GetHost() { return host; }
 		bool GetConnected() { return connected; }
+		bool GetResuming() { return resuming; }
 		double GetMeasuredBitrate()	{ return measured_bitrate; }
 		double GetAveragePacketLoss()	{ return average_packet_loss; }
 		bool GetMuted()	{ return muted; }
 		void SetMuted(bool enable)	{ if (enable != muted) ToggleMute(); }
 		void SetAudioVolume(int volume) { audio_volume = volume; }
 		bool GetCantDisplay()	{ return cant_display; }
+		AudioOutStats GetAudioOutStats();
+		ChiakiCongestionControlStats GetCongestionControlStats();
+		ChiakiPacketStats *GetPacketStats()	{ return &session.stream_connection.packet_stats; }
+		/**
+		 * @return nullptr until the first frame was received
+		 */
+		const ChiakiSessionTimeline *GetStartupTimeline()	{ return has_startup_timeline ? &startup_timeline : nullptr; }
+		ChiakiSessionResumeStats GetResumeStats();
+		/**
+		 * Write the packet trace next to the session log
+		 * @return path of the written file, empty if tracing is disabled or writing failed
+		 */
+		QString DumpTrace();
+		/**
+		 * Save the replay buffer to a new file in the movies folder, written in the background
+		 * @return path of the file, empty if the replay buffer is disabled or has no keyframe yet
+		 */
+		QString SaveReplay();
+#if CHIAKI_GUI_ENABLE_SPEEX
+		bool GetSpeechProcessingEnabled()	{ return speech_processing_enabled; }
+		AecStats GetAecStats();
+#endif
 		ChiakiErrorCode ConnectPsnConnection(QString duid, bool ps5);
 		void CancelPsnConnection(bool stop_thread);
 
@@ -322,7 +456,6 @@ class StreamSession : public QObject
 		void HandleMouseReleaseEvent(QMouseEvent *event);
 		void HandleMousePressEvent(QMouseEvent *event);
 		void HandleMouseMoveEvent(QMouseEvent *event, qreal width, qreal height);
-		void ReadMic(const QByteArray &micdata);
 
 		void BlockInput(bool block) { input_block = block ? 1 : 2; SendFeedbackState(); }
 
@@ -339,6 +472,7 @@ class StreamSession : public QObject
 		void AutoRegistSucceeded(const ChiakiRegisteredHost &host);
 		void NicknameReceived(QString nickname);
 		void ConnectedChanged();
+		void ResumingChanged();
 		void MeasuredBitrateChanged();
 		void AveragePacketLossChanged();
 		void MutedChanged();
@@ -9,6 +9,7 @@
 #include "streamsession.h"
 
 #include <chiaki/session.h>
+#include <chiaki/time.h>
 
 #include <QJsonDocument>
 #include <QJsonObject>
@@ -159,6 +160,8 @@ void ApiServer::handleRequest(QTcpSocket *socket, const QString &method, const Q
             QJsonObject({{"method", "POST"}, {"path", "/disconnect"}, {"description", "Disconnect from current session"}}),
             QJsonObject({{"method", "POST"}, {"path", "/wakeup"}, {"description", "Wake up a console"}}),
             QJsonObject({{"method", "GET"}, {"path", "/stream/status"}, {"description", "Get current stream status"}}),
+            QJsonObject({{"method", "POST"}, {"path", "/stream/trace"}, {"description", "Write the packet trace of the current stream to a file"}}),
+            QJsonObject({{"method", "POST"}, {"path", "/stream/replay"}, {"description", "Save the replay buffer of the current stream to a file"}}),
             QJsonObject({{"method", "GET"}, {"path", "/settings"}, {"description", "Get all settings"}}),
             QJsonObject({{"method", "PUT"}, {"path", "/settings"}, {"description", "Update settings"}}),
             QJsonObject({{"method", "GET"}, {"path", "/settings/video"}, {"description", "Get video settings"}}),
@@ -187,6 +190,12 @@ void ApiServer::handleRequest(QTcpSocket *socket, const QString &method, const Q
     else if (method == "GET" && path == "/stream/status") {
         sendJsonResponse(socket, 200, handleGetStreamStatus());
     }
+    else if (method == "POST" && path == "/stream/trace") {
+        sendJsonResponse(socket, 200, handlePostStreamTrace());
+    }
+    else if (method == "POST" && path == "/stream/replay") {
+        sendJsonResponse(socket, 200, handlePostStreamReplay());
+    }
     // Settings
     else if (method == "GET" && path == "/settings") {
         sendJsonResponse(socket, 200, handleGetSettings());
@@ -454,6 +463,65 @@ QJsonDocument ApiServer::handlePostWakeup(const QJsonObject &body)
     return QJsonDocument(response);
 }
 
+QJsonDocument ApiServer::handlePostStreamTrace()
+{
+    QJsonObject response;
+
+    StreamSession *session = nullptr;
+    if (headlessBackend) {
+        session = headlessBackend->session();
+    } else if (backend) {
+        session = backend->qmlSession();
+    }
+
+    if (!session) {
+        response["success"] = false;
+        response["error"] = "No active stream";
+        return QJsonDocument(response);
+    }
+
+    QString path = session->DumpTrace();
+    if (path.isEmpty()) {
+        response["success"] = false;
+        response["error"] = "Packet trace is disabled or could not be written";
+        return QJsonDocument(response);
+    }
+
+    response["success"] = true;
+    response["file"] = path;
+    return QJsonDocument(response);
+}
+
+QJsonDocument ApiServer::handlePostStreamReplay()
+{
+    QJsonObject response;
+
+    StreamSession *session = nullptr;
+    if (headlessBackend) {
+        session = headlessBackend->session();
+    } else if (backend) {
+        session = backend->qmlSession();
+    }
+
+    if (!session) {
+        response["success"] = false;
+        response["error"] = "No active stream";
+        return QJsonDocument(response);
+    }
+
+    // the file is written in the background, streaming goes on meanwhile
+    QString path = session->SaveReplay();
+    if (path.isEmpty()) {
+        response["success"] = false;
+        response["error"] = "Replay buffer is disabled or has no keyframe yet";
+        return QJsonDocument(response);
+    }
+
+    response["success"] = true;
+    response["file"] = path;
+    return QJsonDocument(response);
+}
+
 QJsonDocument ApiServer::handleGetStreamStatus()
 {
     QJsonObject response;
@@ -472,6 +540,104 @@ QJsonDocument ApiServer::handleGetStreamStatus()
         response["bitrate"] = session->GetMeasuredBitrate();
         response["packetLoss"] = session->GetAveragePacketLoss();
         response["muted"] = session->GetMuted();
+        AudioOutStats audio_stats = session->GetAudioOutStats();
+        QJsonObject audio;
+        audio["fillMs"] = audio_stats.fill_ms;
+        audio["fillMinMs"] = audio_stats.fill_min_ms;
+        audio["targetMs"] = audio_stats.target_ms;
+        audio["underrunFrames"] = (qint64)audio_stats.underrun_frames;
+        audio["overflowFrames"] = (qint64)audio_stats.overflow_frames;
+        response["audio"] = audio;
+#if CHIAKI_GUI_ENABLE_SPEEX
+        if (session->GetSpeechProcessingEnabled()) {
+            AecStats aec_stats = session->GetAecStats();
+            QJsonObject aec;
+            aec["frames"] = (qint64)aec_stats.frames;
+            aec["framesWithoutEcho"] = (qint64)aec_stats.frames_without_echo;
+            aec["echoFramesSkipped"] = (qint64)aec_stats.echo_frames_skipped;
+            aec["processAvgUs"] = aec_stats.process_avg_us;
+            aec["processMaxUs"] = aec_stats.process_max_us;
+            response["aec"] = aec;
+        }
+#endif
+        ChiakiCongestionControlStats congestion_stats = session->GetCongestionControlStats();
+        QJsonObject congestion;
+        congestion["policy"] = chiaki_congestion_control_policy_string(congestion_stats.policy);
+        congestion["overuse"] = congestion_stats.signal == CHIAKI_CONGESTION_SIGNAL_OVERUSE;
+        congestion["packetLossReported"] = congestion_stats.packet_loss_reported;
+        congestion["queueDelayMs"] = congestion_stats.queue_delay_us / 1000.0;
+        congestion["delayTrend"] = congestion_stats.delay_trend;
+        congestion["overuseReports"] = (qint64)congestion_stats.overuse_reports;
+        response["congestion"] = congestion;
+        ChiakiThreadPlacementReport placement_report;
+        chiaki_thread_placement_get_report(&placement_report);
+        QJsonObject threads;
+        for (int i = 0; i < CHIAKI_THREAD_ROLE_COUNT; i++) {
+            const ChiakiThreadPlacementEffective &effective = placement_report.roles[i];
+            char cpus[0x100];
+            chiaki_thread_format_cpu_list(effective.cpu_mask, cpus, sizeof(cpus));
+            threads[chiaki_thread_role_string(static_cast<ChiakiThreadRole>(i))] = QJsonObject({
+                {"threads", (qint64)effective.threads},
+                {"cpus", QString(cpus)},
+                {"priority", chiaki_thread_priority_string(effective.priority)},
+                {"priorityValue", effective.priority_value},
+                {"error", effective.err == CHIAKI_ERR_SUCCESS ? QJsonValue() : QJsonValue(chiaki_error_string(effective.err))}
+            });
+        }
+        threads["memoryLocked"] = placement_report.memory_locked;
+        response["threads"] = threads;
+        ChiakiPacketStats *packet_stats = session->GetPacketStats();
+        uint64_t now_ms = chiaki_time_now_monotonic_ms();
+        QJsonObject packets;
+        const std::pair<ChiakiPacketStatsWindow, const char *> windows[] = {
+            { CHIAKI_PACKET_STATS_WINDOW_1S, "1s" },
+            { CHIAKI_PACKET_STATS_WINDOW_10S, "10s" },
+            { CHIAKI_PACKET_STATS_WINDOW_SESSION, "session" }
+        };
+        for (const auto &window : windows) {
+            uint64_t received, lost;
+            chiaki_packet_stats_get_window(packet_stats, window.first, now_ms, &received, &lost);
+            packets[window.second] = QJsonObject({{"received", (qint64)received}, {"lost", (qint64)lost}});
+        }
+        uint64_t histogram[CHIAKI_PACKET_STATS_BURST_BUCKETS_COUNT];
+        chiaki_packet_stats_get_burst_histogram(packet_stats, histogram);
+        QJsonArray bursts;
+        for (uint64_t count : histogram)
+            bursts.append((qint64)count);
+        packets["lossBursts"] = bursts;
+        response["packets"] = packets;
+        ChiakiSessionResumeStats resume_stats = session->GetResumeStats();
+        QJsonObject resume;
+        resume["resuming"] = resume_stats.resuming;
+        resume["attempts"] = (qint64)resume_stats.attempts;
+        resume["resumed"] = (qint64)resume_stats.resumed;
+        resume["failed"] = (qint64)resume_stats.failed;
+        resume["lastDowntimeMs"] = resume_stats.downtime_last_us / 1000.0;
+        resume["totalDowntimeMs"] = resume_stats.downtime_total_us / 1000.0;
+        response["resume"] = resume;
+        const ChiakiSessionTimeline *timeline = session->GetStartupTimeline();
+        if (timeline) {
+            QJsonObject startup;
+            startup["totalMs"] = timeline->total_us / 1000.0;
+            QJsonObject phases;
+            for (int i = 0; i < CHIAKI_SESSION_PHASE_COUNT; i++) {
+                const ChiakiSessionPhaseTime &time = timeline->phases[i];
+                if (!time.done)
+                    continue;
+                QJsonObject phase;
+                phase["startMs"] = time.start_us / 1000.0;
+                phase["durationMs"] = (time.end_us - time.start_us) / 1000.0;
+                phases[chiaki_session_phase_string(static_cast<ChiakiSessionPhase>(i))] = phase;
+            }
+            startup["phases"] = phases;
+            if (ChiakiFfmpegDecoder *decoder = session->GetFfmpegDecoder()) {
+                startup["warmStart"] = decoder->warm_start;
+                uint64_t first_frame_us = chiaki_ffmpeg_decoder_get_first_frame_latency_us(decoder);
+                if (first_frame_us)
+                    startup["firstDecodedFrameMs"] = first_frame_us / 1000.0;
+            }
+            response["startup"] = startup;
+        }
     } else {
         response["streaming"] = false;
         response["connected"] = false;
@@ -532,6 +698,7 @@ QJsonDocument ApiServer::handleGetSettings()
     
     general["audioVolume"] = settings->GetAudioVolume();
     general["audioBufferSize"] = (int)settings->GetAudioBufferSizeRaw();
+    general["audioTargetLatency"] = (int)settings->GetAudioTargetLatencyMs();
     general["audioVideoDisabled"] = (int)settings->GetAudioVideoDisabled();
     
     // Network Settings
@@ -575,9 +742,30 @@ QJsonDocument ApiServer::handleGetSettings()
     general["customResolutionHeight"] = (int)settings->GetCustomResolutionHeight();
     general["zoomFactor"] = settings->GetZoomFactor();
     general["packetLossMax"] = settings->GetPacketLossMax();
+    general["congestionControlPolicy"] = (int)settings->GetCongestionControlPolicy();
+    general["videoWarmStartEnabled"] = settings->GetVideoWarmStartEnabled();
+    general["sessionResumeEnabled"] = settings->GetSessionResumeEnabled();
+    general["networkProfileCacheEnabled"] = settings->GetNetworkProfileCacheEnabled();
     
     // Log Settings
     general["logVerbose"] = settings->GetLogVerbose();
+    general["logAsync"] = settings->GetLogAsync();
+    general["packetTrace"] = settings->GetPacketTrace();
+    general["recordStream"] = settings->GetRecordStream();
+    general["replayBufferSeconds"] = (int)settings->GetReplayBufferSeconds();
+    general["replayBufferMegabytes"] = (int)settings->GetReplayBufferMegabytes();
+
+    // Thread Placement
+    QJsonObject threadPlacement;
+    for (int i = 0; i < CHIAKI_THREAD_ROLE_COUNT; i++) {
+        ChiakiThreadRole role = static_cast<ChiakiThreadRole>(i);
+        threadPlacement[chiaki_thread_role_string(role)] = QJsonObject({
+            {"cpus", settings->GetThreadCpus(role)},
+            {"priority", chiaki_thread_priority_string(settings->GetThreadPriority(role))}
+        });
+    }
+    general["threadPlacement"] = threadPlacement;
+    general["threadLockMemory"] = settings->GetThreadLockMemory();
     
     response["general"] = general;
     
@@ -677,6 +865,7 @@ QJsonDocument ApiServer::handleGetSettings()
     generalSchema["audioInDevice"] = QJsonObject({{"type", "string"}, {"description", "Use GET /settings/devices to get available devices"}});
     generalSchema["audioVolume"] = QJsonObject({{"type", "integer"}, {"min", 0}, {"max", 128}});
     generalSchema["audioBufferSize"] = QJsonObject({{"type", "integer"}, {"min", 0}, {"description", "0 = automatic"}});
+    generalSchema["audioTargetLatency"] = QJsonObject({{"type", "integer"}, {"min", 0}, {"max", 500}, {"description", "milliseconds, 0 = automatic"}});
     generalSchema["wifiDroppedNotif"] = QJsonObject({{"type", "integer"}, {"min", 0}, {"max", 100}});
     generalSchema["discoveryEnabled"] = QJsonObject({{"type", "boolean"}});
     generalSchema["keyboardEnabled"] = QJsonObject({{"type", "boolean"}});
@@ -697,7 +886,32 @@ QJsonDocument ApiServer::handleGetSettings()
     generalSchema["customResolutionHeight"] = QJsonObject({{"type", "integer"}, {"min", 0}});
     generalSchema["zoomFactor"] = QJsonObject({{"type", "number"}, {"min", 0.1}, {"max", 10.0}});
     generalSchema["packetLossMax"] = QJsonObject({{"type", "number"}, {"min", 0.0}, {"max", 1.0}});
+    generalSchema["congestionControlPolicy"] = QJsonObject({{"type", "integer"}, {"min", 0}, {"max", 2}, {"description", "0 = legacy, 1 = loss-based, 2 = delay-based"}});
+    generalSchema["videoWarmStartEnabled"] = QJsonObject({{"type", "boolean"}, {"description", "Open the video decoder for low delay and pass the stream header to it before the first frame arrives"}});
+    generalSchema["sessionResumeEnabled"] = QJsonObject({{"type", "boolean"}, {"description", "Reconnect in the background when the stream connection is lost instead of ending the session"}});
+    generalSchema["networkProfileCacheEnabled"] = QJsonObject({{"type", "boolean"}, {"description", "Reuse measured MTU/RTT per console and route to skip the network test on reconnect"}});
     generalSchema["logVerbose"] = QJsonObject({{"type", "boolean"}});
+    generalSchema["logAsync"] = QJsonObject({{"type", "boolean"}, {"description", "Write the session log from a background thread, messages are dropped instead of stalling the stream if it falls behind"}});
+    QJsonArray threadPriorityValues;
+    for (int i = CHIAKI_THREAD_PRIORITY_DEFAULT; i <= CHIAKI_THREAD_PRIORITY_REALTIME; i++)
+        threadPriorityValues.append(chiaki_thread_priority_string(static_cast<ChiakiThreadPriority>(i)));
+    QJsonArray threadRoleValues;
+    for (int i = 0; i < CHIAKI_THREAD_ROLE_COUNT; i++)
+        threadRoleValues.append(chiaki_thread_role_string(static_cast<ChiakiThreadRole>(i)));
+    generalSchema["threadPlacement"] = QJsonObject({
+        {"type", "object"},
+        {"keys", threadRoleValues},
+        {"properties", QJsonObject({
+            {"cpus", QJsonObject({{"type", "string"}, {"description", "cpu list like \"2-3,8\", empty for all cpus"}})},
+            {"priority", QJsonObject({{"type", "string"}, {"allowedValues", threadPriorityValues}})}
+        })},
+        {"description", "Affinity and priority of the streaming threads per role, applied when a stream starts. realtime needs CAP_SYS_NICE or an rtprio limit on Linux"}
+    });
+    generalSchema["threadLockMemory"] = QJsonObject({{"type", "boolean"}, {"description", "Lock all memory while streaming so the streaming threads never page fault, needs a sufficient memlock limit"}});
+    generalSchema["packetTrace"] = QJsonObject({{"type", "boolean"}, {"description", "Record the last received packets and frames, written next to the session log on quit or with POST /stream/trace"}});
+    generalSchema["recordStream"] = QJsonObject({{"type", "boolean"}, {"description", "Remux every stream into an mkv file in the movies folder, without re-encoding"}});
+    generalSchema["replayBufferSeconds"] = QJsonObject({{"type", "integer"}, {"min", 0}, {"description", "Keep the last seconds of the stream in memory to save them with POST /stream/replay, 0 to disable"}});
+    generalSchema["replayBufferMegabytes"] = QJsonObject({{"type", "integer"}, {"min", 1}, {"description", "Memory limit of the replay buffer, it may hold less than replayBufferSeconds at high bitrates"}});
     
     schema["general"] = generalSchema;
     
@@ -791,6 +1005,11 @@ QJsonDocument ApiServer::handlePutSettings(const QJsonObject &body)
         updated.append("audioBufferSize");
     }
     
+    if (body.contains("audioTargetLatency")) {
+        settings->SetAudioTargetLatencyMs(body["audioTargetLatency"].toInt());
+        updated.append("audioTargetLatency");
+    }
+    
     if (body.contains("audioVideoDisabled")) {
         settings->SetAudioVideoDisabled(static_cast<ChiakiDisableAudioVideo>(body["audioVideoDisabled"].toInt()));
         updated.append("audioVideoDisabled");
@@ -913,11 +1132,77 @@ QJsonDocument ApiServer::handlePutSettings(const QJsonObject &body)
         updated.append("packetLossMax");
     }
     
+    if (body.contains("congestionControlPolicy")) {
+        int policy = body["congestionControlPolicy"].toInt();
+        if (policy >= 0 && policy < CHIAKI_CONGESTION_CONTROL_POLICY_COUNT) {
+            settings->SetCongestionControlPolicy(static_cast<ChiakiCongestionControlPolicy>(policy));
+            updated.append("congestionControlPolicy");
+        }
+    }
+
+    if (body.contains("videoWarmStartEnabled")) {
+        settings->SetVideoWarmStartEnabled(body["videoWarmStartEnabled"].toBool());
+        updated.append("videoWarmStartEnabled");
+    }
+    if (body.contains("sessionResumeEnabled")) {
+        settings->SetSessionResumeEnabled(body["sessionResumeEnabled"].toBool());
+        updated.append("sessionResumeEnabled");
+    }
+    if (body.contains("networkProfileCacheEnabled")) {
+        settings->SetNetworkProfileCacheEnabled(body["networkProfileCacheEnabled"].toBool());
+        updated.append("networkProfileCacheEnabled");
+    }
+    
     // Log Settings
     if (body.contains("logVerbose")) {
         settings->SetLogVerbose(body["logVerbose"].toBool());
         updated.append("logVerbose");
     }
+    if (body.contains("logAsync")) {
+        settings->SetLogAsync(body["logAsync"].toBool());
+        updated.append("logAsync");
+    }
+    if (body.contains("packetTrace")) {
+        settings->SetPacketTrace(body["packetTrace"].toBool());
+        updated.append("packetTrace");
+    }
+    if (body.contains("recordStream")) {
+        settings->SetRecordStream(body["recordStream"].toBool());
+        updated.append("recordStream");
+    }
+    if (body.contains("replayBufferSeconds")) {
+        settings->SetReplayBufferSeconds(qMax(body["replayBufferSeconds"].toInt(), 0));
+        updated.append("replayBufferSeconds");
+    }
+    if (body.contains("replayBufferMegabytes")) {
+        settings->SetReplayBufferMegabytes(qMax(body["replayBufferMegabytes"].toInt(), 1));
+        updated.append("replayBufferMegabytes");
+    }
+    if (body.contains("threadPlacement")) {
+        QJsonObject threadPlacement = body["threadPlacement"].toObject();
+        for (int i = 0; i < CHIAKI_THREAD_ROLE_COUNT; i++) {
+            ChiakiThreadRole role = static_cast<ChiakiThreadRole>(i);
+            QJsonObject placement = threadPlacement[chiaki_thread_role_string(role)].toObject();
+            if (placement.contains("cpus")) {
+                QString cpus = placement["cpus"].toString();
+                uint64_t mask;
+                if (chiaki_thread_parse_cpu_list(cpus.toUtf8().constData(), &mask) == CHIAKI_ERR_SUCCESS)
+                    settings->SetThreadCpus(role, cpus);
+            }
+            if (placement.contains("priority")) {
+                QString priority = placement["priority"].toString();
+                for (int p = CHIAKI_THREAD_PRIORITY_DEFAULT; p <= CHIAKI_THREAD_PRIORITY_REALTIME; p++) {
+                    if (priority == chiaki_thread_priority_string(static_cast<ChiakiThreadPriority>(p)))
+                        settings->SetThreadPriority(role, static_cast<ChiakiThreadPriority>(p));
+                }
+            }
+        }
+        updated.append("threadPlacement");
+    }
+    if (body.contains("threadLockMemory")) {
+        settings->SetThreadLockMemory(body["threadLockMemory"].toBool());
+        updated.append("threadLockMemory");
+    }
     
     response["updated"] = updated;
     return QJsonDocument(response);
@@ -5,6 +5,7 @@
 #include <settings.h>
 
 #include <cstring>
+#include <algorithm>
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -33,7 +34,7 @@ HostMAC DiscoveryHost::GetHostMAC() const
 	return HostMAC((uint8_t *)data.constData());
 }
 
-static void DiscoveryServiceHostsCallback(ChiakiDiscoveryHost *hosts, size_t hosts_count, void *user);
+static void DiscoveryServiceHostDeltaCallback(ChiakiDiscoveryServiceDelta delta, ChiakiDiscoveryHost *host, void *user);
 static void DiscoveryServiceHostsManualCallback(ChiakiDiscoveryHost *hosts, size_t hosts_count, void *user);
 
 DiscoveryManager::DiscoveryManager(QObject *parent) : QObject(parent)
@@ -41,21 +42,18 @@ DiscoveryManager::DiscoveryManager(QObject *parent) : QObject(parent)
 	chiaki_log_init(&log, CHIAKI_LOG_ALL & ~CHIAKI_LOG_VERBOSE, chiaki_log_cb_print, nullptr);
 
 	service_active = false;
-	service_active_ipv6 = false;
 }
 
 DiscoveryManager::~DiscoveryManager()
 {
 	if(service_active)
 		chiaki_discovery_service_fini(&service);
-	if(service_active_ipv6)
-		chiaki_discovery_service_fini(&service_ipv6);
 	qDeleteAll(manual_services);
 }
 
 void DiscoveryManager::SetActive(bool active)
 {
-	if(service_active == active && service_active_ipv6 == active)
+	if(service_active == active)
 		return;
 
 	if(active)
@@ -66,7 +64,9 @@ void DiscoveryManager::SetActive(bool active)
 			options.ping_ms = PING_MS;
 			options.hosts_max = HOSTS_MAX;
 			options.host_drop_pings = DROP_PINGS;
-			options.cb = DiscoveryServiceHostsCallback;
+			// IPv4 and IPv6 from the same service, so a console answering on both is a single host
+			options.dual_stack = true;
+			options.delta_cb = DiscoveryServiceHostDeltaCallback;
 			options.cb_user = this;
 
 			struct sockaddr_in in_addr = {};
@@ -206,38 +206,12 @@ void DiscoveryManager::SetActive(bool active)
 			if(err != CHIAKI_ERR_SUCCESS)
 			{
 				service_active = false;
-				CHIAKI_LOGE(&log, "DiscoveryManager failed to init Discovery Service IPV4");
+				CHIAKI_LOGE(&log, "DiscoveryManager failed to init Discovery Service");
 				return;
 			}
 			else
 				service_active = true;
 		}
-		if(!service_active_ipv6)
-		{
-			ChiakiDiscoveryServiceOptions options_ipv6 = {};
-			options_ipv6.ping_ms = PING_MS;
-			options_ipv6.hosts_max = HOSTS_MAX;
-			options_ipv6.host_drop_pings = DROP_PINGS;
-			options_ipv6.cb = DiscoveryServiceHostsCallback;
-			options_ipv6.cb_user = this;
-			struct sockaddr_in6 in_addr_ipv6 = {};
-			in_addr_ipv6.sin6_family = AF_INET6;
-			inet_pton(AF_INET6, "FF02::1", &in_addr_ipv6.sin6_addr);
-			struct sockaddr_storage addr_ipv6;
-			memcpy(&addr_ipv6, &in_addr_ipv6, sizeof(in_addr_ipv6));
-			options_ipv6.send_addr = &addr_ipv6;
-			options_ipv6.send_addr_size = sizeof(in_addr_ipv6);
-			options_ipv6.send_host = nullptr;
-
-			ChiakiErrorCode err = chiaki_discovery_service_init(&service_ipv6, &options_ipv6, &log);
-			if(err != CHIAKI_ERR_SUCCESS)
-			{
-				service_active_ipv6 = false;
-				CHIAKI_LOGE(&log, "DiscoveryManager failed to init Discovery Service IPV6");
-			}
-			else
-				service_active_ipv6 = true;
-		}
 
 		UpdateManualServices();
 	}
@@ -248,11 +222,6 @@ void DiscoveryManager::SetActive(bool active)
 			chiaki_discovery_service_fini(&service);
 			service_active = false;
 		}
-		if(service_active_ipv6)
-		{
-			chiaki_discovery_service_fini(&service_ipv6);
-			service_active_ipv6 = false;
-		}
 		qDeleteAll(manual_services);
 		manual_services.clear();
 
@@ -293,7 +262,7 @@ void DiscoveryManager::SendWakeup(const QString &host, const QByteArray &regist_
 	char *ipv6 = strchr(host.toUtf8().data(), ':');
 	ChiakiErrorCode err;
 	if(ipv6)
-		err = chiaki_discovery_wakeup(&log, service_active_ipv6 ? &service_ipv6.discovery : nullptr, host.toUtf8().constData(), credential, ps5);
+		err = chiaki_discovery_wakeup(&log, service_active && service.discovery_ipv6_active ? &service.discovery_ipv6 : nullptr, host.toUtf8().constData(), credential, ps5);
 	else
 		err = chiaki_discovery_wakeup(&log, service_active ? &service.discovery : nullptr, host.toUtf8().constData(), credential, ps5);
 
@@ -313,15 +282,34 @@ const QList<DiscoveryHost> DiscoveryManager::GetHosts() const
 	return ret;
 }
 
-void DiscoveryManager::DiscoveryServiceHosts(QList<DiscoveryHost> hosts)
+void DiscoveryManager::DiscoveryServiceHostDelta(int delta, DiscoveryHost host)
 {
-	this->hosts = std::move(hosts);
+	auto it = std::find_if(hosts.begin(), hosts.end(), [&host](const DiscoveryHost &h) {
+		return h.host_id == host.host_id;
+	});
+	switch(delta)
+	{
+		case CHIAKI_DISCOVERY_SERVICE_HOST_ADDED:
+		case CHIAKI_DISCOVERY_SERVICE_HOST_UPDATED:
+			if(it == hosts.end())
+				hosts.append(host);
+			else
+				*it = host;
+			break;
+		case CHIAKI_DISCOVERY_SERVICE_HOST_REMOVED:
+			if(it == hosts.end())
+				return;
+			hosts.erase(it);
+			break;
+		default:
+			return;
+	}
 	emit HostsUpdated();
 }
 
 void DiscoveryManager::UpdateManualServices()
 {
-	if(!settings || (!service_active && !service_active_ipv6))
+	if(!settings || !service_active)
 		return;
 
 	QSet<QString> hosts;
@@ -380,9 +368,9 @@ void DiscoveryManager::UpdateManualServices()
 class DiscoveryManagerPrivate
 {
 	public:
-		static void DiscoveryServiceHosts(DiscoveryManager *discovery_manager, const QList<DiscoveryHost> &hosts)
+		static void DiscoveryServiceHostDelta(DiscoveryManager *discovery_manager, ChiakiDiscoveryServiceDelta delta, const DiscoveryHost &host)
 		{
-			QMetaObject::invokeMethod(discovery_manager, "DiscoveryServiceHosts", Qt::ConnectionType::QueuedConnection, Q_ARG(QList<DiscoveryHost>, hosts));
+			QMetaObject::invokeMethod(discovery_manager, "DiscoveryServiceHostDelta", Qt::ConnectionType::QueuedConnection, Q_ARG(int, delta), Q_ARG(DiscoveryHost, host));
 		}
 
 		static void DiscoveryServiceManualHost(DiscoveryManager *discovery_manager)
@@ -391,31 +379,22 @@ class DiscoveryManagerPrivate
 		}
 };
 
-static QList<DiscoveryHost> CreateHostsList(ChiakiDiscoveryHost *hosts, size_t hosts_count)
+static DiscoveryHost CreateHost(ChiakiDiscoveryHost *h)
 {
-	QList<DiscoveryHost> hosts_list;
-	hosts_list.reserve(hosts_count);
-
-	for(size_t i=0; i<hosts_count; i++)
-	{
-		ChiakiDiscoveryHost *h = hosts + i;
-		DiscoveryHost o = {};
-		o.ps5 = chiaki_discovery_host_is_ps5(h);
-		o.target = chiaki_discovery_host_system_version_target(h);
-		o.state = h->state;
-		o.host_request_port = h->host_request_port;
+	DiscoveryHost o = {};
+	o.ps5 = chiaki_discovery_host_is_ps5(h);
+	o.target = chiaki_discovery_host_system_version_target(h);
+	o.state = h->state;
+	o.host_request_port = h->host_request_port;
 #define CONVERT_STRING(name) if(h->name) { o.name = QString::fromLocal8Bit(h->name); }
-		CHIAKI_DISCOVERY_HOST_STRING_FOREACH(CONVERT_STRING)
+	CHIAKI_DISCOVERY_HOST_STRING_FOREACH(CONVERT_STRING)
 #undef CONVERT_STRING
-		hosts_list.append(o);
-	}
-
-	return hosts_list;
+	return o;
 }
 
-static void DiscoveryServiceHostsCallback(ChiakiDiscoveryHost *hosts, size_t hosts_count, void *user)
+static void DiscoveryServiceHostDeltaCallback(ChiakiDiscoveryServiceDelta delta, ChiakiDiscoveryHost *host, void *user)
 {
-	DiscoveryManagerPrivate::DiscoveryServiceHosts(reinterpret_cast<DiscoveryManager *>(user), CreateHostsList(hosts, hosts_count));
+	DiscoveryManagerPrivate::DiscoveryServiceHostDelta(reinterpret_cast<DiscoveryManager *>(user), delta, CreateHost(host));
 }
 
 static void DiscoveryServiceHostsManualCallback(ChiakiDiscoveryHost *hosts, size_t hosts_count, void *user)
@@ -423,6 +402,6 @@ static void DiscoveryServiceHostsManualCallback(ChiakiDiscoveryHost *hosts, size
 	ManualService *s = reinterpret_cast<ManualService *>(user);
 	s->discovered = hosts_count;
 	if(s->discovered)
-		s->discovery_host = CreateHostsList(hosts, hosts_count).at(0);
+		s->discovery_host = CreateHost(hosts);
 	DiscoveryManagerPrivate::DiscoveryServiceManualHost(s->manager);
 }
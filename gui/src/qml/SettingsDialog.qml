@@ -634,6 +634,22 @@ DialogView {
                         text: qsTr("(Auto)")
                     }
 
+                    Label {
+                        Layout.alignment: Qt.AlignRight
+                        text: qsTr("Decoder Warm Start:")
+                    }
+
+                    C.CheckBox {
+                        text: qsTr("Prepare the decoder during connection to show the first frame sooner")
+                        checked: Chiaki.settings.videoWarmStartEnabled
+                        onToggled: Chiaki.settings.videoWarmStartEnabled = !Chiaki.settings.videoWarmStartEnabled
+                    }
+
+                    Label {
+                        Layout.alignment: Qt.AlignRight
+                        text: qsTr("(Checked)")
+                    }
+
                     Label {
                         Layout.alignment: Qt.AlignRight
                         text: qsTr("Window Type:")
@@ -1386,6 +1402,37 @@ DialogView {
                             text: qsTr("(50 ms)")
                         }
 
+                        Label {
+                            Layout.alignment: Qt.AlignRight
+                            text: qsTr("Audio Target Latency:")
+                        }
+
+                        C.Slider {
+                            Layout.preferredWidth: 250
+                            from: 0
+                            to: 20
+                            stepSize: 1
+                            value: Chiaki.settings.audioTargetLatency / 10
+                            onMoved: Chiaki.settings.audioTargetLatency = value * 10;
+                            sendOutput: true
+
+                            Label {
+                                anchors {
+                                    left: parent.right
+                                    verticalCenter: parent.verticalCenter
+                                    leftMargin: 10
+                                }
+                                text: {
+                                    parent.value ? (parent.value * 10).toFixed(0) + qsTr(" ms") : qsTr("Auto")
+                                }
+                            }
+                        }
+
+                        Label {
+                            Layout.alignment: Qt.AlignRight
+                            text: qsTr("(Auto)")
+                        }
+
                         Label {
                             Layout.alignment: Qt.AlignRight
                             text: qsTr("Audio Volume:")
@@ -1575,6 +1622,55 @@ DialogView {
                             text: qsTr("(5%)")
                         }
 
+                        Label {
+                            Layout.alignment: Qt.AlignRight
+                            text: qsTr("Congestion Control:")
+                        }
+
+                        C.ComboBox {
+                            Layout.preferredWidth: 400
+                            model: [qsTr("Legacy (report loss)"), qsTr("Loss-based"), qsTr("Delay-based")]
+                            currentIndex: Chiaki.settings.congestionControlPolicy
+                            onActivated: index => Chiaki.settings.congestionControlPolicy = index
+                        }
+
+                        Label {
+                            Layout.alignment: Qt.AlignRight
+                            text: qsTr("(Legacy)")
+                        }
+
+                        Label {
+                            Layout.alignment: Qt.AlignRight
+                            text: qsTr("Cache Network Test Results:")
+                        }
+
+                        C.CheckBox {
+                            text: qsTr("Skip the MTU/latency test when reconnecting over the same network")
+                            checked: Chiaki.settings.networkProfileCacheEnabled
+                            onToggled: Chiaki.settings.networkProfileCacheEnabled = !Chiaki.settings.networkProfileCacheEnabled
+                        }
+
+                        Label {
+                            Layout.alignment: Qt.AlignRight
+                            text: qsTr("(Checked)")
+                        }
+
+                        Label {
+                            Layout.alignment: Qt.AlignRight
+                            text: qsTr("Resume After Connection Loss:")
+                        }
+
+                        C.CheckBox {
+                            text: qsTr("Reconnect in the background when the network drops briefly (local connections only)")
+                            checked: Chiaki.settings.sessionResumeEnabled
+                            onToggled: Chiaki.settings.sessionResumeEnabled = !Chiaki.settings.sessionResumeEnabled
+                        }
+
+                        Label {
+                            Layout.alignment: Qt.AlignRight
+                            text: qsTr("(Checked)")
+                        }
+
                         Label {
                             Layout.alignment: Qt.AlignRight
                             text: qsTr("Show Stream Stats During Gameplay")
@@ -2604,9 +2700,45 @@ DialogView {
                     C.CheckBox {
                         text: qsTr("Verbose Logging (unchecked)")
                         checked: Chiaki.settings.logVerbose
-                        lastInFocusChain: true
                         onToggled: Chiaki.settings.logVerbose = checked
                     }
+
+                    C.CheckBox {
+                        text: qsTr("Background Log Writing (checked)")
+                        checked: Chiaki.settings.logAsync
+                        onToggled: Chiaki.settings.logAsync = checked
+                    }
+
+                    C.CheckBox {
+                        text: qsTr("Packet Trace (unchecked)")
+                        checked: Chiaki.settings.packetTrace
+                        onToggled: Chiaki.settings.packetTrace = checked
+                    }
+
+                    C.CheckBox {
+                        text: qsTr("Record Streams (unchecked)")
+                        checked: Chiaki.settings.recordStream
+                        onToggled: Chiaki.settings.recordStream = checked
+                    }
+
+                    C.CheckBox {
+                        text: qsTr("Instant Replay of the Last 30 Seconds (unchecked)")
+                        checked: Chiaki.settings.replayBufferSeconds > 0
+                        onToggled: Chiaki.settings.replayBufferSeconds = checked ? 30 : 0
+                    }
+
+                    C.CheckBox {
+                        text: qsTr("Real-time Streaming Threads (unchecked)")
+                        checked: Chiaki.settings.threadRealtime
+                        onToggled: Chiaki.settings.threadRealtime = checked
+                    }
+
+                    C.CheckBox {
+                        text: qsTr("Lock Memory While Streaming (unchecked)")
+                        checked: Chiaki.settings.threadLockMemory
+                        lastInFocusChain: true
+                        onToggled: Chiaki.settings.threadLockMemory = checked
+                    }
                 }
             }
         }
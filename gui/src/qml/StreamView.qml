@@ -617,6 +617,8 @@ Item {
             text: {
                 if (!Chiaki.session)
                     return "";
+                if (Chiaki.session.resuming)
+                    return qsTr("Reconnecting to <b>%1</b>").arg(Chiaki.settings.streamerMode ? "hidden" : Chiaki.session.host);
                 if (Chiaki.session.connected)
                     return qsTr("Connected to <b>%1</b>").arg(Chiaki.settings.streamerMode ? "hidden" : Chiaki.session.host);
                 return qsTr("Connecting to <b>%1</b>").arg(Chiaki.settings.streamerMode ? "hidden" : Chiaki.session.host);
@@ -762,6 +762,11 @@ void QmlBackend::createSession(const StreamSessionConnectInfo &connect_info)
         return;
     }
 
+    // the frame thread outlives sessions, so it picks up the placement of each new one
+    QMetaObject::invokeMethod(frame_thread->parent(), []() {
+        chiaki_thread_apply_role(CHIAKI_THREAD_ROLE_DECODER);
+    });
+
     connect(session, &StreamSession::FfmpegFrameAvailable, frame_thread->parent(), [this]() {
         ChiakiFfmpegDecoder *decoder = session->GetFfmpegDecoder();
         if (!decoder) {
@@ -203,6 +203,79 @@ void QmlSettings::setLogVerbose(bool verbose)
     emit logVerboseChanged();
 }
 
+bool QmlSettings::logAsync() const
+{
+    return settings->GetLogAsync();
+}
+
+void QmlSettings::setLogAsync(bool enabled)
+{
+    settings->SetLogAsync(enabled);
+    emit logAsyncChanged();
+}
+
+bool QmlSettings::packetTrace() const
+{
+    return settings->GetPacketTrace();
+}
+
+void QmlSettings::setPacketTrace(bool enabled)
+{
+    settings->SetPacketTrace(enabled);
+    emit packetTraceChanged();
+}
+
+bool QmlSettings::recordStream() const
+{
+    return settings->GetRecordStream();
+}
+
+void QmlSettings::setRecordStream(bool enabled)
+{
+    settings->SetRecordStream(enabled);
+    emit recordStreamChanged();
+}
+
+int QmlSettings::replayBufferSeconds() const
+{
+    return settings->GetReplayBufferSeconds();
+}
+
+void QmlSettings::setReplayBufferSeconds(int seconds)
+{
+    settings->SetReplayBufferSeconds(qMax(seconds, 0));
+    emit replayBufferSecondsChanged();
+}
+
+bool QmlSettings::threadRealtime() const
+{
+    for (int i = 0; i < CHIAKI_THREAD_ROLE_COUNT; i++)
+    {
+        if (settings->GetThreadPriority(static_cast<ChiakiThreadRole>(i)) != CHIAKI_THREAD_PRIORITY_REALTIME)
+            return false;
+    }
+    return true;
+}
+
+void QmlSettings::setThreadRealtime(bool enabled)
+{
+    // per role priorities and cpu lists can be set through the api server
+    for (int i = 0; i < CHIAKI_THREAD_ROLE_COUNT; i++)
+        settings->SetThreadPriority(static_cast<ChiakiThreadRole>(i), enabled ? CHIAKI_THREAD_PRIORITY_REALTIME : CHIAKI_THREAD_PRIORITY_DEFAULT);
+    emit threadRealtimeChanged();
+}
+
+bool QmlSettings::threadLockMemory() const
+{
+    return settings->GetThreadLockMemory();
+}
+
+void QmlSettings::setThreadLockMemory(bool enabled)
+{
+    settings->SetThreadLockMemory(enabled);
+    emit threadLockMemoryChanged();
+}
+
 int QmlSettings::rumbleHapticsIntensity() const
 {
     return static_cast<int>(settings->GetRumbleHapticsIntensity());
@@ -481,6 +554,17 @@ void QmlSettings::setAudioBufferSize(int size)
     emit audioBufferSizeChanged();
 }
 
+int QmlSettings::audioTargetLatency() const
+{
+    return settings->GetAudioTargetLatencyMs();
+}
+
+void QmlSettings::setAudioTargetLatency(int ms)
+{
+    settings->SetAudioTargetLatencyMs(ms);
+    emit audioTargetLatencyChanged();
+}
+
 int QmlSettings::audioVolume() const
 {
     return settings->GetAudioVolume();
@@ -581,6 +665,50 @@ void QmlSettings::setPacketLossMax(int packet_loss_max)
     emit packetLossMaxChanged();
 }
 
+int QmlSettings::congestionControlPolicy() const
+{
+    return settings->GetCongestionControlPolicy();
+}
+
+void QmlSettings::setCongestionControlPolicy(int policy)
+{
+    settings->SetCongestionControlPolicy(static_cast<ChiakiCongestionControlPolicy>(policy));
+    emit congestionControlPolicyChanged();
+}
+
+bool QmlSettings::videoWarmStartEnabled() const
+{
+    return settings->GetVideoWarmStartEnabled();
+}
+
+void QmlSettings::setVideoWarmStartEnabled(bool enabled)
+{
+    settings->SetVideoWarmStartEnabled(enabled);
+    emit videoWarmStartEnabledChanged();
+}
+
+bool QmlSettings::sessionResumeEnabled() const
+{
+    return settings->GetSessionResumeEnabled();
+}
+
+void QmlSettings::setSessionResumeEnabled(bool enabled)
+{
+    settings->SetSessionResumeEnabled(enabled);
+    emit sessionResumeEnabledChanged();
+}
+
+bool QmlSettings::networkProfileCacheEnabled() const
+{
+    return settings->GetNetworkProfileCacheEnabled();
+}
+
+void QmlSettings::setNetworkProfileCacheEnabled(bool enabled)
+{
+    settings->SetNetworkProfileCacheEnabled(enabled);
+    emit networkProfileCacheEnabledChanged();
+}
+
 int QmlSettings::videoPreset() const
 {
     return static_cast<int>(settings->GetPlaceboPreset());
@@ -1686,6 +1814,12 @@ void QmlSettings::refreshAllKeys()
     emit disconnectActionChanged();
     emit suspendActionChanged();
     emit logVerboseChanged();
+    emit logAsyncChanged();
+    emit packetTraceChanged();
+    emit recordStreamChanged();
+    emit replayBufferSecondsChanged();
+    emit threadRealtimeChanged();
+    emit threadLockMemoryChanged();
     emit hapticOverrideChanged();
     emit rumbleHapticsIntensityChanged();
     emit buttonsByPositionChanged();
@@ -1718,6 +1852,7 @@ void QmlSettings::refreshAllKeys()
     emit codecLocalPS5Changed();
     emit codecRemotePS5Changed();
     emit audioBufferSizeChanged();
+    emit audioTargetLatencyChanged();
     emit audioVolumeChanged();
     emit audioOutDeviceChanged();
     emit audioInDeviceChanged();
@@ -1747,6 +1882,10 @@ void QmlSettings::refreshAllKeys()
     emit streamMenuShortcut4Changed();
     emit controllerMappingChanged();
     emit packetLossMaxChanged();
+    emit congestionControlPolicyChanged();
+    emit videoWarmStartEnabledChanged();
+    emit sessionResumeEnabledChanged();
+    emit networkProfileCacheEnabledChanged();
     emit currentProfileChanged();
     emit profilesChanged();
     refreshAllPlaceboKeys();
@@ -2,27 +2,37 @@
 
 #include <sessionlog.h>
 #include <chiaki/log.h>
+#include <chiaki/time.h>
 
 #include <QStandardPaths>
 #include <QDir>
 #include <QRegularExpression>
 #include <QDateTime>
 #include <QFile>
+#include <QFileInfo>
 #include <QPair>
 #include <QVector>
 
 
 static void LogCb(ChiakiLogLevel level, const char *msg, void *user);
+static void LogRecordCb(const ChiakiLogRecord *record, void *user);
 
-SessionLog::SessionLog(StreamSession *session, uint32_t level_mask, const QString &filename)
-	: session(session)
+SessionLog::SessionLog(StreamSession *session, uint32_t level_mask, const QString &filename, bool async)
+	: session(session),
+	async(async)
 {
 	chiaki_log_init(&log, level_mask, LogCb, this);
+	if(this->async && chiaki_log_async_init(&log_async, level_mask, CHIAKI_LOG_ASYNC_RECORDS_DEFAULT, LogRecordCb, this) != CHIAKI_ERR_SUCCESS)
+	{
+		this->async = false;
+		CHIAKI_LOGE(&log, "Failed to start async logging, logging synchronously");
+	}
+	ChiakiLog *init_log = GetChiakiLog();
 
 	if(filename.isEmpty())
 	{
 		file = nullptr;
-		CHIAKI_LOGI(&log, "Logging to file disabled");
+		CHIAKI_LOGI(init_log, "Logging to file disabled");
 	}
 	else
 	{
@@ -31,23 +41,28 @@ SessionLog::SessionLog(StreamSession *session, uint32_t level_mask, const QStrin
 		{
 			delete file;
 			file = nullptr;
-			CHIAKI_LOGI(&log, "Failed to open file %s for logging", filename.toLocal8Bit().constData());
+			CHIAKI_LOGI(init_log, "Failed to open file %s for logging", filename.toLocal8Bit().constData());
 		}
 		else
 		{
-			CHIAKI_LOGI(&log, "Logging to file %s", filename.toLocal8Bit().constData());
+			CHIAKI_LOGI(init_log, "Logging to file %s", filename.toLocal8Bit().constData());
 		}
 	}
 
-	CHIAKI_LOGI(&log, "Chiaki Version " CHIAKI_VERSION);
+	CHIAKI_LOGI(init_log, "Chiaki Version " CHIAKI_VERSION);
 }
 
 SessionLog::~SessionLog()
 {
+	if(async)
+	{
+		// writes everything that is still queued
+		chiaki_log_async_fini(&log_async);
+	}
 	delete file;
 }
 
-void SessionLog::Log(ChiakiLogLevel level, const char *msg)
+void SessionLog::Log(ChiakiLogLevel level, const char *msg, const QDateTime &time)
 {
 	chiaki_log_cb_print(level, msg, nullptr);
 
@@ -55,7 +70,7 @@ void SessionLog::Log(ChiakiLogLevel level, const char *msg)
 	{
 		static const QString date_format = "yyyy-MM-dd HH:mm:ss:zzzzzz";
 		QString str = QString("[%1] [%2] %3\n").arg(
-				QDateTime::currentDateTime().toString(date_format),
+				time.toString(date_format),
 				QString(chiaki_log_level_char(level)),
 				msg);
 
@@ -68,13 +83,21 @@ void SessionLog::Log(ChiakiLogLevel level, const char *msg)
 class SessionLogPrivate
 {
 	public:
-		static void Log(SessionLog *log, ChiakiLogLevel level, const char *msg) { log->Log(level, msg); }
+		static void Log(SessionLog *log, ChiakiLogLevel level, const char *msg, const QDateTime &time) { log->Log(level, msg, time); }
 };
 
 static void LogCb(ChiakiLogLevel level, const char *msg, void *user)
 {
 	auto log = reinterpret_cast<SessionLog *>(user);
-	SessionLogPrivate::Log(log, level, msg);
+	SessionLogPrivate::Log(log, level, msg, QDateTime::currentDateTime());
+}
+
+static void LogRecordCb(const ChiakiLogRecord *record, void *user)
+{
+	auto log = reinterpret_cast<SessionLog *>(user);
+	// the time the message was logged, not written
+	qint64 delay_ms = (qint64)((chiaki_time_now_monotonic_us() - record->timestamp_us) / 1000);
+	SessionLogPrivate::Log(log, record->level, record->msg, QDateTime::currentDateTime().addMSecs(-delay_ms));
 }
 
 #define KEEP_LOG_FILES_COUNT 5
@@ -126,6 +149,10 @@ QString CreateLogFilename()
 		if(!pair.second.isValid())
 			break;
 		dir.remove(pair.first);
+		// packet traces written next to this log
+		const QString trace_wildcard = QFileInfo(pair.first).completeBaseName() + "*.trace";
+		for(const auto &trace : dir.entryList({ trace_wildcard }, QDir::Files))
+			dir.remove(trace);
 	}
 
 	QString filename = "chiaki_session_" + QDateTime::currentDateTime().toString(date_format) + ".log";
@@ -305,6 +305,44 @@ uint32_t Settings::GetLogLevelMask()
 	return mask;
 }
 
+QString Settings::GetThreadCpus(ChiakiThreadRole role) const
+{
+	return settings.value(QString("settings/thread_%1_cpus").arg(chiaki_thread_role_string(role)), QString()).toString();
+}
+
+void Settings::SetThreadCpus(ChiakiThreadRole role, const QString &cpus)
+{
+	settings.setValue(QString("settings/thread_%1_cpus").arg(chiaki_thread_role_string(role)), cpus);
+}
+
+ChiakiThreadPriority Settings::GetThreadPriority(ChiakiThreadRole role) const
+{
+	int priority = settings.value(QString("settings/thread_%1_priority").arg(chiaki_thread_role_string(role)), CHIAKI_THREAD_PRIORITY_DEFAULT).toInt();
+	if(priority < CHIAKI_THREAD_PRIORITY_DEFAULT || priority > CHIAKI_THREAD_PRIORITY_REALTIME)
+		return CHIAKI_THREAD_PRIORITY_DEFAULT;
+	return static_cast<ChiakiThreadPriority>(priority);
+}
+
+void Settings::SetThreadPriority(ChiakiThreadRole role, ChiakiThreadPriority priority)
+{
+	settings.setValue(QString("settings/thread_%1_priority").arg(chiaki_thread_role_string(role)), static_cast<int>(priority));
+}
+
+ChiakiThreadPlacementConfig Settings::GetThreadPlacement() const
+{
+	ChiakiThreadPlacementConfig config = {};
+	for(int i=0; i<CHIAKI_THREAD_ROLE_COUNT; i++)
+	{
+		ChiakiThreadRole role = static_cast<ChiakiThreadRole>(i);
+		// an invalid list leaves the role unpinned
+		if(chiaki_thread_parse_cpu_list(GetThreadCpus(role).toUtf8().constData(), &config.roles[i].cpu_mask) != CHIAKI_ERR_SUCCESS)
+			config.roles[i].cpu_mask = 0;
+		config.roles[i].priority = GetThreadPriority(role);
+	}
+	config.lock_memory = GetThreadLockMemory();
+	return config;
+}
+
 QRect Settings::GetGeometry() const
 {
 	return settings.value("settings/geometry", QRect()).toRect();
@@ -610,6 +648,117 @@ void Settings::SetPacketLossMax(float packet_loss_max)
 	settings.setValue("settings/packet_loss_max", QString("%1").arg(packet_loss_max, 0, 'f', 2));
 }
 
+ChiakiCongestionControlPolicy Settings::GetCongestionControlPolicy() const
+{
+	int policy = settings.value("settings/congestion_control_policy", CHIAKI_CONGESTION_CONTROL_POLICY_LEGACY).toInt();
+	if(policy < 0 || policy >= CHIAKI_CONGESTION_CONTROL_POLICY_COUNT)
+		return CHIAKI_CONGESTION_CONTROL_POLICY_LEGACY;
+	return static_cast<ChiakiCongestionControlPolicy>(policy);
+}
+
+void Settings::SetCongestionControlPolicy(ChiakiCongestionControlPolicy policy)
+{
+	settings.setValue("settings/congestion_control_policy", static_cast<int>(policy));
+}
+
+bool Settings::GetVideoWarmStartEnabled() const
+{
+	return settings.value("settings/video_warm_start_enabled", true).toBool();
+}
+
+void Settings::SetVideoWarmStartEnabled(bool enabled)
+{
+	settings.setValue("settings/video_warm_start_enabled", enabled);
+}
+
+bool Settings::GetSessionResumeEnabled() const
+{
+	return settings.value("settings/session_resume_enabled", false).toBool();
+}
+
+void Settings::SetSessionResumeEnabled(bool enabled)
+{
+	settings.setValue("settings/session_resume_enabled", enabled);
+}
+
+bool Settings::GetNetworkProfileCacheEnabled() const
+{
+	return settings.value("settings/network_profile_cache_enabled", true).toBool();
+}
+
+void Settings::SetNetworkProfileCacheEnabled(bool enabled)
+{
+	settings.setValue("settings/network_profile_cache_enabled", enabled);
+	if(!enabled)
+		settings.remove("network_profiles");
+}
+
+// network profile keys contain '/', which QSettings would treat as groups
+static QString NetworkProfileSettingsKey(const QString &key)
+{
+	return QString::fromLatin1(key.toUtf8().toHex());
+}
+
+QMap<QString, ChiakiNetworkProfile> Settings::GetNetworkProfiles()
+{
+	QMap<QString, ChiakiNetworkProfile> profiles;
+	settings.beginGroup("network_profiles");
+	for(const auto &settings_key : settings.childKeys())
+	{
+		QStringList values = settings.value(settings_key).toString().split(',');
+		if(values.size() != 5)
+			continue;
+		ChiakiNetworkProfile profile = {};
+		profile.mtu_in = values[0].toUInt();
+		profile.mtu_out = values[1].toUInt();
+		profile.rtt_us = values[2].toULongLong();
+		profile.measured_at = values[3].toULongLong();
+		profile.validated_at = values[4].toULongLong();
+		profiles.insert(QString::fromUtf8(QByteArray::fromHex(settings_key.toLatin1())), profile);
+	}
+	settings.endGroup();
+	return profiles;
+}
+
+void Settings::SetNetworkProfile(const QString &key, const ChiakiNetworkProfile *profile)
+{
+	QString settings_key = QString("network_profiles/%1").arg(NetworkProfileSettingsKey(key));
+	if(!profile)
+	{
+		settings.remove(settings_key);
+		return;
+	}
+	settings.setValue(settings_key, QString("%1,%2,%3,%4,%5")
+			.arg(profile->mtu_in)
+			.arg(profile->mtu_out)
+			.arg(profile->rtt_us)
+			.arg(profile->measured_at)
+			.arg(profile->validated_at));
+}
+
+bool Settings::GetHolepunchCandidateHint(const QString &duid, ChiakiHolepunchCandidateHint *hint)
+{
+	QStringList values = settings.value(QString("holepunch_candidate_hints/%1").arg(duid)).toString().split(',');
+	if(values.size() != 3)
+		return false;
+	QByteArray addr = values[0].toLatin1();
+	if(addr.isEmpty() || addr.size() >= CHIAKI_HOLEPUNCH_CANDIDATE_ADDR_SIZE)
+		return false;
+	*hint = {};
+	memcpy(hint->addr, addr.constData(), addr.size());
+	hint->port = values[1].toUShort();
+	hint->rtt_us = values[2].toULongLong();
+	return true;
+}
+
+void Settings::SetHolepunchCandidateHint(const QString &duid, const ChiakiHolepunchCandidateHint &hint)
+{
+	settings.setValue(QString("holepunch_candidate_hints/%1").arg(duid), QString("%1,%2,%3")
+			.arg(QString::fromLatin1(hint.addr))
+			.arg(hint.port)
+			.arg(hint.rtt_us));
+}
+
 static const QMap<WindowType, QString> window_type_values = {
 	{ WindowType::SelectedResolution, "Selected Resolution" },
 	{ WindowType::CustomResolution, "Custom Resolution"},
@@ -712,6 +861,16 @@ void Settings::SetAudioBufferSize(unsigned int size)
 	settings.setValue("settings/audio_buffer_size", size);
 }
 
+unsigned int Settings::GetAudioTargetLatencyMs() const
+{
+	return settings.value("settings/audio_target_latency_ms", 0).toUInt();
+}
+
+void Settings::SetAudioTargetLatencyMs(unsigned int ms)
+{
+	settings.setValue("settings/audio_target_latency_ms", ms);
+}
+
 unsigned int Settings::GetWifiDroppedNotif() const
 {
 	return settings.value("settings/wifi_dropped_notif_percent", 3).toUInt();
@@ -9,12 +9,19 @@
 #include <chiaki/remote/holepunch.h>
 #include <chiaki/session.h>
 #include <chiaki/time.h>
+#include <chiaki/audio.h>
 #include "../../lib/src/utils.h"
 
 #include <QKeyEvent>
+#include <QDateTime>
+#include <QDir>
+#include <QStandardPaths>
+#include <QtConcurrent>
 #include <QtMath>
 
+#include <algorithm>
 #include <cstring>
+#include <memory>
 
 #define SETSU_UPDATE_INTERVAL_MS 4
 #define STEAMDECK_UPDATE_INTERVAL_MS 4
@@ -39,9 +46,8 @@
 #else
 #define DUALSENSE_AUDIO_DEVICE_NEEDLE "Wireless Controller"
 #endif
-#if CHIAKI_GUI_ENABLE_SPEEX
-#define ECHO_QUEUE_MAX 40
-#endif
+// capacity of the output ring in multiples of the target, so the decoder never has to drop anything while the device catches up
+#define AUDIO_OUT_RING_TARGET_FACTOR 4
 
 static bool isLocalAddress(QString host)
 {
@@ -67,6 +73,18 @@ static bool isLocalAddress(QString host)
     return false;
 }
 
+static QString CreateRecordingFilename(const QString &prefix)
+{
+	QString dir_str = QStandardPaths::writableLocation(QStandardPaths::MoviesLocation);
+	if(dir_str.isEmpty())
+		return QString();
+	QDir dir(dir_str);
+	if(!dir.mkpath("chiaki"))
+		return QString();
+	QString filename = prefix + QDateTime::currentDateTime().toString("yyyy-MM-dd_HH-mm-ss-zzz") + ".mkv";
+	return dir.absoluteFilePath("chiaki/" + filename);
+}
+
 StreamSessionConnectInfo::StreamSessionConnectInfo(
 		Settings *settings,
 		ChiakiTarget target,
@@ -86,11 +104,20 @@ StreamSessionConnectInfo::StreamSessionConnectInfo(
 	decoder = settings->GetDecoder();
 	hw_decoder = settings->GetHardwareDecoder();
 	hw_device_ctx = nullptr;
+	video_warm_start = settings->GetVideoWarmStartEnabled();
+	session_resume = settings->GetSessionResumeEnabled();
 	audio_out_device = settings->GetAudioOutDevice();
 	audio_in_device = settings->GetAudioInDevice();
 	log_level_mask = settings->GetLogLevelMask();
 	audio_volume = settings->GetAudioVolume();
 	log_file = CreateLogFilename();
+	log_async = settings->GetLogAsync();
+	trace_events = settings->GetPacketTrace() ? CHIAKI_TRACE_EVENTS_DEFAULT : 0;
+	if(settings->GetRecordStream())
+		record_file = CreateRecordingFilename("chiaki_");
+	replay_seconds = settings->GetReplayBufferSeconds();
+	replay_bytes = (size_t)settings->GetReplayBufferMegabytes() * 1024 * 1024;
+	thread_placement = settings->GetThreadPlacement();
 	// local connection
 	if(duid.isEmpty() && isLocalAddress(host))
 		video_profile = chiaki_target_is_ps5(target) ? settings->GetVideoProfileLocalPS5(): settings->GetVideoProfileLocalPS4();
@@ -104,6 +131,7 @@ StreamSessionConnectInfo::StreamSessionConnectInfo(
 	this->morning = std::move(morning);
 	this->initial_login_pin = std::move(initial_login_pin);
 	audio_buffer_size = settings->GetAudioBufferSize();
+	audio_target_latency_ms = settings->GetAudioTargetLatencyMs();
 	this->fullscreen = fullscreen;
 	this->zoom = zoom;
 	this->stretch = stretch;
@@ -115,6 +143,10 @@ StreamSessionConnectInfo::StreamSessionConnectInfo(
 	this->buttons_by_pos = settings->GetButtonsByPosition();
 	this->start_mic_unmuted = settings->GetStartMicUnmuted();
 	this->packet_loss_max = settings->GetPacketLossMax();
+	this->congestion_control_policy = settings->GetCongestionControlPolicy();
+	this->network_profile_cache_enabled = settings->GetNetworkProfileCacheEnabled();
+	if(this->network_profile_cache_enabled)
+		this->network_profiles = settings->GetNetworkProfiles();
 	this->audio_video_disabled = settings->GetAudioVideoDisabled();
 	this->haptic_override = settings->GetHapticOverride();
 #if CHIAKI_GUI_ENABLE_STEAMDECK_NATIVE
@@ -147,12 +179,21 @@ StreamSessionConnectInfo::StreamSessionConnectInfo(
 
 static void AudioSettingsCb(uint32_t channels, uint32_t rate, void *user);
 static void AudioFrameCb(int16_t *buf, size_t samples_count, void *user);
-static void HapticsFrameCb(uint8_t *buf, size_t buf_size, void *user);
+static size_t AudioQueuedCb(void *user);
+static void AudioOutCb(void *user, Uint8 *stream, int len);
+static void AudioInCb(void *user, Uint8 *stream, int len);
+static void HapticsFrameCb(uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index, void *user);
+static void RecordVideoHeaderCb(uint8_t *buf, size_t buf_size, unsigned int width, unsigned int height, void *user);
+static void RecordVideoFrameCb(uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index, bool keyframe, void *user);
+static void RecordAudioHeaderCb(ChiakiAudioHeader *header, void *user);
+static void RecordAudioFrameCb(uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index, void *user);
 #ifdef Q_OS_MACOS
 static void MacMicRequestCb(Authorization authorization, void *user);
 #endif
 static void CantDisplayCb(void *user, bool cant_display);
 static void EventCb(ChiakiEvent *event, void *user);
+static bool NetworkProfileLoadCb(const char *key, ChiakiNetworkProfile *profile, void *user);
+static void NetworkProfileStoreCb(const char *key, const ChiakiNetworkProfile *profile, void *user);
 #if CHIAKI_GUI_ENABLE_SETSU
 static void SessionSetsuCb(SetsuEvent *event, void *user);
 #endif
@@ -161,15 +202,57 @@ static void SessionSDeckCb(SDeckEvent *event, void *user);
 #endif
 static void FfmpegFrameCb(ChiakiFfmpegDecoder *decoder, void *user);
 
+/**
+ * Process-wide, so reconnecting on the same network can skip STUN.
+ */
+static ChiakiStunCache *StunCache()
+{
+	static struct StunCacheHolder
+	{
+		ChiakiStunCache cache;
+		StunCacheHolder() { chiaki_stun_cache_init(&cache, CHIAKI_STUN_CACHE_TTL_MS_DEFAULT); }
+		~StunCacheHolder() { chiaki_stun_cache_fini(&cache); }
+	} holder;
+	return &holder.cache;
+}
+
 StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObject *parent)
 	: QObject(parent),
-	log(this, connect_info.log_level_mask, connect_info.log_file),
+	log(this, connect_info.log_level_mask, connect_info.log_file, connect_info.log_async),
+	trace_dumps(0),
+	thread_placement_logged(false),
 	ffmpeg_decoder(nullptr),
+	recorder(nullptr),
+	replay(nullptr),
 #if CHIAKI_LIB_ENABLE_PI_DECODER
 	pi_decoder(nullptr),
 #endif
 	audio_out(0),
+	audio_out_sample_size(0),
+	audio_out_rate(0),
+	audio_out_ring_initialized(false),
+	audio_out_target_frames(0),
+	audio_out_fill(0),
+	audio_out_fill_min(SIZE_MAX),
 	audio_in(0),
+	audio_out_device_latency_us(0),
+	mic_ring_initialized(false),
+	mic_rate(0),
+	mic_capture_us(0),
+	mic_thread_stop(false),
+	mic_drain(false),
+#if CHIAKI_GUI_ENABLE_SPEEX
+	echo_write(0),
+	echo_read(0),
+	echo_capture(false),
+	echo_accum_frames(0),
+	echo_accum_play_us(0),
+	aec_frames(0),
+	aec_frames_without_echo(0),
+	aec_echo_skipped(0),
+	aec_process_us_total(0),
+	aec_process_us_max(0),
+#endif
 	haptics_output(0),
 	haptics_handheld(0),
 	session_started(false),
@@ -177,10 +260,6 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 	sdeck_haptics_senderl(nullptr),
 	sdeck_haptics_senderr(nullptr),
 	sdeck(nullptr),
-#endif
-#if CHIAKI_GUI_ENABLE_SPEEX
-	echo_resampler_buf(nullptr),
-	mic_resampler_buf(nullptr),
 #endif
 	haptics_resampler_buf(nullptr),
 	holepunch_session(nullptr),
@@ -190,7 +269,6 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 	rumble_haptics_connected(false),
 	rumble_haptics_on(false)
 {
-	mic_buf.buf = nullptr;
 	connected = false;
 	muted = true;
 	mic_connected = false;
@@ -218,11 +296,11 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 		ffmpeg_decoder = new ChiakiFfmpegDecoder;
 		ChiakiLogSniffer sniffer;
 		chiaki_log_sniffer_init(&sniffer, CHIAKI_LOG_ALL, GetChiakiLog());
-		err = chiaki_ffmpeg_decoder_init(ffmpeg_decoder,
+		err = chiaki_ffmpeg_decoder_init_warm(ffmpeg_decoder,
 				chiaki_log_sniffer_get_log(&sniffer),
 				chiaki_target_is_ps5(connect_info.target) ? connect_info.video_profile.codec : CHIAKI_CODEC_H264,
 				connect_info.hw_decoder.isEmpty() ? NULL : connect_info.hw_decoder.toUtf8().constData(),
-				connect_info.hw_device_ctx, FfmpegFrameCb, this);
+				connect_info.hw_device_ctx, FfmpegFrameCb, this, connect_info.video_warm_start);
 		if(err != CHIAKI_ERR_SUCCESS)
 		{
 			QString log = QString::fromUtf8(chiaki_log_sniffer_get_buffer(&sniffer));
@@ -239,7 +317,13 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 	audio_out_device_name = connect_info.audio_out_device;
 	audio_in_device_name = connect_info.audio_in_device;
 
+	audio_buffer_size = connect_info.audio_buffer_size;
+	audio_target_latency_ms = connect_info.audio_target_latency_ms;
 	chiaki_opus_decoder_init(&opus_decoder, log.GetChiakiLog());
+	// decode off the Takion thread, keeping the output ring at the target latency (set in InitAudio)
+	chiaki_opus_decoder_set_threaded(&opus_decoder,
+			CHIAKI_OPUS_DECODER_JITTER_MIN_DELAY_MS_DEFAULT, CHIAKI_OPUS_DECODER_JITTER_MAX_DELAY_MS_DEFAULT,
+			AudioQueuedCb, audio_buffer_size / (2 * sizeof(int16_t)));
 	chiaki_opus_encoder_init(&opus_encoder, log.GetChiakiLog());
 #if CHIAKI_GUI_ENABLE_SPEEX
 	speech_processing_enabled = connect_info.speech_processing_enabled;
@@ -257,9 +341,10 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 		speex_preprocess_ctl(preprocess_state, SPEEX_PREPROCESS_GET_ECHO_SUPPRESS, &echo_suppress_level);
 		CHIAKI_LOGI(GetChiakiLog(), "Echo suppress level is %i dB", echo_suppress_level);
 		CHIAKI_LOGI(GetChiakiLog(), "Started microphone echo cancellation and noise suppression");
+		for(auto &frame : echo_frames)
+			frame.samples.assign(MICROPHONE_SAMPLES, 0);
 	}
 #endif
-	audio_buffer_size = connect_info.audio_buffer_size;
 	mouse_touch_enabled = connect_info.mouse_touch_enabled;
 	keyboard_controller_enabled = connect_info.keyboard_controller_enabled;
 	host = connect_info.host;
@@ -273,8 +358,22 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 	chiaki_connect_info.enable_keyboard = false;
 	chiaki_connect_info.enable_dualsense = connect_info.enable_dualsense;
 	chiaki_connect_info.packet_loss_max = connect_info.packet_loss_max;
+	chiaki_connect_info.congestion_control_policy = connect_info.congestion_control_policy;
 	chiaki_connect_info.auto_regist = connect_info.auto_regist;
 	chiaki_connect_info.audio_video_disabled = connect_info.audio_video_disabled;
+	// the Pi decoder is set up on its own once the header arrives, only the ffmpeg decoder is opened ahead
+	chiaki_connect_info.video_warm_start = connect_info.video_warm_start && ffmpeg_decoder;
+	chiaki_connect_info.session_resume = connect_info.session_resume;
+	// fec and keystream generation share their workers with all other sessions of this process
+	chiaki_connect_info.thread_pool = true;
+	// without a log directory there is nowhere to write the trace to
+	if(connect_info.trace_events && !connect_info.log_file.isEmpty())
+	{
+		chiaki_connect_info.trace_events = connect_info.trace_events;
+		trace_file_base = connect_info.log_file;
+		if(trace_file_base.endsWith(".log"))
+			trace_file_base.chop(4);
+	}
 
 	dpad_touch_shortcut1 = connect_info.dpad_touch_shortcut1;
 	dpad_touch_shortcut2 = connect_info.dpad_touch_shortcut2;
@@ -340,19 +439,65 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 		if (err != CHIAKI_ERR_SUCCESS)
 			throw ChiakiException("Psn Connection Failed " + QString::fromLocal8Bit(chiaki_error_string(err)));
 		chiaki_connect_info.holepunch_session = holepunch_session;
+		ChiakiHolepunchCandidateHint candidate_hint;
+		if(connect_info.settings->GetHolepunchCandidateHint(connect_info.duid, &candidate_hint))
+			chiaki_holepunch_session_set_candidate_hint(holepunch_session, &candidate_hint);
+		chiaki_holepunch_session_set_stun_cache(holepunch_session, StunCache());
         QByteArray psn_account_id = QByteArray::fromBase64(connect_info.psn_account_id.toUtf8());
         if (psn_account_id.size() != CHIAKI_PSN_ACCOUNT_ID_SIZE) {
             throw ChiakiException((tr("Invalid Account-ID"), tr("The PSN Account-ID must be exactly %1 bytes encoded as base64.")).arg(CHIAKI_PSN_ACCOUNT_ID_SIZE));
         }
         memcpy(chiaki_connect_info.psn_account_id, psn_account_id.constData(), CHIAKI_PSN_ACCOUNT_ID_SIZE);
 	}
+	// before any streaming thread is started
+	err = chiaki_thread_placement_ref(&connect_info.thread_placement);
+	if(err != CHIAKI_ERR_SUCCESS)
+		CHIAKI_LOGW(GetChiakiLog(), "Failed to lock memory for streaming: %s", chiaki_error_string(err));
 	err = chiaki_session_init(&session, &chiaki_connect_info, GetChiakiLog());
 	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		chiaki_thread_placement_unref();
 		throw ChiakiException("Chiaki Session Init failed: " + QString::fromLocal8Bit(chiaki_error_string(err)));
+	}
 	ChiakiCtrlDisplaySink display_sink;
 	display_sink.user = this;
 	display_sink.cantdisplay_cb = CantDisplayCb;
 	chiaki_session_ctrl_set_display_sink(&session, &display_sink);
+	record_codec = chiaki_target_is_ps5(connect_info.target) ? connect_info.video_profile.codec : CHIAKI_CODEC_H264;
+	record_fps = connect_info.video_profile.max_fps;
+	if(!connect_info.record_file.isEmpty())
+	{
+		recorder = new ChiakiRecorder;
+		err = chiaki_recorder_init(recorder, GetChiakiLog(), connect_info.record_file.toLocal8Bit().constData(),
+				record_codec, record_fps, 0);
+		if(err != CHIAKI_ERR_SUCCESS)
+		{
+			CHIAKI_LOGE(GetChiakiLog(), "Failed to start recording: %s", chiaki_error_string(err));
+			delete recorder;
+			recorder = nullptr;
+		}
+	}
+	if(connect_info.replay_seconds)
+	{
+		replay = new ChiakiReplay;
+		err = chiaki_replay_init(replay, (uint64_t)connect_info.replay_seconds * 1000000, connect_info.replay_bytes);
+		if(err != CHIAKI_ERR_SUCCESS)
+		{
+			CHIAKI_LOGE(GetChiakiLog(), "Failed to start replay buffer: %s", chiaki_error_string(err));
+			delete replay;
+			replay = nullptr;
+		}
+	}
+	if(recorder || replay)
+	{
+		ChiakiRecordSink record_sink;
+		record_sink.user = this;
+		record_sink.video_header_cb = RecordVideoHeaderCb;
+		record_sink.video_frame_cb = RecordVideoFrameCb;
+		record_sink.audio_header_cb = RecordAudioHeaderCb;
+		record_sink.audio_frame_cb = RecordAudioFrameCb;
+		chiaki_session_set_record_sink(&session, &record_sink);
+	}
 	chiaki_opus_decoder_set_cb(&opus_decoder, AudioSettingsCb, AudioFrameCb, this);
 	ChiakiAudioSink audio_sink;
 	chiaki_opus_decoder_get_sink(&opus_decoder, &audio_sink);
@@ -387,6 +532,13 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 
 	chiaki_session_set_event_cb(&session, EventCb, this);
 
+	settings = connect_info.settings;
+	if(connect_info.network_profile_cache_enabled)
+	{
+		network_profiles = connect_info.network_profiles;
+		chiaki_session_set_network_profile_cb(&session, NetworkProfileLoadCb, NetworkProfileStoreCb, this);
+	}
+
 #if CHIAKI_GUI_ENABLE_SDL_GAMECONTROLLER
 	connect(ControllerManager::GetInstance(), &ControllerManager::AvailableControllersUpdated, this, &StreamSession::UpdateGamepads);
 	connect(this, &StreamSession::DualSenseIntensityChanged, ControllerManager::GetInstance(), &ControllerManager::SetDualSenseIntensity);
@@ -464,12 +616,10 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 	packet_loss_timer->setInterval(200);
 	packet_loss_timer->start();
 	connect(packet_loss_timer, &QTimer::timeout, this, [this]() {
-		if(packet_loss_history.size() > 10)
-			packet_loss_history.takeFirst();
-		packet_loss_history.append(session.stream_connection.congestion_control.packet_loss);
-		double packet_loss = 0;
-		for(auto v : std::as_const(packet_loss_history))
-			packet_loss += v / packet_loss_history.size();
+		uint64_t received, lost;
+		chiaki_packet_stats_get_window(&session.stream_connection.packet_stats, CHIAKI_PACKET_STATS_WINDOW_1S,
+			chiaki_time_now_monotonic_ms(), &received, &lost);
+		double packet_loss = received + lost ? (double)lost / (received + lost) : 0;
 		if(packet_loss != average_packet_loss)
 		{
 			average_packet_loss = packet_loss;
@@ -480,15 +630,34 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 
 StreamSession::~StreamSession()
 {
-	if(audio_out)
-		SDL_CloseAudioDevice(audio_out);
-	if(audio_in)
-		SDL_CloseAudioDevice(audio_in);
+	StopMic();
 	if(session_started)
 		chiaki_session_join(&session);
+	if(!trace_file_base.isEmpty())
+		chiaki_session_trace_dump(&session, QString(trace_file_base + ".trace").toLocal8Bit().constData());
 	chiaki_session_fini(&session);
+	// nothing pushes anymore, finishes the file
+	if(recorder)
+	{
+		chiaki_recorder_fini(recorder);
+		delete recorder;
+	}
+	// saves log to this session
+	replay_saves.waitForFinished();
+	if(replay)
+	{
+		chiaki_replay_fini(replay);
+		delete replay;
+	}
+	// the streaming threads are gone, unlocks memory if this was the last session
+	chiaki_thread_placement_unref();
+	// stops the audio thread, which may still be pushing to audio_out
 	chiaki_opus_decoder_fini(&opus_decoder);
 	chiaki_opus_encoder_fini(&opus_encoder);
+	if(audio_out)
+		SDL_CloseAudioDevice(audio_out);
+	if(audio_out_ring_initialized)
+		chiaki_audio_ring_fini(&audio_out_ring);
 #if CHIAKI_GUI_ENABLE_SPEEX
 	if(speech_processing_enabled)
 	{
@@ -546,26 +715,6 @@ StreamSession::~StreamSession()
 		free(sdeck_haptics_senderr);
 		sdeck_haptics_senderr = nullptr;
 	}
-#endif
-	if(mic_buf.buf)
-	{
-		free(mic_buf.buf);
-		mic_buf.buf = nullptr;
-	}
-#if CHIAKI_GUI_ENABLE_SPEEX
-	if(speech_processing_enabled)
-	{
-		if(mic_resampler_buf)
-		{
-			free(mic_resampler_buf);
-			mic_resampler_buf = nullptr;
-		}
-		if(echo_resampler_buf)
-		{
-			free(echo_resampler_buf);
-			echo_resampler_buf = nullptr;
-		}
-	}
 #endif
 }
 
@@ -628,7 +777,18 @@ void StreamSession::ToggleMute()
 			controller->SetDualsenseMic(muted);
 	});
 	if(audio_in)
+	{
 		SDL_PauseAudioDevice(audio_in, muted);
+		if(muted && mic_thread.joinable())
+		{
+			// pausing only stops new capture, the mic thread drops what is still in mic_ring
+			{
+				std::lock_guard<std::mutex> lock(mic_mutex);
+				mic_drain = true;
+			}
+			mic_cond.notify_one();
+		}
+	}
 	emit MutedChanged();
 }
 
@@ -1094,19 +1254,47 @@ void StreamSession::SendFeedbackState()
 
 void StreamSession::InitAudio(unsigned int channels, unsigned int rate)
 {
+	// the same stream again after a session resume, keep the device and what is still buffered
+	if(audio_out && audio_out_rate == rate && audio_out_sample_size == sizeof(int16_t) * channels)
+		return;
 	allow_unmute = true;
 	if(start_mic_unmuted)
 		ToggleMute();
 	if(audio_out)
+	{
 		SDL_CloseAudioDevice(audio_out);
+		audio_out = 0;
+	}
+	if(audio_out_ring_initialized)
+	{
+		chiaki_audio_ring_fini(&audio_out_ring);
+		audio_out_ring_initialized = false;
+	}
 
 	SDL_AudioSpec spec = {0};
 	spec.freq = rate;
 	spec.channels = channels;
 	spec.format = AUDIO_S16SYS;
+	spec.callback = AudioOutCb;
+	spec.userdata = this;
 	audio_out_sample_size = sizeof(int16_t) * channels;
+	audio_out_rate = rate;
 	spec.samples = audio_buffer_size / audio_out_sample_size;
 
+	// the device pulls a whole buffer per callback, so less than that buffered would underrun every time
+	audio_out_target_frames = std::max<size_t>((size_t)audio_target_latency_ms * rate / 1000, spec.samples);
+	ChiakiErrorCode err = chiaki_audio_ring_init(&audio_out_ring, channels, audio_out_target_frames * AUDIO_OUT_RING_TARGET_FACTOR);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(log.GetChiakiLog(), "Failed to init Audio Output ring: %s", chiaki_error_string(err));
+		return;
+	}
+	audio_out_ring_initialized = true;
+	audio_out_fill = 0;
+	audio_out_fill_min = SIZE_MAX;
+	// the decoder thread is not running while its settings callback is
+	opus_decoder.output_target_samples = audio_out_target_frames;
+
 	SDL_AudioSpec obtained;
 	audio_out = SDL_OpenAudioDevice(audio_out_device_name.isEmpty() ? nullptr : qUtf8Printable(audio_out_device_name), false, &spec, &obtained, false);
 	if(!audio_out)
@@ -1125,72 +1313,68 @@ void StreamSession::InitAudio(unsigned int channels, unsigned int rate)
 	if(audio_out_device_name.isEmpty())
 		audio_out_device_name = "Auto";
 
-	audio_out_drain_queue = false;
+	// one buffer is queued in the device at all times
+	audio_out_device_latency_us = (uint64_t)obtained.samples * 1000000 / rate;
+#if CHIAKI_GUI_ENABLE_SPEEX
+	if(speech_processing_enabled)
+	{
+		echo_accum_frames = 0;
+		if(SDL_BuildAudioCVT(&echo_cvt, AUDIO_S16SYS, channels, rate, AUDIO_S16SYS, 1, rate) < 0)
+		{
+			CHIAKI_LOGE(log.GetChiakiLog(), "Failed to build echo reference converter: %s", SDL_GetError());
+			echo_accum.clear();
+		}
+		else
+			echo_accum.assign(MICROPHONE_SAMPLES * channels * echo_cvt.len_mult, 0);
+	}
+#endif
 
 	SDL_PauseAudioDevice(audio_out, 0);
 
-	CHIAKI_LOGI(log.GetChiakiLog(), "Audio Device '%s' opened with %u channels @ %d Hz, buffer size %u",
-				qPrintable(audio_out_device_name), obtained.channels, obtained.freq, obtained.size);
+	CHIAKI_LOGI(log.GetChiakiLog(), "Audio Device '%s' opened with %u channels @ %d Hz, buffer size %u, target latency %llu ms",
+				qPrintable(audio_out_device_name), obtained.channels, obtained.freq, obtained.size,
+				(unsigned long long)(audio_out_target_frames * 1000 / rate));
 }
 
 void StreamSession::InitMic(unsigned int channels, unsigned int rate)
 {
-	if(audio_in)
-		SDL_CloseAudioDevice(audio_in);
+	StopMic();
 
-	mic_buf.buf = nullptr;
-#if CHIAKI_GUI_ENABLE_SPEEX
-	mic_resampler_buf = nullptr;
-	echo_resampler_buf = nullptr;
-#endif
+	mic_rate = rate;
+	mic_frame.assign(channels * MICROPHONE_SAMPLES, 0);
 
-	mic_buf.current_byte = 0;
-	int16_t mic_buf_size = channels * MICROPHONE_SAMPLES;
-	mic_buf.size_bytes = mic_buf_size * sizeof(int16_t);
-	mic_buf.buf = (int16_t*) calloc(mic_buf_size, sizeof(int16_t));
-	if(!mic_buf.buf)
+	SDL_AudioSpec spec = {0};
+	spec.freq = rate;
+	spec.channels = channels;
+	spec.format = AUDIO_S16SYS;
+	spec.samples = audio_buffer_size / 4;
+	spec.callback = AudioInCb;
+	spec.userdata = this;
+
+	// room for a few capture buffers in case the mic thread falls behind
+	ChiakiErrorCode err = chiaki_audio_ring_init(&mic_ring, channels, std::max<size_t>(spec.samples, MICROPHONE_SAMPLES) * 4);
+	if(err != CHIAKI_ERR_SUCCESS)
 	{
-		CHIAKI_LOGE(GetChiakiLog(), "Could not allocate memory for mic buf, aborting mic startup");
+		CHIAKI_LOGE(GetChiakiLog(), "Could not init mic ring: %s, aborting mic startup", chiaki_error_string(err));
 		return;
 	}
+	mic_ring_initialized = true;
 
 #if CHIAKI_GUI_ENABLE_SPEEX
 	if(speech_processing_enabled)
 	{
-		SDL_AudioCVT cvt;
-		SDL_BuildAudioCVT(&cvt, AUDIO_S16SYS, 1, 48000, AUDIO_S16SYS, 2, 48000);
-		cvt.len = mic_buf.size_bytes;
-		mic_resampler_buf = (uint8_t*) calloc(cvt.len * cvt.len_mult, sizeof(uint8_t));
-		if(!mic_resampler_buf)
-		{
-			CHIAKI_LOGE(GetChiakiLog(), "Mic resampler buf could not be created, aborting mic startup");
-			return;
-		}
-
-		SDL_AudioCVT cvt2;
-		SDL_BuildAudioCVT(&cvt2, AUDIO_S16SYS, 2, 48000, AUDIO_S16SYS, 1, 48000);
-		cvt2.len = cvt.len * cvt.len_ratio;
-		echo_resampler_buf = (uint8_t*) calloc(cvt2.len * cvt2.len_mult, sizeof(uint8_t));
-		if(!echo_resampler_buf)
+		if(SDL_BuildAudioCVT(&mic_cvt, AUDIO_S16SYS, 1, rate, AUDIO_S16SYS, 2, rate) < 0)
 		{
-			CHIAKI_LOGE(GetChiakiLog(), "Echo resampler buf could not be created, aborting mic startup");
+			CHIAKI_LOGE(GetChiakiLog(), "Mic converter could not be created: %s, aborting mic startup", SDL_GetError());
 			return;
 		}
+		mic_cvt.len = MICROPHONE_SAMPLES * sizeof(int16_t);
+		mic_cvt_buf.assign(mic_cvt.len * mic_cvt.len_mult, 0);
+		aec_frame.assign(MICROPHONE_SAMPLES, 0);
+		aec_echo_frame.assign(MICROPHONE_SAMPLES, 0);
 	}
 #endif
 
-	SDL_AudioSpec spec = {0};
-	spec.freq = rate;
-	spec.channels = channels;
-	spec.format = AUDIO_S16SYS;
-	spec.samples = audio_buffer_size / 4;
-	spec.callback = [](void *userdata, Uint8 *stream, int len) {
-		auto s = static_cast<StreamSession*>(userdata);
-		QByteArray data(reinterpret_cast<char*>(stream), len);
-		QMetaObject::invokeMethod(s, std::bind(&StreamSession::ReadMic, s, data));
-	};
-	spec.userdata = this;
-
 	SDL_AudioSpec obtained;
 	audio_in = SDL_OpenAudioDevice(audio_in_device_name.isEmpty() ? nullptr : qUtf8Printable(audio_in_device_name), true, &spec, &obtained, false);
 	if(!audio_in)
@@ -1210,114 +1394,203 @@ void StreamSession::InitMic(unsigned int channels, unsigned int rate)
 	if(audio_in_device_name.isEmpty())
 		audio_in_device_name = "Auto";
 
+	mic_thread_stop = false;
+	mic_drain = false;
+	mic_thread = std::thread(&StreamSession::MicThreadFunc, this);
+#if CHIAKI_GUI_ENABLE_SPEEX
+	echo_capture = speech_processing_enabled;
+#endif
+
 	CHIAKI_LOGI(log.GetChiakiLog(), "Microphone '%s' opened with %u channels @ %u Hz, buffer size %u",
 			qPrintable(audio_in_device_name), obtained.channels, obtained.freq, obtained.size);
 }
 
-void StreamSession::ReadMic(const QByteArray &micdata)
+void StreamSession::StopMic()
 {
+	if(audio_in)
+	{
+		SDL_CloseAudioDevice(audio_in);
+		audio_in = 0;
+	}
 #if CHIAKI_GUI_ENABLE_SPEEX
-	int16_t echo_buf[mic_buf.size_bytes / sizeof(int16_t)];
+	echo_capture = false;
 #endif
-	uint32_t mic_bytes_left = mic_buf.size_bytes - mic_buf.current_byte;
-	// Don't send mic data if muted
-	if(muted)
-		return;
-	qint64 bytes_read = micdata.size();
-	const char * micdataread = micdata.constData();
-	if(bytes_read == 0)
-		return;
-	if(bytes_read < mic_bytes_left)
+	if(mic_thread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(mic_mutex);
+			mic_thread_stop = true;
+		}
+		mic_cond.notify_one();
+		mic_thread.join();
+	}
+	if(mic_ring_initialized)
 	{
-		memcpy((uint8_t *)mic_buf.buf + mic_buf.current_byte, (uint8_t *)micdataread, bytes_read);
-		mic_buf.current_byte += bytes_read;
+		chiaki_audio_ring_fini(&mic_ring);
+		mic_ring_initialized = false;
 	}
-	else
+}
+
+void StreamSession::PushMic(const uint8_t *stream, size_t len)
+{
+	chiaki_audio_ring_write(&mic_ring, reinterpret_cast<const int16_t *>(stream), len / (mic_ring.channels * sizeof(int16_t)));
+	mic_capture_us = chiaki_time_now_monotonic_us();
 	{
-		memcpy((uint8_t *)mic_buf.buf + mic_buf.current_byte, (uint8_t *)micdataread, mic_bytes_left);
-#if CHIAKI_GUI_ENABLE_SPEEX
-		SDL_AudioCVT cvt;
-		if(speech_processing_enabled)
+		// so the notification can't slip in between the mic thread checking the ring and waiting
+		std::lock_guard<std::mutex> lock(mic_mutex);
+	}
+	mic_cond.notify_one();
+}
+
+void StreamSession::MicThreadFunc()
+{
+	chiaki_thread_apply_role(CHIAKI_THREAD_ROLE_AUDIO);
+	std::unique_lock<std::mutex> lock(mic_mutex);
+	while(true)
+	{
+		mic_cond.wait(lock, [this] {
+			return mic_thread_stop || mic_drain || chiaki_audio_ring_fill(&mic_ring) >= MICROPHONE_SAMPLES;
+		});
+		if(mic_thread_stop)
+			break;
+		if(mic_drain)
 		{
-			// change samples to stereo after processing with SPEEX
-			SDL_BuildAudioCVT(&cvt, AUDIO_S16SYS, 1, 48000, AUDIO_S16SYS, 2, 48000);
-			cvt.len = mic_buf.size_bytes;
-			cvt.buf = mic_resampler_buf;
-			if(!echo_to_cancel.isEmpty())
-			{
-				int16_t *echo = echo_to_cancel.dequeue();
-				speex_echo_cancellation(echo_state, mic_buf.buf, echo, echo_buf);
-				speex_preprocess_run(preprocess_state, echo_buf);
-				memcpy((uint8_t *)mic_resampler_buf, (uint8_t *)echo_buf, mic_buf.size_bytes);
-				if(SDL_ConvertAudio(&cvt) != 0)
-				{
-					CHIAKI_LOGE(log.GetChiakiLog(), "Failed to resample mic audio: %s", SDL_GetError());
-					return;
-				}
-				chiaki_opus_encoder_frame((int16_t *)mic_resampler_buf, &opus_encoder);
-			}
-			else
-			{
-				speex_preprocess_run(preprocess_state, (int16_t *)mic_buf.buf);
-				memcpy((uint8_t *)mic_resampler_buf, (uint8_t *)mic_buf.buf, mic_buf.size_bytes);
-				if(SDL_ConvertAudio(&cvt) != 0)
-				{
-					CHIAKI_LOGE(log.GetChiakiLog(), "Failed to resample mic audio: %s", SDL_GetError());
-					return;
-				}
-				chiaki_opus_encoder_frame((int16_t *)mic_resampler_buf, &opus_encoder);
-			}
+			mic_drain = false;
+			chiaki_audio_ring_clear(&mic_ring);
+			continue;
 		}
-		else
-			chiaki_opus_encoder_frame(mic_buf.buf, &opus_encoder);
-#else
-	    chiaki_opus_encoder_frame(mic_buf.buf, &opus_encoder);
-#endif
-		bytes_read -= mic_bytes_left;
-		uint32_t frames = bytes_read / mic_buf.size_bytes;
-		for (int i = 0; i < frames; i++)
-		{
-			memcpy((uint8_t *)mic_buf.buf, (uint8_t *)micdataread + mic_bytes_left + i * mic_buf.size_bytes, mic_buf.size_bytes);
+		lock.unlock();
+		while(chiaki_audio_ring_fill(&mic_ring) >= MICROPHONE_SAMPLES)
+			ProcessMicFrame();
+		lock.lock();
+	}
+}
+
+void StreamSession::ProcessMicFrame()
+{
+	if(muted)
+	{
+		// captured before muting, don't send it
+		chiaki_audio_ring_clear(&mic_ring);
+		return;
+	}
+
+	// read the time before the fill, so a capture callback in between only makes the frame look older
+	uint64_t capture_cb_us = mic_capture_us;
+	chiaki_audio_ring_read(&mic_ring, mic_frame.data(), MICROPHONE_SAMPLES);
+	uint64_t behind_us = (uint64_t)(chiaki_audio_ring_fill(&mic_ring) + MICROPHONE_SAMPLES) * 1000000 / mic_rate;
+	uint64_t capture_us = capture_cb_us > behind_us ? capture_cb_us - behind_us : 0;
+
+	int16_t *pcm = mic_frame.data();
 #if CHIAKI_GUI_ENABLE_SPEEX
-		if(speech_processing_enabled)
+	if(speech_processing_enabled)
+	{
+		uint64_t start_us = chiaki_time_now_monotonic_us();
+		if(PopEchoReference(capture_us))
 		{
-			if(!echo_to_cancel.isEmpty())
-			{
-				int16_t *echo = echo_to_cancel.dequeue();
-				speex_echo_cancellation(echo_state, mic_buf.buf, echo, echo_buf);
-				speex_preprocess_run(preprocess_state, echo_buf);
-				memcpy((uint8_t *)mic_resampler_buf, (uint8_t *)echo_buf, mic_buf.size_bytes);
-				if(SDL_ConvertAudio(&cvt) != 0)
-				{
-					CHIAKI_LOGE(log.GetChiakiLog(), "Failed to resample mic audio: %s", SDL_GetError());
-					return;
-				}
-				chiaki_opus_encoder_frame((int16_t *)mic_resampler_buf, &opus_encoder);
-			}
-			else
-			{
-				speex_preprocess_run(preprocess_state, (int16_t *)mic_buf.buf);
-				memcpy((uint8_t *)mic_resampler_buf, (uint8_t *)mic_buf.buf, mic_buf.size_bytes);
-				if(SDL_ConvertAudio(&cvt) != 0)
-				{
-					CHIAKI_LOGE(log.GetChiakiLog(), "Failed to resample mic audio: %s", SDL_GetError());
-					return;
-				}
-				chiaki_opus_encoder_frame((int16_t *)mic_resampler_buf, &opus_encoder);
-			}
+			speex_echo_cancellation(echo_state, mic_frame.data(), aec_echo_frame.data(), aec_frame.data());
+			pcm = aec_frame.data();
 		}
 		else
-			chiaki_opus_encoder_frame(mic_buf.buf, &opus_encoder);
+			aec_frames_without_echo++;
+		speex_preprocess_run(preprocess_state, pcm);
+		uint64_t process_us = chiaki_time_now_monotonic_us() - start_us;
+		aec_frames++;
+		aec_process_us_total += process_us;
+		if(process_us > aec_process_us_max)
+			aec_process_us_max = process_us;
+
+		// change samples to stereo after processing with SPEEX
+		memcpy(mic_cvt_buf.data(), pcm, MICROPHONE_SAMPLES * sizeof(int16_t));
+		mic_cvt.buf = mic_cvt_buf.data();
+		mic_cvt.len = MICROPHONE_SAMPLES * sizeof(int16_t);
+		if(SDL_ConvertAudio(&mic_cvt) != 0)
+		{
+			CHIAKI_LOGE(log.GetChiakiLog(), "Failed to resample mic audio: %s", SDL_GetError());
+			return;
+		}
+		pcm = reinterpret_cast<int16_t *>(mic_cvt_buf.data());
+	}
 #else
-	    chiaki_opus_encoder_frame(mic_buf.buf, &opus_encoder);
+	(void)capture_us;
 #endif
-		}
-		mic_buf.current_byte = bytes_read % mic_buf.size_bytes;
-		if(mic_buf.current_byte == 0)
-			return;
-		memcpy((uint8_t *)mic_buf.buf, (uint8_t *)micdataread + mic_bytes_left + frames * mic_buf.size_bytes, mic_buf.current_byte);
+	if(muted)
+		return;
+	chiaki_opus_encoder_frame(pcm, &opus_encoder);
+}
+
+#if CHIAKI_GUI_ENABLE_SPEEX
+void StreamSession::PushEchoReference(const int16_t *buf, size_t frames, uint64_t play_us)
+{
+	if(echo_accum.empty())
+		return;
+	size_t offset = 0;
+	while(offset < frames)
+	{
+		if(!echo_accum_frames)
+			echo_accum_play_us = play_us + (uint64_t)offset * 1000000 / audio_out_rate;
+		size_t count = std::min(frames - offset, (size_t)MICROPHONE_SAMPLES - echo_accum_frames);
+		memcpy((uint8_t *)echo_accum.data() + echo_accum_frames * audio_out_sample_size,
+				(const uint8_t *)buf + offset * audio_out_sample_size, count * audio_out_sample_size);
+		echo_accum_frames += count;
+		offset += count;
+		if(echo_accum_frames < MICROPHONE_SAMPLES)
+			break;
+		echo_accum_frames = 0;
+
+		uint32_t w = echo_write.load(std::memory_order_relaxed);
+		// full, the mic thread skips stale references by their timestamp once it catches up
+		if(w - echo_read.load(std::memory_order_acquire) >= ECHO_RING_FRAMES)
+			continue;
+		echo_cvt.buf = reinterpret_cast<uint8_t *>(echo_accum.data());
+		echo_cvt.len = MICROPHONE_SAMPLES * audio_out_sample_size;
+		if(SDL_ConvertAudio(&echo_cvt) != 0)
+			continue;
+		EchoFrame &frame = echo_frames[w % ECHO_RING_FRAMES];
+		frame.play_us = echo_accum_play_us;
+		memcpy(frame.samples.data(), echo_accum.data(), MICROPHONE_SAMPLES * sizeof(int16_t));
+		echo_write.store(w + 1, std::memory_order_release);
 	}
 }
+
+bool StreamSession::PopEchoReference(uint64_t capture_us)
+{
+	uint64_t half_frame_us = (uint64_t)MICROPHONE_SAMPLES * 1000000 / mic_rate / 2;
+	uint32_t r = echo_read.load(std::memory_order_relaxed);
+	uint32_t w = echo_write.load(std::memory_order_acquire);
+	bool found = false;
+	for(; r != w; r++)
+	{
+		EchoFrame &frame = echo_frames[r % ECHO_RING_FRAMES];
+		if(frame.play_us + half_frame_us < capture_us)
+		{
+			// played out before this mic frame was captured
+			aec_echo_skipped++;
+			continue;
+		}
+		if(frame.play_us > capture_us + half_frame_us)
+			break; // not played yet at capture time
+		memcpy(aec_echo_frame.data(), frame.samples.data(), MICROPHONE_SAMPLES * sizeof(int16_t));
+		found = true;
+		r++;
+		break;
+	}
+	echo_read.store(r, std::memory_order_release);
+	return found;
+}
+
+AecStats StreamSession::GetAecStats()
+{
+	AecStats stats = {};
+	stats.frames = aec_frames;
+	stats.frames_without_echo = aec_frames_without_echo;
+	stats.echo_frames_skipped = aec_echo_skipped;
+	stats.process_avg_us = stats.frames ? (double)aec_process_us_total / stats.frames : 0.0;
+	stats.process_max_us = aec_process_us_max;
+	return stats;
+}
+#endif
+
 void StreamSession::InitHaptics()
 {
 	haptics_output = 0;
@@ -1556,51 +1829,169 @@ void StreamSession::ConnectSdeckHaptics()
 }
 #endif
 
-void StreamSession::PushAudioFrame(int16_t *og_buf, size_t samples_count)
+size_t StreamSession::GetQueuedAudioSamples()
 {
-	if(!audio_out || !audio_volume)
-		return;
+	if(!audio_out)
+		return 0;
+	return chiaki_audio_ring_fill(&audio_out_ring);
+}
 
-	// 2 Channels per sample
-	int16_t buf[samples_count * 2];
-	SDL_memset(buf, 0, sizeof(buf));
+AudioOutStats StreamSession::GetAudioOutStats()
+{
+	AudioOutStats stats = {};
+	if(!audio_out_ring_initialized || !audio_out_rate)
+		return stats;
+	double ms_per_frame = 1000.0 / audio_out_rate;
+	size_t fill_min = audio_out_fill_min.exchange(SIZE_MAX);
+	stats.fill_ms = audio_out_fill * ms_per_frame;
+	stats.fill_min_ms = (fill_min == SIZE_MAX ? audio_out_fill.load() : fill_min) * ms_per_frame;
+	stats.target_ms = audio_out_target_frames * ms_per_frame;
+	ChiakiAudioRingStats ring_stats;
+	chiaki_audio_ring_get_stats(&audio_out_ring, &ring_stats);
+	stats.underrun_frames = ring_stats.underrun;
+	stats.overflow_frames = ring_stats.overflow;
+	return stats;
+}
 
-	// qDebug() << "Audio queue" << (SDL_GetQueuedAudioSize(audio_out) / audio_out_sample_size / samples_count) * 10 << "ms";
-	// Start draining queue when the latency gets too high
-	if(SDL_GetQueuedAudioSize(audio_out) > 3 * audio_buffer_size)
-		audio_out_drain_queue = true;
+ChiakiCongestionControlStats StreamSession::GetCongestionControlStats()
+{
+	ChiakiCongestionControlStats stats;
+	chiaki_congestion_control_get_stats(&session.stream_connection.congestion_control, &stats);
+	return stats;
+}
 
-	if(audio_out_drain_queue)
+void StreamSession::LogThreadPlacement()
+{
+	ChiakiThreadPlacementReport report;
+	chiaki_thread_placement_get_report(&report);
+	for(int i=0; i<CHIAKI_THREAD_ROLE_COUNT; i++)
 	{
-		// Stop when the queue is smaller than configured buffer size
-		if(SDL_GetQueuedAudioSize(audio_out) >= audio_buffer_size)
-			return;
-		audio_out_drain_queue = false;
+		const ChiakiThreadPlacementEffective &effective = report.roles[i];
+		if(!effective.threads)
+			continue;
+		char cpus[0x100];
+		chiaki_thread_format_cpu_list(effective.cpu_mask, cpus, sizeof(cpus));
+		if(effective.err == CHIAKI_ERR_SUCCESS)
+			CHIAKI_LOGI(GetChiakiLog(), "Thread placement %s: %u thread(s) on cpus %s, priority %s (%d)",
+					chiaki_thread_role_string(static_cast<ChiakiThreadRole>(i)), effective.threads, cpus,
+					chiaki_thread_priority_string(effective.priority), effective.priority_value);
+		else
+			CHIAKI_LOGW(GetChiakiLog(), "Thread placement %s could not be applied, running on cpus %s, priority %s (%d)",
+					chiaki_thread_role_string(static_cast<ChiakiThreadRole>(i)), cpus,
+					chiaki_thread_priority_string(effective.priority), effective.priority_value);
 	}
-	if(audio_volume < SDL_MIX_MAXVOLUME)
-		SDL_MixAudioFormat((uint8_t *)buf, (uint8_t *)og_buf, AUDIO_S16SYS, sizeof(buf), audio_volume);
-	else
-		memcpy(buf, og_buf, sizeof(buf));
-#if CHIAKI_GUI_ENABLE_SPEEX
-	// change samples to mono for processing with SPEEX
-	if(echo_resampler_buf && speech_processing_enabled && !muted)
-	{
-		SDL_AudioCVT cvt;
-		SDL_BuildAudioCVT(&cvt, AUDIO_S16SYS, 2, 48000, AUDIO_S16SYS, 1, 48000);
-		cvt.len = mic_buf.size_bytes * 2;
-		cvt.buf = echo_resampler_buf;
-		memcpy(echo_resampler_buf, buf, mic_buf.size_bytes * 2);
-		if(SDL_ConvertAudio(&cvt) != 0)
-		{
-			CHIAKI_LOGE(log.GetChiakiLog(), "Failed to resample echo audio: %s", SDL_GetError());
-			return;
-		}
-		if(echo_to_cancel.size() >= ECHO_QUEUE_MAX)
-			echo_to_cancel.dequeue();
-		echo_to_cancel.enqueue((int16_t *)echo_resampler_buf);
+	if(report.memory_locked)
+		CHIAKI_LOGI(GetChiakiLog(), "Memory locked while streaming");
+}
+
+QString StreamSession::DumpTrace()
+{
+	if(trace_file_base.isEmpty())
+		return QString();
+	QString path = QString("%1_%2.trace").arg(trace_file_base).arg(++trace_dumps);
+	if(chiaki_session_trace_dump(&session, path.toLocal8Bit().constData()) != CHIAKI_ERR_SUCCESS)
+		return QString();
+	return path;
+}
+
+QString StreamSession::SaveReplay()
+{
+	if(!replay)
+		return QString();
+	auto snapshot = std::make_shared<ChiakiReplaySnapshot>();
+	ChiakiErrorCode err = chiaki_replay_snapshot(replay, snapshot.get());
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGW(GetChiakiLog(), "Replay buffer has nothing to save: %s", chiaki_error_string(err));
+		return QString();
+	}
+	QString path = CreateRecordingFilename("chiaki_replay_");
+	if(path.isEmpty())
+	{
+		chiaki_replay_snapshot_fini(snapshot.get());
+		return QString();
 	}
+	ChiakiLog *log = GetChiakiLog();
+	QByteArray path_local = path.toLocal8Bit();
+	ChiakiCodec codec = record_codec;
+	unsigned int fps = record_fps;
+	replay_saves.addFuture(QtConcurrent::run([log, path_local, codec, fps, snapshot]() {
+		chiaki_recorder_save_replay(log, path_local.constData(), codec, fps, snapshot.get());
+		chiaki_replay_snapshot_fini(snapshot.get());
+	}));
+	return path;
+}
+
+void StreamSession::PushRecordVideoHeader(uint8_t *buf, size_t buf_size, unsigned int width, unsigned int height)
+{
+	if(recorder)
+		chiaki_recorder_push_video_header(recorder, buf, buf_size, width, height);
+	if(replay)
+		chiaki_replay_push_video_header(replay, buf, buf_size, width, height);
+}
+
+void StreamSession::PushRecordVideoFrame(uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index, bool keyframe)
+{
+	uint64_t arrival_us = chiaki_time_now_monotonic_us();
+	if(recorder)
+		chiaki_recorder_push_video_frame(recorder, buf, buf_size, frame_index, keyframe, arrival_us);
+	if(replay)
+		chiaki_replay_push_video_frame(replay, buf, buf_size, frame_index, keyframe, arrival_us);
+}
+
+void StreamSession::PushRecordAudioHeader(ChiakiAudioHeader *header)
+{
+	if(recorder)
+		chiaki_recorder_push_audio_header(recorder, header);
+	if(replay)
+		chiaki_replay_push_audio_header(replay, header);
+}
+
+void StreamSession::PushRecordAudioFrame(uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index)
+{
+	uint64_t arrival_us = chiaki_time_now_monotonic_us();
+	if(recorder)
+		chiaki_recorder_push_audio_frame(recorder, buf, buf_size, frame_index, arrival_us);
+	if(replay)
+		chiaki_replay_push_audio_frame(replay, buf, buf_size, frame_index, arrival_us);
+}
+
+ChiakiSessionResumeStats StreamSession::GetResumeStats()
+{
+	ChiakiSessionResumeStats stats;
+	chiaki_session_get_resume_stats(&session, &stats);
+	return stats;
+}
+
+void StreamSession::PullAudio(uint8_t *stream, size_t len)
+{
+	int16_t *buf = reinterpret_cast<int16_t *>(stream);
+	size_t channels = audio_out_sample_size / sizeof(int16_t);
+	size_t frames = len / audio_out_sample_size;
+
+	size_t fill = chiaki_audio_ring_fill(&audio_out_ring);
+	audio_out_fill = fill;
+	size_t fill_min = audio_out_fill_min.load();
+	while(fill < fill_min && !audio_out_fill_min.compare_exchange_weak(fill_min, fill));
+
+	size_t read = chiaki_audio_ring_read(&audio_out_ring, buf, frames);
+	if(read < frames)
+		memset(buf + read * channels, 0, (frames - read) * audio_out_sample_size);
+	chiaki_audio_apply_volume(buf, buf, read * channels, audio_volume.load(std::memory_order_relaxed));
+#if CHIAKI_GUI_ENABLE_SPEEX
+	// exactly what is played out, so the echo canceller sees the real reference
+	if(echo_capture.load(std::memory_order_relaxed))
+		PushEchoReference(buf, frames, chiaki_time_now_monotonic_us() + audio_out_device_latency_us);
 #endif
-	SDL_QueueAudio(audio_out, buf, samples_count * audio_out_sample_size);
+}
+
+void StreamSession::PushAudioFrame(int16_t *buf, size_t samples_count)
+{
+	if(!audio_out)
+		return;
+
+	// volume is applied when the device pulls the samples
+	chiaki_audio_ring_write(&audio_out_ring, buf, samples_count);
 }
 
 #ifdef Q_OS_MACOS
@@ -1792,13 +2183,43 @@ void StreamSession::SdeckQueueHaptics(haptic_packet_t packetl, haptic_packet_t p
 }
 #endif
 
+bool StreamSession::LoadNetworkProfile(const char *key, ChiakiNetworkProfile *profile)
+{
+	auto it = network_profiles.constFind(QString::fromUtf8(key));
+	if(it == network_profiles.constEnd())
+		return false;
+	*profile = it.value();
+	return true;
+}
+
+void StreamSession::StoreNetworkProfile(const char *key, const ChiakiNetworkProfile *profile)
+{
+	// called from the session thread, QSettings must only be touched from the thread of settings
+	QString key_str = QString::fromUtf8(key);
+	bool remove = !profile;
+	ChiakiNetworkProfile profile_copy = {};
+	if(profile)
+		profile_copy = *profile;
+	QMetaObject::invokeMethod(settings, [target = settings, key_str, remove, profile_copy]() {
+		target->SetNetworkProfile(key_str, remove ? nullptr : &profile_copy);
+	}, Qt::QueuedConnection);
+}
+
 void StreamSession::Event(ChiakiEvent *event)
 {
 	switch(event->type)
 	{
 		case CHIAKI_EVENT_CONNECTED:
+			// again after a resume, the first frame was measured already
+			if(ffmpeg_decoder && !connected)
+				chiaki_ffmpeg_decoder_stream_connected(ffmpeg_decoder);
 			connect_timer.invalidate();
 			connected = true;
+			if(!thread_placement_logged)
+			{
+				thread_placement_logged = true;
+				LogThreadPlacement();
+			}
 			emit ConnectedChanged();
 			break;
 		case CHIAKI_EVENT_QUIT:
@@ -1823,6 +2244,26 @@ void StreamSession::Event(ChiakiEvent *event)
 		case CHIAKI_EVENT_NICKNAME_RECEIVED:
 			emit NicknameReceived(event->server_nickname);
 			break;
+		case CHIAKI_EVENT_RESUME: {
+			bool resuming_now = !event->resume.finished;
+			if(event->resume.finished && !event->resume.success)
+				CHIAKI_LOGE(GetChiakiLog(), "Resuming the session failed after %u attempts", event->resume.attempt);
+			QMetaObject::invokeMethod(this, [this, resuming_now]() {
+				if(resuming == resuming_now)
+					return;
+				resuming = resuming_now;
+				emit ResumingChanged();
+			});
+			break;
+		}
+		case CHIAKI_EVENT_STARTUP_TIMELINE: {
+			ChiakiSessionTimeline timeline = event->startup_timeline;
+			QMetaObject::invokeMethod(this, [this, timeline]() {
+				startup_timeline = timeline;
+				has_startup_timeline = true;
+			});
+			break;
+		}
 		case CHIAKI_EVENT_RUMBLE: {
 			if(ps5_rumble_intensity < 0)
 				return;
@@ -2187,6 +2628,15 @@ ChiakiErrorCode StreamSession::ConnectPsnConnection(QString duid, bool ps5)
 		return err;
 	}
 	CHIAKI_LOGI(log, ">> Punched hole for control connection!");
+
+	ChiakiHolepunchCandidateHint candidate_hint;
+	if(chiaki_holepunch_session_get_candidate_hint(holepunch_session, &candidate_hint))
+	{
+		// called from the psn connection worker, QSettings must only be touched from the thread of settings
+		QMetaObject::invokeMethod(settings, [target = settings, duid, candidate_hint]() {
+			target->SetHolepunchCandidateHint(duid, candidate_hint);
+		}, Qt::QueuedConnection);
+	}
 	return err;
 }
 
@@ -2219,12 +2669,21 @@ class StreamSessionPrivate
 		}
 
 		static void PushAudioFrame(StreamSession *session, int16_t *buf, size_t samples_count)	{ session->PushAudioFrame(buf, samples_count); }
+		static size_t GetQueuedAudioSamples(StreamSession *session)								{ return session->GetQueuedAudioSamples(); }
+		static void PullAudio(StreamSession *session, uint8_t *stream, size_t len)					{ session->PullAudio(stream, len); }
+		static void PushMic(StreamSession *session, const uint8_t *stream, size_t len)				{ session->PushMic(stream, len); }
 		static void PushHapticsFrame(StreamSession *session, uint8_t *buf, size_t buf_size)	{ session->PushHapticsFrame(buf, buf_size); }
+		static void PushRecordVideoHeader(StreamSession *session, uint8_t *buf, size_t buf_size, unsigned int width, unsigned int height)	{ session->PushRecordVideoHeader(buf, buf_size, width, height); }
+		static void PushRecordVideoFrame(StreamSession *session, uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index, bool keyframe)	{ session->PushRecordVideoFrame(buf, buf_size, frame_index, keyframe); }
+		static void PushRecordAudioHeader(StreamSession *session, ChiakiAudioHeader *header)	{ session->PushRecordAudioHeader(header); }
+		static void PushRecordAudioFrame(StreamSession *session, uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index)	{ session->PushRecordAudioFrame(buf, buf_size, frame_index); }
 #ifdef Q_OS_MACOS
 		static void SetMicAuthorization(StreamSession *session, Authorization authorization)                 { session->SetMicAuthorization(authorization); }
 #endif
 		static void CantDisplayMessage(StreamSession *session, bool cant_display)	{session->CantDisplayMessage(cant_display); }
 		static void Event(StreamSession *session, ChiakiEvent *event)							{ session->Event(event); }
+		static bool LoadNetworkProfile(StreamSession *session, const char *key, ChiakiNetworkProfile *profile)	{ return session->LoadNetworkProfile(key, profile); }
+		static void StoreNetworkProfile(StreamSession *session, const char *key, const ChiakiNetworkProfile *profile)	{ session->StoreNetworkProfile(key, profile); }
 #if CHIAKI_GUI_ENABLE_SETSU
 		static void HandleSetsuEvent(StreamSession *session, SetsuEvent *event)					{ session->HandleSetsuEvent(event); }
 #endif
@@ -2246,6 +2705,24 @@ static void AudioFrameCb(int16_t *buf, size_t samples_count, void *user)
 	StreamSessionPrivate::PushAudioFrame(session, buf, samples_count);
 }
 
+static size_t AudioQueuedCb(void *user)
+{
+	auto session = reinterpret_cast<StreamSession *>(user);
+	return StreamSessionPrivate::GetQueuedAudioSamples(session);
+}
+
+static void AudioOutCb(void *user, Uint8 *stream, int len)
+{
+	auto session = reinterpret_cast<StreamSession *>(user);
+	StreamSessionPrivate::PullAudio(session, stream, (size_t)len);
+}
+
+static void AudioInCb(void *user, Uint8 *stream, int len)
+{
+	auto session = reinterpret_cast<StreamSession *>(user);
+	StreamSessionPrivate::PushMic(session, stream, (size_t)len);
+}
+
 #ifdef Q_OS_MACOS
 static void MacMicRequestCb(Authorization authorization, void *user)
 {
@@ -2254,12 +2731,36 @@ static void MacMicRequestCb(Authorization authorization, void *user)
 }
 #endif
 
-static void HapticsFrameCb(uint8_t *buf, size_t buf_size, void *user)
+static void HapticsFrameCb(uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index, void *user)
 {
 	auto session = reinterpret_cast<StreamSession *>(user);
 	StreamSessionPrivate::PushHapticsFrame(session, buf, buf_size);
 }
 
+static void RecordVideoHeaderCb(uint8_t *buf, size_t buf_size, unsigned int width, unsigned int height, void *user)
+{
+	auto session = reinterpret_cast<StreamSession *>(user);
+	StreamSessionPrivate::PushRecordVideoHeader(session, buf, buf_size, width, height);
+}
+
+static void RecordVideoFrameCb(uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index, bool keyframe, void *user)
+{
+	auto session = reinterpret_cast<StreamSession *>(user);
+	StreamSessionPrivate::PushRecordVideoFrame(session, buf, buf_size, frame_index, keyframe);
+}
+
+static void RecordAudioHeaderCb(ChiakiAudioHeader *header, void *user)
+{
+	auto session = reinterpret_cast<StreamSession *>(user);
+	StreamSessionPrivate::PushRecordAudioHeader(session, header);
+}
+
+static void RecordAudioFrameCb(uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index, void *user)
+{
+	auto session = reinterpret_cast<StreamSession *>(user);
+	StreamSessionPrivate::PushRecordAudioFrame(session, buf, buf_size, frame_index);
+}
+
 static void CantDisplayCb(void *user, bool cant_display)
 {
 	auto session = reinterpret_cast<StreamSession *>(user);
@@ -2272,6 +2773,18 @@ static void EventCb(ChiakiEvent *event, void *user)
 	StreamSessionPrivate::Event(session, event);
 }
 
+static bool NetworkProfileLoadCb(const char *key, ChiakiNetworkProfile *profile, void *user)
+{
+	auto session = reinterpret_cast<StreamSession *>(user);
+	return StreamSessionPrivate::LoadNetworkProfile(session, key, profile);
+}
+
+static void NetworkProfileStoreCb(const char *key, const ChiakiNetworkProfile *profile, void *user)
+{
+	auto session = reinterpret_cast<StreamSession *>(user);
+	StreamSessionPrivate::StoreNetworkProfile(session, key, profile);
+}
+
 #if CHIAKI_GUI_ENABLE_SETSU
 static void SessionSetsuCb(SetsuEvent *event, void *user)
 {
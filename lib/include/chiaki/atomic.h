@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_ATOMIC_H
+#define CHIAKI_ATOMIC_H
+
+#include "common.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Minimal set of atomic operations for lock-free structures shared between threads.
+ * C11 stdatomic is not available on all supported compilers, so this wraps the builtins directly.
+ * All operations are at least acquire/release, so plain data written before a store is visible after the matching load.
+ */
+
+typedef volatile uint32_t chiaki_atomic_uint32_t;
+typedef volatile uint64_t chiaki_atomic_uint64_t;
+
+#if defined(_MSC_VER) && !defined(__clang__)
+
+static inline uint32_t chiaki_atomic_load_u32(chiaki_atomic_uint32_t *p) { return (uint32_t)_InterlockedOr((volatile long *)p, 0); }
+static inline void chiaki_atomic_store_u32(chiaki_atomic_uint32_t *p, uint32_t v) { _InterlockedExchange((volatile long *)p, (long)v); }
+static inline uint32_t chiaki_atomic_fetch_add_u32(chiaki_atomic_uint32_t *p, uint32_t v) { return (uint32_t)_InterlockedExchangeAdd((volatile long *)p, (long)v); }
+static inline bool chiaki_atomic_cas_u32(chiaki_atomic_uint32_t *p, uint32_t expected, uint32_t desired)
+{
+	return (uint32_t)_InterlockedCompareExchange((volatile long *)p, (long)desired, (long)expected) == expected;
+}
+
+static inline uint64_t chiaki_atomic_load_u64(chiaki_atomic_uint64_t *p) { return (uint64_t)_InterlockedOr64((volatile __int64 *)p, 0); }
+static inline void chiaki_atomic_store_u64(chiaki_atomic_uint64_t *p, uint64_t v) { _InterlockedExchange64((volatile __int64 *)p, (__int64)v); }
+static inline uint64_t chiaki_atomic_fetch_add_u64(chiaki_atomic_uint64_t *p, uint64_t v) { return (uint64_t)_InterlockedExchangeAdd64((volatile __int64 *)p, (__int64)v); }
+static inline bool chiaki_atomic_cas_u64(chiaki_atomic_uint64_t *p, uint64_t expected, uint64_t desired)
+{
+	return (uint64_t)_InterlockedCompareExchange64((volatile __int64 *)p, (__int64)desired, (__int64)expected) == expected;
+}
+
+#else
+
+static inline uint32_t chiaki_atomic_load_u32(chiaki_atomic_uint32_t *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+static inline void chiaki_atomic_store_u32(chiaki_atomic_uint32_t *p, uint32_t v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+static inline uint32_t chiaki_atomic_fetch_add_u32(chiaki_atomic_uint32_t *p, uint32_t v) { return __atomic_fetch_add(p, v, __ATOMIC_ACQ_REL); }
+static inline bool chiaki_atomic_cas_u32(chiaki_atomic_uint32_t *p, uint32_t expected, uint32_t desired)
+{
+	return __atomic_compare_exchange_n(p, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static inline uint64_t chiaki_atomic_load_u64(chiaki_atomic_uint64_t *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+static inline void chiaki_atomic_store_u64(chiaki_atomic_uint64_t *p, uint64_t v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+static inline uint64_t chiaki_atomic_fetch_add_u64(chiaki_atomic_uint64_t *p, uint64_t v) { return __atomic_fetch_add(p, v, __ATOMIC_ACQ_REL); }
+static inline bool chiaki_atomic_cas_u64(chiaki_atomic_uint64_t *p, uint64_t expected, uint64_t desired)
+{
+	return __atomic_compare_exchange_n(p, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_ATOMIC_H
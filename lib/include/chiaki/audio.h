@@ -16,6 +16,9 @@ extern "C" {
 
 #define CHIAKI_AUDIO_HEADER_SIZE 0xe
 
+// same scale as SDL_MIX_MAXVOLUME
+#define CHIAKI_AUDIO_VOLUME_MAX 128
+
 typedef struct chiaki_audio_header_t
 {
 	uint8_t channels;
@@ -34,6 +37,15 @@ static inline size_t chiaki_audio_header_frame_buf_size(ChiakiAudioHeader *audio
 	return audio_header->frame_size * audio_header->channels * sizeof(int16_t);
 }
 
+/**
+ * dst[i] = src[i] * volume / CHIAKI_AUDIO_VOLUME_MAX, vectorized where available.
+ * dst and src may be the same buffer.
+ *
+ * @param count number of samples (not frames)
+ * @param volume between 0 and CHIAKI_AUDIO_VOLUME_MAX
+ */
+CHIAKI_EXPORT void chiaki_audio_apply_volume(int16_t *dst, const int16_t *src, size_t count, int volume);
+
 #ifdef __cplusplus
 }
 #endif
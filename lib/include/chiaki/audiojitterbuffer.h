@@ -0,0 +1,152 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_AUDIOJITTERBUFFER_H
+#define CHIAKI_AUDIOJITTERBUFFER_H
+
+#include "common.h"
+#include "seqnum.h"
+#include "atomic.h"
+
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_AUDIO_JITTER_BUFFER_FRAME_SIZE_MAX 0x400
+
+typedef enum
+{
+	CHIAKI_AUDIO_JITTER_BUFFER_POP_FRAME, // the next frame was written to the output buffer
+	CHIAKI_AUDIO_JITTER_BUFFER_POP_MISSING, // the next frame was lost, but newer ones are available
+	CHIAKI_AUDIO_JITTER_BUFFER_POP_EMPTY // nothing to play out, either buffering or underrun
+} ChiakiAudioJitterBufferPopResult;
+
+typedef struct chiaki_audio_jitter_buffer_slot_t
+{
+	chiaki_atomic_uint32_t state;
+	ChiakiSeqNum16 frame_index;
+	size_t size;
+	uint8_t buf[CHIAKI_AUDIO_JITTER_BUFFER_FRAME_SIZE_MAX];
+} ChiakiAudioJitterBufferSlot;
+
+typedef struct chiaki_audio_jitter_buffer_stats_t
+{
+	uint64_t received; // frames pushed
+	uint64_t late; // frames that arrived after their playout time
+	uint64_t overflow; // frames that could not be stored because the buffer was full
+	uint64_t missing; // frames that were not there at their playout time
+	uint64_t dropped; // frames skipped to catch up after a stall
+	uint32_t jitter_us; // smoothed interarrival jitter (RFC 3550)
+	uint32_t target_delay_us;
+	uint32_t depth_us; // currently buffered audio
+} ChiakiAudioJitterBufferStats;
+
+/**
+ * Single-producer/single-consumer buffer of encoded audio frames keyed by frame index.
+ *
+ * The producer (the Takion thread) pushes frames as they arrive and never blocks.
+ * The consumer (a dedicated audio thread) pops them in order at playout time.
+ * The target delay adapts to the measured arrival jitter between min_delay and max_delay.
+ */
+typedef struct chiaki_audio_jitter_buffer_t
+{
+	size_t size_exp; // real size = 2^size_exp slots
+	ChiakiAudioJitterBufferSlot *slots;
+	uint32_t frame_duration_us;
+	uint32_t min_delay_frames;
+	uint32_t max_delay_frames;
+	uint32_t conceal_frames_max; // see chiaki_audio_jitter_buffer_set_conceal_frames_max()
+
+	// shared, frame indices are stored with a validity bit above the 16 bit index, 0 if not set yet
+	chiaki_atomic_uint32_t first_index;
+	chiaki_atomic_uint32_t newest_index;
+	chiaki_atomic_uint32_t next_index;
+	chiaki_atomic_uint32_t jitter_us;
+
+	// producer only
+	bool arrival_valid;
+	uint64_t arrival_prev_us;
+	ChiakiSeqNum16 arrival_prev_index;
+	double jitter;
+
+	// consumer only
+	bool started;
+	bool buffering;
+	ChiakiSeqNum16 index;
+
+	chiaki_atomic_uint64_t received;
+	chiaki_atomic_uint64_t late;
+	chiaki_atomic_uint64_t overflow;
+	chiaki_atomic_uint64_t missing;
+	chiaki_atomic_uint64_t dropped;
+} ChiakiAudioJitterBuffer;
+
+/**
+ * @param size_exp exponent for 2, must hold more than max_delay
+ * @param frame_duration_us duration of a single frame, e.g. 10000 for 480 samples @ 48 kHz
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_jitter_buffer_init(ChiakiAudioJitterBuffer *jb, size_t size_exp, uint32_t frame_duration_us,
+		uint32_t min_delay_ms, uint32_t max_delay_ms);
+CHIAKI_EXPORT void chiaki_audio_jitter_buffer_fini(ChiakiAudioJitterBuffer *jb);
+
+static inline size_t chiaki_audio_jitter_buffer_size(ChiakiAudioJitterBuffer *jb)
+{
+	return ((size_t)1) << jb->size_exp;
+}
+
+/**
+ * Gaps of more than conceal_frames_max missing frames are skipped by pop() as a whole
+ * instead of reporting every frame as CHIAKI_AUDIO_JITTER_BUFFER_POP_MISSING.
+ * 0 (the default) reports all missing frames.
+ * Must be called before the consumer starts.
+ */
+static inline void chiaki_audio_jitter_buffer_set_conceal_frames_max(ChiakiAudioJitterBuffer *jb, uint32_t conceal_frames_max)
+{
+	jb->conceal_frames_max = conceal_frames_max;
+}
+
+/**
+ * Producer side. Copies buf, never blocks.
+ * @param arrival_us monotonic arrival time of the frame, used for jitter estimation
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_jitter_buffer_push(ChiakiAudioJitterBuffer *jb, ChiakiSeqNum16 frame_index,
+		const uint8_t *buf, size_t buf_size, uint64_t arrival_us);
+
+/**
+ * Consumer side. Take the next frame in order if it is time to play it out.
+ * @param buf output buffer of at least CHIAKI_AUDIO_JITTER_BUFFER_FRAME_SIZE_MAX bytes
+ * @param buf_size written size of the frame, only valid for CHIAKI_AUDIO_JITTER_BUFFER_POP_FRAME
+ * @param frame_index index of the popped or missing frame
+ */
+CHIAKI_EXPORT ChiakiAudioJitterBufferPopResult chiaki_audio_jitter_buffer_pop(ChiakiAudioJitterBuffer *jb,
+		uint8_t *buf, size_t *buf_size, ChiakiSeqNum16 *frame_index);
+
+/**
+ * Consumer side. Copy the frame that pop() will return next without taking it,
+ * e.g. to recover a missing frame from the FEC data of its successor.
+ * @param buf output buffer of at least CHIAKI_AUDIO_JITTER_BUFFER_FRAME_SIZE_MAX bytes
+ * @return true if the next frame is already available
+ */
+CHIAKI_EXPORT bool chiaki_audio_jitter_buffer_peek(ChiakiAudioJitterBuffer *jb, uint8_t *buf, size_t *buf_size);
+
+/**
+ * Number of frames that are buffered and not yet played out.
+ */
+CHIAKI_EXPORT uint32_t chiaki_audio_jitter_buffer_depth(ChiakiAudioJitterBuffer *jb);
+
+/**
+ * Current target delay in frames, derived from the measured jitter.
+ */
+CHIAKI_EXPORT uint32_t chiaki_audio_jitter_buffer_target_frames(ChiakiAudioJitterBuffer *jb);
+
+/**
+ * Can be called from any thread.
+ */
+CHIAKI_EXPORT void chiaki_audio_jitter_buffer_get_stats(ChiakiAudioJitterBuffer *jb, ChiakiAudioJitterBufferStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_AUDIOJITTERBUFFER_H
@@ -15,7 +15,7 @@ extern "C" {
 #endif
 
 typedef void (*ChiakiAudioSinkHeader)(ChiakiAudioHeader *header, void *user);
-typedef void (*ChiakiAudioSinkFrame)(uint8_t *buf, size_t buf_size, void *user);
+typedef void (*ChiakiAudioSinkFrame)(uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index, void *user);
 
 /**
  * Sink that receives Audio encoded as Opus
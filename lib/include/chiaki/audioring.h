@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_AUDIORING_H
+#define CHIAKI_AUDIORING_H
+
+#include "common.h"
+#include "atomic.h"
+
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct chiaki_audio_ring_stats_t
+{
+	uint64_t written; // frames
+	uint64_t overflow; // frames that were dropped because the ring was full
+	uint64_t underrun; // frames that were requested by the consumer but not available
+} ChiakiAudioRingStats;
+
+/**
+ * Preallocated single-producer/single-consumer ring of interleaved 16 bit PCM.
+ *
+ * Positions are counted in frames (one sample per channel) and the capacity is a power of two,
+ * so neither side ever takes a lock. Suitable to be read from an audio device callback.
+ */
+typedef struct chiaki_audio_ring_t
+{
+	int16_t *buf;
+	unsigned int channels;
+	size_t size_exp; // capacity = 2^size_exp frames
+
+	chiaki_atomic_uint32_t write_pos; // only advanced by the producer
+	chiaki_atomic_uint32_t read_pos; // only advanced by the consumer
+
+	chiaki_atomic_uint64_t written;
+	chiaki_atomic_uint64_t overflow;
+	chiaki_atomic_uint64_t underrun;
+} ChiakiAudioRing;
+
+/**
+ * @param frames_min minimum capacity, rounded up to the next power of two
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_ring_init(ChiakiAudioRing *ring, unsigned int channels, size_t frames_min);
+CHIAKI_EXPORT void chiaki_audio_ring_fini(ChiakiAudioRing *ring);
+
+static inline size_t chiaki_audio_ring_capacity(ChiakiAudioRing *ring)
+{
+	return ((size_t)1) << ring->size_exp;
+}
+
+/**
+ * Producer side. Frames that do not fit are dropped.
+ * @return number of frames written
+ */
+CHIAKI_EXPORT size_t chiaki_audio_ring_write(ChiakiAudioRing *ring, const int16_t *buf, size_t frames);
+
+/**
+ * Consumer side. Reads at most frames, the remainder of buf is left untouched.
+ * @return number of frames read
+ */
+CHIAKI_EXPORT size_t chiaki_audio_ring_read(ChiakiAudioRing *ring, int16_t *buf, size_t frames);
+
+/**
+ * Consumer side. Drop everything that is currently buffered.
+ */
+CHIAKI_EXPORT void chiaki_audio_ring_clear(ChiakiAudioRing *ring);
+
+/**
+ * Number of buffered frames. Exact when called from either side, a snapshot otherwise.
+ */
+static inline size_t chiaki_audio_ring_fill(ChiakiAudioRing *ring)
+{
+	uint32_t r = chiaki_atomic_load_u32(&ring->read_pos);
+	uint32_t w = chiaki_atomic_load_u32(&ring->write_pos);
+	return (size_t)(uint32_t)(w - r);
+}
+
+CHIAKI_EXPORT void chiaki_audio_ring_get_stats(ChiakiAudioRing *ring, ChiakiAudioRingStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_AUDIORING_H
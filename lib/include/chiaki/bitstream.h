@@ -46,6 +46,7 @@ typedef enum chiaki_bitstream_slice_type_t
 typedef struct chiaki_bitstream_slice_t
 {
 	ChiakiBitstreamSliceType slice_type;
+	bool idr; // decoding can start here, unlike at any I slice: H.264 nal_unit_type 5, HEVC IDR_W_RADL or IDR_N_LP
 	unsigned reference_frame;
 } ChiakiBitstreamSlice;
 
@@ -6,28 +6,185 @@
 #include "takion.h"
 #include "thread.h"
 #include "packetstats.h"
+#include "seqnum.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * Decides what is reported to the server in the congestion packets.
+ * The server adapts its bitrate to the loss it receives there, so this is what drives the stream quality.
+ */
+typedef enum chiaki_congestion_control_policy_t
+{
+	/**
+	 * Report the measured loss, clamped to packet_loss_max
+	 */
+	CHIAKI_CONGESTION_CONTROL_POLICY_LEGACY = 0,
+
+	/**
+	 * Report smoothed loss, discounting loss that was fully repaired by FEC
+	 */
+	CHIAKI_CONGESTION_CONTROL_POLICY_LOSS = 1,
+
+	/**
+	 * Additionally track the one-way delay gradient and back off as soon as a queue builds up,
+	 * before the bottleneck starts dropping packets
+	 */
+	CHIAKI_CONGESTION_CONTROL_POLICY_DELAY = 2
+} ChiakiCongestionControlPolicy;
+
+#define CHIAKI_CONGESTION_CONTROL_POLICY_COUNT 3
+
+CHIAKI_EXPORT const char *chiaki_congestion_control_policy_string(ChiakiCongestionControlPolicy policy);
+
+typedef enum chiaki_congestion_signal_t
+{
+	CHIAKI_CONGESTION_SIGNAL_NORMAL,
+	CHIAKI_CONGESTION_SIGNAL_OVERUSE, // queueing delay is growing
+	CHIAKI_CONGESTION_SIGNAL_UNDERUSE // queueing delay is shrinking
+} ChiakiCongestionSignal;
+
+#define CHIAKI_CONGESTION_ESTIMATOR_TREND_WINDOW 20
+
+/**
+ * Receiver-side congestion estimator, without any threading or I/O so it can be driven by a simulation.
+ *
+ * The server encodes frames at a fixed rate, so the expected spacing of two video frames is known from
+ * their frame indices. Comparing it to the actual spacing of their arrival gives the one-way delay
+ * gradient, from which a least-squares trend is computed like in WebRTC's trendline estimator.
+ */
+typedef struct chiaki_congestion_estimator_t
+{
+	ChiakiCongestionControlPolicy policy;
+	double packet_loss_max;
+	uint64_t frame_interval_us; // 0 if unknown, disables delay tracking
+
+	bool have_frame;
+	ChiakiSeqNum16 frame_index_last;
+	uint64_t arrival_first_us;
+	uint64_t arrival_last_us;
+	double delay_us; // accumulated delay variation since the first frame
+	double delay_smoothed_us;
+	double delay_base_us; // smoothed delay without any queue, rises slowly to follow clock drift
+	double trend_x[CHIAKI_CONGESTION_ESTIMATOR_TREND_WINDOW]; // ms since arrival_first_us
+	double trend_y[CHIAKI_CONGESTION_ESTIMATOR_TREND_WINDOW]; // delay_smoothed_us in ms
+	uint64_t trend_samples;
+	double trend; // ms of delay per ms
+	unsigned int overuse_samples;
+	ChiakiCongestionSignal signal;
+
+	uint64_t fec_recovered;
+	uint64_t fec_failed;
+	double loss_smoothed;
+
+	double packet_loss; // measured in the last report
+	double packet_loss_reported;
+	uint64_t overuse_reports;
+} ChiakiCongestionEstimator;
+
+CHIAKI_EXPORT void chiaki_congestion_estimator_init(ChiakiCongestionEstimator *estimator, ChiakiCongestionControlPolicy policy, double packet_loss_max, uint64_t frame_interval_us);
+
+/**
+ * Call for the first packet that arrives for every new video frame.
+ */
+CHIAKI_EXPORT void chiaki_congestion_estimator_push_frame(ChiakiCongestionEstimator *estimator, ChiakiSeqNum16 frame_index, uint64_t arrival_us);
+
+/**
+ * Call for every frame that needed FEC.
+ * @param recovered whether FEC was able to restore the frame
+ */
+CHIAKI_EXPORT void chiaki_congestion_estimator_push_fec(ChiakiCongestionEstimator *estimator, bool recovered);
+
+static inline uint32_t chiaki_congestion_estimator_queue_delay_us(ChiakiCongestionEstimator *estimator)
+{
+	double d = estimator->delay_smoothed_us - estimator->delay_base_us;
+	return d > 0 ? (uint32_t)d : 0;
+}
+
+/**
+ * Build the congestion packet for one report interval.
+ * @param received packets received since the last report
+ * @param lost packets lost since the last report
+ */
+CHIAKI_EXPORT void chiaki_congestion_estimator_report(ChiakiCongestionEstimator *estimator, uint64_t received, uint64_t lost, ChiakiTakionCongestionPacket *packet);
+
+typedef struct chiaki_congestion_control_stats_t
+{
+	ChiakiCongestionControlPolicy policy;
+	ChiakiCongestionSignal signal;
+	double packet_loss;
+	double packet_loss_reported;
+	uint32_t queue_delay_us;
+	double delay_trend;
+	uint64_t overuse_reports;
+} ChiakiCongestionControlStats;
+
+#define CHIAKI_CONGESTION_CONTROL_SAMPLES_SIZE 0x100
+
+typedef enum chiaki_congestion_control_sample_type_t
+{
+	CHIAKI_CONGESTION_CONTROL_SAMPLE_FRAME,
+	CHIAKI_CONGESTION_CONTROL_SAMPLE_FEC_RECOVERED,
+	CHIAKI_CONGESTION_CONTROL_SAMPLE_FEC_FAILED
+} ChiakiCongestionControlSampleType;
+
+typedef struct chiaki_congestion_control_sample_t
+{
+	ChiakiCongestionControlSampleType type;
+	ChiakiSeqNum16 frame_index;
+	uint64_t arrival_us;
+} ChiakiCongestionControlSample;
+
 typedef struct chiaki_congestion_control_t
 {
 	ChiakiTakion *takion;
 	ChiakiPacketStats *stats;
+	ChiakiPacketStatsCursor stats_cursor;
 	ChiakiThread thread;
 	ChiakiBoolPredCond stop_cond;
-	double packet_loss;
+	double packet_loss; // measured
 	double packet_loss_max;
+
+	/**
+	 * Single-producer/single-consumer queue of estimator inputs.
+	 * The video receiver pushes without locking and the control thread feeds them to the estimator
+	 * in one batch before every report.
+	 */
+	ChiakiCongestionControlSample samples[CHIAKI_CONGESTION_CONTROL_SAMPLES_SIZE];
+	chiaki_atomic_uint32_t samples_write;
+	chiaki_atomic_uint32_t samples_read;
+	chiaki_atomic_uint64_t samples_dropped;
+
+	ChiakiMutex estimator_mutex; // protects estimator between the control thread and get_stats
+	ChiakiCongestionEstimator estimator;
 } ChiakiCongestionControl;
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_start(ChiakiCongestionControl *control, ChiakiTakion *takion, ChiakiPacketStats *stats, double packet_loss_max);
+CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_init(ChiakiCongestionControl *control, ChiakiCongestionControlPolicy policy, double packet_loss_max);
+CHIAKI_EXPORT void chiaki_congestion_control_fini(ChiakiCongestionControl *control);
+
+/**
+ * @param max_fps frame rate of the video stream, 0 if unknown
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_start(ChiakiCongestionControl *control, ChiakiTakion *takion, ChiakiPacketStats *stats, unsigned int max_fps);
 
 /**
  * Stop control and join the thread
  */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_stop(ChiakiCongestionControl *control);
 
+/**
+ * Producer side of the sample queue, never blocks. Must not be called concurrently with itself or push_fec.
+ */
+CHIAKI_EXPORT void chiaki_congestion_control_push_frame(ChiakiCongestionControl *control, ChiakiSeqNum16 frame_index);
+
+/**
+ * Producer side of the sample queue, see chiaki_congestion_control_push_frame()
+ */
+CHIAKI_EXPORT void chiaki_congestion_control_push_fec(ChiakiCongestionControl *control, bool recovered);
+CHIAKI_EXPORT void chiaki_congestion_control_get_stats(ChiakiCongestionControl *control, ChiakiCongestionControlStats *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -105,12 +105,91 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_thread_start(ChiakiDiscoveryThrea
 CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_thread_start_oneshot(ChiakiDiscoveryThread *thread, ChiakiDiscovery *discovery, ChiakiDiscoveryCb cb, void *cb_user);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_thread_stop(ChiakiDiscoveryThread *thread);
 
+/**
+ * Read and parse a single response from discovery->socket, which must be readable.
+ * @param cb called with the parsed host, whose strings are only valid during the call
+ * @return CHIAKI_ERR_INVALID_DATA if the datagram was not a valid response, CHIAKI_ERR_TIMEOUT if a non-blocking socket had nothing to read,
+ * CHIAKI_ERR_NETWORK if the socket failed
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_recv(ChiakiDiscovery *discovery, ChiakiDiscoveryCb cb, void *cb_user);
+
 /**
  * Convenience function to send a wakeup packet
  * @param discovery Discovery to send the packet on. May be NULL, in which case a new temporary Discovery will be created
  */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_wakeup(ChiakiLog *log, ChiakiDiscovery *discovery, const char *host, uint64_t user_credential, bool ps5);
 
+typedef enum chiaki_discovery_fleet_state_t
+{
+	CHIAKI_DISCOVERY_FLEET_STATE_PENDING,
+	CHIAKI_DISCOVERY_FLEET_STATE_INVALID_HOST, // could not be resolved
+	CHIAKI_DISCOVERY_FLEET_STATE_RESPONDED,
+	CHIAKI_DISCOVERY_FLEET_STATE_TIMEOUT
+} ChiakiDiscoveryFleetState;
+
+CHIAKI_EXPORT const char *chiaki_discovery_fleet_state_string(ChiakiDiscoveryFleetState state);
+
+#define CHIAKI_DISCOVERY_FLEET_HOST_ID_SIZE 32
+#define CHIAKI_DISCOVERY_FLEET_HOST_NAME_SIZE 64
+
+/**
+ * One console of a fleet run.
+ * host, ps5 and user_credential are set by the caller, everything else is filled in by chiaki_discovery_fleet_run().
+ */
+typedef struct chiaki_discovery_fleet_host_t
+{
+	const char *host;
+	bool ps5; // wakeup only, discovery asks on both ports
+	uint64_t user_credential; // wakeup only
+
+	ChiakiDiscoveryFleetState state;
+	ChiakiDiscoveryHostState host_state; // as reported by the last response
+	bool host_ps5;
+	char host_id[CHIAKI_DISCOVERY_FLEET_HOST_ID_SIZE];
+	char host_name[CHIAKI_DISCOVERY_FLEET_HOST_NAME_SIZE];
+	unsigned int attempts; // requests sent
+	uint64_t response_us; // from the first request until the response that completed the host
+	uint64_t rtt_us; // 0 if the response may belong to a retransmission
+
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	char addr_str[64];
+	unsigned int unanswered;
+	uint64_t first_send_us;
+	uint64_t last_send_us;
+	uint64_t next_send_us;
+} ChiakiDiscoveryFleetHost;
+
+typedef struct chiaki_discovery_fleet_options_t
+{
+	/**
+	 * CHIAKI_DISCOVERY_CMD_SRCH to discover or CHIAKI_DISCOVERY_CMD_WAKEUP to wake up.
+	 * A wakeup is followed by a search request, so consoles that got it are reported as responded.
+	 */
+	ChiakiDiscoveryCmd cmd;
+	uint64_t timeout_ms;
+	uint64_t rto_initial_ms; // first retransmission timeout, adapted to the measured RTT and doubled on every retry
+	unsigned int attempts_max; // unanswered requests per host before it is given up
+	bool wait_ready; // wakeup only: do not complete hosts until they report ready
+
+	/**
+	 * Called for every host that completes with a response, may be NULL
+	 * @param response only valid during the call
+	 */
+	void (*cb)(ChiakiDiscoveryFleetHost *host, ChiakiDiscoveryHost *response, void *user);
+	void *cb_user;
+} ChiakiDiscoveryFleetOptions;
+
+CHIAKI_EXPORT void chiaki_discovery_fleet_options_default(ChiakiDiscoveryFleetOptions *options);
+
+/**
+ * Discover or wake up many consoles at once from a single socket per address family.
+ * All requests go out immediately and are retransmitted per host, so the run takes about one RTT plus
+ * the retransmissions of the slowest host instead of one timeout per host.
+ * Blocks until every host completed or options->timeout_ms passed.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_fleet_run(ChiakiLog *log, ChiakiDiscoveryFleetHost *hosts, size_t hosts_count, ChiakiDiscoveryFleetOptions *options);
+
 #ifdef __cplusplus
 }
 #endif
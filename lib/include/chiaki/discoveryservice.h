@@ -12,6 +12,19 @@ extern "C" {
 
 typedef void (*ChiakiDiscoveryServiceCb)(ChiakiDiscoveryHost *hosts, size_t hosts_count, void *user);
 
+typedef enum chiaki_discovery_service_delta_t
+{
+	CHIAKI_DISCOVERY_SERVICE_HOST_ADDED,
+	CHIAKI_DISCOVERY_SERVICE_HOST_UPDATED,
+	CHIAKI_DISCOVERY_SERVICE_HOST_REMOVED
+} ChiakiDiscoveryServiceDelta;
+
+/**
+ * Called once for every host that changed, with the service's state locked.
+ * @param host only valid during the call, the last known state for CHIAKI_DISCOVERY_SERVICE_HOST_REMOVED
+ */
+typedef void (*ChiakiDiscoveryServiceDeltaCb)(ChiakiDiscoveryServiceDelta delta, ChiakiDiscoveryHost *host, void *user);
+
 typedef struct chiaki_discovery_service_options_t
 {
 	size_t hosts_max;
@@ -23,29 +36,87 @@ typedef struct chiaki_discovery_service_options_t
 	struct sockaddr_storage *broadcast_addrs;
 	size_t broadcast_num;
 	char *send_host;
+
+	/**
+	 * If send_addr is the IPv4 broadcast address, also ping ff02::1 on every IPv6 interface
+	 * from a second socket that is served by the same thread.
+	 */
+	bool dual_stack;
+
+	/**
+	 * Called with the whole list of hosts after any change, may be NULL
+	 */
 	ChiakiDiscoveryServiceCb cb;
+
+	/**
+	 * Called for each single change, may be NULL
+	 */
+	ChiakiDiscoveryServiceDeltaCb delta_cb;
 	void *cb_user;
 } ChiakiDiscoveryServiceOptions;
 
 typedef struct chiaki_discovery_service_host_discovery_info_t
 {
 	uint64_t last_ping_index;
+	sa_family_t family; // family of the host_addr that is currently reported
+	uint64_t family_last_ping_index;
 } ChiakiDiscoveryServiceHostDiscoveryInfo;
 
+/**
+ * Hosts of a discovery service, looked up by host id.
+ *
+ * The hosts are kept densely in hosts so they can be reported as a whole,
+ * index is an open addressing table on top of it.
+ */
+typedef struct chiaki_discovery_host_table_t
+{
+	ChiakiDiscoveryHost *hosts;
+	ChiakiDiscoveryServiceHostDiscoveryInfo *infos;
+	size_t hosts_count;
+	size_t hosts_max;
+	size_t *index; // index into hosts + 1, 0 for empty slots
+	size_t index_size; // power of 2
+	ChiakiDiscoveryServiceDeltaCb cb;
+	void *cb_user;
+} ChiakiDiscoveryHostTable;
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_host_table_init(ChiakiDiscoveryHostTable *table, size_t hosts_max, ChiakiDiscoveryServiceDeltaCb cb, void *cb_user);
+CHIAKI_EXPORT void chiaki_discovery_host_table_fini(ChiakiDiscoveryHostTable *table);
+CHIAKI_EXPORT ChiakiDiscoveryHost *chiaki_discovery_host_table_find(ChiakiDiscoveryHostTable *table, const char *host_id);
+
+/**
+ * Insert or update a host that responded to the ping with ping_index.
+ *
+ * A host that responds over both IPv4 and IPv6 keeps the address it was first seen with
+ * until that one misses a ping, so it does not flip between the two on every response.
+ *
+ * @return CHIAKI_ERR_INVALID_DATA if host has no id, CHIAKI_ERR_OVERFLOW if the host is new and the table is full
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_host_table_update(ChiakiDiscoveryHostTable *table, ChiakiDiscoveryHost *host, uint64_t ping_index);
+
+/**
+ * Remove all hosts that did not respond to any of the last drop_pings pings.
+ */
+CHIAKI_EXPORT void chiaki_discovery_host_table_drop_old(ChiakiDiscoveryHostTable *table, uint64_t ping_index, uint64_t drop_pings);
+
 typedef struct chiaki_discovery_service_t
 {
 	ChiakiLog *log;
 	ChiakiDiscoveryServiceOptions options;
 	ChiakiDiscovery discovery;
+	ChiakiDiscovery discovery_ipv6; // only valid if discovery_ipv6_active
+	bool discovery_ipv6_active;
 
 	uint64_t ping_index;
-	ChiakiDiscoveryHost *hosts;
-	ChiakiDiscoveryServiceHostDiscoveryInfo *host_discovery_infos;
-	size_t hosts_count;
+	ChiakiDiscoveryHostTable hosts;
+	bool hosts_changed;
 	ChiakiMutex state_mutex;
 
 	ChiakiThread thread;
-	ChiakiBoolPredCond stop_cond;
+	ChiakiStopPipe stop_pipe;
+#ifdef __linux__
+	int epoll_fd;
+#endif
 } ChiakiDiscoveryService;
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_service_init(ChiakiDiscoveryService *service, ChiakiDiscoveryServiceOptions *options, ChiakiLog *log);
@@ -4,6 +4,7 @@
 #define CHIAKI_FEC_H
 
 #include "common.h"
+#include "threadpool.h"
 
 #include <stdint.h>
 #ifndef _WIN32
@@ -17,6 +18,15 @@ extern "C" {
 #define CHIAKI_FEC_WORDSIZE 8
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_decode(uint8_t *frame_buf, size_t unit_size, size_t stride, unsigned int k, unsigned int m, const unsigned int *erasures, size_t erasures_count);
+/**
+ * Same as chiaki_fec_decode(), but the lost source units are recovered in parallel on pool,
+ * split into byte ranges if there are fewer of them than workers. The calling thread takes part and blocks until done.
+ * Lost fec units are not recovered.
+ * @param pool NULL to decode on the calling thread only
+ * @param affinity from chiaki_thread_pool_affinity()
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_decode_pool(uint8_t *frame_buf, size_t unit_size, size_t stride, unsigned int k, unsigned int m, const unsigned int *erasures, size_t erasures_count, ChiakiThreadPool *pool, uint32_t affinity);
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_encode(uint8_t *frame_buf, size_t unit_size, size_t stride, unsigned int k, unsigned int m);
 
 #ifdef __cplusplus
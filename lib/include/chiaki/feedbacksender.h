@@ -6,6 +6,7 @@
 #include "controller.h"
 #include "takion.h"
 #include "thread.h"
+#include "timerservice.h"
 #include "common.h"
 
 #ifdef __cplusplus
@@ -16,7 +17,8 @@ typedef struct chiaki_feedback_sender_t
 {
 	ChiakiLog *log;
 	ChiakiTakion *takion;
-	ChiakiThread thread;
+	ChiakiTimerService *timer_service;
+	ChiakiTimer timer;
 
 	ChiakiSeqNum16 state_seq_num;
 
@@ -27,8 +29,9 @@ typedef struct chiaki_feedback_sender_t
 	ChiakiControllerState controller_state_prev;
 	ChiakiControllerState controller_state;
 	bool controller_state_changed;
+	bool state_pending; // changed since state_sent_us, but held back by the minimum interval
+	uint64_t state_sent_us;
 	ChiakiMutex state_mutex;
-	ChiakiCond state_cond;
 } ChiakiFeedbackSender;
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_feedback_sender_init(ChiakiFeedbackSender *feedback_sender, ChiakiTakion *takion);
@@ -30,16 +30,40 @@ struct chiaki_ffmpeg_decoder_t
 	int32_t frames_lost;
 	bool frame_recovered;
 	int32_t session_bitrate_kbps;
+	bool warm_start;
+	uint64_t connected_us; // 0 if chiaki_ffmpeg_decoder_stream_connected() was not called yet
+	uint64_t first_frame_latency_us; // 0 until the first frame after connecting was decoded
 };
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_ffmpeg_decoder_init(ChiakiFfmpegDecoder *decoder, ChiakiLog *log,
 		ChiakiCodec codec, const char *hw_decoder_name, AVBufferRef *hw_device_ctx,
 		ChiakiFfmpegFrameAvailable frame_available_cb, void *frame_available_cb_user);
+
+/**
+ * Like chiaki_ffmpeg_decoder_init(), but with warm start enabled the codec is opened for low delay,
+ * so the first keyframe is output as soon as it was decoded instead of being held back for reordering.
+ * Meant to be called before the session is started, together with ChiakiConnectInfo.video_warm_start,
+ * so the codec and hw device contexts are ready by the time the stream header arrives.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_ffmpeg_decoder_init_warm(ChiakiFfmpegDecoder *decoder, ChiakiLog *log,
+		ChiakiCodec codec, const char *hw_decoder_name, AVBufferRef *hw_device_ctx,
+		ChiakiFfmpegFrameAvailable frame_available_cb, void *frame_available_cb_user, bool warm_start);
 CHIAKI_EXPORT void chiaki_ffmpeg_decoder_fini(ChiakiFfmpegDecoder *decoder);
 CHIAKI_EXPORT bool chiaki_ffmpeg_decoder_video_sample_cb(uint8_t *buf, size_t buf_size, int32_t frames_lost, bool frame_recovered, void *user);
 CHIAKI_EXPORT AVFrame *chiaki_ffmpeg_decoder_pull_frame(ChiakiFfmpegDecoder *decoder, int32_t *frames_lost);
 CHIAKI_EXPORT enum AVPixelFormat chiaki_ffmpeg_decoder_get_pixel_format(ChiakiFfmpegDecoder *decoder);
 
+/**
+ * Call on CHIAKI_EVENT_CONNECTED to start measuring the time until the first decoded frame.
+ */
+CHIAKI_EXPORT void chiaki_ffmpeg_decoder_stream_connected(ChiakiFfmpegDecoder *decoder);
+
+/**
+ * @return time from chiaki_ffmpeg_decoder_stream_connected() to the first frame returned by
+ * chiaki_ffmpeg_decoder_pull_frame() or 0 if there was none yet
+ */
+CHIAKI_EXPORT uint64_t chiaki_ffmpeg_decoder_get_first_frame_latency_us(ChiakiFfmpegDecoder *decoder);
+
 #ifdef __cplusplus
 }
 #endif
@@ -6,6 +6,7 @@
 #include "common.h"
 #include "takion.h"
 #include "packetstats.h"
+#include "threadpool.h"
 
 #include <stdint.h>
 #include <stdbool.h>
@@ -42,6 +43,8 @@ typedef struct chiaki_frame_processor_t
 	size_t unit_slots_size;
 	bool flushed; // whether we have already flushed the current frame, i.e. are only interested in stats, not data.
 	ChiakiStreamStats stream_stats;
+	ChiakiThreadPool *thread_pool; // optional, fec is run on it if set
+	uint32_t thread_pool_affinity;
 } ChiakiFrameProcessor;
 
 typedef enum chiaki_frame_flush_result_t {
@@ -6,6 +6,7 @@
 #include "common.h"
 #include "log.h"
 #include "thread.h"
+#include "threadpool.h"
 
 #include <stdlib.h>
 #include <stdint.h>
@@ -39,6 +40,13 @@ typedef struct chiaki_gkcrypt_t {
 	ChiakiCond key_buf_cond;
 	ChiakiThread key_buf_thread;
 
+	// if set, the key stream is generated by key_buf_task instead of key_buf_thread
+	ChiakiThreadPool *pool;
+	uint32_t pool_affinity;
+	ChiakiThreadPoolTask key_buf_task;
+	ChiakiThreadPoolGroup key_buf_group;
+	bool key_buf_task_queued; // protected by key_buf_mutex
+
 	uint8_t iv[CHIAKI_GKCRYPT_BLOCK_SIZE];
 	uint8_t key_base[CHIAKI_GKCRYPT_BLOCK_SIZE];
 	uint8_t key_gmac_base[CHIAKI_GKCRYPT_BLOCK_SIZE];
@@ -50,9 +58,10 @@ typedef struct chiaki_gkcrypt_t {
 struct chiaki_session_t;
 
 /**
- * @param key_buf_chunks if > 0, use a thread to generate the ctr mode key stream
+ * @param key_buf_chunks if > 0, generate the ctr mode key stream ahead of time, on pool if set, otherwise on a dedicated thread
+ * @param pool optional, must outlive gkcrypt
  */
-CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init(ChiakiGKCrypt *gkcrypt, ChiakiLog *log, size_t key_buf_chunks, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret);
+CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init(ChiakiGKCrypt *gkcrypt, ChiakiLog *log, size_t key_buf_chunks, ChiakiThreadPool *pool, uint32_t pool_affinity, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret);
 
 CHIAKI_EXPORT void chiaki_gkcrypt_fini(ChiakiGKCrypt *gkcrypt);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_gen_key_stream(ChiakiGKCrypt *gkcrypt, uint64_t key_pos, uint8_t *buf, size_t buf_size);
@@ -64,12 +73,12 @@ CHIAKI_EXPORT void chiaki_gkcrypt_gen_new_gmac_key(ChiakiGKCrypt *gkcrypt, uint6
 CHIAKI_EXPORT void chiaki_gkcrypt_gen_tmp_gmac_key(ChiakiGKCrypt *gkcrypt, uint64_t index, uint8_t *key_out);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_gmac(ChiakiGKCrypt *gkcrypt, uint64_t key_pos, const uint8_t *buf, size_t buf_size, uint8_t *gmac_out);
 
-static inline ChiakiGKCrypt *chiaki_gkcrypt_new(ChiakiLog *log, size_t key_buf_chunks, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret)
+static inline ChiakiGKCrypt *chiaki_gkcrypt_new(ChiakiLog *log, size_t key_buf_chunks, ChiakiThreadPool *pool, uint32_t pool_affinity, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret)
 {
 	ChiakiGKCrypt *gkcrypt = CHIAKI_NEW(ChiakiGKCrypt);
 	if(!gkcrypt)
 		return NULL;
-	ChiakiErrorCode err = chiaki_gkcrypt_init(gkcrypt, log, key_buf_chunks, index, handshake_key, ecdh_secret);
+	ChiakiErrorCode err = chiaki_gkcrypt_init(gkcrypt, log, key_buf_chunks, pool, pool_affinity, index, handshake_key, ecdh_secret);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		free(gkcrypt);
@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_LOGASYNC_H
+#define CHIAKI_LOGASYNC_H
+
+#include "common.h"
+#include "log.h"
+#include "atomic.h"
+#include "thread.h"
+
+#include <stdarg.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// longer messages are truncated
+#define CHIAKI_LOG_ASYNC_MSG_SIZE 0x200
+
+#define CHIAKI_LOG_ASYNC_RECORDS_DEFAULT 1024
+
+typedef struct chiaki_log_record_t
+{
+	ChiakiLogLevel level;
+	uint64_t timestamp_us; // chiaki_time_now_monotonic_us() at the time of logging
+	uint64_t thread_id; // thread that logged
+	const char *msg;
+} ChiakiLogRecord;
+
+typedef void (*ChiakiLogRecordCb)(const ChiakiLogRecord *record, void *user);
+
+typedef struct chiaki_log_async_slot_t
+{
+	chiaki_atomic_uint64_t seq;
+	ChiakiLogLevel level;
+	uint64_t timestamp_us;
+	uint64_t thread_id;
+	char msg[CHIAKI_LOG_ASYNC_MSG_SIZE];
+} ChiakiLogAsyncSlot;
+
+/**
+ * Log that hands its messages to a background thread instead of calling the callback on the logging thread.
+ *
+ * Messages are formatted into a preallocated ring that any number of threads can push into without taking a lock.
+ * If the ring is full, messages are dropped and counted instead of blocking the logging thread,
+ * the writer thread reports the number of dropped messages once it catches up.
+ */
+typedef struct chiaki_log_async_t
+{
+	ChiakiLog log; // The log where others will log into
+	ChiakiLogRecordCb cb;
+	void *cb_user;
+
+	ChiakiLogAsyncSlot *slots;
+	size_t size_exp; // capacity = 2^size_exp records
+	chiaki_atomic_uint64_t write_pos; // next position to be claimed by a producer
+	uint64_t read_pos; // only touched by the writer thread
+	chiaki_atomic_uint64_t dropped;
+	uint64_t dropped_reported;
+
+	chiaki_atomic_uint32_t writer_idle;
+	ChiakiMutex mutex;
+	ChiakiCond cond;
+	bool should_stop;
+	ChiakiThread thread;
+} ChiakiLogAsync;
+
+/**
+ * @param records_min minimum number of records that can be queued, rounded up to the next power of two
+ * @param cb called on the writer thread for every record, NULL to print with chiaki_log_cb_print
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_log_async_init(ChiakiLogAsync *async, uint32_t level_mask, size_t records_min, ChiakiLogRecordCb cb, void *cb_user);
+
+/**
+ * Stops the writer thread after everything logged before has been passed to the callback.
+ */
+CHIAKI_EXPORT void chiaki_log_async_fini(ChiakiLogAsync *async);
+
+static inline ChiakiLog *chiaki_log_async_get_log(ChiakiLogAsync *async) { return &async->log; }
+
+static inline uint64_t chiaki_log_async_get_dropped(ChiakiLogAsync *async) { return chiaki_atomic_load_u64(&async->dropped); }
+
+/**
+ * Queue a message without checking the level mask. chiaki_log() calls this directly for async logs.
+ */
+CHIAKI_EXPORT void chiaki_log_async_vlog(ChiakiLogAsync *async, ChiakiLogLevel level, const char *fmt, va_list args);
+
+/**
+ * ChiakiLogCb of the async log, user must be the ChiakiLogAsync
+ */
+CHIAKI_EXPORT void chiaki_log_async_cb(ChiakiLogLevel level, const char *msg, void *user);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_LOGASYNC_H
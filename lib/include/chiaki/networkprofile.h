@@ -0,0 +1,150 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_NETWORKPROFILE_H
+#define CHIAKI_NETWORKPROFILE_H
+
+#include "common.h"
+#include "log.h"
+#include "packetstats.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <sys/socket.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Results of a senkusha run, remembered across sessions so a reconnect to the same console
+ * over the same route does not have to measure everything again.
+ */
+typedef struct chiaki_network_profile_t
+{
+	uint32_t mtu_in;
+	uint32_t mtu_out;
+	uint64_t rtt_us;
+	uint64_t measured_at; // unix time in seconds of the last senkusha run
+	uint64_t validated_at; // unix time in seconds of the last stream that confirmed the values
+} ChiakiNetworkProfile;
+
+#define CHIAKI_NETWORK_PROFILE_KEY_SIZE 128
+
+/**
+ * Profiles validated more recently than this are used without running senkusha at all.
+ */
+#define CHIAKI_NETWORK_PROFILE_FRESH_SEC (24 * 60 * 60)
+
+/**
+ * Profiles measured more recently than this only get a shortened senkusha run around the cached values.
+ */
+#define CHIAKI_NETWORK_PROFILE_MAX_AGE_SEC (30 * 24 * 60 * 60)
+
+/**
+ * How long the stream has to run on the cached values before they are considered confirmed.
+ */
+#define CHIAKI_NETWORK_PROFILE_VALIDATE_MS 10000
+
+typedef enum chiaki_network_profile_freshness_t
+{
+	CHIAKI_NETWORK_PROFILE_MISSING,
+	CHIAKI_NETWORK_PROFILE_EXPIRED, // run the full senkusha
+	CHIAKI_NETWORK_PROFILE_STALE, // run a shortened senkusha with the profile as hint
+	CHIAKI_NETWORK_PROFILE_FRESH // skip senkusha
+} ChiakiNetworkProfileFreshness;
+
+CHIAKI_EXPORT const char *chiaki_network_profile_freshness_string(ChiakiNetworkProfileFreshness freshness);
+
+/**
+ * @param profile may be NULL, which gives CHIAKI_NETWORK_PROFILE_MISSING
+ * @param now unix time in seconds
+ */
+CHIAKI_EXPORT ChiakiNetworkProfileFreshness chiaki_network_profile_freshness(const ChiakiNetworkProfile *profile, uint64_t now);
+
+/**
+ * Build the cache key from the console, the local address used to reach it and its address.
+ * The console id is hashed, so the key can be stored in plain text.
+ * @param buf at least CHIAKI_NETWORK_PROFILE_KEY_SIZE bytes
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_network_profile_format_key(char *buf, size_t buf_size,
+		const uint8_t *console_id, size_t console_id_size, const struct sockaddr *local_addr, const struct sockaddr *remote_addr);
+
+/**
+ * Called from the session thread.
+ * @return whether a profile for key was found and written to profile
+ */
+typedef bool (*ChiakiNetworkProfileLoadCallback)(const char *key, ChiakiNetworkProfile *profile, void *user);
+
+/**
+ * Called from the session or stream connection thread.
+ * @param profile the profile to store for key or NULL if the cached profile turned out to be wrong and must be removed
+ */
+typedef void (*ChiakiNetworkProfileStoreCallback)(const char *key, const ChiakiNetworkProfile *profile, void *user);
+
+typedef enum chiaki_network_profile_validation_t
+{
+	CHIAKI_NETWORK_PROFILE_VALIDATION_NONE,
+	CHIAKI_NETWORK_PROFILE_VALIDATION_PENDING, // senkusha was skipped, waiting for the stream
+	CHIAKI_NETWORK_PROFILE_VALIDATION_RUNNING // stream is up, watching its loss
+} ChiakiNetworkProfileValidation;
+
+/**
+ * Per-session state of the cache, the storage itself is provided by the application through the callbacks.
+ */
+typedef struct chiaki_network_profile_cache_t
+{
+	ChiakiLog *log;
+	ChiakiNetworkProfileLoadCallback load_cb;
+	ChiakiNetworkProfileStoreCallback store_cb;
+	void *cb_user;
+
+	char key[CHIAKI_NETWORK_PROFILE_KEY_SIZE];
+	bool key_valid;
+	ChiakiNetworkProfile profile;
+	ChiakiNetworkProfileValidation validation;
+	uint64_t validation_start_ms;
+} ChiakiNetworkProfileCache;
+
+CHIAKI_EXPORT void chiaki_network_profile_cache_init(ChiakiNetworkProfileCache *cache, ChiakiLog *log);
+
+/**
+ * Look up the profile for key, which is remembered for the following calls.
+ * @param profile receives the cached profile if the result is not CHIAKI_NETWORK_PROFILE_MISSING
+ */
+CHIAKI_EXPORT ChiakiNetworkProfileFreshness chiaki_network_profile_cache_lookup(ChiakiNetworkProfileCache *cache, const char *key, ChiakiNetworkProfile *profile);
+
+/**
+ * Store the values just measured by senkusha.
+ */
+CHIAKI_EXPORT void chiaki_network_profile_cache_measured(ChiakiNetworkProfileCache *cache, uint32_t mtu_in, uint32_t mtu_out, uint64_t rtt_us);
+
+/**
+ * Senkusha was skipped, validate the cached profile once the stream is up.
+ */
+CHIAKI_EXPORT void chiaki_network_profile_cache_skipped(ChiakiNetworkProfileCache *cache);
+
+/**
+ * Call once the stream is connected.
+ */
+CHIAKI_EXPORT void chiaki_network_profile_cache_stream_started(ChiakiNetworkProfileCache *cache, uint64_t now_ms);
+
+/**
+ * Call periodically while streaming.
+ * After CHIAKI_NETWORK_PROFILE_VALIDATE_MS, the profile is confirmed if the stream received data without excessive loss
+ * and removed otherwise, so the next connect measures again.
+ */
+CHIAKI_EXPORT void chiaki_network_profile_cache_stream_check(ChiakiNetworkProfileCache *cache, ChiakiPacketStats *stats, uint64_t now_ms);
+
+/**
+ * Call when the stream ended or failed to start.
+ * @param failed if true, a profile that is still unconfirmed at this point is removed
+ */
+CHIAKI_EXPORT void chiaki_network_profile_cache_stream_stopped(ChiakiNetworkProfileCache *cache, bool failed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_NETWORKPROFILE_H
@@ -7,14 +7,37 @@
 #if CHIAKI_LIB_ENABLE_OPUS
 
 #include "audioreceiver.h"
+#include "audiojitterbuffer.h"
+#include "thread.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#define CHIAKI_OPUS_DECODER_JITTER_MIN_DELAY_MS_DEFAULT 20
+#define CHIAKI_OPUS_DECODER_JITTER_MAX_DELAY_MS_DEFAULT 200
+
+// gaps longer than this are not concealed, the output just continues with the next frame
+#define CHIAKI_OPUS_DECODER_CONCEAL_FRAMES_MAX 5
+
 typedef void (*ChiakiOpusDecoderSettingsCallback)(uint32_t channels, uint32_t rate, void *user);
 typedef void (*ChiakiOpusDecoderFrameCallback)(int16_t *buf, size_t samples_count, void *user);
 
+/**
+ * @return number of samples (per channel) that are still queued in the audio output
+ */
+typedef size_t (*ChiakiOpusDecoderQueuedCallback)(void *user);
+
+typedef struct chiaki_opus_decoder_stats_t
+{
+	uint64_t frames_decoded;
+	uint64_t frames_concealed; // missing frames synthesized by packet loss concealment
+	uint64_t frames_recovered; // missing frames reconstructed from the in-band FEC of their successor
+	uint64_t frames_stretched;
+	uint64_t frames_compressed;
+	ChiakiAudioJitterBufferStats jitter_buffer; // only set in threaded mode
+} ChiakiOpusDecoderStats;
+
 typedef struct chiaki_opus_decoder_t
 {
 	ChiakiLog *log;
@@ -26,12 +49,55 @@ typedef struct chiaki_opus_decoder_t
 	ChiakiOpusDecoderSettingsCallback settings_cb;
 	ChiakiOpusDecoderFrameCallback frame_cb;
 	void *cb_user;
+
+	// gap detection when decoding directly on the receiving thread
+	bool frame_index_valid;
+	ChiakiSeqNum16 frame_index_prev;
+
+	// threaded mode, see chiaki_opus_decoder_set_threaded()
+	bool threaded;
+	uint32_t jitter_min_delay_ms;
+	uint32_t jitter_max_delay_ms;
+	ChiakiOpusDecoderQueuedCallback queued_cb;
+	size_t output_target_samples;
+	ChiakiAudioJitterBuffer jitter_buffer;
+	bool jitter_buffer_initialized;
+	int16_t *stretch_buf;
+	ChiakiThread thread;
+	bool thread_running;
+	ChiakiBoolPredCond stop_cond;
+
+	chiaki_atomic_uint64_t frames_decoded;
+	chiaki_atomic_uint64_t frames_concealed;
+	chiaki_atomic_uint64_t frames_recovered;
+	chiaki_atomic_uint64_t frames_stretched;
+	chiaki_atomic_uint64_t frames_compressed;
 } ChiakiOpusDecoder;
 
 CHIAKI_EXPORT void chiaki_opus_decoder_init(ChiakiOpusDecoder *decoder, ChiakiLog *log);
 CHIAKI_EXPORT void chiaki_opus_decoder_fini(ChiakiOpusDecoder *decoder);
 CHIAKI_EXPORT void chiaki_opus_decoder_get_sink(ChiakiOpusDecoder *decoder, ChiakiAudioSink *sink);
 
+/**
+ * Decode on a dedicated thread instead of the Takion thread.
+ *
+ * Received frames are put into an adaptive jitter buffer and played out from there.
+ * If the buffered audio deviates from the target delay, the decoded frames are slightly stretched or compressed
+ * instead of dropping audio. frame_cb will be called from the decoder thread.
+ *
+ * Must be called before the session is started.
+ *
+ * @param queued_cb optional, if set, decoding is paced by the audio output consuming samples
+ * and the output is kept at output_target_samples. Otherwise it is paced by the monotonic clock.
+ */
+CHIAKI_EXPORT void chiaki_opus_decoder_set_threaded(ChiakiOpusDecoder *decoder, uint32_t jitter_min_delay_ms, uint32_t jitter_max_delay_ms,
+		ChiakiOpusDecoderQueuedCallback queued_cb, size_t output_target_samples);
+
+/**
+ * Can be called from any thread.
+ */
+CHIAKI_EXPORT void chiaki_opus_decoder_get_stats(ChiakiOpusDecoder *decoder, ChiakiOpusDecoderStats *stats);
+
 static inline void chiaki_opus_decoder_set_cb(ChiakiOpusDecoder *decoder, ChiakiOpusDecoderSettingsCallback settings_cb, ChiakiOpusDecoderFrameCallback frame_cb, void *user)
 {
 	decoder->settings_cb = settings_cb;
@@ -3,34 +3,107 @@
 #ifndef CHIAKI_PACKETSTATS_H
 #define CHIAKI_PACKETSTATS_H
 
-#include "thread.h"
+#include "common.h"
+#include "atomic.h"
 #include "seqnum.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-typedef struct chiaki_packet_stats_t
+#define CHIAKI_PACKET_STATS_BUCKET_MS 100
+#define CHIAKI_PACKET_STATS_BUCKETS_COUNT 100 // 10 s of history
+
+/**
+ * Bucket i counts loss bursts of length [2^i, 2^(i+1)), the last one everything longer.
+ */
+#define CHIAKI_PACKET_STATS_BURST_BUCKETS_COUNT 8
+
+typedef enum chiaki_packet_stats_window_t
+{
+	CHIAKI_PACKET_STATS_WINDOW_1S,
+	CHIAKI_PACKET_STATS_WINDOW_10S,
+	CHIAKI_PACKET_STATS_WINDOW_SESSION
+} ChiakiPacketStatsWindow;
+
+typedef struct chiaki_packet_stats_bucket_t
 {
-	ChiakiMutex mutex;
+	chiaki_atomic_uint64_t slot; // now_ms / CHIAKI_PACKET_STATS_BUCKET_MS that this bucket currently counts
+	chiaki_atomic_uint64_t received;
+	chiaki_atomic_uint64_t lost;
+} ChiakiPacketStatsBucket;
 
+/**
+ * Counters of one producer.
+ * Only ever written by the thread that pushes into it, so no two writers contend for a cache line.
+ */
+typedef struct chiaki_packet_stats_counters_t
+{
+	chiaki_atomic_uint64_t received;
+	chiaki_atomic_uint64_t lost;
+	chiaki_atomic_uint64_t bursts[CHIAKI_PACKET_STATS_BURST_BUCKETS_COUNT];
+	ChiakiPacketStatsBucket buckets[CHIAKI_PACKET_STATS_BUCKETS_COUNT];
+	uint8_t padding[64];
+} ChiakiPacketStatsCounters;
+
+/**
+ * Lock-free receive statistics.
+ *
+ * Nothing is ever reset, readers either take rolling windows or keep a ChiakiPacketStatsCursor to get
+ * the difference since their last read, so any number of consumers can read independently.
+ */
+typedef struct chiaki_packet_stats_t
+{
 	// For generations of packets, i.e. where we know the number of expected packets per generation
-	uint64_t gen_received;
-	uint64_t gen_lost;
+	ChiakiPacketStatsCounters gen;
 
 	// For sequential packets, i.e. where packets are identified by a sequence number
-	ChiakiSeqNum16 seq_min; // sequence number that was max at the last reset
-	ChiakiSeqNum16 seq_max; // currently maximal sequence number
-	uint64_t seq_received; // total received packets since the last reset
+	ChiakiPacketStatsCounters seq;
+	bool seq_started; // only accessed by the seq producer
+	ChiakiSeqNum16 seq_max; // only accessed by the seq producer
+
+	// for the deprecated chiaki_packet_stats_get() with reset
+	uint64_t reset_received;
+	uint64_t reset_lost;
 } ChiakiPacketStats;
 
+typedef struct chiaki_packet_stats_cursor_t
+{
+	uint64_t received;
+	uint64_t lost;
+} ChiakiPacketStatsCursor;
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_packet_stats_init(ChiakiPacketStats *stats);
 CHIAKI_EXPORT void chiaki_packet_stats_fini(ChiakiPacketStats *stats);
+
+/**
+ * Only reset what chiaki_packet_stats_get() with reset returns, everything else keeps counting.
+ */
 CHIAKI_EXPORT void chiaki_packet_stats_reset(ChiakiPacketStats *stats);
+
 CHIAKI_EXPORT void chiaki_packet_stats_push_generation(ChiakiPacketStats *stats, uint64_t received, uint64_t lost);
+CHIAKI_EXPORT void chiaki_packet_stats_push_generation_at(ChiakiPacketStats *stats, uint64_t received, uint64_t lost, uint64_t now_ms);
 CHIAKI_EXPORT void chiaki_packet_stats_push_seq(ChiakiPacketStats *stats, ChiakiSeqNum16 seq_num);
+CHIAKI_EXPORT void chiaki_packet_stats_push_seq_at(ChiakiPacketStats *stats, ChiakiSeqNum16 seq_num, uint64_t now_ms);
+
+/**
+ * Totals since the last reset. Only safe to use with reset from a single consumer, prefer chiaki_packet_stats_get_since().
+ */
 CHIAKI_EXPORT void chiaki_packet_stats_get(ChiakiPacketStats *stats, bool reset, uint64_t *received, uint64_t *lost);
 
+/**
+ * Counts since the previous call with the same cursor, which is then advanced.
+ * @param cursor zero-initialize to get the session totals on the first call
+ */
+CHIAKI_EXPORT void chiaki_packet_stats_get_since(ChiakiPacketStats *stats, ChiakiPacketStatsCursor *cursor, uint64_t *received, uint64_t *lost);
+
+CHIAKI_EXPORT void chiaki_packet_stats_get_window(ChiakiPacketStats *stats, ChiakiPacketStatsWindow window, uint64_t now_ms, uint64_t *received, uint64_t *lost);
+
+/**
+ * @param histogram receives the number of loss bursts per length, see CHIAKI_PACKET_STATS_BURST_BUCKETS_COUNT
+ */
+CHIAKI_EXPORT void chiaki_packet_stats_get_burst_histogram(ChiakiPacketStats *stats, uint64_t histogram[CHIAKI_PACKET_STATS_BURST_BUCKETS_COUNT]);
+
 #ifdef __cplusplus
 }
 #endif
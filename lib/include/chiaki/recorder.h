@@ -0,0 +1,135 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_RECORDER_H
+#define CHIAKI_RECORDER_H
+
+#include <chiaki/common.h>
+#include <chiaki/log.h>
+#include <chiaki/thread.h>
+#include <chiaki/audio.h>
+#include <chiaki/session.h>
+#include <chiaki/replay.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavformat/avformat.h>
+
+#define CHIAKI_RECORDER_QUEUE_BYTES_DEFAULT (64 * 1024 * 1024)
+
+typedef struct chiaki_recorder_packet_t ChiakiRecorderPacket;
+
+typedef struct chiaki_recorder_stats_t
+{
+	uint64_t video_frames;
+	uint64_t audio_frames;
+	uint64_t bytes_written;
+	uint64_t dropped; // frames dropped because the queue was full, or until the first or next keyframe
+	bool failed; // the file could not be written, everything after is dropped
+} ChiakiRecorderStats;
+
+/**
+ * Remuxes the encoded stream into a file without re-encoding.
+ * Pushing only queues a copy, the file is written on a separate thread, so a stalling disk never blocks the caller.
+ * If the queue is full, frames are dropped instead and video resumes at the next keyframe.
+ *
+ * The container is chosen from the file extension (e.g. mkv or mp4), matroska if there is none.
+ * Timestamps are derived from the frame indices, anchored to the arrival of the first frame of each stream,
+ * so lost frames leave gaps instead of shifting the rest. Parameter sets of later profiles are
+ * written in-band in front of their first keyframe.
+ */
+typedef struct chiaki_recorder_t
+{
+	ChiakiLog *log;
+	char *path;
+	ChiakiCodec codec;
+	unsigned int fps;
+
+	ChiakiMutex mutex; // protects everything below until the writer state
+	ChiakiCond cond;
+	ChiakiRecorderPacket *queue_head;
+	ChiakiRecorderPacket *queue_tail;
+	size_t queue_bytes; // queued and currently being written
+	size_t queue_bytes_max;
+	bool video_wait_keyframe; // a video frame was dropped, so all are until the next keyframe
+	bool should_stop;
+	ChiakiRecorderStats stats;
+	ChiakiThread thread;
+
+	// writer state, only touched by the thread
+	AVFormatContext *format_context;
+	AVStream *video_stream;
+	AVStream *audio_stream;
+	AVPacket *av_packet;
+	bool header_written;
+	uint8_t *video_header;
+	size_t video_header_size;
+	unsigned int width;
+	unsigned int height;
+	bool video_header_pending; // a new profile started, its header goes in front of the next keyframe
+	ChiakiAudioHeader audio_header;
+	bool audio_header_set;
+	bool video_base_set;
+	uint64_t video_index; // unwrapped frame index of the last frame
+	uint64_t video_base_index;
+	uint64_t video_base_us;
+	int64_t video_dts_prev;
+	bool audio_base_set;
+	uint64_t audio_index;
+	uint64_t audio_base_index;
+	uint64_t audio_base_us;
+	int64_t audio_dts_prev;
+	uint64_t start_us; // stream time of the first written keyframe
+} ChiakiRecorder;
+
+/**
+ * @param path file to create, overwritten if it exists
+ * @param codec codec of the video stream
+ * @param fps frame rate the video stream is sent with, used for the video timestamps
+ * @param queue_bytes_max 0 for CHIAKI_RECORDER_QUEUE_BYTES_DEFAULT
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_recorder_init(ChiakiRecorder *recorder, ChiakiLog *log, const char *path,
+		ChiakiCodec codec, unsigned int fps, size_t queue_bytes_max);
+
+/**
+ * Writes everything still queued and finishes the file.
+ */
+CHIAKI_EXPORT void chiaki_recorder_fini(ChiakiRecorder *recorder);
+
+/**
+ * Get a sink for chiaki_session_set_record_sink() that pushes everything into recorder.
+ */
+CHIAKI_EXPORT void chiaki_recorder_get_sink(ChiakiRecorder *recorder, ChiakiRecordSink *sink);
+
+CHIAKI_EXPORT void chiaki_recorder_push_video_header(ChiakiRecorder *recorder, const uint8_t *buf, size_t buf_size, unsigned int width, unsigned int height);
+
+/**
+ * @param arrival_us chiaki_time_now_monotonic_us() at the time the frame was received
+ */
+CHIAKI_EXPORT void chiaki_recorder_push_video_frame(ChiakiRecorder *recorder, const uint8_t *buf, size_t buf_size,
+		ChiakiSeqNum16 frame_index, bool keyframe, uint64_t arrival_us);
+
+CHIAKI_EXPORT void chiaki_recorder_push_audio_header(ChiakiRecorder *recorder, ChiakiAudioHeader *audio_header);
+
+/**
+ * @param arrival_us chiaki_time_now_monotonic_us() at the time the frame was received
+ */
+CHIAKI_EXPORT void chiaki_recorder_push_audio_frame(ChiakiRecorder *recorder, const uint8_t *buf, size_t buf_size,
+		ChiakiSeqNum16 frame_index, uint64_t arrival_us);
+
+CHIAKI_EXPORT void chiaki_recorder_get_stats(ChiakiRecorder *recorder, ChiakiRecorderStats *stats);
+
+/**
+ * Write everything in snapshot into a new file, with the original arrival times.
+ * Blocks until the file is finished, so call it from a thread of its own to keep streaming.
+ * @return CHIAKI_ERR_UNKNOWN if the file could not be written, see the log
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_recorder_save_replay(ChiakiLog *log, const char *path, ChiakiCodec codec, unsigned int fps,
+		ChiakiReplaySnapshot *snapshot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_RECORDER_H
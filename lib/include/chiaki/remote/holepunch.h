@@ -30,6 +30,7 @@
 #include "../log.h"
 #include "../random.h"
 #include "../sock.h"
+#include "stunclient.h"
 
 #include <stdint.h>
 #ifdef _WIN32
@@ -81,6 +82,46 @@ typedef enum chiaki_holepunch_port_type_t
     CHIAKI_HOLEPUNCH_PORT_TYPE_DATA = 1
 } ChiakiHolepunchPortType;
 
+#define CHIAKI_HOLEPUNCH_CANDIDATE_ADDR_SIZE 46
+
+/**
+ * The console candidate that won the last candidate race.
+ *
+ * Candidates matching the hint are probed first on the next connect, the rest follow
+ * staggered in the usual order.
+ */
+typedef struct chiaki_holepunch_candidate_hint_t
+{
+    char addr[CHIAKI_HOLEPUNCH_CANDIDATE_ADDR_SIZE];
+    uint16_t port;
+    uint64_t rtt_us;
+} ChiakiHolepunchCandidateHint;
+
+/**
+ * Counters of the PSN push notifications received by a session.
+ */
+typedef struct chiaki_holepunch_notification_stats_t
+{
+    uint64_t received;
+    uint64_t filtered; // dropped unparsed because the session was not going to wait for their type
+    uint64_t overflowed; // dropped because they were not taken before the buffer filled up
+    uint64_t delivered;
+    uint64_t latency_avg_us; // from receiving the websocket frame until delivery to the session state machine
+    uint64_t latency_max_us;
+} ChiakiHolepunchNotificationStats;
+
+
+/**
+ * Send all PSN requests of this process to another server, e.g. the local mock server
+ * in scripts/holepunch/psn-mock.py.
+ *
+ * The path of every endpoint is appended to url_base. If url_base starts with http://,
+ * the push notification websocket is opened with ws:// instead of wss://.
+ * This function must be called before any other holepunch function.
+ *
+ * @param[in] url_base Scheme, host and port like "http://127.0.0.1:8080", NULL for the PSN servers
+*/
+CHIAKI_EXPORT void chiaki_holepunch_set_url_base(const char *url_base);
 
 /**
  * List devices associated with a PSN account that can be used for remote play.
@@ -149,6 +190,46 @@ CHIAKI_EXPORT uint16_t chiaki_get_ps_ctrl_port(ChiakiHolepunchSession session);
 */
 CHIAKI_EXPORT chiaki_socket_t *chiaki_get_holepunch_sock(ChiakiHolepunchSession session, ChiakiHolepunchPortType type);
 
+/**
+ * Set the candidate to try first when punching holes.
+ *
+ * This function should be called before the first chiaki_holepunch_session_punch_hole,
+ * usually with the hint stored from a previous session to the same console.
+ *
+ * @param[in] session Handle to the holepunching session
+ * @param[in] hint The hint to use, NULL to clear it
+*/
+CHIAKI_EXPORT void chiaki_holepunch_session_set_candidate_hint(ChiakiHolepunchSession session, const ChiakiHolepunchCandidateHint *hint);
+
+/**
+ * Get the candidate that won the last successful chiaki_holepunch_session_punch_hole.
+ *
+ * @param[in] session Handle to the holepunching session
+ * @param[out] hint Receives the winner
+ * @return true if a hint is available
+*/
+CHIAKI_EXPORT bool chiaki_holepunch_session_get_candidate_hint(ChiakiHolepunchSession session, ChiakiHolepunchCandidateHint *hint);
+
+/**
+ * Share a STUN cache between sessions.
+ *
+ * With a fresh entry for the current local interface, chiaki_holepunch_session_create_offer
+ * skips the STUN port allocation test, and skips STUN entirely if the NAT preserves ports.
+ * This function should be called before the first chiaki_holepunch_session_create_offer.
+ *
+ * @param[in] session Handle to the holepunching session
+ * @param[in] cache Cache that must outlive the session, NULL to always run STUN
+*/
+CHIAKI_EXPORT void chiaki_holepunch_session_set_stun_cache(ChiakiHolepunchSession session, ChiakiStunCache *cache);
+
+/**
+ * Get the notification counters of a session.
+ *
+ * @param[in] session Handle to the holepunching session
+ * @param[out] stats Receives the counters
+*/
+CHIAKI_EXPORT void chiaki_holepunch_session_get_notification_stats(ChiakiHolepunchSession session, ChiakiHolepunchNotificationStats *stats);
+
 /**
  * Generate a unique device identifier for the client.
  *
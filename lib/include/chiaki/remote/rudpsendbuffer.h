@@ -9,6 +9,8 @@
 #include "../seqnum.h"
 #include "../sock.h"
 #include "../remote/rudp.h"
+#include "../retransmitqueue.h"
+#include "../timerservice.h"
 
 #include <stdbool.h>
 
@@ -16,28 +18,24 @@
 extern "C" {
 #endif
 
-typedef struct chiaki_rudp_send_buffer_packet_t ChiakiRudpSendBufferPacket;
-
 typedef struct chiaki_rudp_send_buffer_t
 {
 	ChiakiLog *log;
 	ChiakiRudp rudp;
 
-	ChiakiRudpSendBufferPacket *packets;
-	size_t packets_size; // allocated size
-	size_t packets_count; // current count
+	ChiakiRetransmitQueue queue;
+	uint32_t *acked_seq_nums; // scratch of queue.size entries for acks
 
 	ChiakiMutex mutex;
-	ChiakiCond cond;
-	bool should_stop;
-	ChiakiThread thread;
+	ChiakiTimerService *timer_service;
+	ChiakiTimer timer; // armed for the earliest re-send deadline while there are packets
 } ChiakiRudpSendBuffer;
 
 
 /**
- * Init a Send Buffer and start a thread that automatically re-sends RUDP packets.
+ * Init a Send Buffer that automatically re-sends RUDP packets from the shared timer service.
  *
- * @param sock if NULL, the Send Buffer thread will effectively do nothing (for unit testing)
+ * @param rudp if NULL, the Send Buffer will never re-send anything (for unit testing)
  * @param size number of packet slots
  */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_buffer_init(ChiakiRudpSendBuffer *send_buffer, ChiakiRudp rudp, ChiakiLog *log, size_t size);
@@ -50,10 +48,19 @@ CHIAKI_EXPORT void chiaki_rudp_send_buffer_fini(ChiakiRudpSendBuffer *send_buffe
 CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_buffer_push(ChiakiRudpSendBuffer *send_buffer, ChiakiSeqNum16 seq_num, uint8_t *buf, size_t buf_size);
 
 /**
- * @param acked_seq_nums optional array of size of at least send_buffer->packets_size where acked seq nums will be stored
+ * Ack seq_num and all packets before it.
+ *
+ * @param acked_seq_nums optional array of size of at least send_buffer->queue.size where acked seq nums will be stored
  */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_buffer_ack(ChiakiRudpSendBuffer *send_buffer, ChiakiSeqNum16 seq_num, ChiakiSeqNum16 *acked_seq_nums, size_t *acked_seq_nums_count);
 
+/**
+ * Ack exactly seq_num, leaving older packets queued.
+ *
+ * @return true if the packet was queued
+ */
+CHIAKI_EXPORT bool chiaki_rudp_send_buffer_ack_selective(ChiakiRudpSendBuffer *send_buffer, ChiakiSeqNum16 seq_num);
+
 #ifdef __cplusplus
 }
 #endif
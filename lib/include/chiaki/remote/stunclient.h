@@ -0,0 +1,137 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_STUNCLIENT_H
+#define CHIAKI_STUNCLIENT_H
+
+#include "../common.h"
+#include "../log.h"
+#include "../sock.h"
+#include "../stoppipe.h"
+#include "../thread.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_STUN_ADDR_SIZE 46
+#define CHIAKI_STUN_TRANSACTION_ID_SIZE 12
+#define CHIAKI_STUN_REQUEST_SIZE 20
+
+/**
+ * Number of servers a query keeps in flight at the same time.
+ * The next server in the list is started once one of these answered or gave up,
+ * so the NAT allocates its mappings in the order the servers are listed.
+ */
+#define CHIAKI_STUN_QUERY_PARALLEL 4
+#define CHIAKI_STUN_QUERY_TIMEOUT_MS_DEFAULT 5000
+#define CHIAKI_STUN_QUERY_RTO_INITIAL_MS 250
+#define CHIAKI_STUN_QUERY_TRIES_MAX 4
+
+typedef struct chiaki_stun_server_t
+{
+	const char *host;
+	uint16_t port;
+} ChiakiStunServer;
+
+typedef struct chiaki_stun_result_t
+{
+	char addr[CHIAKI_STUN_ADDR_SIZE];
+	uint16_t port;
+	size_t server_index; // index into the servers passed to chiaki_stun_query()
+	uint64_t rtt_us; // from the first request sent to this server
+} ChiakiStunResult;
+
+/**
+ * Write a binding request with the given transaction id into buf.
+ */
+CHIAKI_EXPORT void chiaki_stun_request_format(uint8_t *buf, const uint8_t *transaction_id);
+
+/**
+ * Parse a binding response and extract the (XOR-)MAPPED-ADDRESS.
+ *
+ * @param transaction_id the response must carry this id, otherwise CHIAKI_ERR_INVALID_RESPONSE is returned
+ * @param addr at least CHIAKI_STUN_ADDR_SIZE bytes
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_stun_response_parse(const uint8_t *buf, size_t buf_size, const uint8_t *transaction_id, char *addr, uint16_t *port);
+
+/**
+ * Query several STUN servers concurrently over a single socket.
+ *
+ * Up to CHIAKI_STUN_QUERY_PARALLEL servers are queried at once, each with its own
+ * transaction id and retransmitted with exponential backoff.
+ * The query returns as soon as results_wanted different servers answered, so
+ * results_wanted = 1 means the first response wins.
+ *
+ * @param stop_pipe optional, to cancel the query
+ * @param results at least results_wanted entries, ordered by the time the first request
+ * to the respective server was sent, which is the order a NAT allocated its mappings in
+ * @return CHIAKI_ERR_SUCCESS if at least one server answered, CHIAKI_ERR_TIMEOUT if none did
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_stun_query(ChiakiLog *log, chiaki_socket_t sock, bool ipv4,
+		const ChiakiStunServer *servers, size_t servers_count,
+		ChiakiStunResult *results, size_t results_wanted, size_t *results_count,
+		uint64_t timeout_ms, ChiakiStopPipe *stop_pipe);
+
+#define CHIAKI_STUN_CACHE_ENTRIES 4
+#define CHIAKI_STUN_CACHE_TTL_MS_DEFAULT (3 * 60 * 1000)
+
+/**
+ * Result of a previous STUN run, valid as long as the network did not change.
+ */
+typedef struct chiaki_stun_cache_entry_t
+{
+	bool ipv4;
+	char local_addr[CHIAKI_STUN_ADDR_SIZE]; // key: address of the local interface the query was sent from
+	uint16_t local_port;
+	char addr[CHIAKI_STUN_ADDR_SIZE]; // reflexive address
+	uint16_t port; // reflexive port
+	int32_t allocation_increment;
+	bool random_allocation;
+	uint64_t timestamp_ms;
+} ChiakiStunCacheEntry;
+
+/**
+ * @return true if the NAT keeps the local port, so the reflexive port for any local port can be derived without asking a server
+ */
+static inline bool chiaki_stun_cache_entry_port_preserving(const ChiakiStunCacheEntry *entry)
+{
+	return entry->allocation_increment == 0 && !entry->random_allocation && entry->port == entry->local_port;
+}
+
+/**
+ * Short-lived, thread-safe cache of reflexive addresses and NAT behaviour, keyed by local interface.
+ * Meant to be shared by all sessions of a process.
+ */
+typedef struct chiaki_stun_cache_t
+{
+	ChiakiMutex mutex;
+	ChiakiStunCacheEntry entries[CHIAKI_STUN_CACHE_ENTRIES];
+	size_t entries_count;
+	uint64_t ttl_ms;
+} ChiakiStunCache;
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_stun_cache_init(ChiakiStunCache *cache, uint64_t ttl_ms);
+CHIAKI_EXPORT void chiaki_stun_cache_fini(ChiakiStunCache *cache);
+
+/**
+ * @return true if a fresh entry for local_addr exists, which is copied to entry
+ */
+CHIAKI_EXPORT bool chiaki_stun_cache_get(ChiakiStunCache *cache, bool ipv4, const char *local_addr, ChiakiStunCacheEntry *entry);
+
+/**
+ * Insert or replace the entry for entry->local_addr, evicting the oldest one if full.
+ * entry->timestamp_ms is set to now.
+ */
+CHIAKI_EXPORT void chiaki_stun_cache_put(ChiakiStunCache *cache, const ChiakiStunCacheEntry *entry);
+
+CHIAKI_EXPORT void chiaki_stun_cache_clear(ChiakiStunCache *cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_STUNCLIENT_H
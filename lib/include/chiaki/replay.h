@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_REPLAY_H
+#define CHIAKI_REPLAY_H
+
+#include "common.h"
+#include "thread.h"
+#include "atomic.h"
+#include "audio.h"
+#include "session.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_REPLAY_BYTES_DEFAULT (256 * 1024 * 1024)
+
+typedef enum chiaki_replay_entry_type_t
+{
+	CHIAKI_REPLAY_ENTRY_VIDEO_HEADER,
+	CHIAKI_REPLAY_ENTRY_VIDEO_FRAME,
+	CHIAKI_REPLAY_ENTRY_AUDIO_FRAME
+} ChiakiReplayEntryType;
+
+/**
+ * Immutable copy of one header or frame, shared between the ring and any snapshots taken of it.
+ */
+typedef struct chiaki_replay_entry_t
+{
+	struct chiaki_replay_entry_t *next; // owned by the ring, not valid in snapshots
+	chiaki_atomic_uint32_t refs;
+	ChiakiReplayEntryType type;
+	bool idr; // only IDR frames, not every I frame, can start a GOP
+	ChiakiSeqNum16 index;
+	uint64_t arrival_us;
+	unsigned int width; // only for CHIAKI_REPLAY_ENTRY_VIDEO_HEADER
+	unsigned int height;
+	size_t size;
+	uint8_t data[];
+} ChiakiReplayEntry;
+
+/**
+ * Bounded ring of the most recently received access units and Opus frames, to save the last seconds of a stream on demand.
+ *
+ * The ring always starts at a video IDR frame with the parameter sets it needs, so whole GOPs are evicted at once.
+ * If a single GOP grows beyond bytes_max, everything is dropped and the ring starts again at the next IDR frame.
+ */
+typedef struct chiaki_replay_t
+{
+	ChiakiMutex mutex; // protects everything below
+	ChiakiReplayEntry *head; // an IDR frame or the header in front of it, NULL while waiting for one
+	ChiakiReplayEntry *tail;
+	bool wait_idr; // new parameter sets were appended, the next video frame must be an IDR frame
+	size_t bytes;
+	size_t bytes_max;
+	uint64_t duration_us;
+	ChiakiReplayEntry *video_header; // parameter sets in effect at head
+	ChiakiAudioHeader audio_header;
+	bool audio_header_set;
+	uint64_t overflows; // times a single GOP did not fit
+} ChiakiReplay;
+
+/**
+ * Entries of the ring at the time it was taken, in order, starting with the video header.
+ * Holds references, so it stays valid while the ring moves on.
+ */
+typedef struct chiaki_replay_snapshot_t
+{
+	ChiakiReplayEntry **entries;
+	size_t count;
+	size_t bytes;
+	ChiakiAudioHeader audio_header;
+	bool audio_header_set;
+} ChiakiReplaySnapshot;
+
+/**
+ * @param duration_us keep at least this much of the stream, older GOPs are evicted once a newer IDR frame is this old.
+ * 0 to keep as much as fits into bytes_max.
+ * @param bytes_max 0 for CHIAKI_REPLAY_BYTES_DEFAULT
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_replay_init(ChiakiReplay *replay, uint64_t duration_us, size_t bytes_max);
+CHIAKI_EXPORT void chiaki_replay_fini(ChiakiReplay *replay);
+
+/**
+ * Get a sink for chiaki_session_set_record_sink() that pushes everything into replay.
+ */
+CHIAKI_EXPORT void chiaki_replay_get_sink(ChiakiReplay *replay, ChiakiRecordSink *sink);
+
+CHIAKI_EXPORT void chiaki_replay_push_video_header(ChiakiReplay *replay, const uint8_t *buf, size_t buf_size, unsigned int width, unsigned int height);
+CHIAKI_EXPORT void chiaki_replay_push_video_frame(ChiakiReplay *replay, const uint8_t *buf, size_t buf_size,
+		ChiakiSeqNum16 frame_index, bool idr, uint64_t arrival_us);
+CHIAKI_EXPORT void chiaki_replay_push_audio_header(ChiakiReplay *replay, ChiakiAudioHeader *audio_header);
+CHIAKI_EXPORT void chiaki_replay_push_audio_frame(ChiakiReplay *replay, const uint8_t *buf, size_t buf_size,
+		ChiakiSeqNum16 frame_index, uint64_t arrival_us);
+
+/**
+ * Take references to everything currently in the ring, without copying any data.
+ * @return CHIAKI_ERR_UNINITIALIZED if the ring has no IDR frame yet
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_replay_snapshot(ChiakiReplay *replay, ChiakiReplaySnapshot *snapshot);
+CHIAKI_EXPORT void chiaki_replay_snapshot_fini(ChiakiReplaySnapshot *snapshot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_REPLAY_H
@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_RETRANSMITQUEUE_H
+#define CHIAKI_RETRANSMITQUEUE_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_RETRANSMIT_WHEEL_SLOTS 64
+#define CHIAKI_RETRANSMIT_WHEEL_TICK_MS 10
+
+typedef struct chiaki_retransmit_entry_t ChiakiRetransmitEntry;
+
+struct chiaki_retransmit_entry_t
+{
+	uint32_t seq_num;
+	uint64_t tries; // number of re-sends so far
+	uint64_t first_send_ms;
+	uint64_t last_send_ms;
+	uint64_t deadline_ms;
+	uint64_t rto_ms; // for this packet, doubled on every re-send
+	uint8_t *buf;
+	size_t buf_size;
+
+	ChiakiRetransmitEntry *order_prev; // in push order
+	ChiakiRetransmitEntry *order_next;
+	ChiakiRetransmitEntry *wheel_prev; // in the timer wheel slot
+	ChiakiRetransmitEntry *wheel_next;
+	ChiakiRetransmitEntry *hash_next; // in the seq num bucket, or the free list
+};
+
+typedef struct chiaki_retransmit_config_t
+{
+	bool seq_num_16; // compare seq nums as ChiakiSeqNum16 instead of ChiakiSeqNum32
+	uint64_t rto_initial_ms; // until the first RTT sample
+	uint64_t rto_min_ms;
+	uint64_t rto_max_ms; // cap for the exponential backoff
+	uint64_t give_up_ms; // drop a packet that was not acked this long after it was first sent
+} ChiakiRetransmitConfig;
+
+/**
+ * Packets waiting for an ack, with their re-send timers.
+ *
+ * Packets are found by seq num through a hash table and scheduled on a hashed timer wheel,
+ * so push, ack and expiring timers are O(1) per packet instead of a scan of the whole buffer.
+ * The retransmission timeout follows RFC 6298: it is computed from RTT samples of packets
+ * that were never re-sent (Karn's algorithm) and backed off exponentially per packet.
+ *
+ * Not thread-safe, the owner is expected to hold its own lock.
+ */
+typedef struct chiaki_retransmit_queue_t
+{
+	ChiakiRetransmitConfig config;
+
+	ChiakiRetransmitEntry *entries; // pool of size entries
+	size_t size;
+	size_t count;
+	ChiakiRetransmitEntry *free_entries;
+
+	ChiakiRetransmitEntry **buckets;
+	size_t buckets_mask;
+
+	ChiakiRetransmitEntry *head; // oldest push
+	ChiakiRetransmitEntry *tail;
+	bool ordered; // all entries were pushed in ascending seq num order
+
+	ChiakiRetransmitEntry *wheel[CHIAKI_RETRANSMIT_WHEEL_SLOTS];
+	uint64_t wheel_tick; // last tick that was expired
+
+	uint64_t srtt_us;
+	uint64_t rttvar_us;
+	uint64_t rto_ms;
+	uint64_t rtt_samples;
+	uint64_t resends;
+	uint64_t give_ups;
+} ChiakiRetransmitQueue;
+
+typedef enum chiaki_retransmit_action_t
+{
+	CHIAKI_RETRANSMIT_ACTION_RESEND,
+	CHIAKI_RETRANSMIT_ACTION_GIVE_UP
+} ChiakiRetransmitAction;
+
+/**
+ * Called for every packet whose timer expired.
+ * For CHIAKI_RETRANSMIT_ACTION_GIVE_UP, the entry is removed and its buf freed after the callback returns.
+ */
+typedef void (*ChiakiRetransmitCallback)(ChiakiRetransmitEntry *entry, ChiakiRetransmitAction action, void *user);
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_retransmit_queue_init(ChiakiRetransmitQueue *queue, size_t size, const ChiakiRetransmitConfig *config);
+
+/**
+ * Frees all bufs still in the queue.
+ */
+CHIAKI_EXPORT void chiaki_retransmit_queue_fini(ChiakiRetransmitQueue *queue);
+
+/**
+ * @param buf ownership is taken on success only
+ * @return CHIAKI_ERR_OVERFLOW if full, CHIAKI_ERR_INVALID_DATA if seq_num is already queued
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_retransmit_queue_push(ChiakiRetransmitQueue *queue, uint32_t seq_num, uint8_t *buf, size_t buf_size, uint64_t now_ms);
+
+CHIAKI_EXPORT ChiakiRetransmitEntry *chiaki_retransmit_queue_find(ChiakiRetransmitQueue *queue, uint32_t seq_num);
+
+/**
+ * Ack exactly seq_num, e.g. from a gap ack block.
+ *
+ * @return true if the packet was queued
+ */
+CHIAKI_EXPORT bool chiaki_retransmit_queue_ack(ChiakiRetransmitQueue *queue, uint32_t seq_num, uint64_t now_ms);
+
+/**
+ * Ack seq_num and everything before it.
+ *
+ * @param acked_seq_nums optional array of at least queue->size entries where acked seq nums will be stored
+ * @return number of acked packets
+ */
+CHIAKI_EXPORT size_t chiaki_retransmit_queue_ack_cumulative(ChiakiRetransmitQueue *queue, uint32_t seq_num, uint64_t now_ms, uint32_t *acked_seq_nums);
+
+/**
+ * Run the callback for all packets whose timer expired until now_ms and re-arm them with backoff.
+ *
+ * @return number of expired packets
+ */
+CHIAKI_EXPORT size_t chiaki_retransmit_queue_expire(ChiakiRetransmitQueue *queue, uint64_t now_ms, ChiakiRetransmitCallback cb, void *user);
+
+/**
+ * @return ms from now_ms until the next timer expires, 0 if one is due, UINT64_MAX if the queue is empty
+ */
+CHIAKI_EXPORT uint64_t chiaki_retransmit_queue_next_timeout_ms(ChiakiRetransmitQueue *queue, uint64_t now_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_RETRANSMITQUEUE_H
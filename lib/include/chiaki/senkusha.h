@@ -4,6 +4,7 @@
 #define CHIAKI_SENKUSHA_H
 
 #include "takion.h"
+#include "networkprofile.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -41,7 +42,11 @@ typedef struct senkusha_t
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_senkusha_init(ChiakiSenkusha *senkusha, ChiakiSession *session);
 CHIAKI_EXPORT void chiaki_senkusha_fini(ChiakiSenkusha *senkusha);
-CHIAKI_EXPORT ChiakiErrorCode chiaki_senkusha_run(ChiakiSenkusha *senkusha, uint32_t *mtu_in, uint32_t *mtu_out, uint64_t *rtt_us, chiaki_socket_t *sock);
+
+/**
+ * @param hint previously measured values to verify with a shortened run or NULL to measure everything
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_senkusha_run(ChiakiSenkusha *senkusha, uint32_t *mtu_in, uint32_t *mtu_out, uint64_t *rtt_us, chiaki_socket_t *sock, const ChiakiNetworkProfile *hint);
 
 #ifdef __cplusplus
 }
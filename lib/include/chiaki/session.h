@@ -17,6 +17,9 @@
 #include "remote/holepunch.h"
 #include "remote/rudp.h"
 #include "regist.h"
+#include "networkprofile.h"
+#include "trace.h"
+#include "threadpool.h"
 
 #include <stdint.h>
 
@@ -88,6 +91,11 @@ typedef struct chiaki_connect_info_t
 	chiaki_socket_t *rudp_sock;
 	uint8_t psn_account_id[CHIAKI_PSN_ACCOUNT_ID_SIZE];
 	double packet_loss_max;
+	ChiakiCongestionControlPolicy congestion_control_policy;
+	bool video_warm_start; // Pass the stream header to the video sample callback as soon as the stream info arrives.
+	bool session_resume; // Try to reconnect without ending the session when the stream connection is lost, see ChiakiSessionResumeStats.
+	size_t trace_events; // Keep the last trace_events packet trace events in memory for chiaki_session_trace_dump(), 0 disables tracing.
+	bool thread_pool; // Run fec and keystream generation on the process-wide chiaki_thread_pool_shared_ref() instead of the receive thread and dedicated threads.
 } ChiakiConnectInfo;
 
 
@@ -146,6 +154,70 @@ typedef struct chiaki_trigger_effects_event_t
 	uint8_t right[10];
 } ChiakiTriggerEffectsEvent;
 
+/**
+ * Steps of the session startup. Some of them run concurrently, so they can overlap in the timeline.
+ */
+typedef enum {
+	CHIAKI_SESSION_PHASE_RESOLVE, // resolving the host name, only if it is not an address
+	CHIAKI_SESSION_PHASE_KEY_GEN, // handshake key and ECDH key pair, on a worker thread
+	CHIAKI_SESSION_PHASE_PSN_REGIST,
+	CHIAKI_SESSION_PHASE_SESSION_REQUEST,
+	CHIAKI_SESSION_PHASE_CTRL, // ctrl connect until the session id was received, including LOGIN_PIN
+	CHIAKI_SESSION_PHASE_LOGIN_PIN, // waiting for the user to enter the login pin
+	CHIAKI_SESSION_PHASE_HOLEPUNCH,
+	CHIAKI_SESSION_PHASE_SENKUSHA,
+	CHIAKI_SESSION_PHASE_STREAM_CONNECT, // stream connection until CHIAKI_EVENT_CONNECTED
+	CHIAKI_SESSION_PHASE_FIRST_FRAME // CHIAKI_EVENT_CONNECTED until the first video frame was passed to the video sample callback
+} ChiakiSessionPhase;
+
+#define CHIAKI_SESSION_PHASE_COUNT 10
+
+CHIAKI_EXPORT const char *chiaki_session_phase_string(ChiakiSessionPhase phase);
+
+typedef struct chiaki_session_phase_time_t
+{
+	bool done;
+	uint64_t start_us; // relative to the start of the session
+	uint64_t end_us;
+} ChiakiSessionPhaseTime;
+
+typedef struct chiaki_session_timeline_t
+{
+	ChiakiSessionPhaseTime phases[CHIAKI_SESSION_PHASE_COUNT];
+	uint64_t total_us; // chiaki_session_start() until the first frame, or until connected if video is disabled
+} ChiakiSessionTimeline;
+
+/**
+ * While streaming, no packet for this long means the connection is lost.
+ */
+#define CHIAKI_SESSION_RESUME_LOST_MS 3000
+
+/**
+ * Give up resuming after this many attempts. Every attempt waits twice as long as the one before,
+ * starting at CHIAKI_SESSION_RESUME_BACKOFF_MIN_MS, up to CHIAKI_SESSION_RESUME_BACKOFF_MAX_MS.
+ */
+#define CHIAKI_SESSION_RESUME_ATTEMPTS_MAX 6
+#define CHIAKI_SESSION_RESUME_BACKOFF_MIN_MS 100
+#define CHIAKI_SESSION_RESUME_BACKOFF_MAX_MS 3200
+
+typedef struct chiaki_session_resume_stats_t
+{
+	bool resuming; // the connection is lost and currently being resumed
+	uint64_t attempts; // over all resumes
+	uint64_t resumed; // lost connections that were resumed
+	uint64_t failed; // lost connections that ended the session
+	uint64_t downtime_last_us; // from detecting the loss until connected again
+	uint64_t downtime_total_us;
+} ChiakiSessionResumeStats;
+
+typedef struct chiaki_resume_event_t
+{
+	bool finished; // false when starting another attempt
+	bool success; // if finished, whether the stream is connected again
+	unsigned int attempt; // starting at 1
+	uint64_t downtime_us; // if finished, time since the connection was lost
+} ChiakiResumeEvent;
+
 typedef enum {
 	CHIAKI_EVENT_CONNECTED,
 	CHIAKI_EVENT_LOGIN_PIN_REQUEST,
@@ -163,6 +235,8 @@ typedef enum {
 	CHIAKI_EVENT_PLAYER_INDEX,
 	CHIAKI_EVENT_HAPTIC_INTENSITY,
 	CHIAKI_EVENT_TRIGGER_INTENSITY,
+	CHIAKI_EVENT_STARTUP_TIMELINE, // sent once, see ChiakiSessionTimeline.total_us
+	CHIAKI_EVENT_RESUME, // only with ChiakiConnectInfo.session_resume, CHIAKI_EVENT_CONNECTED is sent again after a successful resume
 } ChiakiEventType;
 
 typedef struct chiaki_event_t
@@ -187,6 +261,8 @@ typedef struct chiaki_event_t
 		} data_holepunch;
 		ChiakiDualSenseEffectIntensity intensity;
 		char server_nickname[0x20];
+		ChiakiSessionTimeline startup_timeline;
+		ChiakiResumeEvent resume;
 	};
 } ChiakiEvent;
 
@@ -198,6 +274,26 @@ typedef void (*ChiakiEventCallback)(ChiakiEvent *event, void *user);
  */
 typedef bool (*ChiakiVideoSampleCallback)(uint8_t *buf, size_t buf_size, int32_t frames_lost, bool frame_recovered, void *user);
 
+typedef void (*ChiakiRecordSinkVideoHeader)(uint8_t *buf, size_t buf_size, unsigned int width, unsigned int height, void *user);
+
+/**
+ * @param keyframe whether the frame is an IDR frame that decoding can start from, not set for other I frames
+ */
+typedef void (*ChiakiRecordSinkVideoFrame)(uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index, bool keyframe, void *user);
+
+/**
+ * Sink that receives the stream as it arrives, before decoding, e.g. to record it without re-encoding.
+ * All callbacks are optional and called on the receiving threads, so they must return quickly.
+ */
+typedef struct chiaki_record_sink_t
+{
+	void *user;
+	ChiakiRecordSinkVideoHeader video_header_cb; // parameter sets in Annex B, on every profile switch before its first frame
+	ChiakiRecordSinkVideoFrame video_frame_cb; // complete access units in Annex B, only those that can be decoded
+	ChiakiAudioSinkHeader audio_header_cb;
+	ChiakiAudioSinkFrame audio_frame_cb; // Opus
+} ChiakiRecordSink;
+
 
 
 typedef struct chiaki_session_t
@@ -216,6 +312,8 @@ typedef struct chiaki_session_t
 		ChiakiDisableAudioVideo disable_audio_video;
 		bool enable_keyboard;
 		bool enable_dualsense;
+		bool video_warm_start;
+		bool session_resume;
 		uint8_t psn_account_id[CHIAKI_PSN_ACCOUNT_ID_SIZE];
 	} connect_info;
 
@@ -241,8 +339,33 @@ typedef struct chiaki_session_t
 	ChiakiAudioSink audio_sink;
 	ChiakiAudioSink haptics_sink;
 	ChiakiCtrlDisplaySink display_sink;
+	ChiakiRecordSink record_sink;
 
 	ChiakiThread session_thread;
+	ChiakiThread key_gen_thread;
+	ChiakiErrorCode key_gen_err;
+
+	/**
+	 * Set if the host given in ChiakiConnectInfo is a name that is resolved on the session thread
+	 */
+	char *host_unresolved;
+
+	ChiakiMutex timeline_mutex;
+	uint64_t timeline_start_us;
+	ChiakiSessionTimeline timeline;
+	bool timeline_sent;
+
+	/**
+	 * protected by state_mutex
+	 */
+	ChiakiSessionResumeStats resume_stats;
+	unsigned int resume_attempt; // of the current resume, 0 if not resuming
+	uint64_t resume_lost_us;
+
+	ChiakiTrace trace;
+
+	ChiakiThreadPool *thread_pool; // NULL if not used
+	uint32_t thread_pool_affinity;
 
 	ChiakiCond state_cond;
 	ChiakiMutex state_mutex;
@@ -266,6 +389,7 @@ typedef struct chiaki_session_t
 	ChiakiLog *log;
 
 	ChiakiStreamConnection stream_connection;
+	ChiakiNetworkProfileCache network_profile_cache;
 
 	ChiakiControllerState controller_state;
 } ChiakiSession;
@@ -275,6 +399,13 @@ CHIAKI_EXPORT void chiaki_session_fini(ChiakiSession *session);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_session_start(ChiakiSession *session);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_session_stop(ChiakiSession *session);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_session_join(ChiakiSession *session);
+CHIAKI_EXPORT void chiaki_session_get_resume_stats(ChiakiSession *session, ChiakiSessionResumeStats *stats);
+
+/**
+ * Write the packet trace to a file, can be called at any time while the session is initialized.
+ * @return CHIAKI_ERR_UNINITIALIZED if tracing was not enabled in ChiakiConnectInfo
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_session_trace_dump(ChiakiSession *session, const char *path);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_session_set_controller_state(ChiakiSession *session, ChiakiControllerState *state);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_session_set_login_pin(ChiakiSession *session, const uint8_t *pin, size_t pin_size);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_session_set_stream_connection_switch_received(ChiakiSession *session);
@@ -298,6 +429,17 @@ static inline void chiaki_session_set_video_sample_cb(ChiakiSession *session, Ch
 	session->video_sample_cb_user = user;
 }
 
+/**
+ * Enable caching of the senkusha results in the application's storage, so reconnecting to the same console
+ * over the same route can skip it. Without callbacks, senkusha runs on every connect.
+ */
+static inline void chiaki_session_set_network_profile_cb(ChiakiSession *session, ChiakiNetworkProfileLoadCallback load_cb, ChiakiNetworkProfileStoreCallback store_cb, void *user)
+{
+	session->network_profile_cache.load_cb = load_cb;
+	session->network_profile_cache.store_cb = store_cb;
+	session->network_profile_cache.cb_user = user;
+}
+
 /**
  * @param sink contents are copied
  */
@@ -314,6 +456,14 @@ static inline void chiaki_session_set_haptics_sink(ChiakiSession *session, Chiak
 	session->haptics_sink = *sink;
 }
 
+/**
+ * @param sink contents are copied
+ */
+static inline void chiaki_session_set_record_sink(ChiakiSession *session, ChiakiRecordSink *sink)
+{
+	session->record_sink = *sink;
+}
+
 /**
  * @param sink contents are copied
  */
@@ -43,6 +43,13 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_init(ChiakiStopPipe *stop_pipe);
 CHIAKI_EXPORT void chiaki_stop_pipe_fini(ChiakiStopPipe *stop_pipe);
 CHIAKI_EXPORT void chiaki_stop_pipe_stop(ChiakiStopPipe *stop_pipe);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_select_single(ChiakiStopPipe *stop_pipe, chiaki_socket_t fd, bool write, uint64_t timeout_ms);
+/**
+ * Wait until any of fds becomes readable.
+ * @param fds invalid sockets are skipped
+ * @param ready receives for each of fds whether it is readable, must have space for fds_count elements
+ * @return CHIAKI_ERR_SUCCESS if at least one socket is readable, CHIAKI_ERR_CANCELED if the pipe was stopped or CHIAKI_ERR_TIMEOUT
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_select_multi(ChiakiStopPipe *stop_pipe, chiaki_socket_t *fds, size_t fds_count, uint64_t timeout_ms, bool *ready);
 /**
  * Like connect(), but can be canceled by the stop pipe. Only makes sense with a non-blocking socket.
  */
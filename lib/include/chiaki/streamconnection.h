@@ -11,6 +11,7 @@
 #include "audioreceiver.h"
 #include "videoreceiver.h"
 #include "congestioncontrol.h"
+#include "atomic.h"
 
 #include <stdbool.h>
 
@@ -76,15 +77,24 @@ typedef struct chiaki_stream_connection_t
 	bool should_stop;
 	bool remote_disconnected;
 	char *remote_disconnect_reason;
+	bool connected; // CHIAKI_EVENT_CONNECTED was sent in the current run
+	bool connection_lost; // nothing received for CHIAKI_SESSION_RESUME_LOST_MS, only detected with session resume enabled
+
+	/**
+	 * monotonic time of the last packet from takion, written by the takion thread
+	 */
+	chiaki_atomic_uint64_t last_recv_ms;
 
 	double measured_bitrate;
 } ChiakiStreamConnection;
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_init(ChiakiStreamConnection *stream_connection, ChiakiSession *session, double packet_loss_max);
+CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_init(ChiakiStreamConnection *stream_connection, ChiakiSession *session, double packet_loss_max, ChiakiCongestionControlPolicy congestion_control_policy);
 CHIAKI_EXPORT void chiaki_stream_connection_fini(ChiakiStreamConnection *stream_connection);
 
 /**
  * Run stream_connection synchronously
+ * May be called again after it returned to connect anew within the same session.
+ * @return CHIAKI_ERR_TIMEOUT if the connection was lost after connecting
  */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_run(ChiakiStreamConnection *stream_connection, chiaki_socket_t *socket);
 
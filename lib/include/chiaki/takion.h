@@ -12,6 +12,7 @@
 #include "reorderqueue.h"
 #include "feedback.h"
 #include "takionsendbuffer.h"
+#include "trace.h"
 
 #include <stdbool.h>
 
@@ -117,6 +118,7 @@ typedef struct chiaki_takion_connect_info_t
 	bool enable_dualsense;
 	uint8_t protocol_version;
 	bool close_socket; // close socket when finishing takion
+	ChiakiTrace *trace; // optional, receives an event for every packet
 } ChiakiTakionConnectInfo;
 
 
@@ -174,6 +176,8 @@ typedef struct chiaki_takion_t
 
 	ChiakiTakionAVPacketParse av_packet_parse;
 
+	ChiakiTrace *trace;
+
 	ChiakiKeyState key_state;
 
 	bool enable_dualsense;
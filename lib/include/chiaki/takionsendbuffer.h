@@ -7,6 +7,8 @@
 #include "log.h"
 #include "thread.h"
 #include "seqnum.h"
+#include "retransmitqueue.h"
+#include "timerservice.h"
 
 #include <stdbool.h>
 
@@ -16,28 +18,23 @@ extern "C" {
 
 typedef struct chiaki_takion_t ChiakiTakion;
 
-typedef struct chiaki_takion_send_buffer_packet_t ChiakiTakionSendBufferPacket;
-
 typedef struct chiaki_takion_send_buffer_t
 {
 	ChiakiLog *log;
 	ChiakiTakion *takion;
 
-	ChiakiTakionSendBufferPacket *packets;
-	size_t packets_size; // allocated size
-	size_t packets_count; // current count
+	ChiakiRetransmitQueue queue;
 
 	ChiakiMutex mutex;
-	ChiakiCond cond;
-	bool should_stop;
-	ChiakiThread thread;
+	ChiakiTimerService *timer_service;
+	ChiakiTimer timer; // armed for the earliest re-send deadline while there are packets
 } ChiakiTakionSendBuffer;
 
 
 /**
- * Init a Send Buffer and start a thread that automatically re-sends packets on takion.
+ * Init a Send Buffer that automatically re-sends packets on takion from the shared timer service.
  *
- * @param takion if NULL, the Send Buffer thread will effectively do nothing (for unit testing)
+ * @param takion if NULL, the Send Buffer will never re-send anything (for unit testing)
  * @param size number of packet slots
  */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_init(ChiakiTakionSendBuffer *send_buffer, ChiakiTakion *takion, size_t size);
@@ -50,10 +47,19 @@ CHIAKI_EXPORT void chiaki_takion_send_buffer_fini(ChiakiTakionSendBuffer *send_b
 CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_push(ChiakiTakionSendBuffer *send_buffer, ChiakiSeqNum32 seq_num, uint8_t *buf, size_t buf_size);
 
 /**
- * @param acked_seq_nums optional array of size of at least send_buffer->packets_size where acked seq nums will be stored
+ * Ack seq_num and everything before it.
+ *
+ * @param acked_seq_nums optional array of size of at least send_buffer->queue.size where acked seq nums will be stored
  */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_ack(ChiakiTakionSendBuffer *send_buffer, ChiakiSeqNum32 seq_num, ChiakiSeqNum32 *acked_seq_nums, size_t *acked_seq_nums_count);
 
+/**
+ * Ack exactly the packets in [begin, end] (inclusive), e.g. from a gap ack block.
+ *
+ * @param acked_seq_nums optional array of size of at least send_buffer->queue.size where acked seq nums will be stored
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_ack_range(ChiakiTakionSendBuffer *send_buffer, ChiakiSeqNum32 begin, ChiakiSeqNum32 end, ChiakiSeqNum32 *acked_seq_nums, size_t *acked_seq_nums_count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -11,6 +11,7 @@ extern "C" {
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -37,6 +38,94 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_join(ChiakiThread *thread, void **re
 CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_timedjoin(ChiakiThread *thread, void **retval, uint64_t timeout_ms);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_set_name(ChiakiThread *thread, const char *name);
 
+/**
+ * Threads that are latency critical while streaming. Each of them calls chiaki_thread_apply_role() when it starts.
+ */
+typedef enum chiaki_thread_role_t
+{
+	CHIAKI_THREAD_ROLE_TAKION = 0, // receiving and handling stream packets, also submits video to the decoder
+	CHIAKI_THREAD_ROLE_GKCRYPT, // keystream generation
+	CHIAKI_THREAD_ROLE_DECODER, // pulling decoded video frames, applied by the application
+	CHIAKI_THREAD_ROLE_AUDIO, // audio decoding and microphone encoding
+	CHIAKI_THREAD_ROLE_FEEDBACK, // feedback, congestion control and send buffers
+	CHIAKI_THREAD_ROLE_WORKER, // ChiakiThreadPool workers, fec and keystream generation when a pool is used
+	CHIAKI_THREAD_ROLE_COUNT
+} ChiakiThreadRole;
+
+CHIAKI_EXPORT const char *chiaki_thread_role_string(ChiakiThreadRole role);
+
+typedef enum chiaki_thread_priority_t
+{
+	CHIAKI_THREAD_PRIORITY_DEFAULT = 0,
+	CHIAKI_THREAD_PRIORITY_HIGH, // negative nice value on Linux, THREAD_PRIORITY_HIGHEST on Windows
+	CHIAKI_THREAD_PRIORITY_REALTIME // SCHED_FIFO, THREAD_PRIORITY_TIME_CRITICAL on Windows
+} ChiakiThreadPriority;
+
+CHIAKI_EXPORT const char *chiaki_thread_priority_string(ChiakiThreadPriority priority);
+
+typedef struct chiaki_thread_placement_t
+{
+	uint64_t cpu_mask; // bit n allows cpu n, 0 for all cpus the process may use
+	ChiakiThreadPriority priority;
+	int priority_value; // nice value for HIGH, SCHED_FIFO priority for REALTIME, 0 for a sensible default
+} ChiakiThreadPlacement;
+
+typedef struct chiaki_thread_placement_config_t
+{
+	ChiakiThreadPlacement roles[CHIAKI_THREAD_ROLE_COUNT];
+	bool lock_memory; // keep all memory of the process resident so hot threads never page fault
+} ChiakiThreadPlacementConfig;
+
+typedef struct chiaki_thread_placement_effective_t
+{
+	unsigned int threads; // number of threads that applied the role since the config was set
+	ChiakiErrorCode err; // of the last thread, CHIAKI_ERR_THREAD if the os refused, e.g. without CAP_SYS_NICE
+	uint64_t cpu_mask; // affinity the last thread ended up with, 0 if unknown
+	ChiakiThreadPriority priority;
+	int priority_value;
+} ChiakiThreadPlacementEffective;
+
+typedef struct chiaki_thread_placement_report_t
+{
+	ChiakiThreadPlacementEffective roles[CHIAKI_THREAD_ROLE_COUNT];
+	bool memory_locked;
+	ChiakiErrorCode memory_lock_err;
+} ChiakiThreadPlacementReport;
+
+/**
+ * Take a reference on the process-wide placement for all roles, applied by threads started afterwards.
+ * The first reference sets config, locks memory if requested and resets the report.
+ * Later ones keep the config already in place, so concurrent sessions don't undo each other.
+ * @param config NULL for the default of all roles
+ * @return the result of locking memory for the config in place
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_placement_ref(const ChiakiThreadPlacementConfig *config);
+
+/**
+ * Drop a reference taken with chiaki_thread_placement_ref(), the last one goes back to the default
+ * for all roles and unlocks memory. The report is kept until the next first reference.
+ */
+CHIAKI_EXPORT void chiaki_thread_placement_unref(void);
+
+/**
+ * Apply the placement configured for role to the calling thread and record the result in the report.
+ * Roles left at the default undo what a placed thread that created this one passed on to it.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_apply_role(ChiakiThreadRole role);
+
+CHIAKI_EXPORT void chiaki_thread_placement_get_report(ChiakiThreadPlacementReport *report);
+
+/**
+ * Parse a cpu list like "2-3,8" into a mask, only cpus 0 to 63 can be addressed.
+ * An empty string gives 0.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_parse_cpu_list(const char *str, uint64_t *mask);
+
+/**
+ * Inverse of chiaki_thread_parse_cpu_list(), always null-terminates buf.
+ */
+CHIAKI_EXPORT void chiaki_thread_format_cpu_list(uint64_t mask, char *buf, size_t buf_size);
+
 
 typedef struct chiaki_mutex_t
 {
@@ -53,6 +142,20 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_mutex_lock(ChiakiMutex *mutex);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_mutex_trylock(ChiakiMutex *mutex);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_mutex_unlock(ChiakiMutex *mutex);
 
+/**
+ * Mutexes for process-wide state, created once on first use and never destroyed.
+ */
+typedef enum chiaki_static_mutex_t
+{
+	CHIAKI_STATIC_MUTEX_THREAD_PLACEMENT,
+	CHIAKI_STATIC_MUTEX_THREAD_POOL_SHARED,
+	CHIAKI_STATIC_MUTEX_TIMER_SERVICE_SHARED,
+	CHIAKI_STATIC_MUTEX_COUNT
+} ChiakiStaticMutex;
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_static_mutex_lock(ChiakiStaticMutex which);
+CHIAKI_EXPORT ChiakiErrorCode chiaki_static_mutex_unlock(ChiakiStaticMutex which);
+
 
 typedef struct chiaki_cond_t
 {
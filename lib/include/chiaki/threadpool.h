@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_THREADPOOL_H
+#define CHIAKI_THREADPOOL_H
+
+#include "common.h"
+#include "thread.h"
+#include "atomic.h"
+#include "log.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_THREAD_POOL_WORKERS_MAX 16
+
+typedef enum chiaki_thread_pool_priority_t
+{
+	CHIAKI_THREAD_POOL_PRIORITY_HIGH = 0, // on the critical path of a frame, e.g. fec
+	CHIAKI_THREAD_POOL_PRIORITY_NORMAL, // background work that is only needed ahead of time, e.g. keystream
+	CHIAKI_THREAD_POOL_PRIORITY_COUNT
+} ChiakiThreadPoolPriority;
+
+/**
+ * Counts the tasks submitted with it that have not finished yet, so they can be waited for.
+ */
+typedef struct chiaki_thread_pool_group_t
+{
+	ChiakiMutex mutex;
+	ChiakiCond cond;
+	unsigned int pending;
+} ChiakiThreadPoolGroup;
+
+typedef void (*ChiakiThreadPoolTaskFunc)(void *user);
+
+/**
+ * Owned by the caller and queued without any allocation.
+ * Must not be touched until it has run, but it may be submitted again from its own func.
+ */
+typedef struct chiaki_thread_pool_task_t
+{
+	ChiakiThreadPoolTaskFunc func;
+	void *user;
+	ChiakiThreadPoolGroup *group; // optional
+	struct chiaki_thread_pool_task_t *next;
+} ChiakiThreadPoolTask;
+
+typedef struct chiaki_thread_pool_worker_t ChiakiThreadPoolWorker;
+
+/**
+ * Fixed set of worker threads, each with its own queue per priority.
+ * Tasks are queued on the worker their affinity maps to and idle workers steal from the others,
+ * so the tasks of one session tend to stay on one core while the pool as a whole still balances.
+ */
+typedef struct chiaki_thread_pool_t
+{
+	ChiakiLog *log;
+	ChiakiThreadPoolWorker *workers;
+	size_t workers_count;
+	chiaki_atomic_uint32_t pending; // queued tasks, incremented before they become visible in a queue
+	chiaki_atomic_uint32_t affinity_next;
+	ChiakiMutex mutex; // idle workers sleep on cond
+	ChiakiCond cond;
+	bool stop;
+} ChiakiThreadPool;
+
+/**
+ * @param workers_count 0 for chiaki_thread_pool_workers_default()
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_pool_init(ChiakiThreadPool *pool, size_t workers_count, ChiakiLog *log);
+
+/**
+ * Runs all tasks that are still queued, then stops the workers.
+ */
+CHIAKI_EXPORT void chiaki_thread_pool_fini(ChiakiThreadPool *pool);
+
+/**
+ * One less than the number of online cpus because the submitting thread helps while waiting, at least 1.
+ */
+CHIAKI_EXPORT size_t chiaki_thread_pool_workers_default(void);
+
+/**
+ * Hand out the next affinity key, e.g. one per session.
+ */
+CHIAKI_EXPORT uint32_t chiaki_thread_pool_affinity(ChiakiThreadPool *pool);
+
+static inline void chiaki_thread_pool_task_init(ChiakiThreadPoolTask *task, ChiakiThreadPoolTaskFunc func, void *user, ChiakiThreadPoolGroup *group)
+{
+	task->func = func;
+	task->user = user;
+	task->group = group;
+	task->next = NULL;
+}
+
+CHIAKI_EXPORT void chiaki_thread_pool_submit(ChiakiThreadPool *pool, ChiakiThreadPoolTask *task, ChiakiThreadPoolPriority priority, uint32_t affinity);
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_pool_group_init(ChiakiThreadPoolGroup *group);
+CHIAKI_EXPORT void chiaki_thread_pool_group_fini(ChiakiThreadPoolGroup *group);
+
+/**
+ * Block until all tasks of group have finished.
+ * Tasks of group that no worker has picked up yet are run on the calling thread instead of waiting for them.
+ */
+CHIAKI_EXPORT void chiaki_thread_pool_group_wait(ChiakiThreadPool *pool, ChiakiThreadPoolGroup *group);
+
+/**
+ * Process-wide pool shared by all sessions, created with the default number of workers on the first reference
+ * and stopped when the last one is released.
+ * @return NULL if the pool could not be created
+ */
+CHIAKI_EXPORT ChiakiThreadPool *chiaki_thread_pool_shared_ref(void);
+CHIAKI_EXPORT void chiaki_thread_pool_shared_unref(ChiakiThreadPool *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_THREADPOOL_H
@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_TIMERSERVICE_H
+#define CHIAKI_TIMERSERVICE_H
+
+#include "common.h"
+#include "thread.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_TIMER_DISARMED UINT64_MAX
+
+typedef struct chiaki_timer_service_t ChiakiTimerService;
+
+typedef void (*ChiakiTimerCallback)(void *user);
+
+/**
+ * One-shot timer owned by the caller, armed with an absolute deadline on the
+ * chiaki_time_now_monotonic_us() clock. The callback runs on the service's thread,
+ * without any of the service's locks held, so it may arm its own timer again.
+ */
+typedef struct chiaki_timer_t
+{
+	ChiakiTimerService *service;
+	ChiakiTimerCallback cb;
+	void *user;
+	uint64_t deadline_us; // CHIAKI_TIMER_DISARMED if not armed
+	size_t heap_index;
+} ChiakiTimer;
+
+/**
+ * Single thread that runs the callbacks of all timers registered with it in deadline order.
+ * On Linux it sleeps on a timerfd with an absolute deadline, so wakeups are exact to the microsecond
+ * instead of being rounded to the millisecond timeouts of chiaki_cond_timedwait().
+ */
+struct chiaki_timer_service_t
+{
+	ChiakiMutex mutex; // protects everything below
+	ChiakiTimer **heap; // min-heap by deadline_us
+	size_t heap_count;
+	size_t heap_size;
+	uint64_t sleep_until_us; // what the thread currently sleeps for, 0 while it is awake
+	ChiakiTimer *running; // timer whose callback is currently being run
+	ChiakiCond running_cond; // signaled whenever a callback returns
+	ChiakiCond wake_cond; // used to sleep if there is no timerfd
+	int timer_fd; // -1 if unavailable
+	int event_fd;
+	bool stop;
+	uint64_t wakeups; // statistics
+	uint64_t fired;
+	ChiakiThread thread;
+};
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_timer_service_init(ChiakiTimerService *service);
+
+/**
+ * All timers must have been cancelled before.
+ */
+CHIAKI_EXPORT void chiaki_timer_service_fini(ChiakiTimerService *service);
+
+/**
+ * Process-wide service shared by all sessions, started on the first reference
+ * and stopped when the last one is released.
+ * @return NULL if the service could not be started
+ */
+CHIAKI_EXPORT ChiakiTimerService *chiaki_timer_service_shared_ref(void);
+CHIAKI_EXPORT void chiaki_timer_service_shared_unref(ChiakiTimerService *service);
+
+static inline void chiaki_timer_init(ChiakiTimer *timer, ChiakiTimerService *service, ChiakiTimerCallback cb, void *user)
+{
+	timer->service = service;
+	timer->cb = cb;
+	timer->user = user;
+	timer->deadline_us = CHIAKI_TIMER_DISARMED;
+	timer->heap_index = 0;
+}
+
+/**
+ * (Re-)arm timer for deadline_us, replacing any earlier deadline.
+ * A deadline in the past fires as soon as possible.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_timer_arm(ChiakiTimer *timer, uint64_t deadline_us);
+
+/**
+ * Like chiaki_timer_arm(), but keep the current deadline if it is earlier than deadline_us.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_timer_arm_earlier(ChiakiTimer *timer, uint64_t deadline_us);
+
+/**
+ * Disarm timer and wait for its callback to return if it is currently running.
+ * Must not be called from the timer's own callback.
+ * After this returns, the callback will not run again unless the timer is armed again.
+ */
+CHIAKI_EXPORT void chiaki_timer_cancel(ChiakiTimer *timer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_TIMERSERVICE_H
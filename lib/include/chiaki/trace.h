@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_TRACE_H
+#define CHIAKI_TRACE_H
+
+#include "common.h"
+#include "atomic.h"
+#include "time.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_TRACE_EVENTS_DEFAULT 65536
+
+#define CHIAKI_TRACE_FILE_MAGIC "CHIAKITR"
+#define CHIAKI_TRACE_FILE_VERSION 1
+
+typedef enum chiaki_trace_event_type_t
+{
+	/**
+	 * Takion packet received and authenticated.
+	 * packet_type: base type, size: packet size, key_pos: from the packet, result: ChiakiTraceMacResult
+	 */
+	CHIAKI_TRACE_EVENT_PACKET = 1,
+
+	/**
+	 * Takion data message pushed into the reorder queue.
+	 * seq: data seq num, index: channel, result: ChiakiTraceReorderAction
+	 */
+	CHIAKI_TRACE_EVENT_DATA = 2,
+
+	/**
+	 * Audio/video unit parsed.
+	 * packet_type: base type, seq: frame index, index: unit index, extra: units in frame total,
+	 * size: payload size, key_pos: from the packet, result: 1 if it is a fec unit
+	 */
+	CHIAKI_TRACE_EVENT_AV_UNIT = 3,
+
+	/**
+	 * Video frame flushed from the frame processor.
+	 * seq: frame index, size: frame size, result: ChiakiFrameProcessorFlushResult
+	 */
+	CHIAKI_TRACE_EVENT_FRAME = 4,
+
+	/**
+	 * Video frame handed to the decoder.
+	 * seq: frame index, size: frame size, extra: frames lost before it, result: 1 if the decoder accepted it
+	 */
+	CHIAKI_TRACE_EVENT_DECODE_SUBMIT = 5
+} ChiakiTraceEventType;
+
+typedef enum chiaki_trace_mac_result_t
+{
+	CHIAKI_TRACE_MAC_NONE = 0, // not checked, crypt not available yet
+	CHIAKI_TRACE_MAC_OK = 1,
+	CHIAKI_TRACE_MAC_INVALID = 2
+} ChiakiTraceMacResult;
+
+typedef enum chiaki_trace_reorder_action_t
+{
+	CHIAKI_TRACE_REORDER_IN_ORDER = 0, // the next expected seq num
+	CHIAKI_TRACE_REORDER_AHEAD = 1, // buffered until the gap is filled
+	CHIAKI_TRACE_REORDER_LATE = 2 // already pulled or out of the window, dropped
+} ChiakiTraceReorderAction;
+
+/**
+ * Fixed 32 byte record, written to dumps as-is in little endian.
+ */
+typedef struct chiaki_trace_event_t
+{
+	uint64_t timestamp_us; // chiaki_time_now_monotonic_us()
+	uint64_t key_pos;
+	uint32_t seq;
+	uint32_t size;
+	uint16_t index;
+	uint16_t extra;
+	uint8_t type; // ChiakiTraceEventType
+	uint8_t packet_type;
+	uint8_t result;
+	uint8_t reserved;
+} ChiakiTraceEvent;
+
+/**
+ * Ring of the most recent events, always overwriting the oldest ones.
+ *
+ * Pushing is a single atomic add and a 32 byte store, so it can stay enabled while streaming.
+ * Snapshots taken while another thread is pushing may contain a few torn records at the write position,
+ * which is fine for post-mortem analysis.
+ */
+typedef struct chiaki_trace_t
+{
+	ChiakiTraceEvent *events; // NULL if disabled
+	size_t size_exp; // capacity = 2^size_exp events
+	chiaki_atomic_uint64_t write_pos;
+	uint64_t start_us;
+} ChiakiTrace;
+
+/**
+ * @param events_min minimum number of events kept, rounded up to the next power of two, 0 to disable tracing
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_trace_init(ChiakiTrace *trace, size_t events_min);
+CHIAKI_EXPORT void chiaki_trace_fini(ChiakiTrace *trace);
+
+static inline bool chiaki_trace_enabled(ChiakiTrace *trace)
+{
+	return trace && trace->events;
+}
+
+/**
+ * Record an event, the timestamp is filled in here.
+ */
+static inline void chiaki_trace_push(ChiakiTrace *trace, ChiakiTraceEvent *event)
+{
+	if(!chiaki_trace_enabled(trace))
+		return;
+	uint64_t pos = chiaki_atomic_fetch_add_u64(&trace->write_pos, 1);
+	event->timestamp_us = chiaki_time_now_monotonic_us();
+	trace->events[pos & ((((uint64_t)1) << trace->size_exp) - 1)] = *event;
+}
+
+/**
+ * Copy the events currently in the ring, oldest first.
+ * @param out array of at least 2^size_exp events
+ * @param overwritten optional, number of events that were lost because the ring wrapped around
+ * @return number of events written to out
+ */
+CHIAKI_EXPORT size_t chiaki_trace_snapshot(ChiakiTrace *trace, ChiakiTraceEvent *out, uint64_t *overwritten);
+
+/**
+ * Write a snapshot to a file, see scripts/chiaki-trace.py for converting it to csv.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_trace_dump_file(ChiakiTrace *trace, const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_TRACE_H
@@ -31,6 +31,7 @@ typedef struct chiaki_video_receiver_t
 	ChiakiPacketStats *packet_stats;
 
 	int32_t frames_lost;
+	bool first_frame_done;
 	int32_t reference_frames[16];
 	ChiakiBitstream bitstream;
 } ChiakiVideoReceiver;
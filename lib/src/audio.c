@@ -2,6 +2,16 @@
 
 #include <chiaki/audio.h>
 
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AUDIO_VOLUME_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define AUDIO_VOLUME_NEON
+#include <arm_neon.h>
+#endif
+
 #ifdef _WIN32
 #include <winsock2.h>
 #else
@@ -38,3 +48,47 @@ void chiaki_audio_header_set(ChiakiAudioHeader * audio_header, uint8_t channels,
 	audio_header->frame_size = frame_size;
 	audio_header->unknown = 1;
 }
+
+// log2(CHIAKI_AUDIO_VOLUME_MAX)
+#define VOLUME_SHIFT 7
+
+CHIAKI_EXPORT void chiaki_audio_apply_volume(int16_t *dst, const int16_t *src, size_t count, int volume)
+{
+	if(volume >= CHIAKI_AUDIO_VOLUME_MAX)
+	{
+		if(dst != src)
+			memmove(dst, src, count * sizeof(int16_t));
+		return;
+	}
+	if(volume <= 0)
+	{
+		memset(dst, 0, count * sizeof(int16_t));
+		return;
+	}
+
+	size_t i = 0;
+#if defined(AUDIO_VOLUME_SSE2)
+	__m128i v = _mm_set1_epi16((short)volume);
+	for(; i + 8 <= count; i += 8)
+	{
+		__m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+		// full 32 bit products from the low and high halves
+		__m128i lo = _mm_mullo_epi16(s, v);
+		__m128i hi = _mm_mulhi_epi16(s, v);
+		__m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), VOLUME_SHIFT);
+		__m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), VOLUME_SHIFT);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(a, b));
+	}
+#elif defined(AUDIO_VOLUME_NEON)
+	int16x4_t v = vdup_n_s16((int16_t)volume);
+	for(; i + 8 <= count; i += 8)
+	{
+		int16x8_t s = vld1q_s16(src + i);
+		int32x4_t a = vmull_s16(vget_low_s16(s), v);
+		int32x4_t b = vmull_s16(vget_high_s16(s), v);
+		vst1q_s16(dst + i, vcombine_s16(vqshrn_n_s32(a, VOLUME_SHIFT), vqshrn_n_s32(b, VOLUME_SHIFT)));
+	}
+#endif
+	for(; i < count; i++)
+		dst[i] = (int16_t)(((int32_t)src[i] * volume) >> VOLUME_SHIFT);
+}
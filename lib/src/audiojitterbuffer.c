@@ -0,0 +1,317 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/audiojitterbuffer.h>
+
+#include <string.h>
+
+#define INDEX_VALID 0x10000
+
+#define SLOT_EMPTY 0
+#define SLOT_WRITING 1
+#define SLOT_FULL 2
+#define SLOT_READING 3
+
+// RFC 3550 A.8
+#define JITTER_GAIN 16.0
+
+// target delay in multiples of the smoothed jitter
+#define JITTER_TARGET_MULT 4
+
+// skip ahead instead of stretching if the buffer grew beyond max_delay times this
+#define CATCH_UP_FACTOR 2
+
+static inline bool index_valid(uint32_t v) { return (v & INDEX_VALID) != 0; }
+static inline ChiakiSeqNum16 index_get(uint32_t v) { return (ChiakiSeqNum16)(v & 0xffff); }
+static inline uint32_t index_pack(ChiakiSeqNum16 index) { return INDEX_VALID | index; }
+static inline int32_t index_diff(ChiakiSeqNum16 a, ChiakiSeqNum16 b) { return (int16_t)(uint16_t)(a - b); }
+
+static uint32_t ms_to_frames(uint32_t ms, uint32_t frame_duration_us)
+{
+	uint64_t us = (uint64_t)ms * 1000;
+	return (uint32_t)((us + frame_duration_us - 1) / frame_duration_us);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_jitter_buffer_init(ChiakiAudioJitterBuffer *jb, size_t size_exp, uint32_t frame_duration_us,
+		uint32_t min_delay_ms, uint32_t max_delay_ms)
+{
+	if(!frame_duration_us || min_delay_ms > max_delay_ms || size_exp > 15)
+		return CHIAKI_ERR_INVALID_DATA;
+
+	jb->size_exp = size_exp;
+	jb->frame_duration_us = frame_duration_us;
+	jb->min_delay_frames = ms_to_frames(min_delay_ms, frame_duration_us);
+	if(jb->min_delay_frames < 1)
+		jb->min_delay_frames = 1;
+	jb->max_delay_frames = ms_to_frames(max_delay_ms, frame_duration_us);
+	if(jb->max_delay_frames < jb->min_delay_frames)
+		jb->max_delay_frames = jb->min_delay_frames;
+	if(jb->max_delay_frames >= chiaki_audio_jitter_buffer_size(jb))
+		return CHIAKI_ERR_INVALID_DATA;
+	jb->conceal_frames_max = 0;
+
+	jb->slots = calloc(chiaki_audio_jitter_buffer_size(jb), sizeof(ChiakiAudioJitterBufferSlot));
+	if(!jb->slots)
+		return CHIAKI_ERR_MEMORY;
+
+	jb->first_index = 0;
+	jb->newest_index = 0;
+	jb->next_index = 0;
+	jb->jitter_us = 0;
+
+	jb->arrival_valid = false;
+	jb->arrival_prev_us = 0;
+	jb->arrival_prev_index = 0;
+	jb->jitter = 0.0;
+
+	jb->started = false;
+	jb->buffering = true;
+	jb->index = 0;
+
+	jb->received = 0;
+	jb->late = 0;
+	jb->overflow = 0;
+	jb->missing = 0;
+	jb->dropped = 0;
+
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_audio_jitter_buffer_fini(ChiakiAudioJitterBuffer *jb)
+{
+	free(jb->slots);
+	jb->slots = NULL;
+}
+
+static void update_jitter(ChiakiAudioJitterBuffer *jb, ChiakiSeqNum16 frame_index, uint64_t arrival_us)
+{
+	if(jb->arrival_valid)
+	{
+		int32_t index_delta = index_diff(frame_index, jb->arrival_prev_index);
+		if(index_delta <= 0)
+			return; // reordered, don't disturb the estimate
+		int64_t d = (int64_t)(arrival_us - jb->arrival_prev_us) - (int64_t)index_delta * jb->frame_duration_us;
+		if(d < 0)
+			d = -d;
+		jb->jitter += ((double)d - jb->jitter) / JITTER_GAIN;
+		chiaki_atomic_store_u32(&jb->jitter_us, (uint32_t)jb->jitter);
+	}
+	jb->arrival_valid = true;
+	jb->arrival_prev_us = arrival_us;
+	jb->arrival_prev_index = frame_index;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_jitter_buffer_push(ChiakiAudioJitterBuffer *jb, ChiakiSeqNum16 frame_index,
+		const uint8_t *buf, size_t buf_size, uint64_t arrival_us)
+{
+	if(buf_size > CHIAKI_AUDIO_JITTER_BUFFER_FRAME_SIZE_MAX)
+	{
+		chiaki_atomic_fetch_add_u64(&jb->overflow, 1);
+		return CHIAKI_ERR_BUF_TOO_SMALL;
+	}
+
+	chiaki_atomic_fetch_add_u64(&jb->received, 1);
+
+	uint32_t next = chiaki_atomic_load_u32(&jb->next_index);
+	if(index_valid(next) && index_diff(frame_index, index_get(next)) < 0)
+	{
+		chiaki_atomic_fetch_add_u64(&jb->late, 1);
+		return CHIAKI_ERR_SUCCESS;
+	}
+
+	update_jitter(jb, frame_index, arrival_us);
+
+	ChiakiAudioJitterBufferSlot *slot = &jb->slots[frame_index & (chiaki_audio_jitter_buffer_size(jb) - 1)];
+	uint32_t state = chiaki_atomic_load_u32(&slot->state);
+	bool acquired = false;
+	if(state == SLOT_EMPTY)
+		acquired = chiaki_atomic_cas_u32(&slot->state, SLOT_EMPTY, SLOT_WRITING);
+	else if(state == SLOT_FULL)
+	{
+		// frame_index of a full slot is only ever written by us, so it is safe to read here
+		if(slot->frame_index == frame_index)
+			return CHIAKI_ERR_SUCCESS;
+		// the consumer has already passed this frame without taking it
+		if(index_valid(next) && index_diff(slot->frame_index, index_get(next)) < 0)
+			acquired = chiaki_atomic_cas_u32(&slot->state, SLOT_FULL, SLOT_WRITING);
+	}
+
+	if(!acquired)
+	{
+		chiaki_atomic_fetch_add_u64(&jb->overflow, 1);
+		return CHIAKI_ERR_OVERFLOW;
+	}
+
+	slot->frame_index = frame_index;
+	slot->size = buf_size;
+	memcpy(slot->buf, buf, buf_size);
+	chiaki_atomic_store_u32(&slot->state, SLOT_FULL);
+
+	uint32_t newest = chiaki_atomic_load_u32(&jb->newest_index);
+	if(!index_valid(newest) || index_diff(frame_index, index_get(newest)) > 0)
+		chiaki_atomic_store_u32(&jb->newest_index, index_pack(frame_index));
+	if(!index_valid(chiaki_atomic_load_u32(&jb->first_index)))
+		chiaki_atomic_store_u32(&jb->first_index, index_pack(frame_index));
+
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT uint32_t chiaki_audio_jitter_buffer_depth(ChiakiAudioJitterBuffer *jb)
+{
+	uint32_t newest = chiaki_atomic_load_u32(&jb->newest_index);
+	if(!index_valid(newest))
+		return 0;
+	uint32_t next = chiaki_atomic_load_u32(&jb->next_index);
+	if(!index_valid(next))
+		next = chiaki_atomic_load_u32(&jb->first_index);
+	int32_t depth = index_diff(index_get(newest), index_get(next)) + 1;
+	return depth > 0 ? (uint32_t)depth : 0;
+}
+
+CHIAKI_EXPORT uint32_t chiaki_audio_jitter_buffer_target_frames(ChiakiAudioJitterBuffer *jb)
+{
+	uint64_t jitter_us = chiaki_atomic_load_u32(&jb->jitter_us);
+	// one more frame for the one currently being played out
+	uint64_t target = (JITTER_TARGET_MULT * jitter_us + jb->frame_duration_us - 1) / jb->frame_duration_us + 1;
+	if(target < jb->min_delay_frames)
+		return jb->min_delay_frames;
+	if(target > jb->max_delay_frames)
+		return jb->max_delay_frames;
+	return (uint32_t)target;
+}
+
+static void advance(ChiakiAudioJitterBuffer *jb, uint32_t frames)
+{
+	jb->index += (ChiakiSeqNum16)frames;
+	chiaki_atomic_store_u32(&jb->next_index, index_pack(jb->index));
+}
+
+/**
+ * Take the frame at jb->index if it is there.
+ */
+static bool take(ChiakiAudioJitterBuffer *jb, uint8_t *buf, size_t *buf_size)
+{
+	ChiakiAudioJitterBufferSlot *slot = &jb->slots[jb->index & (chiaki_audio_jitter_buffer_size(jb) - 1)];
+	if(!chiaki_atomic_cas_u32(&slot->state, SLOT_FULL, SLOT_READING))
+		return false;
+	if(slot->frame_index == jb->index)
+	{
+		memcpy(buf, slot->buf, slot->size);
+		*buf_size = slot->size;
+		chiaki_atomic_store_u32(&slot->state, SLOT_EMPTY);
+		advance(jb, 1);
+		return true;
+	}
+	if(index_diff(slot->frame_index, jb->index) < 0)
+		chiaki_atomic_store_u32(&slot->state, SLOT_EMPTY); // stale
+	else
+		chiaki_atomic_store_u32(&slot->state, SLOT_FULL); // newer frame that already wrapped around
+	return false;
+}
+
+/**
+ * Number of missing frames in a row starting at jb->index, up to the first one that is there.
+ */
+static uint32_t gap_frames(ChiakiAudioJitterBuffer *jb, ChiakiSeqNum16 newest)
+{
+	uint32_t gap = 0;
+	for(ChiakiSeqNum16 index = jb->index; index_diff(newest, index) > 0; index++, gap++)
+	{
+		ChiakiAudioJitterBufferSlot *slot = &jb->slots[index & (chiaki_audio_jitter_buffer_size(jb) - 1)];
+		if(!chiaki_atomic_cas_u32(&slot->state, SLOT_FULL, SLOT_READING))
+			continue;
+		bool present = slot->frame_index == index;
+		chiaki_atomic_store_u32(&slot->state, SLOT_FULL);
+		if(present)
+			break;
+	}
+	return gap;
+}
+
+CHIAKI_EXPORT ChiakiAudioJitterBufferPopResult chiaki_audio_jitter_buffer_pop(ChiakiAudioJitterBuffer *jb,
+		uint8_t *buf, size_t *buf_size, ChiakiSeqNum16 *frame_index)
+{
+	if(!jb->started)
+	{
+		uint32_t first = chiaki_atomic_load_u32(&jb->first_index);
+		if(!index_valid(first))
+			return CHIAKI_AUDIO_JITTER_BUFFER_POP_EMPTY;
+		jb->index = index_get(first);
+		jb->started = true;
+		jb->buffering = true;
+		advance(jb, 0);
+	}
+
+	uint32_t depth = chiaki_audio_jitter_buffer_depth(jb);
+	uint32_t target = chiaki_audio_jitter_buffer_target_frames(jb);
+	if(jb->buffering)
+	{
+		if(depth < target)
+			return CHIAKI_AUDIO_JITTER_BUFFER_POP_EMPTY;
+		jb->buffering = false;
+	}
+	else if(depth > CATCH_UP_FACTOR * jb->max_delay_frames)
+	{
+		// e.g. the consumer stalled, stretching through this would take forever
+		uint32_t skip = depth - target;
+		chiaki_atomic_fetch_add_u64(&jb->dropped, skip);
+		advance(jb, skip);
+	}
+
+	*frame_index = jb->index;
+	if(take(jb, buf, buf_size))
+		return CHIAKI_AUDIO_JITTER_BUFFER_POP_FRAME;
+
+	uint32_t newest = chiaki_atomic_load_u32(&jb->newest_index);
+	if(index_valid(newest) && index_diff(index_get(newest), jb->index) > 0)
+	{
+		// a gap only shrinks by late arrivals, so this decides once for its first frame
+		uint32_t gap = jb->conceal_frames_max ? gap_frames(jb, index_get(newest)) : 0;
+		if(gap > jb->conceal_frames_max)
+		{
+			chiaki_atomic_fetch_add_u64(&jb->missing, gap);
+			advance(jb, gap);
+			*frame_index = jb->index;
+			if(take(jb, buf, buf_size))
+				return CHIAKI_AUDIO_JITTER_BUFFER_POP_FRAME;
+			// the frame after the gap was taken away meanwhile, nothing more to skip to
+			jb->buffering = true;
+			return CHIAKI_AUDIO_JITTER_BUFFER_POP_EMPTY;
+		}
+		chiaki_atomic_fetch_add_u64(&jb->missing, 1);
+		advance(jb, 1);
+		return CHIAKI_AUDIO_JITTER_BUFFER_POP_MISSING;
+	}
+
+	// underrun, build up the target delay again before continuing
+	jb->buffering = true;
+	return CHIAKI_AUDIO_JITTER_BUFFER_POP_EMPTY;
+}
+
+CHIAKI_EXPORT bool chiaki_audio_jitter_buffer_peek(ChiakiAudioJitterBuffer *jb, uint8_t *buf, size_t *buf_size)
+{
+	if(!jb->started)
+		return false;
+	ChiakiAudioJitterBufferSlot *slot = &jb->slots[jb->index & (chiaki_audio_jitter_buffer_size(jb) - 1)];
+	if(!chiaki_atomic_cas_u32(&slot->state, SLOT_FULL, SLOT_READING))
+		return false;
+	bool r = slot->frame_index == jb->index;
+	if(r)
+	{
+		memcpy(buf, slot->buf, slot->size);
+		*buf_size = slot->size;
+	}
+	chiaki_atomic_store_u32(&slot->state, SLOT_FULL);
+	return r;
+}
+
+CHIAKI_EXPORT void chiaki_audio_jitter_buffer_get_stats(ChiakiAudioJitterBuffer *jb, ChiakiAudioJitterBufferStats *stats)
+{
+	stats->received = chiaki_atomic_load_u64(&jb->received);
+	stats->late = chiaki_atomic_load_u64(&jb->late);
+	stats->overflow = chiaki_atomic_load_u64(&jb->overflow);
+	stats->missing = chiaki_atomic_load_u64(&jb->missing);
+	stats->dropped = chiaki_atomic_load_u64(&jb->dropped);
+	stats->jitter_us = chiaki_atomic_load_u32(&jb->jitter_us);
+	stats->target_delay_us = chiaki_audio_jitter_buffer_target_frames(jb) * jb->frame_duration_us;
+	stats->depth_us = chiaki_audio_jitter_buffer_depth(jb) * jb->frame_duration_us;
+}
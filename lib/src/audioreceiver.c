@@ -44,6 +44,8 @@ CHIAKI_EXPORT void chiaki_audio_receiver_stream_info(ChiakiAudioReceiver *audio_
 
 	if(audio_receiver->session->audio_sink.header_cb)
 		audio_receiver->session->audio_sink.header_cb(audio_header, audio_receiver->session->audio_sink.user);
+	if(audio_receiver->session->record_sink.audio_header_cb)
+		audio_receiver->session->record_sink.audio_header_cb(audio_header, audio_receiver->session->record_sink.user);
 
 	chiaki_mutex_unlock(&audio_receiver->mutex);
 }
@@ -118,9 +120,12 @@ static void chiaki_audio_receiver_frame(ChiakiAudioReceiver *audio_receiver, Chi
 	audio_receiver->frame_index_prev = frame_index;
 
 	if(is_haptics && audio_receiver->session->haptics_sink.frame_cb)
-		audio_receiver->session->haptics_sink.frame_cb(buf, buf_size, audio_receiver->session->haptics_sink.user);
+		audio_receiver->session->haptics_sink.frame_cb(buf, buf_size, frame_index, audio_receiver->session->haptics_sink.user);
 	else if(!is_haptics && audio_receiver->session->audio_sink.frame_cb)
-		audio_receiver->session->audio_sink.frame_cb(buf, buf_size, audio_receiver->session->audio_sink.user);
+		audio_receiver->session->audio_sink.frame_cb(buf, buf_size, frame_index, audio_receiver->session->audio_sink.user);
+
+	if(!is_haptics && audio_receiver->session->record_sink.audio_frame_cb)
+		audio_receiver->session->record_sink.audio_frame_cb(buf, buf_size, frame_index, audio_receiver->session->record_sink.user);
 
 beach:
 	chiaki_mutex_unlock(&audio_receiver->mutex);
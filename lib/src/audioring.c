@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/audioring.h>
+
+#include <string.h>
+
+// positions are uint32 and wrap, so the capacity must stay well below 2^32
+#define SIZE_EXP_MAX 24
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_ring_init(ChiakiAudioRing *ring, unsigned int channels, size_t frames_min)
+{
+	if(!channels)
+		return CHIAKI_ERR_INVALID_DATA;
+
+	size_t size_exp = 0;
+	while((((size_t)1) << size_exp) < frames_min)
+	{
+		size_exp++;
+		if(size_exp > SIZE_EXP_MAX)
+			return CHIAKI_ERR_INVALID_DATA;
+	}
+
+	ring->channels = channels;
+	ring->size_exp = size_exp;
+	ring->buf = calloc(chiaki_audio_ring_capacity(ring) * channels, sizeof(int16_t));
+	if(!ring->buf)
+		return CHIAKI_ERR_MEMORY;
+
+	ring->write_pos = 0;
+	ring->read_pos = 0;
+	ring->written = 0;
+	ring->overflow = 0;
+	ring->underrun = 0;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_audio_ring_fini(ChiakiAudioRing *ring)
+{
+	free(ring->buf);
+	ring->buf = NULL;
+}
+
+CHIAKI_EXPORT size_t chiaki_audio_ring_write(ChiakiAudioRing *ring, const int16_t *buf, size_t frames)
+{
+	size_t capacity = chiaki_audio_ring_capacity(ring);
+	uint32_t w = ring->write_pos; // only we write it
+	uint32_t r = chiaki_atomic_load_u32(&ring->read_pos);
+	size_t free_frames = capacity - (size_t)(uint32_t)(w - r);
+
+	size_t count = frames < free_frames ? frames : free_frames;
+	if(count < frames)
+		chiaki_atomic_fetch_add_u64(&ring->overflow, frames - count);
+	if(!count)
+		return 0;
+
+	size_t offset = w & (capacity - 1);
+	size_t first = capacity - offset;
+	if(first > count)
+		first = count;
+	memcpy(ring->buf + offset * ring->channels, buf, first * ring->channels * sizeof(int16_t));
+	if(count > first)
+		memcpy(ring->buf, buf + first * ring->channels, (count - first) * ring->channels * sizeof(int16_t));
+
+	chiaki_atomic_store_u32(&ring->write_pos, w + (uint32_t)count);
+	chiaki_atomic_fetch_add_u64(&ring->written, count);
+	return count;
+}
+
+CHIAKI_EXPORT size_t chiaki_audio_ring_read(ChiakiAudioRing *ring, int16_t *buf, size_t frames)
+{
+	size_t capacity = chiaki_audio_ring_capacity(ring);
+	uint32_t r = ring->read_pos; // only we write it
+	uint32_t w = chiaki_atomic_load_u32(&ring->write_pos);
+	size_t available = (size_t)(uint32_t)(w - r);
+
+	size_t count = frames < available ? frames : available;
+	if(count < frames)
+		chiaki_atomic_fetch_add_u64(&ring->underrun, frames - count);
+	if(!count)
+		return 0;
+
+	size_t offset = r & (capacity - 1);
+	size_t first = capacity - offset;
+	if(first > count)
+		first = count;
+	memcpy(buf, ring->buf + offset * ring->channels, first * ring->channels * sizeof(int16_t));
+	if(count > first)
+		memcpy(buf + first * ring->channels, ring->buf, (count - first) * ring->channels * sizeof(int16_t));
+
+	chiaki_atomic_store_u32(&ring->read_pos, r + (uint32_t)count);
+	return count;
+}
+
+CHIAKI_EXPORT void chiaki_audio_ring_clear(ChiakiAudioRing *ring)
+{
+	chiaki_atomic_store_u32(&ring->read_pos, chiaki_atomic_load_u32(&ring->write_pos));
+}
+
+CHIAKI_EXPORT void chiaki_audio_ring_get_stats(ChiakiAudioRing *ring, ChiakiAudioRingStats *stats)
+{
+	stats->written = chiaki_atomic_load_u64(&ring->written);
+	stats->overflow = chiaki_atomic_load_u64(&ring->overflow);
+	stats->underrun = chiaki_atomic_load_u64(&ring->underrun);
+}
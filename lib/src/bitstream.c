@@ -173,6 +173,8 @@ static bool slice_h264(ChiakiBitstream *bitstream, uint8_t *data, unsigned size,
 		return false;
 	}
 
+	slice->idr = nal_unit_type == 5;
+
 	struct vl_rbsp rbsp;
 	vl_rbsp_init(&rbsp, &vlc, ~0);
 	vl_rbsp_ue(&rbsp); // first_mb_in_slice
@@ -240,16 +242,18 @@ static bool slice_h265(ChiakiBitstream *bitstream, uint8_t *data, unsigned size,
 	vl_vlc_eatbits(&vlc, 6); // nuh_layer_id
 	vl_vlc_eatbits(&vlc, 3); // nuh_temporal_id_plus1
 
-	if(nal_unit_type != 1 && nal_unit_type != 20)
+	if(nal_unit_type != 1 && nal_unit_type != 19 && nal_unit_type != 20)
 	{
 		CHIAKI_LOGW(bitstream->log, "parse_slice_h265: Unexpected NAL unit type %u", nal_unit_type);
 		return false;
 	}
 
+	slice->idr = nal_unit_type != 1;
+
 	struct vl_rbsp rbsp;
 	vl_rbsp_init(&rbsp, &vlc, ~0);
 	unsigned first_slice_segment_in_pic_flag = vl_rbsp_u(&rbsp, 1);
-	if(nal_unit_type == 20)
+	if(slice->idr)
 		vl_rbsp_u(&rbsp, 1); // no_output_of_prior_pics_flag
 
 	vl_rbsp_ue(&rbsp); // slice_pic_parameter_set_id
@@ -1,12 +1,299 @@
 // SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
 
 #include <chiaki/congestioncontrol.h>
+#include <chiaki/time.h>
+
+#include <string.h>
 
 #define CONGESTION_CONTROL_INTERVAL_MS 200
 
+// frame gap after which the delay history is considered meaningless and tracking restarts
+#define FRAME_GAP_MAX_US 1000000
+
+#define DELAY_SMOOTHING 0.9
+// how fast the no-queue baseline may rise, in us per us, to follow clock drift between the two ends
+#define DELAY_BASE_DRIFT 0.001
+
+// same constants as WebRTC's trendline estimator
+#define TREND_SAMPLES_MAX 60
+#define TREND_GAIN 4.0
+#define TREND_THRESHOLD_MS 12.5
+#define OVERUSE_SAMPLES_MIN 2
+
+// a standing queue is overuse even if it is not growing anymore
+#define QUEUE_DELAY_MAX_US 80000
+
+// loss counts as congestion when it coincides with this much queueing
+#define QUEUE_DELAY_LOSS_US 20000
+
+// instant attack, slow release
+#define LOSS_RELEASE 0.7
+
+CHIAKI_EXPORT const char *chiaki_congestion_control_policy_string(ChiakiCongestionControlPolicy policy)
+{
+	switch(policy)
+	{
+		case CHIAKI_CONGESTION_CONTROL_POLICY_LEGACY:
+			return "legacy";
+		case CHIAKI_CONGESTION_CONTROL_POLICY_LOSS:
+			return "loss";
+		case CHIAKI_CONGESTION_CONTROL_POLICY_DELAY:
+			return "delay";
+		default:
+			return "unknown";
+	}
+}
+
+CHIAKI_EXPORT void chiaki_congestion_estimator_init(ChiakiCongestionEstimator *estimator, ChiakiCongestionControlPolicy policy, double packet_loss_max, uint64_t frame_interval_us)
+{
+	memset(estimator, 0, sizeof(*estimator));
+	estimator->policy = policy;
+	estimator->packet_loss_max = packet_loss_max;
+	estimator->frame_interval_us = frame_interval_us;
+	estimator->signal = CHIAKI_CONGESTION_SIGNAL_NORMAL;
+}
+
+static void estimator_restart_delay(ChiakiCongestionEstimator *estimator, ChiakiSeqNum16 frame_index, uint64_t arrival_us)
+{
+	estimator->have_frame = true;
+	estimator->frame_index_last = frame_index;
+	estimator->arrival_first_us = arrival_us;
+	estimator->arrival_last_us = arrival_us;
+	estimator->delay_us = 0.0;
+	estimator->delay_smoothed_us = 0.0;
+	estimator->delay_base_us = 0.0;
+	estimator->trend_samples = 0;
+	estimator->trend = 0.0;
+	estimator->overuse_samples = 0;
+	estimator->signal = CHIAKI_CONGESTION_SIGNAL_NORMAL;
+}
+
+static double estimator_trend(ChiakiCongestionEstimator *estimator)
+{
+	size_t n = estimator->trend_samples < CHIAKI_CONGESTION_ESTIMATOR_TREND_WINDOW
+		? (size_t)estimator->trend_samples : CHIAKI_CONGESTION_ESTIMATOR_TREND_WINDOW;
+	double x_avg = 0.0;
+	double y_avg = 0.0;
+	for(size_t i=0; i<n; i++)
+	{
+		x_avg += estimator->trend_x[i];
+		y_avg += estimator->trend_y[i];
+	}
+	x_avg /= n;
+	y_avg /= n;
+
+	double num = 0.0;
+	double den = 0.0;
+	for(size_t i=0; i<n; i++)
+	{
+		double dx = estimator->trend_x[i] - x_avg;
+		num += dx * (estimator->trend_y[i] - y_avg);
+		den += dx * dx;
+	}
+	return den > 0.0 ? num / den : 0.0;
+}
+
+static void estimator_detect(ChiakiCongestionEstimator *estimator)
+{
+	if(estimator->trend_samples < CHIAKI_CONGESTION_ESTIMATOR_TREND_WINDOW)
+		return;
+
+	uint64_t samples = estimator->trend_samples < TREND_SAMPLES_MAX ? estimator->trend_samples : TREND_SAMPLES_MAX;
+	double modified_trend = samples * estimator->trend * TREND_GAIN;
+
+	if(modified_trend > TREND_THRESHOLD_MS || chiaki_congestion_estimator_queue_delay_us(estimator) > QUEUE_DELAY_MAX_US)
+	{
+		// require it to persist so a single late frame does not count
+		if(estimator->overuse_samples < OVERUSE_SAMPLES_MIN)
+			estimator->overuse_samples++;
+		if(estimator->overuse_samples >= OVERUSE_SAMPLES_MIN)
+			estimator->signal = CHIAKI_CONGESTION_SIGNAL_OVERUSE;
+		return;
+	}
+
+	estimator->overuse_samples = 0;
+	estimator->signal = modified_trend < -TREND_THRESHOLD_MS
+		? CHIAKI_CONGESTION_SIGNAL_UNDERUSE
+		: CHIAKI_CONGESTION_SIGNAL_NORMAL;
+}
+
+CHIAKI_EXPORT void chiaki_congestion_estimator_push_frame(ChiakiCongestionEstimator *estimator, ChiakiSeqNum16 frame_index, uint64_t arrival_us)
+{
+	if(!estimator->frame_interval_us)
+		return;
+
+	if(!estimator->have_frame)
+	{
+		estimator_restart_delay(estimator, frame_index, arrival_us);
+		return;
+	}
+
+	if(!chiaki_seq_num_16_gt(frame_index, estimator->frame_index_last))
+		return;
+
+	uint64_t send_delta_us = (uint64_t)(ChiakiSeqNum16)(frame_index - estimator->frame_index_last) * estimator->frame_interval_us;
+	if(arrival_us < estimator->arrival_last_us
+		|| send_delta_us > FRAME_GAP_MAX_US
+		|| arrival_us - estimator->arrival_last_us > FRAME_GAP_MAX_US)
+	{
+		estimator_restart_delay(estimator, frame_index, arrival_us);
+		return;
+	}
+
+	uint64_t arrival_delta_us = arrival_us - estimator->arrival_last_us;
+	estimator->delay_us += (double)arrival_delta_us - (double)send_delta_us;
+	estimator->delay_smoothed_us = DELAY_SMOOTHING * estimator->delay_smoothed_us + (1.0 - DELAY_SMOOTHING) * estimator->delay_us;
+
+	if(estimator->delay_smoothed_us < estimator->delay_base_us)
+		estimator->delay_base_us = estimator->delay_smoothed_us;
+	else
+	{
+		estimator->delay_base_us += DELAY_BASE_DRIFT * arrival_delta_us;
+		if(estimator->delay_base_us > estimator->delay_smoothed_us)
+			estimator->delay_base_us = estimator->delay_smoothed_us;
+	}
+
+	size_t i = estimator->trend_samples % CHIAKI_CONGESTION_ESTIMATOR_TREND_WINDOW;
+	estimator->trend_x[i] = (arrival_us - estimator->arrival_first_us) / 1000.0;
+	estimator->trend_y[i] = estimator->delay_smoothed_us / 1000.0;
+	estimator->trend_samples++;
+	estimator->trend = estimator_trend(estimator);
+
+	estimator->frame_index_last = frame_index;
+	estimator->arrival_last_us = arrival_us;
+
+	estimator_detect(estimator);
+}
+
+CHIAKI_EXPORT void chiaki_congestion_estimator_push_fec(ChiakiCongestionEstimator *estimator, bool recovered)
+{
+	if(recovered)
+		estimator->fec_recovered++;
+	else
+		estimator->fec_failed++;
+}
+
+static double estimator_congestion_loss(ChiakiCongestionEstimator *estimator, double loss)
+{
+	// Loss that FEC fully repaired looks like random drops rather than an overflowing queue,
+	// which would produce bursts that FEC can not cover.
+	bool repaired = estimator->fec_recovered && !estimator->fec_failed;
+	switch(estimator->policy)
+	{
+		case CHIAKI_CONGESTION_CONTROL_POLICY_LOSS:
+			return repaired ? loss * 0.5 : loss;
+		case CHIAKI_CONGESTION_CONTROL_POLICY_DELAY:
+			// unless a queue is building up at the same time
+			return repaired && chiaki_congestion_estimator_queue_delay_us(estimator) < QUEUE_DELAY_LOSS_US ? 0.0 : loss;
+		default:
+			return loss;
+	}
+}
+
+CHIAKI_EXPORT void chiaki_congestion_estimator_report(ChiakiCongestionEstimator *estimator, uint64_t received, uint64_t lost, ChiakiTakionCongestionPacket *packet)
+{
+	uint64_t total = received + lost;
+	double loss = total > 0 ? (double)lost / total : 0;
+	estimator->packet_loss = loss;
+
+	double congestion_loss = estimator_congestion_loss(estimator, loss);
+	if(congestion_loss > estimator->loss_smoothed)
+		estimator->loss_smoothed = congestion_loss;
+	else
+		estimator->loss_smoothed = LOSS_RELEASE * estimator->loss_smoothed + (1.0 - LOSS_RELEASE) * congestion_loss;
+
+	double reported;
+	switch(estimator->policy)
+	{
+		case CHIAKI_CONGESTION_CONTROL_POLICY_LOSS:
+			reported = estimator->loss_smoothed;
+			break;
+		case CHIAKI_CONGESTION_CONTROL_POLICY_DELAY:
+			if(estimator->signal == CHIAKI_CONGESTION_SIGNAL_OVERUSE)
+			{
+				estimator->overuse_reports++;
+				reported = estimator->packet_loss_max;
+			}
+			else
+				reported = estimator->loss_smoothed;
+			break;
+		default:
+			reported = loss;
+			break;
+	}
+	if(reported > estimator->packet_loss_max)
+		reported = estimator->packet_loss_max;
+	estimator->packet_loss_reported = reported;
+
+	estimator->fec_recovered = 0;
+	estimator->fec_failed = 0;
+
+	memset(packet, 0, sizeof(*packet));
+	if(estimator->policy == CHIAKI_CONGESTION_CONTROL_POLICY_LEGACY)
+	{
+		if(loss > estimator->packet_loss_max)
+		{
+			lost = total * estimator->packet_loss_max;
+			received = total - lost;
+		}
+		packet->received = (uint16_t)received;
+		packet->lost = (uint16_t)lost;
+		return;
+	}
+
+	if(total > UINT16_MAX)
+		total = UINT16_MAX;
+	uint64_t lost_reported = (uint64_t)(total * reported + 0.5);
+	if(lost_reported > total)
+		lost_reported = total;
+	packet->received = (uint16_t)(total - lost_reported);
+	packet->lost = (uint16_t)lost_reported;
+}
+
+static void samples_reset(ChiakiCongestionControl *control)
+{
+	chiaki_atomic_store_u32(&control->samples_write, 0);
+	chiaki_atomic_store_u32(&control->samples_read, 0);
+	chiaki_atomic_store_u64(&control->samples_dropped, 0);
+}
+
+static void samples_push(ChiakiCongestionControl *control, ChiakiCongestionControlSampleType type, ChiakiSeqNum16 frame_index, uint64_t arrival_us)
+{
+	uint32_t write = chiaki_atomic_load_u32(&control->samples_write);
+	if(write - chiaki_atomic_load_u32(&control->samples_read) >= CHIAKI_CONGESTION_CONTROL_SAMPLES_SIZE)
+	{
+		chiaki_atomic_fetch_add_u64(&control->samples_dropped, 1);
+		return;
+	}
+	ChiakiCongestionControlSample *sample = &control->samples[write % CHIAKI_CONGESTION_CONTROL_SAMPLES_SIZE];
+	sample->type = type;
+	sample->frame_index = frame_index;
+	sample->arrival_us = arrival_us;
+	chiaki_atomic_store_u32(&control->samples_write, write + 1);
+}
+
+/**
+ * Feed all queued samples to the estimator, estimator_mutex must be locked.
+ */
+static void samples_drain(ChiakiCongestionControl *control)
+{
+	uint32_t read = chiaki_atomic_load_u32(&control->samples_read);
+	uint32_t write = chiaki_atomic_load_u32(&control->samples_write);
+	for(; read != write; read++)
+	{
+		ChiakiCongestionControlSample *sample = &control->samples[read % CHIAKI_CONGESTION_CONTROL_SAMPLES_SIZE];
+		if(sample->type == CHIAKI_CONGESTION_CONTROL_SAMPLE_FRAME)
+			chiaki_congestion_estimator_push_frame(&control->estimator, sample->frame_index, sample->arrival_us);
+		else
+			chiaki_congestion_estimator_push_fec(&control->estimator, sample->type == CHIAKI_CONGESTION_CONTROL_SAMPLE_FEC_RECOVERED);
+	}
+	chiaki_atomic_store_u32(&control->samples_read, read);
+}
+
 static void *congestion_control_thread_func(void *user)
 {
 	ChiakiCongestionControl *control = user;
+	chiaki_thread_apply_role(CHIAKI_THREAD_ROLE_FEEDBACK);
 
 	ChiakiErrorCode err = chiaki_bool_pred_cond_lock(&control->stop_cond);
 	if(err != CHIAKI_ERR_SUCCESS)
@@ -20,20 +307,22 @@ static void *congestion_control_thread_func(void *user)
 
 		uint64_t received;
 		uint64_t lost;
-		chiaki_packet_stats_get(control->stats, true, &received, &lost);
-		ChiakiTakionCongestionPacket packet = { 0 };
-		uint64_t total = received + lost;
-		control->packet_loss = total > 0 ? (double)lost / total : 0;
+		chiaki_packet_stats_get_since(control->stats, &control->stats_cursor, &received, &lost);
+		ChiakiTakionCongestionPacket packet;
+
+		chiaki_mutex_lock(&control->estimator_mutex);
+		samples_drain(control);
+		chiaki_congestion_estimator_report(&control->estimator, received, lost, &packet);
+		control->packet_loss = control->estimator.packet_loss;
+		ChiakiCongestionSignal signal = control->estimator.signal;
+		uint32_t queue_delay_us = chiaki_congestion_estimator_queue_delay_us(&control->estimator);
+		chiaki_mutex_unlock(&control->estimator_mutex);
+
 		if(control->packet_loss > control->packet_loss_max)
-		{
 			CHIAKI_LOGW(control->takion->log, "Increasing received packets to reduce hit on stream quality");
-			lost = total * control->packet_loss_max;
-			received = total - lost;
-		}
-		packet.received = (uint16_t)received;
-		packet.lost = (uint16_t)lost;
-		CHIAKI_LOGV(control->takion->log, "Sending Congestion Control Packet, received: %u, lost: %u",
-			(unsigned int)packet.received, (unsigned int)packet.lost);
+		CHIAKI_LOGV(control->takion->log, "Sending Congestion Control Packet, received: %u, lost: %u, queue delay: %u us%s",
+			(unsigned int)packet.received, (unsigned int)packet.lost, (unsigned int)queue_delay_us,
+			signal == CHIAKI_CONGESTION_SIGNAL_OVERUSE ? ", overuse" : "");
 		chiaki_takion_send_congestion(control->takion, &packet);
 	}
 
@@ -41,12 +330,36 @@ static void *congestion_control_thread_func(void *user)
 	return NULL;
 }
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_start(ChiakiCongestionControl *control, ChiakiTakion *takion, ChiakiPacketStats *stats, double packet_loss_max)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_init(ChiakiCongestionControl *control, ChiakiCongestionControlPolicy policy, double packet_loss_max)
+{
+	control->takion = NULL;
+	control->stats = NULL;
+	control->thread.thread = 0;
+	control->packet_loss_max = packet_loss_max;
+	control->packet_loss = 0;
+	chiaki_congestion_estimator_init(&control->estimator, policy, packet_loss_max, 0);
+	samples_reset(control);
+	return chiaki_mutex_init(&control->estimator_mutex, false);
+}
+
+CHIAKI_EXPORT void chiaki_congestion_control_fini(ChiakiCongestionControl *control)
+{
+	chiaki_mutex_fini(&control->estimator_mutex);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_start(ChiakiCongestionControl *control, ChiakiTakion *takion, ChiakiPacketStats *stats, unsigned int max_fps)
 {
 	control->takion = takion;
 	control->stats = stats;
-	control->packet_loss_max = packet_loss_max;
+	memset(&control->stats_cursor, 0, sizeof(control->stats_cursor));
 	control->packet_loss = 0;
+	samples_reset(control);
+
+	chiaki_mutex_lock(&control->estimator_mutex);
+	chiaki_congestion_estimator_init(&control->estimator, control->estimator.policy, control->packet_loss_max,
+		max_fps ? 1000000 / max_fps : 0);
+	chiaki_mutex_unlock(&control->estimator_mutex);
+	CHIAKI_LOGI(takion->log, "Congestion Control using %s policy", chiaki_congestion_control_policy_string(control->estimator.policy));
 
 	ChiakiErrorCode err = chiaki_bool_pred_cond_init(&control->stop_cond);
 	if(err != CHIAKI_ERR_SUCCESS)
@@ -77,3 +390,26 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_stop(ChiakiCongestionCon
 
 	return chiaki_bool_pred_cond_fini(&control->stop_cond);
 }
+
+CHIAKI_EXPORT void chiaki_congestion_control_push_frame(ChiakiCongestionControl *control, ChiakiSeqNum16 frame_index)
+{
+	samples_push(control, CHIAKI_CONGESTION_CONTROL_SAMPLE_FRAME, frame_index, chiaki_time_now_monotonic_us());
+}
+
+CHIAKI_EXPORT void chiaki_congestion_control_push_fec(ChiakiCongestionControl *control, bool recovered)
+{
+	samples_push(control, recovered ? CHIAKI_CONGESTION_CONTROL_SAMPLE_FEC_RECOVERED : CHIAKI_CONGESTION_CONTROL_SAMPLE_FEC_FAILED, 0, 0);
+}
+
+CHIAKI_EXPORT void chiaki_congestion_control_get_stats(ChiakiCongestionControl *control, ChiakiCongestionControlStats *stats)
+{
+	chiaki_mutex_lock(&control->estimator_mutex);
+	stats->policy = control->estimator.policy;
+	stats->signal = control->estimator.signal;
+	stats->packet_loss = control->estimator.packet_loss;
+	stats->packet_loss_reported = control->estimator.packet_loss_reported;
+	stats->queue_delay_us = chiaki_congestion_estimator_queue_delay_us(&control->estimator);
+	stats->delay_trend = control->estimator.trend;
+	stats->overuse_reports = control->estimator.overuse_reports;
+	chiaki_mutex_unlock(&control->estimator_mutex);
+}
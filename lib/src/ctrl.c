@@ -195,6 +195,30 @@ static void ctrl_message_queue_free(ChiakiCtrlMessageQueue *queue)
 	free(queue);
 }
 
+CHIAKI_EXPORT ChiakiErrorCode chiaki_ctrl_reset(ChiakiCtrl *ctrl)
+{
+	ChiakiErrorCode err = chiaki_mutex_lock(&ctrl->notif_mutex);
+	assert(err == CHIAKI_ERR_SUCCESS);
+	ctrl->should_stop = false;
+	ctrl->login_pin_entered = false;
+	ctrl->login_pin_requested = false;
+	free(ctrl->login_pin);
+	ctrl->login_pin = NULL;
+	ctrl->login_pin_size = 0;
+	ctrl->cant_displaya = false;
+	ctrl->cant_displayb = false;
+	ctrl->keyboard_text_counter = 0;
+	while(ctrl->msg_queue)
+	{
+		ChiakiCtrlMessageQueue *next = ctrl->msg_queue->next;
+		ctrl_message_queue_free(ctrl->msg_queue);
+		ctrl->msg_queue = next;
+	}
+	err = chiaki_stop_pipe_reset(&ctrl->notif_pipe);
+	chiaki_mutex_unlock(&ctrl->notif_mutex);
+	return err;
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_ctrl_send_message(ChiakiCtrl *ctrl, uint16_t type, const uint8_t *payload, size_t payload_size)
 {
 	ChiakiCtrlMessageQueue *queue = CHIAKI_NEW(ChiakiCtrlMessageQueue);
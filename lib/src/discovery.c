@@ -5,11 +5,15 @@
 #include <chiaki/discovery.h>
 #include <chiaki/http.h>
 #include <chiaki/log.h>
+#include <chiaki/time.h>
+#include <chiaki/thread.h>
+#include <chiaki/atomic.h>
 
 #include <string.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <stdlib.h>
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -338,38 +342,9 @@ static void *discovery_thread_func(void *user)
 			break;
 		}
 
-		char buf[512];
-		struct sockaddr client_addr;
-		socklen_t client_addr_size = sizeof(client_addr);
-		CHIAKI_SSIZET_TYPE n = recvfrom(discovery->socket, buf, sizeof(buf) - 1, 0, &client_addr, &client_addr_size);
-		if(n < 0)
-		{
-			CHIAKI_LOGE(discovery->log, "Discovery thread failed to read from socket");
+		err = chiaki_discovery_recv(discovery, thread->cb, thread->cb_user);
+		if(err == CHIAKI_ERR_NETWORK)
 			break;
-		}
-
-		if(n == 0)
-			continue;
-
-		if(n > sizeof(buf) - 1)
-			n = sizeof(buf) - 1;
-
-		buf[n] = '\00';
-
-		//CHIAKI_LOGV(discovery->log, "Discovery received:\n%s", buf);
-		//chiaki_log_hexdump_raw(discovery->log, CHIAKI_LOG_VERBOSE, (const uint8_t *)buf, n);
-
-		char addr_buf[64];
-		ChiakiDiscoveryHost response;
-		err = chiaki_discovery_srch_response_parse(&response, &client_addr, addr_buf, sizeof(addr_buf), buf, n);
-		if(err != CHIAKI_ERR_SUCCESS)
-		{
-			CHIAKI_LOGI(discovery->log, "Discovery Response invalid");
-			continue;
-		}
-
-		if(thread->cb)
-			thread->cb(&response, thread->cb_user);
 	}
 
 	return NULL;
@@ -391,47 +366,60 @@ static void *discovery_thread_func_oneshot(void *user)
 			break;
 		}
 
-		char buf[512];
-		struct sockaddr client_addr;
-		socklen_t client_addr_size = sizeof(client_addr);
-		CHIAKI_SSIZET_TYPE n = recvfrom(discovery->socket, buf, sizeof(buf) - 1, 0, &client_addr, &client_addr_size);
-		if(n < 0)
-		{
-			CHIAKI_LOGE(discovery->log, "Discovery thread failed to read from socket");
+		err = chiaki_discovery_recv(discovery, thread->cb, thread->cb_user);
+		if(err == CHIAKI_ERR_NETWORK)
 			break;
-		}
+		if(err == CHIAKI_ERR_SUCCESS && thread->cb)
+			break;
+	}
 
-		if(n == 0)
-			continue;
+	return NULL;
+}
 
-		if(n > sizeof(buf) - 1)
-			n = sizeof(buf) - 1;
+CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_recv(ChiakiDiscovery *discovery, ChiakiDiscoveryCb cb, void *cb_user)
+{
+	char buf[512];
+	struct sockaddr_storage client_addr;
+	socklen_t client_addr_size = sizeof(client_addr);
+	CHIAKI_SSIZET_TYPE n = recvfrom(discovery->socket, buf, sizeof(buf) - 1, 0, (struct sockaddr *)&client_addr, &client_addr_size);
+	if(n < 0)
+	{
+#ifdef _WIN32
+		if(WSAGetLastError() == WSAEWOULDBLOCK)
+#else
+		if(errno == EAGAIN || errno == EWOULDBLOCK)
+#endif
+			return CHIAKI_ERR_TIMEOUT;
+		CHIAKI_LOGE(discovery->log, "Discovery failed to read from socket");
+		return CHIAKI_ERR_NETWORK;
+	}
 
-		buf[n] = '\00';
+	if(n == 0)
+		return CHIAKI_ERR_INVALID_DATA;
 
-		//CHIAKI_LOGV(discovery->log, "Discovery received:\n%s", buf);
-		//chiaki_log_hexdump_raw(discovery->log, CHIAKI_LOG_VERBOSE, (const uint8_t *)buf, n);
+	if(n > sizeof(buf) - 1)
+		n = sizeof(buf) - 1;
 
-		char addr_buf[64];
-		ChiakiDiscoveryHost response;
-		err = chiaki_discovery_srch_response_parse(&response, &client_addr, addr_buf, sizeof(addr_buf), buf, n);
-		if(err != CHIAKI_ERR_SUCCESS)
-		{
-			CHIAKI_LOGI(discovery->log, "Discovery Response invalid");
-			continue;
-		}
+	buf[n] = '\00';
 
-		if(thread->cb)
-		{
-			thread->cb(&response, thread->cb_user);
-			break;
-		}
+	//CHIAKI_LOGV(discovery->log, "Discovery received:\n%s", buf);
+	//chiaki_log_hexdump_raw(discovery->log, CHIAKI_LOG_VERBOSE, (const uint8_t *)buf, n);
+
+	char addr_buf[64];
+	ChiakiDiscoveryHost response;
+	ChiakiErrorCode err = chiaki_discovery_srch_response_parse(&response, (struct sockaddr *)&client_addr, addr_buf, sizeof(addr_buf), buf, n);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGI(discovery->log, "Discovery Response invalid");
+		return CHIAKI_ERR_INVALID_DATA;
 	}
 
-	return NULL;
+	if(cb)
+		cb(&response, cb_user);
+	return CHIAKI_ERR_SUCCESS;
 }
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_wakeup(ChiakiLog *log, ChiakiDiscovery *discovery, const char *host, uint64_t user_credential, bool ps5)
+static ChiakiErrorCode discovery_resolve(const char *host, struct sockaddr_storage *addr, socklen_t *addr_len)
 {
 	struct addrinfo *addrinfos;
 	// make hostname use ipv4 for now
@@ -443,48 +431,53 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_wakeup(ChiakiLog *log, ChiakiDisc
 		hints.ai_family = AF_INET6;
 	else
 		hints.ai_family = AF_INET;
-	int r = getaddrinfo(host, NULL, &hints, &addrinfos); // TODO: this blocks, use something else
+	int r = getaddrinfo(host, NULL, &hints, &addrinfos); // blocks, chiaki_discovery_fleet_run() calls this from several threads
 	if(r != 0)
-	{
-		CHIAKI_LOGE(log, "DiscoveryManager failed to getaddrinfo for wakeup");
 		return CHIAKI_ERR_NETWORK;
-	}
-	struct sockaddr_in6 addr = { 0 };
-	socklen_t addr_len = 0;
+	*addr_len = 0;
 	for(struct addrinfo *ai=addrinfos; ai; ai=ai->ai_next)
 	{
 		if(ai->ai_family != AF_INET && ai->ai_family != AF_INET6)
 			continue;
-		if(ai->ai_addrlen > sizeof(addr))
+		if(ai->ai_addrlen > sizeof(*addr))
 			continue;
-		memcpy(&addr, ai->ai_addr, ai->ai_addrlen);
-		addr_len = ai->ai_addrlen;
+		memcpy(addr, ai->ai_addr, ai->ai_addrlen);
+		*addr_len = ai->ai_addrlen;
 		break;
 	}
 	freeaddrinfo(addrinfos);
 
-	if(!addr_len)
+	return *addr_len ? CHIAKI_ERR_SUCCESS : CHIAKI_ERR_UNKNOWN;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_wakeup(ChiakiLog *log, ChiakiDiscovery *discovery, const char *host, uint64_t user_credential, bool ps5)
+{
+	struct sockaddr_storage addr;
+	socklen_t addr_len = 0;
+	ChiakiErrorCode err = discovery_resolve(host, &addr, &addr_len);
+	if(err == CHIAKI_ERR_NETWORK)
+	{
+		CHIAKI_LOGE(log, "DiscoveryManager failed to getaddrinfo for wakeup");
+		return err;
+	}
+	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		CHIAKI_LOGE(log, "DiscoveryManager failed to get suitable address from getaddrinfo for wakeup");
-		return CHIAKI_ERR_UNKNOWN;
+		return err;
 	}
-	if(((struct sockaddr *)&addr)->sa_family == AF_INET)
-		((struct sockaddr_in *)&addr)->sin_port = htons(ps5 ? CHIAKI_DISCOVERY_PORT_PS5 : CHIAKI_DISCOVERY_PORT_PS4);
-	else
-		addr.sin6_port = htons(ps5 ? CHIAKI_DISCOVERY_PORT_PS5 : CHIAKI_DISCOVERY_PORT_PS4);
+	set_port((struct sockaddr *)&addr, htons(ps5 ? CHIAKI_DISCOVERY_PORT_PS5 : CHIAKI_DISCOVERY_PORT_PS4));
 
 	ChiakiDiscoveryPacket packet = { 0 };
 	packet.cmd = CHIAKI_DISCOVERY_CMD_WAKEUP;
 	packet.protocol_version = ps5 ? CHIAKI_DISCOVERY_PROTOCOL_VERSION_PS5 : CHIAKI_DISCOVERY_PROTOCOL_VERSION_PS4;
 	packet.user_credential = user_credential;
 
-	ChiakiErrorCode err;
 	if(discovery)
 		err = chiaki_discovery_send(discovery, &packet, (struct sockaddr *)&addr, addr_len);
 	else
 	{
 		ChiakiDiscovery tmp_discovery;
-		err = chiaki_discovery_init(&tmp_discovery, log, ((struct sockaddr *)&addr)->sa_family);
+		err = chiaki_discovery_init(&tmp_discovery, log, addr.ss_family);
 		if(err != CHIAKI_ERR_SUCCESS)
 		{
 			CHIAKI_LOGE(log, "Failed to init temporary discovery for wakeup: %s", chiaki_error_string(err));
@@ -496,3 +489,379 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_wakeup(ChiakiLog *log, ChiakiDisc
 
 	return err;
 }
+
+#define FLEET_RTO_MIN_MS 50
+#define FLEET_RTO_MAX_MS 2000
+#define FLEET_READY_POLL_MS 1000
+
+CHIAKI_EXPORT const char *chiaki_discovery_fleet_state_string(ChiakiDiscoveryFleetState state)
+{
+	switch(state)
+	{
+		case CHIAKI_DISCOVERY_FLEET_STATE_PENDING:
+			return "pending";
+		case CHIAKI_DISCOVERY_FLEET_STATE_INVALID_HOST:
+			return "invalid host";
+		case CHIAKI_DISCOVERY_FLEET_STATE_RESPONDED:
+			return "responded";
+		case CHIAKI_DISCOVERY_FLEET_STATE_TIMEOUT:
+			return "timeout";
+		default:
+			return "unknown";
+	}
+}
+
+CHIAKI_EXPORT void chiaki_discovery_fleet_options_default(ChiakiDiscoveryFleetOptions *options)
+{
+	memset(options, 0, sizeof(*options));
+	options->cmd = CHIAKI_DISCOVERY_CMD_SRCH;
+	options->timeout_ms = 2000;
+	options->rto_initial_ms = 250;
+	options->attempts_max = 4;
+}
+
+typedef struct discovery_fleet_t
+{
+	ChiakiLog *log;
+	ChiakiDiscoveryFleetOptions *options;
+	ChiakiDiscoveryFleetHost **sorted; // resolved hosts by addr_str, to match responses
+	size_t sorted_count;
+	size_t pending;
+	uint64_t srtt_us; // over all hosts, 0 until the first sample
+	uint64_t rttvar_us;
+	uint64_t now_us;
+} DiscoveryFleet;
+
+static int fleet_host_cmp(const void *a, const void *b)
+{
+	return strcmp((*(ChiakiDiscoveryFleetHost * const *)a)->addr_str, (*(ChiakiDiscoveryFleetHost * const *)b)->addr_str);
+}
+
+static int fleet_host_key_cmp(const void *key, const void *elem)
+{
+	return strcmp((const char *)key, (*(ChiakiDiscoveryFleetHost * const *)elem)->addr_str);
+}
+
+static void fleet_rtt_sample(DiscoveryFleet *fleet, uint64_t rtt_us)
+{
+	// RFC 6298
+	if(!fleet->srtt_us)
+	{
+		fleet->srtt_us = rtt_us;
+		fleet->rttvar_us = rtt_us / 2;
+		return;
+	}
+	uint64_t delta = fleet->srtt_us > rtt_us ? fleet->srtt_us - rtt_us : rtt_us - fleet->srtt_us;
+	fleet->rttvar_us = (3 * fleet->rttvar_us + delta) / 4;
+	fleet->srtt_us = (7 * fleet->srtt_us + rtt_us) / 8;
+}
+
+static uint64_t fleet_rto_ms(DiscoveryFleet *fleet, unsigned int unanswered)
+{
+	uint64_t rto_ms = fleet->options->rto_initial_ms;
+	if(fleet->srtt_us)
+	{
+		// consoles on the same network answer in about the same time,
+		// so the first answers tell how long it is worth waiting for the rest
+		uint64_t adapted_ms = (fleet->srtt_us + 4 * fleet->rttvar_us) / 1000;
+		if(adapted_ms < FLEET_RTO_MIN_MS)
+			adapted_ms = FLEET_RTO_MIN_MS;
+		if(adapted_ms < rto_ms)
+			rto_ms = adapted_ms;
+	}
+	for(unsigned int i=1; i<unanswered && rto_ms < FLEET_RTO_MAX_MS; i++)
+		rto_ms *= 2;
+	return rto_ms < FLEET_RTO_MAX_MS ? rto_ms : FLEET_RTO_MAX_MS;
+}
+
+static void fleet_send_packet(DiscoveryFleet *fleet, ChiakiDiscovery *discovery, ChiakiDiscoveryFleetHost *host, ChiakiDiscoveryPacket *packet, bool ps5)
+{
+	packet->protocol_version = ps5 ? CHIAKI_DISCOVERY_PROTOCOL_VERSION_PS5 : CHIAKI_DISCOVERY_PROTOCOL_VERSION_PS4;
+	set_port((struct sockaddr *)&host->addr, htons(ps5 ? CHIAKI_DISCOVERY_PORT_PS5 : CHIAKI_DISCOVERY_PORT_PS4));
+	ChiakiErrorCode err = chiaki_discovery_send(discovery, packet, (struct sockaddr *)&host->addr, host->addr_len);
+	if(err != CHIAKI_ERR_SUCCESS)
+		CHIAKI_LOGW(fleet->log, "Discovery fleet failed to send to %s: %s", host->host, chiaki_error_string(err));
+}
+
+static void fleet_send(DiscoveryFleet *fleet, ChiakiDiscovery *discovery, ChiakiDiscoveryFleetHost *host)
+{
+	ChiakiDiscoveryPacket packet = { 0 };
+	if(fleet->options->cmd == CHIAKI_DISCOVERY_CMD_WAKEUP)
+	{
+		packet.cmd = CHIAKI_DISCOVERY_CMD_WAKEUP;
+		packet.user_credential = host->user_credential;
+		fleet_send_packet(fleet, discovery, host, &packet, host->ps5);
+		packet.cmd = CHIAKI_DISCOVERY_CMD_SRCH;
+		packet.user_credential = 0;
+		fleet_send_packet(fleet, discovery, host, &packet, host->ps5);
+		return;
+	}
+	packet.cmd = CHIAKI_DISCOVERY_CMD_SRCH;
+	fleet_send_packet(fleet, discovery, host, &packet, false);
+	fleet_send_packet(fleet, discovery, host, &packet, true);
+}
+
+static void fleet_host_responded(DiscoveryFleet *fleet, ChiakiDiscoveryFleetHost *host, ChiakiDiscoveryHost *response)
+{
+	if(host->state != CHIAKI_DISCOVERY_FLEET_STATE_PENDING)
+		return;
+
+	host->host_state = response->state;
+	host->host_ps5 = chiaki_discovery_host_is_ps5(response);
+	snprintf(host->host_id, sizeof(host->host_id), "%s", response->host_id ? response->host_id : "");
+	snprintf(host->host_name, sizeof(host->host_name), "%s", response->host_name ? response->host_name : "");
+
+	// with more than one request outstanding, it is unknown which one this answers
+	if(host->unanswered == 1)
+	{
+		host->rtt_us = fleet->now_us - host->last_send_us;
+		fleet_rtt_sample(fleet, host->rtt_us);
+	}
+	host->unanswered = 0;
+
+	if(fleet->options->cmd == CHIAKI_DISCOVERY_CMD_WAKEUP && fleet->options->wait_ready
+		&& response->state != CHIAKI_DISCOVERY_HOST_STATE_READY)
+	{
+		// the console got the wakeup and is booting, keep asking until it is ready
+		host->next_send_us = fleet->now_us + FLEET_READY_POLL_MS * 1000;
+		return;
+	}
+
+	host->state = CHIAKI_DISCOVERY_FLEET_STATE_RESPONDED;
+	host->response_us = fleet->now_us - host->first_send_us;
+	fleet->pending--;
+	if(fleet->options->cb)
+		fleet->options->cb(host, response, fleet->options->cb_user);
+}
+
+static void fleet_host_received(ChiakiDiscoveryHost *response, void *user)
+{
+	DiscoveryFleet *fleet = user;
+	if(!response->host_addr)
+		return;
+
+	ChiakiDiscoveryFleetHost **found = bsearch(response->host_addr, fleet->sorted, fleet->sorted_count, sizeof(*fleet->sorted), fleet_host_key_cmp);
+	if(!found)
+	{
+		CHIAKI_LOGV(fleet->log, "Discovery fleet ignoring response from %s", response->host_addr);
+		return;
+	}
+
+	// the same console may be listed more than once
+	ChiakiDiscoveryFleetHost **end = fleet->sorted + fleet->sorted_count;
+	while(found > fleet->sorted && strcmp((*(found - 1))->addr_str, response->host_addr) == 0)
+		found--;
+	for(; found < end && strcmp((*found)->addr_str, response->host_addr) == 0; found++)
+		fleet_host_responded(fleet, *found, response);
+}
+
+// hostnames are resolved with blocking getaddrinfo, so many of them are looked up in parallel
+#define FLEET_RESOLVE_THREADS_MAX 16
+
+typedef struct discovery_fleet_resolve_t
+{
+	ChiakiLog *log;
+	ChiakiDiscoveryFleetHost *hosts;
+	size_t hosts_count;
+	chiaki_atomic_uint32_t next;
+} DiscoveryFleetResolve;
+
+static void *fleet_resolve_thread_func(void *user)
+{
+	DiscoveryFleetResolve *resolve = user;
+	while(true)
+	{
+		size_t i = chiaki_atomic_fetch_add_u32(&resolve->next, 1);
+		if(i >= resolve->hosts_count)
+			break;
+		ChiakiDiscoveryFleetHost *host = &resolve->hosts[i];
+		if(!host->host || discovery_resolve(host->host, &host->addr, &host->addr_len) != CHIAKI_ERR_SUCCESS
+			|| !sockaddr_str((struct sockaddr *)&host->addr, host->addr_str, sizeof(host->addr_str)))
+		{
+			CHIAKI_LOGE(resolve->log, "Discovery fleet failed to resolve %s", host->host ? host->host : "(null)");
+			host->state = CHIAKI_DISCOVERY_FLEET_STATE_INVALID_HOST;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Resolve all hosts, setting the ones that fail to CHIAKI_DISCOVERY_FLEET_STATE_INVALID_HOST.
+ */
+static void fleet_resolve(ChiakiLog *log, ChiakiDiscoveryFleetHost *hosts, size_t hosts_count)
+{
+	DiscoveryFleetResolve resolve;
+	resolve.log = log;
+	resolve.hosts = hosts;
+	resolve.hosts_count = hosts_count;
+	resolve.next = 0;
+
+	ChiakiThread threads[FLEET_RESOLVE_THREADS_MAX - 1];
+	size_t threads_count = 0;
+	size_t threads_wanted = hosts_count < FLEET_RESOLVE_THREADS_MAX ? hosts_count : FLEET_RESOLVE_THREADS_MAX;
+	// the calling thread is one of the resolvers
+	for(; threads_count + 1 < threads_wanted; threads_count++)
+	{
+		if(chiaki_thread_create(&threads[threads_count], fleet_resolve_thread_func, &resolve) != CHIAKI_ERR_SUCCESS)
+			break;
+		chiaki_thread_set_name(&threads[threads_count], "Chiaki Discovery Resolve");
+	}
+	fleet_resolve_thread_func(&resolve);
+	for(size_t i=0; i<threads_count; i++)
+		chiaki_thread_join(&threads[i], NULL);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_fleet_run(ChiakiLog *log, ChiakiDiscoveryFleetHost *hosts, size_t hosts_count, ChiakiDiscoveryFleetOptions *options)
+{
+	DiscoveryFleet fleet = { 0 };
+	fleet.log = log;
+	fleet.options = options;
+	fleet.sorted = calloc(hosts_count ? hosts_count : 1, sizeof(*fleet.sorted));
+	if(!fleet.sorted)
+		return CHIAKI_ERR_MEMORY;
+
+	// index 0 for IPv4, 1 for IPv6
+	ChiakiDiscovery discoveries[2];
+	bool discoveries_needed[2] = { false, false };
+	bool discoveries_active[2] = { false, false };
+
+	for(size_t i=0; i<hosts_count; i++)
+	{
+		ChiakiDiscoveryFleetHost *host = &hosts[i];
+		host->state = CHIAKI_DISCOVERY_FLEET_STATE_PENDING;
+		host->host_state = CHIAKI_DISCOVERY_HOST_STATE_UNKNOWN;
+		host->host_ps5 = false;
+		host->host_id[0] = '\0';
+		host->host_name[0] = '\0';
+		host->attempts = 0;
+		host->unanswered = 0;
+		host->response_us = 0;
+		host->rtt_us = 0;
+		host->next_send_us = 0;
+	}
+
+	fleet_resolve(log, hosts, hosts_count);
+
+	for(size_t i=0; i<hosts_count; i++)
+	{
+		ChiakiDiscoveryFleetHost *host = &hosts[i];
+		if(host->state == CHIAKI_DISCOVERY_FLEET_STATE_INVALID_HOST)
+			continue;
+		discoveries_needed[host->addr.ss_family == AF_INET6 ? 1 : 0] = true;
+		fleet.sorted[fleet.sorted_count++] = host;
+	}
+	qsort(fleet.sorted, fleet.sorted_count, sizeof(*fleet.sorted), fleet_host_cmp);
+
+	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+	for(size_t i=0; i<2; i++)
+	{
+		if(!discoveries_needed[i])
+			continue;
+		err = chiaki_discovery_init(&discoveries[i], log, i ? AF_INET6 : AF_INET);
+		if(err != CHIAKI_ERR_SUCCESS)
+			goto cleanup;
+		discoveries_active[i] = true;
+		chiaki_socket_set_nonblock(discoveries[i].socket, true);
+	}
+
+	ChiakiStopPipe stop_pipe;
+	err = chiaki_stop_pipe_init(&stop_pipe);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto cleanup;
+
+	fleet.pending = fleet.sorted_count;
+	uint64_t start_us = chiaki_time_now_monotonic_us();
+	uint64_t deadline_us = start_us + options->timeout_ms * 1000;
+	while(fleet.pending)
+	{
+		fleet.now_us = chiaki_time_now_monotonic_us();
+		if(fleet.now_us >= deadline_us)
+			break;
+
+		uint64_t next_us = deadline_us;
+		for(size_t i=0; i<fleet.sorted_count; i++)
+		{
+			ChiakiDiscoveryFleetHost *host = fleet.sorted[i];
+			if(host->state != CHIAKI_DISCOVERY_FLEET_STATE_PENDING)
+				continue;
+			if(host->next_send_us <= fleet.now_us)
+			{
+				if(host->unanswered >= options->attempts_max)
+				{
+					host->state = CHIAKI_DISCOVERY_FLEET_STATE_TIMEOUT;
+					fleet.pending--;
+					continue;
+				}
+				fleet_send(&fleet, &discoveries[host->addr.ss_family == AF_INET6 ? 1 : 0], host);
+				if(!host->attempts)
+					host->first_send_us = fleet.now_us;
+				host->attempts++;
+				host->unanswered++;
+				host->last_send_us = fleet.now_us;
+				host->next_send_us = fleet.now_us + fleet_rto_ms(&fleet, host->unanswered) * 1000;
+			}
+			if(host->next_send_us < next_us)
+				next_us = host->next_send_us;
+		}
+		if(!fleet.pending)
+			break;
+
+		chiaki_socket_t fds[2];
+		ChiakiDiscovery *fds_discoveries[2];
+		size_t fds_count = 0;
+		for(size_t i=0; i<2; i++)
+		{
+			if(!discoveries_active[i])
+				continue;
+			fds_discoveries[fds_count] = &discoveries[i];
+			fds[fds_count++] = discoveries[i].socket;
+		}
+		bool ready[2];
+		uint64_t wait_ms = next_us > fleet.now_us ? (next_us - fleet.now_us + 999) / 1000 : 0;
+		err = chiaki_stop_pipe_select_multi(&stop_pipe, fds, fds_count, wait_ms, ready);
+		if(err == CHIAKI_ERR_TIMEOUT)
+			continue;
+		if(err != CHIAKI_ERR_SUCCESS)
+		{
+			CHIAKI_LOGE(log, "Discovery fleet failed to wait for sockets");
+			break;
+		}
+
+		fleet.now_us = chiaki_time_now_monotonic_us();
+		for(size_t i=0; i<fds_count; i++)
+		{
+			if(!ready[i])
+				continue;
+			// drain everything that arrived, the socket is non-blocking
+			ChiakiErrorCode recv_err;
+			do
+				recv_err = chiaki_discovery_recv(fds_discoveries[i], fleet_host_received, &fleet);
+			while(recv_err == CHIAKI_ERR_SUCCESS || recv_err == CHIAKI_ERR_INVALID_DATA);
+		}
+	}
+
+	size_t responded = 0;
+	for(size_t i=0; i<fleet.sorted_count; i++)
+	{
+		if(fleet.sorted[i]->state == CHIAKI_DISCOVERY_FLEET_STATE_PENDING)
+			fleet.sorted[i]->state = CHIAKI_DISCOVERY_FLEET_STATE_TIMEOUT;
+		else if(fleet.sorted[i]->state == CHIAKI_DISCOVERY_FLEET_STATE_RESPONDED)
+			responded++;
+	}
+
+	CHIAKI_LOGI(log, "Discovery fleet finished after %llu ms, %llu of %llu hosts responded",
+			(unsigned long long)((chiaki_time_now_monotonic_us() - start_us) / 1000),
+			(unsigned long long)responded, (unsigned long long)hosts_count);
+	if(err == CHIAKI_ERR_TIMEOUT)
+		err = CHIAKI_ERR_SUCCESS;
+
+	chiaki_stop_pipe_fini(&stop_pipe);
+cleanup:
+	for(size_t i=0; i<2; i++)
+	{
+		if(discoveries_active[i])
+			chiaki_discovery_fini(&discoveries[i]);
+	}
+	free(fleet.sorted);
+	return err;
+}
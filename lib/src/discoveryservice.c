@@ -2,9 +2,12 @@
 
 #include <chiaki/discoveryservice.h>
 
+#include <chiaki/time.h>
+
 #include <string.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <limits.h>
 
 #ifdef _WIN32
 #include <ws2tcpip.h>
@@ -12,37 +15,50 @@
 #include <netinet/in.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <errno.h>
 #endif
 
+#if !defined(_WIN32) && !defined(__SWITCH__) && (!defined(__ANDROID__) || __ANDROID_API__ >= 24)
+#define DISCOVERY_SERVICE_IPV6_IFACES
+#include <ifaddrs.h>
+#include <net/if.h>
+#endif
+
+#define IPV6_IFACES_MAX 16
+
 static void *discovery_service_thread_func(void *user);
-static void discovery_service_ping(ChiakiDiscoveryService *service);
-static void discovery_service_drop_old_hosts(ChiakiDiscoveryService *service);
+static ChiakiErrorCode discovery_service_wait(ChiakiDiscoveryService *service, bool ipv6, uint64_t timeout_ms, bool *ready);
+static void discovery_service_ping(ChiakiDiscoveryService *service, bool ipv6);
 static void discovery_service_host_received(ChiakiDiscoveryHost *host, void *user);
+static void discovery_service_host_delta(ChiakiDiscoveryServiceDelta delta, ChiakiDiscoveryHost *host, void *user);
 static void discovery_service_report_state(ChiakiDiscoveryService *service);
 
+static bool send_addr_is_broadcast(ChiakiDiscoveryServiceOptions *options)
+{
+	struct sockaddr *addr = (struct sockaddr *)options->send_addr;
+	return addr->sa_family == AF_INET && ((struct sockaddr_in *)addr)->sin_addr.s_addr == 0xffffffff;
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_service_init(ChiakiDiscoveryService *service, ChiakiDiscoveryServiceOptions *options, ChiakiLog *log)
 {
 	service->log = log;
 	service->options = *options;
 	service->ping_index = 0;
+	service->hosts_changed = false;
+	service->discovery_ipv6_active = false;
 
-	service->hosts = calloc(service->options.hosts_max, sizeof(ChiakiDiscoveryHost));
-	if(!service->hosts)
-		return CHIAKI_ERR_MEMORY;
-
-	ChiakiErrorCode err;
-	service->host_discovery_infos = calloc(service->options.hosts_max, sizeof(ChiakiDiscoveryServiceHostDiscoveryInfo));
-	if(!service->host_discovery_infos)
-	{
-		err = CHIAKI_ERR_MEMORY;
-		goto error_hosts;
-	}
-
-	service->hosts_count = 0;
+	ChiakiErrorCode err = chiaki_discovery_host_table_init(&service->hosts, service->options.hosts_max, discovery_service_host_delta, service);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
 
 	err = chiaki_mutex_init(&service->state_mutex, false);
 	if(err != CHIAKI_ERR_SUCCESS)
-		goto error_host_discovery_infos;
+		goto error_hosts;
 
 	service->options.send_addr = malloc(service->options.send_addr_size);
 	if(!service->options.send_addr)
@@ -60,7 +76,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_service_init(ChiakiDiscoveryServi
 		if(!service->options.broadcast_addrs)
 		{
 			err = CHIAKI_ERR_MEMORY;
-			goto error_state_mutex;
+			goto error_send_addr;
 		}
 		memcpy(service->options.broadcast_addrs, options->broadcast_addrs, service->options.broadcast_num * sizeof(struct sockaddr_storage));
 	}
@@ -79,20 +95,63 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_service_init(ChiakiDiscoveryServi
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_send_addr;
 
-	err = chiaki_bool_pred_cond_init(&service->stop_cond);
+	if(service->options.dual_stack && !service->options.send_host && send_addr_is_broadcast(&service->options))
+	{
+		err = chiaki_discovery_init(&service->discovery_ipv6, log, AF_INET6);
+		if(err == CHIAKI_ERR_SUCCESS)
+			service->discovery_ipv6_active = true;
+		else
+			CHIAKI_LOGW(service->log, "Discovery Service failed to init IPv6 socket, continuing with IPv4 only");
+	}
+
+	err = chiaki_stop_pipe_init(&service->stop_pipe);
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_discovery;
 
+#ifdef __linux__
+	service->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if(service->epoll_fd < 0)
+	{
+		CHIAKI_LOGE(service->log, "Discovery Service failed to create epoll instance");
+		err = CHIAKI_ERR_UNKNOWN;
+		goto error_stop_pipe;
+	}
+	// data.u32 is 0 for the stop pipe and otherwise the index of the socket + 1
+	struct epoll_event ev = { 0 };
+	ev.events = EPOLLIN;
+	ev.data.u32 = 0;
+	bool epoll_ok = epoll_ctl(service->epoll_fd, EPOLL_CTL_ADD, service->stop_pipe.fds[0], &ev) == 0;
+	ev.data.u32 = 1;
+	epoll_ok = epoll_ok && epoll_ctl(service->epoll_fd, EPOLL_CTL_ADD, service->discovery.socket, &ev) == 0;
+	if(service->discovery_ipv6_active)
+	{
+		ev.data.u32 = 2;
+		epoll_ok = epoll_ok && epoll_ctl(service->epoll_fd, EPOLL_CTL_ADD, service->discovery_ipv6.socket, &ev) == 0;
+	}
+	if(!epoll_ok)
+	{
+		CHIAKI_LOGE(service->log, "Discovery Service failed to add sockets to epoll instance");
+		err = CHIAKI_ERR_UNKNOWN;
+		goto error_epoll;
+	}
+#endif
+
 	err = chiaki_thread_create(&service->thread, discovery_service_thread_func, service);
 	if(err != CHIAKI_ERR_SUCCESS)
-		goto error_stop_cond;
+		goto error_epoll;
 
 	chiaki_thread_set_name(&service->thread, "Chiaki Discovery Service");
 
 	return CHIAKI_ERR_SUCCESS;
-error_stop_cond:
-	chiaki_bool_pred_cond_fini(&service->stop_cond);
+error_epoll:
+#ifdef __linux__
+	close(service->epoll_fd);
+error_stop_pipe:
+#endif
+	chiaki_stop_pipe_fini(&service->stop_pipe);
 error_discovery:
+	if(service->discovery_ipv6_active)
+		chiaki_discovery_fini(&service->discovery_ipv6);
 	chiaki_discovery_fini(&service->discovery);
 error_send_addr:
 	free(service->options.broadcast_addrs);
@@ -100,72 +159,155 @@ error_send_addr:
 	free(service->options.send_host);
 error_state_mutex:
 	chiaki_mutex_fini(&service->state_mutex);
-error_host_discovery_infos:
-	free(service->host_discovery_infos);
 error_hosts:
-	free(service->hosts);
+	chiaki_discovery_host_table_fini(&service->hosts);
 	return err;
 }
 
 CHIAKI_EXPORT void chiaki_discovery_service_fini(ChiakiDiscoveryService *service)
 {
-	chiaki_bool_pred_cond_signal(&service->stop_cond);
+	chiaki_stop_pipe_stop(&service->stop_pipe);
 	chiaki_thread_join(&service->thread, NULL);
-	chiaki_bool_pred_cond_fini(&service->stop_cond);
+#ifdef __linux__
+	close(service->epoll_fd);
+#endif
+	chiaki_stop_pipe_fini(&service->stop_pipe);
+	if(service->discovery_ipv6_active)
+		chiaki_discovery_fini(&service->discovery_ipv6);
 	chiaki_discovery_fini(&service->discovery);
 	chiaki_mutex_fini(&service->state_mutex);
 	free(service->options.send_addr);
 	free(service->options.send_host);
 	if(service->options.broadcast_addrs)
 		free(service->options.broadcast_addrs);
-
-	for(size_t i=0; i<service->hosts_count; i++)
-	{
-		ChiakiDiscoveryHost *host = &service->hosts[i];
-#define FREE_STRING(name) free((char *)host->name);
-		CHIAKI_DISCOVERY_HOST_STRING_FOREACH(FREE_STRING)
-#undef FREE_STRING
-	}
-
-	free(service->host_discovery_infos);
-	free(service->hosts);
+	chiaki_discovery_host_table_fini(&service->hosts);
 }
 
 static void *discovery_service_thread_func(void *user)
 {
 	ChiakiDiscoveryService *service = user;
 
-	ChiakiErrorCode err = chiaki_bool_pred_cond_lock(&service->stop_cond);
-	if(err != CHIAKI_ERR_SUCCESS)
-		return NULL;
+	// the sockets stay open until fini, because wakeup packets may be sent on them from other threads
+	bool ipv6 = service->discovery_ipv6_active;
+	uint64_t next_ping_ms = chiaki_time_now_monotonic_ms() + service->options.ping_initial_ms;
+	while(true)
+	{
+		uint64_t now_ms = chiaki_time_now_monotonic_ms();
+		if(now_ms >= next_ping_ms)
+		{
+			discovery_service_ping(service, ipv6);
+			next_ping_ms = now_ms + service->options.ping_ms;
+		}
 
-	ChiakiDiscoveryThread discovery_thread;
-	err = chiaki_discovery_thread_start(&discovery_thread, &service->discovery, discovery_service_host_received, service);
-	if(err != CHIAKI_ERR_SUCCESS)
-		goto beach;
+		bool ready[2];
+		ChiakiErrorCode err = discovery_service_wait(service, ipv6, next_ping_ms - now_ms, ready);
+		if(err == CHIAKI_ERR_CANCELED)
+			break;
+		if(err == CHIAKI_ERR_TIMEOUT)
+			continue;
+		if(err != CHIAKI_ERR_SUCCESS)
+		{
+			CHIAKI_LOGE(service->log, "Discovery Service failed to wait for sockets");
+			break;
+		}
+
+		if(ready[0] && chiaki_discovery_recv(&service->discovery, discovery_service_host_received, service) == CHIAKI_ERR_NETWORK)
+			break;
+		if(ready[1] && chiaki_discovery_recv(&service->discovery_ipv6, discovery_service_host_received, service) == CHIAKI_ERR_NETWORK)
+		{
+			CHIAKI_LOGW(service->log, "Discovery Service IPv6 socket failed, continuing with IPv4 only");
+#ifdef __linux__
+			epoll_ctl(service->epoll_fd, EPOLL_CTL_DEL, service->discovery_ipv6.socket, NULL);
+#endif
+			ipv6 = false;
+		}
+	}
 
-	err = chiaki_bool_pred_cond_timedwait(&service->stop_cond, service->options.ping_initial_ms);
+	return NULL;
+}
 
-	while(err == CHIAKI_ERR_TIMEOUT)
+static ChiakiErrorCode discovery_service_wait(ChiakiDiscoveryService *service, bool ipv6, uint64_t timeout_ms, bool *ready)
+{
+#ifdef __linux__
+	ready[0] = ready[1] = false;
+	struct epoll_event events[3];
+	int n = epoll_wait(service->epoll_fd, events, 3, timeout_ms > INT_MAX ? -1 : (int)timeout_ms);
+	if(n < 0)
+		return errno == EINTR ? CHIAKI_ERR_TIMEOUT : CHIAKI_ERR_UNKNOWN;
+	if(n == 0)
+		return CHIAKI_ERR_TIMEOUT;
+	for(int i=0; i<n; i++)
 	{
-		discovery_service_ping(service);
-		err = chiaki_bool_pred_cond_timedwait(&service->stop_cond, service->options.ping_ms);
+		if(events[i].data.u32 == 0)
+			return CHIAKI_ERR_CANCELED;
+		ready[events[i].data.u32 - 1] = true;
 	}
+	return CHIAKI_ERR_SUCCESS;
+#else
+	chiaki_socket_t fds[2] = { service->discovery.socket, CHIAKI_INVALID_SOCKET };
+	ready[1] = false;
+	if(ipv6)
+		fds[1] = service->discovery_ipv6.socket;
+	return chiaki_stop_pipe_select_multi(&service->stop_pipe, fds, ipv6 ? 2 : 1, timeout_ms, ready);
+#endif
+}
 
-	chiaki_discovery_thread_stop(&discovery_thread);
+static void discovery_service_ping_ipv6(ChiakiDiscoveryService *service, ChiakiDiscoveryPacket *packet, uint16_t port)
+{
+	struct sockaddr_in6 addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin6_family = AF_INET6;
+	addr.sin6_port = htons(port);
+	// ff02::1, all nodes on the link
+	addr.sin6_addr.s6_addr[0] = 0xff;
+	addr.sin6_addr.s6_addr[1] = 0x02;
+	addr.sin6_addr.s6_addr[15] = 0x01;
+
+#ifdef DISCOVERY_SERVICE_IPV6_IFACES
+	// link-local multicast only goes out on a single interface, so send on each of them
+	struct ifaddrs *ifap;
+	if(getifaddrs(&ifap) == 0)
+	{
+		unsigned int scopes[IPV6_IFACES_MAX];
+		size_t scopes_count = 0;
+		for(struct ifaddrs *a=ifap; a && scopes_count < IPV6_IFACES_MAX; a=a->ifa_next)
+		{
+			if(!a->ifa_addr || a->ifa_addr->sa_family != AF_INET6)
+				continue;
+			if((a->ifa_flags & (IFF_UP | IFF_MULTICAST | IFF_LOOPBACK)) != (IFF_UP | IFF_MULTICAST))
+				continue;
+			unsigned int scope = if_nametoindex(a->ifa_name);
+			if(!scope)
+				continue;
+			bool dup = false;
+			for(size_t i=0; i<scopes_count; i++)
+				dup = dup || scopes[i] == scope;
+			if(dup)
+				continue;
+			scopes[scopes_count++] = scope;
+			addr.sin6_scope_id = scope;
+			if(chiaki_discovery_send(&service->discovery_ipv6, packet, (struct sockaddr *)&addr, sizeof(addr)) != CHIAKI_ERR_SUCCESS)
+				CHIAKI_LOGE(service->log, "Discovery Service failed to send IPv6 ping on %s", a->ifa_name);
+		}
+		freeifaddrs(ifap);
+		if(scopes_count)
+			return;
+	}
+#endif
 
-beach:
-	chiaki_bool_pred_cond_unlock(&service->stop_cond);
-	return NULL;
+	addr.sin6_scope_id = 0;
+	if(chiaki_discovery_send(&service->discovery_ipv6, packet, (struct sockaddr *)&addr, sizeof(addr)) != CHIAKI_ERR_SUCCESS)
+		CHIAKI_LOGE(service->log, "Discovery Service failed to send IPv6 ping");
 }
 
-static void discovery_service_ping(ChiakiDiscoveryService *service)
+static void discovery_service_ping(ChiakiDiscoveryService *service, bool ipv6)
 {
 	ChiakiErrorCode err = chiaki_mutex_lock(&service->state_mutex);
 	assert(err == CHIAKI_ERR_SUCCESS);
 
 	service->ping_index++;
-	discovery_service_drop_old_hosts(service);
+	chiaki_discovery_host_table_drop_old(&service->hosts, service->ping_index, service->options.host_drop_pings);
+	discovery_service_report_state(service);
 
 	chiaki_mutex_unlock(&service->state_mutex);
 
@@ -242,6 +384,8 @@ static void discovery_service_ping(ChiakiDiscoveryService *service)
 			}
 		}
 	}
+	if(ipv6)
+		discovery_service_ping_ipv6(service, &packet, CHIAKI_DISCOVERY_PORT_PS4);
 	packet.protocol_version = CHIAKI_DISCOVERY_PROTOCOL_VERSION_PS5;
 	if(((struct sockaddr *)service->options.send_addr)->sa_family == AF_INET)
 		((struct sockaddr_in *)service->options.send_addr)->sin_port = htons(CHIAKI_DISCOVERY_PORT_PS5);
@@ -260,95 +404,227 @@ static void discovery_service_ping(ChiakiDiscoveryService *service)
 				CHIAKI_LOGE(service->log, "Discovery Service failed to send extra broadcast ping for PS5");
 		}
 	}
+	if(ipv6)
+		discovery_service_ping_ipv6(service, &packet, CHIAKI_DISCOVERY_PORT_PS5);
 }
 
-static void discovery_service_drop_old_hosts(ChiakiDiscoveryService *service)
+static void discovery_service_host_received(ChiakiDiscoveryHost *host, void *user)
+{
+	ChiakiDiscoveryService *service = user;
+
+	ChiakiErrorCode err = chiaki_mutex_lock(&service->state_mutex);
+	assert(err == CHIAKI_ERR_SUCCESS);
+
+	if(host->host_id)
+		CHIAKI_LOGV(service->log, "Discovery Service Received host with id %s", host->host_id);
+
+	err = chiaki_discovery_host_table_update(&service->hosts, host, service->ping_index);
+	if(err == CHIAKI_ERR_INVALID_DATA)
+		CHIAKI_LOGE(service->log, "Discovery Service received host without id");
+	else if(err == CHIAKI_ERR_OVERFLOW)
+		CHIAKI_LOGE(service->log, "Discovery Service received new host, but no space available");
+
+	discovery_service_report_state(service);
+
+	chiaki_mutex_unlock(&service->state_mutex);
+}
+
+static void discovery_service_host_delta(ChiakiDiscoveryServiceDelta delta, ChiakiDiscoveryHost *host, void *user)
 {
 	// service->state_mutex must be locked
+	ChiakiDiscoveryService *service = user;
+	switch(delta)
+	{
+		case CHIAKI_DISCOVERY_SERVICE_HOST_ADDED:
+			CHIAKI_LOGI(service->log, "Discovery Service detected new host with id %s", host->host_id);
+			break;
+		case CHIAKI_DISCOVERY_SERVICE_HOST_REMOVED:
+			CHIAKI_LOGI(service->log, "Discovery Service: Host with id %s is no longer available", host->host_id);
+			break;
+		default:
+			break;
+	}
+	service->hosts_changed = true;
+	if(service->options.delta_cb)
+		service->options.delta_cb(delta, host, service->options.cb_user);
+}
 
-	bool change = false;
+static void discovery_service_report_state(ChiakiDiscoveryService *service)
+{
+	// service->state_mutex must be locked
+	if(!service->hosts_changed)
+		return;
+	service->hosts_changed = false;
+	if(service->options.cb)
+		service->options.cb(service->hosts.hosts, service->hosts.hosts_count, service->options.cb_user);
+}
 
-	for(size_t i=0; i<service->hosts_count; i++)
+static size_t host_id_hash(const char *host_id)
+{
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for(const char *c=host_id; *c; c++)
+	{
+		hash ^= (uint8_t)*c;
+		hash *= 0x100000001b3ULL;
+	}
+	return (size_t)hash;
+}
+
+/**
+ * @return the slot holding host_id or the empty slot where it would be inserted
+ */
+static size_t host_table_slot(ChiakiDiscoveryHostTable *table, const char *host_id)
+{
+	size_t mask = table->index_size - 1;
+	size_t slot = host_id_hash(host_id) & mask;
+	while(table->index[slot])
 	{
-		if(service->host_discovery_infos[i].last_ping_index + service->options.host_drop_pings >= service->ping_index)
+		const char *slot_id = table->hosts[table->index[slot] - 1].host_id;
+		if(slot_id && strcmp(slot_id, host_id) == 0)
+			break;
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+static void host_table_index_erase(ChiakiDiscoveryHostTable *table, size_t slot)
+{
+	// backward shift deletion, so lookups never have to skip over tombstones
+	size_t mask = table->index_size - 1;
+	size_t hole = slot;
+	size_t cur = slot;
+	while(true)
+	{
+		cur = (cur + 1) & mask;
+		if(!table->index[cur])
+			break;
+		size_t home = host_id_hash(table->hosts[table->index[cur] - 1].host_id) & mask;
+		// entries whose home lies cyclically in (hole, cur] are still reachable
+		bool reachable = hole <= cur ? (hole < home && home <= cur) : (hole < home || home <= cur);
+		if(reachable)
 			continue;
+		table->index[hole] = table->index[cur];
+		hole = cur;
+	}
+	table->index[hole] = 0;
+}
+
+static void host_table_remove(ChiakiDiscoveryHostTable *table, size_t i)
+{
+	ChiakiDiscoveryHost *host = &table->hosts[i];
+	host_table_index_erase(table, host_table_slot(table, host->host_id));
 
-		ChiakiDiscoveryHost *host = &service->hosts[i];
-		CHIAKI_LOGI(service->log, "Discovery Service: Host with id %s is no longer available", host->host_id ? host->host_id : "");
+	if(table->cb)
+		table->cb(CHIAKI_DISCOVERY_SERVICE_HOST_REMOVED, host, table->cb_user);
 
 #define FREE_STRING(name) do { free((char *)host->name); } while(0)
-		CHIAKI_DISCOVERY_HOST_STRING_FOREACH(FREE_STRING)
+	CHIAKI_DISCOVERY_HOST_STRING_FOREACH(FREE_STRING)
 #undef FREE_STRING
 
-		if(i < service->hosts_count - 1)
-		{
-			memmove(service->host_discovery_infos + i,
-					service->host_discovery_infos + i + 1,
-					sizeof(ChiakiDiscoveryServiceHostDiscoveryInfo) * (service->hosts_count - i - 1));
-
-			memmove(service->hosts + i,
-					service->hosts + i + 1,
-					sizeof(ChiakiDiscoveryHost) * (service->hosts_count - i - 1));
-		}
-
-		change = true;
-		if(i > 0)
-			i--;
-		service->hosts_count--;
+	size_t last = table->hosts_count - 1;
+	if(i != last)
+	{
+		table->hosts[i] = table->hosts[last];
+		table->infos[i] = table->infos[last];
+		table->index[host_table_slot(table, table->hosts[i].host_id)] = i + 1;
 	}
-
-	if(change)
-		discovery_service_report_state(service);
+	memset(&table->hosts[last], 0, sizeof(ChiakiDiscoveryHost));
+	table->hosts_count--;
 }
 
-static void discovery_service_host_received(ChiakiDiscoveryHost *host, void *user)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_host_table_init(ChiakiDiscoveryHostTable *table, size_t hosts_max, ChiakiDiscoveryServiceDeltaCb cb, void *cb_user)
 {
-	ChiakiDiscoveryService *service = user;
+	table->hosts_count = 0;
+	table->hosts_max = hosts_max;
+	table->cb = cb;
+	table->cb_user = cb_user;
+
+	// keep the load factor at or below 1/2
+	table->index_size = 4;
+	while(table->index_size < hosts_max * 2)
+		table->index_size <<= 1;
+
+	table->hosts = calloc(hosts_max ? hosts_max : 1, sizeof(ChiakiDiscoveryHost));
+	if(!table->hosts)
+		return CHIAKI_ERR_MEMORY;
+	table->infos = calloc(hosts_max ? hosts_max : 1, sizeof(ChiakiDiscoveryServiceHostDiscoveryInfo));
+	if(!table->infos)
+		goto error_hosts;
+	table->index = calloc(table->index_size, sizeof(size_t));
+	if(!table->index)
+		goto error_infos;
 
-	ChiakiErrorCode err = chiaki_mutex_lock(&service->state_mutex);
-	assert(err == CHIAKI_ERR_SUCCESS);
+	return CHIAKI_ERR_SUCCESS;
+error_infos:
+	free(table->infos);
+error_hosts:
+	free(table->hosts);
+	return CHIAKI_ERR_MEMORY;
+}
 
-	if(!host->host_id)
+CHIAKI_EXPORT void chiaki_discovery_host_table_fini(ChiakiDiscoveryHostTable *table)
+{
+	for(size_t i=0; i<table->hosts_count; i++)
 	{
-		CHIAKI_LOGE(service->log, "Discovery Service received host without id");
-		chiaki_mutex_unlock(&service->state_mutex);
-		return;
+		ChiakiDiscoveryHost *host = &table->hosts[i];
+#define FREE_STRING(name) free((char *)host->name);
+		CHIAKI_DISCOVERY_HOST_STRING_FOREACH(FREE_STRING)
+#undef FREE_STRING
 	}
-	CHIAKI_LOGV(service->log, "Discovery Service Received host with id %s", host->host_id);
+	free(table->index);
+	free(table->infos);
+	free(table->hosts);
+}
+
+CHIAKI_EXPORT ChiakiDiscoveryHost *chiaki_discovery_host_table_find(ChiakiDiscoveryHostTable *table, const char *host_id)
+{
+	size_t index = table->index[host_table_slot(table, host_id)];
+	return index ? &table->hosts[index - 1] : NULL;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_host_table_update(ChiakiDiscoveryHostTable *table, ChiakiDiscoveryHost *host, uint64_t ping_index)
+{
+	if(!host->host_id)
+		return CHIAKI_ERR_INVALID_DATA;
 
+	sa_family_t family = host->host_addr && strchr(host->host_addr, ':') ? AF_INET6 : AF_INET;
+	ChiakiDiscoveryServiceDelta delta = CHIAKI_DISCOVERY_SERVICE_HOST_UPDATED;
 	bool change = false;
 
-	size_t index = SIZE_MAX;
-	for(size_t i=0; i<service->hosts_count; i++)
+	size_t slot = host_table_slot(table, host->host_id);
+	size_t index;
+	if(table->index[slot])
 	{
-		if(!service->hosts[i].host_id)
-			continue;
-
-		if(strcmp(service->hosts[i].host_id, host->host_id) == 0)
+		index = table->index[slot] - 1;
+		ChiakiDiscoveryServiceHostDiscoveryInfo *info = &table->infos[index];
+		info->last_ping_index = ping_index;
+		if(family != info->family)
 		{
-			index = i;
-			break;
+			// the other address still answered the previous ping, keep reporting that one
+			if(info->family_last_ping_index + 1 >= ping_index)
+				return CHIAKI_ERR_SUCCESS;
+			info->family = family;
 		}
+		info->family_last_ping_index = ping_index;
 	}
-
-	if(index == SIZE_MAX)
+	else
 	{
-		if(service->hosts_count == service->options.hosts_max)
-		{
-			CHIAKI_LOGE(service->log, "Discovery Service received new host, but no space available");
-			goto rzcon;
-		}
-
-		CHIAKI_LOGI(service->log, "Discovery Service detected new host with id %s", host->host_id);
-
+		if(table->hosts_count == table->hosts_max)
+			return CHIAKI_ERR_OVERFLOW;
+
+		index = table->hosts_count++;
+		table->index[slot] = index + 1;
+		memset(&table->hosts[index], 0, sizeof(ChiakiDiscoveryHost));
+		ChiakiDiscoveryServiceHostDiscoveryInfo *info = &table->infos[index];
+		info->last_ping_index = ping_index;
+		info->family = family;
+		info->family_last_ping_index = ping_index;
+		delta = CHIAKI_DISCOVERY_SERVICE_HOST_ADDED;
 		change = true;
-		index = service->hosts_count++;
-		memset(&service->hosts[index], 0, sizeof(ChiakiDiscoveryHost));
 	}
 
-	service->host_discovery_infos[index].last_ping_index = service->ping_index;
-
-	ChiakiDiscoveryHost *host_slot = &service->hosts[index];
+	ChiakiDiscoveryHost *host_slot = &table->hosts[index];
 
 	if(host_slot->state != host->state || host_slot->host_request_port != host->host_request_port)
 		change = true;
@@ -358,7 +634,7 @@ static void discovery_service_host_received(ChiakiDiscoveryHost *host, void *use
 
 #define UPDATE_STRING(name) do { \
 		if(host_slot->name && host->name && strcmp(host_slot->name, host->name) == 0) \
-            break; \
+			break; \
 		if(!host_slot->name && !host->name) \
 			break; \
 		change = true; \
@@ -374,16 +650,22 @@ static void discovery_service_host_received(ChiakiDiscoveryHost *host, void *use
 
 #undef UPDATE_STRING
 
-	if(change)
-		discovery_service_report_state(service);
+	if(change && table->cb)
+		table->cb(delta, host_slot, table->cb_user);
 
-rzcon:
-	chiaki_mutex_unlock(&service->state_mutex);
+	return CHIAKI_ERR_SUCCESS;
 }
 
-static void discovery_service_report_state(ChiakiDiscoveryService *service)
+CHIAKI_EXPORT void chiaki_discovery_host_table_drop_old(ChiakiDiscoveryHostTable *table, uint64_t ping_index, uint64_t drop_pings)
 {
-	// service->state_mutex must be locked
-	if(service->options.cb)
-		service->options.cb(service->hosts, service->hosts_count, service->options.cb_user);
+	for(size_t i=0; i<table->hosts_count;)
+	{
+		if(table->infos[i].last_ping_index + drop_pings >= ping_index)
+		{
+			i++;
+			continue;
+		}
+		// the last host is moved to i
+		host_table_remove(table, i);
+	}
 }
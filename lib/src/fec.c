@@ -74,6 +74,146 @@ error_matrix:
 	return err;
 }
 
+#define DECODE_TASK_BYTES_MIN 0x10000 // source bytes read by one task, below that waking a worker costs more than it saves
+#define DECODE_SLICE_ALIGN 0x40
+
+typedef struct decode_task_t
+{
+	ChiakiThreadPoolTask task;
+	unsigned int k;
+	int *decoding_row;
+	int *dm_ids;
+	int dest_id;
+	char **ptrs; // data pointers followed by coding pointers, offset to the slice
+	size_t size;
+} DecodeTask;
+
+static void decode_task_run(void *user)
+{
+	DecodeTask *task = user;
+	jerasure_matrix_dotprod(task->k, CHIAKI_FEC_WORDSIZE, task->decoding_row, task->dm_ids, task->dest_id,
+			task->ptrs, task->ptrs + task->k, (int)task->size);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_decode_pool(uint8_t *frame_buf, size_t unit_size, size_t stride, unsigned int k, unsigned int m, const unsigned int *erasures, size_t erasures_count, ChiakiThreadPool *pool, uint32_t affinity)
+{
+	if(!pool)
+		return chiaki_fec_decode(frame_buf, unit_size, stride, k, m, erasures, erasures_count);
+	if(stride < unit_size)
+		return CHIAKI_ERR_INVALID_DATA;
+	if(erasures_count > m)
+		return CHIAKI_ERR_FEC_FAILED;
+
+	// also initializes the galois field tables before any task uses them
+	int *matrix = create_matrix(k, m);
+	if(!matrix)
+		return CHIAKI_ERR_MEMORY;
+
+	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+	int *erased = calloc(k + m, sizeof(int));
+	if(!erased)
+	{
+		err = CHIAKI_ERR_MEMORY;
+		goto error_matrix;
+	}
+	size_t erased_source = 0;
+	for(size_t i=0; i<erasures_count; i++)
+	{
+		if(erasures[i] >= k + m)
+		{
+			err = CHIAKI_ERR_INVALID_DATA;
+			goto error_erased;
+		}
+		if(!erased[erasures[i]] && erasures[i] < k)
+			erased_source++;
+		erased[erasures[i]] = 1;
+	}
+	if(!erased_source)
+		goto error_erased;
+
+	int *decoding_matrix = malloc(k * k * sizeof(int));
+	int *dm_ids = malloc(k * sizeof(int));
+	if(!decoding_matrix || !dm_ids)
+	{
+		err = CHIAKI_ERR_MEMORY;
+		goto error_decoding_matrix;
+	}
+	if(jerasure_make_decoding_matrix(k, m, CHIAKI_FEC_WORDSIZE, matrix, erased, decoding_matrix, dm_ids) < 0)
+	{
+		err = CHIAKI_ERR_FEC_FAILED;
+		goto error_decoding_matrix;
+	}
+
+	// split units into slices until there is about one task per worker plus the calling thread
+	size_t slice_size = unit_size;
+	size_t slices_count = 1;
+	size_t slices_max = (pool->workers_count + erased_source) / erased_source;
+	if(slices_max > 1)
+	{
+		size_t slice_min = (DECODE_TASK_BYTES_MIN / k + DECODE_SLICE_ALIGN - 1) / DECODE_SLICE_ALIGN * DECODE_SLICE_ALIGN;
+		if(slice_min < unit_size)
+		{
+			slices_count = (unit_size + slice_min - 1) / slice_min;
+			if(slices_count > slices_max)
+				slices_count = slices_max;
+			slice_size = (unit_size / slices_count + DECODE_SLICE_ALIGN - 1) / DECODE_SLICE_ALIGN * DECODE_SLICE_ALIGN;
+			slices_count = (unit_size + slice_size - 1) / slice_size;
+		}
+	}
+
+	char **ptrs = malloc(slices_count * (k + m) * sizeof(char *));
+	size_t tasks_count = erased_source * slices_count;
+	DecodeTask *tasks = calloc(tasks_count, sizeof(DecodeTask));
+	if(!ptrs || !tasks)
+	{
+		err = CHIAKI_ERR_MEMORY;
+		goto error_tasks;
+	}
+	for(size_t s=0; s<slices_count; s++)
+		for(size_t i=0; i<k+m; i++)
+			ptrs[s * (k + m) + i] = (char *)frame_buf + stride * i + s * slice_size;
+
+	ChiakiThreadPoolGroup group;
+	err = chiaki_thread_pool_group_init(&group);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_tasks;
+
+	DecodeTask *task = tasks;
+	for(unsigned int i=0; i<k; i++)
+	{
+		if(!erased[i])
+			continue;
+		for(size_t s=0; s<slices_count; s++, task++)
+		{
+			task->k = k;
+			task->decoding_row = decoding_matrix + i * k;
+			task->dm_ids = dm_ids;
+			task->dest_id = (int)i;
+			task->ptrs = ptrs + s * (k + m);
+			task->size = s + 1 < slices_count ? slice_size : unit_size - s * slice_size;
+			chiaki_thread_pool_task_init(&task->task, decode_task_run, task, &group);
+		}
+	}
+
+	for(size_t i=0; i+1<tasks_count; i++)
+		chiaki_thread_pool_submit(pool, &tasks[i].task, CHIAKI_THREAD_POOL_PRIORITY_HIGH, affinity);
+	decode_task_run(&tasks[tasks_count - 1]);
+	chiaki_thread_pool_group_wait(pool, &group);
+	chiaki_thread_pool_group_fini(&group);
+
+error_tasks:
+	free(tasks);
+	free(ptrs);
+error_decoding_matrix:
+	free(dm_ids);
+	free(decoding_matrix);
+error_erased:
+	free(erased);
+error_matrix:
+	free(matrix);
+	return err;
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_encode(uint8_t *frame_buf, size_t unit_size, size_t stride, unsigned int k, unsigned int m)
 {
 	if(stride < unit_size)
@@ -1,13 +1,14 @@
 // SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
 
 #include <chiaki/feedbacksender.h>
+#include <chiaki/time.h>
 
 #define FEEDBACK_STATE_TIMEOUT_MIN_MS 8 // minimum time to wait between sending 2 packets
 #define FEEDBACK_STATE_TIMEOUT_MAX_MS 200 // maximum time to wait between sending 2 packets
 
 #define FEEDBACK_HISTORY_BUFFER_SIZE 0x10
 
-static void *feedback_sender_thread_func(void *user);
+static void feedback_sender_timer_cb(void *user);
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_feedback_sender_init(ChiakiFeedbackSender *feedback_sender, ChiakiTakion *takion)
 {
@@ -28,19 +29,27 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_feedback_sender_init(ChiakiFeedbackSender *
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_history_buffer;
 
-	err = chiaki_cond_init(&feedback_sender->state_cond);
-	if(err != CHIAKI_ERR_SUCCESS)
+	feedback_sender->should_stop = false;
+	feedback_sender->controller_state_changed = false;
+	feedback_sender->state_pending = false;
+
+	feedback_sender->timer_service = chiaki_timer_service_shared_ref();
+	if(!feedback_sender->timer_service)
+	{
+		err = CHIAKI_ERR_THREAD;
 		goto error_mutex;
+	}
+	chiaki_timer_init(&feedback_sender->timer, feedback_sender->timer_service, feedback_sender_timer_cb, feedback_sender);
 
-	err = chiaki_thread_create(&feedback_sender->thread, feedback_sender_thread_func, feedback_sender);
+	// like after having sent the idle state, so the first one goes out after the maximum interval unless something changes
+	feedback_sender->state_sent_us = chiaki_time_now_monotonic_us();
+	err = chiaki_timer_arm(&feedback_sender->timer, feedback_sender->state_sent_us + FEEDBACK_STATE_TIMEOUT_MAX_MS * 1000);
 	if(err != CHIAKI_ERR_SUCCESS)
-		goto error_cond;
-
-	chiaki_thread_set_name(&feedback_sender->thread, "Chiaki Feedback Sender");
+		goto error_timer_service;
 
 	return CHIAKI_ERR_SUCCESS;
-error_cond:
-	chiaki_cond_fini(&feedback_sender->state_cond);
+error_timer_service:
+	chiaki_timer_service_shared_unref(feedback_sender->timer_service);
 error_mutex:
 	chiaki_mutex_fini(&feedback_sender->state_mutex);
 error_history_buffer:
@@ -53,9 +62,8 @@ CHIAKI_EXPORT void chiaki_feedback_sender_fini(ChiakiFeedbackSender *feedback_se
 	chiaki_mutex_lock(&feedback_sender->state_mutex);
 	feedback_sender->should_stop = true;
 	chiaki_mutex_unlock(&feedback_sender->state_mutex);
-	chiaki_cond_signal(&feedback_sender->state_cond);
-	chiaki_thread_join(&feedback_sender->thread, NULL);
-	chiaki_cond_fini(&feedback_sender->state_cond);
+	chiaki_timer_cancel(&feedback_sender->timer);
+	chiaki_timer_service_shared_unref(feedback_sender->timer_service);
 	chiaki_mutex_fini(&feedback_sender->state_mutex);
 	chiaki_feedback_history_buffer_fini(&feedback_sender->history_buf);
 }
@@ -75,10 +83,13 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_feedback_sender_set_controller_state(Chiaki
 	feedback_sender->controller_state = *state;
 	feedback_sender->controller_state_changed = true;
 
+	// armed under state_mutex so it can't be overtaken by the callback re-arming for a later deadline
+	if(!feedback_sender->should_stop)
+		err = chiaki_timer_arm(&feedback_sender->timer, chiaki_time_now_monotonic_us());
+
 	chiaki_mutex_unlock(&feedback_sender->state_mutex);
-	chiaki_cond_signal(&feedback_sender->state_cond);
 
-	return CHIAKI_ERR_SUCCESS;
+	return err;
 }
 
 static bool controller_state_equals_for_feedback_state(ChiakiControllerState *a, ChiakiControllerState *b)
@@ -235,55 +246,43 @@ static void feedback_sender_send_history(ChiakiFeedbackSender *feedback_sender)
 	}
 }
 
-static bool state_cond_check(void *user)
-{
-	ChiakiFeedbackSender *feedback_sender = user;
-	return feedback_sender->should_stop || feedback_sender->controller_state_changed;
-}
-
-static void *feedback_sender_thread_func(void *user)
+static void feedback_sender_timer_cb(void *user)
 {
 	ChiakiFeedbackSender *feedback_sender = user;
+	if(chiaki_mutex_lock(&feedback_sender->state_mutex) != CHIAKI_ERR_SUCCESS)
+		return;
 
-	ChiakiErrorCode err = chiaki_mutex_lock(&feedback_sender->state_mutex);
-	if(err != CHIAKI_ERR_SUCCESS)
-		return NULL;
+	if(feedback_sender->should_stop)
+		goto beach;
 
-	uint64_t next_timeout = FEEDBACK_STATE_TIMEOUT_MAX_MS;
-	while(true)
+	if(feedback_sender->controller_state_changed)
 	{
-		err = chiaki_cond_timedwait_pred(&feedback_sender->state_cond, &feedback_sender->state_mutex, next_timeout, state_cond_check, feedback_sender);
-		if(err != CHIAKI_ERR_SUCCESS && err != CHIAKI_ERR_TIMEOUT)
-			break;
-
-		if(feedback_sender->should_stop)
-			break;
-
-		bool send_feedback_state = true;
-		bool send_feedback_history = false;
-
-		if(feedback_sender->controller_state_changed)
-		{
-			// TODO: FEEDBACK_STATE_TIMEOUT_MIN_MS
-			feedback_sender->controller_state_changed = false;
-
-			// don't need to send feedback state if nothing relevant changed
-			if(controller_state_equals_for_feedback_state(&feedback_sender->controller_state, &feedback_sender->controller_state_prev))
-				send_feedback_state = false;
-
-			send_feedback_history = !controller_state_equals_for_feedback_history(&feedback_sender->controller_state, &feedback_sender->controller_state_prev);
-		} // else: timeout
+		feedback_sender->controller_state_changed = false;
 
-		if(send_feedback_state)
-			feedback_sender_send_state(feedback_sender);
-
-		if(send_feedback_history)
+		// buttons and touches go out immediately, their history makes up for any lost packets
+		if(!controller_state_equals_for_feedback_history(&feedback_sender->controller_state, &feedback_sender->controller_state_prev))
 			feedback_sender_send_history(feedback_sender);
 
+		// don't need to send feedback state if nothing relevant changed
+		if(!controller_state_equals_for_feedback_state(&feedback_sender->controller_state, &feedback_sender->controller_state_prev))
+			feedback_sender->state_pending = true;
+
 		feedback_sender->controller_state_prev = feedback_sender->controller_state;
 	}
 
-	chiaki_mutex_unlock(&feedback_sender->state_mutex);
+	// sticks and motion at most every FEEDBACK_STATE_TIMEOUT_MIN_MS, and at least every FEEDBACK_STATE_TIMEOUT_MAX_MS even if nothing changed
+	uint64_t now_us = chiaki_time_now_monotonic_us();
+	uint64_t interval_us = (feedback_sender->state_pending ? FEEDBACK_STATE_TIMEOUT_MIN_MS : FEEDBACK_STATE_TIMEOUT_MAX_MS) * 1000;
+	if(now_us >= feedback_sender->state_sent_us + interval_us)
+	{
+		feedback_sender_send_state(feedback_sender);
+		feedback_sender->state_sent_us = now_us;
+		feedback_sender->state_pending = false;
+		interval_us = FEEDBACK_STATE_TIMEOUT_MAX_MS * 1000;
+	}
+
+	chiaki_timer_arm(&feedback_sender->timer, feedback_sender->state_sent_us + interval_us);
 
-	return NULL;
+beach:
+	chiaki_mutex_unlock(&feedback_sender->state_mutex);
 }
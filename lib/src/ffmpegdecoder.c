@@ -1,5 +1,6 @@
 
 #include <chiaki/ffmpegdecoder.h>
+#include <chiaki/time.h>
 
 #include <libavcodec/avcodec.h>
 #include <libavutil/pixdesc.h>
@@ -19,6 +20,14 @@ static enum AVCodecID chiaki_codec_av_codec_id(ChiakiCodec codec)
 CHIAKI_EXPORT ChiakiErrorCode chiaki_ffmpeg_decoder_init(ChiakiFfmpegDecoder *decoder, ChiakiLog *log,
 		ChiakiCodec codec, const char *hw_decoder_name, AVBufferRef *hw_device_ctx,
 		ChiakiFfmpegFrameAvailable frame_available_cb, void *frame_available_cb_user)
+{
+	return chiaki_ffmpeg_decoder_init_warm(decoder, log, codec, hw_decoder_name, hw_device_ctx,
+			frame_available_cb, frame_available_cb_user, false);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_ffmpeg_decoder_init_warm(ChiakiFfmpegDecoder *decoder, ChiakiLog *log,
+		ChiakiCodec codec, const char *hw_decoder_name, AVBufferRef *hw_device_ctx,
+		ChiakiFfmpegFrameAvailable frame_available_cb, void *frame_available_cb_user, bool warm_start)
 {
 	ChiakiErrorCode err = chiaki_mutex_init(&decoder->mutex, false);
 	if(err != CHIAKI_ERR_SUCCESS)
@@ -30,6 +39,9 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_ffmpeg_decoder_init(ChiakiFfmpegDecoder *de
 	decoder->hdr_enabled = codec == CHIAKI_CODEC_H265_HDR;
 	decoder->frames_lost = 0;
 	decoder->frame_recovered = false;
+	decoder->warm_start = warm_start;
+	decoder->connected_us = 0;
+	decoder->first_frame_latency_us = 0;
 
 	decoder->hw_device_ctx = hw_device_ctx ? av_buffer_ref(hw_device_ctx) : NULL;
 	decoder->hw_pix_fmt = AV_PIX_FMT_NONE;
@@ -86,6 +98,13 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_ffmpeg_decoder_init(ChiakiFfmpegDecoder *de
 		CHIAKI_LOGI(log, "Using hardware decoder \"%s\" with pix_fmt=%s", hw_decoder_name, av_get_pix_fmt_name(decoder->hw_pix_fmt));
 	}
 
+	if(warm_start)
+	{
+		// the stream has no B-frames, so nothing is gained by waiting for reordering before output
+		decoder->codec_context->flags |= AV_CODEC_FLAG_LOW_DELAY;
+		CHIAKI_LOGI(log, "FFMPEG decoder warm start enabled");
+	}
+
 	if(avcodec_open2(decoder->codec_context, decoder->av_codec, NULL) < 0)
 	{
 		CHIAKI_LOGE(log, "Failed to open codec context");
@@ -204,6 +223,14 @@ CHIAKI_EXPORT AVFrame *chiaki_ffmpeg_decoder_pull_frame(ChiakiFfmpegDecoder *dec
 		frame->decode_error_flags |= 1;
 	}
 	decoder->frames_lost = 0;
+	if(frame && decoder->connected_us && !decoder->first_frame_latency_us)
+	{
+		decoder->first_frame_latency_us = chiaki_time_now_monotonic_us() - decoder->connected_us;
+		if(!decoder->first_frame_latency_us)
+			decoder->first_frame_latency_us = 1;
+		CHIAKI_LOGI(decoder->log, "First frame decoded %.1f ms after connecting%s",
+				(double)decoder->first_frame_latency_us / 1000.0, decoder->warm_start ? " (warm start)" : "");
+	}
 	chiaki_mutex_unlock(&decoder->mutex);
 
 	return frame;
@@ -222,3 +249,18 @@ CHIAKI_EXPORT enum AVPixelFormat chiaki_ffmpeg_decoder_get_pixel_format(ChiakiFf
 	}
 }
 
+CHIAKI_EXPORT void chiaki_ffmpeg_decoder_stream_connected(ChiakiFfmpegDecoder *decoder)
+{
+	chiaki_mutex_lock(&decoder->mutex);
+	decoder->connected_us = chiaki_time_now_monotonic_us();
+	decoder->first_frame_latency_us = 0;
+	chiaki_mutex_unlock(&decoder->mutex);
+}
+
+CHIAKI_EXPORT uint64_t chiaki_ffmpeg_decoder_get_first_frame_latency_us(ChiakiFfmpegDecoder *decoder)
+{
+	chiaki_mutex_lock(&decoder->mutex);
+	uint64_t r = decoder->first_frame_latency_us;
+	chiaki_mutex_unlock(&decoder->mutex);
+	return r;
+}
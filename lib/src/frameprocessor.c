@@ -56,6 +56,8 @@ CHIAKI_EXPORT void chiaki_frame_processor_init(ChiakiFrameProcessor *frame_proce
 	frame_processor->unit_slots_size = 0;
 	frame_processor->flushed = true;
 	chiaki_stream_stats_reset(&frame_processor->stream_stats);
+	frame_processor->thread_pool = NULL;
+	frame_processor->thread_pool_affinity = 0;
 }
 
 CHIAKI_EXPORT void chiaki_frame_processor_fini(ChiakiFrameProcessor *frame_processor)
@@ -228,10 +230,11 @@ static ChiakiErrorCode chiaki_frame_processor_fec(ChiakiFrameProcessor *frame_pr
 	}
 	assert(erasure_index == erasures_count);
 
-	ChiakiErrorCode err = chiaki_fec_decode(frame_processor->frame_buf,
+	ChiakiErrorCode err = chiaki_fec_decode_pool(frame_processor->frame_buf,
 			frame_processor->buf_size_per_unit, frame_processor->buf_stride_per_unit,
 			frame_processor->units_source_expected, frame_processor->units_fec_expected,
-			erasures, erasures_count);
+			erasures, erasures_count,
+			frame_processor->thread_pool, frame_processor->thread_pool_affinity);
 
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
@@ -20,15 +20,21 @@
 #include "utils.h"
 
 #define KEY_BUF_CHUNK_SIZE 0x1000
+#define KEY_BUF_TASK_CHUNKS_MAX 0x40 // per run of the pool task, so filling the whole buffer does not hog a worker
 
 static ChiakiErrorCode gkcrypt_gen_key_iv(ChiakiGKCrypt *gkcrypt, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret);
 
 static void *gkcrypt_thread_func(void *user);
+static void gkcrypt_key_buf_task_func(void *user);
+static void gkcrypt_key_buf_task_queue(ChiakiGKCrypt *gkcrypt);
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init(ChiakiGKCrypt *gkcrypt, ChiakiLog *log, size_t key_buf_chunks, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init(ChiakiGKCrypt *gkcrypt, ChiakiLog *log, size_t key_buf_chunks, ChiakiThreadPool *pool, uint32_t pool_affinity, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret)
 {
 	gkcrypt->log = log;
 	gkcrypt->index = index;
+	gkcrypt->pool = pool;
+	gkcrypt->pool_affinity = pool_affinity;
+	gkcrypt->key_buf_task_queued = false;
 
 	gkcrypt->key_buf_size = key_buf_chunks * KEY_BUF_CHUNK_SIZE;
 	gkcrypt->key_buf_populated = 0;
@@ -70,7 +76,18 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init(ChiakiGKCrypt *gkcrypt, Chiaki
 	gkcrypt->key_gmac_index_current = 0;
 	memcpy(gkcrypt->key_gmac_current, gkcrypt->key_gmac_base, sizeof(gkcrypt->key_gmac_current));
 
-	if(gkcrypt->key_buf)
+	if(gkcrypt->key_buf && gkcrypt->pool)
+	{
+		err = chiaki_thread_pool_group_init(&gkcrypt->key_buf_group);
+		if(err != CHIAKI_ERR_SUCCESS)
+			goto error_key_buf_cond;
+		chiaki_thread_pool_task_init(&gkcrypt->key_buf_task, gkcrypt_key_buf_task_func, gkcrypt, &gkcrypt->key_buf_group);
+
+		chiaki_mutex_lock(&gkcrypt->key_buf_mutex);
+		gkcrypt_key_buf_task_queue(gkcrypt);
+		chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
+	}
+	else if(gkcrypt->key_buf)
 	{
 		err = chiaki_thread_create(&gkcrypt->key_buf_thread, gkcrypt_thread_func, gkcrypt);
 		if(err != CHIAKI_ERR_SUCCESS)
@@ -100,8 +117,16 @@ CHIAKI_EXPORT void chiaki_gkcrypt_fini(ChiakiGKCrypt *gkcrypt)
 		chiaki_mutex_lock(&gkcrypt->key_buf_mutex);
 		gkcrypt->key_buf_thread_stop = true;
 		chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
-		chiaki_cond_signal(&gkcrypt->key_buf_cond);
-		chiaki_thread_join(&gkcrypt->key_buf_thread, NULL);
+		if(gkcrypt->pool)
+		{
+			chiaki_thread_pool_group_wait(gkcrypt->pool, &gkcrypt->key_buf_group);
+			chiaki_thread_pool_group_fini(&gkcrypt->key_buf_group);
+		}
+		else
+		{
+			chiaki_cond_signal(&gkcrypt->key_buf_cond);
+			chiaki_thread_join(&gkcrypt->key_buf_thread, NULL);
+		}
 		chiaki_cond_fini(&gkcrypt->key_buf_cond);
 		chiaki_mutex_fini(&gkcrypt->key_buf_mutex);
 		chiaki_aligned_free(gkcrypt->key_buf);
@@ -293,6 +318,11 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_get_key_stream(ChiakiGKCrypt *gkcry
 	if(key_pos + buf_size > gkcrypt->last_key_pos)
 		gkcrypt->last_key_pos = key_pos + buf_size;
 	bool signal = gkcrypt_key_buf_should_generate(gkcrypt);
+	if(signal && gkcrypt->pool)
+	{
+		gkcrypt_key_buf_task_queue(gkcrypt);
+		signal = false;
+	}
 
 	ChiakiErrorCode err;
 	if(key_pos < gkcrypt->key_buf_key_pos_min
@@ -498,9 +528,45 @@ static ChiakiErrorCode gkcrypt_generate_next_chunk(ChiakiGKCrypt *gkcrypt)
 	return err;
 }
 
+/**
+ * Make room for and generate the next chunk, key_buf_mutex must be locked and key_buf_mutex_pred() true.
+ */
+static ChiakiErrorCode gkcrypt_key_buf_advance(ChiakiGKCrypt *gkcrypt)
+{
+	/*
+	CHIAKI_LOGV(gkcrypt->log, "GKCrypt %d key buf size %#llx, start offset: %#llx, populated: %#llx, min key pos: %#llx, last key pos: %#llx, generating next chunk",
+				(int)gkcrypt->index,
+				(unsigned long long)gkcrypt->key_buf_size,
+				(unsigned long long)gkcrypt->key_buf_start_offset,
+				(unsigned long long)gkcrypt->key_buf_populated,
+				(unsigned long long)gkcrypt->key_buf_key_pos_min,
+				(unsigned long long)gkcrypt->last_key_pos);
+	*/
+
+	if(gkcrypt->last_key_pos > gkcrypt->key_buf_key_pos_min + gkcrypt->key_buf_populated)
+	{
+		// skip ahead if the last key pos is already beyond our buffer
+		uint64_t key_pos = (gkcrypt->last_key_pos / KEY_BUF_CHUNK_SIZE) * KEY_BUF_CHUNK_SIZE;
+		CHIAKI_LOGW(gkcrypt->log, "Already requested a higher key pos than in the buffer, skipping ahead from min %#llx to %#llx",
+					(unsigned long long)gkcrypt->key_buf_key_pos_min,
+					(unsigned long long)key_pos);
+		gkcrypt->key_buf_key_pos_min = key_pos;
+		gkcrypt->key_buf_start_offset = 0;
+		gkcrypt->key_buf_populated = 0;
+	}
+	else if(gkcrypt->key_buf_populated == gkcrypt->key_buf_size)
+	{
+		gkcrypt->key_buf_start_offset = (gkcrypt->key_buf_start_offset + KEY_BUF_CHUNK_SIZE) % gkcrypt->key_buf_size;
+		gkcrypt->key_buf_key_pos_min += KEY_BUF_CHUNK_SIZE;
+		gkcrypt->key_buf_populated -= KEY_BUF_CHUNK_SIZE;
+	}
+	return gkcrypt_generate_next_chunk(gkcrypt);
+}
+
 static void *gkcrypt_thread_func(void *user)
 {
 	ChiakiGKCrypt *gkcrypt = user;
+	chiaki_thread_apply_role(CHIAKI_THREAD_ROLE_GKCRYPT);
 	CHIAKI_LOGV(gkcrypt->log, "GKCrypt %d thread starting", (int)gkcrypt->index);
 
 	ChiakiErrorCode err = chiaki_mutex_lock(&gkcrypt->key_buf_mutex);
@@ -512,34 +578,7 @@ static void *gkcrypt_thread_func(void *user)
 		if(gkcrypt->key_buf_thread_stop || err != CHIAKI_ERR_SUCCESS)
 			break;
 
-		/*
-		CHIAKI_LOGV(gkcrypt->log, "GKCrypt %d key buf size %#llx, start offset: %#llx, populated: %#llx, min key pos: %#llx, last key pos: %#llx, generating next chunk",
-					(int)gkcrypt->index,
-					(unsigned long long)gkcrypt->key_buf_size,
-					(unsigned long long)gkcrypt->key_buf_start_offset,
-					(unsigned long long)gkcrypt->key_buf_populated,
-					(unsigned long long)gkcrypt->key_buf_key_pos_min,
-					(unsigned long long)gkcrypt->last_key_pos);
-		*/
-
-		if(gkcrypt->last_key_pos > gkcrypt->key_buf_key_pos_min + gkcrypt->key_buf_populated)
-		{
-			// skip ahead if the last key pos is already beyond our buffer
-			uint64_t key_pos = (gkcrypt->last_key_pos / KEY_BUF_CHUNK_SIZE) * KEY_BUF_CHUNK_SIZE;
-			CHIAKI_LOGW(gkcrypt->log, "Already requested a higher key pos than in the buffer, skipping ahead from min %#llx to %#llx",
-						(unsigned long long)gkcrypt->key_buf_key_pos_min,
-						(unsigned long long)key_pos);
-			gkcrypt->key_buf_key_pos_min = key_pos;
-			gkcrypt->key_buf_start_offset = 0;
-			gkcrypt->key_buf_populated = 0;
-		}
-		else if(gkcrypt->key_buf_populated == gkcrypt->key_buf_size)
-		{
-			gkcrypt->key_buf_start_offset = (gkcrypt->key_buf_start_offset + KEY_BUF_CHUNK_SIZE) % gkcrypt->key_buf_size;
-			gkcrypt->key_buf_key_pos_min += KEY_BUF_CHUNK_SIZE;
-			gkcrypt->key_buf_populated -= KEY_BUF_CHUNK_SIZE;
-		}
-		err = gkcrypt_generate_next_chunk(gkcrypt);
+		err = gkcrypt_key_buf_advance(gkcrypt);
 		if(err != CHIAKI_ERR_SUCCESS)
 			break;
 	}
@@ -548,6 +587,40 @@ static void *gkcrypt_thread_func(void *user)
 	return NULL;
 }
 
+/**
+ * key_buf_mutex must be locked
+ */
+static void gkcrypt_key_buf_task_queue(ChiakiGKCrypt *gkcrypt)
+{
+	if(gkcrypt->key_buf_task_queued || gkcrypt->key_buf_thread_stop)
+		return;
+	gkcrypt->key_buf_task_queued = true;
+	chiaki_thread_pool_submit(gkcrypt->pool, &gkcrypt->key_buf_task, CHIAKI_THREAD_POOL_PRIORITY_NORMAL, gkcrypt->pool_affinity);
+}
+
+/**
+ * Pool counterpart of gkcrypt_thread_func(), runs until the buffer is ahead far enough again.
+ */
+static void gkcrypt_key_buf_task_func(void *user)
+{
+	ChiakiGKCrypt *gkcrypt = user;
+	chiaki_mutex_lock(&gkcrypt->key_buf_mutex);
+	for(size_t chunks=0; !gkcrypt->key_buf_thread_stop && key_buf_mutex_pred(gkcrypt); chunks++)
+	{
+		if(chunks == KEY_BUF_TASK_CHUNKS_MAX)
+		{
+			// let other tasks in and continue afterwards, still counted as queued
+			chiaki_thread_pool_submit(gkcrypt->pool, &gkcrypt->key_buf_task, CHIAKI_THREAD_POOL_PRIORITY_NORMAL, gkcrypt->pool_affinity);
+			chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
+			return;
+		}
+		if(gkcrypt_key_buf_advance(gkcrypt) != CHIAKI_ERR_SUCCESS)
+			break;
+	}
+	gkcrypt->key_buf_task_queued = false;
+	chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
+}
+
 CHIAKI_EXPORT void chiaki_key_state_init(ChiakiKeyState *state)
 {
 	state->prev = 0;
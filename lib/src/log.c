@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
 
 #include <chiaki/log.h>
+#include <chiaki/logasync.h>
 
 #include <stdio.h>
 #include <stdarg.h>
@@ -72,6 +73,15 @@ CHIAKI_EXPORT void chiaki_log(ChiakiLog *log, ChiakiLogLevel level, const char *
 		return;
 
 	va_list args;
+	if(log && log->cb == chiaki_log_async_cb)
+	{
+		// format directly into the queue
+		va_start(args, fmt);
+		chiaki_log_async_vlog(log->user, level, fmt, args);
+		va_end(args);
+		return;
+	}
+
 	char buf[0x100];
 	char *msg = buf;
 
@@ -0,0 +1,259 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/logasync.h>
+#include <chiaki/time.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+#define SIZE_EXP_MAX 20
+
+// producers only wake the writer when it announced it is going to sleep, a wakeup that is lost
+// in between is covered by this timeout
+#define LOG_ASYNC_IDLE_TIMEOUT_MS 100
+
+static void *log_async_thread_func(void *user);
+
+static uint64_t log_async_thread_id()
+{
+#ifdef _WIN32
+	return (uint64_t)GetCurrentThreadId();
+#elif defined(__linux__)
+	return (uint64_t)syscall(SYS_gettid);
+#else
+	return (uint64_t)(uintptr_t)pthread_self();
+#endif
+}
+
+static void log_async_record_cb_print(const ChiakiLogRecord *record, void *user)
+{
+	chiaki_log_cb_print(record->level, record->msg, user);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_log_async_init(ChiakiLogAsync *async, uint32_t level_mask, size_t records_min, ChiakiLogRecordCb cb, void *cb_user)
+{
+	size_t size_exp = 0;
+	while((((size_t)1) << size_exp) < records_min)
+	{
+		size_exp++;
+		if(size_exp > SIZE_EXP_MAX)
+			return CHIAKI_ERR_INVALID_DATA;
+	}
+
+	chiaki_log_init(&async->log, level_mask, chiaki_log_async_cb, async);
+	async->cb = cb ? cb : log_async_record_cb_print;
+	async->cb_user = cb ? cb_user : NULL;
+	async->size_exp = size_exp;
+	async->slots = malloc(sizeof(ChiakiLogAsyncSlot) << size_exp);
+	if(!async->slots)
+		return CHIAKI_ERR_MEMORY;
+	for(size_t i=0; i<((size_t)1) << size_exp; i++)
+		async->slots[i].seq = i;
+	async->write_pos = 0;
+	async->read_pos = 0;
+	async->dropped = 0;
+	async->dropped_reported = 0;
+	async->writer_idle = 0;
+	async->should_stop = false;
+
+	ChiakiErrorCode err = chiaki_mutex_init(&async->mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_slots;
+
+	err = chiaki_cond_init(&async->cond);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_mutex;
+
+	err = chiaki_thread_create(&async->thread, log_async_thread_func, async);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_cond;
+
+	chiaki_thread_set_name(&async->thread, "Chiaki Log");
+
+	return CHIAKI_ERR_SUCCESS;
+error_cond:
+	chiaki_cond_fini(&async->cond);
+error_mutex:
+	chiaki_mutex_fini(&async->mutex);
+error_slots:
+	free(async->slots);
+	return err;
+}
+
+CHIAKI_EXPORT void chiaki_log_async_fini(ChiakiLogAsync *async)
+{
+	chiaki_mutex_lock(&async->mutex);
+	async->should_stop = true;
+	chiaki_mutex_unlock(&async->mutex);
+	ChiakiErrorCode err = chiaki_cond_signal(&async->cond);
+	assert(err == CHIAKI_ERR_SUCCESS);
+	err = chiaki_thread_join(&async->thread, NULL);
+	assert(err == CHIAKI_ERR_SUCCESS);
+
+	chiaki_cond_fini(&async->cond);
+	chiaki_mutex_fini(&async->mutex);
+	free(async->slots);
+}
+
+/**
+ * Claim the next slot, or return NULL and count the record as dropped if the ring is full.
+ */
+static ChiakiLogAsyncSlot *log_async_claim(ChiakiLogAsync *async, uint64_t *pos_out)
+{
+	uint64_t mask = (((uint64_t)1) << async->size_exp) - 1;
+	uint64_t pos = chiaki_atomic_load_u64(&async->write_pos);
+	while(true)
+	{
+		ChiakiLogAsyncSlot *slot = &async->slots[pos & mask];
+		int64_t diff = (int64_t)(chiaki_atomic_load_u64(&slot->seq) - pos);
+		if(diff == 0)
+		{
+			if(chiaki_atomic_cas_u64(&async->write_pos, pos, pos + 1))
+			{
+				*pos_out = pos;
+				return slot;
+			}
+		}
+		else if(diff < 0)
+		{
+			// the writer has not released this slot from the previous round yet
+			chiaki_atomic_fetch_add_u64(&async->dropped, 1);
+			return NULL;
+		}
+		pos = chiaki_atomic_load_u64(&async->write_pos);
+	}
+}
+
+static void log_async_publish(ChiakiLogAsync *async, ChiakiLogAsyncSlot *slot, uint64_t pos)
+{
+	chiaki_atomic_store_u64(&slot->seq, pos + 1);
+	if(chiaki_atomic_load_u32(&async->writer_idle) && chiaki_atomic_cas_u32(&async->writer_idle, 1, 0))
+		chiaki_cond_signal(&async->cond);
+}
+
+static void log_async_slot_begin(ChiakiLogAsyncSlot *slot, ChiakiLogLevel level)
+{
+	slot->level = level;
+	slot->timestamp_us = chiaki_time_now_monotonic_us();
+	slot->thread_id = log_async_thread_id();
+}
+
+CHIAKI_EXPORT void chiaki_log_async_vlog(ChiakiLogAsync *async, ChiakiLogLevel level, const char *fmt, va_list args)
+{
+	uint64_t pos;
+	ChiakiLogAsyncSlot *slot = log_async_claim(async, &pos);
+	if(!slot)
+		return;
+	log_async_slot_begin(slot, level);
+	int written = vsnprintf(slot->msg, sizeof(slot->msg), fmt, args);
+	if(written < 0)
+		slot->msg[0] = '\0';
+	else if(written >= sizeof(slot->msg))
+		memcpy(slot->msg + sizeof(slot->msg) - 4, "...", 4);
+	log_async_publish(async, slot, pos);
+}
+
+CHIAKI_EXPORT void chiaki_log_async_cb(ChiakiLogLevel level, const char *msg, void *user)
+{
+	ChiakiLogAsync *async = user;
+	uint64_t pos;
+	ChiakiLogAsyncSlot *slot = log_async_claim(async, &pos);
+	if(!slot)
+		return;
+	log_async_slot_begin(slot, level);
+	size_t len = strlen(msg);
+	if(len >= sizeof(slot->msg))
+	{
+		len = sizeof(slot->msg) - 1;
+		memcpy(slot->msg, msg, len - 3);
+		memcpy(slot->msg + len - 3, "...", 3);
+	}
+	else
+		memcpy(slot->msg, msg, len);
+	slot->msg[len] = '\0';
+	log_async_publish(async, slot, pos);
+}
+
+static bool log_async_pending(ChiakiLogAsync *async)
+{
+	ChiakiLogAsyncSlot *slot = &async->slots[async->read_pos & ((((uint64_t)1) << async->size_exp) - 1)];
+	return chiaki_atomic_load_u64(&slot->seq) == async->read_pos + 1;
+}
+
+static void log_async_drain(ChiakiLogAsync *async)
+{
+	uint64_t size = ((uint64_t)1) << async->size_exp;
+	while(log_async_pending(async))
+	{
+		ChiakiLogAsyncSlot *slot = &async->slots[async->read_pos & (size - 1)];
+		ChiakiLogRecord record = {
+			.level = slot->level,
+			.timestamp_us = slot->timestamp_us,
+			.thread_id = slot->thread_id,
+			.msg = slot->msg
+		};
+		async->cb(&record, async->cb_user);
+		// release the slot for the producers of the next round
+		chiaki_atomic_store_u64(&slot->seq, async->read_pos + size);
+		async->read_pos++;
+	}
+
+	uint64_t dropped = chiaki_atomic_load_u64(&async->dropped);
+	if(dropped != async->dropped_reported)
+	{
+		char msg[0x80];
+		snprintf(msg, sizeof(msg), "Async log dropped %llu messages because the queue was full",
+				(unsigned long long)(dropped - async->dropped_reported));
+		ChiakiLogRecord record = {
+			.level = CHIAKI_LOG_WARNING,
+			.timestamp_us = chiaki_time_now_monotonic_us(),
+			.thread_id = log_async_thread_id(),
+			.msg = msg
+		};
+		async->cb(&record, async->cb_user);
+		async->dropped_reported = dropped;
+	}
+}
+
+static bool log_async_check_pred(void *user)
+{
+	ChiakiLogAsync *async = user;
+	return async->should_stop || log_async_pending(async);
+}
+
+static void *log_async_thread_func(void *user)
+{
+	ChiakiLogAsync *async = user;
+
+	while(true)
+	{
+		log_async_drain(async);
+
+		ChiakiErrorCode err = chiaki_mutex_lock(&async->mutex);
+		if(err != CHIAKI_ERR_SUCCESS)
+			break;
+		if(async->should_stop)
+		{
+			chiaki_mutex_unlock(&async->mutex);
+			break;
+		}
+		chiaki_atomic_store_u32(&async->writer_idle, 1);
+		err = chiaki_cond_timedwait_pred(&async->cond, &async->mutex, LOG_ASYNC_IDLE_TIMEOUT_MS, log_async_check_pred, async);
+		chiaki_atomic_store_u32(&async->writer_idle, 0);
+		chiaki_mutex_unlock(&async->mutex);
+		if(err != CHIAKI_ERR_SUCCESS && err != CHIAKI_ERR_TIMEOUT)
+			break;
+	}
+
+	// everything that was logged before fini
+	log_async_drain(async);
+	return NULL;
+}
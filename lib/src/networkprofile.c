@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/networkprofile.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "utils.h"
+
+/**
+ * Loss above this while validating means the cached MTU is likely too big for the route now.
+ */
+#define VALIDATE_PACKET_LOSS_MAX 0.1
+
+CHIAKI_EXPORT const char *chiaki_network_profile_freshness_string(ChiakiNetworkProfileFreshness freshness)
+{
+	switch(freshness)
+	{
+		case CHIAKI_NETWORK_PROFILE_EXPIRED:
+			return "expired";
+		case CHIAKI_NETWORK_PROFILE_STALE:
+			return "stale";
+		case CHIAKI_NETWORK_PROFILE_FRESH:
+			return "fresh";
+		case CHIAKI_NETWORK_PROFILE_MISSING:
+		default:
+			return "missing";
+	}
+}
+
+CHIAKI_EXPORT ChiakiNetworkProfileFreshness chiaki_network_profile_freshness(const ChiakiNetworkProfile *profile, uint64_t now)
+{
+	if(!profile || !profile->mtu_in || !profile->mtu_out)
+		return CHIAKI_NETWORK_PROFILE_MISSING;
+	// a clock that went backwards makes the age meaningless
+	if(profile->measured_at > now || profile->validated_at > now)
+		return CHIAKI_NETWORK_PROFILE_EXPIRED;
+	if(now - profile->measured_at > CHIAKI_NETWORK_PROFILE_MAX_AGE_SEC)
+		return CHIAKI_NETWORK_PROFILE_EXPIRED;
+	uint64_t confirmed_at = profile->validated_at > profile->measured_at ? profile->validated_at : profile->measured_at;
+	if(now - confirmed_at > CHIAKI_NETWORK_PROFILE_FRESH_SEC)
+		return CHIAKI_NETWORK_PROFILE_STALE;
+	return CHIAKI_NETWORK_PROFILE_FRESH;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_network_profile_format_key(char *buf, size_t buf_size,
+		const uint8_t *console_id, size_t console_id_size, const struct sockaddr *local_addr, const struct sockaddr *remote_addr)
+{
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for(size_t i=0; i<console_id_size; i++)
+	{
+		hash ^= console_id[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	char local_str[INET6_ADDRSTRLEN];
+	char remote_str[INET6_ADDRSTRLEN];
+	if(!sockaddr_str((struct sockaddr *)local_addr, local_str, sizeof(local_str))
+		|| !sockaddr_str((struct sockaddr *)remote_addr, remote_str, sizeof(remote_str)))
+		return CHIAKI_ERR_INVALID_DATA;
+
+	int r = snprintf(buf, buf_size, "%016llx/%s/%s", (unsigned long long)hash, local_str, remote_str);
+	if(r < 0 || (size_t)r >= buf_size)
+		return CHIAKI_ERR_BUF_TOO_SMALL;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_network_profile_cache_init(ChiakiNetworkProfileCache *cache, ChiakiLog *log)
+{
+	memset(cache, 0, sizeof(*cache));
+	cache->log = log;
+}
+
+CHIAKI_EXPORT ChiakiNetworkProfileFreshness chiaki_network_profile_cache_lookup(ChiakiNetworkProfileCache *cache, const char *key, ChiakiNetworkProfile *profile)
+{
+	cache->key_valid = false;
+	cache->validation = CHIAKI_NETWORK_PROFILE_VALIDATION_NONE;
+	if(!cache->load_cb || !cache->store_cb)
+		return CHIAKI_NETWORK_PROFILE_MISSING;
+
+	strncpy(cache->key, key, sizeof(cache->key) - 1);
+	cache->key[sizeof(cache->key) - 1] = '\0';
+	cache->key_valid = true;
+
+	ChiakiNetworkProfile loaded = { 0 };
+	if(!cache->load_cb(cache->key, &loaded, cache->cb_user))
+		return CHIAKI_NETWORK_PROFILE_MISSING;
+	cache->profile = loaded;
+	*profile = loaded;
+
+	ChiakiNetworkProfileFreshness freshness = chiaki_network_profile_freshness(&loaded, (uint64_t)time(NULL));
+	CHIAKI_LOGI(cache->log, "Network profile for %s is %s: MTU in %u, out %u, RTT %.3f ms",
+			cache->key, chiaki_network_profile_freshness_string(freshness),
+			(unsigned int)loaded.mtu_in, (unsigned int)loaded.mtu_out, (float)loaded.rtt_us * 0.001f);
+	return freshness;
+}
+
+CHIAKI_EXPORT void chiaki_network_profile_cache_measured(ChiakiNetworkProfileCache *cache, uint32_t mtu_in, uint32_t mtu_out, uint64_t rtt_us)
+{
+	if(!cache->key_valid)
+		return;
+	cache->profile.mtu_in = mtu_in;
+	cache->profile.mtu_out = mtu_out;
+	cache->profile.rtt_us = rtt_us;
+	cache->profile.measured_at = (uint64_t)time(NULL);
+	cache->profile.validated_at = 0;
+	cache->validation = CHIAKI_NETWORK_PROFILE_VALIDATION_NONE;
+	cache->store_cb(cache->key, &cache->profile, cache->cb_user);
+}
+
+CHIAKI_EXPORT void chiaki_network_profile_cache_skipped(ChiakiNetworkProfileCache *cache)
+{
+	if(!cache->key_valid)
+		return;
+	cache->validation = CHIAKI_NETWORK_PROFILE_VALIDATION_PENDING;
+}
+
+CHIAKI_EXPORT void chiaki_network_profile_cache_stream_started(ChiakiNetworkProfileCache *cache, uint64_t now_ms)
+{
+	if(cache->validation != CHIAKI_NETWORK_PROFILE_VALIDATION_PENDING)
+		return;
+	cache->validation = CHIAKI_NETWORK_PROFILE_VALIDATION_RUNNING;
+	cache->validation_start_ms = now_ms;
+}
+
+static void cache_invalidate(ChiakiNetworkProfileCache *cache)
+{
+	cache->validation = CHIAKI_NETWORK_PROFILE_VALIDATION_NONE;
+	cache->store_cb(cache->key, NULL, cache->cb_user);
+}
+
+CHIAKI_EXPORT void chiaki_network_profile_cache_stream_check(ChiakiNetworkProfileCache *cache, ChiakiPacketStats *stats, uint64_t now_ms)
+{
+	if(cache->validation != CHIAKI_NETWORK_PROFILE_VALIDATION_RUNNING
+		|| now_ms - cache->validation_start_ms < CHIAKI_NETWORK_PROFILE_VALIDATE_MS)
+		return;
+
+	uint64_t received, lost;
+	chiaki_packet_stats_get_window(stats, CHIAKI_PACKET_STATS_WINDOW_10S, now_ms, &received, &lost);
+	double loss = received + lost ? (double)lost / (double)(received + lost) : 1.0;
+	if(!received || loss > VALIDATE_PACKET_LOSS_MAX)
+	{
+		CHIAKI_LOGW(cache->log, "Network profile for %s failed validation with %.1f%% packet loss, removing it",
+				cache->key, loss * 100.0);
+		cache_invalidate(cache);
+		return;
+	}
+
+	CHIAKI_LOGI(cache->log, "Network profile for %s validated", cache->key);
+	cache->validation = CHIAKI_NETWORK_PROFILE_VALIDATION_NONE;
+	cache->profile.validated_at = (uint64_t)time(NULL);
+	cache->store_cb(cache->key, &cache->profile, cache->cb_user);
+}
+
+CHIAKI_EXPORT void chiaki_network_profile_cache_stream_stopped(ChiakiNetworkProfileCache *cache, bool failed)
+{
+	if(cache->validation == CHIAKI_NETWORK_PROFILE_VALIDATION_NONE)
+		return;
+	if(!failed)
+	{
+		// stopped by the user, this says nothing about the profile
+		cache->validation = CHIAKI_NETWORK_PROFILE_VALIDATION_NONE;
+		return;
+	}
+	CHIAKI_LOGW(cache->log, "Stream ended before the network profile for %s was validated, removing it", cache->key);
+	cache_invalidate(cache);
+}
@@ -4,13 +4,19 @@
 #if CHIAKI_LIB_ENABLE_OPUS
 
 #include <chiaki/opusdecoder.h>
+#include <chiaki/time.h>
 
 #include <opus/opus.h>
 
 #include <string.h>
 
+// frames are stretched or compressed by at most 1/STRETCH_MAX_DIV, i.e. 2%
+#define STRETCH_MAX_DIV 50
+#define STRETCH_DEADBAND_FRAMES 1
+
 static void chiaki_opus_decoder_header(ChiakiAudioHeader *header, void *user);
-static void chiaki_opus_decoder_frame(uint8_t *buf, size_t buf_size, void *user);
+static void chiaki_opus_decoder_frame(uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index, void *user);
+static void *chiaki_opus_decoder_thread_func(void *user);
 
 CHIAKI_EXPORT void chiaki_opus_decoder_init(ChiakiOpusDecoder *decoder, ChiakiLog *log)
 {
@@ -24,10 +30,49 @@ CHIAKI_EXPORT void chiaki_opus_decoder_init(ChiakiOpusDecoder *decoder, ChiakiLo
 	decoder->cb_user = NULL;
 	decoder->settings_cb = NULL;
 	decoder->frame_cb = NULL;
+
+	decoder->frame_index_valid = false;
+	decoder->frame_index_prev = 0;
+
+	decoder->threaded = false;
+	decoder->jitter_min_delay_ms = CHIAKI_OPUS_DECODER_JITTER_MIN_DELAY_MS_DEFAULT;
+	decoder->jitter_max_delay_ms = CHIAKI_OPUS_DECODER_JITTER_MAX_DELAY_MS_DEFAULT;
+	decoder->queued_cb = NULL;
+	decoder->output_target_samples = 0;
+	decoder->jitter_buffer_initialized = false;
+	decoder->stretch_buf = NULL;
+	decoder->thread_running = false;
+
+	decoder->frames_decoded = 0;
+	decoder->frames_concealed = 0;
+	decoder->frames_recovered = 0;
+	decoder->frames_stretched = 0;
+	decoder->frames_compressed = 0;
+}
+
+static void stop_thread(ChiakiOpusDecoder *decoder)
+{
+	if(!decoder->thread_running)
+		return;
+	chiaki_bool_pred_cond_signal(&decoder->stop_cond);
+	chiaki_thread_join(&decoder->thread, NULL);
+	chiaki_bool_pred_cond_fini(&decoder->stop_cond);
+	decoder->thread_running = false;
 }
 
 CHIAKI_EXPORT void chiaki_opus_decoder_fini(ChiakiOpusDecoder *decoder)
 {
+	stop_thread(decoder);
+	if(decoder->opus_decoder)
+	{
+		CHIAKI_LOGI(decoder->log, "ChiakiOpusDecoder decoded %llu frames, concealed %llu, recovered %llu by FEC",
+				(unsigned long long)chiaki_atomic_load_u64(&decoder->frames_decoded),
+				(unsigned long long)chiaki_atomic_load_u64(&decoder->frames_concealed),
+				(unsigned long long)chiaki_atomic_load_u64(&decoder->frames_recovered));
+	}
+	if(decoder->jitter_buffer_initialized)
+		chiaki_audio_jitter_buffer_fini(&decoder->jitter_buffer);
+	free(decoder->stretch_buf);
 	free(decoder->pcm_buf);
 	if(decoder->opus_decoder)
 		opus_decoder_destroy(decoder->opus_decoder);
@@ -40,10 +85,76 @@ CHIAKI_EXPORT void chiaki_opus_decoder_get_sink(ChiakiOpusDecoder *decoder, Chia
 	sink->frame_cb = chiaki_opus_decoder_frame;
 }
 
+CHIAKI_EXPORT void chiaki_opus_decoder_set_threaded(ChiakiOpusDecoder *decoder, uint32_t jitter_min_delay_ms, uint32_t jitter_max_delay_ms,
+		ChiakiOpusDecoderQueuedCallback queued_cb, size_t output_target_samples)
+{
+	decoder->threaded = true;
+	decoder->jitter_min_delay_ms = jitter_min_delay_ms;
+	decoder->jitter_max_delay_ms = jitter_max_delay_ms;
+	decoder->queued_cb = queued_cb;
+	decoder->output_target_samples = output_target_samples;
+}
+
+CHIAKI_EXPORT void chiaki_opus_decoder_get_stats(ChiakiOpusDecoder *decoder, ChiakiOpusDecoderStats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	stats->frames_decoded = chiaki_atomic_load_u64(&decoder->frames_decoded);
+	stats->frames_concealed = chiaki_atomic_load_u64(&decoder->frames_concealed);
+	stats->frames_recovered = chiaki_atomic_load_u64(&decoder->frames_recovered);
+	stats->frames_stretched = chiaki_atomic_load_u64(&decoder->frames_stretched);
+	stats->frames_compressed = chiaki_atomic_load_u64(&decoder->frames_compressed);
+	if(decoder->jitter_buffer_initialized)
+		chiaki_audio_jitter_buffer_get_stats(&decoder->jitter_buffer, &stats->jitter_buffer);
+}
+
+static bool threaded_setup(ChiakiOpusDecoder *decoder, ChiakiAudioHeader *header)
+{
+	if(decoder->jitter_buffer_initialized)
+	{
+		chiaki_audio_jitter_buffer_fini(&decoder->jitter_buffer);
+		decoder->jitter_buffer_initialized = false;
+	}
+
+	if(!header->rate || !header->frame_size)
+	{
+		CHIAKI_LOGE(decoder->log, "ChiakiOpusDecoder got invalid audio header for threaded decoding");
+		return false;
+	}
+
+	uint32_t frame_duration_us = (uint32_t)((uint64_t)header->frame_size * 1000000 / header->rate);
+	uint64_t max_frames = ((uint64_t)decoder->jitter_max_delay_ms * 1000) / frame_duration_us + 1;
+	size_t size_exp = 6;
+	while(size_exp < 15 && ((uint64_t)1 << size_exp) <= 2 * max_frames)
+		size_exp++;
+
+	ChiakiErrorCode err = chiaki_audio_jitter_buffer_init(&decoder->jitter_buffer, size_exp, frame_duration_us,
+			decoder->jitter_min_delay_ms, decoder->jitter_max_delay_ms);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(decoder->log, "ChiakiOpusDecoder failed to initialize jitter buffer: %s", chiaki_error_string(err));
+		return false;
+	}
+	decoder->jitter_buffer_initialized = true;
+	chiaki_audio_jitter_buffer_set_conceal_frames_max(&decoder->jitter_buffer, CHIAKI_OPUS_DECODER_CONCEAL_FRAMES_MAX);
+
+	size_t stretch_samples_max = header->frame_size + header->frame_size / STRETCH_MAX_DIV + 1;
+	int16_t *stretch_buf = realloc(decoder->stretch_buf, stretch_samples_max * header->channels * sizeof(int16_t));
+	if(!stretch_buf)
+	{
+		CHIAKI_LOGE(decoder->log, "ChiakiOpusDecoder failed to alloc stretch buffer");
+		return false;
+	}
+	decoder->stretch_buf = stretch_buf;
+	return true;
+}
+
 static void chiaki_opus_decoder_header(ChiakiAudioHeader *header, void *user)
 {
 	ChiakiOpusDecoder *decoder = user;
+	stop_thread(decoder);
+
 	memcpy(&decoder->audio_header, header, sizeof(decoder->audio_header));
+	decoder->frame_index_valid = false;
 
 	opus_decoder_destroy(decoder->opus_decoder);
 
@@ -76,11 +187,116 @@ static void chiaki_opus_decoder_header(ChiakiAudioHeader *header, void *user)
 
 	decoder->pcm_buf_size = pcm_buf_size_required;
 
+	if(decoder->threaded && !threaded_setup(decoder, header))
+	{
+		opus_decoder_destroy(decoder->opus_decoder);
+		decoder->opus_decoder = NULL;
+		return;
+	}
+
 	if(decoder->settings_cb)
 		decoder->settings_cb(header->channels, header->rate, decoder->cb_user);
+
+	if(!decoder->threaded)
+		return;
+
+	ChiakiErrorCode err = chiaki_bool_pred_cond_init(&decoder->stop_cond);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(decoder->log, "ChiakiOpusDecoder failed to init stop cond");
+		return;
+	}
+
+	err = chiaki_thread_create(&decoder->thread, chiaki_opus_decoder_thread_func, decoder);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(decoder->log, "ChiakiOpusDecoder failed to create decoder thread");
+		chiaki_bool_pred_cond_fini(&decoder->stop_cond);
+		return;
+	}
+	chiaki_thread_set_name(&decoder->thread, "Chiaki Audio");
+	decoder->thread_running = true;
+}
+
+/**
+ * Decode into pcm_buf.
+ * @param buf NULL for packet loss concealment
+ * @param fec decode the in-band FEC data of buf, which belongs to the frame before it
+ * @return number of decoded samples or 0 on error
+ */
+static size_t decode(ChiakiOpusDecoder *decoder, const uint8_t *buf, size_t buf_size, bool fec)
+{
+	int r = opus_decode(decoder->opus_decoder, buf, buf ? (opus_int32)buf_size : 0,
+			decoder->pcm_buf, decoder->audio_header.frame_size, fec ? 1 : 0);
+	if(r < 1)
+	{
+		CHIAKI_LOGE(decoder->log, "Decoding audio frame with opus failed: %s", opus_strerror(r));
+		return 0;
+	}
+	return (size_t)r;
 }
 
-static void chiaki_opus_decoder_frame(uint8_t *buf, size_t buf_size, void *user)
+/**
+ * Whether buf carries in-band FEC (LBRR) data for the frame before it
+ */
+static bool packet_has_lbrr(const uint8_t *buf, size_t buf_size)
+{
+#ifdef CHIAKI_HAVE_OPUS_PACKET_HAS_LBRR
+	return opus_packet_has_lbrr(buf, (opus_int32)buf_size) == 1;
+#else
+	// same as opus_packet_has_lbrr() from libopus 1.5: the LBRR flags follow the VAD flags at the start of the SILK frame
+	if(!buf_size || buf[0] & 0x80) // CELT only
+		return false;
+	const uint8_t *frames[48];
+	opus_int16 sizes[48];
+	if(opus_packet_parse(buf, (opus_int32)buf_size, NULL, frames, sizes, NULL) <= 0 || !sizes[0])
+		return false;
+	int samples = opus_packet_get_samples_per_frame(buf, 48000);
+	int silk_frames = samples > 960 ? samples / 960 : 1;
+	if((frames[0][0] >> (7 - silk_frames)) & 1)
+		return true;
+	return opus_packet_get_nb_channels(buf) == 2 && ((frames[0][0] >> (6 - 2 * silk_frames)) & 1);
+#endif
+}
+
+/**
+ * Synthesize a missing frame into pcm_buf.
+ * If the frame after it is already known and carries FEC data, that is used, otherwise opus conceals the loss.
+ */
+static size_t conceal(ChiakiOpusDecoder *decoder, const uint8_t *next_buf, size_t next_buf_size)
+{
+	// decoding fec from a frame without any would conceal as well, but must not count as recovered
+	bool fec = next_buf && packet_has_lbrr(next_buf, next_buf_size);
+	size_t samples = decode(decoder, fec ? next_buf : NULL, next_buf_size, fec);
+	if(samples)
+		chiaki_atomic_fetch_add_u64(fec ? &decoder->frames_recovered : &decoder->frames_concealed, 1);
+	return samples;
+}
+
+static void conceal_gap(ChiakiOpusDecoder *decoder, ChiakiSeqNum16 frame_index, uint8_t *buf, size_t buf_size)
+{
+	bool valid = decoder->frame_index_valid;
+	ChiakiSeqNum16 prev = decoder->frame_index_prev;
+	decoder->frame_index_valid = true;
+	decoder->frame_index_prev = frame_index;
+	if(!valid || !chiaki_seq_num_16_gt(frame_index, prev))
+		return;
+
+	ChiakiSeqNum16 gap = frame_index - prev - 1;
+	if(!gap || gap > CHIAKI_OPUS_DECODER_CONCEAL_FRAMES_MAX)
+		return;
+
+	for(ChiakiSeqNum16 i = 0; i < gap; i++)
+	{
+		// only the last missing frame can be recovered from the current one
+		bool last = i == gap - 1;
+		size_t samples = conceal(decoder, last ? buf : NULL, buf_size);
+		if(samples && decoder->frame_cb)
+			decoder->frame_cb(decoder->pcm_buf, samples, decoder->cb_user);
+	}
+}
+
+static void chiaki_opus_decoder_frame(uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index, void *user)
 {
 	ChiakiOpusDecoder *decoder = user;
 	if(!decoder->opus_decoder)
@@ -89,11 +305,155 @@ static void chiaki_opus_decoder_frame(uint8_t *buf, size_t buf_size, void *user)
 		return;
 	}
 
-	int r = opus_decode(decoder->opus_decoder, buf, (opus_int32)buf_size, decoder->pcm_buf, decoder->audio_header.frame_size, 0);
-	if(r < 1)
-		CHIAKI_LOGE(decoder->log, "Decoding audio frame with opus failed: %s", opus_strerror(r));
-	else if(decoder->frame_cb)
-		decoder->frame_cb(decoder->pcm_buf, (size_t)r, decoder->cb_user);
+	if(decoder->threaded)
+	{
+		if(!decoder->thread_running)
+			return;
+		ChiakiErrorCode err = chiaki_audio_jitter_buffer_push(&decoder->jitter_buffer, frame_index, buf, buf_size, chiaki_time_now_monotonic_us());
+		if(err == CHIAKI_ERR_BUF_TOO_SMALL)
+			CHIAKI_LOGE(decoder->log, "Audio frame of size %#llx does not fit into the jitter buffer", (unsigned long long)buf_size);
+		else if(err != CHIAKI_ERR_SUCCESS)
+			CHIAKI_LOGV(decoder->log, "Audio jitter buffer full, dropping frame %u", (unsigned int)frame_index);
+		return;
+	}
+
+	conceal_gap(decoder, frame_index, buf, buf_size);
+
+	size_t samples = decode(decoder, buf, buf_size, false);
+	if(!samples)
+		return;
+	chiaki_atomic_fetch_add_u64(&decoder->frames_decoded, 1);
+	if(decoder->frame_cb)
+		decoder->frame_cb(decoder->pcm_buf, samples, decoder->cb_user);
+}
+
+/**
+ * Resample a frame to out_samples by linear interpolation, keeping the first and last sample in place
+ * so consecutive frames stay continuous.
+ */
+static void stretch_frame(const int16_t *in, size_t in_samples, int16_t *out, size_t out_samples, unsigned int channels)
+{
+	if(in_samples < 2 || out_samples < 2)
+	{
+		memcpy(out, in, (in_samples < out_samples ? in_samples : out_samples) * channels * sizeof(int16_t));
+		return;
+	}
+	uint64_t step = ((uint64_t)(in_samples - 1) << 16) / (out_samples - 1);
+	for(size_t j = 0; j < out_samples; j++)
+	{
+		uint64_t pos = j * step;
+		size_t i = (size_t)(pos >> 16);
+		if(i >= in_samples)
+			i = in_samples - 1;
+		size_t i_next = i + 1 < in_samples ? i + 1 : i;
+		int64_t frac = (int64_t)(pos & 0xffff);
+		for(unsigned int c = 0; c < channels; c++)
+		{
+			int64_t a = in[i * channels + c];
+			int64_t b = in[i_next * channels + c];
+			out[j * channels + c] = (int16_t)(a + (((b - a) * frac) >> 16));
+		}
+	}
+}
+
+/**
+ * @return number of samples to add to (positive) or remove from (negative) the next frame
+ */
+static int32_t stretch_delta(ChiakiOpusDecoder *decoder, size_t samples)
+{
+	// +1 for the frame that is currently being played out
+	int32_t excess = (int32_t)chiaki_audio_jitter_buffer_depth(&decoder->jitter_buffer) + 1
+		- (int32_t)chiaki_audio_jitter_buffer_target_frames(&decoder->jitter_buffer);
+	if(excess >= -STRETCH_DEADBAND_FRAMES && excess <= STRETCH_DEADBAND_FRAMES)
+		return 0;
+	int32_t max_delta = (int32_t)(samples / STRETCH_MAX_DIV);
+	return excess > 0 ? -max_delta : max_delta;
+}
+
+static size_t play_out(ChiakiOpusDecoder *decoder)
+{
+	uint8_t buf[CHIAKI_AUDIO_JITTER_BUFFER_FRAME_SIZE_MAX];
+	size_t buf_size = 0;
+	ChiakiSeqNum16 frame_index;
+	// gaps longer than CHIAKI_OPUS_DECODER_CONCEAL_FRAMES_MAX are skipped by the jitter buffer, like in conceal_gap()
+	ChiakiAudioJitterBufferPopResult result = chiaki_audio_jitter_buffer_pop(&decoder->jitter_buffer, buf, &buf_size, &frame_index);
+	if(result == CHIAKI_AUDIO_JITTER_BUFFER_POP_EMPTY)
+		return 0;
+
+	size_t samples;
+	if(result == CHIAKI_AUDIO_JITTER_BUFFER_POP_MISSING)
+	{
+		bool has_next = chiaki_audio_jitter_buffer_peek(&decoder->jitter_buffer, buf, &buf_size);
+		samples = conceal(decoder, has_next ? buf : NULL, buf_size);
+	}
+	else
+	{
+		samples = decode(decoder, buf, buf_size, false);
+		if(samples)
+			chiaki_atomic_fetch_add_u64(&decoder->frames_decoded, 1);
+	}
+	if(!samples)
+		return 0;
+
+	int16_t *out = decoder->pcm_buf;
+	size_t out_samples = samples;
+	int32_t delta = stretch_delta(decoder, samples);
+	if(delta)
+	{
+		out_samples = (size_t)((int32_t)samples + delta);
+		stretch_frame(decoder->pcm_buf, samples, decoder->stretch_buf, out_samples, decoder->audio_header.channels);
+		out = decoder->stretch_buf;
+		chiaki_atomic_fetch_add_u64(delta > 0 ? &decoder->frames_stretched : &decoder->frames_compressed, 1);
+	}
+
+	if(decoder->frame_cb)
+		decoder->frame_cb(out, out_samples, decoder->cb_user);
+	return out_samples;
+}
+
+static void *chiaki_opus_decoder_thread_func(void *user)
+{
+	ChiakiOpusDecoder *decoder = user;
+	chiaki_thread_apply_role(CHIAKI_THREAD_ROLE_AUDIO);
+	uint64_t frame_duration_us = decoder->jitter_buffer.frame_duration_us;
+	uint64_t poll_ms = frame_duration_us / 2000;
+	if(!poll_ms)
+		poll_ms = 1;
+	uint64_t next_us = 0;
+
+	ChiakiErrorCode err = chiaki_bool_pred_cond_lock(&decoder->stop_cond);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return NULL;
+
+	while(!decoder->stop_cond.pred)
+	{
+		bool due;
+		if(decoder->queued_cb)
+			due = decoder->queued_cb(decoder->cb_user) < decoder->output_target_samples;
+		else
+			due = chiaki_time_now_monotonic_us() >= next_us;
+
+		size_t samples = due ? play_out(decoder) : 0;
+		if(!samples)
+		{
+			err = chiaki_bool_pred_cond_timedwait(&decoder->stop_cond, poll_ms);
+			if(err != CHIAKI_ERR_SUCCESS && err != CHIAKI_ERR_TIMEOUT)
+				break;
+			continue;
+		}
+
+		if(!decoder->queued_cb)
+		{
+			// the playout clock advances by the duration of the audio that was actually produced
+			uint64_t now = chiaki_time_now_monotonic_us();
+			if(!next_us || now > next_us + 4 * frame_duration_us)
+				next_us = now;
+			next_us += (uint64_t)samples * 1000000 / decoder->audio_header.rate;
+		}
+	}
+
+	chiaki_bool_pred_cond_unlock(&decoder->stop_cond);
+	return NULL;
 }
 
-#endif
\ No newline at end of file
+#endif
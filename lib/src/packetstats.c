@@ -1,83 +1,201 @@
 // SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
 
 #include <chiaki/packetstats.h>
-#include <chiaki/log.h>
-#include <assert.h>
+#include <chiaki/time.h>
+
+#include <string.h>
+
+#define SLOT_INVALID UINT64_MAX
+
+static void counters_init(ChiakiPacketStatsCounters *counters)
+{
+	memset(counters, 0, sizeof(*counters));
+	for(size_t i=0; i<CHIAKI_PACKET_STATS_BUCKETS_COUNT; i++)
+		counters->buckets[i].slot = SLOT_INVALID;
+}
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_packet_stats_init(ChiakiPacketStats *stats)
 {
-	ChiakiErrorCode err = chiaki_mutex_init(&stats->mutex, false);
-	if(err != CHIAKI_ERR_SUCCESS)
-		return err;
-	err = chiaki_mutex_lock(&stats->mutex);
-	assert(err == CHIAKI_ERR_SUCCESS);
-	stats->gen_received = 0;
-	stats->gen_lost = 0;
-	stats->seq_min = 0;
+	counters_init(&stats->gen);
+	counters_init(&stats->seq);
+	stats->seq_started = false;
 	stats->seq_max = 0;
-	stats->seq_received = 0;
-	err = chiaki_mutex_unlock(&stats->mutex);
-	return err;
+	stats->reset_received = 0;
+	stats->reset_lost = 0;
+	return CHIAKI_ERR_SUCCESS;
 }
 
 CHIAKI_EXPORT void chiaki_packet_stats_fini(ChiakiPacketStats *stats)
 {
-	chiaki_mutex_fini(&stats->mutex);
 }
 
-static void reset_stats(ChiakiPacketStats *stats)
+// Every ChiakiPacketStatsCounters has a single writer, so a plain load and store is enough
+// and avoids the locked read-modify-write.
+static inline void counter_add(chiaki_atomic_uint64_t *counter, uint64_t v)
+{
+	chiaki_atomic_store_u64(counter, chiaki_atomic_load_u64(counter) + v);
+}
+
+static inline void counter_sub(chiaki_atomic_uint64_t *counter, uint64_t v)
+{
+	uint64_t cur = chiaki_atomic_load_u64(counter);
+	chiaki_atomic_store_u64(counter, cur > v ? cur - v : 0);
+}
+
+static ChiakiPacketStatsBucket *counters_bucket(ChiakiPacketStatsCounters *counters, uint64_t now_ms)
+{
+	uint64_t slot = now_ms / CHIAKI_PACKET_STATS_BUCKET_MS;
+	ChiakiPacketStatsBucket *bucket = &counters->buckets[slot % CHIAKI_PACKET_STATS_BUCKETS_COUNT];
+	if(chiaki_atomic_load_u64(&bucket->slot) != slot)
+	{
+		// invalidate first so readers never attribute the old counts to the new slot
+		chiaki_atomic_store_u64(&bucket->slot, SLOT_INVALID);
+		chiaki_atomic_store_u64(&bucket->received, 0);
+		chiaki_atomic_store_u64(&bucket->lost, 0);
+		chiaki_atomic_store_u64(&bucket->slot, slot);
+	}
+	return bucket;
+}
+
+static void counters_push_burst(ChiakiPacketStatsCounters *counters, uint64_t length)
 {
-	stats->gen_received = 0;
-	stats->gen_lost = 0;
-	stats->seq_min = stats->seq_max;
-	stats->seq_received = 0;
+	size_t i = 0;
+	while(i < CHIAKI_PACKET_STATS_BURST_BUCKETS_COUNT - 1 && (length >> (i + 1)))
+		i++;
+	counter_add(&counters->bursts[i], 1);
 }
 
 CHIAKI_EXPORT void chiaki_packet_stats_reset(ChiakiPacketStats *stats)
 {
-	chiaki_mutex_lock(&stats->mutex);
-	reset_stats(stats);
-	chiaki_mutex_unlock(&stats->mutex);
+	ChiakiPacketStatsCursor cursor = { stats->reset_received, stats->reset_lost };
+	uint64_t received, lost;
+	chiaki_packet_stats_get_since(stats, &cursor, &received, &lost);
+	stats->reset_received = cursor.received;
+	stats->reset_lost = cursor.lost;
 }
 
 CHIAKI_EXPORT void chiaki_packet_stats_push_generation(ChiakiPacketStats *stats, uint64_t received, uint64_t lost)
 {
-	chiaki_mutex_lock(&stats->mutex);
-	stats->gen_received += received;
-	stats->gen_lost += lost;
-	chiaki_mutex_unlock(&stats->mutex);
+	chiaki_packet_stats_push_generation_at(stats, received, lost, chiaki_time_now_monotonic_ms());
+}
+
+CHIAKI_EXPORT void chiaki_packet_stats_push_generation_at(ChiakiPacketStats *stats, uint64_t received, uint64_t lost, uint64_t now_ms)
+{
+	ChiakiPacketStatsCounters *counters = &stats->gen;
+	ChiakiPacketStatsBucket *bucket = counters_bucket(counters, now_ms);
+	counter_add(&counters->received, received);
+	counter_add(&bucket->received, received);
+	if(!lost)
+		return;
+	counter_add(&counters->lost, lost);
+	counter_add(&bucket->lost, lost);
+	// the position of the lost packets inside the generation is unknown, so count them as one burst
+	counters_push_burst(counters, lost);
 }
 
 CHIAKI_EXPORT void chiaki_packet_stats_push_seq(ChiakiPacketStats *stats, ChiakiSeqNum16 seq_num)
 {
-	stats->seq_received++;
+	chiaki_packet_stats_push_seq_at(stats, seq_num, chiaki_time_now_monotonic_ms());
+}
+
+CHIAKI_EXPORT void chiaki_packet_stats_push_seq_at(ChiakiPacketStats *stats, ChiakiSeqNum16 seq_num, uint64_t now_ms)
+{
+	ChiakiPacketStatsCounters *counters = &stats->seq;
+	ChiakiPacketStatsBucket *bucket = counters_bucket(counters, now_ms);
+	counter_add(&counters->received, 1);
+	counter_add(&bucket->received, 1);
+
+	if(!stats->seq_started)
+	{
+		stats->seq_started = true;
+		stats->seq_max = seq_num;
+		return;
+	}
+
 	if(chiaki_seq_num_16_gt(seq_num, stats->seq_max))
+	{
+		uint64_t gap = (ChiakiSeqNum16)(seq_num - stats->seq_max) - 1;
 		stats->seq_max = seq_num;
+		if(!gap)
+			return;
+		counter_add(&counters->lost, gap);
+		counter_add(&bucket->lost, gap);
+		counters_push_burst(counters, gap);
+		return;
+	}
+
+	// late, it was counted as lost before
+	counter_sub(&counters->lost, 1);
+	counter_sub(&bucket->lost, 1);
+}
+
+static void counters_total(ChiakiPacketStatsCounters *counters, uint64_t *received, uint64_t *lost)
+{
+	*received += chiaki_atomic_load_u64(&counters->received);
+	*lost += chiaki_atomic_load_u64(&counters->lost);
 }
 
 CHIAKI_EXPORT void chiaki_packet_stats_get(ChiakiPacketStats *stats, bool reset, uint64_t *received, uint64_t *lost)
 {
-	chiaki_mutex_lock(&stats->mutex);
+	ChiakiPacketStatsCursor cursor = { stats->reset_received, stats->reset_lost };
+	chiaki_packet_stats_get_since(stats, &cursor, received, lost);
+	if(!reset)
+		return;
+	stats->reset_received = cursor.received;
+	stats->reset_lost = cursor.lost;
+}
 
-	// gen
-	*received = stats->gen_received;
-	*lost = stats->gen_lost;
+CHIAKI_EXPORT void chiaki_packet_stats_get_since(ChiakiPacketStats *stats, ChiakiPacketStatsCursor *cursor, uint64_t *received, uint64_t *lost)
+{
+	uint64_t received_total = 0;
+	uint64_t lost_total = 0;
+	counters_total(&stats->gen, &received_total, &lost_total);
+	counters_total(&stats->seq, &received_total, &lost_total);
 
-	//CHIAKI_LOGD(NULL, "gen received: %llu, lost: %llu",
-	//		(unsigned long long)stats->gen_received,
-	//		(unsigned long long)stats->gen_lost);
+	*received = received_total > cursor->received ? received_total - cursor->received : 0;
+	// late seq packets can decrease the lost total
+	*lost = lost_total > cursor->lost ? lost_total - cursor->lost : 0;
+	cursor->received = received_total;
+	cursor->lost = lost_total;
+}
 
-	// seq
-	uint64_t seq_diff = stats->seq_max - stats->seq_min; // overflow on purpose if max < min
-	uint64_t seq_lost = stats->seq_received > seq_diff ? seq_diff : seq_diff - stats->seq_received;
-	*received += stats->seq_received;
-	*lost += seq_lost;
+static void counters_window(ChiakiPacketStatsCounters *counters, uint64_t slot_now, uint64_t slots, uint64_t *received, uint64_t *lost)
+{
+	for(size_t i=0; i<CHIAKI_PACKET_STATS_BUCKETS_COUNT; i++)
+	{
+		ChiakiPacketStatsBucket *bucket = &counters->buckets[i];
+		uint64_t slot = chiaki_atomic_load_u64(&bucket->slot);
+		if(slot == SLOT_INVALID || slot > slot_now || slot_now - slot >= slots)
+			continue;
+		uint64_t r = chiaki_atomic_load_u64(&bucket->received);
+		uint64_t l = chiaki_atomic_load_u64(&bucket->lost);
+		// skip a bucket that was recycled while reading it
+		if(chiaki_atomic_load_u64(&bucket->slot) != slot)
+			continue;
+		*received += r;
+		*lost += l;
+	}
+}
 
-	//CHIAKI_LOGD(NULL, "seq received: %llu, lost: %llu",
-	//		(unsigned long long)stats->seq_received,
-	//		(unsigned long long)seq_lost);
+CHIAKI_EXPORT void chiaki_packet_stats_get_window(ChiakiPacketStats *stats, ChiakiPacketStatsWindow window, uint64_t now_ms, uint64_t *received, uint64_t *lost)
+{
+	*received = 0;
+	*lost = 0;
+	if(window == CHIAKI_PACKET_STATS_WINDOW_SESSION)
+	{
+		counters_total(&stats->gen, received, lost);
+		counters_total(&stats->seq, received, lost);
+		return;
+	}
+
+	uint64_t slots = (window == CHIAKI_PACKET_STATS_WINDOW_1S ? 1000 : 10000) / CHIAKI_PACKET_STATS_BUCKET_MS;
+	uint64_t slot_now = now_ms / CHIAKI_PACKET_STATS_BUCKET_MS;
+	counters_window(&stats->gen, slot_now, slots, received, lost);
+	counters_window(&stats->seq, slot_now, slots, received, lost);
+}
 
-	if(reset)
-		reset_stats(stats);
-	chiaki_mutex_unlock(&stats->mutex);
+CHIAKI_EXPORT void chiaki_packet_stats_get_burst_histogram(ChiakiPacketStats *stats, uint64_t histogram[CHIAKI_PACKET_STATS_BURST_BUCKETS_COUNT])
+{
+	for(size_t i=0; i<CHIAKI_PACKET_STATS_BURST_BUCKETS_COUNT; i++)
+		histogram[i] = chiaki_atomic_load_u64(&stats->gen.bursts[i]) + chiaki_atomic_load_u64(&stats->seq.bursts[i]);
 }
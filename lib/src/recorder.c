@@ -0,0 +1,649 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/recorder.h>
+#include <chiaki/time.h>
+
+#include <libavformat/avformat.h>
+#include <libavutil/channel_layout.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define OPUS_HEAD_SIZE 19
+
+typedef enum chiaki_recorder_packet_type_t
+{
+	CHIAKI_RECORDER_PACKET_VIDEO_HEADER,
+	CHIAKI_RECORDER_PACKET_VIDEO_FRAME,
+	CHIAKI_RECORDER_PACKET_AUDIO_HEADER,
+	CHIAKI_RECORDER_PACKET_AUDIO_FRAME
+} ChiakiRecorderPacketType;
+
+struct chiaki_recorder_packet_t
+{
+	struct chiaki_recorder_packet_t *next;
+	ChiakiRecorderPacketType type;
+	bool keyframe;
+	ChiakiSeqNum16 index;
+	uint64_t arrival_us;
+	unsigned int width;
+	unsigned int height;
+	ChiakiAudioHeader audio_header;
+	size_t size;
+	uint8_t data[];
+};
+
+static void *recorder_thread_func(void *user);
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_recorder_init(ChiakiRecorder *recorder, ChiakiLog *log, const char *path,
+		ChiakiCodec codec, unsigned int fps, size_t queue_bytes_max)
+{
+	memset(recorder, 0, sizeof(*recorder));
+	recorder->log = log;
+	recorder->codec = codec;
+	recorder->fps = fps ? fps : 60;
+	recorder->queue_bytes_max = queue_bytes_max ? queue_bytes_max : CHIAKI_RECORDER_QUEUE_BYTES_DEFAULT;
+	recorder->path = strdup(path);
+	if(!recorder->path)
+		return CHIAKI_ERR_MEMORY;
+
+	ChiakiErrorCode err = CHIAKI_ERR_MEMORY;
+	recorder->av_packet = av_packet_alloc();
+	if(!recorder->av_packet)
+		goto error_path;
+
+	err = chiaki_mutex_init(&recorder->mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_packet;
+
+	err = chiaki_cond_init(&recorder->cond);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_mutex;
+
+	err = chiaki_thread_create(&recorder->thread, recorder_thread_func, recorder);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_cond;
+
+	chiaki_thread_set_name(&recorder->thread, "Chiaki Recorder");
+
+	CHIAKI_LOGI(log, "Recording stream to %s", path);
+	return CHIAKI_ERR_SUCCESS;
+
+error_cond:
+	chiaki_cond_fini(&recorder->cond);
+error_mutex:
+	chiaki_mutex_fini(&recorder->mutex);
+error_packet:
+	av_packet_free(&recorder->av_packet);
+error_path:
+	free(recorder->path);
+	return err;
+}
+
+CHIAKI_EXPORT void chiaki_recorder_fini(ChiakiRecorder *recorder)
+{
+	chiaki_mutex_lock(&recorder->mutex);
+	recorder->should_stop = true;
+	chiaki_cond_signal(&recorder->cond);
+	chiaki_mutex_unlock(&recorder->mutex);
+	chiaki_thread_join(&recorder->thread, NULL);
+
+	CHIAKI_LOGI(recorder->log, "Recorder wrote %llu video and %llu audio frames (%llu bytes) to %s, dropped %llu%s",
+			(unsigned long long)recorder->stats.video_frames, (unsigned long long)recorder->stats.audio_frames,
+			(unsigned long long)recorder->stats.bytes_written, recorder->path,
+			(unsigned long long)recorder->stats.dropped, recorder->stats.failed ? ", writing failed" : "");
+
+	chiaki_cond_fini(&recorder->cond);
+	chiaki_mutex_fini(&recorder->mutex);
+	av_packet_free(&recorder->av_packet);
+	free(recorder->video_header);
+	free(recorder->path);
+}
+
+static ChiakiRecorderPacket *recorder_packet_new(ChiakiRecorderPacketType type, const uint8_t *buf, size_t buf_size)
+{
+	ChiakiRecorderPacket *packet = malloc(sizeof(ChiakiRecorderPacket) + buf_size);
+	if(!packet)
+		return NULL;
+	memset(packet, 0, sizeof(ChiakiRecorderPacket));
+	packet->type = type;
+	packet->size = buf_size;
+	if(buf_size)
+		memcpy(packet->data, buf, buf_size);
+	return packet;
+}
+
+/**
+ * mutex must be locked
+ */
+static void recorder_queue(ChiakiRecorder *recorder, ChiakiRecorderPacket *packet)
+{
+	packet->next = NULL;
+	if(recorder->queue_tail)
+		recorder->queue_tail->next = packet;
+	else
+		recorder->queue_head = packet;
+	recorder->queue_tail = packet;
+	recorder->queue_bytes += packet->size;
+	chiaki_cond_signal(&recorder->cond);
+}
+
+/**
+ * Headers are never dropped for a full queue, the frames after them would be useless without.
+ */
+static void recorder_push_header(ChiakiRecorder *recorder, ChiakiRecorderPacket *packet)
+{
+	if(!packet)
+	{
+		CHIAKI_LOGE(recorder->log, "Recorder failed to allocate header");
+		return;
+	}
+	chiaki_mutex_lock(&recorder->mutex);
+	recorder_queue(recorder, packet);
+	chiaki_mutex_unlock(&recorder->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_recorder_push_video_header(ChiakiRecorder *recorder, const uint8_t *buf, size_t buf_size, unsigned int width, unsigned int height)
+{
+	ChiakiRecorderPacket *packet = recorder_packet_new(CHIAKI_RECORDER_PACKET_VIDEO_HEADER, buf, buf_size);
+	if(packet)
+	{
+		packet->width = width;
+		packet->height = height;
+	}
+	recorder_push_header(recorder, packet);
+}
+
+CHIAKI_EXPORT void chiaki_recorder_push_audio_header(ChiakiRecorder *recorder, ChiakiAudioHeader *audio_header)
+{
+	ChiakiRecorderPacket *packet = recorder_packet_new(CHIAKI_RECORDER_PACKET_AUDIO_HEADER, NULL, 0);
+	if(packet)
+		packet->audio_header = *audio_header;
+	recorder_push_header(recorder, packet);
+}
+
+/**
+ * mutex must be locked
+ */
+static bool recorder_queue_full(ChiakiRecorder *recorder, size_t size)
+{
+	return recorder->stats.failed || recorder->queue_bytes + size > recorder->queue_bytes_max;
+}
+
+CHIAKI_EXPORT void chiaki_recorder_push_video_frame(ChiakiRecorder *recorder, const uint8_t *buf, size_t buf_size,
+		ChiakiSeqNum16 frame_index, bool keyframe, uint64_t arrival_us)
+{
+	chiaki_mutex_lock(&recorder->mutex);
+	if((recorder->video_wait_keyframe && !keyframe) || recorder_queue_full(recorder, buf_size))
+		goto drop;
+
+	// copied under the lock, so the check above stays valid, it is only a memcpy
+	ChiakiRecorderPacket *packet = recorder_packet_new(CHIAKI_RECORDER_PACKET_VIDEO_FRAME, buf, buf_size);
+	if(!packet)
+		goto drop;
+	packet->index = frame_index;
+	packet->keyframe = keyframe;
+	packet->arrival_us = arrival_us;
+	recorder->video_wait_keyframe = false;
+	recorder_queue(recorder, packet);
+	chiaki_mutex_unlock(&recorder->mutex);
+	return;
+
+drop:
+	if(!recorder->video_wait_keyframe && !recorder->stats.failed)
+		CHIAKI_LOGW(recorder->log, "Recorder queue full, dropping video until the next keyframe");
+	recorder->video_wait_keyframe = true;
+	recorder->stats.dropped++;
+	chiaki_mutex_unlock(&recorder->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_recorder_push_audio_frame(ChiakiRecorder *recorder, const uint8_t *buf, size_t buf_size,
+		ChiakiSeqNum16 frame_index, uint64_t arrival_us)
+{
+	chiaki_mutex_lock(&recorder->mutex);
+	ChiakiRecorderPacket *packet = NULL;
+	if(!recorder_queue_full(recorder, buf_size))
+		packet = recorder_packet_new(CHIAKI_RECORDER_PACKET_AUDIO_FRAME, buf, buf_size);
+	if(packet)
+	{
+		packet->index = frame_index;
+		packet->arrival_us = arrival_us;
+		recorder_queue(recorder, packet);
+	}
+	else
+		recorder->stats.dropped++;
+	chiaki_mutex_unlock(&recorder->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_recorder_get_stats(ChiakiRecorder *recorder, ChiakiRecorderStats *stats)
+{
+	chiaki_mutex_lock(&recorder->mutex);
+	*stats = recorder->stats;
+	chiaki_mutex_unlock(&recorder->mutex);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_recorder_save_replay(ChiakiLog *log, const char *path, ChiakiCodec codec, unsigned int fps,
+		ChiakiReplaySnapshot *snapshot)
+{
+	ChiakiRecorder *recorder = malloc(sizeof(ChiakiRecorder));
+	if(!recorder)
+		return CHIAKI_ERR_MEMORY;
+	// the whole snapshot fits into the queue, so nothing is dropped however fast it is pushed
+	ChiakiErrorCode err = chiaki_recorder_init(recorder, log, path, codec, fps, snapshot->bytes + 1);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		free(recorder);
+		return err;
+	}
+
+	if(snapshot->audio_header_set)
+		chiaki_recorder_push_audio_header(recorder, &snapshot->audio_header);
+	for(size_t i=0; i<snapshot->count; i++)
+	{
+		ChiakiReplayEntry *entry = snapshot->entries[i];
+		switch(entry->type)
+		{
+			case CHIAKI_REPLAY_ENTRY_VIDEO_HEADER:
+				chiaki_recorder_push_video_header(recorder, entry->data, entry->size, entry->width, entry->height);
+				break;
+			case CHIAKI_REPLAY_ENTRY_VIDEO_FRAME:
+				chiaki_recorder_push_video_frame(recorder, entry->data, entry->size, entry->index, entry->idr, entry->arrival_us);
+				break;
+			case CHIAKI_REPLAY_ENTRY_AUDIO_FRAME:
+				chiaki_recorder_push_audio_frame(recorder, entry->data, entry->size, entry->index, entry->arrival_us);
+				break;
+		}
+	}
+
+	chiaki_recorder_fini(recorder);
+	err = recorder->stats.failed || !recorder->stats.video_frames ? CHIAKI_ERR_UNKNOWN : CHIAKI_ERR_SUCCESS;
+	free(recorder);
+	return err;
+}
+
+static void recorder_sink_video_header(uint8_t *buf, size_t buf_size, unsigned int width, unsigned int height, void *user)
+{
+	chiaki_recorder_push_video_header(user, buf, buf_size, width, height);
+}
+
+static void recorder_sink_video_frame(uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index, bool keyframe, void *user)
+{
+	chiaki_recorder_push_video_frame(user, buf, buf_size, frame_index, keyframe, chiaki_time_now_monotonic_us());
+}
+
+static void recorder_sink_audio_header(ChiakiAudioHeader *header, void *user)
+{
+	chiaki_recorder_push_audio_header(user, header);
+}
+
+static void recorder_sink_audio_frame(uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index, void *user)
+{
+	chiaki_recorder_push_audio_frame(user, buf, buf_size, frame_index, chiaki_time_now_monotonic_us());
+}
+
+CHIAKI_EXPORT void chiaki_recorder_get_sink(ChiakiRecorder *recorder, ChiakiRecordSink *sink)
+{
+	sink->user = recorder;
+	sink->video_header_cb = recorder_sink_video_header;
+	sink->video_frame_cb = recorder_sink_video_frame;
+	sink->audio_header_cb = recorder_sink_audio_header;
+	sink->audio_frame_cb = recorder_sink_audio_frame;
+}
+
+static uint8_t *recorder_extradata(const uint8_t *buf, size_t size)
+{
+	uint8_t *extradata = av_mallocz(size + AV_INPUT_BUFFER_PADDING_SIZE);
+	if(extradata)
+		memcpy(extradata, buf, size);
+	return extradata;
+}
+
+/**
+ * Create the file and write its header, called on the first keyframe once the video header is known.
+ */
+static bool recorder_open(ChiakiRecorder *recorder)
+{
+	int r = avformat_alloc_output_context2(&recorder->format_context, NULL, NULL, recorder->path);
+	if(r < 0 || !recorder->format_context)
+		r = avformat_alloc_output_context2(&recorder->format_context, NULL, "matroska", recorder->path);
+	if(r < 0 || !recorder->format_context)
+	{
+		CHIAKI_LOGE(recorder->log, "Recorder failed to create output context for %s", recorder->path);
+		return false;
+	}
+	AVFormatContext *fmt = recorder->format_context;
+
+	recorder->video_stream = avformat_new_stream(fmt, NULL);
+	if(!recorder->video_stream)
+		goto error;
+	AVCodecParameters *par = recorder->video_stream->codecpar;
+	par->codec_type = AVMEDIA_TYPE_VIDEO;
+	par->codec_id = chiaki_codec_is_h265(recorder->codec) ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264;
+	par->width = (int)recorder->width;
+	par->height = (int)recorder->height;
+	if(chiaki_codec_is_hdr(recorder->codec))
+	{
+		par->color_primaries = AVCOL_PRI_BT2020;
+		par->color_trc = AVCOL_TRC_SMPTE2084;
+		par->color_space = AVCOL_SPC_BT2020_NCL;
+	}
+	par->extradata = recorder_extradata(recorder->video_header, recorder->video_header_size);
+	if(!par->extradata)
+		goto error;
+	par->extradata_size = (int)recorder->video_header_size;
+	recorder->video_stream->time_base = (AVRational){ 1, 90000 };
+	recorder->video_stream->avg_frame_rate = (AVRational){ (int)recorder->fps, 1 };
+
+	if(recorder->audio_header_set)
+	{
+		recorder->audio_stream = avformat_new_stream(fmt, NULL);
+		if(!recorder->audio_stream)
+			goto error;
+		par = recorder->audio_stream->codecpar;
+		par->codec_type = AVMEDIA_TYPE_AUDIO;
+		par->codec_id = AV_CODEC_ID_OPUS;
+		par->sample_rate = (int)recorder->audio_header.rate;
+		par->frame_size = (int)recorder->audio_header.frame_size;
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(57, 28, 100)
+		av_channel_layout_default(&par->ch_layout, recorder->audio_header.channels);
+#else
+		par->channels = recorder->audio_header.channels;
+		par->channel_layout = av_get_default_channel_layout(recorder->audio_header.channels);
+#endif
+		// OpusHead, as both matroska and mp4 need it
+		uint8_t opus_head[OPUS_HEAD_SIZE] = { 'O', 'p', 'u', 's', 'H', 'e', 'a', 'd', 1 };
+		opus_head[9] = recorder->audio_header.channels;
+		// pre-skip 0, the stream is already running
+		uint32_t rate = recorder->audio_header.rate;
+		opus_head[12] = rate & 0xff;
+		opus_head[13] = (rate >> 8) & 0xff;
+		opus_head[14] = (rate >> 16) & 0xff;
+		opus_head[15] = (rate >> 24) & 0xff;
+		// output gain 0, mapping family 0
+		par->extradata = recorder_extradata(opus_head, sizeof(opus_head));
+		if(!par->extradata)
+			goto error;
+		par->extradata_size = sizeof(opus_head);
+		recorder->audio_stream->time_base = (AVRational){ 1, (int)recorder->audio_header.rate };
+	}
+	else
+		CHIAKI_LOGW(recorder->log, "Recorder got no audio header before the first keyframe, recording video only");
+
+	if(!(fmt->oformat->flags & AVFMT_NOFILE))
+	{
+		r = avio_open(&fmt->pb, recorder->path, AVIO_FLAG_WRITE);
+		if(r < 0)
+		{
+			CHIAKI_LOGE(recorder->log, "Recorder failed to open %s: %s", recorder->path, av_err2str(r));
+			goto error;
+		}
+	}
+
+	r = avformat_write_header(fmt, NULL);
+	if(r < 0)
+	{
+		CHIAKI_LOGE(recorder->log, "Recorder failed to write header: %s", av_err2str(r));
+		goto error;
+	}
+	recorder->header_written = true;
+	recorder->video_dts_prev = INT64_MIN;
+	recorder->audio_dts_prev = INT64_MIN;
+	CHIAKI_LOGI(recorder->log, "Recorder started %s file with %ux%u %s%s", fmt->oformat->name,
+			recorder->width, recorder->height, chiaki_codec_name(recorder->codec), recorder->audio_stream ? " and Opus" : "");
+	return true;
+
+error:
+	if(!(fmt->oformat->flags & AVFMT_NOFILE))
+		avio_closep(&fmt->pb);
+	avformat_free_context(fmt);
+	recorder->format_context = NULL;
+	recorder->video_stream = NULL;
+	recorder->audio_stream = NULL;
+	return false;
+}
+
+static void recorder_close(ChiakiRecorder *recorder)
+{
+	AVFormatContext *fmt = recorder->format_context;
+	if(!fmt)
+		return;
+	int r = av_write_trailer(fmt);
+	if(r < 0)
+		CHIAKI_LOGE(recorder->log, "Recorder failed to write trailer: %s", av_err2str(r));
+	if(!(fmt->oformat->flags & AVFMT_NOFILE))
+		avio_closep(&fmt->pb);
+	avformat_free_context(fmt);
+	recorder->format_context = NULL;
+}
+
+static uint64_t seq_num_16_unwrap(uint64_t prev, ChiakiSeqNum16 index)
+{
+	return prev + (int64_t)(int16_t)(index - (ChiakiSeqNum16)prev);
+}
+
+/**
+ * @return false if writing failed
+ */
+static bool recorder_write(ChiakiRecorder *recorder, AVStream *stream, uint64_t pts_us, int64_t *dts_prev, bool keyframe,
+		const uint8_t *prefix, size_t prefix_size, const uint8_t *buf, size_t size)
+{
+	AVPacket *pkt = recorder->av_packet;
+	if(av_new_packet(pkt, (int)(prefix_size + size)) < 0)
+		return false;
+	if(prefix_size)
+		memcpy(pkt->data, prefix, prefix_size);
+	memcpy(pkt->data + prefix_size, buf, size);
+
+	// no reordering in the stream, so pts == dts, which the muxer needs strictly increasing
+	int64_t ts = av_rescale_q((int64_t)(pts_us - recorder->start_us), (AVRational){ 1, 1000000 }, stream->time_base);
+	if(*dts_prev != INT64_MIN && ts <= *dts_prev)
+		ts = *dts_prev + 1;
+	*dts_prev = ts;
+	pkt->pts = pkt->dts = ts;
+	pkt->stream_index = stream->index;
+	if(keyframe)
+		pkt->flags |= AV_PKT_FLAG_KEY;
+
+	int r = av_interleaved_write_frame(recorder->format_context, pkt);
+	if(r < 0)
+	{
+		CHIAKI_LOGE(recorder->log, "Recorder failed to write frame: %s", av_err2str(r));
+		return false;
+	}
+	return true;
+}
+
+typedef struct recorder_batch_stats_t
+{
+	uint64_t video_frames;
+	uint64_t audio_frames;
+	uint64_t bytes_written;
+	uint64_t dropped;
+	bool failed;
+} RecorderBatchStats;
+
+static void recorder_video_frame(ChiakiRecorder *recorder, ChiakiRecorderPacket *packet, RecorderBatchStats *stats)
+{
+	recorder->video_index = recorder->video_base_set
+		? seq_num_16_unwrap(recorder->video_index, packet->index)
+		: packet->index;
+	if(!recorder->video_base_set)
+	{
+		recorder->video_base_set = true;
+		recorder->video_base_index = recorder->video_index;
+		recorder->video_base_us = packet->arrival_us;
+	}
+	uint64_t pts_us = recorder->video_base_us
+		+ (recorder->video_index - recorder->video_base_index) * 1000000 / recorder->fps;
+
+	if(!recorder->header_written)
+	{
+		if(!packet->keyframe || !recorder->video_header)
+		{
+			stats->dropped++;
+			return;
+		}
+		if(!recorder_open(recorder))
+		{
+			stats->failed = true;
+			return;
+		}
+		recorder->start_us = pts_us;
+		recorder->video_header_pending = false;
+	}
+
+	const uint8_t *prefix = NULL;
+	size_t prefix_size = 0;
+	if(recorder->video_header_pending)
+	{
+		// frames of the new profile can't be decoded before its parameter sets
+		if(!packet->keyframe)
+		{
+			stats->dropped++;
+			return;
+		}
+		prefix = recorder->video_header;
+		prefix_size = recorder->video_header_size;
+		recorder->video_header_pending = false;
+	}
+
+	if(!recorder_write(recorder, recorder->video_stream, pts_us, &recorder->video_dts_prev, packet->keyframe,
+			prefix, prefix_size, packet->data, packet->size))
+	{
+		stats->failed = true;
+		return;
+	}
+	stats->video_frames++;
+	stats->bytes_written += prefix_size + packet->size;
+}
+
+static void recorder_audio_frame(ChiakiRecorder *recorder, ChiakiRecorderPacket *packet, RecorderBatchStats *stats)
+{
+	if(!recorder->audio_header_set || !recorder->audio_header.rate)
+	{
+		stats->dropped++;
+		return;
+	}
+	recorder->audio_index = recorder->audio_base_set
+		? seq_num_16_unwrap(recorder->audio_index, packet->index)
+		: packet->index;
+	if(!recorder->audio_base_set)
+	{
+		recorder->audio_base_set = true;
+		recorder->audio_base_index = recorder->audio_index;
+		recorder->audio_base_us = packet->arrival_us;
+	}
+	uint64_t pts_us = recorder->audio_base_us
+		+ (recorder->audio_index - recorder->audio_base_index) * recorder->audio_header.frame_size * 1000000 / recorder->audio_header.rate;
+
+	// nothing before the first keyframe
+	if(!recorder->header_written || !recorder->audio_stream || pts_us < recorder->start_us)
+	{
+		stats->dropped++;
+		return;
+	}
+
+	if(!recorder_write(recorder, recorder->audio_stream, pts_us, &recorder->audio_dts_prev, true,
+			NULL, 0, packet->data, packet->size))
+	{
+		stats->failed = true;
+		return;
+	}
+	stats->audio_frames++;
+	stats->bytes_written += packet->size;
+}
+
+static void recorder_video_header(ChiakiRecorder *recorder, ChiakiRecorderPacket *packet)
+{
+	uint8_t *header = malloc(packet->size);
+	if(!header)
+	{
+		CHIAKI_LOGE(recorder->log, "Recorder failed to allocate video header");
+		return;
+	}
+	memcpy(header, packet->data, packet->size);
+	free(recorder->video_header);
+	recorder->video_header = header;
+	recorder->video_header_size = packet->size;
+	if(recorder->header_written)
+	{
+		recorder->video_header_pending = true;
+		if(packet->width != recorder->width || packet->height != recorder->height)
+			CHIAKI_LOGI(recorder->log, "Recorder continues with %ux%u, the file still declares %ux%u",
+					packet->width, packet->height, recorder->width, recorder->height);
+	}
+	else
+	{
+		recorder->width = packet->width;
+		recorder->height = packet->height;
+	}
+}
+
+static void *recorder_thread_func(void *user)
+{
+	ChiakiRecorder *recorder = user;
+
+	chiaki_mutex_lock(&recorder->mutex);
+	while(true)
+	{
+		while(!recorder->queue_head && !recorder->should_stop)
+			chiaki_cond_wait(&recorder->cond, &recorder->mutex);
+		if(!recorder->queue_head)
+			break;
+
+		// take everything at once and write it without the lock, pushing only ever waits for the list
+		ChiakiRecorderPacket *packet = recorder->queue_head;
+		recorder->queue_head = recorder->queue_tail = NULL;
+		bool failed = recorder->stats.failed;
+		chiaki_mutex_unlock(&recorder->mutex);
+
+		RecorderBatchStats stats = { 0 };
+		stats.failed = failed;
+		size_t batch_bytes = 0;
+		while(packet)
+		{
+			ChiakiRecorderPacket *next = packet->next;
+			batch_bytes += packet->size;
+			switch(packet->type)
+			{
+				case CHIAKI_RECORDER_PACKET_VIDEO_HEADER:
+					recorder_video_header(recorder, packet);
+					break;
+				case CHIAKI_RECORDER_PACKET_AUDIO_HEADER:
+					recorder->audio_header = packet->audio_header;
+					recorder->audio_header_set = true;
+					break;
+				case CHIAKI_RECORDER_PACKET_VIDEO_FRAME:
+					if(stats.failed)
+						stats.dropped++;
+					else
+						recorder_video_frame(recorder, packet, &stats);
+					break;
+				case CHIAKI_RECORDER_PACKET_AUDIO_FRAME:
+					if(stats.failed)
+						stats.dropped++;
+					else
+						recorder_audio_frame(recorder, packet, &stats);
+					break;
+			}
+			free(packet);
+			packet = next;
+		}
+
+		chiaki_mutex_lock(&recorder->mutex);
+		recorder->queue_bytes -= batch_bytes;
+		recorder->stats.video_frames += stats.video_frames;
+		recorder->stats.audio_frames += stats.audio_frames;
+		recorder->stats.bytes_written += stats.bytes_written;
+		recorder->stats.dropped += stats.dropped;
+		if(stats.failed && !recorder->stats.failed)
+		{
+			CHIAKI_LOGE(recorder->log, "Recording stopped after an error");
+			recorder->stats.failed = true;
+		}
+	}
+	chiaki_mutex_unlock(&recorder->mutex);
+
+	recorder_close(recorder);
+	return NULL;
+}
@@ -17,8 +17,22 @@
 #endif
 
 #include <chiaki/remote/holepunch.h>
+#include <chiaki/time.h>
 #include "../utils.h"
 
+static uint64_t phase_start_us;
+
+/**
+ * Prints the time since the last call, to benchmark the steps against scripts/holepunch/psn-mock.py
+ */
+static double phase_ms()
+{
+    uint64_t now_us = chiaki_time_now_monotonic_us();
+    double ms = (now_us - phase_start_us) / 1000.0;
+    phase_start_us = now_us;
+    return ms;
+}
+
 // ================================================================================================
 // ================================================================================================
 // ================================================================================================
@@ -26,6 +40,17 @@ int main(int argc, char **argv)
 {
     printf("libchiaki UDP Holepunching Test\n");
 
+    // -u <url_base> sends all requests to another server, e.g. http://127.0.0.1:8080 for psn-mock.py
+    const char *url_base = NULL;
+    if (argc >= 3 && strcmp(argv[1], "-u") == 0)
+    {
+        url_base = argv[2];
+        argc -= 2;
+        argv += 2;
+        chiaki_holepunch_set_url_base(url_base);
+        printf("Using URL base: %s\n", url_base);
+    }
+
     char *oauth_token = NULL;
     FILE *token_file = fopen("/tmp/token.txt", "r");
     if (token_file != NULL)
@@ -46,9 +71,11 @@ int main(int argc, char **argv)
     {
         if (argc == 2)
             oauth_token = argv[1];
+        else if (url_base)
+            oauth_token = "mock";
         else
         {
-            fprintf(stderr, "Usage: %s <oauth_token>\n", argv[0]);
+            fprintf(stderr, "Usage: %s [-u <url_base>] <oauth_token>\n", argv[0]);
             return 1;
         }
     }
@@ -56,12 +83,14 @@ int main(int argc, char **argv)
 
     ChiakiLog log;
 	chiaki_log_init(&log, CHIAKI_LOG_ALL, chiaki_log_cb_print, NULL);
+    uint64_t total_start_us = chiaki_time_now_monotonic_us();
+    phase_start_us = total_start_us;
 
     // List available devices
     ChiakiHolepunchDeviceInfo *device_info_ps5;
     size_t num_devices_ps5;
-    ChiakiHolepunchDeviceInfo *device_info_ps4;
-    size_t num_devices_ps4;
+    ChiakiHolepunchDeviceInfo *device_info_ps4 = NULL;
+    size_t num_devices_ps4 = 0;
 
     ChiakiErrorCode err = chiaki_holepunch_list_devices(oauth_token, CHIAKI_HOLEPUNCH_CONSOLE_TYPE_PS5, &device_info_ps5, &num_devices_ps5, &log);
     if (err != CHIAKI_ERR_SUCCESS)
@@ -69,13 +98,8 @@ int main(int argc, char **argv)
         fprintf(stderr, "!! Failed to get PS5 devices\n");
         return 1;
     }
-    err = chiaki_holepunch_list_devices(oauth_token, CHIAKI_HOLEPUNCH_CONSOLE_TYPE_PS4, &device_info_ps4, &num_devices_ps4, &log);
-    if (err != CHIAKI_ERR_SUCCESS)
-    {
-        fprintf(stderr, "!! Failed to get PS4 devices\n");
-        return 1;
-    }
-    printf(">> Found %ld devices\n", num_devices_ps5 + num_devices_ps4);
+    // chiaki_holepunch_list_devices only supports PS5
+    printf(">> Found %ld devices (%.1f ms)\n", num_devices_ps5 + num_devices_ps4, phase_ms());
     for (size_t i = 0; i < num_devices_ps5; i++)
     {
         ChiakiHolepunchDeviceInfo dev = device_info_ps5[i];
@@ -124,7 +148,7 @@ int main(int argc, char **argv)
         fprintf(stderr, "!! Failed to initialize session\n");
         return -1;
     }
-    printf(">> Initialized session\n");
+    printf(">> Initialized session (%.1f ms)\n", phase_ms());
 
     err = chiaki_holepunch_session_create(session);
     if (err != CHIAKI_ERR_SUCCESS)
@@ -132,7 +156,7 @@ int main(int argc, char **argv)
         fprintf(stderr, "!! Failed to create session\n");
         return -1;
     }
-    printf(">> Created session\n");
+    printf(">> Created session (%.1f ms)\n", phase_ms());
 
 	err = holepunch_session_create_offer(session);
 	if (err != CHIAKI_ERR_SUCCESS)
@@ -140,7 +164,7 @@ int main(int argc, char **argv)
 		fprintf(stderr, "!! Failed to create offer msg for ctrl connection");
 		return err;
 	}
-    printf(">> Created offer msg for ctrl connection\n");
+    printf(">> Created offer msg for ctrl connection (%.1f ms)\n", phase_ms());
     err = chiaki_holepunch_session_start(session, device_uid, console_type);
     if (err != CHIAKI_ERR_SUCCESS)
     {
@@ -148,7 +172,7 @@ int main(int argc, char **argv)
         chiaki_holepunch_session_fini(session);
         return -1;
     }
-    printf(">> Started session\n");
+    printf(">> Started session (%.1f ms)\n", phase_ms());
 
     err = chiaki_holepunch_session_punch_hole(session, CHIAKI_HOLEPUNCH_PORT_TYPE_CTRL);
     if (err != CHIAKI_ERR_SUCCESS)
@@ -157,14 +181,14 @@ int main(int argc, char **argv)
         chiaki_holepunch_session_fini(session);
         return -1;
     }
-    printf(">> Punched hole for control connection!\n");
+    printf(">> Punched hole for control connection! (%.1f ms)\n", phase_ms());
 	err = holepunch_session_create_offer(session);
 	if (err != CHIAKI_ERR_SUCCESS)
 	{
-		fprintf(stderr, "!! Failed to create offer msg for ctrl connection");
+		fprintf(stderr, "!! Failed to create offer msg for data connection");
 		return err;
 	}
-    printf(">> Created offer msg for ctrl connection\n");
+    printf(">> Created offer msg for data connection (%.1f ms)\n", phase_ms());
     err = chiaki_holepunch_session_punch_hole(session, CHIAKI_HOLEPUNCH_PORT_TYPE_DATA);
     if (err != CHIAKI_ERR_SUCCESS)
     {
@@ -172,9 +196,16 @@ int main(int argc, char **argv)
         chiaki_holepunch_session_fini(session);
         return -1;
     }
-    printf(">> Punched hole for data connection!\n");
+    printf(">> Punched hole for data connection! (%.1f ms)\n", phase_ms());
+
+    printf(">> Successfully punched holes for all neccessary connections! (%.1f ms total)\n",
+        (chiaki_time_now_monotonic_us() - total_start_us) / 1000.0);
 
-    printf(">> Successfully punched holes for all neccessary connections!\n");
+    ChiakiHolepunchNotificationStats stats;
+    chiaki_holepunch_session_get_notification_stats(session, &stats);
+    printf(">> Notifications: %llu received, %llu filtered, %llu overflowed, %llu delivered, latency avg %.3f ms, max %.3f ms\n",
+        (unsigned long long)stats.received, (unsigned long long)stats.filtered, (unsigned long long)stats.overflowed,
+        (unsigned long long)stats.delivered, stats.latency_avg_us / 1000.0, stats.latency_max_us / 1000.0);
 
 cleanup:
     chiaki_holepunch_free_device_list(&device_info_ps5);
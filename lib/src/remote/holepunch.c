@@ -47,6 +47,9 @@
 #include <netdb.h>
 #include <ifaddrs.h>
 #include <net/if.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 #endif
 
 #include <curl/curl.h>
@@ -74,12 +77,16 @@
 #define WEBSOCKET_PING_INTERVAL_SEC 5
 // Maximum WebSocket frame size currently supported by libcurl
 #define WEBSOCKET_MAX_FRAME_SIZE 64 * 1024
+#define NOTIFICATION_RING_SIZE 32
 #define SESSION_CREATION_TIMEOUT_SEC 30
 #define SESSION_START_TIMEOUT_SEC 30
 #define SESSION_DELETION_TIMEOUT_SEC 3
-#define SELECT_CANDIDATE_TIMEOUT_SEC 0.5F
-#define SELECT_CANDIDATE_TRIES 20
-#define SELECT_CANDIDATE_CONNECTION_SEC 5
+#define CHECK_CANDIDATES_TIMEOUT_MS 10000
+#define CANDIDATE_STAGGER_MS 50
+#define CANDIDATE_RTO_INITIAL_MS 200
+#define CANDIDATE_RTO_MAX_MS 1000
+#define CANDIDATE_CANCEL_POLL_MS 250
+#define CANDIDATE_RACE_EVENTS_MAX 16
 #define RANDOM_ALLOCATION_GUESSES_NUMBER 75
 #define RANDOM_ALLOCATION_SOCKS_NUMBER 250
 #define CHECK_CANDIDATES_REQUEST_NUMBER 1
@@ -102,6 +109,11 @@ static const char wakeup_url_fmt[] = "%s/v1/users/%s/remoteConsole/wakeUp?platfo
 static const char session_command_url[] = "https://web.np.playstation.com/api/cloudAssistedNavigation/v2/users/me/commands";
 static const char session_message_url_fmt[] = "https://web.np.playstation.com/api/sessionManager/v1/remotePlaySessions/%s/sessionMessage";
 static const char delete_messsage_url_fmt[] = "https://web.np.playstation.com/api/sessionManager/v1/remotePlaySessions/%s/members/me";
+static const char stun_hosts_url[] = "https://raw.githubusercontent.com/pradt2/always-online-stun/master/valid_hosts.txt";
+static const char stun_hosts_ipv6_url[] = "https://raw.githubusercontent.com/pradt2/always-online-stun/master/valid_ipv6s.txt";
+
+// Replaces the scheme and host of all endpoints above if not empty, see chiaki_holepunch_set_url_base()
+static char url_base[256] = "";
 
 // JSON payloads for requests.
 // Implemented as string templates due to the broken JSON used by the official app, which we're
@@ -191,19 +203,24 @@ typedef enum notification_type_t
 
 typedef struct notification_t
 {
-    struct notification_t *next;
-
     NotificationType type;
-    json_object* json;
-    char* json_buf;
+    json_object* json; // only parsed once the notification is taken by the state machine
+    char* json_buf; // null-terminated frame payload
     size_t json_buf_size;
+    uint64_t received_us; // when the websocket frame arrived, for measuring the delivery latency
 } Notification;
 
-typedef struct notification_queue_t
+/**
+ * Notifications received but not taken by the state machine yet, oldest first.
+ * Taking a notification leaves an empty slot (json_buf == NULL) that is skipped,
+ * if the ring is full the oldest notification is dropped.
+ */
+typedef struct notification_ring_t
 {
-    Notification *front, *rear;
-
-} NotificationQueue;
+    Notification slots[NOTIFICATION_RING_SIZE];
+    uint64_t head; // sequence number of the oldest slot
+    uint64_t tail; // sequence number of the next slot to write
+} NotificationRing;
 
 typedef enum session_state_t
 {
@@ -291,7 +308,6 @@ typedef struct session_message_t
     uint16_t req_id;
     uint16_t error;
     ConnectionRequest *conn_request;
-    Notification *notification;
 } SessionMessage;
 
 typedef struct session_t
@@ -339,7 +355,7 @@ typedef struct session_t
 
     char* ws_fqdn;
     ChiakiThread ws_thread;
-    NotificationQueue* ws_notification_queue;
+    NotificationRing notif_ring;
     bool ws_thread_should_stop;
     bool ws_open;
 
@@ -350,6 +366,9 @@ typedef struct session_t
 
     ChiakiMutex notif_mutex;
     ChiakiCond notif_cond;
+    uint16_t notif_waiting_types; // the websocket thread only signals notif_cond for these
+    ChiakiHolepunchNotificationStats notif_stats;
+    uint64_t notif_latency_sum_us;
 
     SessionState state;
     ChiakiMutex state_mutex;
@@ -359,6 +378,10 @@ typedef struct session_t
     chiaki_socket_t ipv4_sock;
     chiaki_socket_t ipv6_sock;
 
+    ChiakiHolepunchCandidateHint candidate_hint;
+    bool candidate_hint_valid;
+    ChiakiStunCache *stun_cache;
+
     chiaki_socket_t ctrl_sock;
     chiaki_socket_t data_sock;
 
@@ -375,7 +398,7 @@ static ChiakiErrorCode hex_to_bytes(const char* hex_str, uint8_t* bytes, size_t
 static void bytes_to_hex(const uint8_t* bytes, size_t len, char* hex_str, size_t max_len);
 static void random_uuidv4(char* out);
 static void *websocket_thread_func(void *user);
-static NotificationType parse_notification_type(ChiakiLog *log, json_object* json);
+static NotificationType parse_notification_type(ChiakiLog *log, const char *buf);
 static ChiakiErrorCode send_offer(Session *session);
 static ChiakiErrorCode send_accept(Session *session, int req_id, Candidate *selected_candidate);
 static ChiakiErrorCode http_create_session(Session *session);
@@ -404,11 +427,10 @@ static ChiakiErrorCode wait_for_notification(
     uint16_t types, uint64_t timeout_ms);
 static ChiakiErrorCode clear_notification(
     Session *session, Notification *notification);
-static void notification_queue_free(NotificationQueue* queue);
-static NotificationQueue *createNq();
-static void dequeueNq(NotificationQueue *nq);
-static void enqueueNq(NotificationQueue *nq, Notification *notif);
-static Notification* newNotification(NotificationType type, json_object *json, char* json_buf, size_t json_buf_size);
+static uint16_t notification_interest(Session *session);
+static bool notification_ring_push(NotificationRing *ring, Notification *notif);
+static bool notification_ring_take(NotificationRing *ring, uint16_t types, Notification *out);
+static void notification_ring_clear(NotificationRing *ring);
 static void remove_substring(char *str, char *substring);
 
 static ChiakiErrorCode wait_for_session_message(
@@ -426,6 +448,7 @@ static ChiakiErrorCode session_message_free(SessionMessage *message);
 static ChiakiErrorCode deleteSession(Session *session);
 static void print_session_request(ChiakiLog *log, ConnectionRequest *req);
 static void print_candidate(ChiakiLog *log, Candidate *candidate);
+static void endpoint_url(char *url, size_t url_size, const char *psn_url);
 static ChiakiErrorCode receive_request_send_response_ps(Session *session, chiaki_socket_t *sock,
     Candidate *candidate, size_t timeout);
 static ChiakiErrorCode send_response_ps(Session *session, uint8_t *req, chiaki_socket_t *sock,
@@ -433,6 +456,38 @@ static ChiakiErrorCode send_response_ps(Session *session, uint8_t *req, chiaki_s
 static ChiakiErrorCode send_responseto_ps(Session *session, uint8_t *req, chiaki_socket_t *sock,
     Candidate *candidate, struct sockaddr *addr, socklen_t len);
 
+CHIAKI_EXPORT void chiaki_holepunch_set_url_base(const char *base)
+{
+    if(!base)
+    {
+        url_base[0] = '\0';
+        return;
+    }
+    snprintf(url_base, sizeof(url_base), "%s", base);
+    size_t len = strlen(url_base);
+    while(len > 0 && url_base[len - 1] == '/')
+        url_base[--len] = '\0';
+}
+
+/**
+ * Gets the url to request for an endpoint
+ *
+ * @param[out] url Buffer receiving the url
+ * @param[in] url_size Size of the buffer
+ * @param[in] psn_url Absolute url of the endpoint on the PSN servers, its path is kept if a url base is set
+*/
+static void endpoint_url(char *url, size_t url_size, const char *psn_url)
+{
+    if(!url_base[0])
+    {
+        snprintf(url, url_size, "%s", psn_url);
+        return;
+    }
+    const char *path = strstr(psn_url, "://");
+    path = path ? strchr(path + 3, '/') : NULL;
+    snprintf(url, url_size, "%s%s", url_base, path ? path : "");
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_list_devices(
     const char* psn_oauth2_token, ChiakiHolepunchConsoleType console_type,
     ChiakiHolepunchDeviceInfo **devices, size_t *device_count,
@@ -444,7 +499,8 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_list_devices(
         CHIAKI_LOGE(log, "Curl could not init");
         return CHIAKI_ERR_MEMORY;
     }
-    char url[133];
+    char psn_url[133];
+    char url[256];
     char platform[4];
     if (console_type != CHIAKI_HOLEPUNCH_CONSOLE_TYPE_PS5) {
         CHIAKI_LOGW(log, "Only PS5 is supported by the list devices function!");
@@ -452,7 +508,8 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_list_devices(
         return CHIAKI_ERR_INVALID_DATA;
     }
     snprintf(platform, sizeof(platform), "%s", "PS5");
-    snprintf(url, sizeof(url), device_list_url_fmt, platform);
+    snprintf(psn_url, sizeof(psn_url), device_list_url_fmt, platform);
+    endpoint_url(url, sizeof(url), psn_url);
 
     char* oauth_header = NULL;
     ChiakiErrorCode err = make_oauth2_header(&oauth_header, psn_oauth2_token);
@@ -687,6 +744,36 @@ CHIAKI_EXPORT chiaki_socket_t *chiaki_get_holepunch_sock(ChiakiHolepunchSession
 
 }
 
+CHIAKI_EXPORT void chiaki_holepunch_session_set_candidate_hint(Session *session, const ChiakiHolepunchCandidateHint *hint)
+{
+    session->candidate_hint_valid = hint && hint->addr[0];
+    if(session->candidate_hint_valid)
+    {
+        session->candidate_hint = *hint;
+        session->candidate_hint.addr[sizeof(session->candidate_hint.addr) - 1] = '\0';
+    }
+}
+
+CHIAKI_EXPORT bool chiaki_holepunch_session_get_candidate_hint(Session *session, ChiakiHolepunchCandidateHint *hint)
+{
+    if(!session->candidate_hint_valid)
+        return false;
+    *hint = session->candidate_hint;
+    return true;
+}
+
+CHIAKI_EXPORT void chiaki_holepunch_session_set_stun_cache(Session *session, ChiakiStunCache *cache)
+{
+    session->stun_cache = cache;
+}
+
+CHIAKI_EXPORT void chiaki_holepunch_session_get_notification_stats(Session *session, ChiakiHolepunchNotificationStats *stats)
+{
+    chiaki_mutex_lock(&session->notif_mutex);
+    *stats = session->notif_stats;
+    chiaki_mutex_unlock(&session->notif_mutex);
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_generate_client_device_uid(
     char *out, size_t *out_size)
 {
@@ -719,12 +806,10 @@ CHIAKI_EXPORT Session* chiaki_holepunch_session_init(
     session->log = log;
 
     session->ws_fqdn = NULL;
-    session->ws_notification_queue = createNq();
-    if(!session->ws_notification_queue)
-    {
-        free(session);
-        return NULL;
-    }
+    memset(&session->notif_ring, 0, sizeof(session->notif_ring));
+    session->notif_waiting_types = 0;
+    memset(&session->notif_stats, 0, sizeof(session->notif_stats));
+    session->notif_latency_sum_us = 0;
     session->local_candidates = NULL;
     session->our_offer_msg = NULL;
     session->ws_open = false;
@@ -737,6 +822,8 @@ CHIAKI_EXPORT Session* chiaki_holepunch_session_init(
     session->data_sock = CHIAKI_INVALID_SOCKET;
     session->ipv4_sock = CHIAKI_INVALID_SOCKET;
     session->ipv6_sock = CHIAKI_INVALID_SOCKET;
+    session->candidate_hint_valid = false;
+    session->stun_cache = NULL;
     session->sid_console = 0;
     session->local_req_id = 1;
     session->local_port_ctrl = 0;
@@ -914,6 +1001,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_create(Session* session)
             if (!online_id_json)
             {
                 CHIAKI_LOGE(session->log, "chiaki_holepunch_session_create: could not extra PSN online id string.");
+                clear_notification(session, notif);
                 err = CHIAKI_ERR_UNKNOWN;
                 return err;
             }
@@ -921,6 +1009,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_create(Session* session)
             if(!session->online_id)
             {
                 CHIAKI_LOGE(session->log, "chiaki_holepunch_session_create: could not allocate space for PSN online id string.");
+                clear_notification(session, notif);
                 err = CHIAKI_ERR_MEMORY;
                 return err;
             }
@@ -934,6 +1023,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_create(Session* session)
         else
         {
             CHIAKI_LOGE(session->log, "chiaki_holepunch_session_create: Got unexpected notification of type %d", notif->type);
+            clear_notification(session, notif);
             err = CHIAKI_ERR_UNKNOWN;
             return err;
         }
@@ -943,6 +1033,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_create(Session* session)
             session->main_should_stop = false;
             chiaki_mutex_unlock(&session->stop_mutex);
             CHIAKI_LOGI(session->log, "chiaki_holepunch_session_create: canceled");
+            clear_notification(session, notif);
             err = CHIAKI_ERR_CANCELED;
             return err;
         }
@@ -953,7 +1044,9 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_create(Session* session)
                         (session->state & SESSION_STATE_CLIENT_JOINED);
         chiaki_mutex_unlock(&session->state_mutex);
         clear_notification(session, notif);
+        notif = NULL;
     }
+    clear_notification(session, notif);
     return err;
 }
 
@@ -1114,6 +1207,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_start(
             break;
         }
         clear_notification(session, notif);
+        notif = NULL;
         chiaki_mutex_lock(&session->stop_mutex);
         if(session->main_should_stop)
         {
@@ -1130,6 +1224,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_start(
         log_session_state(session);
         chiaki_mutex_unlock(&session->state_mutex);
     }
+    clear_notification(session, notif);
     chiaki_mutex_unlock(&session->state_mutex);
     return err;
 }
@@ -1174,7 +1269,9 @@ static ChiakiErrorCode http_ps4_session_wakeup(Session *session)
     res = curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
     if(res != CURLE_OK)
         CHIAKI_LOGW(session->log, "http_ps4_session_wakeup: CURL setopt CURLOPT_TIMEOUT failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_URL, user_profile_url);
+    char profile_url[256];
+    endpoint_url(profile_url, sizeof(profile_url), user_profile_url);
+    res = curl_easy_setopt(curl, CURLOPT_URL, profile_url);
     if(res != CURLE_OK)
         CHIAKI_LOGW(session->log, "http_ps4_session_wakeup: CURL setopt CURLOPT_URL failed with CURL error %s", curl_easy_strerror(res));
     res = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
@@ -1433,7 +1530,6 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_punch_hole(Session* sessi
         .req_id = console_offer_msg->req_id,
         .error = 0,
         .conn_request = NULL,
-        .notification = NULL,
     };
     err = http_send_session_message(session, &ack_msg, true);
     if(err != CHIAKI_ERR_SUCCESS)
@@ -1546,7 +1642,6 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_punch_hole(Session* sessi
         .req_id = msg->req_id,
         .error = 0,
         .conn_request = NULL,
-        .notification = NULL,
     };
     err = http_send_session_message(session, &accept_ack_msg, true);
     if(err != CHIAKI_ERR_SUCCESS)
@@ -1671,6 +1766,7 @@ CHIAKI_EXPORT void chiaki_holepunch_session_fini(Session* session)
             else
             {
                 CHIAKI_LOGE(session->log, "chiaki_holepunch_session_fini: Got unexpected notification of type %d", notif->type);
+                clear_notification(session, notif);
                 err = CHIAKI_ERR_UNKNOWN;
                 break;
             }
@@ -1711,12 +1807,14 @@ CHIAKI_EXPORT void chiaki_holepunch_session_fini(Session* session)
         curl_share_cleanup(session->curl_share);
     if (session->ws_fqdn)
         free(session->ws_fqdn);
-    if (session->ws_notification_queue)
-    {
-        chiaki_mutex_lock(&session->notif_mutex);
-        notification_queue_free(session->ws_notification_queue);
-        chiaki_mutex_unlock(&session->notif_mutex);
-    }
+    chiaki_mutex_lock(&session->notif_mutex);
+    notification_ring_clear(&session->notif_ring);
+    ChiakiHolepunchNotificationStats *stats = &session->notif_stats;
+    if(stats->received)
+        CHIAKI_LOGI(session->log, "Holepunch notifications: %llu received, %llu filtered, %llu overflowed, %llu delivered, latency avg %.3f ms max %.3f ms",
+            (unsigned long long)stats->received, (unsigned long long)stats->filtered, (unsigned long long)stats->overflowed,
+            (unsigned long long)stats->delivered, stats->latency_avg_us / 1000.0, stats->latency_max_us / 1000.0);
+    chiaki_mutex_unlock(&session->notif_mutex);
     for(int i=0; i < session->num_stun_servers; i++)
     {
         free(session->stun_server_list[i].host);
@@ -1749,14 +1847,6 @@ CHIAKI_EXPORT void chiaki_holepunch_main_thread_cancel(Session *session, bool st
     chiaki_cond_signal(&session->state_cond);
 }
 
-void notification_queue_free(NotificationQueue *nq)
-{
-    while(nq->front != NULL)
-    {
-        dequeueNq(nq);
-    }
-}
-
 static ChiakiErrorCode make_oauth2_header(char** out, const char* token)
 {
     size_t oauth_header_len = sizeof(oauth_header_fmt) + strlen(token) + 1;
@@ -1811,7 +1901,9 @@ static ChiakiErrorCode get_websocket_fqdn(Session *session, char **fqdn)
     res = curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
     if(res != CURLE_OK)
         CHIAKI_LOGW(session->log, "get_websocket_fqdn: CURL setopt CURLOPT_TIMEOUT failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_URL, ws_fqdn_api_url);
+    char url[256];
+    endpoint_url(url, sizeof(url), ws_fqdn_api_url);
+    res = curl_easy_setopt(curl, CURLOPT_URL, url);
     if(res != CURLE_OK)
         CHIAKI_LOGW(session->log, "get_websocket_fqdn: CURL setopt CURLOPT_URL failed with CURL error %s", curl_easy_strerror(res));
     res = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
@@ -1833,10 +1925,10 @@ static ChiakiErrorCode get_websocket_fqdn(Session *session, char **fqdn)
         {
             long http_code = 0;
             curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-            CHIAKI_LOGE(session->log, "get_websocket_fqdn: Fetching websocket FQDN from %s failed with HTTP code %ld", ws_fqdn_api_url, http_code);
+            CHIAKI_LOGE(session->log, "get_websocket_fqdn: Fetching websocket FQDN from %s failed with HTTP code %ld", url, http_code);
             err = CHIAKI_ERR_HTTP_NONOK;
         } else {
-            CHIAKI_LOGE(session->log, "get_websocket_fqdn: Fetching websocket FQDN from %s failed with CURL error %s", ws_fqdn_api_url, curl_easy_strerror(res));
+            CHIAKI_LOGE(session->log, "get_websocket_fqdn: Fetching websocket FQDN from %s failed with CURL error %s", url, curl_easy_strerror(res));
             err = CHIAKI_ERR_NETWORK;
         }
         goto cleanup;
@@ -1964,7 +2056,9 @@ static void* websocket_thread_func(void *user) {
     Session* session = (Session*) user;
 
     char ws_url[128] = {0};
-    snprintf(ws_url, sizeof(ws_url), "wss://%s/np/pushNotification", session->ws_fqdn);
+    // plain websocket if the endpoints were redirected to a plain http server
+    bool insecure = strncmp(url_base, "http://", strlen("http://")) == 0;
+    snprintf(ws_url, sizeof(ws_url), "%s://%s/np/pushNotification", insecure ? "ws" : "wss", session->ws_fqdn);
 
     CURL* curl = curl_easy_init();
     if(!curl)
@@ -2089,7 +2183,6 @@ static void* websocket_thread_func(void *user) {
             expecting_pong = true;
         }
 
-        memset(buf, 0, WEBSOCKET_MAX_FRAME_SIZE);
         res = curl_ws_recv(curl, buf, WEBSOCKET_MAX_FRAME_SIZE, &rlen, &meta);
         if (res != CURLE_OK)
         {
@@ -2140,25 +2233,22 @@ static void* websocket_thread_func(void *user) {
         if (meta->flags & CURLWS_TEXT || meta->flags & CURLWS_BINARY)
         {
             CHIAKI_LOGV(session->log, "websocket_thread_func: Received WebSocket frame with %zu bytes of payload.", rlen);
-            json_object *json = json_tokener_parse_ex(tok, buf, rlen);
-            if (json == NULL)
-            {
-                CHIAKI_LOGE(session->log, "websocket_thread_func: Parsing JSON from payload failed");
-                CHIAKI_LOGV(session->log, "websocket_thread_func: Payload was:\n%s", buf);
-                continue;
-            }
-            CHIAKI_LOGV(session->log, json_object_to_json_string_ext(json, JSON_C_TO_STRING_PRETTY));
-
-            NotificationType type = parse_notification_type(session->log, json);
-            char *json_buf = malloc(rlen);
-            if(!json_buf)
-                goto cleanup_json;
-            memcpy(json_buf, buf, rlen);
-            size_t json_buf_size = rlen;
-            CHIAKI_LOGV(session->log, "Received notification of type %d", type);
-            Notification *notif = newNotification(type, json, json_buf, json_buf_size);
-            if(!notif)
+            Notification notif = {
+                .type = NOTIFICATION_TYPE_UNKNOWN,
+                .json = NULL,
+                .json_buf = malloc(rlen + 1),
+                .json_buf_size = rlen,
+                .received_us = chiaki_time_now_monotonic_us(),
+            };
+            if(!notif.json_buf)
                 goto cleanup_json;
+            memcpy(notif.json_buf, buf, rlen);
+            notif.json_buf[rlen] = '\0';
+            CHIAKI_LOGV(session->log, "websocket_thread_func: Payload:\n%s", notif.json_buf);
+
+            // Classify from the raw text so notifications nobody waits for are never parsed
+            notif.type = parse_notification_type(session->log, notif.json_buf);
+            CHIAKI_LOGV(session->log, "Received notification of type %d", notif.type);
 
             // Automatically ACK OFFER session messages if we're not currently explicitly
             // waiting on offers
@@ -2170,16 +2260,21 @@ static void* websocket_thread_func(void *user) {
                  && !(session->state & SESSION_STATE_CTRL_ESTABLISHED))
                  // At this point all offers were received and we don't care for new ones anymore
                 || session->state & SESSION_STATE_DATA_OFFER_RECEIVED;
+            uint16_t interest = notification_interest(session);
             chiaki_mutex_unlock(&session->state_mutex);
-            if (should_ack_offers && notif->type == NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED)
+            if (should_ack_offers && notif.type == NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED)
             {
+                json_tokener_reset(tok);
+                json_object *json = json_tokener_parse_ex(tok, notif.json_buf, rlen);
                 SessionMessage *msg = NULL;
-                json_object *payload = session_message_get_payload(session->log, json);
-                err = session_message_parse(session->log, payload, &msg);
+                json_object *payload = json ? session_message_get_payload(session->log, json) : NULL;
+                err = payload ? session_message_parse(session->log, payload, &msg) : CHIAKI_ERR_INVALID_DATA;
                 json_object_put(payload);
                 if (err != CHIAKI_ERR_SUCCESS)
                 {
                     CHIAKI_LOGE(session->log, "websocket_thread_func: Failed to parse session message for ACKing.");
+                    json_object_put(json);
+                    free(notif.json_buf);
                     continue;
                 }
                 if (msg->action == SESSION_MESSAGE_ACTION_OFFER)
@@ -2189,18 +2284,37 @@ static void* websocket_thread_func(void *user) {
                         .req_id = msg->req_id,
                         .error = 0,
                         .conn_request = NULL,
-                        .notification = NULL,
                     };
                     http_send_session_message(session, &ack_msg, true);
                 }
                 session_message_free(msg);
+                // the state machine would parse it again anyway
+                notif.json = json;
             }
+
+            NotificationType type = notif.type;
             ChiakiErrorCode mutex_err = chiaki_mutex_lock(&session->notif_mutex);
             assert(mutex_err == CHIAKI_ERR_SUCCESS);
-            enqueueNq(session->ws_notification_queue, notif);
-            chiaki_cond_signal(&session->notif_cond);
+            session->notif_stats.received++;
+            if (!(type & interest))
+            {
+                CHIAKI_LOGV(session->log, "websocket_thread_func: Dropping notification of type %d, nobody is waiting for it", type);
+                session->notif_stats.filtered++;
+                json_object_put(notif.json);
+                free(notif.json_buf);
+            }
+            else
+            {
+                if (!notification_ring_push(&session->notif_ring, &notif))
+                {
+                    CHIAKI_LOGW(session->log, "websocket_thread_func: Notification ring overflowed, dropped the oldest notification");
+                    session->notif_stats.overflowed++;
+                }
+                if (type & session->notif_waiting_types)
+                    chiaki_cond_signal(&session->notif_cond);
+            }
             chiaki_mutex_unlock(&session->notif_mutex);
-            if (notif->type == NOTIFICATION_TYPE_SESSION_DELETED)
+            if (type == NOTIFICATION_TYPE_SESSION_DELETED)
             {
                 CHIAKI_LOGI(session->log, "websocket_thread_func: Holepunch session was deleted on PSN server, exiting....");
                 goto cleanup_json;
@@ -2218,45 +2332,80 @@ cleanup:
     return NULL;
 }
 
+static const struct
+{
+    const char *data_type;
+    NotificationType type;
+} notification_types[] = {
+    { "psn:sessionManager:sys:remotePlaySession:created", NOTIFICATION_TYPE_SESSION_CREATED },
+    { "psn:sessionManager:sys:rps:members:created", NOTIFICATION_TYPE_MEMBER_CREATED },
+    { "psn:sessionManager:sys:rps:customData1:updated", NOTIFICATION_TYPE_CUSTOM_DATA1_UPDATED },
+    { "psn:sessionManager:sys:rps:sessionMessage:created", NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED },
+    { "psn:sessionManager:sys:rps:members:deleted", NOTIFICATION_TYPE_MEMBER_DELETED },
+    { "psn:sessionManager:sys:remotePlaySession:deleted", NOTIFICATION_TYPE_SESSION_DELETED },
+};
+
+/**
+ * Get the type of a notification from the "dataType" field of its raw json text,
+ * without parsing the whole notification.
+ *
+ * @param[in] log Pointer to a ChiakiLog object for logging
+ * @param[in] buf Null-terminated json text of the notification
+*/
 static NotificationType parse_notification_type(
-    ChiakiLog *log, json_object* json
+    ChiakiLog *log, const char *buf
 ) {
-    json_object* datatype;
-    if (!json_object_object_get_ex(json, "dataType", &datatype))
+    const char *datatype = strstr(buf, "\"dataType\"");
+    if (!datatype)
     {
         CHIAKI_LOGE(log, "parse_notification_type: JSON does not contain \"datatype\" field\n");
         return NOTIFICATION_TYPE_UNKNOWN;
-    } else if (!json_object_is_type(datatype, json_type_string))
+    }
+    datatype += strlen("\"dataType\"");
+    while (*datatype == ' ' || *datatype == '\t' || *datatype == '\r' || *datatype == '\n' || *datatype == ':')
+        datatype++;
+    if (*datatype != '"')
     {
         CHIAKI_LOGE(log, "parse_notification_type: JSON \"datatype\" field is not a string\n");
         return NOTIFICATION_TYPE_UNKNOWN;
     }
-    const char* datatype_str = json_object_get_string(datatype);
-
-    if (strcmp(datatype_str, "psn:sessionManager:sys:remotePlaySession:created") == 0)
-    {
-        return NOTIFICATION_TYPE_SESSION_CREATED;
-    } else if (strcmp(datatype_str, "psn:sessionManager:sys:rps:members:created") == 0)
-    {
-        return NOTIFICATION_TYPE_MEMBER_CREATED;
-    } else if (strcmp(datatype_str, "psn:sessionManager:sys:rps:customData1:updated") == 0)
-    {
-        return NOTIFICATION_TYPE_CUSTOM_DATA1_UPDATED;
-    } else if (strcmp(datatype_str, "psn:sessionManager:sys:rps:sessionMessage:created") == 0)
-    {
-        return NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED;
-    } else if (strcmp(datatype_str, "psn:sessionManager:sys:rps:members:deleted") == 0)
+    datatype++;
+    const char *datatype_end = strchr(datatype, '"');
+    if (!datatype_end)
     {
-        return NOTIFICATION_TYPE_MEMBER_DELETED;
-    } else if (strcmp(datatype_str, "psn:sessionManager:sys:remotePlaySession:deleted") == 0)
-    {
-        return NOTIFICATION_TYPE_SESSION_DELETED;
-    }else
-    {
-        CHIAKI_LOGW(log, "parse_notification_type: Unknown notification type \"%s\"", datatype_str);
-        CHIAKI_LOGV(log, "parse_notification_type: JSON was:\n%s", json_object_to_json_string_ext(json, JSON_C_TO_STRING_PRETTY));
+        CHIAKI_LOGE(log, "parse_notification_type: JSON \"datatype\" field is not terminated\n");
         return NOTIFICATION_TYPE_UNKNOWN;
     }
+    size_t datatype_len = datatype_end - datatype;
+
+    for (size_t i = 0; i < sizeof(notification_types) / sizeof(notification_types[0]); i++)
+    {
+        if (strlen(notification_types[i].data_type) == datatype_len
+            && memcmp(notification_types[i].data_type, datatype, datatype_len) == 0)
+            return notification_types[i].type;
+    }
+    CHIAKI_LOGW(log, "parse_notification_type: Unknown notification type \"%.*s\"", (int)datatype_len, datatype);
+    CHIAKI_LOGV(log, "parse_notification_type: JSON was:\n%s", buf);
+    return NOTIFICATION_TYPE_UNKNOWN;
+}
+
+/**
+ * Get the notification types the state machine may still wait for.
+ *
+ * Must be called with state_mutex locked.
+*/
+static uint16_t notification_interest(Session *session)
+{
+    uint16_t types = NOTIFICATION_TYPE_MEMBER_DELETED | NOTIFICATION_TYPE_SESSION_DELETED;
+    if (!(session->state & SESSION_STATE_CREATED))
+        types |= NOTIFICATION_TYPE_SESSION_CREATED;
+    if (!(session->state & SESSION_STATE_CONSOLE_JOINED))
+        types |= NOTIFICATION_TYPE_MEMBER_CREATED;
+    if (!(session->state & SESSION_STATE_CUSTOMDATA1_RECEIVED))
+        types |= NOTIFICATION_TYPE_CUSTOM_DATA1_UPDATED;
+    if (!(session->state & SESSION_STATE_DATA_ESTABLISHED))
+        types |= NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED;
+    return types;
 }
 
 
@@ -2377,7 +2526,6 @@ CHIAKI_EXPORT ChiakiErrorCode holepunch_session_create_offer(Session *session)
         .req_id = our_offer_msg_req_id,
         .error = 0,
         .conn_request = malloc(sizeof(ConnectionRequest)),
-        .notification = NULL,
     };
     if(!msg.conn_request)
     {
@@ -2704,7 +2852,6 @@ static ChiakiErrorCode send_accept(Session *session, int req_id, Candidate *sele
         .req_id = req_id,
         .error = 0,
         .conn_request = calloc(1, sizeof(ConnectionRequest)),
-        .notification = NULL,
     };
     if(!msg.conn_request)
         return CHIAKI_ERR_MEMORY;
@@ -2767,7 +2914,9 @@ static ChiakiErrorCode http_create_session(Session *session)
     res = curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
     if(res != CURLE_OK)
         CHIAKI_LOGW(session->log, "http_create_session: CURL setopt CURLOPT_FAILONERROR failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_URL, session_create_url);
+    char url[256];
+    endpoint_url(url, sizeof(url), session_create_url);
+    res = curl_easy_setopt(curl, CURLOPT_URL, url);
     if(res != CURLE_OK)
         CHIAKI_LOGW(session->log, "http_create_session: CURL setopt CURLOPT_URL failed with CURL error %s", curl_easy_strerror(res));
     res = curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
@@ -2892,7 +3041,9 @@ static ChiakiErrorCode http_check_session(Session *session, bool viewurl)
     res = curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
     if(res != CURLE_OK)
         CHIAKI_LOGW(session->log, "http_check_session: CURL setopt CURLOPT_FAILONERROR failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_URL, viewurl ? session_view_url : session_create_url);
+    char url[256];
+    endpoint_url(url, sizeof(url), viewurl ? session_view_url : session_create_url);
+    res = curl_easy_setopt(curl, CURLOPT_URL, url);
     if(res != CURLE_OK)
         CHIAKI_LOGW(session->log, "http_check_session: CURL setopt CURLOPT_URL failed with CURL error %s", curl_easy_strerror(res));
     res = curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
@@ -3014,7 +3165,9 @@ static ChiakiErrorCode http_start_session(Session *session)
     res = curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
     if(res != CURLE_OK)
         CHIAKI_LOGW(session->log, "http_start_session: CURL setopt CURLOPT_FAILONERROR failed with CURL error %s", curl_easy_strerror(res));
-    res = curl_easy_setopt(curl, CURLOPT_URL, session_command_url);
+    char url[256];
+    endpoint_url(url, sizeof(url), session_command_url);
+    res = curl_easy_setopt(curl, CURLOPT_URL, url);
     if(res != CURLE_OK)
         CHIAKI_LOGW(session->log, "http_start_session: CURL setopt CURLOPT_URL failed with CURL error %s", curl_easy_strerror(res));
     res = curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
@@ -3096,8 +3249,10 @@ static ChiakiErrorCode http_send_session_message(Session *session, SessionMessag
         .size = 0,
     };
 
-    char url[128] = {0};
-    snprintf(url, sizeof(url), session_message_url_fmt, session->session_id);
+    char psn_url[128] = {0};
+    snprintf(psn_url, sizeof(psn_url), session_message_url_fmt, session->session_id);
+    char url[256] = {0};
+    endpoint_url(url, sizeof(url), psn_url);
 
     char console_uid_str[sizeof(session->console_uid) * 2 + 1] = {0};
     bytes_to_hex(session->console_uid, sizeof(session->console_uid), console_uid_str, sizeof(console_uid_str));
@@ -3193,8 +3348,10 @@ static ChiakiErrorCode deleteSession(Session *session)
         .size = 0,
     };
 
-    char url[128] = {0};
-    snprintf(url, sizeof(url), delete_messsage_url_fmt, session->session_id);
+    char psn_url[128] = {0};
+    snprintf(psn_url, sizeof(psn_url), delete_messsage_url_fmt, session->session_id);
+    char url[256] = {0};
+    endpoint_url(url, sizeof(url), psn_url);
 
     CURL *curl = curl_easy_init();
     if(!curl)
@@ -3499,6 +3656,38 @@ static bool upnp_delete_udp_port_mapping(ChiakiLog *log, UPNPGatewayInfo *gw_inf
 */
 static bool get_client_addr_remote_stun(Session *session, char *address, uint16_t *port, chiaki_socket_t *sock, bool ipv4)
 {
+    uint16_t local_port = 0;
+    struct sockaddr_storage local_addr;
+    socklen_t local_addr_len = sizeof(local_addr);
+    if(!CHIAKI_SOCKET_IS_INVALID(*sock) && getsockname(*sock, (struct sockaddr *)&local_addr, &local_addr_len) == 0)
+    {
+        if(local_addr.ss_family == AF_INET)
+            local_port = ntohs(((struct sockaddr_in *)&local_addr)->sin_port);
+        else if(local_addr.ss_family == AF_INET6)
+            local_port = ntohs(((struct sockaddr_in6 *)&local_addr)->sin6_port);
+    }
+
+    // the local LAN address identifies the network we are on for both families
+    ChiakiStunCacheEntry cached;
+    bool cache_hit = session->stun_cache && session->client_local_ip[0]
+        && chiaki_stun_cache_get(session->stun_cache, ipv4, session->client_local_ip, &cached);
+    if(cache_hit)
+    {
+        if(ipv4 && session->stun_allocation_increment == -1)
+        {
+            session->stun_allocation_increment = cached.allocation_increment;
+            session->stun_random_allocation = cached.random_allocation;
+        }
+        if(local_port && chiaki_stun_cache_entry_port_preserving(&cached))
+        {
+            CHIAKI_LOGI(session->log, "get_client_addr_remote_stun: NAT on %s preserves ports, using cached address %s and skipping STUN", session->client_local_ip, cached.addr);
+            memcpy(address, cached.addr, sizeof(cached.addr));
+            *port = local_port;
+            return true;
+        }
+        CHIAKI_LOGI(session->log, "get_client_addr_remote_stun: Using cached NAT allocation increment %d for %s, only querying the external port", (int)cached.allocation_increment, session->client_local_ip);
+    }
+
     // run STUN test if it hasn't been run yet
     if(session->stun_allocation_increment == -1)
     {
@@ -3507,16 +3696,15 @@ static bool get_client_addr_remote_stun(Session *session, char *address, uint16_
         {
             CHIAKI_LOGW(session->log, "Getting stun servers returned error %s", chiaki_error_string(err));
         }
-        if (!stun_port_allocation_test(session->log, address, port, &session->stun_allocation_increment, &session->stun_random_allocation, session->stun_server_list, session->num_stun_servers, sock))
+        if (!stun_port_allocation_test(session->log, address, port, &session->stun_allocation_increment, &session->stun_random_allocation, session->stun_server_list, session->num_stun_servers, sock, &session->select_pipe))
         {
             CHIAKI_LOGE(session->log, "get_client_addr_remote_stun: Failed to get external address");
             return false;
         }
-        return true;
     }
-    if(ipv4)
+    else if(ipv4)
     {
-        if (!stun_get_external_address(session->log, address, port, session->stun_server_list, session->num_stun_servers, sock, ipv4))
+        if (!stun_get_external_address(session->log, address, port, session->stun_server_list, session->num_stun_servers, sock, ipv4, &session->select_pipe))
         {
             CHIAKI_LOGE(session->log, "get_client_addr_remote_stun: Failed to get external address");
             return false;
@@ -3524,12 +3712,27 @@ static bool get_client_addr_remote_stun(Session *session, char *address, uint16_
     }
     else
     {
-        if (!stun_get_external_address(session->log, address, port, session->stun_server_list_ipv6, session->num_stun_servers_ipv6, sock, ipv4))
+        if (!stun_get_external_address(session->log, address, port, session->stun_server_list_ipv6, session->num_stun_servers_ipv6, sock, ipv4, &session->select_pipe))
         {
             CHIAKI_LOGE(session->log, "get_client_addr_remote_stun: Failed to get external address");
             return false;
         }
     }
+
+    if(session->stun_cache && session->client_local_ip[0] && local_port)
+    {
+        ChiakiStunCacheEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.ipv4 = ipv4;
+        memcpy(entry.local_addr, session->client_local_ip, sizeof(entry.local_addr));
+        entry.local_port = local_port;
+        memcpy(entry.addr, address, sizeof(entry.addr));
+        entry.addr[sizeof(entry.addr) - 1] = '\0';
+        entry.port = *port;
+        entry.allocation_increment = ipv4 ? session->stun_allocation_increment : 0;
+        entry.random_allocation = ipv4 && session->stun_random_allocation;
+        chiaki_stun_cache_put(session->stun_cache, &entry);
+    }
     return true;
 }
 
@@ -3583,15 +3786,306 @@ static bool get_client_addr_remote_stun(Session *session, char *address, uint16_
 //     return true;
 // }
 
+/**
+ * Per candidate state of the candidate race
+ */
+typedef struct candidate_probe_t
+{
+    chiaki_socket_t sock; // socket requests to this candidate go out from
+    unsigned int sends;
+    uint64_t first_send_us;
+    uint64_t last_send_us;
+    uint64_t next_send_us; // UINT64_MAX if nothing is scheduled
+    uint64_t rtt_us; // 0 until a response arrived
+} CandidateProbe;
+
+/**
+ * Waits on all sockets of a candidate race at once
+ *
+ * Sockets are referred to by index (0 = ipv4_sock, 1 = ipv6_sock, 2... = random allocation sockets)
+ * and looked up again after every wait, so sockets closed during the race simply drop out.
+ */
+typedef struct candidate_race_t
+{
+    Session *session;
+    chiaki_socket_t *socks;
+    size_t socks_count;
+#ifdef __linux__
+    int epoll_fd;
+#endif
+} CandidateRace;
+
+#define CANDIDATE_RACE_STOP_INDEX UINT32_MAX
+
+static void candidate_probe_init(CandidateProbe *probe, chiaki_socket_t sock)
+{
+    probe->sock = sock;
+    probe->sends = 0;
+    probe->first_send_us = 0;
+    probe->last_send_us = 0;
+    probe->next_send_us = UINT64_MAX;
+    probe->rtt_us = 0;
+}
+
+/**
+ * Send a request to a candidate and schedule its retransmission with exponential backoff
+ */
+static bool candidate_probe_send(Session *session, CandidateProbe *probe, Candidate *candidate, chiaki_socket_t sock,
+    uint8_t *buf, size_t buf_size, struct sockaddr *addr, socklen_t addr_len, uint64_t now_us)
+{
+    if(probe->sends == 0)
+        probe->first_send_us = now_us;
+    probe->last_send_us = now_us;
+    uint64_t rto_ms = CANDIDATE_RTO_INITIAL_MS << (probe->sends < 8 ? probe->sends : 8);
+    if(rto_ms > CANDIDATE_RTO_MAX_MS)
+        rto_ms = CANDIDATE_RTO_MAX_MS;
+    probe->next_send_us = now_us + rto_ms * MILLISECONDS_US;
+    probe->sends++;
+
+    if(CHIAKI_SOCKET_IS_INVALID(sock))
+        return false;
+    if (sendto(sock, (CHIAKI_SOCKET_BUF_TYPE) buf, buf_size, 0, addr, addr_len) < 0)
+    {
+        CHIAKI_LOGW(session->log, "check_candidates: Sending request failed for %s:%d with error: " CHIAKI_SOCKET_ERROR_FMT, candidate->addr, candidate->port, CHIAKI_SOCKET_ERROR_VALUE);
+        return false;
+    }
+    return true;
+}
+
+static chiaki_socket_t candidate_family_sock(Session *session, struct sockaddr *addr)
+{
+    switch(addr->sa_family)
+    {
+        case AF_INET:
+            return session->ipv4_sock;
+        case AF_INET6:
+            return session->ipv6_sock;
+        default:
+            return CHIAKI_INVALID_SOCKET;
+    }
+}
+
+static int candidate_priority(Candidate *candidate, const ChiakiHolepunchCandidateHint *hint)
+{
+    if(hint && strcmp(candidate->addr, hint->addr) == 0)
+        return candidate->port == hint->port ? 0 : 1;
+    switch(candidate->type)
+    {
+        case CANDIDATE_TYPE_LOCAL:
+            return 2;
+        case CANDIDATE_TYPE_STATIC:
+            return 3;
+        case CANDIDATE_TYPE_STUN:
+            return 4;
+        default:
+            return 5;
+    }
+}
+
+/**
+ * Order in which the candidates are started, RFC 8305 style:
+ * sorted by priority (previous winner first, then local, static and STUN candidates),
+ * then interleaved by address family starting with the family of the best candidate.
+ *
+ * @param[out] order Receives the indices of all usable candidates
+ * @return number of indices written to order
+ */
+static size_t candidates_race_order(Candidate *candidates, struct sockaddr_storage *addrs, bool *usable, size_t num_candidates,
+    const ChiakiHolepunchCandidateHint *hint, size_t *order)
+{
+    size_t sorted[num_candidates ? num_candidates : 1];
+    size_t sorted_count = 0;
+    for(size_t i = 0; i < num_candidates; i++)
+    {
+        if(!usable[i])
+            continue;
+        // stable insertion sort
+        int priority = candidate_priority(&candidates[i], hint);
+        size_t j = sorted_count;
+        while(j > 0 && candidate_priority(&candidates[sorted[j - 1]], hint) > priority)
+        {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = i;
+        sorted_count++;
+    }
+    if(!sorted_count)
+        return 0;
+
+    sa_family_t family = addrs[sorted[0]].ss_family;
+    size_t next[2] = { 0, 0 }; // next unused position in sorted for the preferred and the other family
+    for(size_t k = 0; k < sorted_count; k++)
+    {
+        bool other = k % 2 == 1;
+        size_t *pos = &next[other ? 1 : 0];
+        while(*pos < sorted_count && ((addrs[sorted[*pos]].ss_family == family) == other))
+            (*pos)++;
+        if(*pos == sorted_count)
+        {
+            // one family ran out, continue with the other one
+            other = !other;
+            pos = &next[other ? 1 : 0];
+            while(*pos < sorted_count && ((addrs[sorted[*pos]].ss_family == family) == other))
+                (*pos)++;
+        }
+        order[k] = sorted[*pos];
+        (*pos)++;
+    }
+    return sorted_count;
+}
+
+static chiaki_socket_t candidate_race_sock(CandidateRace *race, uint32_t index)
+{
+    if(index == 0)
+        return race->session->ipv4_sock;
+    if(index == 1)
+        return race->session->ipv6_sock;
+    if(index - 2 < race->socks_count)
+        return race->socks[index - 2];
+    return CHIAKI_INVALID_SOCKET;
+}
+
+static ChiakiErrorCode candidate_race_init(CandidateRace *race, Session *session, chiaki_socket_t *socks, size_t socks_count)
+{
+    race->session = session;
+    race->socks = socks;
+    race->socks_count = socks_count;
+#ifdef __linux__
+    race->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(race->epoll_fd < 0)
+    {
+        CHIAKI_LOGE(session->log, "check_candidates: Failed to create epoll instance");
+        return CHIAKI_ERR_UNKNOWN;
+    }
+    struct epoll_event ev = { 0 };
+    ev.events = EPOLLIN;
+    ev.data.u32 = CANDIDATE_RACE_STOP_INDEX;
+    if(epoll_ctl(race->epoll_fd, EPOLL_CTL_ADD, session->select_pipe.fds[0], &ev) < 0)
+        goto error;
+    for(uint32_t i = 0; i < 2 + socks_count; i++)
+    {
+        chiaki_socket_t sock = candidate_race_sock(race, i);
+        if(CHIAKI_SOCKET_IS_INVALID(sock))
+            continue;
+        ev.data.u32 = i;
+        if(epoll_ctl(race->epoll_fd, EPOLL_CTL_ADD, sock, &ev) < 0)
+            goto error;
+    }
+    return CHIAKI_ERR_SUCCESS;
+error:
+    CHIAKI_LOGE(session->log, "check_candidates: Failed to add socket to epoll instance");
+    close(race->epoll_fd);
+    race->epoll_fd = -1;
+    return CHIAKI_ERR_UNKNOWN;
+#else
+    return CHIAKI_ERR_SUCCESS;
+#endif
+}
+
+static void candidate_race_fini(CandidateRace *race)
+{
+#ifdef __linux__
+    if(race->epoll_fd >= 0)
+    {
+        close(race->epoll_fd);
+        race->epoll_fd = -1;
+    }
+#endif
+}
+
+/**
+ * @param[out] ready Receives the indices of readable sockets, must have space for CANDIDATE_RACE_EVENTS_MAX elements
+ * @return CHIAKI_ERR_SUCCESS, CHIAKI_ERR_TIMEOUT, CHIAKI_ERR_CANCELED if the session's select pipe was stopped
+ *         or CHIAKI_ERR_NETWORK
+ */
+static ChiakiErrorCode candidate_race_wait(CandidateRace *race, uint64_t timeout_ms, uint32_t *ready, size_t *ready_count)
+{
+    *ready_count = 0;
+#ifdef __linux__
+    struct epoll_event events[CANDIDATE_RACE_EVENTS_MAX];
+    int n;
+    do
+    {
+        n = epoll_wait(race->epoll_fd, events, CANDIDATE_RACE_EVENTS_MAX, (int)timeout_ms);
+    } while(n < 0 && errno == EINTR);
+    if(n < 0)
+    {
+        CHIAKI_LOGE(race->session->log, "check_candidates: epoll_wait failed with error: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+        return CHIAKI_ERR_NETWORK;
+    }
+    for(int i = 0; i < n; i++)
+    {
+        if(events[i].data.u32 == CANDIDATE_RACE_STOP_INDEX)
+            return CHIAKI_ERR_CANCELED;
+        ready[(*ready_count)++] = events[i].data.u32;
+    }
+#else
+    fd_set fds;
+    FD_ZERO(&fds);
+    chiaki_socket_t maxfd = 0;
+    for(uint32_t i = 0; i < 2 + race->socks_count; i++)
+    {
+        chiaki_socket_t sock = candidate_race_sock(race, i);
+        if(CHIAKI_SOCKET_IS_INVALID(sock))
+            continue;
+        FD_SET(sock, &fds);
+        if(sock > maxfd)
+            maxfd = sock;
+    }
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    int ret = select(maxfd + 1, &fds, NULL, NULL, &tv);
+    if(ret < 0)
+    {
+#ifdef _WIN32
+        if(WSAGetLastError() == WSAEINTR)
+#else
+        if(errno == EINTR)
+#endif
+            return CHIAKI_ERR_TIMEOUT;
+        CHIAKI_LOGE(race->session->log, "check_candidates: Select failed with error: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+        return CHIAKI_ERR_NETWORK;
+    }
+    for(uint32_t i = 0; i < 2 + race->socks_count && *ready_count < CANDIDATE_RACE_EVENTS_MAX; i++)
+    {
+        chiaki_socket_t sock = candidate_race_sock(race, i);
+        if(!CHIAKI_SOCKET_IS_INVALID(sock) && FD_ISSET(sock, &fds))
+            ready[(*ready_count)++] = i;
+    }
+#endif
+    return *ready_count ? CHIAKI_ERR_SUCCESS : CHIAKI_ERR_TIMEOUT;
+}
+
+static const char *candidate_type_string(CandidateType type)
+{
+    switch(type)
+    {
+        case CANDIDATE_TYPE_STATIC:
+            return "static";
+        case CANDIDATE_TYPE_LOCAL:
+            return "local";
+        case CANDIDATE_TYPE_STUN:
+            return "stun";
+        case CANDIDATE_TYPE_DERIVED:
+            return "derived";
+        default:
+            return "unknown";
+    }
+}
+
 /**
  * Linking to a responsive PlayStation candidate from the available console candidates
  *
+ * All candidates are raced against each other: requests are started in the order of candidates_race_order()
+ * CANDIDATE_STAGGER_MS apart and retransmitted per candidate, the first candidate that answers wins.
+ *
  * @param[in] session Pointer to the session context
  * @param[in] local_candidates Pointer to the client's candidates
  * @param[in] candidates Candidates for the console to check against
  * @param[out] out Pointer to the socket where the connection was established with the selected candidate
 */
-
 static ChiakiErrorCode check_candidates(
     Session *session, Candidate* local_candidates, Candidate *candidates_received, size_t num_candidates, chiaki_socket_t *out,
     Candidate *out_candidate)
@@ -3624,7 +4118,8 @@ static ChiakiErrorCode check_candidates(
     Candidate candidates[num_candidates + EXTRA_CANDIDATE_ADDRESSES];
     memcpy(candidates, candidates_received, num_candidates * sizeof(Candidate));
     int responses_received[num_candidates + EXTRA_CANDIDATE_ADDRESSES];
-    fd_set fds;
+    CandidateProbe probes[num_candidates + EXTRA_CANDIDATE_ADDRESSES];
+    size_t order[num_candidates ? num_candidates : 1];
     bool failed = true;
     char service_remote[6];
     struct addrinfo hints;
@@ -3633,6 +4128,9 @@ static ChiakiErrorCode check_candidates(
     hints.ai_family = AF_UNSPEC;
     struct addrinfo *addr_remote;
     chiaki_socket_t socks[RANDOM_ALLOCATION_SOCKS_NUMBER];
+    for (int i=0; i < RANDOM_ALLOCATION_SOCKS_NUMBER; i++)
+        socks[i] = CHIAKI_INVALID_SOCKET;
+    bool usable[num_candidates ? num_candidates : 1];
 
     if(session->stun_random_allocation)
     {
@@ -3713,10 +4211,14 @@ static ChiakiErrorCode check_candidates(
             }
         }
     }
-    for (int i=0; i < num_candidates; i++)
+    for (size_t i=0; i < num_candidates; i++)
     {
         Candidate *candidate = &candidates[i];
         responses_received[i] = 0;
+        usable[i] = false;
+        memset(&addrs[i], 0, sizeof(addrs[i]));
+        lens[i] = 0;
+        candidate_probe_init(&probes[i], CHIAKI_INVALID_SOCKET);
 
         sprintf(service_remote, "%d", candidate->port);
 
@@ -3728,385 +4230,311 @@ static ChiakiErrorCode check_candidates(
         }
         memcpy((struct sockaddr *)&addrs[i], addr_remote->ai_addr, addr_remote->ai_addrlen);
         lens[i] = addr_remote->ai_addrlen;
-        bool sent = false;
-        switch(((struct sockaddr *)&addrs[i])->sa_family)
+        freeaddrinfo(addr_remote);
+        switch(addrs[i].ss_family)
         {
             case AF_INET:
-                if(!CHIAKI_SOCKET_IS_INVALID(session->ipv4_sock))
-                {
-                    if (sendto(session->ipv4_sock, (CHIAKI_SOCKET_BUF_TYPE) request_buf[0], sizeof(request_buf[0]), 0, (struct sockaddr *)&addrs[i], lens[i]) < 0)
-                    {
-                        CHIAKI_LOGW(session->log, "check_candidates: Sending request failed for %s:%d with error: " CHIAKI_SOCKET_ERROR_FMT, candidate->addr, candidate->port, CHIAKI_SOCKET_ERROR_VALUE);
-                        err = CHIAKI_ERR_NETWORK;
-                        freeaddrinfo(addr_remote);
-                        continue;
-                    }
-                }
-                if(session->stun_random_allocation && ((candidate->type == CANDIDATE_TYPE_STATIC && !sent) || candidate->type == CANDIDATE_TYPE_STUN))
-                {
-                    for (int j=0; j<RANDOM_ALLOCATION_SOCKS_NUMBER; j++)
-                    {
-                        if(CHIAKI_SOCKET_IS_INVALID(socks[j]))
-                            continue;
-                        if (sendto(socks[j], (CHIAKI_SOCKET_BUF_TYPE) request_buf[0], sizeof(request_buf[0]), 0, (struct sockaddr *)&addrs[i], lens[i]) < 0)
-                        {
-                            CHIAKI_LOGW(session->log, "check_candidates: Sending request for socket %d failed for %s:%d with error, closing socket: " CHIAKI_SOCKET_ERROR_FMT, j, candidate->addr, candidate->port, CHIAKI_SOCKET_ERROR_VALUE);
-                            if (!CHIAKI_SOCKET_IS_INVALID(socks[j]))
-                            {
-                                CHIAKI_SOCKET_CLOSE(socks[j]);
-                                socks[j] = CHIAKI_INVALID_SOCKET;
-                            }
-                            continue;
-                        }
-                        sent = true;
-                    }
-                }
-                break;
             case AF_INET6:
-                if(!CHIAKI_SOCKET_IS_INVALID(session->ipv6_sock))
-                {
-                    if (sendto(session->ipv6_sock, (CHIAKI_SOCKET_BUF_TYPE) request_buf[0], sizeof(request_buf[0]), 0, (struct sockaddr *)&addrs[i], lens[i]) < 0)
-                    {
-                        CHIAKI_LOGW(session->log, "check_candidates: Sending request failed for %s:%d with error: " CHIAKI_SOCKET_ERROR_FMT, candidate->addr, candidate->port, CHIAKI_SOCKET_ERROR_VALUE);
-                        err = CHIAKI_ERR_NETWORK;
-                        freeaddrinfo(addr_remote);
-                        continue;
-                    }
-                }
+                probes[i].sock = candidate_family_sock(session, (struct sockaddr *)&addrs[i]);
+                usable[i] = !CHIAKI_SOCKET_IS_INVALID(probes[i].sock)
+                    || (session->stun_random_allocation && addrs[i].ss_family == AF_INET);
+                if(!usable[i])
+                    CHIAKI_LOGV(session->log, "check_candidates: No socket for the address family of %s:%d, skipping", candidate->addr, candidate->port);
+                failed = false;
                 break;
             default:
                 CHIAKI_LOGW(session->log, "Unsupported address family, skipping...");
+                break;
         }
-        failed = false;
-        freeaddrinfo(addr_remote);
     }
+
+    CandidateRace race;
+    err = candidate_race_init(&race, session, socks, session->stun_random_allocation ? RANDOM_ALLOCATION_SOCKS_NUMBER : 0);
+    if(err != CHIAKI_ERR_SUCCESS)
+        goto cleanup_sockets;
     if(failed)
     {
         err = CHIAKI_ERR_NETWORK;
         goto cleanup_sockets;
     }
 
+    // Stagger the first request of each candidate, so a reachable candidate with high priority
+    // usually wins before the others were even tried
+    size_t order_count = candidates_race_order(candidates, addrs, usable, num_candidates,
+        session->candidate_hint_valid ? &session->candidate_hint : NULL, order);
+    if(!order_count)
+    {
+        CHIAKI_LOGE(session->log, "check_candidates: No candidate can be reached with the available sockets");
+        err = CHIAKI_ERR_NETWORK;
+        goto cleanup_sockets;
+    }
+    uint64_t race_start_us = chiaki_time_now_monotonic_us();
+    for(size_t k = 0; k < order_count; k++)
+        probes[order[k]].next_send_us = race_start_us + k * CANDIDATE_STAGGER_MS * MILLISECONDS_US;
+    if(session->candidate_hint_valid && order_count && candidate_priority(&candidates[order[0]], &session->candidate_hint) < 2)
+        CHIAKI_LOGI(session->log, "check_candidates: Trying previous winner %s:%d first", candidates[order[0]].addr, candidates[order[0]].port);
+
     // Wait for responses
     uint8_t response_buf[88];
 
     chiaki_socket_t selected_sock = CHIAKI_INVALID_SOCKET;
     Candidate *selected_candidate = NULL;
-    bool received_response = false;
+    CandidateProbe *selected_probe = NULL;
     bool responded = false;
-    bool connecting = false;
-    int retry_counter = 0;
-    chiaki_socket_t maxfd = -1;
-    struct timeval tv;
+    uint64_t deadline_us = race_start_us + CHECK_CANDIDATES_TIMEOUT_MS * MILLISECONDS_US;
 
     while (!selected_candidate)
     {
-        // Reset fd_set before each select() call 
-        FD_ZERO(&fds);
-        maxfd = -1;
-        if(!CHIAKI_SOCKET_IS_INVALID(session->ipv4_sock))
-        {
-            FD_SET(session->ipv4_sock, &fds);
-            maxfd = session->ipv4_sock;
-        }
-        if(!CHIAKI_SOCKET_IS_INVALID(session->ipv6_sock))
-        {
-            FD_SET(session->ipv6_sock, &fds);
-            if(session->ipv6_sock > maxfd)
-                maxfd = session->ipv6_sock;
-        }
-        if(session->stun_random_allocation)
-        {
-            for(int i=0; i<RANDOM_ALLOCATION_SOCKS_NUMBER; i++)
-            {
-                if(socks[i] > maxfd)
-                    maxfd = socks[i];
-                FD_SET(socks[i], &fds);
-            }
-        }
-        maxfd = maxfd + 1;
-        if(connecting)
-        {
-            tv.tv_sec = SELECT_CANDIDATE_CONNECTION_SEC;
-            tv.tv_usec = 0;
-        }
-        else
+        chiaki_mutex_lock(&session->stop_mutex);
+        bool stop = session->main_should_stop;
+        session->main_should_stop = false;
+        chiaki_mutex_unlock(&session->stop_mutex);
+        if(stop)
         {
-            tv.tv_usec = SELECT_CANDIDATE_TIMEOUT_SEC * SECOND_US;
-            tv.tv_sec = 0;
+            CHIAKI_LOGI(session->log, "check_candidates: canceled");
+            err = CHIAKI_ERR_CANCELED;
+            goto cleanup_sockets;
         }
-        int ret = select(maxfd, &fds, NULL, NULL, &tv);
-#ifdef _WIN32
-	    if (ret < 0 && WSAGetLastError() != WSAEINTR)
-#else
-	    if (ret < 0 && errno != EINTR)
-#endif
+
+        uint64_t now_us = chiaki_time_now_monotonic_us();
+        if(now_us >= deadline_us)
         {
-            CHIAKI_LOGE(session->log, "check_candidates: Select failed with error: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-            err = CHIAKI_ERR_NETWORK;
+            CHIAKI_LOGE(session->log, "check_candidates: No candidate answered within %d ms", CHECK_CANDIDATES_TIMEOUT_MS);
+            err = CHIAKI_ERR_HOST_UNREACH;
             goto cleanup_sockets;
-        } else if (ret == 0)
+        }
+
+        // Start and retransmit everything that is due
+        uint64_t wakeup_us = deadline_us;
+        for (size_t i=0; i < num_candidates + extra_addresses_used; i++)
         {
-            if (CHIAKI_SOCKET_IS_INVALID(selected_sock))
+            CandidateProbe *probe = &probes[i];
+            if(probe->next_send_us <= now_us)
             {
-                if(retry_counter < SELECT_CANDIDATE_TRIES && !received_response)
+                Candidate *candidate = &candidates[i];
+                bool first = probe->sends == 0;
+                candidate_probe_send(session, probe, candidate, probe->sock, request_buf[0], sizeof(request_buf[0]), (struct sockaddr *)&addrs[i], lens[i], now_us);
+                if(first && session->stun_random_allocation && addrs[i].ss_family == AF_INET
+                    && (candidate->type == CANDIDATE_TYPE_STATIC || candidate->type == CANDIDATE_TYPE_STUN))
                 {
-                    retry_counter++;
-                    Candidate *candidate = NULL;
-                    chiaki_socket_t sock = CHIAKI_INVALID_SOCKET;
-                    CHIAKI_LOGI(session->log, "check_candidates: Resending requests to all candidates TRY %d... waiting for 1st response", retry_counter);
-                    for (int i=0; i < num_candidates + extra_addresses_used; i++)
+                    for (int j=0; j<RANDOM_ALLOCATION_SOCKS_NUMBER; j++)
                     {
-                        if(((struct sockaddr *)&addrs[i])->sa_family == AF_INET)
-                            sock = session->ipv4_sock;
-                        else if(((struct sockaddr *)&addrs[i])->sa_family == AF_INET6)
-                            sock = session->ipv6_sock;
-                        else
-                        {
-                            CHIAKI_LOGE(session->log, "check_candidates: Got an address with an unsupported address family %d, skipping ...", ((struct sockaddr *)&addrs[i])->sa_family);
-                            continue;
-                        }
-                        if(CHIAKI_SOCKET_IS_INVALID(sock))
+                        if(CHIAKI_SOCKET_IS_INVALID(socks[j]))
                             continue;
-                        candidate = &candidates[i];
-                        if (sendto(sock, (CHIAKI_SOCKET_BUF_TYPE) request_buf[0], sizeof(request_buf[0]), 0, (struct sockaddr *)&addrs[i], lens[i]) < 0)
+                        if (sendto(socks[j], (CHIAKI_SOCKET_BUF_TYPE) request_buf[0], sizeof(request_buf[0]), 0, (struct sockaddr *)&addrs[i], lens[i]) < 0)
                         {
-                            CHIAKI_LOGE(session->log, "check_candidates: Sending request failed for %s:%d with error: " CHIAKI_SOCKET_ERROR_FMT, candidate->addr, candidate->port, CHIAKI_SOCKET_ERROR_VALUE);
-                            continue;
+                            CHIAKI_LOGW(session->log, "check_candidates: Sending request for socket %d failed for %s:%d with error, closing socket: " CHIAKI_SOCKET_ERROR_FMT, j, candidate->addr, candidate->port, CHIAKI_SOCKET_ERROR_VALUE);
+                            CHIAKI_SOCKET_CLOSE(socks[j]);
+                            socks[j] = CHIAKI_INVALID_SOCKET;
                         }
                     }
-                    continue;                    
                 }
-                else if(received_response && !connecting)
-                {
-                    connecting = true;
-                    continue;
-                }
-                // No responsive candidate within timeout, terminate with error
-                CHIAKI_LOGE(session->log, "check_candidates: Select timed out");
-                err = CHIAKI_ERR_HOST_UNREACH;
-                goto cleanup_sockets;
             }
-            // Otherwise, we have a responsive candidate, break out of loop
-            break;
+            if(probe->next_send_us < wakeup_us)
+                wakeup_us = probe->next_send_us;
         }
 
-        Candidate *candidate = NULL;
-        chiaki_socket_t candidate_sock = CHIAKI_INVALID_SOCKET;
-        socklen_t recv_len;
-        if (!(CHIAKI_SOCKET_IS_INVALID(session->ipv4_sock)) && FD_ISSET(session->ipv4_sock, &fds))
-        {
-            candidate_sock = session->ipv4_sock;
-            recv_len = sizeof(struct sockaddr_in);
-        }
-        else if (!(CHIAKI_SOCKET_IS_INVALID(session->ipv6_sock)) && FD_ISSET(session->ipv6_sock, &fds))
+        uint64_t timeout_ms = (wakeup_us - now_us + MILLISECONDS_US - 1) / MILLISECONDS_US;
+        if(timeout_ms > CANDIDATE_CANCEL_POLL_MS)
+            timeout_ms = CANDIDATE_CANCEL_POLL_MS;
+        uint32_t ready[CANDIDATE_RACE_EVENTS_MAX];
+        size_t ready_count = 0;
+        err = candidate_race_wait(&race, timeout_ms, ready, &ready_count);
+        if(err == CHIAKI_ERR_TIMEOUT)
+            continue;
+        if(err == CHIAKI_ERR_CANCELED)
         {
-            candidate_sock = session->ipv6_sock;
-            recv_len = sizeof(struct sockaddr_in6);
+            CHIAKI_LOGI(session->log, "check_candidates: canceled");
+            goto cleanup_sockets;
         }
-        else
+        if(err != CHIAKI_ERR_SUCCESS)
+            goto cleanup_sockets;
+
+        for(size_t r = 0; r < ready_count && !selected_candidate; r++)
         {
-            for(int j=0; j<RANDOM_ALLOCATION_SOCKS_NUMBER; j++)
+            Candidate *candidate = NULL;
+            chiaki_socket_t candidate_sock = candidate_race_sock(&race, ready[r]);
+            if(CHIAKI_SOCKET_IS_INVALID(candidate_sock))
+                continue;
+            if(ready[r] >= 2)
             {
-                if(!(CHIAKI_SOCKET_IS_INVALID(socks[j])) && FD_ISSET(socks[j], &fds))
-                {
-                    candidate_sock = socks[j];
-                    recv_len = sizeof(struct sockaddr_in);
+                // random allocation socket, the hole is punched now so packets may travel all the way
 #ifdef _WIN32
-                    DWORD ttl = 64;
+                DWORD ttl = 64;
 #else
-                    int ttl = 64;
+                int ttl = 64;
 #endif
-                    if (setsockopt(socks[j], IPPROTO_IP, IP_TTL, (const CHIAKI_SOCKET_BUF_TYPE)&ttl, sizeof(ttl)) < 0)
-                    {
-                        CHIAKI_LOGE(session->log, "setsockopt(IP_TTL) failed with error" CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-                        if (!CHIAKI_SOCKET_IS_INVALID(socks[j]))
-                        {
-                            CHIAKI_SOCKET_CLOSE(socks[j]);
-                            socks[j] = CHIAKI_INVALID_SOCKET;
-                        }
-                        err = CHIAKI_ERR_UNKNOWN;
-                        goto cleanup_sockets;
-                    }
-                    break;
+                if (setsockopt(candidate_sock, IPPROTO_IP, IP_TTL, (const CHIAKI_SOCKET_BUF_TYPE)&ttl, sizeof(ttl)) < 0)
+                {
+                    CHIAKI_LOGE(session->log, "setsockopt(IP_TTL) failed with error" CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+                    CHIAKI_SOCKET_CLOSE(socks[ready[r] - 2]);
+                    socks[ready[r] - 2] = CHIAKI_INVALID_SOCKET;
+                    err = CHIAKI_ERR_UNKNOWN;
+                    goto cleanup_sockets;
                 }
             }
-        }
-        if(CHIAKI_SOCKET_IS_INVALID(candidate_sock))
-        {
-            CHIAKI_LOGE(session->log, "check_candidates: Select returned an invalid socket!");
-            err = CHIAKI_ERR_UNKNOWN;
-            goto cleanup_sockets;
-        }
 
-        struct sockaddr* recv_address;
-        // allocate up to sockaddr in6 since that's what may be needed
-        recv_address = malloc(sizeof(struct sockaddr_in6));
-        if(!recv_address)
-        {
-            err = CHIAKI_ERR_MEMORY;
-            goto cleanup_sockets;
-        }
-        char recv_address_string[INET6_ADDRSTRLEN];
-        uint16_t recv_address_port = 0;
-        int i = 0;
-        CHIAKI_SSIZET_TYPE response_len = recvfrom(candidate_sock, (CHIAKI_SOCKET_BUF_TYPE) response_buf, sizeof(response_buf), 0, recv_address, &recv_len);
-        if (response_len < 0)
-        {
-            CHIAKI_LOGE(session->log, "check_candidates: Receiving response failed with error: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-            free(recv_address);
-            continue;
-        }
-        if(recv_address->sa_family == AF_INET)
-        {
-            if (!inet_ntop(AF_INET, &(((struct sockaddr_in *)recv_address)->sin_addr), recv_address_string, sizeof(recv_address_string)))
+            struct sockaddr_storage recv_address_storage;
+            struct sockaddr *recv_address = (struct sockaddr *)&recv_address_storage;
+            socklen_t recv_len = sizeof(recv_address_storage);
+            char recv_address_string[INET6_ADDRSTRLEN];
+            uint16_t recv_address_port = 0;
+            size_t i = 0;
+            CHIAKI_SSIZET_TYPE response_len = recvfrom(candidate_sock, (CHIAKI_SOCKET_BUF_TYPE) response_buf, sizeof(response_buf), 0, recv_address, &recv_len);
+            if (response_len < 0)
             {
-                CHIAKI_LOGE(session->log, "check_candidates: Couldn't retrieve address from recv address!");
-                free(recv_address);
+                CHIAKI_LOGE(session->log, "check_candidates: Receiving response failed with error: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
                 continue;
             }
-            recv_address_port = ntohs(((struct sockaddr_in *)recv_address)->sin_port);
-        }
-        else if (recv_address->sa_family == AF_INET6)
-        {
-            if (!inet_ntop(AF_INET6, &(((struct sockaddr_in6 *)recv_address)->sin6_addr), recv_address_string, sizeof(recv_address_string)))
+            uint64_t recv_us = chiaki_time_now_monotonic_us();
+            if(recv_address->sa_family == AF_INET)
             {
-                CHIAKI_LOGE(session->log, "check_candidates: Couldn't retrieve address from recv address!");
-                free(recv_address);
-                continue;
+                if (!inet_ntop(AF_INET, &(((struct sockaddr_in *)recv_address)->sin_addr), recv_address_string, sizeof(recv_address_string)))
+                {
+                    CHIAKI_LOGE(session->log, "check_candidates: Couldn't retrieve address from recv address!");
+                    continue;
+                }
+                recv_address_port = ntohs(((struct sockaddr_in *)recv_address)->sin_port);
             }
-            recv_address_port = ntohs(((struct sockaddr_in6 *)recv_address)->sin6_port);
-        }
-        else
-        {
-            CHIAKI_LOGE(session->log, "check_candidates: Got an address with an unsupported address family %d, skipping ...", recv_address->sa_family);
-            free(recv_address);
-            continue;
-        }
-        bool existing_candidate = false;
-        for (; i < num_candidates + extra_addresses_used; i++)
-        {
-            candidate = &candidates[i];
-            if((strcmp(candidate->addr, recv_address_string) == 0) && (candidate->port == recv_address_port))
+            else if (recv_address->sa_family == AF_INET6)
             {
-                existing_candidate = true;
-                break;
+                if (!inet_ntop(AF_INET6, &(((struct sockaddr_in6 *)recv_address)->sin6_addr), recv_address_string, sizeof(recv_address_string)))
+                {
+                    CHIAKI_LOGE(session->log, "check_candidates: Couldn't retrieve address from recv address!");
+                    continue;
+                }
+                recv_address_port = ntohs(((struct sockaddr_in6 *)recv_address)->sin6_port);
             }
-        }
-        if(!existing_candidate)
-        {
-            if(extra_addresses_used >= EXTRA_CANDIDATE_ADDRESSES)
+            else
             {
-                CHIAKI_LOGI(session->log, "check_candidates: Received more than %d extra candidates skipping this one", EXTRA_CANDIDATE_ADDRESSES);
-                free(recv_address);
+                CHIAKI_LOGE(session->log, "check_candidates: Got an address with an unsupported address family %d, skipping ...", recv_address->sa_family);
                 continue;
             }
-            else
+            bool existing_candidate = false;
+            for (; i < num_candidates + extra_addresses_used; i++)
+            {
+                candidate = &candidates[i];
+                if((strcmp(candidate->addr, recv_address_string) == 0) && (candidate->port == recv_address_port))
+                {
+                    existing_candidate = true;
+                    break;
+                }
+            }
+            if(!existing_candidate)
             {
+                if(extra_addresses_used >= EXTRA_CANDIDATE_ADDRESSES)
+                {
+                    CHIAKI_LOGI(session->log, "check_candidates: Received more than %d extra candidates skipping this one", EXTRA_CANDIDATE_ADDRESSES);
+                    continue;
+                }
                 candidate = &candidates[i];
                 responses_received[i] = 0;
+                candidate_probe_init(&probes[i], candidate_sock);
                 memcpy(candidate->addr, recv_address_string, sizeof(recv_address_string));
+                candidate->port = recv_address_port;
                 candidate->port_mapped = 0;
                 candidate->type = CANDIDATE_TYPE_DERIVED;
                 if(recv_address->sa_family == AF_INET)
-                {
-                    candidate->port = recv_address_port;
                     memcpy(candidate->addr_mapped, "0.0.0.0", 8);
-                }
-                else if(recv_address->sa_family == AF_INET6)
-                {
-                    candidate->port = recv_address_port;
-                    memcpy(candidate->addr_mapped, "0:0:0:0:0:0:0:0", 16);
-                }
                 else
-                {
-                    CHIAKI_LOGE(session->log, "check_candidates: Got an address with an unsupported address family %d, skipping ...", recv_address->sa_family);
-                    free(recv_address);
-                    continue;
-                }
+                    memcpy(candidate->addr_mapped, "0:0:0:0:0:0:0:0", 16);
                 memcpy((struct sockaddr *)&addrs[i], recv_address, recv_len);
                 lens[i] = recv_len;
                 extra_addresses_used++;
                 CHIAKI_LOGI(session->log, "check_candidates: Received new candidate at %s:%d", candidate->addr, candidate->port);
             }
-            free(recv_address);
-        }
-        CHIAKI_LOGV(session->log, "check_candidates: Received data from %s:%d", candidate->addr, candidate->port);
-        if (response_len != sizeof(response_buf))
-        {
-            if(candidate->type == CANDIDATE_TYPE_DERIVED)
+            CHIAKI_LOGV(session->log, "check_candidates: Received data from %s:%d", candidate->addr, candidate->port);
+            if (response_len != sizeof(response_buf))
+            {
+                if(candidate->type != CANDIDATE_TYPE_DERIVED)
+                    CHIAKI_LOGE(session->log, "check_candidates: Received response of unexpected size %zd from %s:%d", response_len, candidate->addr, candidate->port);
                 continue;
-            CHIAKI_LOGE(session->log, "check_candidates: Received response of unexpected size %zd from %s:%d", response_len, candidate->addr, candidate->port);
-            err = CHIAKI_ERR_NETWORK;
-            goto cleanup_sockets;
-        }
-        uint32_t msg_type = ntohl(*((uint32_t*)(response_buf)));
-        if (msg_type == MSG_TYPE_REQ)
-        {
-            CHIAKI_LOGI(session->log, "Responding to request");
-            responded = true;
-            err = send_responseto_ps(session, response_buf, &candidate_sock, candidate, (struct sockaddr *)&addrs[i], lens[i]);
-            if(err != CHIAKI_ERR_SUCCESS && candidate->type != CANDIDATE_TYPE_DERIVED)
-                goto cleanup_sockets;
-            if((session->stun_random_allocation || candidate->type == CANDIDATE_TYPE_DERIVED) && responses_received[i] == 0)
+            }
+            uint32_t msg_type = ntohl(*((uint32_t*)(response_buf)));
+            if (msg_type == MSG_TYPE_REQ)
             {
-                if (sendto(candidate_sock, (CHIAKI_SOCKET_BUF_TYPE) request_buf[0], sizeof(request_buf[0]), 0, (struct sockaddr *)&addrs[i], lens[i]) < 0)
+                CHIAKI_LOGI(session->log, "Responding to request");
+                responded = true;
+                err = send_responseto_ps(session, response_buf, &candidate_sock, candidate, (struct sockaddr *)&addrs[i], lens[i]);
+                if(err != CHIAKI_ERR_SUCCESS)
+                    continue;
+                if((session->stun_random_allocation || candidate->type == CANDIDATE_TYPE_DERIVED) && responses_received[i] == 0)
                 {
-                    CHIAKI_LOGE(session->log, "check_candidates: Sending request failed for %s:%d with error: " CHIAKI_SOCKET_ERROR_FMT, candidate->addr, candidate->port, CHIAKI_SOCKET_ERROR_VALUE);
-                    goto cleanup_sockets;
+                    // the console reached us through this socket, so answer and retransmit from it too
+                    probes[i].sock = candidate_sock;
+                    candidate_probe_send(session, &probes[i], candidate, candidate_sock, request_buf[0], sizeof(request_buf[0]), (struct sockaddr *)&addrs[i], lens[i], recv_us);
                 }
+                continue;
             }
-            continue;
-        }
-        if (msg_type != MSG_TYPE_RESP)
-        {
-            CHIAKI_LOGE(session->log, "check_candidates: Received response of unexpected type %"PRIu32" from %s:%d", msg_type, candidate->addr, candidate->port);
-            chiaki_log_hexdump(session->log, CHIAKI_LOG_ERROR, response_buf, 88);
-            err = CHIAKI_ERR_UNKNOWN;
-            if(candidate->type == CANDIDATE_TYPE_DERIVED)
+            if (msg_type != MSG_TYPE_RESP)
+            {
+                if(candidate->type != CANDIDATE_TYPE_DERIVED)
+                {
+                    CHIAKI_LOGE(session->log, "check_candidates: Received response of unexpected type %"PRIu32" from %s:%d", msg_type, candidate->addr, candidate->port);
+                    chiaki_log_hexdump(session->log, CHIAKI_LOG_ERROR, response_buf, 88);
+                }
                 continue;
-            goto cleanup_sockets;
-        }
-        // TODO: More validation of localHashedIds, sids and the weird data at 0x4b?
-        int responses = responses_received[i];
-        if(memcmp(response_buf + 0x4b, request_id[responses], sizeof(request_id[responses])) != 0)
-        {
-            CHIAKI_LOGE(session->log, "check_candidates: Received response with unexpected request ID from %s:%d", candidate->addr, candidate->port);
-            CHIAKI_LOGE(session->log, "check_candidates: Request ID expected:");
-            chiaki_log_hexdump(session->log, CHIAKI_LOG_ERROR, request_id[responses], 5);
-            CHIAKI_LOGE(session->log, "check_candidates: Request ID received:");
-            chiaki_log_hexdump(session->log, CHIAKI_LOG_ERROR, response_buf + 0x4b, 5);
-            CHIAKI_LOGE(session->log, "check_candidates: Full response received:");
-            chiaki_log_hexdump(session->log, CHIAKI_LOG_ERROR, response_buf, 88);
-            continue;
-        }
-        received_response = true;
-        responses_received[i]++;
-        responses = responses_received[i];
-        CHIAKI_LOGV(session->log, "Received response %d", responses);
-        if(responses > (CHECK_CANDIDATES_REQUEST_NUMBER - 1))
-        {
-            selected_sock = candidate_sock;
-            selected_candidate = candidate;
-            if (connect(selected_sock, (struct sockaddr *)&addrs[i], lens[i]) < 0)
+            }
+            // TODO: More validation of localHashedIds, sids and the weird data at 0x4b?
+            int responses = responses_received[i];
+            if(memcmp(response_buf + 0x4b, request_id[responses], sizeof(request_id[responses])) != 0)
             {
-                CHIAKI_LOGE(session->log, "check_candidates: Connecting socket failed for %s:%d with error " CHIAKI_SOCKET_ERROR_FMT, selected_candidate->addr, selected_candidate->port, CHIAKI_SOCKET_ERROR_VALUE);
-                err = CHIAKI_ERR_NETWORK;
-                goto cleanup_sockets;
+                CHIAKI_LOGE(session->log, "check_candidates: Received response with unexpected request ID from %s:%d", candidate->addr, candidate->port);
+                CHIAKI_LOGE(session->log, "check_candidates: Request ID expected:");
+                chiaki_log_hexdump(session->log, CHIAKI_LOG_ERROR, request_id[responses], 5);
+                CHIAKI_LOGE(session->log, "check_candidates: Request ID received:");
+                chiaki_log_hexdump(session->log, CHIAKI_LOG_ERROR, response_buf + 0x4b, 5);
+                CHIAKI_LOGE(session->log, "check_candidates: Full response received:");
+                chiaki_log_hexdump(session->log, CHIAKI_LOG_ERROR, response_buf, 88);
+                continue;
             }
-            CHIAKI_LOGV(session->log, "Selected Candidate");
-            print_candidate(session->log, selected_candidate);
-            break;
-        }
-        else
-        {
-            if (sendto(candidate_sock, (CHIAKI_SOCKET_BUF_TYPE) request_buf[responses], sizeof(request_buf[responses]), 0, (struct sockaddr *)&addrs[i], lens[i]) < 0)
+            // all requests of a race share their request id, so this is measured from the most recent one
+            if(probes[i].sends && !probes[i].rtt_us)
+                probes[i].rtt_us = recv_us - probes[i].last_send_us;
+            responses_received[i]++;
+            responses = responses_received[i];
+            CHIAKI_LOGV(session->log, "Received response %d", responses);
+            if(responses > (CHECK_CANDIDATES_REQUEST_NUMBER - 1))
             {
-                CHIAKI_LOGE(session->log, "check_candidates: Sending request failed for %s:%d with error: " CHIAKI_SOCKET_ERROR_FMT, candidate->addr, candidate->port, CHIAKI_SOCKET_ERROR_VALUE);
-                err = CHIAKI_ERR_NETWORK;
-                    continue;
+                selected_sock = candidate_sock;
+                selected_candidate = candidate;
+                selected_probe = &probes[i];
+                if (connect(selected_sock, (struct sockaddr *)&addrs[i], lens[i]) < 0)
+                {
+                    CHIAKI_LOGE(session->log, "check_candidates: Connecting socket failed for %s:%d with error " CHIAKI_SOCKET_ERROR_FMT, selected_candidate->addr, selected_candidate->port, CHIAKI_SOCKET_ERROR_VALUE);
+                    err = CHIAKI_ERR_NETWORK;
+                    goto cleanup_sockets;
+                }
+                CHIAKI_LOGV(session->log, "Selected Candidate");
+                print_candidate(session->log, selected_candidate);
+                break;
+            }
+            else
+            {
+                candidate_probe_send(session, &probes[i], candidate, candidate_sock, request_buf[responses], sizeof(request_buf[responses]), (struct sockaddr *)&addrs[i], lens[i], recv_us);
             }
         }
     }
+    candidate_race_fini(&race);
+
+    CHIAKI_LOGI(session->log, "check_candidates: Selected %s candidate %s:%d after %.1f ms",
+        candidate_type_string(selected_candidate->type), selected_candidate->addr, selected_candidate->port,
+        (chiaki_time_now_monotonic_us() - race_start_us) / 1000.0);
+    for (size_t i=0; i < num_candidates + extra_addresses_used; i++)
+    {
+        if(probes[i].rtt_us)
+            CHIAKI_LOGV(session->log, "check_candidates: %s candidate %s:%d, %u requests, RTT %.2f ms",
+                candidate_type_string(candidates[i].type), candidates[i].addr, candidates[i].port, probes[i].sends, probes[i].rtt_us / 1000.0);
+        else
+            CHIAKI_LOGV(session->log, "check_candidates: %s candidate %s:%d, %u requests, no response",
+                candidate_type_string(candidates[i].type), candidates[i].addr, candidates[i].port, probes[i].sends);
+    }
+    memset(&session->candidate_hint, 0, sizeof(session->candidate_hint));
+    strncpy(session->candidate_hint.addr, selected_candidate->addr, sizeof(session->candidate_hint.addr) - 1);
+    session->candidate_hint.port = selected_candidate->port;
+    session->candidate_hint.rtt_us = selected_probe->rtt_us;
+    session->candidate_hint_valid = true;
+
     *out = selected_sock;
     // Close non-chosen sockets
     if (session->ipv4_sock != *out && (!CHIAKI_SOCKET_IS_INVALID(session->ipv4_sock)))
@@ -4194,6 +4622,7 @@ static ChiakiErrorCode check_candidates(
     return CHIAKI_ERR_SUCCESS;
 
 cleanup_sockets:
+    candidate_race_fini(&race);
     if(!CHIAKI_SOCKET_IS_INVALID(session->ipv4_sock))
     {
         CHIAKI_SOCKET_CLOSE(session->ipv4_sock);
@@ -4559,6 +4988,9 @@ static json_object* session_message_get_payload(ChiakiLog *log, json_object *ses
 /**
  * Wait for notification to arrive
  *
+ * The returned notification is taken out of the session's ring and must be released
+ * with clear_notification.
+ *
  * @param[in] session Pointer to the session context
  * @param[out] out The new Notification object that's been created from the arrived json over the websocket
  * @param[in] types The types of notifications to look for (ORed together if multiple)
@@ -4568,26 +5000,26 @@ static ChiakiErrorCode wait_for_notification(
     Session *session, Notification** out,
     uint16_t types, uint64_t timeout_ms)
 {
-    uint64_t waiting_since = chiaki_time_now_monotonic_us();
-    uint64_t now = waiting_since;
-    Notification *last_known = NULL;
+    uint64_t deadline = chiaki_time_now_monotonic_us() + timeout_ms * MILLISECONDS_US;
+    Notification *notif = malloc(sizeof(Notification));
+    if(!notif)
+        return CHIAKI_ERR_MEMORY;
 
     ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
     chiaki_mutex_lock(&session->notif_mutex);
+    session->notif_waiting_types = types;
     while (true) {
-        while (session->ws_notification_queue->rear == last_known || session->ws_notification_queue->rear == NULL)
+        while (!notification_ring_take(&session->notif_ring, types, notif))
         {
-            err = chiaki_cond_timedwait(&session->notif_cond, &session->notif_mutex, timeout_ms);
-            if (err == CHIAKI_ERR_TIMEOUT)
+            uint64_t now = chiaki_time_now_monotonic_us();
+            if (now >= deadline)
             {
-                now = chiaki_time_now_monotonic_us();
-                if ((now - waiting_since) > (timeout_ms * MILLISECONDS_US))
-                {
-                    CHIAKI_LOGE(session->log, "wait_for_notification: Timed out waiting for holepunch session messages");
-                    err = CHIAKI_ERR_TIMEOUT;
-                    goto cleanup;
-                }
+                CHIAKI_LOGE(session->log, "wait_for_notification: Timed out waiting for holepunch session messages");
+                err = CHIAKI_ERR_TIMEOUT;
+                goto cleanup;
             }
+            uint64_t remaining_ms = (deadline - now + MILLISECONDS_US - 1) / MILLISECONDS_US;
+            err = chiaki_cond_timedwait(&session->notif_cond, &session->notif_mutex, remaining_ms);
             assert(err == CHIAKI_ERR_SUCCESS || err == CHIAKI_ERR_TIMEOUT);
             chiaki_mutex_lock(&session->stop_mutex);
             if(session->main_should_stop)
@@ -4599,51 +5031,57 @@ static ChiakiErrorCode wait_for_notification(
             }
             chiaki_mutex_unlock(&session->stop_mutex);
         }
-        Notification *notif;
-        if(last_known)
-            notif = last_known->next;
-        else
-            notif = session->ws_notification_queue->front;
-        while (notif != NULL && notif != last_known)
+
+        // only notifications somebody waits for get parsed
+        if (!notif->json)
+            notif->json = json_tokener_parse(notif->json_buf);
+        if (!notif->json)
         {
-            if (notif->type & types)
-            {
-                CHIAKI_LOGV(session->log, "wait_for_notification: Found notification of type %d", notif->type);
-                *out = notif;
-                err = CHIAKI_ERR_SUCCESS;
-                goto cleanup;
-            }
-            last_known = notif;
-            notif = notif->next;
+            CHIAKI_LOGE(session->log, "wait_for_notification: Parsing JSON of notification of type %d failed", notif->type);
+            CHIAKI_LOGV(session->log, "wait_for_notification: Payload was:\n%s", notif->json_buf);
+            free(notif->json_buf);
+            notif->json_buf = NULL;
+            continue;
         }
+        CHIAKI_LOGV(session->log, json_object_to_json_string_ext(notif->json, JSON_C_TO_STRING_PRETTY));
+
+        ChiakiHolepunchNotificationStats *stats = &session->notif_stats;
+        uint64_t latency_us = chiaki_time_now_monotonic_us() - notif->received_us;
+        stats->delivered++;
+        session->notif_latency_sum_us += latency_us;
+        stats->latency_avg_us = session->notif_latency_sum_us / stats->delivered;
+        if (latency_us > stats->latency_max_us)
+            stats->latency_max_us = latency_us;
+        CHIAKI_LOGV(session->log, "wait_for_notification: Found notification of type %d, %.3f ms after it was received",
+            notif->type, latency_us / 1000.0);
+        *out = notif;
+        notif = NULL;
+        err = CHIAKI_ERR_SUCCESS;
+        goto cleanup;
     }
 
 cleanup:
+    session->notif_waiting_types = 0;
     chiaki_mutex_unlock(&session->notif_mutex);
+    free(notif);
     return err;
 }
 
+/**
+ * Release a notification returned by wait_for_notification
+ *
+ * @param[in] session Pointer to the session context
+ * @param[in] notification The notification to free, may be NULL
+*/
 static ChiakiErrorCode clear_notification(
     Session *session, Notification *notification)
 {
-    bool found = false;
-    NotificationQueue *nq = session->ws_notification_queue;
-    chiaki_mutex_lock(&session->notif_mutex);
-    while (nq->rear != NULL)
-    {
-        if(nq->front == notification)
-        {
-            found = true;
-            dequeueNq(nq);
-            break;
-        }
-        dequeueNq(nq);
-    }
-    chiaki_mutex_unlock(&session->notif_mutex);
-    if (found)
+    if (!notification)
         return CHIAKI_ERR_SUCCESS;
-    else
-        return CHIAKI_ERR_UNKNOWN;
+    json_object_put(notification->json);
+    free(notification->json_buf);
+    free(notification);
+    return CHIAKI_ERR_SUCCESS;
 }
 
 /**
@@ -4681,6 +5119,7 @@ static ChiakiErrorCode wait_for_session_message(
         {
             session->main_should_stop = false;
             chiaki_mutex_unlock(&session->stop_mutex);
+            clear_notification(session, notif);
             err = CHIAKI_ERR_CANCELED;
             return err;
         }
@@ -4688,6 +5127,8 @@ static ChiakiErrorCode wait_for_session_message(
         json_object *payload = session_message_get_payload(session->log, notif->json);
         err = session_message_parse(session->log, payload, &msg);
         json_object_put(payload);
+        clear_notification(session, notif);
+        notif = NULL;
         if (err != CHIAKI_ERR_SUCCESS)
         {
             CHIAKI_LOGE(session->log, "Failed to parse holepunch session message");
@@ -4706,12 +5147,10 @@ static ChiakiErrorCode wait_for_session_message(
             CHIAKI_LOGV(session->log, "Ignoring holepunch session message with action %d", msg->action);
             session_message_free(msg);
             msg = NULL;
-            clear_notification(session, notif);
             continue;
         }
         finished = true;
     }
-    msg->notification = notif;
     *out = msg;
     return CHIAKI_ERR_SUCCESS;
 }
@@ -4785,8 +5224,6 @@ static ChiakiErrorCode session_message_parse(
     SessionMessage *msg = calloc(1, sizeof(SessionMessage));
     if(!msg)
         return CHIAKI_ERR_MEMORY;
-    msg->notification = NULL;
-
     json_object *action_json;
     json_object_object_get_ex(message_json, "action", &action_json);
     if (action_json == NULL || !json_object_is_type(action_json, json_type_string))
@@ -5234,7 +5671,6 @@ static ChiakiErrorCode session_message_free(SessionMessage *message)
                 free(message->conn_request->candidates);
             free(message->conn_request);
         }
-        message->notification = NULL;
         free(message);
     }
     return err;
@@ -5249,7 +5685,8 @@ static ChiakiErrorCode session_message_free(SessionMessage *message)
 static ChiakiErrorCode get_stun_servers(Session *session)
 {
     ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
-    const char STUN_HOSTS_URL[] = "https://raw.githubusercontent.com/pradt2/always-online-stun/master/valid_hosts.txt";
+    char STUN_HOSTS_URL[256];
+    endpoint_url(STUN_HOSTS_URL, sizeof(STUN_HOSTS_URL), stun_hosts_url);
     CURL *curl = curl_easy_init();
     if(!curl)
     {
@@ -5337,7 +5774,8 @@ static ChiakiErrorCode get_stun_servers(Session *session)
     response_data.size = 0;
     curl_easy_cleanup(curl);
     curl = NULL;
-    const char STUN_HOSTS_URL_IPV6[] = "https://raw.githubusercontent.com/pradt2/always-online-stun/master/valid_ipv6s.txt";
+    char STUN_HOSTS_URL_IPV6[256];
+    endpoint_url(STUN_HOSTS_URL_IPV6, sizeof(STUN_HOSTS_URL_IPV6), stun_hosts_ipv6_url);
     curl = curl_easy_init();
     if(!curl)
     {
@@ -5503,83 +5941,74 @@ static void print_candidate(ChiakiLog *log, Candidate *candidate)
 }
 
 /**
- * Create a notification queue for holding notifications for a session.
+ * Append a notification to the ring, taking ownership of its buffers.
  *
- * @return nq Pointer to a NotificationQueue to be used for the session.
+ * @param ring The ring to push to
+ * @param[in] notif Notification to copy into the ring
+ * @return false if the ring was full and the oldest notification was dropped
 */
-
-static NotificationQueue *createNq()
+static bool notification_ring_push(NotificationRing *ring, Notification *notif)
 {
-    NotificationQueue *nq = (NotificationQueue*)malloc(sizeof(NotificationQueue));
-    if(!nq)
-        return NULL;
-    nq->front = nq->rear = NULL;
-    return nq;
+    bool overflow = false;
+    if (ring->tail - ring->head == NOTIFICATION_RING_SIZE)
+    {
+        Notification *oldest = &ring->slots[ring->head % NOTIFICATION_RING_SIZE];
+        overflow = oldest->json_buf != NULL;
+        json_object_put(oldest->json);
+        free(oldest->json_buf);
+        oldest->json = NULL;
+        oldest->json_buf = NULL;
+        ring->head++;
+    }
+    ring->slots[ring->tail % NOTIFICATION_RING_SIZE] = *notif;
+    ring->tail++;
+    return !overflow;
 }
 
 /**
- * Delete a notification from the queue
+ * Take the oldest notification of the given types out of the ring.
  *
- * @param nq the notification queue to dequeue from
-*/
-
-static void dequeueNq(NotificationQueue *nq)
-{
-    if(nq->front == NULL)
-        return;
-
-    Notification *notif = nq->front;
-
-    nq->front = nq->front->next;
-
-    if(nq->front == NULL)
-        nq->rear = NULL;
-
-    json_object_put(notif->json);
-    notif->json = NULL;
-    free(notif->json_buf);
-    notif->json_buf = NULL;
-    free(notif);
-}
-
-/**
- * Adds a notification to the queue.
- *
- * @param nq Notification queue to add to
- * @param[in] notif Notification to add to the queue
+ * @param ring The ring to take from
+ * @param[in] types The types of notifications to look for (ORed together if multiple)
+ * @param[out] out Receives the notification and ownership of its buffers
+ * @return true if a notification was found
 */
-
-static void enqueueNq(NotificationQueue *nq, Notification*notif)
+static bool notification_ring_take(NotificationRing *ring, uint16_t types, Notification *out)
 {
-    if(nq->rear == NULL)
+    // taken slots at the front can be reused
+    while (ring->head != ring->tail && !ring->slots[ring->head % NOTIFICATION_RING_SIZE].json_buf)
+        ring->head++;
+    for (uint64_t i = ring->head; i != ring->tail; i++)
     {
-        nq->front = nq->rear = notif;
-        return;
+        Notification *slot = &ring->slots[i % NOTIFICATION_RING_SIZE];
+        if (!slot->json_buf || !(slot->type & types))
+            continue;
+        *out = *slot;
+        slot->json = NULL;
+        slot->json_buf = NULL;
+        if (i == ring->head)
+            ring->head++;
+        return true;
     }
-    nq->rear->next = notif;
-    nq->rear = notif;
+    return false;
 }
 
 /**
- * Creates a notification
+ * Free all notifications left in the ring.
  *
- * @param[in] type The type of notification
- * @param[in] json The pointer to the json object of the notification
- * @param[in] json_buf A pointer to the char representation of the json
- * @param[in] json_buf_size The length of the char representation of the json
- * @return notif Created notification
+ * @param ring The ring to clear
 */
-static Notification* newNotification(NotificationType type, json_object *json, char* json_buf, size_t json_buf_size)
+static void notification_ring_clear(NotificationRing *ring)
 {
-    Notification *notif = (Notification *)malloc(sizeof(Notification));
-    if(!notif)
-        return NULL;
-    notif->type = type;
-    notif->json = json;
-    notif->json_buf = json_buf;
-    notif->json_buf_size = json_buf_size;
-    notif->next = NULL;
-    return notif;
+    for (uint64_t i = ring->head; i != ring->tail; i++)
+    {
+        Notification *slot = &ring->slots[i % NOTIFICATION_RING_SIZE];
+        json_object_put(slot->json);
+        free(slot->json_buf);
+        slot->json = NULL;
+        slot->json_buf = NULL;
+    }
+    ring->head = ring->tail;
 }
 
 /**
@@ -1,7 +1,5 @@
 // SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
 
-#ifndef CHIAKI_UNIT_TEST
-
 #include <chiaki/remote/rudpsendbuffer.h>
 #include <chiaki/time.h>
 
@@ -15,24 +13,11 @@
 #endif
 
 #define RUDP_DATA_RESEND_TIMEOUT_MS 400
-#define RUDP_DATA_RESEND_WAKEUP_TIMEOUT_MS (RUDP_DATA_RESEND_TIMEOUT_MS/2)
-#define RUDP_DATA_RESEND_TRIES_MAX 25
-#define RUDP_SEND_BUFFER_SIZE 16
-
-#endif
+#define RUDP_DATA_RESEND_TIMEOUT_MIN_MS 200
+#define RUDP_DATA_RESEND_TIMEOUT_MAX_MS 2000
+#define RUDP_DATA_RESEND_GIVE_UP_MS 10000
 
-struct chiaki_rudp_send_buffer_packet_t
-{
-	ChiakiSeqNum16 seq_num;
-	uint64_t tries;
-	uint64_t last_send_ms; // chiaki_time_now_monotonic_ms()
-	uint8_t *buf;
-	size_t buf_size;
-}; // ChiakiRudpSendBufferPacket
-
-#ifndef CHIAKI_UNIT_TEST
-
-static void *rudp_send_buffer_thread_func(void *user);
+static void rudp_send_buffer_timer_cb(void *user);
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_buffer_init(ChiakiRudpSendBuffer *send_buffer, ChiakiRudp rudp, ChiakiLog *log, size_t size)
 {
@@ -43,33 +28,42 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_buffer_init(ChiakiRudpSendBuffer
 	send_buffer->rudp = rudp;
 	send_buffer->log = log;
 
-	send_buffer->packets = calloc(size, sizeof(ChiakiRudpSendBufferPacket));
-	if(!send_buffer->packets)
+	ChiakiRetransmitConfig config = { 0 };
+	config.seq_num_16 = true;
+	config.rto_initial_ms = RUDP_DATA_RESEND_TIMEOUT_MS;
+	config.rto_min_ms = RUDP_DATA_RESEND_TIMEOUT_MIN_MS;
+	config.rto_max_ms = RUDP_DATA_RESEND_TIMEOUT_MAX_MS;
+	config.give_up_ms = RUDP_DATA_RESEND_GIVE_UP_MS;
+	err = chiaki_retransmit_queue_init(&send_buffer->queue, size, &config);
+	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		chiaki_mutex_unlock(&send_buffer->mutex);
-		err = CHIAKI_ERR_MEMORY;
 		goto error_mutex;
 	}
-	send_buffer->packets_size = size;
-	send_buffer->packets_count = 0;
-
-	send_buffer->should_stop = false;
-	chiaki_mutex_unlock(&send_buffer->mutex);
-	err = chiaki_cond_init(&send_buffer->cond);
-	if(err != CHIAKI_ERR_SUCCESS)
-		goto error_packets;
 
-	err = chiaki_thread_create(&send_buffer->thread, rudp_send_buffer_thread_func, send_buffer);
-	if(err != CHIAKI_ERR_SUCCESS)
-		goto error_cond;
+	send_buffer->acked_seq_nums = calloc(size, sizeof(uint32_t));
+	if(!send_buffer->acked_seq_nums)
+	{
+		chiaki_mutex_unlock(&send_buffer->mutex);
+		err = CHIAKI_ERR_MEMORY;
+		goto error_queue;
+	}
 
-	chiaki_thread_set_name(&send_buffer->thread, "Chiaki Rudp Send Buffer");
+	send_buffer->timer_service = chiaki_timer_service_shared_ref();
+	if(!send_buffer->timer_service)
+	{
+		chiaki_mutex_unlock(&send_buffer->mutex);
+		err = CHIAKI_ERR_THREAD;
+		goto error_acked;
+	}
+	chiaki_timer_init(&send_buffer->timer, send_buffer->timer_service, rudp_send_buffer_timer_cb, send_buffer);
+	chiaki_mutex_unlock(&send_buffer->mutex);
 
 	return CHIAKI_ERR_SUCCESS;
-error_cond:
-	chiaki_cond_fini(&send_buffer->cond);
-error_packets:
-	free(send_buffer->packets);
+error_acked:
+	free(send_buffer->acked_seq_nums);
+error_queue:
+	chiaki_retransmit_queue_fini(&send_buffer->queue);
 error_mutex:
 	chiaki_mutex_fini(&send_buffer->mutex);
 	return err;
@@ -77,18 +71,17 @@ error_mutex:
 
 CHIAKI_EXPORT void chiaki_rudp_send_buffer_fini(ChiakiRudpSendBuffer *send_buffer)
 {
-	send_buffer->should_stop = true;
-	ChiakiErrorCode err = chiaki_cond_signal(&send_buffer->cond);
-	assert(err == CHIAKI_ERR_SUCCESS);
-	err = chiaki_thread_join(&send_buffer->thread, NULL);
-	assert(err == CHIAKI_ERR_SUCCESS);
+	chiaki_timer_cancel(&send_buffer->timer);
+	chiaki_timer_service_shared_unref(send_buffer->timer_service);
 
-	for(size_t i=0; i<send_buffer->packets_count; i++)
-		free(send_buffer->packets[i].buf);
+	if(send_buffer->queue.rtt_samples || send_buffer->queue.resends)
+		CHIAKI_LOGI(send_buffer->log, "Rudp Send Buffer re-sent %llu packets, gave up on %llu, smoothed RTT %.1fms",
+				(unsigned long long)send_buffer->queue.resends, (unsigned long long)send_buffer->queue.give_ups,
+				send_buffer->queue.srtt_us / 1000.0);
 
-	chiaki_cond_fini(&send_buffer->cond);
 	chiaki_mutex_fini(&send_buffer->mutex);
-	free(send_buffer->packets);
+	free(send_buffer->acked_seq_nums);
+	chiaki_retransmit_queue_fini(&send_buffer->queue);
 }
 
 static void GetRudpPacketType(ChiakiRudpSendBuffer *send_buffer, uint16_t packet_type, char *ptype)
@@ -136,38 +129,32 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_buffer_push(ChiakiRudpSendBuffer
 {
 	ChiakiErrorCode err = chiaki_mutex_lock(&send_buffer->mutex);
 	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		free(buf);
 		return err;
+	}
 
-	if(send_buffer->packets_count >= send_buffer->packets_size)
+	err = chiaki_retransmit_queue_push(&send_buffer->queue, seq_num, buf, buf_size, chiaki_time_now_monotonic_ms());
+	if(err == CHIAKI_ERR_OVERFLOW)
 	{
 		CHIAKI_LOGE(send_buffer->log, "Rudp Send Buffer overflow");
-		err = CHIAKI_ERR_OVERFLOW;
 		goto beach;
 	}
-
-	for(size_t i=0; i<send_buffer->packets_count; i++)
+	else if(err == CHIAKI_ERR_INVALID_DATA)
 	{
-		if(send_buffer->packets[i].seq_num == seq_num)
-		{
-			CHIAKI_LOGE(send_buffer->log, "Tried to push duplicate seqnum into Rudp Send Buffer");
-			err = CHIAKI_ERR_INVALID_DATA;
-			goto beach;
-		}
+		CHIAKI_LOGE(send_buffer->log, "Tried to push duplicate seqnum into Rudp Send Buffer");
+		goto beach;
 	}
-
-	ChiakiRudpSendBufferPacket *packet = &send_buffer->packets[send_buffer->packets_count++];
-	packet->seq_num = seq_num;
-	packet->tries = 0;
-	packet->last_send_ms = chiaki_time_now_monotonic_ms();
-	packet->buf = buf;
-	packet->buf_size = buf_size;
+	else if(err != CHIAKI_ERR_SUCCESS)
+		goto beach;
 
 	CHIAKI_LOGV(send_buffer->log, "Pushed seq num %#lx into Rudp Send Buffer", (unsigned long)seq_num);
 
-	if(send_buffer->packets_count == 1)
+	// the rto may have shrunk since older packets were armed, so this one can be the earliest
+	if(send_buffer->rudp)
 	{
-		// buffer was empty before, so it will sleep without timeout => WAKE UP!!
-		chiaki_cond_signal(&send_buffer->cond);
+		ChiakiRetransmitEntry *entry = chiaki_retransmit_queue_find(&send_buffer->queue, seq_num);
+		chiaki_timer_arm_earlier(&send_buffer->timer, entry->deadline_ms * 1000);
 	}
 
 beach:
@@ -183,54 +170,13 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_buffer_ack(ChiakiRudpSendBuffer *
 	if(err != CHIAKI_ERR_SUCCESS)
 		return err;
 
+	size_t acked = chiaki_retransmit_queue_ack_cumulative(&send_buffer->queue, seq_num, chiaki_time_now_monotonic_ms(), send_buffer->acked_seq_nums);
 	if(acked_seq_nums_count)
 		*acked_seq_nums_count = 0;
-
-	size_t i;
-	size_t shift = 0; // amount to shift back
-	size_t shift_start = SIZE_MAX;
-	for(i=0; i<send_buffer->packets_count; i++)
+	if(acked_seq_nums && acked_seq_nums_count)
 	{
-		if(send_buffer->packets[i].seq_num == seq_num || chiaki_seq_num_16_lt(send_buffer->packets[i].seq_num, seq_num))
-		{
-			if(acked_seq_nums && acked_seq_nums_count)
-				acked_seq_nums[(*acked_seq_nums_count)++] = send_buffer->packets[i].seq_num;
-
-			free(send_buffer->packets[i].buf);
-			if(shift_start == SIZE_MAX)
-			{
-				// first shift
-				shift_start = i;
-				shift = 1;
-			}
-			else if(shift_start + shift == i)
-			{
-				// still in the same gap
-				shift++;
-			}
-			else
-			{
-				// new gap, do shift
-				memmove(send_buffer->packets + shift_start,
-						send_buffer->packets + shift_start + shift,
-						(i - (shift_start + shift)) * sizeof(ChiakiRudpSendBufferPacket));
-				// start new shift
-				shift_start = i - shift;
-				shift++;
-			}
-		}
-	}
-
-	if(shift_start != SIZE_MAX)
-	{
-		// do final shift
-		if(shift_start + shift < send_buffer->packets_count)
-		{
-			memmove(send_buffer->packets + shift_start,
-					send_buffer->packets + shift_start + shift,
-					(send_buffer->packets_count - (shift_start + shift)) * sizeof(ChiakiRudpSendBufferPacket));
-		}
-		send_buffer->packets_count -= shift;
+		for(size_t i=0; i<acked; i++)
+			acked_seq_nums[(*acked_seq_nums_count)++] = (ChiakiSeqNum16)send_buffer->acked_seq_nums[i];
 	}
 
 	CHIAKI_LOGV(send_buffer->log, "Acked seq num %#lx from Rudp Send Buffer", (unsigned long)seq_num);
@@ -239,81 +185,46 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_buffer_ack(ChiakiRudpSendBuffer *
 	return err;
 }
 
-static void rudp_send_buffer_resend(ChiakiRudpSendBuffer *send_buffer);
-
-static bool rudp_send_buffer_check_pred_packets(void *user)
+CHIAKI_EXPORT bool chiaki_rudp_send_buffer_ack_selective(ChiakiRudpSendBuffer *send_buffer, ChiakiSeqNum16 seq_num)
 {
-	ChiakiRudpSendBuffer *send_buffer = user;
-	return send_buffer->should_stop;
+	if(chiaki_mutex_lock(&send_buffer->mutex) != CHIAKI_ERR_SUCCESS)
+		return false;
+	bool acked = chiaki_retransmit_queue_ack(&send_buffer->queue, seq_num, chiaki_time_now_monotonic_ms());
+	chiaki_mutex_unlock(&send_buffer->mutex);
+	return acked;
 }
 
-static bool rudp_send_buffer_check_pred_no_packets(void *user)
-{
-	ChiakiRudpSendBuffer *send_buffer = user;
-	return send_buffer->should_stop || send_buffer->packets_count;
-}
+static void rudp_send_buffer_resend_cb(ChiakiRetransmitEntry *entry, ChiakiRetransmitAction action, void *user);
 
-static void *rudp_send_buffer_thread_func(void *user)
+static void rudp_send_buffer_timer_cb(void *user)
 {
 	ChiakiRudpSendBuffer *send_buffer = user;
+	if(chiaki_mutex_lock(&send_buffer->mutex) != CHIAKI_ERR_SUCCESS)
+		return;
 
-	ChiakiErrorCode err = chiaki_mutex_lock(&send_buffer->mutex);
-	if(err != CHIAKI_ERR_SUCCESS)
-		return NULL;
-
-	while(true)
-	{
-		if(send_buffer->packets_count) // if there are packets, wait with timeout
-			err = chiaki_cond_timedwait_pred(&send_buffer->cond, &send_buffer->mutex, RUDP_DATA_RESEND_WAKEUP_TIMEOUT_MS, rudp_send_buffer_check_pred_packets, send_buffer);
-		else // if not, wait without timeout, but also wakeup if packets become available
-			err = chiaki_cond_wait_pred(&send_buffer->cond, &send_buffer->mutex, rudp_send_buffer_check_pred_no_packets, send_buffer);
-
-		if(err != CHIAKI_ERR_SUCCESS && err != CHIAKI_ERR_TIMEOUT)
-			break;
+	uint64_t now_ms = chiaki_time_now_monotonic_ms();
+	chiaki_retransmit_queue_expire(&send_buffer->queue, now_ms, rudp_send_buffer_resend_cb, send_buffer);
 
-		if(send_buffer->should_stop)
-			break;
-
-		rudp_send_buffer_resend(send_buffer);
-	}
+	// acks don't disarm the timer, so this may find nothing to do and only re-arm for whatever is left
+	uint64_t timeout_ms = chiaki_retransmit_queue_next_timeout_ms(&send_buffer->queue, now_ms);
+	if(timeout_ms != UINT64_MAX)
+		chiaki_timer_arm(&send_buffer->timer, (now_ms + timeout_ms) * 1000);
 
 	chiaki_mutex_unlock(&send_buffer->mutex);
-
-	return NULL;
 }
 
-static void rudp_send_buffer_resend(ChiakiRudpSendBuffer *send_buffer)
+static void rudp_send_buffer_resend_cb(ChiakiRetransmitEntry *entry, ChiakiRetransmitAction action, void *user)
 {
-	if(!send_buffer->rudp)
-		return;
-
-	uint64_t now = chiaki_time_now_monotonic_ms();
-
-	for(size_t i=0; i<send_buffer->packets_count; i++)
+	ChiakiRudpSendBuffer *send_buffer = user;
+	if(action == CHIAKI_RETRANSMIT_ACTION_GIVE_UP)
 	{
-		ChiakiRudpSendBufferPacket *packet = &send_buffer->packets[i];
-		if(now - packet->last_send_ms > RUDP_DATA_RESEND_TIMEOUT_MS)
-		{
-			if(packet->tries >= RUDP_DATA_RESEND_TRIES_MAX)
-			{
-				CHIAKI_LOGI(send_buffer->log, "Hit max retries of %d tries giving up on packet with seqnum %#lx", RUDP_DATA_RESEND_TRIES_MAX, (unsigned long)packet->seq_num);
-				ChiakiSeqNum16 ack_seq_nums[RUDP_SEND_BUFFER_SIZE];
-				size_t ack_seq_nums_count;
-				chiaki_mutex_unlock(&send_buffer->mutex);
-				chiaki_rudp_send_buffer_ack(send_buffer, packet->seq_num, ack_seq_nums, &ack_seq_nums_count);
-				chiaki_mutex_lock(&send_buffer->mutex);
-				if(i > 0)
-					i-= 1;
-				continue;
-			}
-			char packet_type[29] = {0};
-			GetRudpPacketType(send_buffer, *((uint16_t *)(packet->buf + 6)), packet_type);
-			CHIAKI_LOGI(send_buffer->log, "rudp Send Buffer re-sending packet with seqnum %#lx and type %s, tries: %llu", (unsigned long)packet->seq_num, packet_type, (unsigned long long)packet->tries);
-			packet->last_send_ms = now;
-			chiaki_rudp_send_raw(send_buffer->rudp, packet->buf, packet->buf_size);
-			packet->tries++;
-		}
+		CHIAKI_LOGI(send_buffer->log, "Hit max resend time of %dms after %llu tries giving up on packet with seqnum %#lx",
+				RUDP_DATA_RESEND_GIVE_UP_MS, (unsigned long long)entry->tries, (unsigned long)entry->seq_num);
+		return;
 	}
+	char packet_type[29] = {0};
+	GetRudpPacketType(send_buffer, *((uint16_t *)(entry->buf + 6)), packet_type);
+	CHIAKI_LOGI(send_buffer->log, "rudp Send Buffer re-sending packet with seqnum %#lx and type %s, tries: %llu, rto: %llums",
+			(unsigned long)entry->seq_num, packet_type, (unsigned long long)entry->tries, (unsigned long long)entry->rto_ms);
+	chiaki_rudp_send_raw(send_buffer->rudp, entry->buf, entry->buf_size);
 }
-
-#endif
\ No newline at end of file
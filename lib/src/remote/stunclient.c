@@ -0,0 +1,430 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/remote/stunclient.h>
+#include <chiaki/random.h>
+#include <chiaki/time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#endif
+
+#define STUN_MSG_TYPE_BINDING_REQUEST 0x0001
+#define STUN_MSG_TYPE_BINDING_RESPONSE 0x0101
+#define STUN_MAGIC_COOKIE 0x2112A442UL
+#define STUN_ATTRIB_MAPPED_ADDRESS 0x0001
+#define STUN_ATTRIB_XOR_MAPPED_ADDRESS 0x0020
+#define STUN_MAPPED_ADDR_FAMILY_IPV4 0x01
+#define STUN_MAPPED_ADDR_FAMILY_IPV6 0x02
+
+static uint16_t read_u16(const uint8_t *buf)
+{
+	return ((uint16_t)buf[0] << 8) | buf[1];
+}
+
+static uint32_t read_u32(const uint8_t *buf)
+{
+	return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+}
+
+CHIAKI_EXPORT void chiaki_stun_request_format(uint8_t *buf, const uint8_t *transaction_id)
+{
+	buf[0] = (STUN_MSG_TYPE_BINDING_REQUEST >> 8) & 0xff;
+	buf[1] = STUN_MSG_TYPE_BINDING_REQUEST & 0xff;
+	buf[2] = 0; // length
+	buf[3] = 0;
+	buf[4] = (STUN_MAGIC_COOKIE >> 24) & 0xff;
+	buf[5] = (STUN_MAGIC_COOKIE >> 16) & 0xff;
+	buf[6] = (STUN_MAGIC_COOKIE >> 8) & 0xff;
+	buf[7] = STUN_MAGIC_COOKIE & 0xff;
+	memcpy(buf + 8, transaction_id, CHIAKI_STUN_TRANSACTION_ID_SIZE);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_stun_response_parse(const uint8_t *buf, size_t buf_size, const uint8_t *transaction_id, char *addr, uint16_t *port)
+{
+	if(buf_size < CHIAKI_STUN_REQUEST_SIZE)
+		return CHIAKI_ERR_BUF_TOO_SMALL;
+	if(read_u16(buf) != STUN_MSG_TYPE_BINDING_RESPONSE)
+		return CHIAKI_ERR_INVALID_RESPONSE;
+	if(read_u16(buf + 2) + CHIAKI_STUN_REQUEST_SIZE != buf_size)
+		return CHIAKI_ERR_INVALID_DATA;
+	if(read_u32(buf + 4) != STUN_MAGIC_COOKIE)
+		return CHIAKI_ERR_INVALID_RESPONSE;
+	if(memcmp(buf + 8, transaction_id, CHIAKI_STUN_TRANSACTION_ID_SIZE) != 0)
+		return CHIAKI_ERR_INVALID_RESPONSE;
+
+	size_t pos = CHIAKI_STUN_REQUEST_SIZE;
+	while(pos + 4 <= buf_size)
+	{
+		uint16_t attr_type = read_u16(buf + pos);
+		uint16_t attr_length = read_u16(buf + pos + 2);
+		const uint8_t *attr = buf + pos + 4;
+		if(pos + 4 + attr_length > buf_size)
+			return CHIAKI_ERR_INVALID_DATA;
+		// attributes are padded to 4 bytes
+		pos += 4 + ((attr_length + 3) & ~3);
+
+		if(attr_type != STUN_ATTRIB_MAPPED_ADDRESS && attr_type != STUN_ATTRIB_XOR_MAPPED_ADDRESS)
+			continue;
+		bool xored = attr_type == STUN_ATTRIB_XOR_MAPPED_ADDRESS;
+		if(attr_length < 4)
+			return CHIAKI_ERR_INVALID_DATA;
+
+		uint8_t family = attr[1];
+		uint16_t mapped_port = read_u16(attr + 2);
+		if(xored)
+			mapped_port ^= (uint16_t)(STUN_MAGIC_COOKIE >> 16);
+
+		uint8_t mapped_addr[16];
+		int af;
+		if(family == STUN_MAPPED_ADDR_FAMILY_IPV4)
+		{
+			if(attr_length != 8)
+				return CHIAKI_ERR_INVALID_DATA;
+			af = AF_INET;
+			memcpy(mapped_addr, attr + 4, 4);
+			if(xored)
+			{
+				// XOR with the magic cookie, which is the start of the header in network order
+				for(size_t i=0; i<4; i++)
+					mapped_addr[i] ^= buf[4 + i];
+			}
+		}
+		else if(family == STUN_MAPPED_ADDR_FAMILY_IPV6)
+		{
+			if(attr_length != 20)
+				return CHIAKI_ERR_INVALID_DATA;
+			af = AF_INET6;
+			memcpy(mapped_addr, attr + 4, 16);
+			if(xored)
+			{
+				// XOR with concat(magic cookie, transaction id)
+				for(size_t i=0; i<16; i++)
+					mapped_addr[i] ^= buf[4 + i];
+			}
+		}
+		else
+			return CHIAKI_ERR_INVALID_DATA;
+
+		if(!inet_ntop(af, mapped_addr, addr, CHIAKI_STUN_ADDR_SIZE))
+			return CHIAKI_ERR_INVALID_DATA;
+		*port = mapped_port;
+		return CHIAKI_ERR_SUCCESS;
+	}
+
+	return CHIAKI_ERR_INVALID_RESPONSE;
+}
+
+typedef enum stun_query_state_t
+{
+	STUN_QUERY_STATE_IDLE,
+	STUN_QUERY_STATE_PENDING,
+	STUN_QUERY_STATE_DONE,
+	STUN_QUERY_STATE_FAILED
+} StunQueryState;
+
+typedef struct stun_query_server_t
+{
+	StunQueryState state;
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	uint8_t request[CHIAKI_STUN_REQUEST_SIZE];
+	unsigned int tries;
+	uint64_t rto_ms;
+	uint64_t first_send_us;
+	uint64_t next_send_us;
+	size_t start_seq;
+} StunQueryServer;
+
+static bool stun_query_resolve(ChiakiLog *log, const ChiakiStunServer *server, bool ipv4, StunQueryServer *query)
+{
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = ipv4 ? AF_INET : AF_INET6;
+	// IPv6 servers are only ever given as literal addresses
+	hints.ai_flags = ipv4 ? 0 : AI_NUMERICHOST;
+	hints.ai_socktype = SOCK_DGRAM;
+	char service[6];
+	snprintf(service, sizeof(service), "%u", (unsigned int)server->port);
+
+	struct addrinfo *resolved;
+	if(getaddrinfo(server->host, service, &hints, &resolved) != 0 || !resolved)
+	{
+		CHIAKI_LOGW(log, "STUN: Failed to resolve server %s:%u", server->host, (unsigned int)server->port);
+		return false;
+	}
+	if(resolved->ai_addrlen > sizeof(query->addr))
+	{
+		freeaddrinfo(resolved);
+		return false;
+	}
+	memcpy(&query->addr, resolved->ai_addr, resolved->ai_addrlen);
+	query->addr_len = (socklen_t)resolved->ai_addrlen;
+	freeaddrinfo(resolved);
+	return true;
+}
+
+static bool stun_query_send(ChiakiLog *log, chiaki_socket_t sock, const ChiakiStunServer *server, StunQueryServer *query, uint64_t now_us)
+{
+	CHIAKI_SSIZET_TYPE sent = sendto(sock, (CHIAKI_SOCKET_BUF_TYPE)query->request, sizeof(query->request), 0,
+			(struct sockaddr *)&query->addr, query->addr_len);
+	if(sent != sizeof(query->request))
+	{
+		CHIAKI_LOGW(log, "STUN: Failed to send request to %s:%u, error was " CHIAKI_SOCKET_ERROR_FMT,
+				server->host, (unsigned int)server->port, CHIAKI_SOCKET_ERROR_VALUE);
+		return false;
+	}
+	if(!query->tries)
+		query->first_send_us = now_us;
+	query->tries++;
+	query->next_send_us = now_us + query->rto_ms * 1000;
+	query->rto_ms *= 2;
+	return true;
+}
+
+static ChiakiErrorCode stun_query_wait(chiaki_socket_t sock, uint64_t timeout_ms, ChiakiStopPipe *stop_pipe)
+{
+	if(stop_pipe)
+		return chiaki_stop_pipe_select_single(stop_pipe, sock, false, timeout_ms);
+
+	fd_set fds;
+	FD_ZERO(&fds);
+	FD_SET(sock, &fds);
+	struct timeval timeout;
+	timeout.tv_sec = (long)(timeout_ms / 1000);
+	timeout.tv_usec = (long)((timeout_ms % 1000) * 1000);
+#ifdef _WIN32
+	int r = select(0, &fds, NULL, NULL, &timeout);
+#else
+	int r = select(sock + 1, &fds, NULL, NULL, &timeout);
+#endif
+	if(r < 0)
+		return CHIAKI_ERR_UNKNOWN;
+	return r == 0 ? CHIAKI_ERR_TIMEOUT : CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_stun_query(ChiakiLog *log, chiaki_socket_t sock, bool ipv4,
+		const ChiakiStunServer *servers, size_t servers_count,
+		ChiakiStunResult *results, size_t results_wanted, size_t *results_count,
+		uint64_t timeout_ms, ChiakiStopPipe *stop_pipe)
+{
+	*results_count = 0;
+	if(CHIAKI_SOCKET_IS_INVALID(sock) || !servers_count || !results_wanted)
+		return CHIAKI_ERR_INVALID_DATA;
+
+	StunQueryServer *queries = calloc(servers_count, sizeof(StunQueryServer));
+	if(!queries)
+		return CHIAKI_ERR_MEMORY;
+	size_t *result_seqs = calloc(results_wanted, sizeof(size_t));
+	if(!result_seqs)
+	{
+		free(queries);
+		return CHIAKI_ERR_MEMORY;
+	}
+
+	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+	uint64_t deadline_us = chiaki_time_now_monotonic_us() + timeout_ms * 1000;
+	size_t next_server = 0;
+	size_t active = 0;
+	size_t started = 0;
+	while(*results_count < results_wanted)
+	{
+		uint64_t now_us = chiaki_time_now_monotonic_us();
+		while(active < CHIAKI_STUN_QUERY_PARALLEL && next_server < servers_count)
+		{
+			StunQueryServer *query = &queries[next_server];
+			const ChiakiStunServer *server = &servers[next_server];
+			next_server++;
+			query->state = STUN_QUERY_STATE_FAILED;
+			if(!stun_query_resolve(log, server, ipv4, query))
+				continue;
+			uint8_t transaction_id[CHIAKI_STUN_TRANSACTION_ID_SIZE];
+			chiaki_random_bytes_crypt(transaction_id, sizeof(transaction_id));
+			chiaki_stun_request_format(query->request, transaction_id);
+			query->rto_ms = CHIAKI_STUN_QUERY_RTO_INITIAL_MS;
+			now_us = chiaki_time_now_monotonic_us();
+			if(!stun_query_send(log, sock, server, query, now_us))
+				continue;
+			query->state = STUN_QUERY_STATE_PENDING;
+			query->start_seq = started++;
+			active++;
+		}
+		if(!active)
+		{
+			CHIAKI_LOGE(log, "STUN: None of the %zu servers answered", servers_count);
+			break;
+		}
+		if(now_us >= deadline_us)
+		{
+			CHIAKI_LOGW(log, "STUN: Query timed out with %zu of %zu wanted responses", *results_count, results_wanted);
+			break;
+		}
+
+		// retransmit or give up on servers whose timer expired
+		uint64_t wakeup_us = deadline_us;
+		for(size_t i=0; i<next_server; i++)
+		{
+			StunQueryServer *query = &queries[i];
+			if(query->state != STUN_QUERY_STATE_PENDING)
+				continue;
+			if(query->next_send_us <= now_us)
+			{
+				if(query->tries >= CHIAKI_STUN_QUERY_TRIES_MAX || !stun_query_send(log, sock, &servers[i], query, now_us))
+				{
+					CHIAKI_LOGV(log, "STUN: No response from %s:%u after %u tries", servers[i].host, (unsigned int)servers[i].port, query->tries);
+					query->state = STUN_QUERY_STATE_FAILED;
+					active--;
+					continue;
+				}
+			}
+			if(query->next_send_us < wakeup_us)
+				wakeup_us = query->next_send_us;
+		}
+		if(active < CHIAKI_STUN_QUERY_PARALLEL && next_server < servers_count)
+			continue; // start the next server right away
+
+		uint64_t wait_ms = wakeup_us > now_us ? (wakeup_us - now_us + 999) / 1000 : 0;
+		err = stun_query_wait(sock, wait_ms, stop_pipe);
+		if(err == CHIAKI_ERR_TIMEOUT)
+		{
+			err = CHIAKI_ERR_SUCCESS;
+			continue;
+		}
+		if(err != CHIAKI_ERR_SUCCESS)
+			break;
+
+		uint8_t buf[512];
+		CHIAKI_SSIZET_TYPE received = recvfrom(sock, (CHIAKI_SOCKET_BUF_TYPE)buf, sizeof(buf), 0, NULL, NULL);
+		if(received < 0)
+		{
+			CHIAKI_LOGW(log, "STUN: Failed to receive response, error was " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+			continue;
+		}
+		if(received < CHIAKI_STUN_REQUEST_SIZE)
+			continue;
+		now_us = chiaki_time_now_monotonic_us();
+		for(size_t i=0; i<next_server; i++)
+		{
+			StunQueryServer *query = &queries[i];
+			// a late response from a server that was already given up on is still good
+			if(query->state != STUN_QUERY_STATE_PENDING && !(query->state == STUN_QUERY_STATE_FAILED && query->tries))
+				continue;
+			if(memcmp(buf + 8, query->request + 8, CHIAKI_STUN_TRANSACTION_ID_SIZE) != 0)
+				continue;
+			ChiakiStunResult *result = &results[*results_count];
+			ChiakiErrorCode parse_err = chiaki_stun_response_parse(buf, (size_t)received, query->request + 8, result->addr, &result->port);
+			if(parse_err != CHIAKI_ERR_SUCCESS)
+			{
+				CHIAKI_LOGW(log, "STUN: Invalid response from %s:%u: %s", servers[i].host, (unsigned int)servers[i].port, chiaki_error_string(parse_err));
+				break;
+			}
+			result->server_index = i;
+			result->rtt_us = now_us - query->first_send_us;
+			result_seqs[*results_count] = query->start_seq;
+			(*results_count)++;
+			if(query->state == STUN_QUERY_STATE_PENDING)
+				active--;
+			query->state = STUN_QUERY_STATE_DONE;
+			CHIAKI_LOGV(log, "STUN: %s:%u answered with %s:%u after %.1fms", servers[i].host, (unsigned int)servers[i].port,
+					result->addr, (unsigned int)result->port, result->rtt_us / 1000.0);
+			break;
+		}
+	}
+
+	// order by the time of the first request, insertion sort is plenty for a handful of results
+	for(size_t i=1; i<*results_count; i++)
+	{
+		ChiakiStunResult result = results[i];
+		size_t seq = result_seqs[i];
+		size_t j = i;
+		for(; j>0 && result_seqs[j-1] > seq; j--)
+		{
+			results[j] = results[j-1];
+			result_seqs[j] = result_seqs[j-1];
+		}
+		results[j] = result;
+		result_seqs[j] = seq;
+	}
+
+	free(result_seqs);
+	free(queries);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	return *results_count ? CHIAKI_ERR_SUCCESS : CHIAKI_ERR_TIMEOUT;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_stun_cache_init(ChiakiStunCache *cache, uint64_t ttl_ms)
+{
+	memset(cache->entries, 0, sizeof(cache->entries));
+	cache->entries_count = 0;
+	cache->ttl_ms = ttl_ms;
+	return chiaki_mutex_init(&cache->mutex, false);
+}
+
+CHIAKI_EXPORT void chiaki_stun_cache_fini(ChiakiStunCache *cache)
+{
+	chiaki_mutex_fini(&cache->mutex);
+}
+
+static ChiakiStunCacheEntry *stun_cache_find(ChiakiStunCache *cache, bool ipv4, const char *local_addr)
+{
+	for(size_t i=0; i<cache->entries_count; i++)
+	{
+		ChiakiStunCacheEntry *entry = &cache->entries[i];
+		if(entry->ipv4 == ipv4 && strcmp(entry->local_addr, local_addr) == 0)
+			return entry;
+	}
+	return NULL;
+}
+
+CHIAKI_EXPORT bool chiaki_stun_cache_get(ChiakiStunCache *cache, bool ipv4, const char *local_addr, ChiakiStunCacheEntry *entry)
+{
+	bool r = false;
+	chiaki_mutex_lock(&cache->mutex);
+	ChiakiStunCacheEntry *found = stun_cache_find(cache, ipv4, local_addr);
+	if(found && chiaki_time_now_monotonic_ms() - found->timestamp_ms < cache->ttl_ms)
+	{
+		*entry = *found;
+		r = true;
+	}
+	chiaki_mutex_unlock(&cache->mutex);
+	return r;
+}
+
+CHIAKI_EXPORT void chiaki_stun_cache_put(ChiakiStunCache *cache, const ChiakiStunCacheEntry *entry)
+{
+	chiaki_mutex_lock(&cache->mutex);
+	ChiakiStunCacheEntry *slot = stun_cache_find(cache, entry->ipv4, entry->local_addr);
+	if(!slot)
+	{
+		if(cache->entries_count < CHIAKI_STUN_CACHE_ENTRIES)
+			slot = &cache->entries[cache->entries_count++];
+		else
+		{
+			slot = &cache->entries[0];
+			for(size_t i=1; i<cache->entries_count; i++)
+			{
+				if(cache->entries[i].timestamp_ms < slot->timestamp_ms)
+					slot = &cache->entries[i];
+			}
+		}
+	}
+	*slot = *entry;
+	slot->timestamp_ms = chiaki_time_now_monotonic_ms();
+	chiaki_mutex_unlock(&cache->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_stun_cache_clear(ChiakiStunCache *cache)
+{
+	chiaki_mutex_lock(&cache->mutex);
+	cache->entries_count = 0;
+	chiaki_mutex_unlock(&cache->mutex);
+}
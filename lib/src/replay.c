@@ -0,0 +1,292 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/replay.h>
+#include <chiaki/time.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_replay_init(ChiakiReplay *replay, uint64_t duration_us, size_t bytes_max)
+{
+	memset(replay, 0, sizeof(*replay));
+	replay->duration_us = duration_us;
+	replay->bytes_max = bytes_max ? bytes_max : CHIAKI_REPLAY_BYTES_DEFAULT;
+	return chiaki_mutex_init(&replay->mutex, false);
+}
+
+static ChiakiReplayEntry *replay_entry_new(ChiakiReplayEntryType type, const uint8_t *buf, size_t buf_size)
+{
+	ChiakiReplayEntry *entry = malloc(sizeof(ChiakiReplayEntry) + buf_size);
+	if(!entry)
+		return NULL;
+	memset(entry, 0, sizeof(ChiakiReplayEntry));
+	entry->refs = 1;
+	entry->type = type;
+	entry->size = buf_size;
+	if(buf_size)
+		memcpy(entry->data, buf, buf_size);
+	return entry;
+}
+
+static void replay_entry_unref(ChiakiReplayEntry *entry)
+{
+	if(entry && chiaki_atomic_fetch_add_u32(&entry->refs, (uint32_t)-1) == 1)
+		free(entry);
+}
+
+/**
+ * Entries that can start the ring: parameter sets, or an IDR frame that has none in front of it
+ */
+static bool replay_entry_gop_start(ChiakiReplayEntry *prev, ChiakiReplayEntry *entry)
+{
+	if(entry->type == CHIAKI_REPLAY_ENTRY_VIDEO_HEADER)
+		return true;
+	return entry->type == CHIAKI_REPLAY_ENTRY_VIDEO_FRAME && entry->idr
+		&& (!prev || prev->type != CHIAKI_REPLAY_ENTRY_VIDEO_HEADER);
+}
+
+/**
+ * Remove everything in front of until, which becomes the new head. NULL removes everything.
+ * mutex must be locked
+ */
+static void replay_evict_until(ChiakiReplay *replay, ChiakiReplayEntry *until)
+{
+	while(replay->head && replay->head != until)
+	{
+		ChiakiReplayEntry *entry = replay->head;
+		replay->head = entry->next;
+		replay->bytes -= entry->size;
+		if(entry->type == CHIAKI_REPLAY_ENTRY_VIDEO_HEADER)
+		{
+			// still needed by the frames that follow
+			replay_entry_unref(replay->video_header);
+			replay->video_header = entry;
+		}
+		else
+			replay_entry_unref(entry);
+	}
+	if(!replay->head)
+		replay->tail = NULL;
+}
+
+/**
+ * @return the start of the second GOP in the ring or NULL
+ */
+static ChiakiReplayEntry *replay_gop_next(ChiakiReplay *replay)
+{
+	if(!replay->head)
+		return NULL;
+	ChiakiReplayEntry *prev = replay->head;
+	for(ChiakiReplayEntry *entry = replay->head->next; entry; prev = entry, entry = entry->next)
+	{
+		if(replay_entry_gop_start(prev, entry))
+			return entry;
+	}
+	return NULL;
+}
+
+static uint64_t replay_gop_arrival_us(ChiakiReplayEntry *gop)
+{
+	if(gop->type == CHIAKI_REPLAY_ENTRY_VIDEO_HEADER)
+		return gop->next ? gop->next->arrival_us : UINT64_MAX;
+	return gop->arrival_us;
+}
+
+/**
+ * mutex must be locked
+ */
+static void replay_evict(ChiakiReplay *replay, uint64_t now_us)
+{
+	while(replay->head)
+	{
+		ChiakiReplayEntry *gop_next = replay_gop_next(replay);
+		if(replay->bytes > replay->bytes_max)
+		{
+			if(!gop_next)
+				replay->overflows++;
+			replay_evict_until(replay, gop_next);
+			continue;
+		}
+		// only once the rest still covers the whole duration
+		if(!replay->duration_us)
+			break;
+		uint64_t gop_next_us = gop_next ? replay_gop_arrival_us(gop_next) : UINT64_MAX;
+		if(gop_next_us == UINT64_MAX || gop_next_us + replay->duration_us > now_us)
+			break;
+		replay_evict_until(replay, gop_next);
+	}
+}
+
+/**
+ * mutex must be locked
+ */
+static void replay_append(ChiakiReplay *replay, ChiakiReplayEntry *entry, uint64_t now_us)
+{
+	entry->next = NULL;
+	if(replay->tail)
+		replay->tail->next = entry;
+	else
+		replay->head = entry;
+	replay->tail = entry;
+	replay->bytes += entry->size;
+	replay_evict(replay, now_us);
+}
+
+CHIAKI_EXPORT void chiaki_replay_fini(ChiakiReplay *replay)
+{
+	replay_evict_until(replay, NULL);
+	replay_entry_unref(replay->video_header);
+	chiaki_mutex_fini(&replay->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_replay_push_video_header(ChiakiReplay *replay, const uint8_t *buf, size_t buf_size, unsigned int width, unsigned int height)
+{
+	ChiakiReplayEntry *entry = replay_entry_new(CHIAKI_REPLAY_ENTRY_VIDEO_HEADER, buf, buf_size);
+	if(!entry)
+		return;
+	entry->width = width;
+	entry->height = height;
+	chiaki_mutex_lock(&replay->mutex);
+	if(!replay->head)
+	{
+		// applies from the next IDR frame on, which will start the ring
+		replay_entry_unref(replay->video_header);
+		replay->video_header = entry;
+	}
+	else
+	{
+		replay->wait_idr = true;
+		replay_append(replay, entry, replay->tail->arrival_us);
+	}
+	chiaki_mutex_unlock(&replay->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_replay_push_video_frame(ChiakiReplay *replay, const uint8_t *buf, size_t buf_size,
+		ChiakiSeqNum16 frame_index, bool idr, uint64_t arrival_us)
+{
+	chiaki_mutex_lock(&replay->mutex);
+	// frames after new parameter sets can't be decoded before an IDR frame, other I frames don't reset references
+	if((!replay->head || replay->wait_idr) && !idr)
+		goto beach;
+	ChiakiReplayEntry *entry = replay_entry_new(CHIAKI_REPLAY_ENTRY_VIDEO_FRAME, buf, buf_size);
+	if(!entry)
+		goto beach;
+	entry->index = frame_index;
+	entry->idr = idr;
+	entry->arrival_us = arrival_us;
+	replay->wait_idr = false;
+	replay_append(replay, entry, arrival_us);
+beach:
+	chiaki_mutex_unlock(&replay->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_replay_push_audio_header(ChiakiReplay *replay, ChiakiAudioHeader *audio_header)
+{
+	chiaki_mutex_lock(&replay->mutex);
+	replay->audio_header = *audio_header;
+	replay->audio_header_set = true;
+	chiaki_mutex_unlock(&replay->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_replay_push_audio_frame(ChiakiReplay *replay, const uint8_t *buf, size_t buf_size,
+		ChiakiSeqNum16 frame_index, uint64_t arrival_us)
+{
+	chiaki_mutex_lock(&replay->mutex);
+	// nothing to play it with before the first IDR frame
+	if(!replay->head)
+		goto beach;
+	ChiakiReplayEntry *entry = replay_entry_new(CHIAKI_REPLAY_ENTRY_AUDIO_FRAME, buf, buf_size);
+	if(!entry)
+		goto beach;
+	entry->index = frame_index;
+	entry->arrival_us = arrival_us;
+	replay_append(replay, entry, arrival_us);
+beach:
+	chiaki_mutex_unlock(&replay->mutex);
+}
+
+static void replay_sink_video_header(uint8_t *buf, size_t buf_size, unsigned int width, unsigned int height, void *user)
+{
+	chiaki_replay_push_video_header(user, buf, buf_size, width, height);
+}
+
+static void replay_sink_video_frame(uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index, bool keyframe, void *user)
+{
+	chiaki_replay_push_video_frame(user, buf, buf_size, frame_index, keyframe, chiaki_time_now_monotonic_us());
+}
+
+static void replay_sink_audio_header(ChiakiAudioHeader *header, void *user)
+{
+	chiaki_replay_push_audio_header(user, header);
+}
+
+static void replay_sink_audio_frame(uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index, void *user)
+{
+	chiaki_replay_push_audio_frame(user, buf, buf_size, frame_index, chiaki_time_now_monotonic_us());
+}
+
+CHIAKI_EXPORT void chiaki_replay_get_sink(ChiakiReplay *replay, ChiakiRecordSink *sink)
+{
+	sink->user = replay;
+	sink->video_header_cb = replay_sink_video_header;
+	sink->video_frame_cb = replay_sink_video_frame;
+	sink->audio_header_cb = replay_sink_audio_header;
+	sink->audio_frame_cb = replay_sink_audio_frame;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_replay_snapshot(ChiakiReplay *replay, ChiakiReplaySnapshot *snapshot)
+{
+	memset(snapshot, 0, sizeof(*snapshot));
+	chiaki_mutex_lock(&replay->mutex);
+	ChiakiErrorCode err = CHIAKI_ERR_UNINITIALIZED;
+	bool header_in_ring = replay->head && replay->head->type == CHIAKI_REPLAY_ENTRY_VIDEO_HEADER;
+	if(!header_in_ring && !replay->video_header)
+		goto beach;
+
+	size_t count = header_in_ring ? 0 : 1;
+	size_t video_frames = 0;
+	for(ChiakiReplayEntry *entry = replay->head; entry; entry = entry->next)
+	{
+		count++;
+		if(entry->type == CHIAKI_REPLAY_ENTRY_VIDEO_FRAME)
+			video_frames++;
+	}
+	// e.g. only parameter sets whose IDR frame did not arrive yet
+	if(!video_frames)
+		goto beach;
+	snapshot->entries = malloc(count * sizeof(ChiakiReplayEntry *));
+	if(!snapshot->entries)
+	{
+		err = CHIAKI_ERR_MEMORY;
+		goto beach;
+	}
+
+	if(!header_in_ring)
+	{
+		chiaki_atomic_fetch_add_u32(&replay->video_header->refs, 1);
+		snapshot->entries[snapshot->count++] = replay->video_header;
+		snapshot->bytes += replay->video_header->size;
+	}
+	for(ChiakiReplayEntry *entry = replay->head; entry; entry = entry->next)
+	{
+		chiaki_atomic_fetch_add_u32(&entry->refs, 1);
+		snapshot->entries[snapshot->count++] = entry;
+	}
+	snapshot->bytes += replay->bytes;
+	snapshot->audio_header = replay->audio_header;
+	snapshot->audio_header_set = replay->audio_header_set;
+	err = CHIAKI_ERR_SUCCESS;
+
+beach:
+	chiaki_mutex_unlock(&replay->mutex);
+	return err;
+}
+
+CHIAKI_EXPORT void chiaki_replay_snapshot_fini(ChiakiReplaySnapshot *snapshot)
+{
+	for(size_t i=0; i<snapshot->count; i++)
+		replay_entry_unref(snapshot->entries[i]);
+	free(snapshot->entries);
+	snapshot->entries = NULL;
+	snapshot->count = 0;
+}
@@ -0,0 +1,330 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/retransmitqueue.h>
+#include <chiaki/seqnum.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+// RFC 6298
+#define RTT_ALPHA_SHIFT 3 // 1/8
+#define RTT_BETA_SHIFT 2 // 1/4
+#define RTT_K 4
+
+static bool seq_num_lt(ChiakiRetransmitQueue *queue, uint32_t a, uint32_t b)
+{
+	if(queue->config.seq_num_16)
+		return chiaki_seq_num_16_lt((ChiakiSeqNum16)a, (ChiakiSeqNum16)b);
+	return chiaki_seq_num_32_lt(a, b);
+}
+
+static size_t seq_num_bucket(ChiakiRetransmitQueue *queue, uint32_t seq_num)
+{
+	// Fibonacci hashing, consecutive seq nums end up in different buckets anyway
+	return (size_t)((seq_num * 2654435761u) >> 7) & queue->buckets_mask;
+}
+
+static uint64_t clamp_rto(ChiakiRetransmitQueue *queue, uint64_t rto_ms)
+{
+	if(rto_ms < queue->config.rto_min_ms)
+		return queue->config.rto_min_ms;
+	if(rto_ms > queue->config.rto_max_ms)
+		return queue->config.rto_max_ms;
+	return rto_ms;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_retransmit_queue_init(ChiakiRetransmitQueue *queue, size_t size, const ChiakiRetransmitConfig *config)
+{
+	memset(queue, 0, sizeof(*queue));
+	queue->config = *config;
+	if(!size)
+		return CHIAKI_ERR_INVALID_DATA;
+
+	queue->entries = calloc(size, sizeof(ChiakiRetransmitEntry));
+	if(!queue->entries)
+		return CHIAKI_ERR_MEMORY;
+	queue->size = size;
+
+	size_t buckets_count = 1;
+	while(buckets_count < size * 2)
+		buckets_count <<= 1;
+	queue->buckets = calloc(buckets_count, sizeof(ChiakiRetransmitEntry *));
+	if(!queue->buckets)
+	{
+		free(queue->entries);
+		return CHIAKI_ERR_MEMORY;
+	}
+	queue->buckets_mask = buckets_count - 1;
+
+	for(size_t i=0; i<size; i++)
+		queue->entries[i].hash_next = i + 1 < size ? &queue->entries[i + 1] : NULL;
+	queue->free_entries = &queue->entries[0];
+	queue->ordered = true;
+	queue->rto_ms = clamp_rto(queue, config->rto_initial_ms);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_retransmit_queue_fini(ChiakiRetransmitQueue *queue)
+{
+	for(ChiakiRetransmitEntry *entry = queue->head; entry; entry = entry->order_next)
+		free(entry->buf);
+	free(queue->buckets);
+	free(queue->entries);
+}
+
+static void wheel_insert(ChiakiRetransmitQueue *queue, ChiakiRetransmitEntry *entry)
+{
+	size_t slot = (entry->deadline_ms / CHIAKI_RETRANSMIT_WHEEL_TICK_MS) % CHIAKI_RETRANSMIT_WHEEL_SLOTS;
+	entry->wheel_prev = NULL;
+	entry->wheel_next = queue->wheel[slot];
+	if(entry->wheel_next)
+		entry->wheel_next->wheel_prev = entry;
+	queue->wheel[slot] = entry;
+}
+
+static void wheel_remove(ChiakiRetransmitQueue *queue, ChiakiRetransmitEntry *entry)
+{
+	if(entry->wheel_prev)
+		entry->wheel_prev->wheel_next = entry->wheel_next;
+	else
+		queue->wheel[(entry->deadline_ms / CHIAKI_RETRANSMIT_WHEEL_TICK_MS) % CHIAKI_RETRANSMIT_WHEEL_SLOTS] = entry->wheel_next;
+	if(entry->wheel_next)
+		entry->wheel_next->wheel_prev = entry->wheel_prev;
+	entry->wheel_prev = entry->wheel_next = NULL;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_retransmit_queue_push(ChiakiRetransmitQueue *queue, uint32_t seq_num, uint8_t *buf, size_t buf_size, uint64_t now_ms)
+{
+	if(queue->config.seq_num_16)
+		seq_num &= 0xffff;
+	if(chiaki_retransmit_queue_find(queue, seq_num))
+		return CHIAKI_ERR_INVALID_DATA;
+	if(!queue->free_entries)
+		return CHIAKI_ERR_OVERFLOW;
+
+	ChiakiRetransmitEntry *entry = queue->free_entries;
+	queue->free_entries = entry->hash_next;
+	memset(entry, 0, sizeof(*entry));
+	entry->seq_num = seq_num;
+	entry->first_send_ms = now_ms;
+	entry->last_send_ms = now_ms;
+	entry->rto_ms = queue->rto_ms;
+	entry->deadline_ms = now_ms + entry->rto_ms;
+	entry->buf = buf;
+	entry->buf_size = buf_size;
+
+	size_t bucket = seq_num_bucket(queue, seq_num);
+	entry->hash_next = queue->buckets[bucket];
+	queue->buckets[bucket] = entry;
+
+	if(queue->tail && !seq_num_lt(queue, queue->tail->seq_num, seq_num))
+		queue->ordered = false;
+	entry->order_prev = queue->tail;
+	if(queue->tail)
+		queue->tail->order_next = entry;
+	else
+		queue->head = entry;
+	queue->tail = entry;
+
+	if(!queue->count)
+		queue->wheel_tick = now_ms / CHIAKI_RETRANSMIT_WHEEL_TICK_MS;
+	wheel_insert(queue, entry);
+	queue->count++;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT ChiakiRetransmitEntry *chiaki_retransmit_queue_find(ChiakiRetransmitQueue *queue, uint32_t seq_num)
+{
+	if(queue->config.seq_num_16)
+		seq_num &= 0xffff;
+	for(ChiakiRetransmitEntry *entry = queue->buckets[seq_num_bucket(queue, seq_num)]; entry; entry = entry->hash_next)
+	{
+		if(entry->seq_num == seq_num)
+			return entry;
+	}
+	return NULL;
+}
+
+static void queue_remove(ChiakiRetransmitQueue *queue, ChiakiRetransmitEntry *entry)
+{
+	ChiakiRetransmitEntry **link = &queue->buckets[seq_num_bucket(queue, entry->seq_num)];
+	while(*link != entry)
+		link = &(*link)->hash_next;
+	*link = entry->hash_next;
+
+	if(entry->order_prev)
+		entry->order_prev->order_next = entry->order_next;
+	else
+		queue->head = entry->order_next;
+	if(entry->order_next)
+		entry->order_next->order_prev = entry->order_prev;
+	else
+		queue->tail = entry->order_prev;
+
+	wheel_remove(queue, entry);
+	free(entry->buf);
+	entry->buf = NULL;
+
+	entry->hash_next = queue->free_entries;
+	queue->free_entries = entry;
+	queue->count--;
+	if(!queue->count)
+		queue->ordered = true;
+}
+
+static void rtt_sample(ChiakiRetransmitQueue *queue, uint64_t rtt_us)
+{
+	if(!queue->rtt_samples)
+	{
+		queue->srtt_us = rtt_us;
+		queue->rttvar_us = rtt_us / 2;
+	}
+	else
+	{
+		uint64_t delta = rtt_us > queue->srtt_us ? rtt_us - queue->srtt_us : queue->srtt_us - rtt_us;
+		queue->rttvar_us = queue->rttvar_us - (queue->rttvar_us >> RTT_BETA_SHIFT) + (delta >> RTT_BETA_SHIFT);
+		queue->srtt_us = queue->srtt_us - (queue->srtt_us >> RTT_ALPHA_SHIFT) + (rtt_us >> RTT_ALPHA_SHIFT);
+	}
+	queue->rtt_samples++;
+	queue->rto_ms = clamp_rto(queue, (queue->srtt_us + RTT_K * queue->rttvar_us + 999) / 1000);
+}
+
+CHIAKI_EXPORT bool chiaki_retransmit_queue_ack(ChiakiRetransmitQueue *queue, uint32_t seq_num, uint64_t now_ms)
+{
+	ChiakiRetransmitEntry *entry = chiaki_retransmit_queue_find(queue, seq_num);
+	if(!entry)
+		return false;
+	// Karn's algorithm: an ack for a re-sent packet is ambiguous
+	if(!entry->tries && now_ms >= entry->first_send_ms)
+		rtt_sample(queue, (now_ms - entry->first_send_ms) * 1000);
+	queue_remove(queue, entry);
+	return true;
+}
+
+CHIAKI_EXPORT size_t chiaki_retransmit_queue_ack_cumulative(ChiakiRetransmitQueue *queue, uint32_t seq_num, uint64_t now_ms, uint32_t *acked_seq_nums)
+{
+	if(queue->config.seq_num_16)
+		seq_num &= 0xffff;
+	size_t acked = 0;
+	// sample the RTT from the newest packet that was never re-sent
+	uint64_t sample_send_ms = 0;
+	bool sample = false;
+
+	ChiakiRetransmitEntry *entry = queue->head;
+	while(entry)
+	{
+		ChiakiRetransmitEntry *next = entry->order_next;
+		if(entry->seq_num == seq_num || seq_num_lt(queue, entry->seq_num, seq_num))
+		{
+			if(!entry->tries && now_ms >= entry->first_send_ms && (!sample || entry->first_send_ms >= sample_send_ms))
+			{
+				sample = true;
+				sample_send_ms = entry->first_send_ms;
+			}
+			if(acked_seq_nums)
+				acked_seq_nums[acked] = entry->seq_num;
+			acked++;
+			queue_remove(queue, entry);
+		}
+		else if(queue->ordered)
+		{
+			// everything behind is newer
+			break;
+		}
+		entry = next;
+	}
+
+	if(sample)
+		rtt_sample(queue, (now_ms - sample_send_ms) * 1000);
+	return acked;
+}
+
+CHIAKI_EXPORT size_t chiaki_retransmit_queue_expire(ChiakiRetransmitQueue *queue, uint64_t now_ms, ChiakiRetransmitCallback cb, void *user)
+{
+	if(!queue->count)
+		return 0;
+	uint64_t now_tick = now_ms / CHIAKI_RETRANSMIT_WHEEL_TICK_MS;
+	if(now_tick < queue->wheel_tick)
+		return 0;
+
+	// collect everything that is due first, re-armed timers may land in a slot that is still to be visited
+	ChiakiRetransmitEntry *due = NULL;
+	uint64_t ticks = now_tick - queue->wheel_tick + 1;
+	if(ticks > CHIAKI_RETRANSMIT_WHEEL_SLOTS)
+		ticks = CHIAKI_RETRANSMIT_WHEEL_SLOTS;
+	for(uint64_t t=0; t<ticks; t++)
+	{
+		size_t slot = (now_tick - t) % CHIAKI_RETRANSMIT_WHEEL_SLOTS;
+		ChiakiRetransmitEntry *entry = queue->wheel[slot];
+		while(entry)
+		{
+			ChiakiRetransmitEntry *next = entry->wheel_next;
+			if(entry->deadline_ms <= now_ms)
+			{
+				wheel_remove(queue, entry);
+				entry->wheel_next = due;
+				due = entry;
+			}
+			entry = next;
+		}
+	}
+	queue->wheel_tick = now_tick;
+
+	size_t expired = 0;
+	while(due)
+	{
+		ChiakiRetransmitEntry *entry = due;
+		due = entry->wheel_next;
+		entry->wheel_next = NULL;
+		expired++;
+		if(now_ms - entry->first_send_ms >= queue->config.give_up_ms)
+		{
+			queue->give_ups++;
+			// still has to be in a wheel slot for queue_remove
+			wheel_insert(queue, entry);
+			cb(entry, CHIAKI_RETRANSMIT_ACTION_GIVE_UP, user);
+			queue_remove(queue, entry);
+			continue;
+		}
+		cb(entry, CHIAKI_RETRANSMIT_ACTION_RESEND, user);
+		queue->resends++;
+		entry->tries++;
+		entry->last_send_ms = now_ms;
+		entry->rto_ms = clamp_rto(queue, entry->rto_ms * 2);
+		entry->deadline_ms = now_ms + entry->rto_ms;
+		wheel_insert(queue, entry);
+	}
+	return expired;
+}
+
+CHIAKI_EXPORT uint64_t chiaki_retransmit_queue_next_timeout_ms(ChiakiRetransmitQueue *queue, uint64_t now_ms)
+{
+	if(!queue->count)
+		return UINT64_MAX;
+
+	// walk the wheel from the last expired tick, the first slot with an entry due in this round has the earliest deadline
+	uint64_t deadline_ms = UINT64_MAX;
+	for(uint64_t t=0; t<CHIAKI_RETRANSMIT_WHEEL_SLOTS; t++)
+	{
+		uint64_t tick = queue->wheel_tick + t;
+		for(ChiakiRetransmitEntry *entry = queue->wheel[tick % CHIAKI_RETRANSMIT_WHEEL_SLOTS]; entry; entry = entry->wheel_next)
+		{
+			if(entry->deadline_ms / CHIAKI_RETRANSMIT_WHEEL_TICK_MS <= tick && entry->deadline_ms < deadline_ms)
+				deadline_ms = entry->deadline_ms;
+		}
+		if(deadline_ms != UINT64_MAX)
+			break;
+	}
+
+	// only timers further away than one revolution left
+	if(deadline_ms == UINT64_MAX)
+	{
+		for(ChiakiRetransmitEntry *entry = queue->head; entry; entry = entry->order_next)
+		{
+			if(entry->deadline_ms < deadline_ms)
+				deadline_ms = entry->deadline_ms;
+		}
+	}
+
+	return deadline_ms > now_ms ? deadline_ms - now_ms : 0;
+}
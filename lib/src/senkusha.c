@@ -32,6 +32,9 @@
 #define CONNECT_TIMEOUT_MS 30000
 
 #define SENKUSHA_PING_COUNT_DEFAULT 10
+#define SENKUSHA_PING_COUNT_HINT 3
+#define SENKUSHA_MTU_MIN 576
+#define SENKUSHA_MTU_MAX 1454
 #define EXPECT_PONG_TIMEOUT_MS 1000
 
 // Assuming IPv4, sizeof(ip header) + sizeof(udp header)
@@ -56,7 +59,7 @@ typedef enum {
 
 static ChiakiErrorCode senkusha_run_rtt_test(ChiakiSenkusha *senkusha, uint16_t ping_test_index, uint16_t ping_count, uint64_t *rtt_us);
 static ChiakiErrorCode senkusha_run_mtu_in_test(ChiakiSenkusha *senkusha, uint32_t min, uint32_t max, uint32_t retries, uint64_t timeout_ms, uint32_t *mtu);
-static ChiakiErrorCode senkusha_run_mtu_out_test(ChiakiSenkusha *senkusha, uint32_t mtu_in, uint32_t min, uint32_t max, uint32_t retries, uint64_t timeout_ms, uint32_t *mtu);
+static ChiakiErrorCode senkusha_run_mtu_out_test(ChiakiSenkusha *senkusha, uint32_t mtu_in, uint32_t min, uint32_t max, uint32_t start, uint32_t retries, uint64_t timeout_ms, uint32_t *mtu);
 static void senkusha_takion_cb(ChiakiTakionEvent *event, void *user);
 static void senkusha_takion_data(ChiakiSenkusha *senkusha, ChiakiTakionMessageDataType data_type, uint8_t *buf, size_t buf_size);
 static void senkusha_takion_data_ack(ChiakiSenkusha *senkusha, ChiakiSeqNum32 seq_num);
@@ -112,7 +115,16 @@ static bool state_finished_cond_check(void *user)
 	return senkusha->state_finished || senkusha->should_stop;
 }
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_senkusha_run(ChiakiSenkusha *senkusha, uint32_t *mtu_in, uint32_t *mtu_out, uint64_t *rtt_us, chiaki_socket_t *socket)
+static uint32_t mtu_clamp(uint32_t mtu)
+{
+	if(mtu <= SENKUSHA_MTU_MIN)
+		return SENKUSHA_MTU_MIN + 1;
+	if(mtu > SENKUSHA_MTU_MAX)
+		return SENKUSHA_MTU_MAX;
+	return mtu;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_senkusha_run(ChiakiSenkusha *senkusha, uint32_t *mtu_in, uint32_t *mtu_out, uint64_t *rtt_us, chiaki_socket_t *socket, const ChiakiNetworkProfile *hint)
 {
 	ChiakiSession *session = senkusha->session;
 	ChiakiErrorCode err;
@@ -133,6 +145,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_senkusha_run(ChiakiSenkusha *senkusha, uint
 
 	ChiakiTakionConnectInfo takion_info;
 	takion_info.log = senkusha->log;
+	takion_info.trace = NULL;
 	if(!socket)
 	{
 		takion_info.close_socket = true;
@@ -249,7 +262,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_senkusha_run(ChiakiSenkusha *senkusha, uint
 
 	CHIAKI_LOGI(session->log, "Senkusha successfully received bang");
 
-	err = senkusha_run_rtt_test(senkusha, 0, SENKUSHA_PING_COUNT_DEFAULT, rtt_us);
+	err = senkusha_run_rtt_test(senkusha, 0, hint ? SENKUSHA_PING_COUNT_HINT : SENKUSHA_PING_COUNT_DEFAULT, rtt_us);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		CHIAKI_LOGE(senkusha->log, "Senkusha Ping Test failed");
@@ -262,14 +275,19 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_senkusha_run(ChiakiSenkusha *senkusha, uint
 	if(mtu_timeout_ms > 500)
 		mtu_timeout_ms = 500;
 
-	err = senkusha_run_mtu_in_test(senkusha, 576, 1454, 3, mtu_timeout_ms, mtu_in);
+	// With a hint, the cached values are probed first and only searched below if they don't pass anymore,
+	// so a route that has not changed takes a single probe per direction.
+	uint32_t mtu_in_max = hint ? mtu_clamp(hint->mtu_in) : SENKUSHA_MTU_MAX;
+	err = senkusha_run_mtu_in_test(senkusha, SENKUSHA_MTU_MIN, mtu_in_max, 3, mtu_timeout_ms, mtu_in);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		CHIAKI_LOGE(senkusha->log, "Senkusha MTU in test failed");
 		goto disconnect;
 	}
 
-	err = senkusha_run_mtu_out_test(senkusha, *mtu_in, 576, 1454, 3, mtu_timeout_ms, mtu_out);
+	uint32_t mtu_out_max = hint ? mtu_clamp(hint->mtu_out) : SENKUSHA_MTU_MAX;
+	uint32_t mtu_out_start = hint ? mtu_out_max : *mtu_in;
+	err = senkusha_run_mtu_out_test(senkusha, *mtu_in, SENKUSHA_MTU_MIN, mtu_out_max, mtu_out_start, 3, mtu_timeout_ms, mtu_out);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		CHIAKI_LOGE(senkusha->log, "Senkusha MTU out test failed");
@@ -454,9 +472,9 @@ static ChiakiErrorCode senkusha_run_mtu_in_test(ChiakiSenkusha *senkusha, uint32
 	return CHIAKI_ERR_SUCCESS;
 }
 
-static ChiakiErrorCode senkusha_run_mtu_out_test(ChiakiSenkusha *senkusha, uint32_t mtu_in, uint32_t min, uint32_t max, uint32_t retries, uint64_t timeout_ms, uint32_t *mtu)
+static ChiakiErrorCode senkusha_run_mtu_out_test(ChiakiSenkusha *senkusha, uint32_t mtu_in, uint32_t min, uint32_t max, uint32_t start, uint32_t retries, uint64_t timeout_ms, uint32_t *mtu)
 {
-	if(min < 8 + MTU_PING_DATA_ADD || max < min || mtu_in < min || mtu_in > max)
+	if(min < 8 + MTU_PING_DATA_ADD || max < min || start < min || start > max)
 		return CHIAKI_ERR_INVALID_DATA;
 
 	CHIAKI_LOGI(senkusha->log, "Senkusha starting MTU out test with min %u, max %u, retries %u, timeout %llu ms",
@@ -512,7 +530,7 @@ static ChiakiErrorCode senkusha_run_mtu_out_test(ChiakiSenkusha *senkusha, uint3
 
 	err = CHIAKI_ERR_SUCCESS;
 
-	uint32_t cur = mtu_in;
+	uint32_t cur = start;
 	while((max - min) > 1)
 	{
 		bool success = false;
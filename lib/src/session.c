@@ -6,6 +6,7 @@
 #include <chiaki/http.h>
 #include <chiaki/base64.h>
 #include <chiaki/random.h>
+#include <chiaki/time.h>
 
 #include <stdlib.h>
 #include <string.h>
@@ -135,6 +136,35 @@ CHIAKI_EXPORT void chiaki_connect_video_profile_preset(ChiakiConnectVideoProfile
 	}
 }
 
+CHIAKI_EXPORT const char *chiaki_session_phase_string(ChiakiSessionPhase phase)
+{
+	switch(phase)
+	{
+		case CHIAKI_SESSION_PHASE_RESOLVE:
+			return "resolve";
+		case CHIAKI_SESSION_PHASE_KEY_GEN:
+			return "key_gen";
+		case CHIAKI_SESSION_PHASE_PSN_REGIST:
+			return "psn_regist";
+		case CHIAKI_SESSION_PHASE_SESSION_REQUEST:
+			return "session_request";
+		case CHIAKI_SESSION_PHASE_CTRL:
+			return "ctrl";
+		case CHIAKI_SESSION_PHASE_LOGIN_PIN:
+			return "login_pin";
+		case CHIAKI_SESSION_PHASE_HOLEPUNCH:
+			return "holepunch";
+		case CHIAKI_SESSION_PHASE_SENKUSHA:
+			return "senkusha";
+		case CHIAKI_SESSION_PHASE_STREAM_CONNECT:
+			return "stream_connect";
+		case CHIAKI_SESSION_PHASE_FIRST_FRAME:
+			return "first_frame";
+		default:
+			return "unknown";
+	}
+}
+
 CHIAKI_EXPORT const char *chiaki_quit_reason_string(ChiakiQuitReason reason)
 {
 	switch(reason)
@@ -183,6 +213,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_session_init(ChiakiSession *session, Chiaki
 	session->holepunch_session = connect_info->holepunch_session;
 	session->rudp = NULL;
 	session->dontfrag = true;
+	chiaki_network_profile_cache_init(&session->network_profile_cache, log);
 
 	ChiakiErrorCode err = chiaki_cond_init(&session->state_cond);
 	if(err != CHIAKI_ERR_SUCCESS)
@@ -192,10 +223,14 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_session_init(ChiakiSession *session, Chiaki
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_state_cond;
 
-	err = chiaki_stop_pipe_init(&session->stop_pipe);
+	err = chiaki_mutex_init(&session->timeline_mutex, false);
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_state_mutex;
 
+	err = chiaki_stop_pipe_init(&session->stop_pipe);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_timeline_mutex;
+
 	chiaki_mutex_lock(&session->state_mutex);
 	session->should_stop = false;
 	session->ctrl_session_id_received = false;
@@ -205,16 +240,37 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_session_init(ChiakiSession *session, Chiaki
 	session->stream_connection_switch_received = false;
 	session->login_pin = NULL;
 	session->login_pin_size = 0;
+	memset(&session->resume_stats, 0, sizeof(session->resume_stats));
+	session->resume_attempt = 0;
+	session->resume_lost_us = 0;
 	chiaki_mutex_unlock(&session->state_mutex);
 
+	err = chiaki_trace_init(&session->trace, connect_info->trace_events);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(session->log, "Trace init failed");
+		goto error_stop_pipe;
+	}
+
+	session->thread_pool = NULL;
+	session->thread_pool_affinity = 0;
+	if(connect_info->thread_pool)
+	{
+		session->thread_pool = chiaki_thread_pool_shared_ref();
+		if(session->thread_pool)
+			session->thread_pool_affinity = chiaki_thread_pool_affinity(session->thread_pool);
+		else
+			CHIAKI_LOGW(session->log, "Failed to start thread pool, running without it");
+	}
+
 	err = chiaki_ctrl_init(&session->ctrl, session);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		CHIAKI_LOGE(session->log, "Ctrl init failed");
-		goto error_stop_pipe;
+		goto error_thread_pool;
 	}
 
-	err = chiaki_stream_connection_init(&session->stream_connection, session, connect_info->packet_loss_max);
+	err = chiaki_stream_connection_init(&session->stream_connection, session, connect_info->packet_loss_max, connect_info->congestion_control_policy);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		CHIAKI_LOGE(session->log, "StreamConnection init failed");
@@ -236,8 +292,21 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_session_init(ChiakiSession *session, Chiaki
 			hints.ai_family = AF_INET6;
 		else
 			hints.ai_family = AF_INET;
+		// Addresses are parsed right away, names are resolved on the session thread
+		// while the keys are generated.
+		hints.ai_flags = AI_NUMERICHOST;
 		int r = getaddrinfo(connect_info->host, NULL, &hints, &session->connect_info.host_addrinfos);
-		if(r != 0)
+		if(r == EAI_NONAME && !ipv6)
+		{
+			session->connect_info.host_addrinfos = NULL;
+			session->host_unresolved = strdup(connect_info->host);
+			if(!session->host_unresolved)
+			{
+				chiaki_session_fini(session);
+				return CHIAKI_ERR_MEMORY;
+			}
+		}
+		else if(r != 0)
 		{
 			chiaki_session_fini(session);
 			return CHIAKI_ERR_PARSE_ADDR;
@@ -263,13 +332,20 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_session_init(ChiakiSession *session, Chiaki
 	session->connect_info.video_profile_auto_downgrade = connect_info->video_profile_auto_downgrade;
 	session->connect_info.enable_keyboard = connect_info->enable_keyboard;
 	session->connect_info.enable_dualsense = connect_info->enable_dualsense;
+	session->connect_info.video_warm_start = connect_info->video_warm_start;
+	session->connect_info.session_resume = connect_info->session_resume;
 
 	return CHIAKI_ERR_SUCCESS;
 
 error_ctrl:
 	chiaki_ctrl_fini(&session->ctrl);
+error_thread_pool:
+	chiaki_thread_pool_shared_unref(session->thread_pool);
+	chiaki_trace_fini(&session->trace);
 error_stop_pipe:
 	chiaki_stop_pipe_fini(&session->stop_pipe);
+error_timeline_mutex:
+	chiaki_mutex_fini(&session->timeline_mutex);
 error_state_mutex:
 	chiaki_mutex_fini(&session->state_mutex);
 error_state_cond:
@@ -295,14 +371,25 @@ CHIAKI_EXPORT void chiaki_session_fini(ChiakiSession *session)
 		chiaki_rudp_fini(session->rudp);
 	if(session->holepunch_session)
 		chiaki_holepunch_session_fini(session->holepunch_session);
+	chiaki_thread_pool_shared_unref(session->thread_pool);
+	chiaki_trace_fini(&session->trace);
 	chiaki_stop_pipe_fini(&session->stop_pipe);
 	chiaki_cond_fini(&session->state_cond);
+	chiaki_mutex_fini(&session->timeline_mutex);
 	chiaki_mutex_fini(&session->state_mutex);
-	freeaddrinfo(session->connect_info.host_addrinfos);
+	free(session->host_unresolved);
+	if(session->connect_info.host_addrinfos)
+		freeaddrinfo(session->connect_info.host_addrinfos);
 }
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_session_start(ChiakiSession *session)
 {
+	chiaki_mutex_lock(&session->timeline_mutex);
+	session->timeline_start_us = chiaki_time_now_monotonic_us();
+	memset(&session->timeline, 0, sizeof(session->timeline));
+	session->timeline_sent = false;
+	chiaki_mutex_unlock(&session->timeline_mutex);
+
 	ChiakiErrorCode err = chiaki_thread_create(&session->session_thread, session_thread_func, session);
 	if(err != CHIAKI_ERR_SUCCESS)
 		return err;
@@ -330,6 +417,23 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_session_join(ChiakiSession *session)
 	return chiaki_thread_join(&session->session_thread, NULL);
 }
 
+CHIAKI_EXPORT void chiaki_session_get_resume_stats(ChiakiSession *session, ChiakiSessionResumeStats *stats)
+{
+	chiaki_mutex_lock(&session->state_mutex);
+	*stats = session->resume_stats;
+	chiaki_mutex_unlock(&session->state_mutex);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_session_trace_dump(ChiakiSession *session, const char *path)
+{
+	ChiakiErrorCode err = chiaki_trace_dump_file(&session->trace, path);
+	if(err == CHIAKI_ERR_SUCCESS)
+		CHIAKI_LOGI(session->log, "Packet trace written to %s", path);
+	else if(err != CHIAKI_ERR_UNINITIALIZED)
+		CHIAKI_LOGE(session->log, "Failed to write packet trace to %s: %s", path, chiaki_error_string(err));
+	return err;
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_session_set_controller_state(ChiakiSession *session, ChiakiControllerState *state)
 {
 	ChiakiErrorCode err = chiaki_mutex_lock(&session->stream_connection.feedback_sender_mutex);
@@ -371,13 +475,113 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_session_set_stream_connection_switch_receiv
 	return CHIAKI_ERR_SUCCESS;
 }
 
+static void session_resume_connected(ChiakiSession *session);
+
 void chiaki_session_send_event(ChiakiSession *session, ChiakiEvent *event)
 {
+	if(event->type == CHIAKI_EVENT_CONNECTED)
+		session_resume_connected(session);
 	if(!session->event_cb)
 		return;
 	session->event_cb(event, session->event_cb_user);
 }
 
+void chiaki_session_timeline_begin(ChiakiSession *session, ChiakiSessionPhase phase)
+{
+	uint64_t now_us = chiaki_time_now_monotonic_us();
+	chiaki_mutex_lock(&session->timeline_mutex);
+	if(session->timeline_sent) // resumed after startup
+	{
+		chiaki_mutex_unlock(&session->timeline_mutex);
+		return;
+	}
+	ChiakiSessionPhaseTime *time = &session->timeline.phases[phase];
+	time->done = false;
+	time->start_us = now_us - session->timeline_start_us;
+	time->end_us = time->start_us;
+	chiaki_mutex_unlock(&session->timeline_mutex);
+}
+
+void chiaki_session_timeline_end(ChiakiSession *session, ChiakiSessionPhase phase)
+{
+	uint64_t now_us = chiaki_time_now_monotonic_us();
+	chiaki_mutex_lock(&session->timeline_mutex);
+	if(session->timeline_sent)
+	{
+		chiaki_mutex_unlock(&session->timeline_mutex);
+		return;
+	}
+	ChiakiSessionPhaseTime *time = &session->timeline.phases[phase];
+	time->done = true;
+	time->end_us = now_us - session->timeline_start_us;
+	chiaki_mutex_unlock(&session->timeline_mutex);
+}
+
+/**
+ * Close the timeline and send it with CHIAKI_EVENT_STARTUP_TIMELINE, only the first call has an effect.
+ */
+void chiaki_session_timeline_finish(ChiakiSession *session)
+{
+	uint64_t now_us = chiaki_time_now_monotonic_us();
+	ChiakiEvent event = { 0 };
+	event.type = CHIAKI_EVENT_STARTUP_TIMELINE;
+	chiaki_mutex_lock(&session->timeline_mutex);
+	if(session->timeline_sent)
+	{
+		chiaki_mutex_unlock(&session->timeline_mutex);
+		return;
+	}
+	session->timeline_sent = true;
+	session->timeline.total_us = now_us - session->timeline_start_us;
+	event.startup_timeline = session->timeline;
+	chiaki_mutex_unlock(&session->timeline_mutex);
+
+	CHIAKI_LOGI(session->log, "Session startup took %.1f ms", (double)event.startup_timeline.total_us / 1000.0);
+	for(size_t i=0; i<CHIAKI_SESSION_PHASE_COUNT; i++)
+	{
+		ChiakiSessionPhaseTime *time = &event.startup_timeline.phases[i];
+		if(!time->done)
+			continue;
+		CHIAKI_LOGI(session->log, "  %-16s %8.1f ms .. %8.1f ms (%.1f ms)", chiaki_session_phase_string((ChiakiSessionPhase)i),
+				(double)time->start_us / 1000.0, (double)time->end_us / 1000.0, (double)(time->end_us - time->start_us) / 1000.0);
+	}
+	chiaki_session_send_event(session, &event);
+}
+
+static ChiakiErrorCode session_gen_keys(ChiakiSession *session)
+{
+	session->key_gen_err = chiaki_random_bytes_crypt(session->handshake_key, sizeof(session->handshake_key));
+	if(session->key_gen_err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(session->log, "Session failed to generate handshake key");
+		return session->key_gen_err;
+	}
+	session->key_gen_err = chiaki_ecdh_init(&session->ecdh);
+	if(session->key_gen_err != CHIAKI_ERR_SUCCESS)
+		CHIAKI_LOGE(session->log, "Session failed to initialize ECDH");
+	return session->key_gen_err;
+}
+
+static void *session_key_gen_thread_func(void *arg)
+{
+	ChiakiSession *session = arg;
+	chiaki_session_timeline_begin(session, CHIAKI_SESSION_PHASE_KEY_GEN);
+	if(session_gen_keys(session) == CHIAKI_ERR_SUCCESS)
+		chiaki_session_timeline_end(session, CHIAKI_SESSION_PHASE_KEY_GEN);
+	return NULL;
+}
+
+/**
+ * Replace the handshake key and ECDH keypair, so every stream connection of a resumed session gets its own.
+ */
+static ChiakiErrorCode session_regen_keys(ChiakiSession *session)
+{
+	if(session->key_gen_err == CHIAKI_ERR_SUCCESS)
+		chiaki_ecdh_fini(&session->ecdh);
+	session->key_gen_err = CHIAKI_ERR_UNINITIALIZED;
+	return session_gen_keys(session);
+}
+
 
 static bool session_check_state_pred(void *user)
 {
@@ -395,6 +599,12 @@ static bool session_check_state_pred_ctrl_start(void *user)
 		   || session->ctrl_login_pin_requested;
 }
 
+static bool session_check_state_pred_stop(void *user)
+{
+	ChiakiSession *session = user;
+	return session->should_stop;
+}
+
 static bool session_check_state_pred_pin(void *user)
 {
 	ChiakiSession *session = user;
@@ -419,8 +629,228 @@ static bool session_check_state_pred_regist(void *user)
 		|| session->psn_regist_succeeded;
 }
 
+static ChiakiErrorCode session_resolve_host(ChiakiSession *session)
+{
+	chiaki_session_timeline_begin(session, CHIAKI_SESSION_PHASE_RESOLVE);
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_family = AF_INET; // see chiaki_session_init()
+	int r = getaddrinfo(session->host_unresolved, NULL, &hints, &session->connect_info.host_addrinfos);
+	if(r != 0)
+	{
+		CHIAKI_LOGE(session->log, "Failed to resolve %s: %s", session->host_unresolved, gai_strerror(r));
+		session->connect_info.host_addrinfos = NULL;
+		return CHIAKI_ERR_PARSE_ADDR;
+	}
+	chiaki_session_timeline_end(session, CHIAKI_SESSION_PHASE_RESOLVE);
+	free(session->host_unresolved);
+	session->host_unresolved = NULL;
+	return CHIAKI_ERR_SUCCESS;
+}
+
 #define ENABLE_SENKUSHA
 
+#ifdef ENABLE_SENKUSHA
+/**
+ * Only direct local connections are cached, the route of a holepunched connection is different every time.
+ */
+static ChiakiNetworkProfileFreshness session_network_profile_lookup(ChiakiSession *session, chiaki_socket_t *data_sock, ChiakiNetworkProfile *profile)
+{
+	if(session->rudp || data_sock || CHIAKI_SOCKET_IS_INVALID(session->ctrl.sock))
+		return CHIAKI_NETWORK_PROFILE_MISSING;
+
+	struct sockaddr_storage local_addr;
+	socklen_t local_addr_len = sizeof(local_addr);
+	if(getsockname(session->ctrl.sock, (struct sockaddr *)&local_addr, &local_addr_len) < 0)
+		return CHIAKI_NETWORK_PROFILE_MISSING;
+
+	char key[CHIAKI_NETWORK_PROFILE_KEY_SIZE];
+	ChiakiErrorCode err = chiaki_network_profile_format_key(key, sizeof(key),
+			(const uint8_t *)session->connect_info.regist_key, sizeof(session->connect_info.regist_key),
+			(struct sockaddr *)&local_addr, session->connect_info.host_addrinfo_selected->ai_addr);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return CHIAKI_NETWORK_PROFILE_MISSING;
+
+	return chiaki_network_profile_cache_lookup(&session->network_profile_cache, key, profile);
+}
+#endif
+
+/**
+ * Call with state_mutex locked, after the stream connection returned err.
+ */
+static bool session_resume_possible(ChiakiSession *session, ChiakiErrorCode err)
+{
+	if(!session->connect_info.session_resume
+		|| session->rudp // the data connection was punched through PSN and can't simply be reconnected
+		|| session->should_stop
+		|| err == CHIAKI_ERR_SUCCESS || err == CHIAKI_ERR_CANCELED || err == CHIAKI_ERR_DISCONNECTED)
+		return false;
+	// a session that never connected is not resumed, but an attempt that did not connect again is retried
+	if(!session->resume_attempt && !session->stream_connection.connected)
+		return false;
+	if(session->resume_attempt >= CHIAKI_SESSION_RESUME_ATTEMPTS_MAX)
+	{
+		CHIAKI_LOGE(session->log, "Giving up resuming the session after %u attempts", session->resume_attempt);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Stop ctrl and start it again with a fresh session request, keeping everything else from the first connect.
+ * Call with state_mutex locked.
+ */
+static ChiakiErrorCode session_thread_restart_ctrl(ChiakiSession *session, bool *ctrl_running)
+{
+	chiaki_mutex_unlock(&session->state_mutex);
+	if(*ctrl_running)
+	{
+		chiaki_ctrl_stop(&session->ctrl);
+		chiaki_ctrl_join(&session->ctrl);
+		*ctrl_running = false;
+	}
+	ChiakiErrorCode err = chiaki_ctrl_reset(&session->ctrl);
+	chiaki_mutex_lock(&session->state_mutex);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+
+	session->ctrl_failed = false;
+	session->ctrl_session_id_received = false;
+	session->ctrl_login_pin_requested = false;
+	session->quit_reason = CHIAKI_QUIT_REASON_NONE;
+
+	// the server target is already known from the first request
+	err = session_thread_request_session(session, NULL);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error;
+	chiaki_rpcrypt_init_auth(&session->rpcrypt, session->target, session->nonce, session->connect_info.morning);
+
+	err = chiaki_ctrl_start(&session->ctrl);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error;
+	*ctrl_running = true;
+	chiaki_cond_timedwait_pred(&session->state_cond, &session->state_mutex, SESSION_EXPECT_CTRL_START_MS, session_check_state_pred_ctrl_start, session);
+	if(session->should_stop)
+		return CHIAKI_ERR_CANCELED;
+	if(session->ctrl_failed || session->ctrl_login_pin_requested)
+	{
+		// asking for the PIN again is not what resuming in the background is for
+		err = CHIAKI_ERR_UNKNOWN;
+		goto error;
+	}
+	if(!session->ctrl_session_id_received)
+	{
+		chiaki_mutex_unlock(&session->state_mutex);
+		err = ctrl_message_set_fallback_session_id(&session->ctrl);
+		chiaki_mutex_lock(&session->state_mutex);
+		if(err != CHIAKI_ERR_SUCCESS)
+			goto error;
+		ctrl_enable_features(&session->ctrl);
+	}
+	return CHIAKI_ERR_SUCCESS;
+error:
+	CHIAKI_LOGW(session->log, "Restarting ctrl for resume failed");
+	// the next attempt starts over, this one's failure is not what ends the session
+	session->quit_reason = CHIAKI_QUIT_REASON_NONE;
+	session->ctrl_failed = true;
+	return err;
+}
+
+/**
+ * Wait for the next resume attempt and get ctrl ready for it, call with state_mutex locked.
+ * Every attempt after the first restarts ctrl too, as the first one only reconnects the stream
+ * in case ctrl survived the loss.
+ * @return CHIAKI_ERR_SUCCESS to run the stream connection again
+ */
+static ChiakiErrorCode session_thread_resume(ChiakiSession *session, bool *ctrl_running)
+{
+	while(true)
+	{
+		unsigned int attempt = ++session->resume_attempt;
+		if(attempt == 1)
+		{
+			CHIAKI_LOGW(session->log, "Stream connection lost, trying to resume the session");
+			session->resume_stats.resuming = true;
+			session->resume_lost_us = chiaki_time_now_monotonic_us();
+		}
+		session->resume_stats.attempts++;
+
+		ChiakiEvent event = { 0 };
+		event.type = CHIAKI_EVENT_RESUME;
+		event.resume.attempt = attempt;
+		chiaki_mutex_unlock(&session->state_mutex);
+		chiaki_session_send_event(session, &event);
+		chiaki_mutex_lock(&session->state_mutex);
+
+		uint64_t backoff_ms = CHIAKI_SESSION_RESUME_BACKOFF_MIN_MS << (attempt - 1);
+		if(backoff_ms > CHIAKI_SESSION_RESUME_BACKOFF_MAX_MS)
+			backoff_ms = CHIAKI_SESSION_RESUME_BACKOFF_MAX_MS;
+		CHIAKI_LOGI(session->log, "Resume attempt %u in %u ms", attempt, (unsigned int)backoff_ms);
+		chiaki_cond_timedwait_pred(&session->state_cond, &session->state_mutex, backoff_ms, session_check_state_pred_stop, session);
+		if(session->should_stop)
+			return CHIAKI_ERR_CANCELED;
+
+		if(attempt == 1 && !session->ctrl_failed)
+			return CHIAKI_ERR_SUCCESS;
+		ChiakiErrorCode err = session_thread_restart_ctrl(session, ctrl_running);
+		if(err == CHIAKI_ERR_SUCCESS || err == CHIAKI_ERR_CANCELED)
+			return err;
+		if(attempt >= CHIAKI_SESSION_RESUME_ATTEMPTS_MAX)
+		{
+			CHIAKI_LOGE(session->log, "Giving up resuming the session after %u attempts", attempt);
+			return err;
+		}
+	}
+}
+
+static void session_resume_finish(ChiakiSession *session, bool success)
+{
+	chiaki_mutex_lock(&session->state_mutex);
+	if(!session->resume_attempt)
+	{
+		chiaki_mutex_unlock(&session->state_mutex);
+		return;
+	}
+	ChiakiEvent event = { 0 };
+	event.type = CHIAKI_EVENT_RESUME;
+	event.resume.finished = true;
+	event.resume.success = success;
+	event.resume.attempt = session->resume_attempt;
+	event.resume.downtime_us = chiaki_time_now_monotonic_us() - session->resume_lost_us;
+	session->resume_attempt = 0;
+	session->resume_stats.resuming = false;
+	if(success)
+	{
+		session->resume_stats.resumed++;
+		session->resume_stats.downtime_last_us = event.resume.downtime_us;
+		session->resume_stats.downtime_total_us += event.resume.downtime_us;
+	}
+	else
+		session->resume_stats.failed++;
+	chiaki_mutex_unlock(&session->state_mutex);
+
+	if(success)
+		CHIAKI_LOGI(session->log, "Session resumed after %u attempts and %.1f ms",
+				event.resume.attempt, (double)event.resume.downtime_us / 1000.0);
+	chiaki_session_send_event(session, &event);
+}
+
+static void session_resume_connected(ChiakiSession *session)
+{
+	session_resume_finish(session, true);
+}
+
+/**
+ * Call with state_mutex locked, sends the final event with it unlocked.
+ */
+static void session_resume_failed(ChiakiSession *session)
+{
+	chiaki_mutex_unlock(&session->state_mutex);
+	session_resume_finish(session, false);
+	chiaki_mutex_lock(&session->state_mutex);
+}
+
 static void *session_thread_func(void *arg)
 {
 	ChiakiSession *session = (ChiakiSession *)arg;
@@ -438,6 +868,15 @@ static void *session_thread_func(void *arg)
 		QUIT(quit_label); \
 	} } while(0)
 
+	// The keys are only needed for the stream connection, so they are generated
+	// while waiting for the network below.
+	ChiakiErrorCode err;
+	bool ctrl_running = false;
+	session->key_gen_err = CHIAKI_ERR_UNINITIALIZED;
+	bool key_gen_started = chiaki_thread_create(&session->key_gen_thread, session_key_gen_thread_func, session) == CHIAKI_ERR_SUCCESS;
+	if(key_gen_started)
+		chiaki_thread_set_name(&session->key_gen_thread, "Chiaki Session Keys");
+
 	CHECK_STOP(quit);
 
 	if(session->holepunch_session)
@@ -465,10 +904,12 @@ static void *session_thread_func(void *arg)
 		memcpy(info.psn_account_id, session->connect_info.psn_account_id, CHIAKI_PSN_ACCOUNT_ID_SIZE);
 		info.rudp = session->rudp;
 		info.target = session->connect_info.ps5 ? CHIAKI_TARGET_PS5_1 : CHIAKI_TARGET_PS4_10;
+		chiaki_session_timeline_begin(session, CHIAKI_SESSION_PHASE_PSN_REGIST);
 		chiaki_regist_start(&regist, session->log, &info, regist_cb, session);
 		chiaki_cond_timedwait_pred(&session->state_cond, &session->state_mutex, 10000, session_check_state_pred_regist, session);
 		chiaki_regist_stop(&regist);
 		chiaki_regist_fini(&regist);
+		chiaki_session_timeline_end(session, CHIAKI_SESSION_PHASE_PSN_REGIST);
 		CHECK_STOP(quit);
 	}
 	if(session->auto_regist)
@@ -477,10 +918,24 @@ static void *session_thread_func(void *arg)
 		session->quit_reason = CHIAKI_QUIT_REASON_STOPPED;
 		QUIT(quit);
 	}
+	if(session->host_unresolved)
+	{
+		chiaki_mutex_unlock(&session->state_mutex);
+		err = session_resolve_host(session);
+		chiaki_mutex_lock(&session->state_mutex);
+		if(err != CHIAKI_ERR_SUCCESS)
+		{
+			session->quit_reason = CHIAKI_QUIT_REASON_SESSION_REQUEST_UNKNOWN;
+			QUIT(quit);
+		}
+		CHECK_STOP(quit);
+	}
+
 	CHIAKI_LOGI(session->log, "Starting session request for %s", session->connect_info.ps5 ? "PS5" : "PS4");
 
+	chiaki_session_timeline_begin(session, CHIAKI_SESSION_PHASE_SESSION_REQUEST);
 	ChiakiTarget server_target = CHIAKI_TARGET_PS4_UNKNOWN;
-	ChiakiErrorCode err = session_thread_request_session(session, &server_target);
+	err = session_thread_request_session(session, &server_target);
 
 	if(err == CHIAKI_ERR_VERSION_MISMATCH && !chiaki_target_is_unknown(server_target))
 	{
@@ -504,6 +959,7 @@ static void *session_thread_func(void *arg)
 		QUIT(quit);
 
 	CHIAKI_LOGI(session->log, "Session request successful");
+	chiaki_session_timeline_end(session, CHIAKI_SESSION_PHASE_SESSION_REQUEST);
 
 	chiaki_rpcrypt_init_auth(&session->rpcrypt, session->target, session->nonce, session->connect_info.morning);
 
@@ -512,9 +968,11 @@ static void *session_thread_func(void *arg)
 
 	CHIAKI_LOGI(session->log, "Starting ctrl");
 
+	chiaki_session_timeline_begin(session, CHIAKI_SESSION_PHASE_CTRL);
 	err = chiaki_ctrl_start(&session->ctrl);
 	if(err != CHIAKI_ERR_SUCCESS)
 		QUIT(quit);
+	ctrl_running = true;
 
 	err = chiaki_cond_timedwait_pred(&session->state_cond, &session->state_mutex, SESSION_EXPECT_CTRL_START_MS, session_check_state_pred_ctrl_start, session);
 	CHECK_STOP(quit_ctrl);
@@ -526,6 +984,9 @@ static void *session_thread_func(void *arg)
 	}
 
 	bool pin_incorrect = false;
+	bool pin_requested = session->ctrl_login_pin_requested;
+	if(pin_requested)
+		chiaki_session_timeline_begin(session, CHIAKI_SESSION_PHASE_LOGIN_PIN);
 	while(session->ctrl_login_pin_requested)
 	{
 		session->ctrl_login_pin_requested = false;
@@ -557,6 +1018,9 @@ static void *session_thread_func(void *arg)
 		err = chiaki_cond_timedwait_pred(&session->state_cond, &session->state_mutex, SESSION_EXPECT_CTRL_START_MS, session_check_state_pred_ctrl_start, session);
 		CHECK_STOP(quit_ctrl);
 	}
+	if(pin_requested)
+		chiaki_session_timeline_end(session, CHIAKI_SESSION_PHASE_LOGIN_PIN);
+	chiaki_session_timeline_end(session, CHIAKI_SESSION_PHASE_CTRL);
 
 	chiaki_socket_t *data_sock = NULL;
 	if(session->rudp)
@@ -568,6 +1032,7 @@ static void *session_thread_func(void *arg)
 			CHECK_STOP(quit_ctrl);
 		}
 		CHIAKI_LOGI(session->log, "Punching hole for data connection");
+		chiaki_session_timeline_begin(session, CHIAKI_SESSION_PHASE_HOLEPUNCH);
 		ChiakiEvent event_start = { 0 };
 		event_start.type = CHIAKI_EVENT_HOLEPUNCH;
 		event_start.data_holepunch.finished = false;
@@ -579,6 +1044,7 @@ static void *session_thread_func(void *arg)
 			QUIT(quit_ctrl);
 		}
 		CHIAKI_LOGI(session->log, ">> Punched hole for data connection!");
+		chiaki_session_timeline_end(session, CHIAKI_SESSION_PHASE_HOLEPUNCH);
 		data_sock = chiaki_get_holepunch_sock(session->holepunch_session, CHIAKI_HOLEPUNCH_PORT_TYPE_DATA);
 		ChiakiEvent event_finish = { 0 };
 		event_finish.type = CHIAKI_EVENT_HOLEPUNCH;
@@ -609,33 +1075,52 @@ ctrl_failed:
 	}
 
 #ifdef ENABLE_SENKUSHA
-	CHIAKI_LOGI(session->log, "Starting Senkusha");
-
-	ChiakiSenkusha senkusha;
-	err = chiaki_senkusha_init(&senkusha, session);
-	if(err != CHIAKI_ERR_SUCCESS)
-		QUIT(quit_ctrl);
-
-	err = chiaki_senkusha_run(&senkusha, &session->mtu_in, &session->mtu_out, &session->rtt_us, data_sock);
-	chiaki_senkusha_fini(&senkusha);
-	CHECK_STOP(quit_ctrl);
-	if(session->ctrl_failed)
+	ChiakiNetworkProfile network_profile;
+	ChiakiNetworkProfileFreshness network_profile_freshness = session_network_profile_lookup(session, data_sock, &network_profile);
+	if(network_profile_freshness == CHIAKI_NETWORK_PROFILE_FRESH)
 	{
-		CHIAKI_LOGE(session->log, "Ctrl has failed since session started, exiting");
-		QUIT(quit_ctrl);
+		CHIAKI_LOGI(session->log, "Skipping Senkusha, using cached network profile");
+		session->mtu_in = network_profile.mtu_in;
+		session->mtu_out = network_profile.mtu_out;
+		session->rtt_us = network_profile.rtt_us;
+		chiaki_network_profile_cache_skipped(&session->network_profile_cache);
 	}
-
-	if(err == CHIAKI_ERR_SUCCESS)
-		CHIAKI_LOGI(session->log, "Senkusha completed successfully");
-	else if(err == CHIAKI_ERR_CANCELED)
-		QUIT(quit_ctrl);
 	else
 	{
-		CHIAKI_LOGE(session->log, "Senkusha failed, but we still try to connect with fallback values");
-		session->mtu_in = 1454;
-		session->mtu_out = 1454;
-		session->rtt_us = 1000;
-		session->dontfrag = false;
+		bool shortened = network_profile_freshness == CHIAKI_NETWORK_PROFILE_STALE;
+		CHIAKI_LOGI(session->log, shortened ? "Starting shortened Senkusha with cached network profile" : "Starting Senkusha");
+
+		ChiakiSenkusha senkusha;
+		err = chiaki_senkusha_init(&senkusha, session);
+		if(err != CHIAKI_ERR_SUCCESS)
+			QUIT(quit_ctrl);
+
+		chiaki_session_timeline_begin(session, CHIAKI_SESSION_PHASE_SENKUSHA);
+		err = chiaki_senkusha_run(&senkusha, &session->mtu_in, &session->mtu_out, &session->rtt_us, data_sock, shortened ? &network_profile : NULL);
+		chiaki_senkusha_fini(&senkusha);
+		chiaki_session_timeline_end(session, CHIAKI_SESSION_PHASE_SENKUSHA);
+		CHECK_STOP(quit_ctrl);
+		if(session->ctrl_failed)
+		{
+			CHIAKI_LOGE(session->log, "Ctrl has failed since session started, exiting");
+			QUIT(quit_ctrl);
+		}
+
+		if(err == CHIAKI_ERR_SUCCESS)
+		{
+			CHIAKI_LOGI(session->log, "Senkusha completed successfully");
+			chiaki_network_profile_cache_measured(&session->network_profile_cache, session->mtu_in, session->mtu_out, session->rtt_us);
+		}
+		else if(err == CHIAKI_ERR_CANCELED)
+			QUIT(quit_ctrl);
+		else
+		{
+			CHIAKI_LOGE(session->log, "Senkusha failed, but we still try to connect with fallback values");
+			session->mtu_in = 1454;
+			session->mtu_out = 1454;
+			session->rtt_us = 1000;
+			session->dontfrag = false;
+		}
 	}
 #endif
 	if(session->rudp)
@@ -657,23 +1142,46 @@ ctrl_failed:
 		CHIAKI_LOGI(session->log, "Received Switch to Stream Connection Ack... Switching to Stream Connection now");
 	}
 
-	err = chiaki_random_bytes_crypt(session->handshake_key, sizeof(session->handshake_key));
-	if(err != CHIAKI_ERR_SUCCESS)
+	chiaki_mutex_unlock(&session->state_mutex);
+	if(key_gen_started)
 	{
-		CHIAKI_LOGE(session->log, "Session failed to generate handshake key");
-		QUIT(quit_ctrl);
+		chiaki_thread_join(&session->key_gen_thread, NULL);
+		key_gen_started = false;
 	}
+	else
+		session_key_gen_thread_func(session);
+	chiaki_mutex_lock(&session->state_mutex);
+	if(session->key_gen_err != CHIAKI_ERR_SUCCESS)
+		QUIT(quit_ctrl);
 
-	err = chiaki_ecdh_init(&session->ecdh);
-	if(err != CHIAKI_ERR_SUCCESS)
+	chiaki_mutex_unlock(&session->state_mutex);
+	chiaki_session_timeline_begin(session, CHIAKI_SESSION_PHASE_STREAM_CONNECT);
+	while(true)
 	{
-		CHIAKI_LOGE(session->log, "Session failed to initialize ECDH");
-		QUIT(quit_ctrl);
+		err = chiaki_stream_connection_run(&session->stream_connection, data_sock);
+		chiaki_mutex_lock(&session->state_mutex);
+		if(!session_resume_possible(session, err))
+			break;
+		ChiakiErrorCode resume_err = session_thread_resume(session, &ctrl_running);
+		if(resume_err != CHIAKI_ERR_SUCCESS)
+		{
+			if(resume_err == CHIAKI_ERR_CANCELED)
+				err = resume_err;
+			break;
+		}
+		chiaki_mutex_unlock(&session->state_mutex);
+		if(session_regen_keys(session) != CHIAKI_ERR_SUCCESS)
+		{
+			chiaki_mutex_lock(&session->state_mutex);
+			break;
+		}
 	}
+	if(session->resume_attempt)
+		session_resume_failed(session);
+	// only now, a drop that was resumed from says nothing against the network profile
+	chiaki_network_profile_cache_stream_stopped(&session->network_profile_cache,
+			err != CHIAKI_ERR_SUCCESS && err != CHIAKI_ERR_CANCELED && err != CHIAKI_ERR_DISCONNECTED);
 
-	chiaki_mutex_unlock(&session->state_mutex);
-	err = chiaki_stream_connection_run(&session->stream_connection, data_sock);
-	chiaki_mutex_lock(&session->state_mutex);
 	if(err == CHIAKI_ERR_DISCONNECTED)
 	{
 		CHIAKI_LOGE(session->log, "Remote disconnected from StreamConnection");
@@ -695,15 +1203,22 @@ ctrl_failed:
 	}
 
 	chiaki_mutex_unlock(&session->state_mutex);
-	chiaki_ecdh_fini(&session->ecdh);
 
 quit_ctrl:
-	chiaki_ctrl_stop(&session->ctrl);
-	chiaki_ctrl_join(&session->ctrl);
-	CHIAKI_LOGI(session->log, "Ctrl stopped");
+	if(ctrl_running)
+	{
+		chiaki_ctrl_stop(&session->ctrl);
+		chiaki_ctrl_join(&session->ctrl);
+		CHIAKI_LOGI(session->log, "Ctrl stopped");
+	}
 
 	ChiakiEvent quit_event;
 quit:
+	if(key_gen_started)
+		chiaki_thread_join(&session->key_gen_thread, NULL);
+	if(session->key_gen_err == CHIAKI_ERR_SUCCESS)
+		chiaki_ecdh_fini(&session->ecdh);
+	session->key_gen_err = CHIAKI_ERR_UNINITIALIZED;
 
 	CHIAKI_LOGI(session->log, "Session has quit");
 	chiaki_mutex_lock(&session->state_mutex);
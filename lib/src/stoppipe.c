@@ -170,6 +170,105 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_select_single(ChiakiStopPipe *sto
 #endif
 }
 
+CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_select_multi(ChiakiStopPipe *stop_pipe, chiaki_socket_t *fds, size_t fds_count, uint64_t timeout_ms, bool *ready)
+{
+	for(size_t i=0; i<fds_count; i++)
+		ready[i] = false;
+
+#ifdef _WIN32
+	WSAEVENT events[WSA_MAXIMUM_WAIT_EVENTS];
+	if(fds_count + 1 > WSA_MAXIMUM_WAIT_EVENTS)
+		return CHIAKI_ERR_OVERFLOW;
+	events[0] = stop_pipe->event;
+	DWORD events_count = 1;
+	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+	for(size_t i=0; i<fds_count; i++)
+	{
+		events[i+1] = WSACreateEvent();
+		if(events[i+1] == WSA_INVALID_EVENT)
+		{
+			err = CHIAKI_ERR_UNKNOWN;
+			goto beach;
+		}
+		events_count++;
+		WSAEventSelect(fds[i], events[i+1], FD_READ);
+	}
+
+	DWORD r = WSAWaitForMultipleEvents(events_count, events, FALSE, timeout_ms == UINT64_MAX ? WSA_INFINITE : (DWORD)timeout_ms, FALSE);
+	if(r == WSA_WAIT_EVENT_0)
+		err = CHIAKI_ERR_CANCELED;
+	else if(r == WSA_WAIT_TIMEOUT)
+		err = CHIAKI_ERR_TIMEOUT;
+	else if(r > WSA_WAIT_EVENT_0 && r < WSA_WAIT_EVENT_0 + events_count)
+	{
+		// more than one may be signaled, but only the lowest is reported
+		for(DWORD i=r - WSA_WAIT_EVENT_0; i<events_count; i++)
+		{
+			if(WSAWaitForMultipleEvents(1, &events[i], FALSE, 0, FALSE) == WSA_WAIT_EVENT_0)
+				ready[i-1] = true;
+		}
+	}
+	else
+		err = CHIAKI_ERR_UNKNOWN;
+
+beach:
+	for(DWORD i=1; i<events_count; i++)
+		WSACloseEvent(events[i]);
+	return err;
+#else
+	fd_set rfds;
+	FD_ZERO(&rfds);
+#if defined(__SWITCH__)
+	int stop_fd = stop_pipe->fd;
+#else
+	int stop_fd = stop_pipe->fds[0];
+#endif
+	FD_SET(stop_fd, &rfds);
+	int nfds = stop_fd;
+	for(size_t i=0; i<fds_count; i++)
+	{
+		if(CHIAKI_SOCKET_IS_INVALID(fds[i]))
+			continue;
+		FD_SET(fds[i], &rfds);
+		if(fds[i] > nfds)
+			nfds = fds[i];
+	}
+	nfds++;
+
+	struct timeval timeout_s;
+	struct timeval *timeout = NULL;
+	if(timeout_ms != UINT64_MAX)
+	{
+		timeout_s.tv_sec = timeout_ms / 1000;
+		timeout_s.tv_usec = (timeout_ms % 1000) * 1000;
+		timeout = &timeout_s;
+	}
+
+	int r;
+	do
+	{
+		r = select(nfds, &rfds, NULL, NULL, timeout);
+	} while(r < 0 && errno == EINTR);
+
+	if(r < 0)
+		return CHIAKI_ERR_UNKNOWN;
+
+	if(FD_ISSET(stop_fd, &rfds))
+		return CHIAKI_ERR_CANCELED;
+
+	bool any = false;
+	for(size_t i=0; i<fds_count; i++)
+	{
+		if(CHIAKI_SOCKET_IS_INVALID(fds[i]) || !FD_ISSET(fds[i], &rfds))
+			continue;
+		ready[i] = true;
+		any = true;
+	}
+
+	return any ? CHIAKI_ERR_SUCCESS : CHIAKI_ERR_TIMEOUT;
+#endif
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_connect(ChiakiStopPipe *stop_pipe, chiaki_socket_t fd, struct sockaddr *addr, size_t addrlen, uint64_t timeout_ms)
 {
 	int r = connect(fd, addr, (socklen_t)addrlen);
@@ -8,6 +8,7 @@
 #include <chiaki/base64.h>
 #include <chiaki/audio.h>
 #include <chiaki/video.h>
+#include <chiaki/time.h>
 
 #include <string.h>
 #include <inttypes.h>
@@ -43,6 +44,9 @@ typedef enum {
 } StreamConnectionState;
 
 void chiaki_session_send_event(ChiakiSession *session, ChiakiEvent *event);
+void chiaki_session_timeline_begin(ChiakiSession *session, ChiakiSessionPhase phase);
+void chiaki_session_timeline_end(ChiakiSession *session, ChiakiSessionPhase phase);
+void chiaki_session_timeline_finish(ChiakiSession *session);
 
 static void stream_connection_takion_cb(ChiakiTakionEvent *event, void *user);
 static void stream_connection_takion_data(ChiakiStreamConnection *stream_connection, ChiakiTakionMessageDataType data_type, uint8_t *buf, size_t buf_size);
@@ -61,7 +65,7 @@ static ChiakiErrorCode stream_connection_send_streaminfo_ack(ChiakiStreamConnect
 static void stream_connection_takion_av(ChiakiStreamConnection *stream_connection, ChiakiTakionAVPacket *packet);
 static ChiakiErrorCode stream_connection_send_heartbeat(ChiakiStreamConnection *stream_connection);
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_init(ChiakiStreamConnection *stream_connection, ChiakiSession *session, double packet_loss_max)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_init(ChiakiStreamConnection *stream_connection, ChiakiSession *session, double packet_loss_max, ChiakiCongestionControlPolicy congestion_control_policy)
 {
 	stream_connection->session = session;
 	stream_connection->log = session->log;
@@ -94,19 +98,28 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_init(ChiakiStreamConnecti
 	stream_connection->audio_receiver = NULL;
 	stream_connection->haptics_receiver = NULL;
 
-	err = chiaki_mutex_init(&stream_connection->feedback_sender_mutex, false);
+	err = chiaki_congestion_control_init(&stream_connection->congestion_control, congestion_control_policy, packet_loss_max);
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_packet_stats;
 
+	err = chiaki_mutex_init(&stream_connection->feedback_sender_mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_congestion_control;
+
 	stream_connection->state = STATE_IDLE;
 	stream_connection->state_finished = false;
 	stream_connection->state_failed = false;
 	stream_connection->should_stop = false;
 	stream_connection->remote_disconnected = false;
 	stream_connection->remote_disconnect_reason = NULL;
+	stream_connection->connected = false;
+	stream_connection->connection_lost = false;
+	chiaki_atomic_store_u64(&stream_connection->last_recv_ms, 0);
 
 	return CHIAKI_ERR_SUCCESS;
 
+error_congestion_control:
+	chiaki_congestion_control_fini(&stream_connection->congestion_control);
 error_packet_stats:
 	chiaki_packet_stats_fini(&stream_connection->packet_stats);
 error_state_cond:
@@ -127,6 +140,7 @@ CHIAKI_EXPORT void chiaki_stream_connection_fini(ChiakiStreamConnection *stream_
 	free(stream_connection->ecdh_secret);
 	if (stream_connection->congestion_control.thread.thread)
 		chiaki_congestion_control_stop(&stream_connection->congestion_control);
+	chiaki_congestion_control_fini(&stream_connection->congestion_control);
 
 	chiaki_packet_stats_fini(&stream_connection->packet_stats);
 
@@ -136,6 +150,19 @@ CHIAKI_EXPORT void chiaki_stream_connection_fini(ChiakiStreamConnection *stream_
 	chiaki_mutex_fini(&stream_connection->state_mutex);
 }
 
+/**
+ * The keys of a previous run in the same session must not be reused
+ */
+static void stream_connection_reset_crypt(ChiakiStreamConnection *stream_connection)
+{
+	chiaki_gkcrypt_free(stream_connection->gkcrypt_remote);
+	stream_connection->gkcrypt_remote = NULL;
+	chiaki_gkcrypt_free(stream_connection->gkcrypt_local);
+	stream_connection->gkcrypt_local = NULL;
+	free(stream_connection->ecdh_secret);
+	stream_connection->ecdh_secret = NULL;
+}
+
 static bool state_finished_cond_check(void *user)
 {
 	ChiakiStreamConnection *stream_connection = user;
@@ -169,10 +196,15 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_run(ChiakiStreamConnectio
 
 	takion_info.cb = stream_connection_takion_cb;
 	takion_info.cb_user = stream_connection;
+	takion_info.trace = &session->trace;
 
 	err = chiaki_mutex_lock(&stream_connection->state_mutex);
 	assert(err == CHIAKI_ERR_SUCCESS);
 
+	stream_connection_reset_crypt(stream_connection);
+	stream_connection->connected = false;
+	stream_connection->connection_lost = false;
+
 #define CHECK_STOP(quit_label) do { \
 	if(stream_connection->should_stop) \
 	{ \
@@ -219,7 +251,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_run(ChiakiStreamConnectio
 		goto err_video_receiver;
 	}
 
-	err = chiaki_congestion_control_start(&stream_connection->congestion_control, &stream_connection->takion, &stream_connection->packet_stats, stream_connection->packet_loss_max);
+	err = chiaki_congestion_control_start(&stream_connection->congestion_control, &stream_connection->takion, &stream_connection->packet_stats, session->connect_info.video_profile.max_fps);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		CHIAKI_LOGE(session->log, "StreamConnection failed to start Congestion Control");
@@ -306,8 +338,15 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_run(ChiakiStreamConnectio
 
 	ChiakiEvent event = { 0 };
 	event.type = CHIAKI_EVENT_CONNECTED;
+	stream_connection->connected = true;
+	chiaki_atomic_store_u64(&stream_connection->last_recv_ms, chiaki_time_now_monotonic_ms());
 	chiaki_mutex_unlock(&stream_connection->state_mutex);
+	chiaki_session_timeline_end(session, CHIAKI_SESSION_PHASE_STREAM_CONNECT);
+	chiaki_session_timeline_begin(session, CHIAKI_SESSION_PHASE_FIRST_FRAME);
 	chiaki_session_send_event(session, &event);
+	if(session->connect_info.disable_audio_video & CHIAKI_VIDEO_DISABLED)
+		chiaki_session_timeline_finish(session);
+	chiaki_network_profile_cache_stream_started(&session->network_profile_cache, chiaki_time_now_monotonic_ms());
 	err = chiaki_mutex_lock(&stream_connection->state_mutex);
 	assert(err == CHIAKI_ERR_SUCCESS);
 
@@ -317,11 +356,25 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_run(ChiakiStreamConnectio
 		if(err != CHIAKI_ERR_TIMEOUT)
 			break;
 
+		uint64_t now_ms = chiaki_time_now_monotonic_ms();
+		uint64_t last_recv_ms = chiaki_atomic_load_u64(&stream_connection->last_recv_ms);
+		if(session->connect_info.session_resume && now_ms > last_recv_ms && now_ms - last_recv_ms >= CHIAKI_SESSION_RESUME_LOST_MS)
+		{
+			CHIAKI_LOGW(stream_connection->log, "StreamConnection received nothing for %"PRIu64" ms, connection lost", now_ms - last_recv_ms);
+			stream_connection->connection_lost = true;
+			break;
+		}
+
 		err = stream_connection_send_heartbeat(stream_connection);
 		if(err != CHIAKI_ERR_SUCCESS)
 			CHIAKI_LOGE(stream_connection->log, "StreamConnection failed to send heartbeat");
 		else
 			CHIAKI_LOGV(stream_connection->log, "StreamConnection sent heartbeat");
+
+		// may call into the application to store the profile
+		chiaki_mutex_unlock(&stream_connection->state_mutex);
+		chiaki_network_profile_cache_stream_check(&session->network_profile_cache, &stream_connection->packet_stats, chiaki_time_now_monotonic_ms());
+		chiaki_mutex_lock(&stream_connection->state_mutex);
 	}
 
 	err = chiaki_mutex_lock(&stream_connection->feedback_sender_mutex);
@@ -330,7 +383,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_run(ChiakiStreamConnectio
 	chiaki_feedback_sender_fini(&stream_connection->feedback_sender);
 	chiaki_mutex_unlock(&stream_connection->feedback_sender_mutex);
 
-	err = CHIAKI_ERR_SUCCESS;
+	err = stream_connection->connection_lost ? CHIAKI_ERR_TIMEOUT : CHIAKI_ERR_SUCCESS;
 
 disconnect:
 	CHIAKI_LOGI(session->log, "StreamConnection is disconnecting");
@@ -411,9 +464,11 @@ static void stream_connection_takion_cb(ChiakiTakionEvent *event, void *user)
 			chiaki_mutex_unlock(&stream_connection->state_mutex);
 			break;
 		case CHIAKI_TAKION_EVENT_TYPE_DATA:
+			chiaki_atomic_store_u64(&stream_connection->last_recv_ms, chiaki_time_now_monotonic_ms());
 			stream_connection_takion_data(stream_connection, event->data.data_type, event->data.buf, event->data.buf_size);
 			break;
 		case CHIAKI_TAKION_EVENT_TYPE_AV:
+			chiaki_atomic_store_u64(&stream_connection->last_recv_ms, chiaki_time_now_monotonic_ms());
 			stream_connection_takion_av(stream_connection, event->av);
 			break;
 		default:
@@ -721,13 +776,13 @@ static ChiakiErrorCode stream_connection_init_crypt(ChiakiStreamConnection *stre
 {
 	ChiakiSession *session = stream_connection->session;
 
-	stream_connection->gkcrypt_local = chiaki_gkcrypt_new(stream_connection->log, CHIAKI_GKCRYPT_KEY_BUF_BLOCKS_DEFAULT, 2, session->handshake_key, stream_connection->ecdh_secret);
+	stream_connection->gkcrypt_local = chiaki_gkcrypt_new(stream_connection->log, CHIAKI_GKCRYPT_KEY_BUF_BLOCKS_DEFAULT, session->thread_pool, session->thread_pool_affinity, 2, session->handshake_key, stream_connection->ecdh_secret);
 	if(!stream_connection->gkcrypt_local)
 	{
 		CHIAKI_LOGE(stream_connection->log, "StreamConnection failed to initialize local GKCrypt with index 2");
 		return CHIAKI_ERR_UNKNOWN;
 	}
-	stream_connection->gkcrypt_remote = chiaki_gkcrypt_new(stream_connection->log, CHIAKI_GKCRYPT_KEY_BUF_BLOCKS_DEFAULT, 3, session->handshake_key, stream_connection->ecdh_secret);
+	stream_connection->gkcrypt_remote = chiaki_gkcrypt_new(stream_connection->log, CHIAKI_GKCRYPT_KEY_BUF_BLOCKS_DEFAULT, session->thread_pool, session->thread_pool_affinity, 3, session->handshake_key, stream_connection->ecdh_secret);
 	if(!stream_connection->gkcrypt_remote)
 	{
 		CHIAKI_LOGE(stream_connection->log, "StreamConnection failed to initialize remote GKCrypt with index 3");
@@ -163,7 +163,7 @@ typedef struct chiaki_takion_postponed_packet_t
 
 static void *takion_thread_func(void *user);
 static void takion_handle_packet(ChiakiTakion *takion, uint8_t *buf, size_t buf_size);
-static ChiakiErrorCode takion_handle_packet_mac(ChiakiTakion *takion, uint8_t base_type, uint8_t *buf, size_t buf_size);
+static ChiakiErrorCode takion_handle_packet_mac(ChiakiTakion *takion, uint8_t base_type, uint8_t *buf, size_t buf_size, uint64_t *key_pos_out);
 static void takion_handle_packet_message(ChiakiTakion *takion, uint8_t *buf, size_t buf_size);
 static void takion_handle_packet_message_data(ChiakiTakion *takion, uint8_t *packet_buf, size_t packet_buf_size, uint8_t type_b, uint8_t *payload, size_t payload_size);
 static void takion_handle_packet_message_data_ack(ChiakiTakion *takion, uint8_t flags, uint8_t *buf, size_t buf_size);
@@ -210,6 +210,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_connect(ChiakiTakion *takion, Chiaki
 	takion->gkcrypt_remote = NULL;
 	takion->cb = info->cb;
 	takion->cb_user = info->cb_user;
+	takion->trace = info->trace;
 	takion->a_rwnd = TAKION_A_RWND;
 
 	takion->tag_local = chiaki_random_32(); // 0x4823
@@ -915,6 +916,7 @@ static void takion_data_drop(uint64_t seq_num, void *elem_user, void *cb_user)
 static void *takion_thread_func(void *user)
 {
 	ChiakiTakion *takion = user;
+	chiaki_thread_apply_role(CHIAKI_THREAD_ROLE_TAKION);
 
 	uint32_t seq_num_remote_initial;
 	if(takion_handshake(takion, &seq_num_remote_initial) != CHIAKI_ERR_SUCCESS)
@@ -954,7 +956,7 @@ static void *takion_thread_func(void *user)
 				if(packet->packet_size == 0)
 					continue;
 				uint8_t base_type = (uint8_t)(packet->packet_buf[0] & TAKION_PACKET_BASE_TYPE_MASK);
-				if(takion_handle_packet_mac(takion, base_type, packet->packet_buf, packet->packet_size) != CHIAKI_ERR_SUCCESS)
+				if(takion_handle_packet_mac(takion, base_type, packet->packet_buf, packet->packet_size, NULL) != CHIAKI_ERR_SUCCESS)
 				{
 					CHIAKI_LOGW(takion->log, "Found an invalid MAC");
 					chiaki_reorder_queue_drop(&takion->data_queue, i);
@@ -1046,7 +1048,10 @@ static ChiakiErrorCode takion_recv(ChiakiTakion *takion, uint8_t *buf, size_t *b
 	return CHIAKI_ERR_SUCCESS;
 }
 
-static ChiakiErrorCode takion_handle_packet_mac(ChiakiTakion *takion, uint8_t base_type, uint8_t *buf, size_t buf_size)
+/**
+ * @param key_pos_out optional, set to the key_pos of the packet if the MAC was checked
+ */
+static ChiakiErrorCode takion_handle_packet_mac(ChiakiTakion *takion, uint8_t base_type, uint8_t *buf, size_t buf_size, uint64_t *key_pos_out)
 {
 	if(!takion->gkcrypt_remote)
 		return CHIAKI_ERR_SUCCESS;
@@ -1060,6 +1065,8 @@ static ChiakiErrorCode takion_handle_packet_mac(ChiakiTakion *takion, uint8_t ba
 		CHIAKI_LOGE(takion->log, "Takion failed to pull key_pos out of received packet");
 		return err;
 	}
+	if(key_pos_out)
+		*key_pos_out = key_pos;
 	err = chiaki_takion_packet_mac(takion->gkcrypt_remote, buf, buf_size, key_pos, mac_expected, mac);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
@@ -1114,7 +1121,16 @@ static void takion_handle_packet(ChiakiTakion *takion, uint8_t *buf, size_t buf_
 	assert(buf_size > 0);
 	uint8_t base_type = (uint8_t)(buf[0] & TAKION_PACKET_BASE_TYPE_MASK);
 
-	if(takion_handle_packet_mac(takion, base_type, buf, buf_size) != CHIAKI_ERR_SUCCESS)
+	ChiakiTraceEvent trace_event = { 0 };
+	trace_event.type = CHIAKI_TRACE_EVENT_PACKET;
+	trace_event.packet_type = base_type;
+	trace_event.size = (uint32_t)buf_size;
+	trace_event.result = takion->gkcrypt_remote ? CHIAKI_TRACE_MAC_OK : CHIAKI_TRACE_MAC_NONE;
+	ChiakiErrorCode err = takion_handle_packet_mac(takion, base_type, buf, buf_size, &trace_event.key_pos);
+	if(err != CHIAKI_ERR_SUCCESS)
+		trace_event.result = CHIAKI_TRACE_MAC_INVALID;
+	chiaki_trace_push(takion->trace, &trace_event);
+	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		free(buf);
 		return;
@@ -1247,15 +1263,43 @@ static void takion_handle_packet_message_data(ChiakiTakion *takion, uint8_t *pac
 	entry->channel = ntohs(*((chiaki_unaligned_uint16_t *)(payload + 4)));
 	ChiakiSeqNum32 seq_num = ntohl(*((chiaki_unaligned_uint32_t *)(payload + 0)));
 
+	if(chiaki_trace_enabled(takion->trace))
+	{
+		ChiakiTraceEvent trace_event = { 0 };
+		trace_event.type = CHIAKI_TRACE_EVENT_DATA;
+		trace_event.seq = seq_num;
+		trace_event.size = (uint32_t)payload_size;
+		trace_event.index = entry->channel;
+		ChiakiReorderQueue *queue = &takion->data_queue;
+		if(seq_num == queue->begin)
+			trace_event.result = CHIAKI_TRACE_REORDER_IN_ORDER;
+		else if(queue->seq_num_lt(seq_num, queue->begin))
+			trace_event.result = CHIAKI_TRACE_REORDER_LATE;
+		else
+			trace_event.result = CHIAKI_TRACE_REORDER_AHEAD;
+		chiaki_trace_push(takion->trace, &trace_event);
+	}
+
 	chiaki_reorder_queue_push(&takion->data_queue, seq_num, entry);
 	takion_flush_data_queue(takion);
 }
 
+static void takion_handle_packet_message_data_ack_events(ChiakiTakion *takion, ChiakiSeqNum32 *acked_seq_nums, size_t acked_seq_nums_count)
+{
+	for(size_t i=0; i<acked_seq_nums_count; i++)
+	{
+		ChiakiTakionEvent event = { 0 };
+		event.type = CHIAKI_TAKION_EVENT_TYPE_DATA_ACK;
+		event.data_ack.seq_num = acked_seq_nums[i];
+		takion->cb(&event, takion->cb_user);
+	}
+}
+
 static void takion_handle_packet_message_data_ack(ChiakiTakion *takion, uint8_t flags, uint8_t *buf, size_t buf_size)
 {
-	if(buf_size != 0xc)
+	if(buf_size < 0xc)
 	{
-		CHIAKI_LOGE(takion->log, "Takion received data ack with size %zx != %#x", buf_size, 0xc);
+		CHIAKI_LOGE(takion->log, "Takion received data ack with size %zx < %#x", buf_size, 0xc);
 		return;
 	}
 
@@ -1279,13 +1323,22 @@ static void takion_handle_packet_message_data_ack(ChiakiTakion *takion, uint8_t
 	ChiakiSeqNum32 acked_seq_nums[TAKION_SEND_BUFFER_SIZE];
 	size_t acked_seq_nums_count = 0;
 	chiaki_takion_send_buffer_ack(&takion->send_buffer, cumulative_seq_num, acked_seq_nums, &acked_seq_nums_count);
+	takion_handle_packet_message_data_ack_events(takion, acked_seq_nums, acked_seq_nums_count);
 
-	for(size_t i=0; i<acked_seq_nums_count; i++)
+	// gap ack blocks (like in SCTP) ack packets received after a missing one, given as offsets from cumulative_seq_num
+	for(uint16_t i=0; i<gap_ack_blocks_count; i++)
 	{
-		ChiakiTakionEvent event = { 0 };
-		event.type = CHIAKI_TAKION_EVENT_TYPE_DATA_ACK;
-		event.data_ack.seq_num = acked_seq_nums[i];
-		takion->cb(&event, takion->cb_user);
+		uint16_t gap_start = ntohs(*((chiaki_unaligned_uint16_t *)(buf + 0xc + i * 4)));
+		uint16_t gap_end = ntohs(*((chiaki_unaligned_uint16_t *)(buf + 0xc + i * 4 + 2)));
+		if(!gap_start || gap_end < gap_start)
+		{
+			CHIAKI_LOGW(takion->log, "Takion received data ack with invalid gap ack block %#x-%#x", gap_start, gap_end);
+			continue;
+		}
+		chiaki_takion_send_buffer_ack_range(&takion->send_buffer,
+				cumulative_seq_num + gap_start, cumulative_seq_num + gap_end,
+				acked_seq_nums, &acked_seq_nums_count);
+		takion_handle_packet_message_data_ack_events(takion, acked_seq_nums, acked_seq_nums_count);
 	}
 }
 
@@ -1480,6 +1533,23 @@ static void takion_handle_packet_av(ChiakiTakion *takion, uint8_t base_type, uin
 		return;
 	}
 
+	if(chiaki_trace_enabled(takion->trace))
+	{
+		ChiakiTraceEvent trace_event = { 0 };
+		trace_event.type = CHIAKI_TRACE_EVENT_AV_UNIT;
+		trace_event.packet_type = base_type;
+		trace_event.seq = packet.frame_index;
+		trace_event.index = packet.unit_index;
+		trace_event.extra = packet.units_in_frame_total;
+		trace_event.size = (uint32_t)packet.data_size;
+		trace_event.key_pos = packet.key_pos;
+		uint16_t source_units = packet.is_video
+			? packet.units_in_frame_total - packet.units_in_frame_fec
+			: chiaki_takion_av_packet_audio_source_units_count(&packet);
+		trace_event.result = packet.unit_index >= source_units ? 1 : 0;
+		chiaki_trace_push(takion->trace, &trace_event);
+	}
+
 	if(takion->cb)
 	{
 		ChiakiTakionEvent event = { 0 };
@@ -1,7 +1,5 @@
 // SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
 
-#ifndef CHIAKI_UNIT_TEST
-
 #include <chiaki/takionsendbuffer.h>
 #include <chiaki/takion.h>
 #include <chiaki/time.h>
@@ -10,114 +8,91 @@
 #include <assert.h>
 
 #define TAKION_DATA_RESEND_TIMEOUT_MS 200
-#define TAKION_DATA_RESEND_WAKEUP_TIMEOUT_MS (TAKION_DATA_RESEND_TIMEOUT_MS/2)
-#define TAKION_DATA_RESEND_TRIES_MAX 25
-#define TAKION_SEND_BUFFER_SIZE 16
-
-#endif
-
-struct chiaki_takion_send_buffer_packet_t
-{
-	ChiakiSeqNum32 seq_num;
-	uint64_t tries;
-	uint64_t last_send_ms; // chiaki_time_now_monotonic_ms()
-	uint8_t *buf;
-	size_t buf_size;
-}; // ChiakiTakionSendBufferPacket
+#define TAKION_DATA_RESEND_TIMEOUT_MIN_MS 100
+#define TAKION_DATA_RESEND_TIMEOUT_MAX_MS 1000
+#define TAKION_DATA_RESEND_GIVE_UP_MS 5000
 
-#ifndef CHIAKI_UNIT_TEST
-
-static void *takion_send_buffer_thread_func(void *user);
+static void takion_send_buffer_timer_cb(void *user);
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_init(ChiakiTakionSendBuffer *send_buffer, ChiakiTakion *takion, size_t size)
 {
 	send_buffer->takion = takion;
 	send_buffer->log = takion ? takion->log : NULL;
 
-	send_buffer->packets = calloc(size, sizeof(ChiakiTakionSendBufferPacket));
-	if(!send_buffer->packets)
-		return CHIAKI_ERR_MEMORY;
-	send_buffer->packets_size = size;
-	send_buffer->packets_count = 0;
-
-	send_buffer->should_stop = false;
-
-	ChiakiErrorCode err = chiaki_mutex_init(&send_buffer->mutex, false);
-	if(err != CHIAKI_ERR_SUCCESS)
-		goto error_packets;
-
-	err = chiaki_cond_init(&send_buffer->cond);
+	ChiakiRetransmitConfig config = { 0 };
+	config.seq_num_16 = false;
+	config.rto_initial_ms = TAKION_DATA_RESEND_TIMEOUT_MS;
+	config.rto_min_ms = TAKION_DATA_RESEND_TIMEOUT_MIN_MS;
+	config.rto_max_ms = TAKION_DATA_RESEND_TIMEOUT_MAX_MS;
+	config.give_up_ms = TAKION_DATA_RESEND_GIVE_UP_MS;
+	ChiakiErrorCode err = chiaki_retransmit_queue_init(&send_buffer->queue, size, &config);
 	if(err != CHIAKI_ERR_SUCCESS)
-		goto error_mutex;
+		return err;
 
-	err = chiaki_thread_create(&send_buffer->thread, takion_send_buffer_thread_func, send_buffer);
+	err = chiaki_mutex_init(&send_buffer->mutex, false);
 	if(err != CHIAKI_ERR_SUCCESS)
-		goto error_cond;
+		goto error_queue;
 
-	chiaki_thread_set_name(&send_buffer->thread, "Chiaki Takion Send Buffer");
+	send_buffer->timer_service = chiaki_timer_service_shared_ref();
+	if(!send_buffer->timer_service)
+	{
+		err = CHIAKI_ERR_THREAD;
+		goto error_mutex;
+	}
+	chiaki_timer_init(&send_buffer->timer, send_buffer->timer_service, takion_send_buffer_timer_cb, send_buffer);
 
 	return CHIAKI_ERR_SUCCESS;
-error_cond:
-	chiaki_cond_fini(&send_buffer->cond);
 error_mutex:
 	chiaki_mutex_fini(&send_buffer->mutex);
-error_packets:
-	free(send_buffer->packets);
+error_queue:
+	chiaki_retransmit_queue_fini(&send_buffer->queue);
 	return err;
 }
 
 CHIAKI_EXPORT void chiaki_takion_send_buffer_fini(ChiakiTakionSendBuffer *send_buffer)
 {
-	send_buffer->should_stop = true;
-	ChiakiErrorCode err = chiaki_cond_signal(&send_buffer->cond);
-	assert(err == CHIAKI_ERR_SUCCESS);
-	err = chiaki_thread_join(&send_buffer->thread, NULL);
-	assert(err == CHIAKI_ERR_SUCCESS);
+	chiaki_timer_cancel(&send_buffer->timer);
+	chiaki_timer_service_shared_unref(send_buffer->timer_service);
 
-	for(size_t i=0; i<send_buffer->packets_count; i++)
-		free(send_buffer->packets[i].buf);
+	if(send_buffer->queue.rtt_samples || send_buffer->queue.resends)
+		CHIAKI_LOGI(send_buffer->log, "Takion Send Buffer re-sent %llu packets, gave up on %llu, smoothed RTT %.1fms",
+				(unsigned long long)send_buffer->queue.resends, (unsigned long long)send_buffer->queue.give_ups,
+				send_buffer->queue.srtt_us / 1000.0);
 
-	chiaki_cond_fini(&send_buffer->cond);
 	chiaki_mutex_fini(&send_buffer->mutex);
-	free(send_buffer->packets);
+	chiaki_retransmit_queue_fini(&send_buffer->queue);
 }
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_push(ChiakiTakionSendBuffer *send_buffer, ChiakiSeqNum32 seq_num, uint8_t *buf, size_t buf_size)
 {
 	ChiakiErrorCode err = chiaki_mutex_lock(&send_buffer->mutex);
 	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		free(buf);
 		return err;
+	}
 
-	if(send_buffer->packets_count >= send_buffer->packets_size)
+	err = chiaki_retransmit_queue_push(&send_buffer->queue, seq_num, buf, buf_size, chiaki_time_now_monotonic_ms());
+	if(err == CHIAKI_ERR_OVERFLOW)
 	{
 		CHIAKI_LOGE(send_buffer->log, "Takion Send Buffer overflow");
-		err = CHIAKI_ERR_OVERFLOW;
 		goto beach;
 	}
-
-	for(size_t i=0; i<send_buffer->packets_count; i++)
+	else if(err == CHIAKI_ERR_INVALID_DATA)
 	{
-		if(send_buffer->packets[i].seq_num == seq_num)
-		{
-			CHIAKI_LOGE(send_buffer->log, "Tried to push duplicate seqnum into Takion Send Buffer");
-			err = CHIAKI_ERR_INVALID_DATA;
-			goto beach;
-		}
+		CHIAKI_LOGE(send_buffer->log, "Tried to push duplicate seqnum into Takion Send Buffer");
+		goto beach;
 	}
-
-	ChiakiTakionSendBufferPacket *packet = &send_buffer->packets[send_buffer->packets_count++];
-	packet->seq_num = seq_num;
-	packet->tries = 0;
-	packet->last_send_ms = chiaki_time_now_monotonic_ms();
-	packet->buf = buf;
-	packet->buf_size = buf_size;
+	else if(err != CHIAKI_ERR_SUCCESS)
+		goto beach;
 
 	CHIAKI_LOGV(send_buffer->log, "Pushed seq num %#llx into Takion Send Buffer", (unsigned long long)seq_num);
 
-	if(send_buffer->packets_count == 1)
+	// the rto may have shrunk since older packets were armed, so this one can be the earliest
+	if(send_buffer->takion)
 	{
-		// buffer was empty before, so it will sleep without timeout => WAKE UP!!
-		chiaki_cond_signal(&send_buffer->cond);
+		ChiakiRetransmitEntry *entry = chiaki_retransmit_queue_find(&send_buffer->queue, seq_num);
+		chiaki_timer_arm_earlier(&send_buffer->timer, entry->deadline_ms * 1000);
 	}
 
 beach:
@@ -128,6 +103,23 @@ beach:
 }
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_ack(ChiakiTakionSendBuffer *send_buffer, ChiakiSeqNum32 seq_num, ChiakiSeqNum32 *acked_seq_nums, size_t *acked_seq_nums_count)
+{
+	ChiakiErrorCode err = chiaki_mutex_lock(&send_buffer->mutex);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+
+	size_t acked = chiaki_retransmit_queue_ack_cumulative(&send_buffer->queue, seq_num, chiaki_time_now_monotonic_ms(),
+			acked_seq_nums && acked_seq_nums_count ? acked_seq_nums : NULL);
+	if(acked_seq_nums_count)
+		*acked_seq_nums_count = acked_seq_nums ? acked : 0;
+
+	CHIAKI_LOGV(send_buffer->log, "Acked seq num %#llx from Takion Send Buffer", (unsigned long long)seq_num);
+
+	chiaki_mutex_unlock(&send_buffer->mutex);
+	return err;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_ack_range(ChiakiTakionSendBuffer *send_buffer, ChiakiSeqNum32 begin, ChiakiSeqNum32 end, ChiakiSeqNum32 *acked_seq_nums, size_t *acked_seq_nums_count)
 {
 	ChiakiErrorCode err = chiaki_mutex_lock(&send_buffer->mutex);
 	if(err != CHIAKI_ERR_SUCCESS)
@@ -136,131 +128,66 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_ack(ChiakiTakionSendBuff
 	if(acked_seq_nums_count)
 		*acked_seq_nums_count = 0;
 
-	size_t i;
-	size_t shift = 0; // amount to shift back
-	size_t shift_start = SIZE_MAX;
-	for(i=0; i<send_buffer->packets_count; i++)
+	uint64_t now_ms = chiaki_time_now_monotonic_ms();
+	uint32_t range = end - begin;
+	if(range < send_buffer->queue.count)
 	{
-		if(send_buffer->packets[i].seq_num == seq_num || chiaki_seq_num_32_lt(send_buffer->packets[i].seq_num, seq_num))
+		// short range, look up every seq num
+		for(uint32_t i=0; i<=range; i++)
 		{
-			if(acked_seq_nums && acked_seq_nums_count)
-				acked_seq_nums[(*acked_seq_nums_count)++] = send_buffer->packets[i].seq_num;
-
-			free(send_buffer->packets[i].buf);
-			if(shift_start == SIZE_MAX)
-			{
-				// first shift
-				shift_start = i;
-				shift = 1;
-			}
-			else if(shift_start + shift == i)
-			{
-				// still in the same gap
-				shift++;
-			}
-			else
-			{
-				// new gap, do shift
-				memmove(send_buffer->packets + shift_start,
-						send_buffer->packets + shift_start + shift,
-						(i - (shift_start + shift)) * sizeof(ChiakiTakionSendBufferPacket));
-				// start new shift
-				shift_start = i - shift;
-				shift++;
-			}
+			if(chiaki_retransmit_queue_ack(&send_buffer->queue, begin + i, now_ms) && acked_seq_nums && acked_seq_nums_count)
+				acked_seq_nums[(*acked_seq_nums_count)++] = begin + i;
 		}
 	}
-
-	if(shift_start != SIZE_MAX)
+	else
 	{
-		// do final shift
-		if(shift_start + shift < send_buffer->packets_count)
+		// long range, check every queued packet instead
+		ChiakiRetransmitEntry *entry = send_buffer->queue.head;
+		while(entry)
 		{
-			memmove(send_buffer->packets + shift_start,
-					send_buffer->packets + shift_start + shift,
-					(send_buffer->packets_count - (shift_start + shift)) * sizeof(ChiakiTakionSendBufferPacket));
+			ChiakiRetransmitEntry *next = entry->order_next;
+			ChiakiSeqNum32 seq_num = entry->seq_num;
+			if((uint32_t)(seq_num - begin) <= range
+					&& chiaki_retransmit_queue_ack(&send_buffer->queue, seq_num, now_ms)
+					&& acked_seq_nums && acked_seq_nums_count)
+				acked_seq_nums[(*acked_seq_nums_count)++] = seq_num;
+			entry = next;
 		}
-		send_buffer->packets_count -= shift;
 	}
 
-	CHIAKI_LOGV(send_buffer->log, "Acked seq num %#llx from Takion Send Buffer", (unsigned long long)seq_num);
-
 	chiaki_mutex_unlock(&send_buffer->mutex);
 	return err;
 }
 
-static void takion_send_buffer_resend(ChiakiTakionSendBuffer *send_buffer);
-
-static bool takion_send_buffer_check_pred_packets(void *user)
-{
-	ChiakiTakionSendBuffer *send_buffer = user;
-	return send_buffer->should_stop;
-}
-
-static bool takion_send_buffer_check_pred_no_packets(void *user)
-{
-	ChiakiTakionSendBuffer *send_buffer = user;
-	return send_buffer->should_stop || send_buffer->packets_count;
-}
+static void takion_send_buffer_resend_cb(ChiakiRetransmitEntry *entry, ChiakiRetransmitAction action, void *user);
 
-static void *takion_send_buffer_thread_func(void *user)
+static void takion_send_buffer_timer_cb(void *user)
 {
 	ChiakiTakionSendBuffer *send_buffer = user;
+	if(chiaki_mutex_lock(&send_buffer->mutex) != CHIAKI_ERR_SUCCESS)
+		return;
 
-	ChiakiErrorCode err = chiaki_mutex_lock(&send_buffer->mutex);
-	if(err != CHIAKI_ERR_SUCCESS)
-		return NULL;
-
-	while(true)
-	{
-		if(send_buffer->packets_count) // if there are packets, wait with timeout
-			err = chiaki_cond_timedwait_pred(&send_buffer->cond, &send_buffer->mutex, TAKION_DATA_RESEND_WAKEUP_TIMEOUT_MS, takion_send_buffer_check_pred_packets, send_buffer);
-		else // if not, wait without timeout, but also wakeup if packets become available
-			err = chiaki_cond_wait_pred(&send_buffer->cond, &send_buffer->mutex, takion_send_buffer_check_pred_no_packets, send_buffer);
-
-		if(err != CHIAKI_ERR_SUCCESS && err != CHIAKI_ERR_TIMEOUT)
-			break;
+	uint64_t now_ms = chiaki_time_now_monotonic_ms();
+	chiaki_retransmit_queue_expire(&send_buffer->queue, now_ms, takion_send_buffer_resend_cb, send_buffer);
 
-		if(send_buffer->should_stop)
-			break;
+	// acks don't disarm the timer, so this may find nothing to do and only re-arm for whatever is left
+	uint64_t timeout_ms = chiaki_retransmit_queue_next_timeout_ms(&send_buffer->queue, now_ms);
+	if(timeout_ms != UINT64_MAX)
+		chiaki_timer_arm(&send_buffer->timer, (now_ms + timeout_ms) * 1000);
 
-		takion_send_buffer_resend(send_buffer);
-	}
 	chiaki_mutex_unlock(&send_buffer->mutex);
-
-	return NULL;
 }
 
-static void takion_send_buffer_resend(ChiakiTakionSendBuffer *send_buffer)
+static void takion_send_buffer_resend_cb(ChiakiRetransmitEntry *entry, ChiakiRetransmitAction action, void *user)
 {
-	if(!send_buffer->takion)
-		return;
-
-	uint64_t now = chiaki_time_now_monotonic_ms();
-
-	for(size_t i=0; i<send_buffer->packets_count; i++)
+	ChiakiTakionSendBuffer *send_buffer = user;
+	if(action == CHIAKI_RETRANSMIT_ACTION_GIVE_UP)
 	{
-		ChiakiTakionSendBufferPacket *packet = &send_buffer->packets[i];
-		if(now - packet->last_send_ms > TAKION_DATA_RESEND_TIMEOUT_MS)
-		{
-			if(packet->tries >= TAKION_DATA_RESEND_TRIES_MAX)
-			{
-				CHIAKI_LOGI(send_buffer->log, "Hit max retries of %d tries... giving up on packet with seqnum %#llx", TAKION_DATA_RESEND_TRIES_MAX, (unsigned long long)packet->seq_num);
-				ChiakiSeqNum32 ack_seq_nums[TAKION_SEND_BUFFER_SIZE];
-				size_t ack_seq_nums_count;
-				chiaki_mutex_unlock(&send_buffer->mutex);
-				chiaki_takion_send_buffer_ack(send_buffer, packet->seq_num, ack_seq_nums, &ack_seq_nums_count);
-				chiaki_mutex_lock(&send_buffer->mutex);
-				if(i > 0)
-					i-= 1;
-				continue;
-			}
-			CHIAKI_LOGI(send_buffer->log, "Takion Send Buffer re-sending packet with seqnum %#llx, tries: %llu", (unsigned long long)packet->seq_num, (unsigned long long)packet->tries);
-			packet->last_send_ms = now;
-			chiaki_takion_send_raw(send_buffer->takion, packet->buf, packet->buf_size);
-			packet->tries++;
-		}
+		CHIAKI_LOGI(send_buffer->log, "Hit max resend time of %dms after %llu tries... giving up on packet with seqnum %#llx",
+				TAKION_DATA_RESEND_GIVE_UP_MS, (unsigned long long)entry->tries, (unsigned long long)entry->seq_num);
+		return;
 	}
+	CHIAKI_LOGI(send_buffer->log, "Takion Send Buffer re-sending packet with seqnum %#llx, tries: %llu, rto: %llums",
+			(unsigned long long)entry->seq_num, (unsigned long long)entry->tries, (unsigned long long)entry->rto_ms);
+	chiaki_takion_send_raw(send_buffer->takion, entry->buf, entry->buf_size);
 }
-
-#endif
@@ -7,7 +7,19 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#include <assert.h>
+
+#if !defined(_WIN32) && !defined(__SWITCH__)
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#endif
 
 #ifdef __SWITCH__
 #include <switch.h>
@@ -97,6 +109,372 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_set_name(ChiakiThread *thread, const
 	return CHIAKI_ERR_SUCCESS;
 }
 
+#define PLACEMENT_NICE_DEFAULT (-10)
+#define PLACEMENT_FIFO_DEFAULT 10
+
+// protected by CHIAKI_STATIC_MUTEX_THREAD_PLACEMENT, which a realtime thread must never wait for
+static unsigned int placement_refs = 0;
+static bool placement_active = false;
+static ChiakiThreadPlacementConfig placement_config;
+static ChiakiThreadPlacementReport placement_report;
+static uint64_t placement_base_cpu_mask; // affinity of the thread that set the config, restored for default roles
+
+static void placement_lock()
+{
+	chiaki_static_mutex_lock(CHIAKI_STATIC_MUTEX_THREAD_PLACEMENT);
+}
+
+static void placement_unlock()
+{
+	chiaki_static_mutex_unlock(CHIAKI_STATIC_MUTEX_THREAD_PLACEMENT);
+}
+
+CHIAKI_EXPORT const char *chiaki_thread_role_string(ChiakiThreadRole role)
+{
+	switch(role)
+	{
+		case CHIAKI_THREAD_ROLE_TAKION:
+			return "takion";
+		case CHIAKI_THREAD_ROLE_GKCRYPT:
+			return "gkcrypt";
+		case CHIAKI_THREAD_ROLE_DECODER:
+			return "decoder";
+		case CHIAKI_THREAD_ROLE_AUDIO:
+			return "audio";
+		case CHIAKI_THREAD_ROLE_FEEDBACK:
+			return "feedback";
+		case CHIAKI_THREAD_ROLE_WORKER:
+			return "worker";
+		default:
+			return "unknown";
+	}
+}
+
+CHIAKI_EXPORT const char *chiaki_thread_priority_string(ChiakiThreadPriority priority)
+{
+	switch(priority)
+	{
+		case CHIAKI_THREAD_PRIORITY_DEFAULT:
+			return "default";
+		case CHIAKI_THREAD_PRIORITY_HIGH:
+			return "high";
+		case CHIAKI_THREAD_PRIORITY_REALTIME:
+			return "realtime";
+		default:
+			return "unknown";
+	}
+}
+
+static uint64_t thread_get_cpu_mask()
+{
+#if defined(__linux__)
+	cpu_set_t set;
+	if(sched_getaffinity(0, sizeof(set), &set) != 0)
+		return 0;
+	uint64_t mask = 0;
+	for(int i=0; i<64; i++)
+		if(CPU_ISSET(i, &set))
+			mask |= ((uint64_t)1) << i;
+	return mask;
+#elif defined(_WIN32)
+	DWORD_PTR process_mask, system_mask;
+	if(!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+		return 0;
+	return (uint64_t)process_mask;
+#else
+	return 0;
+#endif
+}
+
+static ChiakiErrorCode thread_set_cpu_mask(uint64_t mask)
+{
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for(int i=0; i<64; i++)
+		if(mask & (((uint64_t)1) << i))
+			CPU_SET(i, &set);
+	return sched_setaffinity(0, sizeof(set), &set) == 0 ? CHIAKI_ERR_SUCCESS : CHIAKI_ERR_THREAD;
+#elif defined(_WIN32)
+	return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)mask) ? CHIAKI_ERR_SUCCESS : CHIAKI_ERR_THREAD;
+#else
+	// no hard affinity on macOS and consoles
+	(void)mask;
+	return CHIAKI_ERR_THREAD;
+#endif
+}
+
+static ChiakiErrorCode thread_set_priority(ChiakiThreadPriority priority, int value)
+{
+#if defined(_WIN32)
+	int win_priority = THREAD_PRIORITY_NORMAL;
+	if(priority == CHIAKI_THREAD_PRIORITY_HIGH)
+		win_priority = THREAD_PRIORITY_HIGHEST;
+	else if(priority == CHIAKI_THREAD_PRIORITY_REALTIME)
+		win_priority = THREAD_PRIORITY_TIME_CRITICAL;
+	(void)value;
+	return SetThreadPriority(GetCurrentThread(), win_priority) ? CHIAKI_ERR_SUCCESS : CHIAKI_ERR_THREAD;
+#elif defined(__SWITCH__)
+	(void)value;
+	return priority == CHIAKI_THREAD_PRIORITY_DEFAULT ? CHIAKI_ERR_SUCCESS : CHIAKI_ERR_THREAD;
+#else
+	struct sched_param param = { 0 };
+	if(priority == CHIAKI_THREAD_PRIORITY_REALTIME)
+	{
+		param.sched_priority = value ? value : PLACEMENT_FIFO_DEFAULT;
+		return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0 ? CHIAKI_ERR_SUCCESS : CHIAKI_ERR_THREAD;
+	}
+	if(pthread_setschedparam(pthread_self(), SCHED_OTHER, &param) != 0)
+		return CHIAKI_ERR_THREAD;
+#if defined(__linux__)
+	// on Linux the nice value is per thread
+	int nice_value = priority == CHIAKI_THREAD_PRIORITY_HIGH ? (value ? value : PLACEMENT_NICE_DEFAULT) : 0;
+	if(setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), nice_value) != 0)
+		return CHIAKI_ERR_THREAD;
+	return CHIAKI_ERR_SUCCESS;
+#else
+	return priority == CHIAKI_THREAD_PRIORITY_DEFAULT ? CHIAKI_ERR_SUCCESS : CHIAKI_ERR_THREAD;
+#endif
+#endif
+}
+
+static void thread_get_priority(ChiakiThreadPriority *priority, int *value)
+{
+	*priority = CHIAKI_THREAD_PRIORITY_DEFAULT;
+	*value = 0;
+#if defined(_WIN32)
+	int win_priority = GetThreadPriority(GetCurrentThread());
+	if(win_priority >= THREAD_PRIORITY_TIME_CRITICAL)
+		*priority = CHIAKI_THREAD_PRIORITY_REALTIME;
+	else if(win_priority > THREAD_PRIORITY_NORMAL)
+		*priority = CHIAKI_THREAD_PRIORITY_HIGH;
+	*value = win_priority;
+#elif !defined(__SWITCH__)
+	int policy;
+	struct sched_param param;
+	if(pthread_getschedparam(pthread_self(), &policy, &param) != 0)
+		return;
+	if(policy == SCHED_FIFO || policy == SCHED_RR)
+	{
+		*priority = CHIAKI_THREAD_PRIORITY_REALTIME;
+		*value = param.sched_priority;
+		return;
+	}
+#if defined(__linux__)
+	errno = 0;
+	int nice_value = getpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid));
+	if(errno == 0 && nice_value < 0)
+	{
+		*priority = CHIAKI_THREAD_PRIORITY_HIGH;
+		*value = nice_value;
+	}
+#endif
+#endif
+}
+
+static ChiakiErrorCode thread_lock_memory(bool lock)
+{
+#if defined(_WIN32) || defined(__SWITCH__)
+	return lock ? CHIAKI_ERR_THREAD : CHIAKI_ERR_SUCCESS;
+#else
+	if(lock)
+		return mlockall(MCL_CURRENT | MCL_FUTURE) == 0 ? CHIAKI_ERR_SUCCESS : CHIAKI_ERR_MEMORY;
+	return munlockall() == 0 ? CHIAKI_ERR_SUCCESS : CHIAKI_ERR_MEMORY;
+#endif
+}
+
+static int thread_realtime_priority_value(int value)
+{
+#if defined(_WIN32)
+	(void)value;
+	return THREAD_PRIORITY_TIME_CRITICAL;
+#else
+	return value ? value : PLACEMENT_FIFO_DEFAULT;
+#endif
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_placement_ref(const ChiakiThreadPlacementConfig *config)
+{
+	placement_lock();
+	if(placement_refs++)
+	{
+		ChiakiErrorCode err = placement_report.memory_lock_err;
+		placement_unlock();
+		return err;
+	}
+
+	memset(&placement_report, 0, sizeof(placement_report));
+	placement_active = true;
+	if(config)
+		placement_config = *config;
+	else
+		memset(&placement_config, 0, sizeof(placement_config));
+	placement_base_cpu_mask = thread_get_cpu_mask();
+
+	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+	if(placement_config.lock_memory)
+		err = thread_lock_memory(true);
+	placement_report.memory_locked = placement_config.lock_memory && err == CHIAKI_ERR_SUCCESS;
+	placement_report.memory_lock_err = err;
+	placement_unlock();
+	return err;
+}
+
+CHIAKI_EXPORT void chiaki_thread_placement_unref(void)
+{
+	placement_lock();
+	assert(placement_refs > 0);
+	if(--placement_refs == 0)
+	{
+		placement_active = false;
+		memset(&placement_config, 0, sizeof(placement_config));
+		if(placement_report.memory_locked)
+			thread_lock_memory(false);
+		placement_report.memory_locked = false;
+	}
+	placement_unlock();
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_apply_role(ChiakiThreadRole role)
+{
+	if(role < 0 || role >= CHIAKI_THREAD_ROLE_COUNT)
+		return CHIAKI_ERR_INVALID_DATA;
+
+	// a realtime creator passes its policy on, drop it before waiting for the placement mutex
+	ChiakiThreadPriority inherited_priority;
+	int inherited_priority_value;
+	thread_get_priority(&inherited_priority, &inherited_priority_value);
+	bool dropped = inherited_priority == CHIAKI_THREAD_PRIORITY_REALTIME
+		&& thread_set_priority(CHIAKI_THREAD_PRIORITY_DEFAULT, 0) == CHIAKI_ERR_SUCCESS;
+
+	placement_lock();
+	bool active = placement_active;
+	ChiakiThreadPlacement placement = placement_config.roles[role];
+	uint64_t base_cpu_mask = placement_base_cpu_mask;
+	placement_unlock();
+
+	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+	bool set_priority = active || dropped;
+	ChiakiThreadPriority priority = inherited_priority;
+	int priority_value = inherited_priority_value;
+	if(active)
+	{
+		uint64_t cpu_mask = placement.cpu_mask ? placement.cpu_mask : base_cpu_mask;
+		if(cpu_mask && cpu_mask != thread_get_cpu_mask())
+			err = thread_set_cpu_mask(cpu_mask);
+		priority = placement.priority;
+		priority_value = placement.priority_value;
+	}
+	bool realtime = set_priority && priority == CHIAKI_THREAD_PRIORITY_REALTIME;
+	if(set_priority && !realtime)
+	{
+		// still try the priority if the affinity was refused
+		ChiakiErrorCode priority_err = thread_set_priority(priority, priority_value);
+		if(err == CHIAKI_ERR_SUCCESS)
+			err = priority_err;
+	}
+
+	ChiakiThreadPlacementEffective effective;
+	effective.err = err;
+	effective.cpu_mask = thread_get_cpu_mask();
+	thread_get_priority(&effective.priority, &effective.priority_value);
+	if(realtime)
+	{
+		// recorded up front, once the thread runs realtime it must not take the placement mutex anymore
+		effective.priority = CHIAKI_THREAD_PRIORITY_REALTIME;
+		effective.priority_value = thread_realtime_priority_value(priority_value);
+	}
+
+	placement_lock();
+	effective.threads = placement_report.roles[role].threads + 1;
+	placement_report.roles[role] = effective;
+	placement_unlock();
+
+	if(realtime)
+	{
+		ChiakiErrorCode priority_err = thread_set_priority(priority, priority_value);
+		if(priority_err != CHIAKI_ERR_SUCCESS)
+		{
+			// refused, so the thread did not become realtime and may correct the report
+			if(err == CHIAKI_ERR_SUCCESS)
+				err = priority_err;
+			placement_lock();
+			placement_report.roles[role].err = err;
+			thread_get_priority(&placement_report.roles[role].priority, &placement_report.roles[role].priority_value);
+			placement_unlock();
+		}
+	}
+	return err;
+}
+
+CHIAKI_EXPORT void chiaki_thread_placement_get_report(ChiakiThreadPlacementReport *report)
+{
+	placement_lock();
+	*report = placement_report;
+	placement_unlock();
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_parse_cpu_list(const char *str, uint64_t *mask)
+{
+	*mask = 0;
+	const char *p = str;
+	while(*p)
+	{
+		while(*p == ' ')
+			p++;
+		if(!*p)
+			break;
+		char *end;
+		unsigned long first = strtoul(p, &end, 10);
+		if(end == p)
+			return CHIAKI_ERR_INVALID_DATA;
+		unsigned long last = first;
+		p = end;
+		if(*p == '-')
+		{
+			p++;
+			last = strtoul(p, &end, 10);
+			if(end == p)
+				return CHIAKI_ERR_INVALID_DATA;
+			p = end;
+		}
+		if(first > last || last > 63)
+			return CHIAKI_ERR_INVALID_DATA;
+		for(unsigned long i=first; i<=last; i++)
+			*mask |= ((uint64_t)1) << i;
+		while(*p == ' ')
+			p++;
+		if(*p == ',')
+			p++;
+		else if(*p)
+			return CHIAKI_ERR_INVALID_DATA;
+	}
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_thread_format_cpu_list(uint64_t mask, char *buf, size_t buf_size)
+{
+	if(!buf_size)
+		return;
+	buf[0] = '\0';
+	size_t len = 0;
+	for(int i=0; i<64; i++)
+	{
+		if(!(mask & (((uint64_t)1) << i)))
+			continue;
+		int last = i;
+		while(last < 63 && (mask & (((uint64_t)1) << (last + 1))))
+			last++;
+		int r = last > i
+			? snprintf(buf + len, buf_size - len, "%s%d-%d", len ? "," : "", i, last)
+			: snprintf(buf + len, buf_size - len, "%s%d", len ? "," : "", i);
+		if(r < 0 || (size_t)r >= buf_size - len)
+			return;
+		len += r;
+		i = last;
+	}
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_mutex_init(ChiakiMutex *mutex, bool rec)
 {
 #if _WIN32
@@ -172,6 +550,49 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_mutex_unlock(ChiakiMutex *mutex)
 	return CHIAKI_ERR_SUCCESS;
 }
 
+static ChiakiMutex static_mutexes[CHIAKI_STATIC_MUTEX_COUNT];
+
+#if _WIN32
+static INIT_ONCE static_mutexes_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK static_mutexes_init(PINIT_ONCE once, PVOID param, PVOID *context)
+{
+	(void)once; (void)param; (void)context;
+	for(size_t i=0; i<CHIAKI_STATIC_MUTEX_COUNT; i++)
+		chiaki_mutex_init(&static_mutexes[i], false);
+	return TRUE;
+}
+#else
+static pthread_once_t static_mutexes_once = PTHREAD_ONCE_INIT;
+
+static void static_mutexes_init(void)
+{
+	for(size_t i=0; i<CHIAKI_STATIC_MUTEX_COUNT; i++)
+		chiaki_mutex_init(&static_mutexes[i], false);
+}
+#endif
+
+static ChiakiMutex *static_mutex_get(ChiakiStaticMutex which)
+{
+	assert(which >= 0 && which < CHIAKI_STATIC_MUTEX_COUNT);
+#if _WIN32
+	InitOnceExecuteOnce(&static_mutexes_once, static_mutexes_init, NULL, NULL);
+#else
+	pthread_once(&static_mutexes_once, static_mutexes_init);
+#endif
+	return &static_mutexes[which];
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_static_mutex_lock(ChiakiStaticMutex which)
+{
+	return chiaki_mutex_lock(static_mutex_get(which));
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_static_mutex_unlock(ChiakiStaticMutex which)
+{
+	return chiaki_mutex_unlock(static_mutex_get(which));
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_cond_init(ChiakiCond *cond)
 {
 #if _WIN32
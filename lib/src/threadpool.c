@@ -0,0 +1,307 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/threadpool.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+struct chiaki_thread_pool_worker_t
+{
+	ChiakiThreadPool *pool;
+	size_t index;
+	ChiakiThread thread;
+	ChiakiMutex mutex; // protects the queues
+	ChiakiThreadPoolTask *head[CHIAKI_THREAD_POOL_PRIORITY_COUNT];
+	ChiakiThreadPoolTask *tail[CHIAKI_THREAD_POOL_PRIORITY_COUNT];
+};
+
+static void *worker_thread_func(void *user);
+
+CHIAKI_EXPORT size_t chiaki_thread_pool_workers_default(void)
+{
+#if defined(_WIN32)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	long cpus = (long)info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+	long cpus = 1;
+#endif
+	if(cpus <= 1)
+		return 1;
+	if(cpus - 1 > CHIAKI_THREAD_POOL_WORKERS_MAX)
+		return CHIAKI_THREAD_POOL_WORKERS_MAX;
+	return (size_t)(cpus - 1);
+}
+
+static void pool_stop_workers(ChiakiThreadPool *pool, size_t started)
+{
+	chiaki_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	chiaki_cond_broadcast(&pool->cond);
+	chiaki_mutex_unlock(&pool->mutex);
+	for(size_t i=0; i<started; i++)
+		chiaki_thread_join(&pool->workers[i].thread, NULL);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_pool_init(ChiakiThreadPool *pool, size_t workers_count, ChiakiLog *log)
+{
+	pool->log = log;
+	if(!workers_count)
+		workers_count = chiaki_thread_pool_workers_default();
+	if(workers_count > CHIAKI_THREAD_POOL_WORKERS_MAX)
+		workers_count = CHIAKI_THREAD_POOL_WORKERS_MAX;
+	pool->workers_count = workers_count;
+	pool->pending = 0;
+	pool->affinity_next = 0;
+	pool->stop = false;
+	size_t mutexes = 0;
+
+	pool->workers = calloc(workers_count, sizeof(ChiakiThreadPoolWorker));
+	if(!pool->workers)
+		return CHIAKI_ERR_MEMORY;
+
+	ChiakiErrorCode err = chiaki_mutex_init(&pool->mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_workers;
+
+	err = chiaki_cond_init(&pool->cond);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_mutex;
+
+	for(; mutexes<workers_count; mutexes++)
+	{
+		ChiakiThreadPoolWorker *worker = &pool->workers[mutexes];
+		worker->pool = pool;
+		worker->index = mutexes;
+		err = chiaki_mutex_init(&worker->mutex, false);
+		if(err != CHIAKI_ERR_SUCCESS)
+			goto error_worker_mutexes;
+	}
+
+	for(size_t i=0; i<workers_count; i++)
+	{
+		err = chiaki_thread_create(&pool->workers[i].thread, worker_thread_func, &pool->workers[i]);
+		if(err != CHIAKI_ERR_SUCCESS)
+		{
+			CHIAKI_LOGE(pool->log, "Thread pool failed to start worker %llu", (unsigned long long)i);
+			pool_stop_workers(pool, i);
+			goto error_worker_mutexes;
+		}
+		chiaki_thread_set_name(&pool->workers[i].thread, "Chiaki Worker");
+	}
+
+	return CHIAKI_ERR_SUCCESS;
+
+error_worker_mutexes:
+	for(size_t i=0; i<mutexes; i++)
+		chiaki_mutex_fini(&pool->workers[i].mutex);
+	chiaki_cond_fini(&pool->cond);
+error_mutex:
+	chiaki_mutex_fini(&pool->mutex);
+error_workers:
+	free(pool->workers);
+	return err;
+}
+
+CHIAKI_EXPORT void chiaki_thread_pool_fini(ChiakiThreadPool *pool)
+{
+	pool_stop_workers(pool, pool->workers_count);
+	assert(!chiaki_atomic_load_u32(&pool->pending));
+	for(size_t i=0; i<pool->workers_count; i++)
+		chiaki_mutex_fini(&pool->workers[i].mutex);
+	chiaki_cond_fini(&pool->cond);
+	chiaki_mutex_fini(&pool->mutex);
+	free(pool->workers);
+}
+
+CHIAKI_EXPORT uint32_t chiaki_thread_pool_affinity(ChiakiThreadPool *pool)
+{
+	return chiaki_atomic_fetch_add_u32(&pool->affinity_next, 1);
+}
+
+CHIAKI_EXPORT void chiaki_thread_pool_submit(ChiakiThreadPool *pool, ChiakiThreadPoolTask *task, ChiakiThreadPoolPriority priority, uint32_t affinity)
+{
+	assert(priority >= 0 && priority < CHIAKI_THREAD_POOL_PRIORITY_COUNT);
+	if(task->group)
+	{
+		chiaki_mutex_lock(&task->group->mutex);
+		task->group->pending++;
+		chiaki_mutex_unlock(&task->group->mutex);
+	}
+
+	// counted first, so a worker that sees pending == 0 can safely go to sleep
+	chiaki_atomic_fetch_add_u32(&pool->pending, 1);
+
+	ChiakiThreadPoolWorker *worker = &pool->workers[affinity % pool->workers_count];
+	task->next = NULL;
+	chiaki_mutex_lock(&worker->mutex);
+	if(worker->tail[priority])
+		worker->tail[priority]->next = task;
+	else
+		worker->head[priority] = task;
+	worker->tail[priority] = task;
+	chiaki_mutex_unlock(&worker->mutex);
+
+	// whichever worker wakes up takes it, stealing if it is not the one it was queued on
+	chiaki_mutex_lock(&pool->mutex);
+	chiaki_cond_signal(&pool->cond);
+	chiaki_mutex_unlock(&pool->mutex);
+}
+
+/**
+ * Remove the first task of the given priority from the worker's queue, only a task of group if group is not NULL.
+ */
+static ChiakiThreadPoolTask *worker_queue_take(ChiakiThreadPoolWorker *worker, ChiakiThreadPoolPriority priority, ChiakiThreadPoolGroup *group)
+{
+	chiaki_mutex_lock(&worker->mutex);
+	ChiakiThreadPoolTask *prev = NULL;
+	ChiakiThreadPoolTask *task = worker->head[priority];
+	while(task && group && task->group != group)
+	{
+		prev = task;
+		task = task->next;
+	}
+	if(task)
+	{
+		if(prev)
+			prev->next = task->next;
+		else
+			worker->head[priority] = task->next;
+		if(worker->tail[priority] == task)
+			worker->tail[priority] = prev;
+		task->next = NULL;
+	}
+	chiaki_mutex_unlock(&worker->mutex);
+	return task;
+}
+
+/**
+ * Own queue first, then steal from the others, always all high priority tasks before normal ones.
+ */
+static ChiakiThreadPoolTask *pool_take(ChiakiThreadPool *pool, size_t start, ChiakiThreadPoolGroup *group)
+{
+	for(int priority=0; priority<CHIAKI_THREAD_POOL_PRIORITY_COUNT; priority++)
+	{
+		for(size_t i=0; i<pool->workers_count; i++)
+		{
+			ChiakiThreadPoolWorker *worker = &pool->workers[(start + i) % pool->workers_count];
+			ChiakiThreadPoolTask *task = worker_queue_take(worker, (ChiakiThreadPoolPriority)priority, group);
+			if(task)
+			{
+				chiaki_atomic_fetch_add_u32(&pool->pending, (uint32_t)-1);
+				return task;
+			}
+		}
+	}
+	return NULL;
+}
+
+static void task_run(ChiakiThreadPoolTask *task)
+{
+	// the task may be resubmitted or freed by its func, so nothing of it is touched afterwards
+	ChiakiThreadPoolGroup *group = task->group;
+	task->func(task->user);
+	if(!group)
+		return;
+	chiaki_mutex_lock(&group->mutex);
+	assert(group->pending > 0);
+	if(--group->pending == 0)
+		chiaki_cond_broadcast(&group->cond);
+	chiaki_mutex_unlock(&group->mutex);
+}
+
+static void *worker_thread_func(void *user)
+{
+	ChiakiThreadPoolWorker *worker = user;
+	ChiakiThreadPool *pool = worker->pool;
+	chiaki_thread_apply_role(CHIAKI_THREAD_ROLE_WORKER);
+
+	while(true)
+	{
+		ChiakiThreadPoolTask *task = pool_take(pool, worker->index, NULL);
+		if(task)
+		{
+			task_run(task);
+			continue;
+		}
+
+		chiaki_mutex_lock(&pool->mutex);
+		while(!pool->stop && !chiaki_atomic_load_u32(&pool->pending))
+			chiaki_cond_wait(&pool->cond, &pool->mutex);
+		bool done = pool->stop && !chiaki_atomic_load_u32(&pool->pending);
+		chiaki_mutex_unlock(&pool->mutex);
+		if(done)
+			break;
+	}
+	return NULL;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_pool_group_init(ChiakiThreadPoolGroup *group)
+{
+	group->pending = 0;
+	ChiakiErrorCode err = chiaki_mutex_init(&group->mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	err = chiaki_cond_init(&group->cond);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		chiaki_mutex_fini(&group->mutex);
+		return err;
+	}
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_thread_pool_group_fini(ChiakiThreadPoolGroup *group)
+{
+	assert(!group->pending);
+	chiaki_cond_fini(&group->cond);
+	chiaki_mutex_fini(&group->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_thread_pool_group_wait(ChiakiThreadPool *pool, ChiakiThreadPoolGroup *group)
+{
+	ChiakiThreadPoolTask *task;
+	while((task = pool_take(pool, 0, group)))
+		task_run(task);
+
+	chiaki_mutex_lock(&group->mutex);
+	while(group->pending)
+		chiaki_cond_wait(&group->cond, &group->mutex);
+	chiaki_mutex_unlock(&group->mutex);
+}
+
+// protected by CHIAKI_STATIC_MUTEX_THREAD_POOL_SHARED
+static ChiakiThreadPool shared_pool;
+static unsigned int shared_refs = 0;
+
+CHIAKI_EXPORT ChiakiThreadPool *chiaki_thread_pool_shared_ref(void)
+{
+	ChiakiThreadPool *pool = &shared_pool;
+	chiaki_static_mutex_lock(CHIAKI_STATIC_MUTEX_THREAD_POOL_SHARED);
+	// no log, the pool may outlive whoever created it
+	if(!shared_refs && chiaki_thread_pool_init(&shared_pool, 0, NULL) != CHIAKI_ERR_SUCCESS)
+		pool = NULL;
+	else
+		shared_refs++;
+	chiaki_static_mutex_unlock(CHIAKI_STATIC_MUTEX_THREAD_POOL_SHARED);
+	return pool;
+}
+
+CHIAKI_EXPORT void chiaki_thread_pool_shared_unref(ChiakiThreadPool *pool)
+{
+	if(!pool)
+		return;
+	assert(pool == &shared_pool);
+	chiaki_static_mutex_lock(CHIAKI_STATIC_MUTEX_THREAD_POOL_SHARED);
+	assert(shared_refs > 0);
+	if(--shared_refs == 0)
+		chiaki_thread_pool_fini(&shared_pool);
+	chiaki_static_mutex_unlock(CHIAKI_STATIC_MUTEX_THREAD_POOL_SHARED);
+}
@@ -0,0 +1,359 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/timerservice.h>
+#include <chiaki/time.h>
+
+#include <stdlib.h>
+#include <assert.h>
+
+#ifdef __linux__
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <time.h>
+#endif
+
+#define TIMER_SERVICE_HEAP_SIZE_MIN 16
+
+static void *timer_service_thread_func(void *user);
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_timer_service_init(ChiakiTimerService *service)
+{
+	service->heap = NULL;
+	service->heap_count = 0;
+	service->heap_size = 0;
+	service->sleep_until_us = 0;
+	service->running = NULL;
+	service->timer_fd = -1;
+	service->event_fd = -1;
+	service->stop = false;
+	service->wakeups = 0;
+	service->fired = 0;
+
+	ChiakiErrorCode err = chiaki_mutex_init(&service->mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+
+	err = chiaki_cond_init(&service->running_cond);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_mutex;
+
+	err = chiaki_cond_init(&service->wake_cond);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_running_cond;
+
+#ifdef __linux__
+	// without them, fall back to wake_cond with millisecond timeouts
+	service->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if(service->timer_fd >= 0)
+	{
+		service->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if(service->event_fd < 0)
+		{
+			close(service->timer_fd);
+			service->timer_fd = -1;
+		}
+	}
+#endif
+
+	err = chiaki_thread_create(&service->thread, timer_service_thread_func, service);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_fds;
+
+	chiaki_thread_set_name(&service->thread, "Chiaki Timers");
+
+	return CHIAKI_ERR_SUCCESS;
+
+error_fds:
+#ifdef __linux__
+	if(service->timer_fd >= 0)
+	{
+		close(service->timer_fd);
+		close(service->event_fd);
+	}
+#endif
+	chiaki_cond_fini(&service->wake_cond);
+error_running_cond:
+	chiaki_cond_fini(&service->running_cond);
+error_mutex:
+	chiaki_mutex_fini(&service->mutex);
+	return err;
+}
+
+/**
+ * Make the thread re-check the heap, mutex must be locked.
+ */
+static void timer_service_wake(ChiakiTimerService *service)
+{
+	// it re-reads the heap before sleeping again, so once is enough
+	service->sleep_until_us = 0;
+#ifdef __linux__
+	if(service->timer_fd >= 0)
+	{
+		uint64_t v = 1;
+		ssize_t r = write(service->event_fd, &v, sizeof(v));
+		(void)r; // only fails if the counter is already non-zero, which wakes it as well
+		return;
+	}
+#endif
+	chiaki_cond_signal(&service->wake_cond);
+}
+
+CHIAKI_EXPORT void chiaki_timer_service_fini(ChiakiTimerService *service)
+{
+	chiaki_mutex_lock(&service->mutex);
+	service->stop = true;
+	timer_service_wake(service);
+	chiaki_mutex_unlock(&service->mutex);
+	chiaki_thread_join(&service->thread, NULL);
+
+	assert(!service->heap_count);
+#ifdef __linux__
+	if(service->timer_fd >= 0)
+	{
+		close(service->timer_fd);
+		close(service->event_fd);
+	}
+#endif
+	free(service->heap);
+	chiaki_cond_fini(&service->wake_cond);
+	chiaki_cond_fini(&service->running_cond);
+	chiaki_mutex_fini(&service->mutex);
+}
+
+static void heap_set(ChiakiTimerService *service, size_t index, ChiakiTimer *timer)
+{
+	service->heap[index] = timer;
+	timer->heap_index = index;
+}
+
+static void heap_sift_up(ChiakiTimerService *service, size_t index)
+{
+	ChiakiTimer *timer = service->heap[index];
+	while(index > 0)
+	{
+		size_t parent = (index - 1) / 2;
+		if(service->heap[parent]->deadline_us <= timer->deadline_us)
+			break;
+		heap_set(service, index, service->heap[parent]);
+		index = parent;
+	}
+	heap_set(service, index, timer);
+}
+
+static void heap_sift_down(ChiakiTimerService *service, size_t index)
+{
+	ChiakiTimer *timer = service->heap[index];
+	while(true)
+	{
+		size_t child = 2 * index + 1;
+		if(child >= service->heap_count)
+			break;
+		if(child + 1 < service->heap_count && service->heap[child + 1]->deadline_us < service->heap[child]->deadline_us)
+			child++;
+		if(timer->deadline_us <= service->heap[child]->deadline_us)
+			break;
+		heap_set(service, index, service->heap[child]);
+		index = child;
+	}
+	heap_set(service, index, timer);
+}
+
+static void heap_remove(ChiakiTimerService *service, size_t index)
+{
+	assert(index < service->heap_count);
+	ChiakiTimer *last = service->heap[--service->heap_count];
+	if(index == service->heap_count)
+		return;
+	heap_set(service, index, last);
+	heap_sift_up(service, index);
+	heap_sift_down(service, last->heap_index);
+}
+
+/**
+ * Sleep until deadline_us or until woken up, mutex must be locked and is released while sleeping.
+ */
+static void timer_service_sleep(ChiakiTimerService *service, uint64_t deadline_us, uint64_t now_us)
+{
+#ifdef __linux__
+	if(service->timer_fd >= 0)
+	{
+		// an all-zero it_value disarms, which is exactly what sleeping without a deadline needs
+		struct itimerspec spec = { 0 };
+		if(deadline_us != UINT64_MAX)
+		{
+			spec.it_value.tv_sec = (time_t)(deadline_us / 1000000);
+			spec.it_value.tv_nsec = (long)(deadline_us % 1000000) * 1000;
+		}
+		timerfd_settime(service->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+		chiaki_mutex_unlock(&service->mutex);
+
+		struct pollfd pfds[2] = {
+			{ .fd = service->timer_fd, .events = POLLIN },
+			{ .fd = service->event_fd, .events = POLLIN }
+		};
+		if(poll(pfds, 2, -1) > 0)
+		{
+			uint64_t v;
+			ssize_t r = 0;
+			if(pfds[0].revents & POLLIN)
+				r = read(service->timer_fd, &v, sizeof(v));
+			if(pfds[1].revents & POLLIN)
+				r = read(service->event_fd, &v, sizeof(v));
+			(void)r;
+		}
+
+		chiaki_mutex_lock(&service->mutex);
+		return;
+	}
+#endif
+	if(deadline_us == UINT64_MAX)
+		chiaki_cond_wait(&service->wake_cond, &service->mutex);
+	else // rounded up, waking up early would only mean sleeping again
+		chiaki_cond_timedwait(&service->wake_cond, &service->mutex, (deadline_us - now_us + 999) / 1000);
+}
+
+static void *timer_service_thread_func(void *user)
+{
+	ChiakiTimerService *service = user;
+	chiaki_thread_apply_role(CHIAKI_THREAD_ROLE_FEEDBACK);
+
+	chiaki_mutex_lock(&service->mutex);
+	while(!service->stop)
+	{
+		uint64_t now_us = chiaki_time_now_monotonic_us();
+		if(service->heap_count && service->heap[0]->deadline_us <= now_us)
+		{
+			ChiakiTimer *timer = service->heap[0];
+			heap_remove(service, 0);
+			timer->deadline_us = CHIAKI_TIMER_DISARMED;
+			service->running = timer;
+			service->fired++;
+			chiaki_mutex_unlock(&service->mutex);
+
+			timer->cb(timer->user);
+
+			chiaki_mutex_lock(&service->mutex);
+			service->running = NULL;
+			chiaki_cond_broadcast(&service->running_cond);
+			continue;
+		}
+
+		uint64_t deadline_us = service->heap_count ? service->heap[0]->deadline_us : UINT64_MAX;
+		service->sleep_until_us = deadline_us;
+		service->wakeups++;
+		timer_service_sleep(service, deadline_us, now_us);
+		service->sleep_until_us = 0;
+	}
+	chiaki_mutex_unlock(&service->mutex);
+
+	return NULL;
+}
+
+static ChiakiErrorCode timer_arm(ChiakiTimer *timer, uint64_t deadline_us, bool only_earlier)
+{
+	ChiakiTimerService *service = timer->service;
+	ChiakiErrorCode err = chiaki_mutex_lock(&service->mutex);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+
+	if(timer->deadline_us != CHIAKI_TIMER_DISARMED)
+	{
+		if(only_earlier && timer->deadline_us <= deadline_us)
+			goto beach;
+		timer->deadline_us = deadline_us;
+		heap_sift_up(service, timer->heap_index);
+		heap_sift_down(service, timer->heap_index);
+	}
+	else
+	{
+		if(service->heap_count == service->heap_size)
+		{
+			size_t size = service->heap_size ? service->heap_size * 2 : TIMER_SERVICE_HEAP_SIZE_MIN;
+			ChiakiTimer **heap = realloc(service->heap, size * sizeof(ChiakiTimer *));
+			if(!heap)
+			{
+				err = CHIAKI_ERR_MEMORY;
+				goto beach;
+			}
+			service->heap = heap;
+			service->heap_size = size;
+		}
+		timer->deadline_us = deadline_us;
+		heap_set(service, service->heap_count++, timer);
+		heap_sift_up(service, timer->heap_index);
+	}
+
+	if(service->sleep_until_us && deadline_us < service->sleep_until_us)
+		timer_service_wake(service);
+
+beach:
+	chiaki_mutex_unlock(&service->mutex);
+	return err;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_timer_arm(ChiakiTimer *timer, uint64_t deadline_us)
+{
+	return timer_arm(timer, deadline_us, false);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_timer_arm_earlier(ChiakiTimer *timer, uint64_t deadline_us)
+{
+	return timer_arm(timer, deadline_us, true);
+}
+
+CHIAKI_EXPORT void chiaki_timer_cancel(ChiakiTimer *timer)
+{
+	ChiakiTimerService *service = timer->service;
+	chiaki_mutex_lock(&service->mutex);
+	// wait first, the callback may arm the timer again
+	while(service->running == timer)
+		chiaki_cond_wait(&service->running_cond, &service->mutex);
+	if(timer->deadline_us != CHIAKI_TIMER_DISARMED)
+	{
+		heap_remove(service, timer->heap_index);
+		timer->deadline_us = CHIAKI_TIMER_DISARMED;
+	}
+	chiaki_mutex_unlock(&service->mutex);
+}
+
+// protected by CHIAKI_STATIC_MUTEX_TIMER_SERVICE_SHARED
+static ChiakiTimerService *shared_service = NULL;
+static unsigned int shared_refs = 0;
+
+CHIAKI_EXPORT ChiakiTimerService *chiaki_timer_service_shared_ref(void)
+{
+	chiaki_static_mutex_lock(CHIAKI_STATIC_MUTEX_TIMER_SERVICE_SHARED);
+	if(!shared_service)
+	{
+		shared_service = malloc(sizeof(ChiakiTimerService));
+		if(shared_service && chiaki_timer_service_init(shared_service) != CHIAKI_ERR_SUCCESS)
+		{
+			free(shared_service);
+			shared_service = NULL;
+		}
+	}
+	ChiakiTimerService *service = shared_service;
+	if(service)
+		shared_refs++;
+	chiaki_static_mutex_unlock(CHIAKI_STATIC_MUTEX_TIMER_SERVICE_SHARED);
+	return service;
+}
+
+CHIAKI_EXPORT void chiaki_timer_service_shared_unref(ChiakiTimerService *service)
+{
+	if(!service)
+		return;
+	chiaki_static_mutex_lock(CHIAKI_STATIC_MUTEX_TIMER_SERVICE_SHARED);
+	assert(service == shared_service && shared_refs > 0);
+	bool last = --shared_refs == 0;
+	if(last)
+		shared_service = NULL; // the next ref starts a new one while this one is joined
+	chiaki_static_mutex_unlock(CHIAKI_STATIC_MUTEX_TIMER_SERVICE_SHARED);
+	if(!last)
+		return;
+	// outside the mutex, fini joins the service thread and a timer callback may still take a ref
+	chiaki_timer_service_fini(service);
+	free(service);
+}
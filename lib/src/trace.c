@@ -0,0 +1,131 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/trace.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIZE_EXP_MAX 24
+
+#define TRACE_FILE_HEADER_SIZE 40
+#define TRACE_FILE_EVENT_SIZE 32
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_trace_init(ChiakiTrace *trace, size_t events_min)
+{
+	trace->events = NULL;
+	trace->size_exp = 0;
+	trace->write_pos = 0;
+	trace->start_us = chiaki_time_now_monotonic_us();
+	if(!events_min)
+		return CHIAKI_ERR_SUCCESS;
+
+	size_t size_exp = 0;
+	while((((size_t)1) << size_exp) < events_min)
+	{
+		size_exp++;
+		if(size_exp > SIZE_EXP_MAX)
+			return CHIAKI_ERR_INVALID_DATA;
+	}
+
+	trace->events = calloc(((size_t)1) << size_exp, sizeof(ChiakiTraceEvent));
+	if(!trace->events)
+		return CHIAKI_ERR_MEMORY;
+	trace->size_exp = size_exp;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_trace_fini(ChiakiTrace *trace)
+{
+	free(trace->events);
+	trace->events = NULL;
+}
+
+CHIAKI_EXPORT size_t chiaki_trace_snapshot(ChiakiTrace *trace, ChiakiTraceEvent *out, uint64_t *overwritten)
+{
+	if(overwritten)
+		*overwritten = 0;
+	if(!chiaki_trace_enabled(trace))
+		return 0;
+	uint64_t size = ((uint64_t)1) << trace->size_exp;
+	uint64_t end = chiaki_atomic_load_u64(&trace->write_pos);
+	uint64_t begin = end > size ? end - size : 0;
+	if(overwritten)
+		*overwritten = begin;
+	for(uint64_t pos=begin; pos<end; pos++)
+		out[pos - begin] = trace->events[pos & (size - 1)];
+	return (size_t)(end - begin);
+}
+
+static uint8_t *write_le(uint8_t *buf, uint64_t v, size_t size)
+{
+	for(size_t i=0; i<size; i++)
+		buf[i] = (uint8_t)(v >> (i * 8));
+	return buf + size;
+}
+
+static void trace_event_serialize(uint8_t *buf, const ChiakiTraceEvent *event)
+{
+	buf = write_le(buf, event->timestamp_us, 8);
+	buf = write_le(buf, event->key_pos, 8);
+	buf = write_le(buf, event->seq, 4);
+	buf = write_le(buf, event->size, 4);
+	buf = write_le(buf, event->index, 2);
+	buf = write_le(buf, event->extra, 2);
+	*buf++ = event->type;
+	*buf++ = event->packet_type;
+	*buf++ = event->result;
+	*buf = 0;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_trace_dump_file(ChiakiTrace *trace, const char *path)
+{
+	if(!chiaki_trace_enabled(trace))
+		return CHIAKI_ERR_UNINITIALIZED;
+
+	// snapshot first so the time spent writing the file does not let the ring overwrite what is being dumped
+	ChiakiTraceEvent *events = malloc(sizeof(ChiakiTraceEvent) << trace->size_exp);
+	if(!events)
+		return CHIAKI_ERR_MEMORY;
+	uint64_t overwritten;
+	size_t count = chiaki_trace_snapshot(trace, events, &overwritten);
+
+	FILE *f = fopen(path, "wb");
+	if(!f)
+	{
+		free(events);
+		return CHIAKI_ERR_UNKNOWN;
+	}
+
+	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+	uint8_t header[TRACE_FILE_HEADER_SIZE];
+	uint8_t *p = header;
+	memcpy(p, CHIAKI_TRACE_FILE_MAGIC, 8);
+	p = write_le(p + 8, CHIAKI_TRACE_FILE_VERSION, 4);
+	p = write_le(p, TRACE_FILE_EVENT_SIZE, 4);
+	p = write_le(p, trace->start_us, 8);
+	p = write_le(p, count, 8);
+	write_le(p, overwritten, 8);
+	if(fwrite(header, sizeof(header), 1, f) != 1)
+	{
+		err = CHIAKI_ERR_UNKNOWN;
+		goto beach;
+	}
+
+	for(size_t i=0; i<count; i++)
+	{
+		uint8_t buf[TRACE_FILE_EVENT_SIZE];
+		trace_event_serialize(buf, &events[i]);
+		if(fwrite(buf, sizeof(buf), 1, f) != 1)
+		{
+			err = CHIAKI_ERR_UNKNOWN;
+			goto beach;
+		}
+	}
+
+beach:
+	if(fclose(f) != 0 && err == CHIAKI_ERR_SUCCESS)
+		err = CHIAKI_ERR_UNKNOWN;
+	free(events);
+	return err;
+}
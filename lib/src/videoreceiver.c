@@ -7,6 +7,9 @@
 
 static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *video_receiver);
 
+void chiaki_session_timeline_end(ChiakiSession *session, ChiakiSessionPhase phase);
+void chiaki_session_timeline_finish(ChiakiSession *session);
+
 static void add_ref_frame(ChiakiVideoReceiver *video_receiver, int32_t frame)
 {
 	if(video_receiver->reference_frames[0] != -1)
@@ -46,9 +49,12 @@ CHIAKI_EXPORT void chiaki_video_receiver_init(ChiakiVideoReceiver *video_receive
 	video_receiver->frame_index_prev_complete = 0;
 
 	chiaki_frame_processor_init(&video_receiver->frame_processor, video_receiver->log);
+	video_receiver->frame_processor.thread_pool = session->thread_pool;
+	video_receiver->frame_processor.thread_pool_affinity = session->thread_pool_affinity;
 	video_receiver->packet_stats = packet_stats;
 
 	video_receiver->frames_lost = 0;
+	video_receiver->first_frame_done = false;
 	memset(video_receiver->reference_frames, -1, sizeof(video_receiver->reference_frames));
 	chiaki_bitstream_init(&video_receiver->bitstream, video_receiver->log, video_receiver->session->connect_info.video_profile.codec);
 }
@@ -60,6 +66,32 @@ CHIAKI_EXPORT void chiaki_video_receiver_fini(ChiakiVideoReceiver *video_receive
 	chiaki_frame_processor_fini(&video_receiver->frame_processor);
 }
 
+/**
+ * The first frame is sent in the first profile, so its header can be parsed and handed to the decoder
+ * while still waiting for the first packet instead of right before the keyframe.
+ * If the server starts with another profile after all, the usual profile switch sends that header too.
+ */
+static void video_receiver_prefetch_header(ChiakiVideoReceiver *video_receiver)
+{
+	ChiakiVideoProfile *profile = &video_receiver->profiles[0];
+	if(!chiaki_bitstream_header(&video_receiver->bitstream, profile->header, profile->header_sz))
+	{
+		CHIAKI_LOGW(video_receiver->log, "Failed to parse video header for warm start");
+		return;
+	}
+	if(video_receiver->session->video_sample_cb
+		&& !video_receiver->session->video_sample_cb(profile->header, profile->header_sz, 0, false, video_receiver->session->video_sample_cb_user))
+	{
+		CHIAKI_LOGW(video_receiver->log, "Video callback did not process header for warm start");
+		return;
+	}
+	if(video_receiver->session->record_sink.video_header_cb)
+		video_receiver->session->record_sink.video_header_cb(profile->header, profile->header_sz,
+				profile->width, profile->height, video_receiver->session->record_sink.user);
+	video_receiver->profile_cur = 0;
+	CHIAKI_LOGI(video_receiver->log, "Prefetched header of profile 0 for warm start");
+}
+
 CHIAKI_EXPORT void chiaki_video_receiver_stream_info(ChiakiVideoReceiver *video_receiver, ChiakiVideoProfile *profiles, size_t profiles_count)
 {
 	if(video_receiver->profiles_count > 0)
@@ -78,6 +110,9 @@ CHIAKI_EXPORT void chiaki_video_receiver_stream_info(ChiakiVideoReceiver *video_
 		CHIAKI_LOGI(video_receiver->log, "  %zu: %ux%u", i, profile->width, profile->height);
 		//chiaki_log_hexdump(video_receiver->log, CHIAKI_LOG_DEBUG, profile->header, profile->header_sz);
 	}
+
+	if(video_receiver->session->connect_info.video_warm_start && video_receiver->profiles_count > 0)
+		video_receiver_prefetch_header(video_receiver);
 }
 
 CHIAKI_EXPORT void chiaki_video_receiver_av_packet(ChiakiVideoReceiver *video_receiver, ChiakiTakionAVPacket *packet)
@@ -108,6 +143,9 @@ CHIAKI_EXPORT void chiaki_video_receiver_av_packet(ChiakiVideoReceiver *video_re
 		CHIAKI_LOGI(video_receiver->log, "Switched to profile %d, resolution: %ux%u", video_receiver->profile_cur, profile->width, profile->height);
 		if(video_receiver->session->video_sample_cb)
 			video_receiver->session->video_sample_cb(profile->header, profile->header_sz, 0, false, video_receiver->session->video_sample_cb_user);
+		if(video_receiver->session->record_sink.video_header_cb)
+			video_receiver->session->record_sink.video_header_cb(profile->header, profile->header_sz,
+					profile->width, profile->height, video_receiver->session->record_sink.user);
 		if(!chiaki_bitstream_header(&video_receiver->bitstream, profile->header, profile->header_sz))
 			CHIAKI_LOGW(video_receiver->log, "Failed to parse video header");
 	}
@@ -137,6 +175,7 @@ CHIAKI_EXPORT void chiaki_video_receiver_av_packet(ChiakiVideoReceiver *video_re
 		}
 
 		video_receiver->frame_index_cur = frame_index;
+		chiaki_congestion_control_push_frame(&video_receiver->session->stream_connection.congestion_control, frame_index);
 		err = chiaki_frame_processor_alloc_frame(&video_receiver->frame_processor, packet);
 		if(err != CHIAKI_ERR_SUCCESS)
 			CHIAKI_LOGW(video_receiver->log, "Video receiver could not allocate frame for packet.");
@@ -162,6 +201,20 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 	uint8_t *frame;
 	size_t frame_size;
 	ChiakiFrameProcessorFlushResult flush_result = chiaki_frame_processor_flush(&video_receiver->frame_processor, &frame, &frame_size);
+	ChiakiTrace *trace = &video_receiver->session->trace;
+	if(chiaki_trace_enabled(trace))
+	{
+		ChiakiTraceEvent trace_event = { 0 };
+		trace_event.type = CHIAKI_TRACE_EVENT_FRAME;
+		trace_event.seq = (uint32_t)video_receiver->frame_index_cur;
+		trace_event.size = flush_result == CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FAILED ? 0 : (uint32_t)frame_size;
+		trace_event.result = (uint8_t)flush_result;
+		chiaki_trace_push(trace, &trace_event);
+	}
+	if(flush_result == CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_SUCCESS
+		|| flush_result == CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED)
+		chiaki_congestion_control_push_fec(&video_receiver->session->stream_connection.congestion_control,
+			flush_result == CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_SUCCESS);
 
 	if(flush_result == CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FAILED
 		|| flush_result == CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED)
@@ -181,8 +234,10 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 	bool recovered = false;
 
 	ChiakiBitstreamSlice slice;
+	bool keyframe = false;
 	if(chiaki_bitstream_slice(&video_receiver->bitstream, frame, frame_size, &slice))
 	{
+		keyframe = slice.idr;
 		if(slice.slice_type == CHIAKI_BITSTREAM_SLICE_P)
 		{
 			ChiakiSeqNum16 ref_frame_index = video_receiver->frame_index_cur - slice.reference_frame - 1;
@@ -211,9 +266,23 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 		}
 	}
 
+	if(succ && video_receiver->session->record_sink.video_frame_cb)
+		video_receiver->session->record_sink.video_frame_cb(frame, frame_size, (ChiakiSeqNum16)video_receiver->frame_index_cur,
+				keyframe, video_receiver->session->record_sink.user);
+
 	if(succ && video_receiver->session->video_sample_cb)
 	{
 		bool cb_succ = video_receiver->session->video_sample_cb(frame, frame_size, video_receiver->frames_lost, recovered, video_receiver->session->video_sample_cb_user);
+		if(chiaki_trace_enabled(trace))
+		{
+			ChiakiTraceEvent trace_event = { 0 };
+			trace_event.type = CHIAKI_TRACE_EVENT_DECODE_SUBMIT;
+			trace_event.seq = (uint32_t)video_receiver->frame_index_cur;
+			trace_event.size = (uint32_t)frame_size;
+			trace_event.extra = (uint16_t)video_receiver->frames_lost;
+			trace_event.result = cb_succ ? 1 : 0;
+			chiaki_trace_push(trace, &trace_event);
+		}
 		video_receiver->frames_lost = 0;
 		if(!cb_succ)
 		{
@@ -222,6 +291,12 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 		}
 		else
 		{
+			if(!video_receiver->first_frame_done)
+			{
+				video_receiver->first_frame_done = true;
+				chiaki_session_timeline_end(video_receiver->session, CHIAKI_SESSION_PHASE_FIRST_FRAME);
+				chiaki_session_timeline_finish(video_receiver->session);
+			}
 			add_ref_frame(video_receiver, video_receiver->frame_index_cur);
 			CHIAKI_LOGV(video_receiver->log, "Added reference %c frame %d", slice.slice_type == CHIAKI_BITSTREAM_SLICE_I ? 'I' : 'P', (int)video_receiver->frame_index_cur);
 		}
@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+# SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+"""
+Convert a packet trace dump written by chiaki_trace_dump_file() (lib/include/chiaki/trace.h)
+into a csv timeline, one row per event:
+
+	scripts/chiaki-trace.py chiaki-session.trace > timeline.csv
+	scripts/chiaki-trace.py --summary chiaki-session.trace
+
+Time is in milliseconds since the first event in the dump, delta is the time since the previous event.
+Only the Python standard library is used.
+"""
+
+import sys
+if sys.version_info < (3, 6, 0):
+	print("Python 3.6 or newer is required.")
+	exit(1)
+
+import argparse
+import collections
+import csv
+import struct
+
+MAGIC = b"CHIAKITR"
+HEADER = struct.Struct("<8sIIQQQ")
+EVENT = struct.Struct("<QQIIHHBBBx")
+
+EVENT_TYPES = {
+	1: "packet",
+	2: "data",
+	3: "av_unit",
+	4: "frame",
+	5: "decode_submit"
+}
+
+PACKET_TYPES = {
+	0: "control",
+	2: "video",
+	3: "audio"
+}
+
+MAC_RESULTS = ["none", "ok", "invalid"]
+REORDER_ACTIONS = ["in_order", "ahead", "late"]
+FLUSH_RESULTS = ["success", "fec_success", "fec_failed", "failed"]
+
+COLUMNS = ["time_ms", "delta_ms", "event", "packet_type", "seq", "index", "extra", "size", "key_pos", "result"]
+
+
+def lookup(names, value):
+	if isinstance(names, dict):
+		return names.get(value, str(value))
+	return names[value] if value < len(names) else str(value)
+
+
+def result_name(event_type, result):
+	if event_type == 1:
+		return lookup(MAC_RESULTS, result)
+	if event_type == 2:
+		return lookup(REORDER_ACTIONS, result)
+	if event_type == 3:
+		return "fec" if result else "source"
+	if event_type == 4:
+		return lookup(FLUSH_RESULTS, result)
+	if event_type == 5:
+		return "accepted" if result else "rejected"
+	return str(result)
+
+
+def read_trace(f):
+	header = f.read(HEADER.size)
+	if len(header) < HEADER.size:
+		raise ValueError("File too short")
+	magic, version, event_size, start_us, count, overwritten = HEADER.unpack(header)
+	if magic != MAGIC:
+		raise ValueError("Not a chiaki trace")
+	if version != 1 or event_size != EVENT.size:
+		raise ValueError("Unsupported trace version {} with event size {}".format(version, event_size))
+	events = []
+	for _ in range(count):
+		buf = f.read(EVENT.size)
+		if len(buf) < EVENT.size:
+			break
+		events.append(EVENT.unpack(buf))
+	return overwritten, events
+
+
+def write_csv(events, out):
+	writer = csv.writer(out)
+	writer.writerow(COLUMNS)
+	if not events:
+		return
+	first_us = events[0][0]
+	prev_us = first_us
+	for timestamp_us, key_pos, seq, size, index, extra, event_type, packet_type, result in events:
+		writer.writerow([
+			"{:.3f}".format((timestamp_us - first_us) / 1000.0),
+			"{:.3f}".format((timestamp_us - prev_us) / 1000.0),
+			lookup(EVENT_TYPES, event_type),
+			lookup(PACKET_TYPES, packet_type) if event_type in (1, 3) else "",
+			seq,
+			index,
+			extra,
+			size,
+			"{:#x}".format(key_pos) if event_type in (1, 3) else "",
+			result_name(event_type, result)
+		])
+		prev_us = timestamp_us
+
+
+def write_summary(overwritten, events, out):
+	if not events:
+		out.write("No events\n")
+		return
+	duration_ms = (events[-1][0] - events[0][0]) / 1000.0
+	out.write("{} events over {:.1f} ms, {} older events overwritten\n".format(len(events), duration_ms, overwritten))
+	counts = collections.Counter((e[6], result_name(e[6], e[8])) for e in events)
+	for (event_type, result), count in sorted(counts.items()):
+		out.write("  {:<14} {:<12} {}\n".format(lookup(EVENT_TYPES, event_type), result, count))
+	# longest gaps between received packets are usually what the user saw as stutter
+	packets = [e[0] for e in events if e[6] == 1]
+	gaps = sorted(((b - a, a) for a, b in zip(packets, packets[1:])), reverse=True)[:5]
+	for gap_us, at_us in gaps:
+		out.write("  gap of {:.1f} ms at {:.1f} ms\n".format(gap_us / 1000.0, (at_us - events[0][0]) / 1000.0))
+
+
+def main():
+	parser = argparse.ArgumentParser(description="Convert a chiaki packet trace to csv")
+	parser.add_argument("trace", help="trace file written by chiaki")
+	parser.add_argument("--summary", action="store_true", help="print event counts and the longest packet gaps instead of csv")
+	args = parser.parse_args()
+
+	with open(args.trace, "rb") as f:
+		try:
+			overwritten, events = read_trace(f)
+		except ValueError as e:
+			print("{}: {}".format(args.trace, e), file=sys.stderr)
+			return 1
+
+	if args.summary:
+		write_summary(overwritten, events, sys.stdout)
+	else:
+		write_csv(events, sys.stdout)
+	return 0
+
+
+if __name__ == "__main__":
+	exit(main())
@@ -0,0 +1,512 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+# SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+"""
+Local mock of the PSN backend used by lib/src/remote/holepunch.c, including a fake PS5.
+
+It serves the session manager and cloud assisted navigation endpoints over plain HTTP,
+pushes notifications over a plain websocket, answers the UDP requests of the candidate
+checks like a console would and runs a few STUN servers, so a whole holepunch can be run
+and timed on one machine without a PSN account:
+
+	scripts/holepunch/psn-mock.py --port 8080
+	holepunch-test -u http://127.0.0.1:8080
+
+Every event is logged with the time since the session was created.
+Only the Python standard library is used.
+"""
+
+import sys
+if sys.version_info < (3, 6, 0):
+	print("Python 3.6 or newer is required.")
+	exit(1)
+
+import argparse
+import base64
+import hashlib
+import json
+import os
+import queue
+import random
+import socket
+import struct
+import threading
+import time
+import uuid
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import urlsplit
+
+MSG_TYPE_REQ = 0x06000000
+MSG_TYPE_RESP = 0x07000000
+HOLEPUNCH_MSG_SIZE = 88
+
+STUN_MAGIC_COOKIE = 0x2112A442
+STUN_BINDING_REQUEST = 0x0001
+STUN_BINDING_RESPONSE = 0x0101
+STUN_ATTRIB_XOR_MAPPED_ADDRESS = 0x0020
+
+WS_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+WS_OP_TEXT = 0x1
+WS_OP_CLOSE = 0x8
+WS_OP_PING = 0x9
+WS_OP_PONG = 0xa
+
+ACCOUNT_ID = "1234567890123456789"
+ONLINE_ID = "mock-user"
+CONSOLE_NAME = "Mock PS5"
+
+SESSIONS_PATH = "/api/sessionManager/v1/remotePlaySessions"
+CLIENTS_PATH = "/api/cloudAssistedNavigation/v2/users/me/clients"
+COMMANDS_PATH = "/api/cloudAssistedNavigation/v2/users/me/commands"
+STUN_HOSTS_PATH = "/pradt2/always-online-stun/master/valid_hosts.txt"
+STUN_HOSTS_IPV6_PATH = "/pradt2/always-online-stun/master/valid_ipv6s.txt"
+
+
+def b64(data):
+	return base64.b64encode(data).decode("ascii")
+
+
+class Clock:
+	def __init__(self):
+		self.start = time.monotonic()
+
+	def log(self, msg):
+		print("[+{:9.1f} ms] {}".format((time.monotonic() - self.start) * 1000.0, msg), flush=True)
+
+
+class WebSocket:
+	"""Server side of one push notification websocket, RFC 6455 without extensions."""
+
+	def __init__(self, rfile, wfile):
+		self.rfile = rfile
+		self.wfile = wfile
+		self.lock = threading.Lock()
+		self.open = True
+
+	def send(self, opcode, payload):
+		header = bytes([0x80 | opcode])
+		if len(payload) < 126:
+			header += bytes([len(payload)])
+		elif len(payload) < 0x10000:
+			header += bytes([126]) + struct.pack("!H", len(payload))
+		else:
+			header += bytes([127]) + struct.pack("!Q", len(payload))
+		with self.lock:
+			if not self.open:
+				return
+			try:
+				self.wfile.write(header + payload)
+				self.wfile.flush()
+			except OSError:
+				self.open = False
+
+	def send_json(self, obj):
+		self.send(WS_OP_TEXT, json.dumps(obj).encode("utf-8"))
+
+	def recv(self):
+		"""Returns (opcode, payload) of the next frame, None if the connection is gone."""
+		header = self.rfile.read(2)
+		if len(header) < 2:
+			return None
+		opcode = header[0] & 0x0f
+		masked = header[1] & 0x80
+		size = header[1] & 0x7f
+		if size == 126:
+			size = struct.unpack("!H", self.rfile.read(2))[0]
+		elif size == 127:
+			size = struct.unpack("!Q", self.rfile.read(8))[0]
+		mask = self.rfile.read(4) if masked else b"\0\0\0\0"
+		payload = bytearray(self.rfile.read(size))
+		for i in range(len(payload)):
+			payload[i] ^= mask[i % 4]
+		return opcode, bytes(payload)
+
+
+class StunServer(threading.Thread):
+	"""Answers STUN binding requests with the address they came from."""
+
+	def __init__(self, host, family):
+		super().__init__(daemon=True)
+		self.sock = socket.socket(family, socket.SOCK_DGRAM)
+		self.sock.bind((host, 0))
+		self.port = self.sock.getsockname()[1]
+
+	def run(self):
+		while True:
+			data, addr = self.sock.recvfrom(2048)
+			if len(data) < 20:
+				continue
+			msg_type, _, cookie = struct.unpack("!HHI", data[:8])
+			if msg_type != STUN_BINDING_REQUEST or cookie != STUN_MAGIC_COOKIE:
+				continue
+			transaction_id = data[8:20]
+			port = addr[1] ^ (STUN_MAGIC_COOKIE >> 16)
+			if self.sock.family == socket.AF_INET:
+				raw = socket.inet_pton(socket.AF_INET, addr[0])
+				xored = struct.pack("!I", struct.unpack("!I", raw)[0] ^ STUN_MAGIC_COOKIE)
+				value = struct.pack("!BBH", 0, 0x01, port) + xored
+			else:
+				raw = socket.inet_pton(socket.AF_INET6, addr[0])
+				key = struct.pack("!I", STUN_MAGIC_COOKIE) + transaction_id
+				value = struct.pack("!BBH", 0, 0x02, port) + bytes(a ^ b for a, b in zip(raw, key))
+			attrib = struct.pack("!HH", STUN_ATTRIB_XOR_MAPPED_ADDRESS, len(value)) + value
+			header = struct.pack("!HHI", STUN_BINDING_RESPONSE, len(attrib), STUN_MAGIC_COOKIE) + transaction_id
+			self.sock.sendto(header + attrib, addr)
+
+
+class ConsoleSocket(threading.Thread):
+	"""UDP side of the fake console for one punched hole (control or data)."""
+
+	def __init__(self, session, name, host, udp_loss):
+		super().__init__(daemon=True)
+		self.session = session
+		self.name = name
+		self.udp_loss = udp_loss
+		self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+		self.sock.bind((host, 0))
+		self.sock.settimeout(0.5)
+		self.host = host
+		self.port = self.sock.getsockname()[1]
+		self.sid = random.randint(1, 0xffff)
+		self.hashed_id = os.urandom(20)
+		self.skey = os.urandom(16)
+		self.peer_sid = 0
+		self.peer_hashed_id = bytes(20)
+		self.stopped = False
+		self.first_req = None
+
+	def candidates(self):
+		return [
+			{"type": "LOCAL", "addr": self.host, "mappedAddr": "0.0.0.0", "port": self.port, "mappedPort": 0},
+			{"type": "STATIC", "addr": self.host, "mappedAddr": self.host, "port": self.port, "mappedPort": self.port},
+		]
+
+	def packet(self, msg_type, request_id):
+		buf = bytearray(HOLEPUNCH_MSG_SIZE)
+		struct.pack_into("!I", buf, 0x00, msg_type)
+		buf[0x04:0x04 + len(self.hashed_id)] = self.hashed_id
+		buf[0x24:0x24 + len(self.peer_hashed_id)] = self.peer_hashed_id
+		struct.pack_into("!HH", buf, 0x44, self.sid, self.peer_sid)
+		buf[0x4b:0x50] = request_id
+		return bytes(buf)
+
+	def run(self):
+		while not self.stopped:
+			try:
+				data, addr = self.sock.recvfrom(2048)
+			except socket.timeout:
+				continue
+			except OSError:
+				break
+			if len(data) != HOLEPUNCH_MSG_SIZE:
+				continue
+			msg_type = struct.unpack("!I", data[:4])[0]
+			if msg_type != MSG_TYPE_REQ:
+				continue
+			if random.random() < self.udp_loss:
+				self.session.clock.log("{}: dropped REQ from {}:{}".format(self.name, addr[0], addr[1]))
+				continue
+			if self.first_req is None:
+				self.first_req = time.monotonic()
+				self.session.clock.log("{}: first REQ from {}:{}".format(self.name, addr[0], addr[1]))
+			self.sock.sendto(self.packet(MSG_TYPE_RESP, data[0x4b:0x50]), addr)
+			# follow-up request the client answers after selecting this candidate
+			self.sock.sendto(self.packet(MSG_TYPE_REQ, os.urandom(5)), addr)
+
+	def stop(self):
+		self.stopped = True
+		self.sock.close()
+
+
+class Session:
+	def __init__(self, server):
+		self.server = server
+		self.clock = Clock()
+		self.id = str(uuid.uuid4())
+		self.duid = None
+		self.console_req_id = 1
+		self.punches = []  # ConsoleSocket per OFFER, control first
+		self.pending_accept = None  # reqId of our ACCEPT waiting for the client's RESULT
+		self.lock = threading.Lock()
+
+	def message(self, action, req_id, conn_request):
+		body = json.dumps({"action": action, "reqId": req_id, "error": 0, "connRequest": conn_request}, separators=(",", ":"))
+		return {"sessionMessage": {"payload": "ver=1.0, type=text, body=" + body}}
+
+	def offer(self):
+		name = "ctrl" if not self.punches else "data"
+		console = ConsoleSocket(self, name, self.server.args.host, self.server.args.udp_loss)
+		console.start()
+		self.punches.append(console)
+		with self.lock:
+			req_id = self.console_req_id
+			self.console_req_id += 1
+		conn_request = {
+			"sid": console.sid,
+			"peerSid": 0,
+			"skey": b64(console.skey),
+			"natType": 2,
+			"candidate": console.candidates(),
+			"defaultRouteMacAddr": "00:00:00:00:00:00",
+			"localPeerAddr": {"accountId": ACCOUNT_ID, "platform": "PS5"},
+			"localHashedId": b64(console.hashed_id),
+		}
+		self.clock.log("{}: console OFFER reqId={} from {}:{}".format(name, req_id, console.host, console.port))
+		self.server.notify(self, "psn:sessionManager:sys:rps:sessionMessage:created", self.message("OFFER", req_id, conn_request))
+
+	def on_session_message(self, msg):
+		action = msg.get("action")
+		req_id = msg.get("reqId")
+		punch = self.punches[-1] if self.punches else None
+		name = punch.name if punch else "-"
+		if action == "OFFER":
+			conn_request = msg.get("connRequest") or {}
+			if punch:
+				punch.peer_sid = conn_request.get("sid", 0)
+				try:
+					punch.peer_hashed_id = base64.b64decode(conn_request.get("localHashedId", ""))[:20]
+				except ValueError:
+					pass
+			self.clock.log("{}: client OFFER reqId={} with {} candidates".format(name, req_id, len(conn_request.get("candidate", []))))
+			self.server.notify(self, "psn:sessionManager:sys:rps:sessionMessage:created", self.message("RESULT", req_id, {}))
+		elif action == "ACCEPT":
+			self.clock.log("{}: client ACCEPT reqId={}".format(name, req_id))
+			self.server.notify(self, "psn:sessionManager:sys:rps:sessionMessage:created", self.message("RESULT", req_id, {}))
+			with self.lock:
+				accept_req_id = self.console_req_id
+				self.console_req_id += 1
+				self.pending_accept = accept_req_id
+			self.server.notify(self, "psn:sessionManager:sys:rps:sessionMessage:created", self.message("ACCEPT", accept_req_id, {}))
+		elif action == "RESULT":
+			with self.lock:
+				accepted = req_id == self.pending_accept
+				if accepted:
+					self.pending_accept = None
+			self.clock.log("{}: client RESULT reqId={}".format(name, req_id))
+			if accepted:
+				self.clock.log("{}: hole punched".format(name))
+				if len(self.punches) == 1:
+					self.server.later(self.offer)
+		else:
+			self.clock.log("{}: client sent unknown action {}".format(name, action))
+
+	def close(self):
+		for punch in self.punches:
+			punch.stop()
+		self.clock.log("session {} deleted".format(self.id))
+
+
+class MockServer(ThreadingHTTPServer):
+	daemon_threads = True
+
+	def __init__(self, args):
+		super().__init__((args.host, args.port), MockHandler)
+		self.args = args
+		self.websockets = []
+		self.sessions = {}
+		self.console_duid = os.urandom(32).hex()
+		self.lock = threading.Lock()
+		self.stun_servers = [StunServer(args.host, socket.AF_INET) for _ in range(args.stun_servers)]
+		self.stun_servers_ipv6 = []
+		if socket.has_ipv6:
+			try:
+				self.stun_servers_ipv6 = [StunServer("::1", socket.AF_INET6) for _ in range(args.stun_servers)]
+			except OSError:
+				pass
+		for stun in self.stun_servers + self.stun_servers_ipv6:
+			stun.start()
+		self.pending = queue.Queue()
+		threading.Thread(target=self.run_pending, daemon=True).start()
+
+	def later(self, func, *args):
+		"""Run func after the configured signalling delay, like PSN pushing a notification."""
+		self.pending.put((time.monotonic() + self.args.delay_ms / 1000.0, func, args))
+
+	def run_pending(self):
+		# one thread, so notifications keep their order
+		while True:
+			due, func, args = self.pending.get()
+			wait = due - time.monotonic()
+			if wait > 0:
+				time.sleep(wait)
+			func(*args)
+
+	def notify(self, session, data_type, data):
+		notification = {
+			"dataType": data_type,
+			"to": {"accountId": ACCOUNT_ID, "onlineId": ONLINE_ID, "platform": "PS5"},
+			"body": {"data": dict(data, sessionId=session.id if session else None)},
+		}
+		def send():
+			with self.lock:
+				websockets = list(self.websockets)
+			if not websockets:
+				print("No websocket connected, dropping {}".format(data_type), flush=True)
+			for ws in websockets:
+				ws.send_json(notification)
+		self.later(send)
+
+
+class MockHandler(BaseHTTPRequestHandler):
+	protocol_version = "HTTP/1.1"
+
+	def log_message(self, fmt, *args):
+		if self.server.args.verbose:
+			super().log_message(fmt, *args)
+
+	def reply(self, code, obj=None, text=None):
+		if text is not None:
+			body = text.encode("utf-8")
+			content_type = "text/plain"
+		else:
+			body = json.dumps(obj if obj is not None else {}).encode("utf-8")
+			content_type = "application/json"
+		self.send_response(code)
+		self.send_header("Content-Type", content_type)
+		self.send_header("Content-Length", str(len(body)))
+		self.end_headers()
+		self.wfile.write(body)
+
+	def read_body(self):
+		length = int(self.headers.get("Content-Length", 0))
+		return self.rfile.read(length) if length else b""
+
+	def session_from_path(self, path):
+		parts = path[len(SESSIONS_PATH):].strip("/").split("/")
+		return self.server.sessions.get(parts[0]) if parts else None
+
+	def do_GET(self):
+		url = urlsplit(self.path)
+		path = url.path
+		if path == "/np/pushNotification":
+			self.websocket()
+		elif path == "/np/serveraddr":
+			self.reply(200, {"fqdn": "{}:{}".format(self.server.args.host, self.server.server_port)})
+		elif path == CLIENTS_PATH:
+			self.reply(200, {"clients": [{
+				"duid": self.server.console_duid,
+				"device": {"enabledFeatures": ["remotePlay"], "name": CONSOLE_NAME},
+			}]})
+		elif path == SESSIONS_PATH:
+			self.reply(200, {"remotePlaySessions": [{"sessionId": s.id} for s in self.server.sessions.values()]})
+		elif path == "/asm/v1/apps/me/baseUrls/userProfile":
+			self.reply(200, {"url": "http://{}:{}".format(self.server.args.host, self.server.server_port)})
+		elif path == STUN_HOSTS_PATH:
+			self.reply(200, text="".join("{}:{}\n".format(self.server.args.host, s.port) for s in self.server.stun_servers))
+		elif path == STUN_HOSTS_IPV6_PATH:
+			self.reply(200, text="".join("[::1]:{}\n".format(s.port) for s in self.server.stun_servers_ipv6))
+		else:
+			self.reply(404, {"error": "unknown endpoint " + path})
+
+	def do_POST(self):
+		path = urlsplit(self.path).path
+		body = self.read_body()
+		if path == SESSIONS_PATH:
+			session = Session(self.server)
+			self.server.sessions[session.id] = session
+			session.clock.log("session {} created".format(session.id))
+			self.reply(200, {"remotePlaySessions": [{"sessionId": session.id, "members": [{"accountId": ACCOUNT_ID}]}]})
+			self.server.notify(session, "psn:sessionManager:sys:remotePlaySession:created", {})
+			self.server.notify(session, "psn:sessionManager:sys:rps:members:created",
+				{"members": [{"accountId": ACCOUNT_ID, "deviceUniqueId": "me", "platform": "PC"}]})
+		elif path == COMMANDS_PATH:
+			request = json.loads(body or b"{}")
+			duid = request.get("commandDetail", {}).get("duid", self.server.console_duid)
+			sessions = list(self.server.sessions.values())
+			session = sessions[-1] if sessions else None
+			self.reply(200, {})
+			if not session:
+				return
+			session.duid = duid
+			session.clock.log("session started for console {}".format(duid[:16]))
+			custom_data1 = b64(b64(os.urandom(16)).encode("ascii"))
+			self.server.notify(session, "psn:sessionManager:sys:rps:members:created",
+				{"members": [{"accountId": ACCOUNT_ID, "deviceUniqueId": duid, "platform": "PS5"}]})
+			self.server.notify(session, "psn:sessionManager:sys:rps:customData1:updated", {"customData1": custom_data1})
+			self.server.later(session.offer)
+		elif path.startswith(SESSIONS_PATH) and path.endswith("/sessionMessage"):
+			session = self.session_from_path(path)
+			if not session:
+				self.reply(404, {"error": "unknown session"})
+				return
+			self.reply(200, {})
+			envelope = json.loads(body)
+			payload = envelope.get("payload", "")
+			message = payload[payload.find("body=") + len("body="):]
+			# the official app sends "localPeerAddr": without a value if it has none
+			message = message.replace('"localPeerAddr":,', '"localPeerAddr":{},')
+			session.on_session_message(json.loads(message))
+		elif path.endswith("/remoteConsole/wakeUp"):
+			self.reply(200, {})
+		else:
+			self.reply(404, {"error": "unknown endpoint " + path})
+
+	def do_DELETE(self):
+		path = urlsplit(self.path).path
+		session = self.session_from_path(path) if path.startswith(SESSIONS_PATH) else None
+		if not session:
+			self.reply(404, {"error": "unknown session"})
+			return
+		self.reply(200, {})
+		self.server.sessions.pop(session.id, None)
+		session.close()
+
+	def websocket(self):
+		key = self.headers.get("Sec-WebSocket-Key")
+		if not key or self.headers.get("Upgrade", "").lower() != "websocket":
+			self.reply(400, {"error": "websocket upgrade expected"})
+			return
+		accept = b64(hashlib.sha1((key + WS_GUID).encode("ascii")).digest())
+		self.send_response(101)
+		self.send_header("Upgrade", "websocket")
+		self.send_header("Connection", "Upgrade")
+		self.send_header("Sec-WebSocket-Accept", accept)
+		self.send_header("Sec-WebSocket-Protocol", "np-pushpacket")
+		self.end_headers()
+		self.wfile.flush()
+
+		ws = WebSocket(self.rfile, self.wfile)
+		with self.server.lock:
+			self.server.websockets.append(ws)
+		print("Push notification websocket connected", flush=True)
+		try:
+			while True:
+				frame = ws.recv()
+				if frame is None:
+					break
+				opcode, payload = frame
+				if opcode == WS_OP_PING:
+					ws.send(WS_OP_PONG, payload)
+				elif opcode == WS_OP_CLOSE:
+					ws.send(WS_OP_CLOSE, payload[:2])
+					break
+		finally:
+			ws.open = False
+			with self.server.lock:
+				self.server.websockets.remove(ws)
+			self.close_connection = True
+			print("Push notification websocket closed", flush=True)
+
+
+def main():
+	parser = argparse.ArgumentParser(description="Local mock of the PSN holepunch backend with a fake PS5.")
+	parser.add_argument("--host", default="127.0.0.1", help="address to listen on and to use for the console candidates")
+	parser.add_argument("--port", type=int, default=8080, help="HTTP and websocket port")
+	parser.add_argument("--delay-ms", type=float, default=0.0, help="delay of every notification, to emulate PSN latency")
+	parser.add_argument("--udp-loss", type=float, default=0.0, help="fraction of console UDP requests to drop")
+	parser.add_argument("--stun-servers", type=int, default=4, help="number of STUN servers to run")
+	parser.add_argument("--verbose", action="store_true", help="log every HTTP request")
+	args = parser.parse_args()
+
+	server = MockServer(args)
+	print("PSN mock listening on http://{}:{}, console duid {}".format(args.host, server.server_port, server.console_duid), flush=True)
+	try:
+		server.serve_forever()
+	except KeyboardInterrupt:
+		pass
+	server.server_close()
+
+
+if __name__ == "__main__":
+	main()
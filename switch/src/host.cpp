@@ -25,7 +25,7 @@ static void AudioCB(int16_t *buf, size_t samples_count, void *user)
 	io->AudioCB(buf, samples_count);
 }
 
-static void HapticsFrameCb(uint8_t *buf, size_t buf_size, void *user)
+static void HapticsFrameCb(uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index, void *user)
 {
 	IO *io = (IO *)user;
 	io->HapticCB(buf, buf_size);
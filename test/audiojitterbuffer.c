@@ -0,0 +1,231 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/audiojitterbuffer.h>
+
+#define FRAME_DURATION_US 10000
+
+static void push_frame(ChiakiAudioJitterBuffer *jb, ChiakiSeqNum16 frame_index, uint64_t arrival_us)
+{
+	uint8_t buf[4] = { (uint8_t)frame_index, (uint8_t)(frame_index >> 8), 0x42, 0x42 };
+	ChiakiErrorCode err = chiaki_audio_jitter_buffer_push(jb, frame_index, buf, sizeof(buf), arrival_us);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+}
+
+static void assert_pop_frame(ChiakiAudioJitterBuffer *jb, ChiakiSeqNum16 expected)
+{
+	uint8_t buf[CHIAKI_AUDIO_JITTER_BUFFER_FRAME_SIZE_MAX];
+	size_t buf_size = 0;
+	ChiakiSeqNum16 frame_index = 0;
+	ChiakiAudioJitterBufferPopResult r = chiaki_audio_jitter_buffer_pop(jb, buf, &buf_size, &frame_index);
+	munit_assert_int(r, ==, CHIAKI_AUDIO_JITTER_BUFFER_POP_FRAME);
+	munit_assert_uint16(frame_index, ==, expected);
+	munit_assert_size(buf_size, ==, 4);
+	munit_assert_uint8(buf[0], ==, (uint8_t)expected);
+	munit_assert_uint8(buf[1], ==, (uint8_t)(expected >> 8));
+}
+
+static ChiakiAudioJitterBufferPopResult pop(ChiakiAudioJitterBuffer *jb, ChiakiSeqNum16 *frame_index)
+{
+	uint8_t buf[CHIAKI_AUDIO_JITTER_BUFFER_FRAME_SIZE_MAX];
+	size_t buf_size;
+	return chiaki_audio_jitter_buffer_pop(jb, buf, &buf_size, frame_index);
+}
+
+static MunitResult test_in_order(const MunitParameter params[], void *user)
+{
+	ChiakiAudioJitterBuffer jb;
+	ChiakiErrorCode err = chiaki_audio_jitter_buffer_init(&jb, 6, FRAME_DURATION_US, 20, 200);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	ChiakiSeqNum16 frame_index;
+	munit_assert_int(pop(&jb, &frame_index), ==, CHIAKI_AUDIO_JITTER_BUFFER_POP_EMPTY);
+
+	// starting close to the wrap-around
+	uint64_t t = 1000000;
+	push_frame(&jb, 0xfffe, t);
+	munit_assert_uint32(chiaki_audio_jitter_buffer_target_frames(&jb), ==, 2);
+
+	// still buffering up to the min delay
+	munit_assert_int(pop(&jb, &frame_index), ==, CHIAKI_AUDIO_JITTER_BUFFER_POP_EMPTY);
+
+	push_frame(&jb, 0xffff, t += FRAME_DURATION_US);
+	munit_assert_uint32(chiaki_audio_jitter_buffer_depth(&jb), ==, 2);
+
+	assert_pop_frame(&jb, 0xfffe);
+	for(ChiakiSeqNum16 i = 0; i < 10; i++)
+	{
+		push_frame(&jb, i, t += FRAME_DURATION_US);
+		assert_pop_frame(&jb, (ChiakiSeqNum16)(i - 1));
+	}
+	assert_pop_frame(&jb, 9);
+
+	// underrun
+	munit_assert_int(pop(&jb, &frame_index), ==, CHIAKI_AUDIO_JITTER_BUFFER_POP_EMPTY);
+
+	ChiakiAudioJitterBufferStats stats;
+	chiaki_audio_jitter_buffer_get_stats(&jb, &stats);
+	munit_assert_uint64(stats.received, ==, 12);
+	munit_assert_uint64(stats.late, ==, 0);
+	munit_assert_uint64(stats.missing, ==, 0);
+	munit_assert_uint32(stats.jitter_us, ==, 0);
+
+	chiaki_audio_jitter_buffer_fini(&jb);
+	return MUNIT_OK;
+}
+
+static MunitResult test_missing_late(const MunitParameter params[], void *user)
+{
+	ChiakiAudioJitterBuffer jb;
+	ChiakiErrorCode err = chiaki_audio_jitter_buffer_init(&jb, 6, FRAME_DURATION_US, 20, 200);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	uint64_t t = 1000000;
+	push_frame(&jb, 100, t);
+	push_frame(&jb, 101, t += FRAME_DURATION_US);
+	// 102 is lost
+	push_frame(&jb, 103, t += 2 * FRAME_DURATION_US);
+
+	assert_pop_frame(&jb, 100);
+	assert_pop_frame(&jb, 101);
+
+	uint8_t peek_buf[CHIAKI_AUDIO_JITTER_BUFFER_FRAME_SIZE_MAX];
+	size_t peek_size = 0;
+	munit_assert_false(chiaki_audio_jitter_buffer_peek(&jb, peek_buf, &peek_size));
+
+	ChiakiSeqNum16 frame_index;
+	munit_assert_int(pop(&jb, &frame_index), ==, CHIAKI_AUDIO_JITTER_BUFFER_POP_MISSING);
+	munit_assert_uint16(frame_index, ==, 102);
+
+	// the successor is available to recover 102 from
+	munit_assert_true(chiaki_audio_jitter_buffer_peek(&jb, peek_buf, &peek_size));
+	munit_assert_size(peek_size, ==, 4);
+	munit_assert_uint8(peek_buf[0], ==, 103);
+
+	// arrives after its playout time
+	push_frame(&jb, 102, t);
+
+	assert_pop_frame(&jb, 103);
+
+	ChiakiAudioJitterBufferStats stats;
+	chiaki_audio_jitter_buffer_get_stats(&jb, &stats);
+	munit_assert_uint64(stats.received, ==, 4);
+	munit_assert_uint64(stats.late, ==, 1);
+	munit_assert_uint64(stats.missing, ==, 1);
+
+	chiaki_audio_jitter_buffer_fini(&jb);
+	return MUNIT_OK;
+}
+
+static MunitResult test_long_gap(const MunitParameter params[], void *user)
+{
+	ChiakiAudioJitterBuffer jb;
+	ChiakiErrorCode err = chiaki_audio_jitter_buffer_init(&jb, 6, FRAME_DURATION_US, 20, 200);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	chiaki_audio_jitter_buffer_set_conceal_frames_max(&jb, 2);
+
+	uint64_t t = 1000000;
+	push_frame(&jb, 10, t);
+	push_frame(&jb, 11, t += FRAME_DURATION_US);
+	// 12 to 14 are lost, one more than can be concealed
+	push_frame(&jb, 15, t += 4 * FRAME_DURATION_US);
+	push_frame(&jb, 16, t += FRAME_DURATION_US);
+	// 17 and 18 are lost
+	push_frame(&jb, 19, t += 3 * FRAME_DURATION_US);
+
+	assert_pop_frame(&jb, 10);
+	assert_pop_frame(&jb, 11);
+	// the long gap is skipped as a whole
+	assert_pop_frame(&jb, 15);
+	assert_pop_frame(&jb, 16);
+
+	// the short one is reported frame by frame for concealment
+	ChiakiSeqNum16 frame_index;
+	munit_assert_int(pop(&jb, &frame_index), ==, CHIAKI_AUDIO_JITTER_BUFFER_POP_MISSING);
+	munit_assert_uint16(frame_index, ==, 17);
+	munit_assert_int(pop(&jb, &frame_index), ==, CHIAKI_AUDIO_JITTER_BUFFER_POP_MISSING);
+	munit_assert_uint16(frame_index, ==, 18);
+	assert_pop_frame(&jb, 19);
+
+	ChiakiAudioJitterBufferStats stats;
+	chiaki_audio_jitter_buffer_get_stats(&jb, &stats);
+	munit_assert_uint64(stats.missing, ==, 5);
+
+	chiaki_audio_jitter_buffer_fini(&jb);
+	return MUNIT_OK;
+}
+
+static MunitResult test_adaptive_target(const MunitParameter params[], void *user)
+{
+	ChiakiAudioJitterBuffer jb;
+	ChiakiErrorCode err = chiaki_audio_jitter_buffer_init(&jb, 6, FRAME_DURATION_US, 20, 200);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	uint64_t t = 1000000;
+	ChiakiSeqNum16 index = 0;
+	for(; index < 100; index++)
+	{
+		// frames arrive in bursts of two, 20 ms apart
+		push_frame(&jb, index, t + (index / 2) * 2 * FRAME_DURATION_US);
+		ChiakiSeqNum16 frame_index;
+		while(pop(&jb, &frame_index) != CHIAKI_AUDIO_JITTER_BUFFER_POP_EMPTY);
+	}
+	uint32_t target_bursty = chiaki_audio_jitter_buffer_target_frames(&jb);
+	munit_assert_uint32(target_bursty, >, 2);
+	munit_assert_uint32(target_bursty, <=, 20);
+
+	ChiakiAudioJitterBufferStats stats;
+	chiaki_audio_jitter_buffer_get_stats(&jb, &stats);
+	munit_assert_uint32(stats.jitter_us, >, 0);
+	munit_assert_uint32(stats.target_delay_us, ==, target_bursty * FRAME_DURATION_US);
+
+	// smooth arrival again, the target must decay back to the minimum
+	t += (index / 2) * 2 * FRAME_DURATION_US;
+	for(; index < 400; index++)
+	{
+		push_frame(&jb, index, t += FRAME_DURATION_US);
+		ChiakiSeqNum16 frame_index;
+		while(pop(&jb, &frame_index) != CHIAKI_AUDIO_JITTER_BUFFER_POP_EMPTY);
+	}
+	munit_assert_uint32(chiaki_audio_jitter_buffer_target_frames(&jb), ==, 2);
+
+	chiaki_audio_jitter_buffer_fini(&jb);
+	return MUNIT_OK;
+}
+
+MunitTest tests_audio_jitter_buffer[] = {
+	{
+		"/in_order",
+		test_in_order,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/missing_late",
+		test_missing_late,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/long_gap",
+		test_long_gap,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/adaptive_target",
+		test_adaptive_target,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,120 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/audioring.h>
+#include <chiaki/audio.h>
+
+#include <string.h>
+
+#define CHANNELS 2
+
+static void fill_frames(int16_t *buf, size_t frames, int16_t start)
+{
+	for(size_t i = 0; i < frames; i++)
+	{
+		buf[i * CHANNELS] = (int16_t)(start + i);
+		buf[i * CHANNELS + 1] = (int16_t)-(start + i);
+	}
+}
+
+static MunitResult test_wrap(const MunitParameter params[], void *user)
+{
+	ChiakiAudioRing ring;
+	ChiakiErrorCode err = chiaki_audio_ring_init(&ring, CHANNELS, 12);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(chiaki_audio_ring_capacity(&ring), ==, 16);
+
+	int16_t in[16 * CHANNELS];
+	int16_t out[16 * CHANNELS];
+	int16_t expected[16 * CHANNELS];
+
+	int16_t next_in = 0;
+	int16_t next_out = 0;
+	for(int round = 0; round < 20; round++)
+	{
+		// 10 in, 10 out, so the positions wrap around the buffer end in different places
+		fill_frames(in, 10, next_in);
+		munit_assert_size(chiaki_audio_ring_write(&ring, in, 10), ==, 10);
+		next_in += 10;
+		munit_assert_size(chiaki_audio_ring_fill(&ring), ==, 10);
+
+		munit_assert_size(chiaki_audio_ring_read(&ring, out, 10), ==, 10);
+		fill_frames(expected, 10, next_out);
+		munit_assert_memory_equal(10 * CHANNELS * sizeof(int16_t), out, expected);
+		next_out += 10;
+		munit_assert_size(chiaki_audio_ring_fill(&ring), ==, 0);
+	}
+
+	// overflow
+	fill_frames(in, 16, 0);
+	munit_assert_size(chiaki_audio_ring_write(&ring, in, 10), ==, 10);
+	munit_assert_size(chiaki_audio_ring_write(&ring, in, 10), ==, 6);
+	munit_assert_size(chiaki_audio_ring_fill(&ring), ==, 16);
+
+	// underrun
+	munit_assert_size(chiaki_audio_ring_read(&ring, out, 16), ==, 16);
+	munit_assert_size(chiaki_audio_ring_read(&ring, out, 4), ==, 0);
+
+	ChiakiAudioRingStats stats;
+	chiaki_audio_ring_get_stats(&ring, &stats);
+	munit_assert_uint64(stats.written, ==, 216);
+	munit_assert_uint64(stats.overflow, ==, 4);
+	munit_assert_uint64(stats.underrun, ==, 4);
+
+	fill_frames(in, 3, 0);
+	chiaki_audio_ring_write(&ring, in, 3);
+	chiaki_audio_ring_clear(&ring);
+	munit_assert_size(chiaki_audio_ring_fill(&ring), ==, 0);
+
+	chiaki_audio_ring_fini(&ring);
+	return MUNIT_OK;
+}
+
+static MunitResult test_volume(const MunitParameter params[], void *user)
+{
+	// odd size to also cover the scalar tail after the vectorized part
+	int16_t src[37];
+	int16_t dst[37];
+	for(size_t i = 0; i < 37; i++)
+		src[i] = (int16_t)((i % 2 ? -1 : 1) * (int32_t)(i * 911 % 32768));
+	src[0] = INT16_MAX;
+	src[1] = INT16_MIN;
+
+	int volumes[] = { 0, 1, 37, 64, 127, CHIAKI_AUDIO_VOLUME_MAX };
+	for(size_t v = 0; v < sizeof(volumes) / sizeof(volumes[0]); v++)
+	{
+		int volume = volumes[v];
+		chiaki_audio_apply_volume(dst, src, 37, volume);
+		for(size_t i = 0; i < 37; i++)
+			munit_assert_int(dst[i], ==, (int16_t)(((int32_t)src[i] * volume) >> 7));
+	}
+
+	// in place
+	memcpy(dst, src, sizeof(dst));
+	chiaki_audio_apply_volume(dst, dst, 37, 64);
+	for(size_t i = 0; i < 37; i++)
+		munit_assert_int(dst[i], ==, src[i] >> 1);
+
+	return MUNIT_OK;
+}
+
+MunitTest tests_audio_ring[] = {
+	{
+		"/wrap",
+		test_wrap,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/volume",
+		test_volume,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -30,6 +30,7 @@ static MunitResult test_bitstream_parse_h264(const MunitParameter params[], void
 	memset(&slice, -1, sizeof(slice));
 	munit_assert(chiaki_bitstream_slice(&bs, slice_i, ARRAY_SIZE(slice_i), &slice));
 	munit_assert(slice.slice_type == CHIAKI_BITSTREAM_SLICE_I);
+	munit_assert(slice.idr);
 
 	uint8_t slice_p[] = {
 		0x00, 0x00, 0x00, 0x01, 0x41, 0x9a, 0x04, 0x44, 0x3f, 0x41, 0x5b, 0xf4, 0x65, 0xb4, 0x3e, 0x1a,
@@ -38,8 +39,18 @@ static MunitResult test_bitstream_parse_h264(const MunitParameter params[], void
 	memset(&slice, -1, sizeof(slice));
 	munit_assert(chiaki_bitstream_slice(&bs, slice_p, ARRAY_SIZE(slice_p), &slice));
 	munit_assert(slice.slice_type == CHIAKI_BITSTREAM_SLICE_P);
+	munit_assert(!slice.idr);
 	munit_assert(slice.reference_frame == 0);
 
+	// intra refresh, an I slice in a non-IDR NAL unit
+	uint8_t slice_i_non_idr[] = {
+		0x00, 0x00, 0x00, 0x01, 0x21, 0x88, 0x80, 0x3f, 0xff, 0xff,
+	};
+	memset(&slice, -1, sizeof(slice));
+	munit_assert(chiaki_bitstream_slice(&bs, slice_i_non_idr, ARRAY_SIZE(slice_i_non_idr), &slice));
+	munit_assert(slice.slice_type == CHIAKI_BITSTREAM_SLICE_I);
+	munit_assert(!slice.idr);
+
 	uint8_t slice_p_ref_5[] = {
 		0x00, 0x00, 0x00, 0x01, 0x41, 0x9b, 0xfd, 0x98, 0x89, 0xdf, 0x00, 0x03, 0x24, 0x60, 0x47, 0x1a,
 		0x90, 0x10, 0xb3, 0x2c, 0x4e, 0x45, 0xfc, 0xff, 0x45, 0x24, 0x8c, 0x79, 0xec, 0x12, 0xe5, 0x9b,
@@ -78,6 +89,7 @@ static MunitResult test_bitstream_parse_h265(const MunitParameter params[], void
 	memset(&slice, -1, sizeof(slice));
 	munit_assert(chiaki_bitstream_slice(&bs, slice_i, ARRAY_SIZE(slice_i), &slice));
 	munit_assert(slice.slice_type == CHIAKI_BITSTREAM_SLICE_I);
+	munit_assert(slice.idr);
 
 	uint8_t slice_p[] = {
 		0x00, 0x00, 0x00, 0x01, 0x02, 0x01, 0xd0, 0x97, 0x61, 0x28, 0x23, 0x2d, 0x8b, 0x80, 0x6f, 0xfd,
@@ -86,8 +98,27 @@ static MunitResult test_bitstream_parse_h265(const MunitParameter params[], void
 	memset(&slice, -1, sizeof(slice));
 	munit_assert(chiaki_bitstream_slice(&bs, slice_p, ARRAY_SIZE(slice_p), &slice));
 	munit_assert(slice.slice_type == CHIAKI_BITSTREAM_SLICE_P);
+	munit_assert(!slice.idr);
 	munit_assert(slice.reference_frame == 0);
 
+	// intra refresh, an I slice in a TRAIL_R NAL unit
+	uint8_t slice_i_non_idr[] = {
+		0x00, 0x00, 0x00, 0x01, 0x02, 0x01, 0xd8, 0x7f, 0xff, 0xff,
+	};
+	memset(&slice, -1, sizeof(slice));
+	munit_assert(chiaki_bitstream_slice(&bs, slice_i_non_idr, ARRAY_SIZE(slice_i_non_idr), &slice));
+	munit_assert(slice.slice_type == CHIAKI_BITSTREAM_SLICE_I);
+	munit_assert(!slice.idr);
+
+	// IDR_W_RADL
+	uint8_t slice_i_w_radl[] = {
+		0x00, 0x00, 0x00, 0x01, 0x26, 0x01, 0xaf, 0xff, 0xff,
+	};
+	memset(&slice, -1, sizeof(slice));
+	munit_assert(chiaki_bitstream_slice(&bs, slice_i_w_radl, ARRAY_SIZE(slice_i_w_radl), &slice));
+	munit_assert(slice.slice_type == CHIAKI_BITSTREAM_SLICE_I);
+	munit_assert(slice.idr);
+
 	uint8_t slice_p_ref_5[] = {
 		0x00, 0x00, 0x00, 0x01, 0x02, 0x01, 0xd7, 0x85, 0x6a, 0xae, 0xa6, 0x11, 0x80, 0x95, 0x80, 0x0a,
 		0xec, 0x5e, 0xdf, 0x39, 0x86, 0xe6, 0xd9, 0x07, 0x49, 0x17, 0xe2, 0x62, 0x57, 0x14, 0xd7, 0x08,
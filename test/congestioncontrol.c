@@ -0,0 +1,252 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/congestioncontrol.h>
+
+#define FPS 60
+#define FRAME_INTERVAL_US (1000000 / FPS)
+#define REPORT_INTERVAL_US 200000
+#define UNIT_BITS (1400 * 8)
+#define PACKET_LOSS_MAX 0.05
+
+/**
+ * Server sending video frames over a single bottleneck link with a drop-tail queue,
+ * adapting its bitrate to the congestion packets like the console does.
+ */
+typedef struct sim_t
+{
+	ChiakiCongestionEstimator estimator;
+	uint32_t rng;
+
+	double bitrate; // bit/s
+	double bitrate_min;
+	double bitrate_max;
+
+	double capacity; // bit/s
+	uint64_t propagation_us;
+	uint64_t queue_max_us;
+	double random_loss;
+	uint64_t jitter_us;
+
+	double link_free_us;
+	uint64_t received;
+	uint64_t lost;
+	uint64_t report_next_us;
+	uint64_t reports;
+	uint64_t reports_with_loss;
+
+	uint64_t queue_delay_max_us; // ground truth, reset by the caller
+} Sim;
+
+static uint32_t sim_rand(Sim *sim)
+{
+	sim->rng = sim->rng * 1664525 + 1013904223;
+	return sim->rng >> 8;
+}
+
+static double sim_rand_unit(Sim *sim)
+{
+	return (sim_rand(sim) & 0xffff) / 65536.0;
+}
+
+static void sim_init(Sim *sim, ChiakiCongestionControlPolicy policy, double capacity)
+{
+	memset(sim, 0, sizeof(*sim));
+	chiaki_congestion_estimator_init(&sim->estimator, policy, PACKET_LOSS_MAX, FRAME_INTERVAL_US);
+	sim->rng = 42;
+	sim->bitrate = 10000000;
+	sim->bitrate_min = 2000000;
+	sim->bitrate_max = 15000000;
+	sim->capacity = capacity;
+	sim->propagation_us = 10000;
+	sim->queue_max_us = 400000;
+	sim->report_next_us = REPORT_INTERVAL_US;
+}
+
+static void sim_report(Sim *sim)
+{
+	ChiakiTakionCongestionPacket packet;
+	chiaki_congestion_estimator_report(&sim->estimator, sim->received, sim->lost, &packet);
+	sim->received = 0;
+	sim->lost = 0;
+	sim->reports++;
+
+	uint32_t total = (uint32_t)packet.received + packet.lost;
+	double loss = total ? (double)packet.lost / total : 0.0;
+	if(loss > 0.0)
+		sim->reports_with_loss++;
+
+	if(loss >= 0.02)
+		sim->bitrate *= 0.8;
+	else if(loss > 0.0)
+		sim->bitrate *= 0.95;
+	else
+		sim->bitrate *= 1.05;
+	if(sim->bitrate < sim->bitrate_min)
+		sim->bitrate = sim->bitrate_min;
+	if(sim->bitrate > sim->bitrate_max)
+		sim->bitrate = sim->bitrate_max;
+}
+
+static void sim_run(Sim *sim, uint64_t frame_start, uint64_t frames)
+{
+	for(uint64_t frame = frame_start; frame < frame_start + frames; frame++)
+	{
+		uint64_t send_us = frame * FRAME_INTERVAL_US;
+		unsigned int units = (unsigned int)(sim->bitrate / FPS / UNIT_BITS) + 1;
+		unsigned int units_fec = units / 5 + 1;
+		unsigned int units_lost = 0;
+		bool first = true;
+		uint64_t first_arrival_us = 0;
+
+		for(unsigned int i=0; i<units + units_fec; i++)
+		{
+			double queue_delay_us = sim->link_free_us > send_us ? sim->link_free_us - send_us : 0.0;
+			if(queue_delay_us > sim->queue_max_us)
+			{
+				units_lost++;
+				continue;
+			}
+			if(first && (uint64_t)queue_delay_us > sim->queue_delay_max_us)
+				sim->queue_delay_max_us = (uint64_t)queue_delay_us;
+
+			double start_us = send_us + queue_delay_us;
+			sim->link_free_us = start_us + UNIT_BITS / sim->capacity * 1000000.0;
+			if(sim_rand_unit(sim) < sim->random_loss)
+			{
+				units_lost++;
+				continue;
+			}
+
+			if(first)
+			{
+				first = false;
+				first_arrival_us = (uint64_t)sim->link_free_us + sim->propagation_us;
+				if(sim->jitter_us)
+					first_arrival_us += sim_rand(sim) % sim->jitter_us;
+			}
+		}
+
+		while(!first && first_arrival_us >= sim->report_next_us)
+		{
+			sim_report(sim);
+			sim->report_next_us += REPORT_INTERVAL_US;
+		}
+
+		if(!first)
+			chiaki_congestion_estimator_push_frame(&sim->estimator, (ChiakiSeqNum16)frame, first_arrival_us);
+		if(units_lost)
+			chiaki_congestion_estimator_push_fec(&sim->estimator, units_lost <= units_fec);
+		sim->received += units + units_fec - units_lost;
+		sim->lost += units_lost;
+	}
+}
+
+static MunitResult test_capacity_drop(const MunitParameter params[], void *user)
+{
+	uint64_t queue_delay_max_us[CHIAKI_CONGESTION_CONTROL_POLICY_COUNT];
+	double bitrate[CHIAKI_CONGESTION_CONTROL_POLICY_COUNT];
+	for(int policy=0; policy<CHIAKI_CONGESTION_CONTROL_POLICY_COUNT; policy++)
+	{
+		Sim sim;
+		sim_init(&sim, (ChiakiCongestionControlPolicy)policy, 20000000);
+
+		// plenty of capacity
+		sim_run(&sim, 0, 5 * FPS);
+		munit_assert_uint64(sim.queue_delay_max_us, <, 5000);
+		munit_assert_double(sim.bitrate, ==, sim.bitrate_max);
+
+		// bottleneck drops below the sending rate, let the controller settle
+		sim.capacity = 6000000;
+		sim_run(&sim, 5 * FPS, 5 * FPS);
+
+		sim.queue_delay_max_us = 0;
+		sim_run(&sim, 10 * FPS, 10 * FPS);
+		queue_delay_max_us[policy] = sim.queue_delay_max_us;
+		bitrate[policy] = sim.bitrate;
+		munit_assert_double(sim.bitrate, <, sim.capacity);
+	}
+
+	// delay-based keeps the queue short, the others only react once the queue overflows
+	munit_assert_uint64(queue_delay_max_us[CHIAKI_CONGESTION_CONTROL_POLICY_DELAY], <, 100000);
+	munit_assert_uint64(queue_delay_max_us[CHIAKI_CONGESTION_CONTROL_POLICY_LOSS], >, 200000);
+	munit_assert_uint64(queue_delay_max_us[CHIAKI_CONGESTION_CONTROL_POLICY_LEGACY], >, 200000);
+	munit_assert_double(bitrate[CHIAKI_CONGESTION_CONTROL_POLICY_DELAY], >, 2000000);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_random_loss(const MunitParameter params[], void *user)
+{
+	uint64_t reports_with_loss[CHIAKI_CONGESTION_CONTROL_POLICY_COUNT];
+	for(int policy=0; policy<CHIAKI_CONGESTION_CONTROL_POLICY_COUNT; policy++)
+	{
+		Sim sim;
+		sim_init(&sim, (ChiakiCongestionControlPolicy)policy, 50000000);
+		// non-congestive loss that FEC can repair and some arrival jitter
+		sim.random_loss = 0.005;
+		sim.jitter_us = 4000;
+		sim_run(&sim, 0, 20 * FPS);
+
+		munit_assert_uint64(sim.estimator.overuse_reports, ==, 0);
+		reports_with_loss[policy] = sim.reports_with_loss;
+		if(policy == CHIAKI_CONGESTION_CONTROL_POLICY_DELAY)
+			munit_assert_double(sim.bitrate, ==, sim.bitrate_max);
+	}
+
+	munit_assert_uint64(reports_with_loss[CHIAKI_CONGESTION_CONTROL_POLICY_DELAY], <, reports_with_loss[CHIAKI_CONGESTION_CONTROL_POLICY_LEGACY] / 4);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_legacy(const MunitParameter params[], void *user)
+{
+	ChiakiCongestionEstimator estimator;
+	chiaki_congestion_estimator_init(&estimator, CHIAKI_CONGESTION_CONTROL_POLICY_LEGACY, PACKET_LOSS_MAX, 0);
+
+	ChiakiTakionCongestionPacket packet;
+	chiaki_congestion_estimator_report(&estimator, 990, 10, &packet);
+	munit_assert_uint16(packet.received, ==, 990);
+	munit_assert_uint16(packet.lost, ==, 10);
+
+	// clamped to packet_loss_max
+	chiaki_congestion_estimator_report(&estimator, 800, 200, &packet);
+	munit_assert_uint16(packet.received, ==, 950);
+	munit_assert_uint16(packet.lost, ==, 50);
+	munit_assert_double(estimator.packet_loss, ==, 0.2);
+
+	chiaki_congestion_estimator_report(&estimator, 0, 0, &packet);
+	munit_assert_uint16(packet.received, ==, 0);
+	munit_assert_uint16(packet.lost, ==, 0);
+
+	return MUNIT_OK;
+}
+
+MunitTest tests_congestion_control[] = {
+	{
+		"/legacy",
+		test_legacy,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/capacity_drop",
+		test_capacity_drop,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/random_loss",
+		test_random_loss,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
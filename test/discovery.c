@@ -0,0 +1,174 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/discovery.h>
+#include <chiaki/stoppipe.h>
+#include <chiaki/thread.h>
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#endif
+
+#include "test_log.h"
+
+#define FAKE_CONSOLES_COUNT 2
+
+/**
+ * PS5s on 127.0.0.1 and 127.0.0.2, the first one drops its first request.
+ */
+typedef struct fake_consoles_t
+{
+	chiaki_socket_t socks[FAKE_CONSOLES_COUNT];
+	unsigned int requests[FAKE_CONSOLES_COUNT];
+	ChiakiStopPipe stop_pipe;
+	ChiakiThread thread;
+} FakeConsoles;
+
+static const char *fake_responses[FAKE_CONSOLES_COUNT] = {
+	"HTTP/1.1 200 Ok\r\nhost-id:FAKE0\r\nhost-type:PS5\r\nhost-name:Fake0\r\nhost-request-port:997\r\n"
+	"device-discovery-protocol-version:00030010\r\nsystem-version:07020001\r\n\r\n",
+	"HTTP/1.1 620 Server Standby\r\nhost-id:FAKE1\r\nhost-type:PS5\r\nhost-name:Fake1\r\nhost-request-port:997\r\n"
+	"device-discovery-protocol-version:00030010\r\nsystem-version:07020001\r\n\r\n"
+};
+
+static void *fake_consoles_thread_func(void *user)
+{
+	FakeConsoles *fake = user;
+	while(true)
+	{
+		bool ready[FAKE_CONSOLES_COUNT];
+		ChiakiErrorCode err = chiaki_stop_pipe_select_multi(&fake->stop_pipe, fake->socks, FAKE_CONSOLES_COUNT, UINT64_MAX, ready);
+		if(err != CHIAKI_ERR_SUCCESS)
+			break;
+		for(size_t i=0; i<FAKE_CONSOLES_COUNT; i++)
+		{
+			if(!ready[i])
+				continue;
+			char buf[512];
+			struct sockaddr_storage addr;
+			socklen_t addr_len = sizeof(addr);
+			int n = recvfrom(fake->socks[i], buf, sizeof(buf) - 1, 0, (struct sockaddr *)&addr, &addr_len);
+			if(n < 4 || memcmp(buf, "SRCH", 4) != 0)
+				continue;
+			fake->requests[i]++;
+			if(i == 0 && fake->requests[i] == 1)
+				continue;
+			sendto(fake->socks[i], fake_responses[i], strlen(fake_responses[i]), 0, (struct sockaddr *)&addr, addr_len);
+		}
+	}
+	return NULL;
+}
+
+static bool fake_consoles_start(FakeConsoles *fake)
+{
+	memset(fake, 0, sizeof(*fake));
+	for(size_t i=0; i<FAKE_CONSOLES_COUNT; i++)
+		fake->socks[i] = CHIAKI_INVALID_SOCKET;
+	for(size_t i=0; i<FAKE_CONSOLES_COUNT; i++)
+	{
+		fake->socks[i] = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if(CHIAKI_SOCKET_IS_INVALID(fake->socks[i]))
+			goto error;
+		struct sockaddr_in addr = { 0 };
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(CHIAKI_DISCOVERY_PORT_PS5);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK + i);
+		if(bind(fake->socks[i], (struct sockaddr *)&addr, sizeof(addr)) < 0)
+			goto error;
+	}
+	if(chiaki_stop_pipe_init(&fake->stop_pipe) != CHIAKI_ERR_SUCCESS)
+		goto error;
+	if(chiaki_thread_create(&fake->thread, fake_consoles_thread_func, fake) != CHIAKI_ERR_SUCCESS)
+	{
+		chiaki_stop_pipe_fini(&fake->stop_pipe);
+		goto error;
+	}
+	return true;
+error:
+	for(size_t i=0; i<FAKE_CONSOLES_COUNT; i++)
+	{
+		if(!CHIAKI_SOCKET_IS_INVALID(fake->socks[i]))
+			CHIAKI_SOCKET_CLOSE(fake->socks[i]);
+	}
+	return false;
+}
+
+static void fake_consoles_stop(FakeConsoles *fake)
+{
+	chiaki_stop_pipe_stop(&fake->stop_pipe);
+	chiaki_thread_join(&fake->thread, NULL);
+	chiaki_stop_pipe_fini(&fake->stop_pipe);
+	for(size_t i=0; i<FAKE_CONSOLES_COUNT; i++)
+		CHIAKI_SOCKET_CLOSE(fake->socks[i]);
+}
+
+static void fleet_cb(ChiakiDiscoveryFleetHost *host, ChiakiDiscoveryHost *response, void *user)
+{
+	unsigned int *responses = user;
+	(*responses)++;
+}
+
+static MunitResult test_fleet(const MunitParameter params[], void *user)
+{
+	FakeConsoles fake;
+	// 127.0.0.2 is not available on every system, and the port may be taken
+	if(!fake_consoles_start(&fake))
+		return MUNIT_SKIP;
+
+	ChiakiDiscoveryFleetHost hosts[4];
+	memset(hosts, 0, sizeof(hosts));
+	hosts[0].host = "127.0.0.1";
+	hosts[1].host = "127.0.0.2";
+	hosts[2].host = "127.0.0.3"; // nobody there
+	hosts[3].host = ""; // fails to resolve
+
+	unsigned int responses = 0;
+	ChiakiDiscoveryFleetOptions options;
+	chiaki_discovery_fleet_options_default(&options);
+	options.rto_initial_ms = 100;
+	options.attempts_max = 3;
+	options.cb = fleet_cb;
+	options.cb_user = &responses;
+	ChiakiErrorCode err = chiaki_discovery_fleet_run(get_test_log(), hosts, 4, &options);
+	fake_consoles_stop(&fake);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_uint(responses, ==, 2);
+
+	munit_assert_int(hosts[0].state, ==, CHIAKI_DISCOVERY_FLEET_STATE_RESPONDED);
+	munit_assert_uint(hosts[0].attempts, ==, 2);
+	munit_assert_int(hosts[0].host_state, ==, CHIAKI_DISCOVERY_HOST_STATE_READY);
+	munit_assert_true(hosts[0].host_ps5);
+	munit_assert_string_equal(hosts[0].host_id, "FAKE0");
+
+	munit_assert_int(hosts[1].state, ==, CHIAKI_DISCOVERY_FLEET_STATE_RESPONDED);
+	munit_assert_uint(hosts[1].attempts, ==, 1);
+	munit_assert_int(hosts[1].host_state, ==, CHIAKI_DISCOVERY_HOST_STATE_STANDBY);
+	munit_assert_string_equal(hosts[1].host_name, "Fake1");
+	munit_assert_uint64(hosts[1].rtt_us, >, 0);
+
+	munit_assert_int(hosts[2].state, ==, CHIAKI_DISCOVERY_FLEET_STATE_TIMEOUT);
+	munit_assert_uint(hosts[2].attempts, ==, 3);
+
+	munit_assert_int(hosts[3].state, ==, CHIAKI_DISCOVERY_FLEET_STATE_INVALID_HOST);
+	munit_assert_uint(hosts[3].attempts, ==, 0);
+
+	return MUNIT_OK;
+}
+
+MunitTest tests_discovery[] = {
+	{
+		"/fleet",
+		test_fleet,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,208 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/discoveryservice.h>
+
+#include <stdio.h>
+#include <string.h>
+
+typedef struct deltas_t
+{
+	unsigned int added;
+	unsigned int updated;
+	unsigned int removed;
+	char last_addr[64];
+} Deltas;
+
+static void delta_cb(ChiakiDiscoveryServiceDelta delta, ChiakiDiscoveryHost *host, void *user)
+{
+	Deltas *deltas = user;
+	switch(delta)
+	{
+		case CHIAKI_DISCOVERY_SERVICE_HOST_ADDED:
+			deltas->added++;
+			break;
+		case CHIAKI_DISCOVERY_SERVICE_HOST_UPDATED:
+			deltas->updated++;
+			break;
+		case CHIAKI_DISCOVERY_SERVICE_HOST_REMOVED:
+			deltas->removed++;
+			break;
+	}
+	snprintf(deltas->last_addr, sizeof(deltas->last_addr), "%s", host->host_addr ? host->host_addr : "");
+}
+
+static ChiakiDiscoveryHost make_host(const char *host_id, const char *host_addr, ChiakiDiscoveryHostState state)
+{
+	ChiakiDiscoveryHost host = { 0 };
+	host.host_id = host_id;
+	host.host_addr = host_addr;
+	host.host_name = "PS5-123";
+	host.state = state;
+	host.host_request_port = 997;
+	return host;
+}
+
+static MunitResult test_deltas(const MunitParameter params[], void *user)
+{
+	Deltas deltas = { 0 };
+	ChiakiDiscoveryHostTable table;
+	ChiakiErrorCode err = chiaki_discovery_host_table_init(&table, 2, delta_cb, &deltas);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	ChiakiDiscoveryHost a = make_host("AAAAAAAAAAAA", "192.168.1.2", CHIAKI_DISCOVERY_HOST_STATE_STANDBY);
+	err = chiaki_discovery_host_table_update(&table, &a, 1);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_uint(deltas.added, ==, 1);
+
+	// same response again is not a change
+	err = chiaki_discovery_host_table_update(&table, &a, 2);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_uint(deltas.added, ==, 1);
+	munit_assert_uint(deltas.updated, ==, 0);
+
+	a.state = CHIAKI_DISCOVERY_HOST_STATE_READY;
+	chiaki_discovery_host_table_update(&table, &a, 2);
+	munit_assert_uint(deltas.updated, ==, 1);
+
+	ChiakiDiscoveryHost b = make_host("BBBBBBBBBBBB", "192.168.1.3", CHIAKI_DISCOVERY_HOST_STATE_READY);
+	chiaki_discovery_host_table_update(&table, &b, 2);
+	ChiakiDiscoveryHost c = make_host("CCCCCCCCCCCC", "192.168.1.4", CHIAKI_DISCOVERY_HOST_STATE_READY);
+	err = chiaki_discovery_host_table_update(&table, &c, 2);
+	munit_assert_int(err, ==, CHIAKI_ERR_OVERFLOW);
+	munit_assert_uint(deltas.added, ==, 2);
+	munit_assert_size(table.hosts_count, ==, 2);
+
+	munit_assert_ptr_not_null(chiaki_discovery_host_table_find(&table, "AAAAAAAAAAAA"));
+	munit_assert_ptr_null(chiaki_discovery_host_table_find(&table, "CCCCCCCCCCCC"));
+
+	b.host_id = NULL;
+	err = chiaki_discovery_host_table_update(&table, &b, 2);
+	munit_assert_int(err, ==, CHIAKI_ERR_INVALID_DATA);
+	b.host_id = "BBBBBBBBBBBB";
+
+	// only b keeps answering
+	for(uint64_t ping=3; ping<=6; ping++)
+	{
+		chiaki_discovery_host_table_drop_old(&table, ping, 3);
+		chiaki_discovery_host_table_update(&table, &b, ping);
+	}
+	munit_assert_uint(deltas.removed, ==, 1);
+	munit_assert_string_equal(deltas.last_addr, "192.168.1.2");
+	munit_assert_size(table.hosts_count, ==, 1);
+	munit_assert_ptr_null(chiaki_discovery_host_table_find(&table, "AAAAAAAAAAAA"));
+	ChiakiDiscoveryHost *found = chiaki_discovery_host_table_find(&table, "BBBBBBBBBBBB");
+	munit_assert_ptr_equal(found, &table.hosts[0]);
+
+	chiaki_discovery_host_table_fini(&table);
+	return MUNIT_OK;
+}
+
+static MunitResult test_dual_stack(const MunitParameter params[], void *user)
+{
+	Deltas deltas = { 0 };
+	ChiakiDiscoveryHostTable table;
+	ChiakiErrorCode err = chiaki_discovery_host_table_init(&table, 4, delta_cb, &deltas);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	ChiakiDiscoveryHost v4 = make_host("AAAAAAAAAAAA", "192.168.1.2", CHIAKI_DISCOVERY_HOST_STATE_READY);
+	ChiakiDiscoveryHost v6 = make_host("AAAAAAAAAAAA", "fe80::1", CHIAKI_DISCOVERY_HOST_STATE_READY);
+
+	// answering over both does not flip the address
+	for(uint64_t ping=1; ping<=5; ping++)
+	{
+		chiaki_discovery_host_table_update(&table, &v6, ping);
+		chiaki_discovery_host_table_update(&table, &v4, ping);
+	}
+	munit_assert_uint(deltas.added, ==, 1);
+	munit_assert_uint(deltas.updated, ==, 0);
+	munit_assert_string_equal(table.hosts[0].host_addr, "fe80::1");
+
+	// IPv6 goes away, IPv4 takes over without the host being removed
+	for(uint64_t ping=6; ping<=10; ping++)
+	{
+		chiaki_discovery_host_table_drop_old(&table, ping, 3);
+		chiaki_discovery_host_table_update(&table, &v4, ping);
+	}
+	munit_assert_uint(deltas.removed, ==, 0);
+	munit_assert_uint(deltas.updated, ==, 1);
+	munit_assert_string_equal(table.hosts[0].host_addr, "192.168.1.2");
+
+	chiaki_discovery_host_table_fini(&table);
+	return MUNIT_OK;
+}
+
+static MunitResult test_many(const MunitParameter params[], void *user)
+{
+	Deltas deltas = { 0 };
+	ChiakiDiscoveryHostTable table;
+	ChiakiErrorCode err = chiaki_discovery_host_table_init(&table, 64, delta_cb, &deltas);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	char ids[64][16];
+	for(int i=0; i<64; i++)
+	{
+		snprintf(ids[i], sizeof(ids[i]), "%012X", i * 7919);
+		ChiakiDiscoveryHost host = make_host(ids[i], "10.0.0.1", CHIAKI_DISCOVERY_HOST_STATE_READY);
+		err = chiaki_discovery_host_table_update(&table, &host, 1);
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	}
+	munit_assert_uint(deltas.added, ==, 64);
+
+	// every other host disappears, the rest must still be found after the index was shifted around
+	for(uint64_t ping=2; ping<=5; ping++)
+	{
+		chiaki_discovery_host_table_drop_old(&table, ping, 3);
+		for(int i=1; i<64; i+=2)
+		{
+			ChiakiDiscoveryHost host = make_host(ids[i], "10.0.0.1", CHIAKI_DISCOVERY_HOST_STATE_READY);
+			chiaki_discovery_host_table_update(&table, &host, ping);
+		}
+	}
+	munit_assert_uint(deltas.removed, ==, 32);
+	munit_assert_uint(deltas.added, ==, 64);
+	munit_assert_size(table.hosts_count, ==, 32);
+	for(int i=0; i<64; i++)
+	{
+		ChiakiDiscoveryHost *host = chiaki_discovery_host_table_find(&table, ids[i]);
+		if(i % 2)
+		{
+			munit_assert_ptr_not_null(host);
+			munit_assert_string_equal(host->host_id, ids[i]);
+		}
+		else
+			munit_assert_ptr_null(host);
+	}
+
+	chiaki_discovery_host_table_fini(&table);
+	return MUNIT_OK;
+}
+
+MunitTest tests_discovery_service[] = {
+	{
+		"/deltas",
+		test_deltas,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/dual_stack",
+		test_dual_stack,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/many",
+		test_many,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
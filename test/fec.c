@@ -16,7 +16,7 @@ typedef struct fec_test_case_t
 
 #include "fec_test_cases.inl"
 
-static MunitResult test_fec_case(FECTestCase *test_case)
+static MunitResult test_fec_case(FECTestCase *test_case, ChiakiThreadPool *pool)
 {
 	size_t b64len = strlen(test_case->frame_buffer_b64);
 	uint8_t *frame_buffer_ref = malloc(b64len);
@@ -45,7 +45,10 @@ static MunitResult test_fec_case(FECTestCase *test_case)
 		memset(frame_buffer + stride * e, 0x42, test_case->unit_size);
 	}
 
-	err = chiaki_fec_decode(frame_buffer, test_case->unit_size, stride, test_case->k, test_case->m, (const unsigned int *)test_case->erasures, erasures_count);
+	if(pool)
+		err = chiaki_fec_decode_pool(frame_buffer, test_case->unit_size, stride, test_case->k, test_case->m, (const unsigned int *)test_case->erasures, erasures_count, pool, 0);
+	else
+		err = chiaki_fec_decode(frame_buffer, test_case->unit_size, stride, test_case->k, test_case->m, (const unsigned int *)test_case->erasures, erasures_count);
 	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
 
 	for(size_t i=0; i<test_case->k; i++)
@@ -64,7 +67,18 @@ static MunitParameterEnum fec_params[] = {
 static MunitResult test_fec(const MunitParameter params[], void *test_user)
 {
 	unsigned long test_case_id = strtoul(params[0].value, NULL, 0);
-	return test_fec_case(&fec_test_cases[test_case_id]);
+	return test_fec_case(&fec_test_cases[test_case_id], NULL);
+}
+
+static MunitResult test_fec_pool(const MunitParameter params[], void *test_user)
+{
+	unsigned long test_case_id = strtoul(params[0].value, NULL, 0);
+	ChiakiThreadPool pool;
+	ChiakiErrorCode err = chiaki_thread_pool_init(&pool, 3, NULL);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	MunitResult r = test_fec_case(&fec_test_cases[test_case_id], &pool);
+	chiaki_thread_pool_fini(&pool);
+	return r;
 }
 
 MunitTest tests_fec[] = {
@@ -76,5 +90,13 @@ MunitTest tests_fec[] = {
 		MUNIT_TEST_OPTION_NONE,
 		fec_params
 	},
+	{
+		"/fec_pool",
+		test_fec_pool,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		fec_params
+	},
 	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
 };
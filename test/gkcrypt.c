@@ -5,6 +5,8 @@
 #include <chiaki/ecdh.h>
 #include <chiaki/gkcrypt.h>
 
+#include "test_log.h"
+
 static MunitResult test_ecdh(const MunitParameter params[], void *user)
 {
 	static const uint8_t handshake_key[] = { 0xfc, 0x5d, 0x4b, 0xa0, 0x3a, 0x35, 0x3a, 0xbb, 0x6a, 0x7f, 0xac, 0x79, 0x1b, 0x17, 0xbb, 0x34 };
@@ -63,7 +65,7 @@ static MunitResult test_key_stream(const MunitParameter params[], void *user)
 	ChiakiLog log;
 
 	ChiakiGKCrypt gkcrypt;
-	ChiakiErrorCode err = chiaki_gkcrypt_init(&gkcrypt, &log, 0, 42, handshake_key, ecdh_secret);
+	ChiakiErrorCode err = chiaki_gkcrypt_init(&gkcrypt, &log, 0, NULL, 0, 42, handshake_key, ecdh_secret);
 	if(err != CHIAKI_ERR_SUCCESS)
 		return MUNIT_ERROR;
 
@@ -109,7 +111,7 @@ static MunitResult test_endecrypt(const MunitParameter params[], void *user)
 	ChiakiLog log;
 
 	ChiakiGKCrypt gkcrypt;
-	ChiakiErrorCode err = chiaki_gkcrypt_init(&gkcrypt, &log, 0, 42, handshake_key, ecdh_secret);
+	ChiakiErrorCode err = chiaki_gkcrypt_init(&gkcrypt, &log, 0, NULL, 0, 42, handshake_key, ecdh_secret);
 	if(err != CHIAKI_ERR_SUCCESS)
 		return MUNIT_ERROR;
 
@@ -365,7 +367,7 @@ static MunitResult test_gmac_multiple_of_key_refresh(const MunitParameter params
 
 	ChiakiLog log;
 	ChiakiGKCrypt gkcrypt;
-	chiaki_gkcrypt_init(&gkcrypt, &log, 0, crypt_index, handshake_key, ecdh_secret);
+	chiaki_gkcrypt_init(&gkcrypt, &log, 0, NULL, 0, crypt_index, handshake_key, ecdh_secret);
 
 	uint8_t gmac[CHIAKI_GKCRYPT_GMAC_SIZE];
 	ChiakiErrorCode err = chiaki_gkcrypt_gmac(&gkcrypt, key_pos, data, sizeof(data), gmac);
@@ -379,6 +381,42 @@ static MunitResult test_gmac_multiple_of_key_refresh(const MunitParameter params
 	return MUNIT_OK;
 }
 
+static MunitResult test_key_buf_pool(const MunitParameter params[], void *user)
+{
+	static const uint8_t handshake_key[] = { 0x83, 0xcf, 0x93, 0x1a, 0x6a, 0xa7, 0x69, 0xa6, 0xc4, 0x48, 0x5d, 0x19, 0xc1, 0x5c, 0xcc, 0x52 };
+	static const uint8_t ecdh_secret[] = { 0x73, 0xc8, 0xd5, 0x49, 0xc4, 0xd9, 0xdb, 0x50, 0x2e, 0xc0, 0x44, 0xea, 0x33, 0x64, 0x8c, 0x6a, 0xc9, 0xf3, 0x6c, 0x41, 0xb6, 0xa0, 0x50, 0x4f, 0xe0, 0x93, 0xde, 0xfb, 0x61, 0x9b, 0x9, 0x73 };
+
+	ChiakiThreadPool pool;
+	ChiakiErrorCode err = chiaki_thread_pool_init(&pool, 2, NULL);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	ChiakiGKCrypt gkcrypt;
+	err = chiaki_gkcrypt_init(&gkcrypt, get_test_log(), 4, &pool, chiaki_thread_pool_affinity(&pool), 42, handshake_key, ecdh_secret);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	// the initial fill is a single task that keeps requeueing itself until the buffer is full
+	chiaki_thread_pool_group_wait(&pool, &gkcrypt.key_buf_group);
+	munit_assert_uint64(gkcrypt.key_buf_populated, ==, gkcrypt.key_buf_size);
+
+	uint8_t expected[0x100];
+	uint8_t result[0x100];
+	for(uint64_t key_pos=0; key_pos<0x8000; key_pos+=0x330)
+	{
+		err = chiaki_gkcrypt_get_key_stream(&gkcrypt, key_pos, result, sizeof(result));
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+		err = chiaki_gkcrypt_gen_key_stream(&gkcrypt, key_pos, expected, sizeof(expected));
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+		munit_assert_memory_equal(sizeof(result), result, expected);
+		// give the task the chance to move the buffer along
+		chiaki_thread_pool_group_wait(&pool, &gkcrypt.key_buf_group);
+	}
+	munit_assert_uint64(gkcrypt.key_buf_key_pos_min, >, 0);
+
+	chiaki_gkcrypt_fini(&gkcrypt);
+	chiaki_thread_pool_fini(&pool);
+	return MUNIT_OK;
+}
+
 
 MunitTest tests_gkcrypt[] = {
 	{
@@ -437,5 +475,13 @@ MunitTest tests_gkcrypt[] = {
 		MUNIT_TEST_OPTION_NONE,
 		NULL
 	},
+	{
+		"/key_buf_pool",
+		test_key_buf_pool,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
 	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
 };
\ No newline at end of file
@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/logasync.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define RECORDS_MAX 16
+
+typedef struct record_list_t
+{
+	ChiakiMutex block; // held by the test to stall the writer thread
+	size_t count;
+	ChiakiLogLevel level[RECORDS_MAX];
+	char msg[RECORDS_MAX][CHIAKI_LOG_ASYNC_MSG_SIZE];
+	uint64_t timestamp_us[RECORDS_MAX];
+} RecordList;
+
+static void record_cb(const ChiakiLogRecord *record, void *user)
+{
+	RecordList *list = user;
+	chiaki_mutex_lock(&list->block);
+	if(list->count < RECORDS_MAX)
+	{
+		list->level[list->count] = record->level;
+		strcpy(list->msg[list->count], record->msg);
+		list->timestamp_us[list->count] = record->timestamp_us;
+		list->count++;
+	}
+	chiaki_mutex_unlock(&list->block);
+}
+
+static MunitResult test_order(const MunitParameter params[], void *user)
+{
+	RecordList list = { 0 };
+	chiaki_mutex_init(&list.block, false);
+	ChiakiLogAsync async;
+	ChiakiErrorCode err = chiaki_log_async_init(&async, CHIAKI_LOG_ALL & ~CHIAKI_LOG_VERBOSE, 8, record_cb, &list);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	ChiakiLog *log = chiaki_log_async_get_log(&async);
+
+	CHIAKI_LOGI(log, "first %d", 1);
+	CHIAKI_LOGV(log, "masked");
+	CHIAKI_LOGW(log, "second %s", "two");
+	CHIAKI_LOGE(log, "third");
+
+	// everything logged before fini is written
+	chiaki_log_async_fini(&async);
+	chiaki_mutex_fini(&list.block);
+
+	munit_assert_size(list.count, ==, 3);
+	munit_assert_int(list.level[0], ==, CHIAKI_LOG_INFO);
+	munit_assert_string_equal(list.msg[0], "first 1");
+	munit_assert_int(list.level[1], ==, CHIAKI_LOG_WARNING);
+	munit_assert_string_equal(list.msg[1], "second two");
+	munit_assert_int(list.level[2], ==, CHIAKI_LOG_ERROR);
+	munit_assert_string_equal(list.msg[2], "third");
+	munit_assert_uint64(list.timestamp_us[0], <=, list.timestamp_us[2]);
+	return MUNIT_OK;
+}
+
+static MunitResult test_overflow(const MunitParameter params[], void *user)
+{
+	RecordList list = { 0 };
+	chiaki_mutex_init(&list.block, false);
+	chiaki_mutex_lock(&list.block);
+	ChiakiLogAsync async;
+	ChiakiErrorCode err = chiaki_log_async_init(&async, CHIAKI_LOG_ALL, 4, record_cb, &list);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	ChiakiLog *log = chiaki_log_async_get_log(&async);
+
+	// the writer is stuck in the callback of the first record, which keeps its slot occupied
+	for(int i=0; i<6; i++)
+		CHIAKI_LOGI(log, "msg %d", i);
+	munit_assert_uint64(chiaki_log_async_get_dropped(&async), ==, 2);
+
+	chiaki_mutex_unlock(&list.block);
+	chiaki_log_async_fini(&async);
+	chiaki_mutex_fini(&list.block);
+
+	munit_assert_size(list.count, ==, 5);
+	for(int i=0; i<4; i++)
+	{
+		char expected[16];
+		snprintf(expected, sizeof(expected), "msg %d", i);
+		munit_assert_string_equal(list.msg[i], expected);
+	}
+	munit_assert_int(list.level[4], ==, CHIAKI_LOG_WARNING);
+	munit_assert_not_null(strstr(list.msg[4], "dropped 2 messages"));
+	return MUNIT_OK;
+}
+
+static MunitResult test_truncate(const MunitParameter params[], void *user)
+{
+	RecordList list = { 0 };
+	chiaki_mutex_init(&list.block, false);
+	ChiakiLogAsync async;
+	ChiakiErrorCode err = chiaki_log_async_init(&async, CHIAKI_LOG_ALL, 4, record_cb, &list);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	char msg[CHIAKI_LOG_ASYNC_MSG_SIZE * 2];
+	memset(msg, 'a', sizeof(msg) - 1);
+	msg[sizeof(msg) - 1] = '\0';
+	CHIAKI_LOGI(chiaki_log_async_get_log(&async), "%s", msg);
+	// pushed preformatted, e.g. by a sniffer forwarding into it
+	chiaki_log_async_cb(CHIAKI_LOG_INFO, msg, &async);
+
+	chiaki_log_async_fini(&async);
+	chiaki_mutex_fini(&list.block);
+
+	munit_assert_size(list.count, ==, 2);
+	for(size_t i=0; i<2; i++)
+	{
+		munit_assert_size(strlen(list.msg[i]), ==, CHIAKI_LOG_ASYNC_MSG_SIZE - 1);
+		munit_assert_string_equal(list.msg[i] + CHIAKI_LOG_ASYNC_MSG_SIZE - 4, "...");
+	}
+	return MUNIT_OK;
+}
+
+MunitTest tests_log_async[] = {
+	{
+		"/order",
+		test_order,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/overflow",
+		test_overflow,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/truncate",
+		test_truncate,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -2,6 +2,8 @@
 
 #include <munit.h>
 
+#include <chiaki/config.h>
+
 extern MunitTest tests_seq_num[];
 extern MunitTest tests_key_state[];
 extern MunitTest tests_reorder_queue[];
@@ -12,6 +14,24 @@ extern MunitTest tests_takion[];
 extern MunitTest tests_fec[];
 extern MunitTest tests_regist[];
 extern MunitTest tests_bitstream[];
+extern MunitTest tests_audio_jitter_buffer[];
+extern MunitTest tests_audio_ring[];
+extern MunitTest tests_congestion_control[];
+extern MunitTest tests_packet_stats[];
+extern MunitTest tests_network_profile[];
+extern MunitTest tests_discovery_service[];
+extern MunitTest tests_discovery[];
+extern MunitTest tests_stunclient[];
+extern MunitTest tests_retransmitqueue[];
+extern MunitTest tests_log_async[];
+extern MunitTest tests_trace[];
+extern MunitTest tests_thread_placement[];
+extern MunitTest tests_thread_pool[];
+extern MunitTest tests_timer_service[];
+extern MunitTest tests_replay[];
+#if CHIAKI_LIB_ENABLE_OPUS
+extern MunitTest tests_opus_decoder[];
+#endif
 
 static MunitSuite suites[] = {
 	{
@@ -84,6 +104,120 @@ static MunitSuite suites[] = {
 		1,
 		MUNIT_SUITE_OPTION_NONE
 	},
+	{
+		"/audio_jitter_buffer",
+		tests_audio_jitter_buffer,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/audio_ring",
+		tests_audio_ring,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/congestion_control",
+		tests_congestion_control,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/packet_stats",
+		tests_packet_stats,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/network_profile",
+		tests_network_profile,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/discovery_service",
+		tests_discovery_service,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/discovery",
+		tests_discovery,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/stunclient",
+		tests_stunclient,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/retransmitqueue",
+		tests_retransmitqueue,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/log_async",
+		tests_log_async,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/trace",
+		tests_trace,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/thread_placement",
+		tests_thread_placement,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/thread_pool",
+		tests_thread_pool,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/timer_service",
+		tests_timer_service,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/replay",
+		tests_replay,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+#if CHIAKI_LIB_ENABLE_OPUS
+	{
+		"/opus_decoder",
+		tests_opus_decoder,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+#endif
 	{ NULL, NULL, NULL, 0, MUNIT_SUITE_OPTION_NONE }
 };
 
@@ -0,0 +1,215 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/networkprofile.h>
+
+#include <string.h>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#endif
+
+#include "test_log.h"
+
+#define DAY (24 * 60 * 60)
+
+static MunitResult test_freshness(const MunitParameter params[], void *user)
+{
+	uint64_t now = 1700000000;
+	ChiakiNetworkProfile profile = { 0 };
+	profile.mtu_in = 1454;
+	profile.mtu_out = 1454;
+	profile.rtt_us = 2000;
+
+	munit_assert_int(chiaki_network_profile_freshness(NULL, now), ==, CHIAKI_NETWORK_PROFILE_MISSING);
+
+	profile.measured_at = now - 60;
+	munit_assert_int(chiaki_network_profile_freshness(&profile, now), ==, CHIAKI_NETWORK_PROFILE_FRESH);
+
+	profile.measured_at = now - 2 * DAY;
+	munit_assert_int(chiaki_network_profile_freshness(&profile, now), ==, CHIAKI_NETWORK_PROFILE_STALE);
+
+	// a recent validation keeps an older measurement fresh
+	profile.validated_at = now - 60;
+	munit_assert_int(chiaki_network_profile_freshness(&profile, now), ==, CHIAKI_NETWORK_PROFILE_FRESH);
+
+	// but not forever
+	profile.measured_at = now - 31 * DAY;
+	munit_assert_int(chiaki_network_profile_freshness(&profile, now), ==, CHIAKI_NETWORK_PROFILE_EXPIRED);
+
+	// clock went backwards
+	profile.measured_at = now + 60;
+	profile.validated_at = 0;
+	munit_assert_int(chiaki_network_profile_freshness(&profile, now), ==, CHIAKI_NETWORK_PROFILE_EXPIRED);
+
+	profile.measured_at = now;
+	profile.mtu_out = 0;
+	munit_assert_int(chiaki_network_profile_freshness(&profile, now), ==, CHIAKI_NETWORK_PROFILE_MISSING);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_key(const MunitParameter params[], void *user)
+{
+	struct sockaddr_in local = { 0 };
+	local.sin_family = AF_INET;
+	inet_pton(AF_INET, "192.168.1.10", &local.sin_addr);
+	struct sockaddr_in remote = { 0 };
+	remote.sin_family = AF_INET;
+	inet_pton(AF_INET, "192.168.1.42", &remote.sin_addr);
+
+	uint8_t console_a[0x10] = { 1, 2, 3 };
+	uint8_t console_b[0x10] = { 1, 2, 4 };
+
+	char key_a[CHIAKI_NETWORK_PROFILE_KEY_SIZE];
+	char key_b[CHIAKI_NETWORK_PROFILE_KEY_SIZE];
+	ChiakiErrorCode err = chiaki_network_profile_format_key(key_a, sizeof(key_a), console_a, sizeof(console_a), (struct sockaddr *)&local, (struct sockaddr *)&remote);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(strlen(key_a), ==, 16 + 1 + strlen("192.168.1.10") + 1 + strlen("192.168.1.42"));
+	munit_assert_string_equal(key_a + 16, "/192.168.1.10/192.168.1.42");
+
+	err = chiaki_network_profile_format_key(key_b, sizeof(key_b), console_b, sizeof(console_b), (struct sockaddr *)&local, (struct sockaddr *)&remote);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(memcmp(key_a, key_b, 16), !=, 0);
+
+	// different local interface
+	inet_pton(AF_INET, "10.0.0.2", &local.sin_addr);
+	err = chiaki_network_profile_format_key(key_b, sizeof(key_b), console_a, sizeof(console_a), (struct sockaddr *)&local, (struct sockaddr *)&remote);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(strcmp(key_a, key_b), !=, 0);
+
+	err = chiaki_network_profile_format_key(key_b, 20, console_a, sizeof(console_a), (struct sockaddr *)&local, (struct sockaddr *)&remote);
+	munit_assert_int(err, ==, CHIAKI_ERR_BUF_TOO_SMALL);
+
+	return MUNIT_OK;
+}
+
+typedef struct store_t
+{
+	bool present;
+	ChiakiNetworkProfile profile;
+	unsigned int stores;
+} Store;
+
+static bool store_load(const char *key, ChiakiNetworkProfile *profile, void *user)
+{
+	Store *store = user;
+	if(!store->present)
+		return false;
+	*profile = store->profile;
+	return true;
+}
+
+static void store_store(const char *key, const ChiakiNetworkProfile *profile, void *user)
+{
+	Store *store = user;
+	store->stores++;
+	store->present = profile != NULL;
+	if(profile)
+		store->profile = *profile;
+}
+
+static void cache_init(ChiakiNetworkProfileCache *cache, Store *store)
+{
+	chiaki_network_profile_cache_init(cache, get_test_log());
+	cache->load_cb = store_load;
+	cache->store_cb = store_store;
+	cache->cb_user = store;
+}
+
+static MunitResult test_cache(const MunitParameter params[], void *user)
+{
+	Store store = { 0 };
+	ChiakiNetworkProfileCache cache;
+	cache_init(&cache, &store);
+
+	// first connect measures and stores
+	ChiakiNetworkProfile profile;
+	munit_assert_int(chiaki_network_profile_cache_lookup(&cache, "key", &profile), ==, CHIAKI_NETWORK_PROFILE_MISSING);
+	chiaki_network_profile_cache_measured(&cache, 1400, 1300, 3000);
+	munit_assert_true(store.present);
+	munit_assert_uint32(store.profile.mtu_in, ==, 1400);
+	munit_assert_uint32(store.profile.mtu_out, ==, 1300);
+
+	// reconnect skips senkusha, the healthy stream confirms the profile
+	cache_init(&cache, &store);
+	munit_assert_int(chiaki_network_profile_cache_lookup(&cache, "key", &profile), ==, CHIAKI_NETWORK_PROFILE_FRESH);
+	munit_assert_uint64(profile.rtt_us, ==, 3000);
+	chiaki_network_profile_cache_skipped(&cache);
+
+	ChiakiPacketStats stats;
+	chiaki_packet_stats_init(&stats);
+	uint64_t now_ms = 1000000;
+	chiaki_network_profile_cache_stream_started(&cache, now_ms);
+	unsigned int stores = store.stores;
+	for(int i=0; i<CHIAKI_NETWORK_PROFILE_VALIDATE_MS / 100; i++, now_ms += 100)
+	{
+		chiaki_packet_stats_push_generation_at(&stats, 50, 1, now_ms);
+		chiaki_network_profile_cache_stream_check(&cache, &stats, now_ms);
+	}
+	munit_assert_uint(store.stores, ==, stores);
+	chiaki_network_profile_cache_stream_check(&cache, &stats, now_ms);
+	munit_assert_uint(store.stores, ==, stores + 1);
+	munit_assert_true(store.present);
+	munit_assert_uint64(store.profile.validated_at, !=, 0);
+	chiaki_network_profile_cache_stream_stopped(&cache, true);
+	munit_assert_true(store.present);
+	chiaki_packet_stats_fini(&stats);
+
+	// the route changed and the cached MTU now drops most packets
+	cache_init(&cache, &store);
+	munit_assert_int(chiaki_network_profile_cache_lookup(&cache, "key", &profile), ==, CHIAKI_NETWORK_PROFILE_FRESH);
+	chiaki_network_profile_cache_skipped(&cache);
+	chiaki_packet_stats_init(&stats);
+	chiaki_network_profile_cache_stream_started(&cache, now_ms);
+	for(int i=0; i<=CHIAKI_NETWORK_PROFILE_VALIDATE_MS / 100; i++, now_ms += 100)
+	{
+		chiaki_packet_stats_push_generation_at(&stats, 10, 40, now_ms);
+		chiaki_network_profile_cache_stream_check(&cache, &stats, now_ms);
+	}
+	munit_assert_false(store.present);
+	chiaki_packet_stats_fini(&stats);
+
+	// a stream that fails before it was validated removes the profile too
+	chiaki_network_profile_cache_measured(&cache, 1400, 1300, 3000);
+	cache_init(&cache, &store);
+	munit_assert_int(chiaki_network_profile_cache_lookup(&cache, "key", &profile), ==, CHIAKI_NETWORK_PROFILE_FRESH);
+	chiaki_network_profile_cache_skipped(&cache);
+	chiaki_network_profile_cache_stream_stopped(&cache, false);
+	munit_assert_true(store.present);
+	chiaki_network_profile_cache_skipped(&cache);
+	chiaki_network_profile_cache_stream_stopped(&cache, true);
+	munit_assert_false(store.present);
+
+	return MUNIT_OK;
+}
+
+MunitTest tests_network_profile[] = {
+	{
+		"/freshness",
+		test_freshness,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/key",
+		test_key,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/cache",
+		test_cache,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
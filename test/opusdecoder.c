@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/opusdecoder.h>
+
+#include "test_log.h"
+
+#include <string.h>
+
+#define PACKET_SIZE 40
+
+/**
+ * SILK-only, narrowband, 20ms, mono, the first byte of the frame holds the VAD and LBRR flags
+ */
+static void make_silk_packet(uint8_t *buf, bool lbrr)
+{
+	memset(buf, 0x5a, PACKET_SIZE);
+	buf[0] = 0x08; // config 1, mono, one frame
+	buf[1] = lbrr ? 0xc0 : 0x80;
+}
+
+static void push_frame(ChiakiAudioSink *sink, ChiakiSeqNum16 frame_index, bool lbrr)
+{
+	uint8_t buf[PACKET_SIZE];
+	make_silk_packet(buf, lbrr);
+	sink->frame_cb(buf, sizeof(buf), frame_index, sink->user);
+}
+
+static MunitResult test_conceal_without_lbrr(const MunitParameter params[], void *user)
+{
+	ChiakiOpusDecoder decoder;
+	chiaki_opus_decoder_init(&decoder, get_test_log());
+	ChiakiAudioSink sink;
+	chiaki_opus_decoder_get_sink(&decoder, &sink);
+
+	ChiakiAudioHeader header = { 0 };
+	header.channels = 2;
+	header.bits = 16;
+	header.rate = 48000;
+	header.frame_size = 960;
+	sink.header_cb(&header, sink.user);
+	munit_assert_not_null(decoder.opus_decoder);
+
+	push_frame(&sink, 0, false);
+	// frame 1 is missing and frame 2 has no fec data for it
+	push_frame(&sink, 2, false);
+
+	ChiakiOpusDecoderStats stats;
+	chiaki_opus_decoder_get_stats(&decoder, &stats);
+	munit_assert_uint64(stats.frames_decoded, ==, 2);
+	munit_assert_uint64(stats.frames_concealed, ==, 1);
+	munit_assert_uint64(stats.frames_recovered, ==, 0);
+
+	// frame 3 is missing, but frame 4 carries it
+	push_frame(&sink, 4, true);
+	chiaki_opus_decoder_get_stats(&decoder, &stats);
+	munit_assert_uint64(stats.frames_decoded, ==, 3);
+	munit_assert_uint64(stats.frames_concealed, ==, 1);
+	munit_assert_uint64(stats.frames_recovered, ==, 1);
+
+	chiaki_opus_decoder_fini(&decoder);
+	return MUNIT_OK;
+}
+
+MunitTest tests_opus_decoder[] = {
+	{
+		"/conceal_without_lbrr",
+		test_conceal_without_lbrr,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,144 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/packetstats.h>
+
+static MunitResult test_seq(const MunitParameter params[], void *user)
+{
+	ChiakiPacketStats stats;
+	chiaki_packet_stats_init(&stats);
+
+	uint64_t now_ms = 1000000;
+	// starting close to the wrap-around
+	chiaki_packet_stats_push_seq_at(&stats, 0xfffe, now_ms);
+	chiaki_packet_stats_push_seq_at(&stats, 0xffff, now_ms);
+	// 0 and 1 lost
+	chiaki_packet_stats_push_seq_at(&stats, 2, now_ms);
+	// 3 lost, arrives late
+	chiaki_packet_stats_push_seq_at(&stats, 4, now_ms);
+	chiaki_packet_stats_push_seq_at(&stats, 3, now_ms);
+	// 5 to 9 lost
+	chiaki_packet_stats_push_seq_at(&stats, 10, now_ms);
+
+	uint64_t received, lost;
+	chiaki_packet_stats_get_window(&stats, CHIAKI_PACKET_STATS_WINDOW_SESSION, now_ms, &received, &lost);
+	munit_assert_uint64(received, ==, 6);
+	munit_assert_uint64(lost, ==, 7);
+
+	uint64_t histogram[CHIAKI_PACKET_STATS_BURST_BUCKETS_COUNT];
+	chiaki_packet_stats_get_burst_histogram(&stats, histogram);
+	munit_assert_uint64(histogram[0], ==, 1); // 3
+	munit_assert_uint64(histogram[1], ==, 1); // 0, 1
+	munit_assert_uint64(histogram[2], ==, 1); // 5 to 9
+	munit_assert_uint64(histogram[3], ==, 0);
+
+	chiaki_packet_stats_fini(&stats);
+	return MUNIT_OK;
+}
+
+static MunitResult test_cursors(const MunitParameter params[], void *user)
+{
+	ChiakiPacketStats stats;
+	chiaki_packet_stats_init(&stats);
+
+	ChiakiPacketStatsCursor a = { 0 };
+	ChiakiPacketStatsCursor b = { 0 };
+	uint64_t received, lost;
+
+	chiaki_packet_stats_push_generation_at(&stats, 10, 2, 0);
+	chiaki_packet_stats_get_since(&stats, &a, &received, &lost);
+	munit_assert_uint64(received, ==, 10);
+	munit_assert_uint64(lost, ==, 2);
+
+	chiaki_packet_stats_push_generation_at(&stats, 20, 0, 0);
+	chiaki_packet_stats_get_since(&stats, &a, &received, &lost);
+	munit_assert_uint64(received, ==, 20);
+	munit_assert_uint64(lost, ==, 0);
+
+	// independent of a
+	chiaki_packet_stats_get_since(&stats, &b, &received, &lost);
+	munit_assert_uint64(received, ==, 30);
+	munit_assert_uint64(lost, ==, 2);
+
+	// legacy reset only affects chiaki_packet_stats_get()
+	chiaki_packet_stats_get(&stats, true, &received, &lost);
+	munit_assert_uint64(received, ==, 30);
+	chiaki_packet_stats_push_generation_at(&stats, 5, 1, 0);
+	chiaki_packet_stats_get(&stats, false, &received, &lost);
+	munit_assert_uint64(received, ==, 5);
+	munit_assert_uint64(lost, ==, 1);
+	chiaki_packet_stats_get_window(&stats, CHIAKI_PACKET_STATS_WINDOW_SESSION, 0, &received, &lost);
+	munit_assert_uint64(received, ==, 35);
+	munit_assert_uint64(lost, ==, 3);
+
+	chiaki_packet_stats_fini(&stats);
+	return MUNIT_OK;
+}
+
+static MunitResult test_windows(const MunitParameter params[], void *user)
+{
+	ChiakiPacketStats stats;
+	chiaki_packet_stats_init(&stats);
+
+	// one generation of 10 packets with 1 lost every 100 ms for 20 s
+	uint64_t now_ms = 5000000;
+	for(int i=0; i<200; i++, now_ms += 100)
+		chiaki_packet_stats_push_generation_at(&stats, 9, 1, now_ms);
+	now_ms -= 100;
+
+	uint64_t received, lost;
+	chiaki_packet_stats_get_window(&stats, CHIAKI_PACKET_STATS_WINDOW_1S, now_ms, &received, &lost);
+	munit_assert_uint64(received, ==, 90);
+	munit_assert_uint64(lost, ==, 10);
+	chiaki_packet_stats_get_window(&stats, CHIAKI_PACKET_STATS_WINDOW_10S, now_ms, &received, &lost);
+	munit_assert_uint64(received, ==, 900);
+	munit_assert_uint64(lost, ==, 100);
+	chiaki_packet_stats_get_window(&stats, CHIAKI_PACKET_STATS_WINDOW_SESSION, now_ms, &received, &lost);
+	munit_assert_uint64(received, ==, 1800);
+	munit_assert_uint64(lost, ==, 200);
+
+	// nothing received for a while, the windows empty but the session stays
+	now_ms += 2000;
+	chiaki_packet_stats_get_window(&stats, CHIAKI_PACKET_STATS_WINDOW_1S, now_ms, &received, &lost);
+	munit_assert_uint64(received, ==, 0);
+	chiaki_packet_stats_get_window(&stats, CHIAKI_PACKET_STATS_WINDOW_10S, now_ms, &received, &lost);
+	munit_assert_uint64(received, ==, 720);
+	chiaki_packet_stats_get_window(&stats, CHIAKI_PACKET_STATS_WINDOW_SESSION, now_ms, &received, &lost);
+	munit_assert_uint64(received, ==, 1800);
+
+	uint64_t histogram[CHIAKI_PACKET_STATS_BURST_BUCKETS_COUNT];
+	chiaki_packet_stats_get_burst_histogram(&stats, histogram);
+	munit_assert_uint64(histogram[0], ==, 200);
+
+	chiaki_packet_stats_fini(&stats);
+	return MUNIT_OK;
+}
+
+MunitTest tests_packet_stats[] = {
+	{
+		"/seq",
+		test_seq,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/cursors",
+		test_cursors,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/windows",
+		test_windows,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,273 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/replay.h>
+#include <chiaki/bitstream.h>
+
+#include <string.h>
+
+#define FRAME_SIZE 100
+
+static const uint8_t header[] = { 0, 0, 0, 1, 0x67, 0x42 };
+static const uint8_t header_other[] = { 0, 0, 0, 1, 0x67, 0x64 };
+
+static void push_frame(ChiakiReplay *replay, ChiakiSeqNum16 index, bool idr, uint64_t arrival_us)
+{
+	uint8_t buf[FRAME_SIZE];
+	memset(buf, (uint8_t)index, sizeof(buf));
+	chiaki_replay_push_video_frame(replay, buf, sizeof(buf), index, idr, arrival_us);
+}
+
+static void push_audio(ChiakiReplay *replay, ChiakiSeqNum16 index, uint64_t arrival_us)
+{
+	uint8_t buf[10] = { 0 };
+	chiaki_replay_push_audio_frame(replay, buf, sizeof(buf), index, arrival_us);
+}
+
+static void assert_entry(ChiakiReplayEntry *entry, ChiakiReplayEntryType type, ChiakiSeqNum16 index, bool idr)
+{
+	munit_assert_int(entry->type, ==, type);
+	if(type == CHIAKI_REPLAY_ENTRY_VIDEO_HEADER)
+		return;
+	munit_assert_uint16(entry->index, ==, index);
+	munit_assert(entry->idr == idr);
+}
+
+static MunitResult test_gop(const MunitParameter params[], void *user)
+{
+	ChiakiReplay replay;
+	// room for 8 frames
+	munit_assert_int(chiaki_replay_init(&replay, 0, 8 * FRAME_SIZE), ==, CHIAKI_ERR_SUCCESS);
+
+	ChiakiReplaySnapshot snapshot;
+	munit_assert_int(chiaki_replay_snapshot(&replay, &snapshot), ==, CHIAKI_ERR_UNINITIALIZED);
+
+	chiaki_replay_push_video_header(&replay, header, sizeof(header), 1280, 720);
+	// nothing before the first keyframe
+	push_frame(&replay, 1, false, 1000);
+	push_audio(&replay, 1, 1000);
+	munit_assert_null(replay.head);
+
+	// 3 GOPs of 4 frames, the first one must go
+	uint64_t t = 2000;
+	for(ChiakiSeqNum16 i=2; i<14; i++)
+	{
+		push_frame(&replay, i, (i - 2) % 4 == 0, t);
+		t += 1000;
+	}
+	munit_assert_size(replay.bytes, <=, 8 * FRAME_SIZE);
+
+	munit_assert_int(chiaki_replay_snapshot(&replay, &snapshot), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(snapshot.count, ==, 1 + 8);
+	assert_entry(snapshot.entries[0], CHIAKI_REPLAY_ENTRY_VIDEO_HEADER, 0, false);
+	munit_assert_memory_equal(sizeof(header), snapshot.entries[0]->data, header);
+	for(size_t i=1; i<snapshot.count; i++)
+		assert_entry(snapshot.entries[i], CHIAKI_REPLAY_ENTRY_VIDEO_FRAME, (ChiakiSeqNum16)(5 + i), i == 1 || i == 5);
+	munit_assert_size(snapshot.bytes, ==, sizeof(header) + 8 * FRAME_SIZE);
+
+	// the snapshot holds on to its entries while the ring moves on
+	for(ChiakiSeqNum16 i=14; i<30; i++)
+	{
+		push_frame(&replay, i, (i - 2) % 4 == 0, t);
+		t += 1000;
+	}
+	munit_assert_uint8(snapshot.entries[1]->data[0], ==, 6);
+	munit_assert_uint8(snapshot.entries[8]->data[FRAME_SIZE - 1], ==, 13);
+	chiaki_replay_snapshot_fini(&snapshot);
+
+	chiaki_replay_fini(&replay);
+	return MUNIT_OK;
+}
+
+static MunitResult test_duration(const MunitParameter params[], void *user)
+{
+	ChiakiReplay replay;
+	munit_assert_int(chiaki_replay_init(&replay, 10000, 0), ==, CHIAKI_ERR_SUCCESS);
+	chiaki_replay_push_video_header(&replay, header, sizeof(header), 1280, 720);
+
+	// keyframe every 5ms, one frame and one audio frame per ms
+	for(ChiakiSeqNum16 i=0; i<40; i++)
+	{
+		uint64_t t = 1000 * (uint64_t)i;
+		push_frame(&replay, i, i % 5 == 0, t);
+		push_audio(&replay, i, t);
+	}
+
+	// last arrival is at 39ms, so the ring keeps the GOP at 25ms, which covers 10ms or more, and everything after
+	ChiakiReplaySnapshot snapshot;
+	munit_assert_int(chiaki_replay_snapshot(&replay, &snapshot), ==, CHIAKI_ERR_SUCCESS);
+	assert_entry(snapshot.entries[1], CHIAKI_REPLAY_ENTRY_VIDEO_FRAME, 25, true);
+	assert_entry(snapshot.entries[2], CHIAKI_REPLAY_ENTRY_AUDIO_FRAME, 25, false);
+	munit_assert_size(snapshot.count, ==, 1 + 15 * 2);
+	chiaki_replay_snapshot_fini(&snapshot);
+
+	chiaki_replay_fini(&replay);
+	return MUNIT_OK;
+}
+
+static MunitResult test_profile_switch(const MunitParameter params[], void *user)
+{
+	ChiakiReplay replay;
+	munit_assert_int(chiaki_replay_init(&replay, 0, 6 * FRAME_SIZE + sizeof(header_other)), ==, CHIAKI_ERR_SUCCESS);
+	chiaki_replay_push_video_header(&replay, header, sizeof(header), 1280, 720);
+	push_frame(&replay, 0, true, 0);
+	push_frame(&replay, 1, false, 1000);
+	push_frame(&replay, 2, false, 2000);
+
+	// new parameter sets, frames are dropped until the keyframe
+	chiaki_replay_push_video_header(&replay, header_other, sizeof(header_other), 1920, 1080);
+	push_frame(&replay, 3, false, 3000);
+	push_frame(&replay, 4, true, 4000);
+	push_frame(&replay, 5, false, 5000);
+
+	ChiakiReplaySnapshot snapshot;
+	munit_assert_int(chiaki_replay_snapshot(&replay, &snapshot), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(snapshot.count, ==, 1 + 3 + 1 + 2);
+	assert_entry(snapshot.entries[4], CHIAKI_REPLAY_ENTRY_VIDEO_HEADER, 0, false);
+	munit_assert_uint(snapshot.entries[4]->width, ==, 1920);
+	assert_entry(snapshot.entries[5], CHIAKI_REPLAY_ENTRY_VIDEO_FRAME, 4, true);
+	chiaki_replay_snapshot_fini(&snapshot);
+
+	// first GOP evicted, the ring now starts with the new parameter sets
+	push_frame(&replay, 6, false, 6000);
+	push_frame(&replay, 7, false, 7000);
+	munit_assert_int(chiaki_replay_snapshot(&replay, &snapshot), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(snapshot.count, ==, 1 + 4);
+	munit_assert_memory_equal(sizeof(header_other), snapshot.entries[0]->data, header_other);
+	assert_entry(snapshot.entries[1], CHIAKI_REPLAY_ENTRY_VIDEO_FRAME, 4, true);
+	chiaki_replay_snapshot_fini(&snapshot);
+
+	chiaki_replay_fini(&replay);
+	return MUNIT_OK;
+}
+
+static MunitResult test_overflow(const MunitParameter params[], void *user)
+{
+	ChiakiReplay replay;
+	munit_assert_int(chiaki_replay_init(&replay, 0, 4 * FRAME_SIZE), ==, CHIAKI_ERR_SUCCESS);
+	chiaki_replay_push_video_header(&replay, header, sizeof(header), 1280, 720);
+
+	// a single GOP larger than the ring
+	for(ChiakiSeqNum16 i=0; i<5; i++)
+		push_frame(&replay, i, i == 0, 1000 * i);
+	munit_assert_uint64(replay.overflows, ==, 1);
+	munit_assert_size(replay.bytes, ==, 0);
+	ChiakiReplaySnapshot snapshot;
+	munit_assert_int(chiaki_replay_snapshot(&replay, &snapshot), ==, CHIAKI_ERR_UNINITIALIZED);
+
+	// starts again at the next keyframe
+	push_frame(&replay, 5, false, 5000);
+	push_frame(&replay, 6, true, 6000);
+	munit_assert_int(chiaki_replay_snapshot(&replay, &snapshot), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(snapshot.count, ==, 2);
+	assert_entry(snapshot.entries[1], CHIAKI_REPLAY_ENTRY_VIDEO_FRAME, 6, true);
+	chiaki_replay_snapshot_fini(&snapshot);
+
+	chiaki_replay_fini(&replay);
+	return MUNIT_OK;
+}
+
+static const uint8_t slice_idr[] = { 0x00, 0x00, 0x00, 0x01, 0x65, 0x88, 0x80, 0x82, 0x1f, 0x00 };
+static const uint8_t slice_i_non_idr[] = { 0x00, 0x00, 0x00, 0x01, 0x21, 0x88, 0x80, 0x3f, 0xff, 0xff };
+static const uint8_t slice_p[] = { 0x00, 0x00, 0x00, 0x01, 0x41, 0x9a, 0x04, 0x44, 0x3f, 0x41 };
+
+/**
+ * Push a frame starting with slice, flagged the way the video receiver does
+ */
+static void push_slice(ChiakiReplay *replay, ChiakiBitstream *bitstream, const uint8_t *slice_data, size_t slice_size,
+		ChiakiSeqNum16 index, uint64_t arrival_us)
+{
+	uint8_t buf[FRAME_SIZE];
+	memset(buf, 0xff, sizeof(buf));
+	memcpy(buf, slice_data, slice_size);
+	ChiakiBitstreamSlice slice;
+	munit_assert(chiaki_bitstream_slice(bitstream, buf, sizeof(buf), &slice));
+	chiaki_replay_push_video_frame(replay, buf, sizeof(buf), index, slice.idr, arrival_us);
+}
+
+static MunitResult test_non_idr_i(const MunitParameter params[], void *user)
+{
+	ChiakiBitstream bitstream;
+	chiaki_bitstream_init(&bitstream, NULL, CHIAKI_CODEC_H264);
+	bitstream.h264.sps.log2_max_frame_num_minus4 = 3;
+
+	ChiakiReplay replay;
+	munit_assert_int(chiaki_replay_init(&replay, 0, 4 * FRAME_SIZE), ==, CHIAKI_ERR_SUCCESS);
+	chiaki_replay_push_video_header(&replay, header, sizeof(header), 1280, 720);
+
+	// intra refresh can't start the ring
+	push_slice(&replay, &bitstream, slice_i_non_idr, sizeof(slice_i_non_idr), 0, 0);
+	munit_assert_null(replay.head);
+
+	// nor split a GOP, so one that outgrows the ring is dropped as a whole
+	push_slice(&replay, &bitstream, slice_idr, sizeof(slice_idr), 1, 1000);
+	push_slice(&replay, &bitstream, slice_p, sizeof(slice_p), 2, 2000);
+	push_slice(&replay, &bitstream, slice_i_non_idr, sizeof(slice_i_non_idr), 3, 3000);
+	push_slice(&replay, &bitstream, slice_p, sizeof(slice_p), 4, 4000);
+	ChiakiReplaySnapshot snapshot;
+	munit_assert_int(chiaki_replay_snapshot(&replay, &snapshot), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(snapshot.count, ==, 1 + 4);
+	assert_entry(snapshot.entries[1], CHIAKI_REPLAY_ENTRY_VIDEO_FRAME, 1, true);
+	assert_entry(snapshot.entries[3], CHIAKI_REPLAY_ENTRY_VIDEO_FRAME, 3, false);
+	chiaki_replay_snapshot_fini(&snapshot);
+
+	push_slice(&replay, &bitstream, slice_p, sizeof(slice_p), 5, 5000);
+	munit_assert_uint64(replay.overflows, ==, 1);
+	munit_assert_int(chiaki_replay_snapshot(&replay, &snapshot), ==, CHIAKI_ERR_UNINITIALIZED);
+
+	push_slice(&replay, &bitstream, slice_i_non_idr, sizeof(slice_i_non_idr), 6, 6000);
+	munit_assert_null(replay.head);
+	push_slice(&replay, &bitstream, slice_idr, sizeof(slice_idr), 7, 7000);
+	munit_assert_int(chiaki_replay_snapshot(&replay, &snapshot), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(snapshot.count, ==, 2);
+	assert_entry(snapshot.entries[1], CHIAKI_REPLAY_ENTRY_VIDEO_FRAME, 7, true);
+	chiaki_replay_snapshot_fini(&snapshot);
+
+	chiaki_replay_fini(&replay);
+	return MUNIT_OK;
+}
+
+MunitTest tests_replay[] = {
+	{
+		"/gop",
+		test_gop,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/duration",
+		test_duration,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/profile_switch",
+		test_profile_switch,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/overflow",
+		test_overflow,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/non_idr_i",
+		test_non_idr_i,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,257 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/retransmitqueue.h>
+
+#include <stdlib.h>
+
+#define EXPIRE_RECORD_MAX 16
+
+typedef struct expire_record_t
+{
+	size_t resends;
+	size_t give_ups;
+	uint32_t seq_num[EXPIRE_RECORD_MAX];
+	ChiakiRetransmitAction action[EXPIRE_RECORD_MAX];
+	size_t count;
+} ExpireRecord;
+
+static void expire_cb(ChiakiRetransmitEntry *entry, ChiakiRetransmitAction action, void *user)
+{
+	ExpireRecord *record = user;
+	if(action == CHIAKI_RETRANSMIT_ACTION_RESEND)
+		record->resends++;
+	else
+		record->give_ups++;
+	if(record->count < EXPIRE_RECORD_MAX)
+	{
+		record->seq_num[record->count] = entry->seq_num;
+		record->action[record->count] = action;
+		record->count++;
+	}
+}
+
+static void config_default(ChiakiRetransmitConfig *config)
+{
+	config->seq_num_16 = false;
+	config->rto_initial_ms = 200;
+	config->rto_min_ms = 100;
+	config->rto_max_ms = 1000;
+	config->give_up_ms = 5000;
+}
+
+static MunitResult test_push_ack(const MunitParameter params[], void *user)
+{
+	ChiakiRetransmitConfig config;
+	config_default(&config);
+	ChiakiRetransmitQueue queue;
+	ChiakiErrorCode err = chiaki_retransmit_queue_init(&queue, 4, &config);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	for(uint32_t i=0; i<4; i++)
+	{
+		err = chiaki_retransmit_queue_push(&queue, 100 + i, malloc(8), 8, 1000);
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	}
+	munit_assert_size(queue.count, ==, 4);
+
+	// full
+	uint8_t *buf = malloc(8);
+	err = chiaki_retransmit_queue_push(&queue, 104, buf, 8, 1000);
+	munit_assert_int(err, ==, CHIAKI_ERR_OVERFLOW);
+	free(buf);
+
+	// duplicate
+	chiaki_retransmit_queue_ack(&queue, 103, 1010);
+	buf = malloc(8);
+	err = chiaki_retransmit_queue_push(&queue, 101, buf, 8, 1000);
+	munit_assert_int(err, ==, CHIAKI_ERR_INVALID_DATA);
+	free(buf);
+
+	// selective ack leaves the older ones alone
+	munit_assert(chiaki_retransmit_queue_ack(&queue, 102, 1020));
+	munit_assert(!chiaki_retransmit_queue_ack(&queue, 102, 1020));
+	munit_assert_size(queue.count, ==, 2);
+	munit_assert_not_null(chiaki_retransmit_queue_find(&queue, 100));
+	munit_assert_not_null(chiaki_retransmit_queue_find(&queue, 101));
+	munit_assert_null(chiaki_retransmit_queue_find(&queue, 102));
+
+	// freed entries are reused
+	err = chiaki_retransmit_queue_push(&queue, 104, malloc(8), 8, 1030);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	err = chiaki_retransmit_queue_push(&queue, 105, malloc(8), 8, 1030);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	uint32_t acked[4];
+	size_t acked_count = chiaki_retransmit_queue_ack_cumulative(&queue, 104, 1040, acked);
+	munit_assert_size(acked_count, ==, 3);
+	munit_assert_uint32(acked[0], ==, 100);
+	munit_assert_uint32(acked[1], ==, 101);
+	munit_assert_uint32(acked[2], ==, 104);
+	munit_assert_size(queue.count, ==, 1);
+	munit_assert_not_null(chiaki_retransmit_queue_find(&queue, 105));
+
+	// fini frees the rest
+	chiaki_retransmit_queue_fini(&queue);
+	return MUNIT_OK;
+}
+
+static MunitResult test_ack_cumulative_wrap(const MunitParameter params[], void *user)
+{
+	ChiakiRetransmitConfig config;
+	config_default(&config);
+	config.seq_num_16 = true;
+	ChiakiRetransmitQueue queue;
+	ChiakiErrorCode err = chiaki_retransmit_queue_init(&queue, 8, &config);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	// pushed out of order and across the 16 bit wrap-around
+	uint16_t nums[] = { 0xfffe, 0x0001, 0xffff, 0x0000, 0x0003 };
+	for(size_t i=0; i<sizeof(nums) / sizeof(nums[0]); i++)
+	{
+		err = chiaki_retransmit_queue_push(&queue, nums[i], malloc(8), 8, 0);
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	}
+	munit_assert(!queue.ordered);
+
+	size_t acked_count = chiaki_retransmit_queue_ack_cumulative(&queue, 0x0001, 10, NULL);
+	munit_assert_size(acked_count, ==, 4);
+	munit_assert_size(queue.count, ==, 1);
+	munit_assert_not_null(chiaki_retransmit_queue_find(&queue, 0x0003));
+
+	chiaki_retransmit_queue_fini(&queue);
+	return MUNIT_OK;
+}
+
+static MunitResult test_expire_backoff(const MunitParameter params[], void *user)
+{
+	ChiakiRetransmitConfig config;
+	config_default(&config);
+	ChiakiRetransmitQueue queue;
+	ChiakiErrorCode err = chiaki_retransmit_queue_init(&queue, 4, &config);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	munit_assert_uint64(chiaki_retransmit_queue_next_timeout_ms(&queue, 0), ==, UINT64_MAX);
+
+	err = chiaki_retransmit_queue_push(&queue, 1, malloc(8), 8, 1000);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	err = chiaki_retransmit_queue_push(&queue, 2, malloc(8), 8, 1050);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_uint64(chiaki_retransmit_queue_next_timeout_ms(&queue, 1100), ==, 100);
+
+	ExpireRecord record = { 0 };
+	munit_assert_size(chiaki_retransmit_queue_expire(&queue, 1199, expire_cb, &record), ==, 0);
+
+	// first timer after the initial rto
+	munit_assert_size(chiaki_retransmit_queue_expire(&queue, 1200, expire_cb, &record), ==, 1);
+	munit_assert_size(record.resends, ==, 1);
+	munit_assert_uint32(record.seq_num[0], ==, 1);
+	ChiakiRetransmitEntry *entry = chiaki_retransmit_queue_find(&queue, 1);
+	munit_assert_not_null(entry);
+	munit_assert_uint64(entry->tries, ==, 1);
+	munit_assert_uint64(entry->rto_ms, ==, 400);
+	munit_assert_uint64(entry->deadline_ms, ==, 1600);
+
+	munit_assert_size(chiaki_retransmit_queue_expire(&queue, 1250, expire_cb, &record), ==, 1);
+	munit_assert_uint32(record.seq_num[1], ==, 2);
+	munit_assert_uint64(chiaki_retransmit_queue_next_timeout_ms(&queue, 1250), ==, 350);
+
+	// backoff is capped at rto_max_ms, also when expiring late past a full wheel revolution
+	uint64_t now = 1600;
+	for(size_t i=0; i<4; i++)
+	{
+		chiaki_retransmit_queue_expire(&queue, now, expire_cb, &record);
+		now = entry->deadline_ms;
+	}
+	munit_assert_uint64(entry->rto_ms, ==, 1000);
+	munit_assert_size(record.give_ups, ==, 0);
+
+	// give up once give_up_ms passed since the first send
+	chiaki_retransmit_queue_expire(&queue, 6100, expire_cb, &record);
+	munit_assert_size(record.give_ups, ==, 2);
+	munit_assert_size(queue.count, ==, 0);
+	munit_assert_uint64(queue.give_ups, ==, 2);
+	munit_assert_uint64(chiaki_retransmit_queue_next_timeout_ms(&queue, 6100), ==, UINT64_MAX);
+
+	chiaki_retransmit_queue_fini(&queue);
+	return MUNIT_OK;
+}
+
+static MunitResult test_rto(const MunitParameter params[], void *user)
+{
+	ChiakiRetransmitConfig config;
+	config_default(&config);
+	ChiakiRetransmitQueue queue;
+	ChiakiErrorCode err = chiaki_retransmit_queue_init(&queue, 4, &config);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_uint64(queue.rto_ms, ==, 200);
+
+	// first sample: srtt = 40ms, rttvar = 20ms => rto = 120ms
+	chiaki_retransmit_queue_push(&queue, 1, malloc(8), 8, 1000);
+	munit_assert(chiaki_retransmit_queue_ack(&queue, 1, 1040));
+	munit_assert_uint64(queue.rtt_samples, ==, 1);
+	munit_assert_uint64(queue.srtt_us, ==, 40000);
+	munit_assert_uint64(queue.rttvar_us, ==, 20000);
+	munit_assert_uint64(queue.rto_ms, ==, 120);
+
+	// new packets use the measured rto
+	chiaki_retransmit_queue_push(&queue, 2, malloc(8), 8, 2000);
+	ChiakiRetransmitEntry *entry = chiaki_retransmit_queue_find(&queue, 2);
+	munit_assert_uint64(entry->rto_ms, ==, 120);
+
+	// re-sent packets give no sample (Karn)
+	ExpireRecord record = { 0 };
+	chiaki_retransmit_queue_expire(&queue, 2120, expire_cb, &record);
+	munit_assert_size(record.resends, ==, 1);
+	munit_assert(chiaki_retransmit_queue_ack(&queue, 2, 2130));
+	munit_assert_uint64(queue.rtt_samples, ==, 1);
+
+	// very low rtt is clamped to rto_min_ms
+	for(uint32_t i=0; i<16; i++)
+	{
+		chiaki_retransmit_queue_push(&queue, 10 + i, malloc(8), 8, 3000 + i * 10);
+		chiaki_retransmit_queue_ack_cumulative(&queue, 10 + i, 3000 + i * 10 + 1, NULL);
+	}
+	munit_assert_uint64(queue.rtt_samples, ==, 17);
+	munit_assert_uint64(queue.rto_ms, ==, 100);
+
+	chiaki_retransmit_queue_fini(&queue);
+	return MUNIT_OK;
+}
+
+MunitTest tests_retransmitqueue[] = {
+	{
+		"/push_ack",
+		test_push_ack,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/ack_cumulative_wrap",
+		test_ack_cumulative_wrap,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/expire_backoff",
+		test_expire_backoff,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/rto",
+		test_rto,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,368 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/remote/stunclient.h>
+#include <chiaki/stoppipe.h>
+#include <chiaki/thread.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#endif
+
+#include "test_log.h"
+
+/**
+ * STUN server on 127.0.0.1 that answers binding requests with the source address,
+ * optionally after a delay or never.
+ */
+typedef struct fake_stun_server_t
+{
+	chiaki_socket_t sock;
+	uint16_t port;
+	bool silent;
+	uint64_t delay_ms;
+	unsigned int requests;
+	ChiakiStopPipe stop_pipe;
+	ChiakiThread thread;
+} FakeStunServer;
+
+static size_t fake_stun_response(const uint8_t *req, const struct sockaddr_in *addr, uint8_t *buf)
+{
+	memset(buf, 0, 32);
+	buf[0] = 0x01; buf[1] = 0x01; // binding response
+	buf[3] = 12; // length
+	memcpy(buf + 4, req + 4, 16); // cookie and transaction id
+	buf[20] = 0x00; buf[21] = 0x20; // XOR-MAPPED-ADDRESS
+	buf[23] = 8;
+	buf[25] = 0x01; // IPv4
+	uint16_t port = ntohs(addr->sin_port) ^ 0x2112;
+	buf[26] = port >> 8;
+	buf[27] = port & 0xff;
+	memcpy(buf + 28, &addr->sin_addr.s_addr, 4);
+	for(size_t i=0; i<4; i++)
+		buf[28 + i] ^= buf[4 + i];
+	return 32;
+}
+
+static void *fake_stun_server_thread_func(void *user)
+{
+	FakeStunServer *server = user;
+	while(chiaki_stop_pipe_select_single(&server->stop_pipe, server->sock, false, UINT64_MAX) == CHIAKI_ERR_SUCCESS)
+	{
+		uint8_t req[64];
+		struct sockaddr_in addr;
+		socklen_t addr_len = sizeof(addr);
+		int n = recvfrom(server->sock, req, sizeof(req), 0, (struct sockaddr *)&addr, &addr_len);
+		if(n != CHIAKI_STUN_REQUEST_SIZE)
+			continue;
+		server->requests++;
+		if(server->silent)
+			continue;
+		if(server->delay_ms && chiaki_stop_pipe_sleep(&server->stop_pipe, server->delay_ms) != CHIAKI_ERR_TIMEOUT)
+			break;
+		uint8_t buf[32];
+		size_t size = fake_stun_response(req, &addr, buf);
+		sendto(server->sock, buf, size, 0, (struct sockaddr *)&addr, addr_len);
+	}
+	return NULL;
+}
+
+static chiaki_socket_t bind_loopback(uint16_t *port)
+{
+	chiaki_socket_t sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if(CHIAKI_SOCKET_IS_INVALID(sock))
+		return sock;
+	struct sockaddr_in addr = { 0 };
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addr_len = sizeof(addr);
+	if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0
+			|| getsockname(sock, (struct sockaddr *)&addr, &addr_len) < 0)
+	{
+		CHIAKI_SOCKET_CLOSE(sock);
+		return CHIAKI_INVALID_SOCKET;
+	}
+	*port = ntohs(addr.sin_port);
+	return sock;
+}
+
+static void fake_stun_server_start(FakeStunServer *server, bool silent, uint64_t delay_ms)
+{
+	memset(server, 0, sizeof(*server));
+	server->silent = silent;
+	server->delay_ms = delay_ms;
+	server->sock = bind_loopback(&server->port);
+	munit_assert_false(CHIAKI_SOCKET_IS_INVALID(server->sock));
+	munit_assert_int(chiaki_stop_pipe_init(&server->stop_pipe), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_thread_create(&server->thread, fake_stun_server_thread_func, server), ==, CHIAKI_ERR_SUCCESS);
+}
+
+static void fake_stun_server_stop(FakeStunServer *server)
+{
+	chiaki_stop_pipe_stop(&server->stop_pipe);
+	chiaki_thread_join(&server->thread, NULL);
+	chiaki_stop_pipe_fini(&server->stop_pipe);
+	CHIAKI_SOCKET_CLOSE(server->sock);
+}
+
+static MunitResult test_parse(const MunitParameter params[], void *user)
+{
+	uint8_t transaction_id[CHIAKI_STUN_TRANSACTION_ID_SIZE];
+	for(size_t i=0; i<sizeof(transaction_id); i++)
+		transaction_id[i] = (uint8_t)i;
+	uint8_t req[CHIAKI_STUN_REQUEST_SIZE];
+	chiaki_stun_request_format(req, transaction_id);
+	munit_assert_uint8(req[0], ==, 0x00);
+	munit_assert_uint8(req[1], ==, 0x01);
+	munit_assert_uint8(req[4], ==, 0x21);
+	munit_assert_uint8(req[7], ==, 0x42);
+
+	struct sockaddr_in addr = { 0 };
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(49152);
+	inet_pton(AF_INET, "203.0.113.7", &addr.sin_addr);
+	uint8_t resp[32];
+	size_t resp_size = fake_stun_response(req, &addr, resp);
+
+	char mapped[CHIAKI_STUN_ADDR_SIZE];
+	uint16_t port;
+	ChiakiErrorCode err = chiaki_stun_response_parse(resp, resp_size, transaction_id, mapped, &port);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_string_equal(mapped, "203.0.113.7");
+	munit_assert_uint16(port, ==, 49152);
+
+	// wrong transaction
+	transaction_id[0] ^= 0xff;
+	err = chiaki_stun_response_parse(resp, resp_size, transaction_id, mapped, &port);
+	munit_assert_int(err, ==, CHIAKI_ERR_INVALID_RESPONSE);
+	transaction_id[0] ^= 0xff;
+
+	// truncated attribute
+	err = chiaki_stun_response_parse(resp, resp_size - 4, transaction_id, mapped, &port);
+	munit_assert_int(err, ==, CHIAKI_ERR_INVALID_DATA);
+	resp[3] = 8;
+	err = chiaki_stun_response_parse(resp, resp_size - 4, transaction_id, mapped, &port);
+	munit_assert_int(err, ==, CHIAKI_ERR_INVALID_DATA);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_first_response_wins(const MunitParameter params[], void *user)
+{
+	FakeStunServer servers[3];
+	fake_stun_server_start(&servers[0], true, 0);
+	fake_stun_server_start(&servers[1], false, 1000);
+	fake_stun_server_start(&servers[2], false, 0);
+
+	ChiakiStunServer list[4];
+	for(size_t i=0; i<3; i++)
+	{
+		list[i].host = "127.0.0.1";
+		list[i].port = servers[i].port;
+	}
+	list[3].host = "127.0.0.1";
+	list[3].port = servers[2].port;
+
+	uint16_t local_port;
+	chiaki_socket_t sock = bind_loopback(&local_port);
+	munit_assert_false(CHIAKI_SOCKET_IS_INVALID(sock));
+
+	ChiakiStunResult result;
+	size_t results_count;
+	ChiakiErrorCode err = chiaki_stun_query(get_test_log(), sock, true, list, 4, &result, 1, &results_count, 2000, NULL);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(results_count, ==, 1);
+	munit_assert_size(result.server_index, >=, 2);
+	munit_assert_string_equal(result.addr, "127.0.0.1");
+	munit_assert_uint16(result.port, ==, local_port);
+	munit_assert_uint64(result.rtt_us, <, 1000 * 1000);
+
+	CHIAKI_SOCKET_CLOSE(sock);
+	for(size_t i=0; i<3; i++)
+		fake_stun_server_stop(&servers[i]);
+	// all of them were asked at once
+	munit_assert_uint(servers[0].requests, >=, 1);
+	munit_assert_uint(servers[1].requests, >=, 1);
+	return MUNIT_OK;
+}
+
+static MunitResult test_multiple_responses(const MunitParameter params[], void *user)
+{
+	// answered servers are replaced by the ones behind them while the silent ones are still retried
+	FakeStunServer servers[6];
+	fake_stun_server_start(&servers[0], false, 300);
+	fake_stun_server_start(&servers[1], true, 0);
+	fake_stun_server_start(&servers[2], false, 0);
+	fake_stun_server_start(&servers[3], true, 0);
+	fake_stun_server_start(&servers[4], false, 0);
+	fake_stun_server_start(&servers[5], false, 0);
+
+	ChiakiStunServer list[6];
+	for(size_t i=0; i<6; i++)
+	{
+		list[i].host = "127.0.0.1";
+		list[i].port = servers[i].port;
+	}
+
+	uint16_t local_port;
+	chiaki_socket_t sock = bind_loopback(&local_port);
+	munit_assert_false(CHIAKI_SOCKET_IS_INVALID(sock));
+
+	ChiakiStunResult results[4];
+	size_t results_count;
+	ChiakiErrorCode err = chiaki_stun_query(get_test_log(), sock, true, list, 6, results, 4, &results_count, 10000, NULL);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(results_count, ==, 4);
+	// ordered by first request, not by arrival
+	munit_assert_size(results[0].server_index, ==, 0);
+	munit_assert_size(results[1].server_index, ==, 2);
+	munit_assert_size(results[2].server_index, ==, 4);
+	munit_assert_size(results[3].server_index, ==, 5);
+	munit_assert_uint64(results[0].rtt_us, >=, 300 * 1000);
+	for(size_t i=0; i<4; i++)
+		munit_assert_uint16(results[i].port, ==, local_port);
+
+	CHIAKI_SOCKET_CLOSE(sock);
+	for(size_t i=0; i<6; i++)
+		fake_stun_server_stop(&servers[i]);
+	munit_assert_uint(servers[1].requests, >=, 1);
+	munit_assert_uint(servers[1].requests, <, CHIAKI_STUN_QUERY_TRIES_MAX);
+	return MUNIT_OK;
+}
+
+static MunitResult test_timeout(const MunitParameter params[], void *user)
+{
+	FakeStunServer server;
+	fake_stun_server_start(&server, true, 0);
+	ChiakiStunServer list = { "127.0.0.1", server.port };
+
+	uint16_t local_port;
+	chiaki_socket_t sock = bind_loopback(&local_port);
+	munit_assert_false(CHIAKI_SOCKET_IS_INVALID(sock));
+
+	ChiakiStunResult result;
+	size_t results_count;
+	ChiakiErrorCode err = chiaki_stun_query(get_test_log(), sock, true, &list, 1, &result, 1, &results_count, 400, NULL);
+	munit_assert_int(err, ==, CHIAKI_ERR_TIMEOUT);
+	munit_assert_size(results_count, ==, 0);
+
+	CHIAKI_SOCKET_CLOSE(sock);
+	fake_stun_server_stop(&server);
+	munit_assert_uint(server.requests, ==, 2);
+	return MUNIT_OK;
+}
+
+static ChiakiStunCacheEntry make_entry(const char *local_addr, uint16_t local_port, uint16_t port)
+{
+	ChiakiStunCacheEntry entry = { 0 };
+	entry.ipv4 = true;
+	snprintf(entry.local_addr, sizeof(entry.local_addr), "%s", local_addr);
+	entry.local_port = local_port;
+	snprintf(entry.addr, sizeof(entry.addr), "%s", "198.51.100.1");
+	entry.port = port;
+	return entry;
+}
+
+static MunitResult test_cache(const MunitParameter params[], void *user)
+{
+	ChiakiStunCache cache;
+	ChiakiErrorCode err = chiaki_stun_cache_init(&cache, 60 * 1000);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	ChiakiStunCacheEntry entry = make_entry("192.168.1.10", 40000, 40000);
+	chiaki_stun_cache_put(&cache, &entry);
+
+	ChiakiStunCacheEntry found;
+	munit_assert_true(chiaki_stun_cache_get(&cache, true, "192.168.1.10", &found));
+	munit_assert_string_equal(found.addr, "198.51.100.1");
+	munit_assert_true(chiaki_stun_cache_entry_port_preserving(&found));
+	// other interface or family means another network
+	munit_assert_false(chiaki_stun_cache_get(&cache, true, "10.0.0.10", &found));
+	munit_assert_false(chiaki_stun_cache_get(&cache, false, "192.168.1.10", &found));
+
+	entry = make_entry("192.168.1.10", 40000, 61000);
+	entry.allocation_increment = 1;
+	chiaki_stun_cache_put(&cache, &entry);
+	munit_assert_true(chiaki_stun_cache_get(&cache, true, "192.168.1.10", &found));
+	munit_assert_false(chiaki_stun_cache_entry_port_preserving(&found));
+	munit_assert_int(found.allocation_increment, ==, 1);
+	munit_assert_size(cache.entries_count, ==, 1);
+
+	// the oldest interface is evicted
+	cache.entries[0].timestamp_ms -= 10;
+	char local_addr[CHIAKI_STUN_ADDR_SIZE];
+	for(int i=0; i<CHIAKI_STUN_CACHE_ENTRIES; i++)
+	{
+		snprintf(local_addr, sizeof(local_addr), "10.0.0.%d", i);
+		entry = make_entry(local_addr, 40000, 40000);
+		chiaki_stun_cache_put(&cache, &entry);
+	}
+	munit_assert_size(cache.entries_count, ==, CHIAKI_STUN_CACHE_ENTRIES);
+	munit_assert_false(chiaki_stun_cache_get(&cache, true, "192.168.1.10", &found));
+	munit_assert_true(chiaki_stun_cache_get(&cache, true, "10.0.0.0", &found));
+
+	chiaki_stun_cache_clear(&cache);
+	munit_assert_false(chiaki_stun_cache_get(&cache, true, "10.0.0.0", &found));
+	chiaki_stun_cache_fini(&cache);
+
+	// expired entries are not returned
+	err = chiaki_stun_cache_init(&cache, 0);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	chiaki_stun_cache_put(&cache, &entry);
+	munit_assert_false(chiaki_stun_cache_get(&cache, true, entry.local_addr, &found));
+	chiaki_stun_cache_fini(&cache);
+
+	return MUNIT_OK;
+}
+
+MunitTest tests_stunclient[] = {
+	{
+		"/parse",
+		test_parse,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/first_response_wins",
+		test_first_response_wins,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/multiple_responses",
+		test_multiple_responses,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/timeout",
+		test_timeout,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/cache",
+		test_cache,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -3,12 +3,10 @@
 #include <munit.h>
 
 #include <chiaki/takion.h>
+#include <chiaki/takionsendbuffer.h>
 #include <chiaki/seqnum.h>
 #include <chiaki/base64.h>
 
-#define CHIAKI_UNIT_TEST
-#include "../lib/src/takionsendbuffer.c"
-
 #include "test_log.h"
 
 
@@ -84,21 +82,12 @@ static bool check_send_buffer_contents(ChiakiTakionSendBuffer *send_buffer, cons
 	if(chiaki_mutex_lock(&send_buffer->mutex) != CHIAKI_ERR_SUCCESS)
 		return false;
 
-	if(send_buffer->packets_count != nums_expected_count)
+	if(send_buffer->queue.count != nums_expected_count)
 		goto fail;
 
 	for(size_t i=0; i<nums_expected_count; i++)
 	{
-		bool found = false;
-		for(size_t j=0; j<send_buffer->packets_count; j++)
-		{
-			if(send_buffer->packets[j].seq_num == nums_expected[i])
-			{
-				found = true;
-				break;
-			}
-		}
-		if(!found)
+		if(!chiaki_retransmit_queue_find(&send_buffer->queue, nums_expected[i]))
 			goto fail;
 	}
 
@@ -166,7 +155,7 @@ static MunitResult test_takion_format_congestion(const MunitParameter params[],
 	static const uint8_t ecdh_secret[] = { 0x00, 0x34, 0xf8, 0x21, 0xc7, 0xd9, 0xde, 0xa9, 0xe9, 0x11, 0xca, 0x5a, 0xd6, 0x7d, 0x11, 0xce, 0x4f, 0x02, 0xb1, 0xce, 0x1e, 0xe7, 0xc3, 0x8d, 0x54, 0x39, 0xfa, 0x64, 0xe3, 0xdb, 0xd8, 0x0d };
 
 	ChiakiGKCrypt gkcrypt;
-	ChiakiErrorCode err = chiaki_gkcrypt_init(&gkcrypt, NULL, 0, 2, handshake_key, ecdh_secret);
+	ChiakiErrorCode err = chiaki_gkcrypt_init(&gkcrypt, NULL, 0, NULL, 0, 2, handshake_key, ecdh_secret);
 	if(err != CHIAKI_ERR_SUCCESS)
 		return MUNIT_ERROR;
 
@@ -0,0 +1,112 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/thread.h>
+
+#include <string.h>
+
+static MunitResult test_cpu_list(const MunitParameter params[], void *user)
+{
+	uint64_t mask;
+	munit_assert_int(chiaki_thread_parse_cpu_list("", &mask), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_uint64(mask, ==, 0);
+	munit_assert_int(chiaki_thread_parse_cpu_list("0", &mask), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_uint64(mask, ==, 1);
+	munit_assert_int(chiaki_thread_parse_cpu_list("2-4, 8,63", &mask), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_uint64(mask, ==, 0x800000000000011cull);
+
+	munit_assert_int(chiaki_thread_parse_cpu_list("64", &mask), ==, CHIAKI_ERR_INVALID_DATA);
+	munit_assert_int(chiaki_thread_parse_cpu_list("4-2", &mask), ==, CHIAKI_ERR_INVALID_DATA);
+	munit_assert_int(chiaki_thread_parse_cpu_list("1;2", &mask), ==, CHIAKI_ERR_INVALID_DATA);
+	munit_assert_int(chiaki_thread_parse_cpu_list("a", &mask), ==, CHIAKI_ERR_INVALID_DATA);
+
+	char buf[32];
+	chiaki_thread_format_cpu_list(0x800000000000011cull, buf, sizeof(buf));
+	munit_assert_string_equal(buf, "2-4,8,63");
+	chiaki_thread_format_cpu_list(0, buf, sizeof(buf));
+	munit_assert_string_equal(buf, "");
+	chiaki_thread_format_cpu_list(0xffffffffffffffffull, buf, sizeof(buf));
+	munit_assert_string_equal(buf, "0-63");
+	// too small, but still terminated
+	chiaki_thread_format_cpu_list(0x15, buf, 4);
+	munit_assert_string_equal(buf, "0,2");
+	return MUNIT_OK;
+}
+
+static void *apply_thread_func(void *user)
+{
+	ChiakiErrorCode *err = user;
+	*err = chiaki_thread_apply_role(CHIAKI_THREAD_ROLE_AUDIO);
+	return NULL;
+}
+
+static MunitResult test_apply(const MunitParameter params[], void *user)
+{
+	ChiakiThreadPlacementConfig config;
+	memset(&config, 0, sizeof(config));
+	munit_assert_int(chiaki_thread_placement_ref(&config), ==, CHIAKI_ERR_SUCCESS);
+
+	// run on separate threads so the test runner keeps its own placement
+	for(int i=0; i<2; i++)
+	{
+		ChiakiErrorCode err = CHIAKI_ERR_UNKNOWN;
+		ChiakiThread thread;
+		munit_assert_int(chiaki_thread_create(&thread, apply_thread_func, &err), ==, CHIAKI_ERR_SUCCESS);
+		munit_assert_int(chiaki_thread_join(&thread, NULL), ==, CHIAKI_ERR_SUCCESS);
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	}
+
+	ChiakiThreadPlacementReport report;
+	chiaki_thread_placement_get_report(&report);
+	munit_assert_uint(report.roles[CHIAKI_THREAD_ROLE_AUDIO].threads, ==, 2);
+	munit_assert_int(report.roles[CHIAKI_THREAD_ROLE_AUDIO].err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(report.roles[CHIAKI_THREAD_ROLE_AUDIO].priority, ==, CHIAKI_THREAD_PRIORITY_DEFAULT);
+	munit_assert_uint(report.roles[CHIAKI_THREAD_ROLE_TAKION].threads, ==, 0);
+	munit_assert_false(report.memory_locked);
+
+	munit_assert_int(chiaki_thread_apply_role(CHIAKI_THREAD_ROLE_COUNT), ==, CHIAKI_ERR_INVALID_DATA);
+
+	// a second reference keeps the config and the report of the first
+	ChiakiThreadPlacementConfig other;
+	memset(&other, 0, sizeof(other));
+	other.roles[CHIAKI_THREAD_ROLE_AUDIO].priority = CHIAKI_THREAD_PRIORITY_HIGH;
+	munit_assert_int(chiaki_thread_placement_ref(&other), ==, CHIAKI_ERR_SUCCESS);
+	chiaki_thread_placement_unref();
+	ChiakiErrorCode err = CHIAKI_ERR_UNKNOWN;
+	ChiakiThread thread;
+	munit_assert_int(chiaki_thread_create(&thread, apply_thread_func, &err), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_thread_join(&thread, NULL), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	chiaki_thread_placement_get_report(&report);
+	munit_assert_uint(report.roles[CHIAKI_THREAD_ROLE_AUDIO].threads, ==, 3);
+	munit_assert_int(report.roles[CHIAKI_THREAD_ROLE_AUDIO].priority, ==, CHIAKI_THREAD_PRIORITY_DEFAULT);
+	chiaki_thread_placement_unref();
+
+	// the next first reference starts a new report
+	munit_assert_int(chiaki_thread_placement_ref(NULL), ==, CHIAKI_ERR_SUCCESS);
+	chiaki_thread_placement_get_report(&report);
+	munit_assert_uint(report.roles[CHIAKI_THREAD_ROLE_AUDIO].threads, ==, 0);
+	chiaki_thread_placement_unref();
+	return MUNIT_OK;
+}
+
+MunitTest tests_thread_placement[] = {
+	{
+		"/cpu_list",
+		test_cpu_list,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/apply",
+		test_apply,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
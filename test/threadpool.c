@@ -0,0 +1,264 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/threadpool.h>
+
+#include <string.h>
+
+#define TASKS_COUNT 1000
+
+typedef struct test_ctx_t
+{
+	ChiakiMutex mutex;
+	ChiakiCond cond;
+	unsigned int done;
+	unsigned int order[4];
+	bool started[4];
+	bool released;
+} TestCtx;
+
+typedef struct test_task_t
+{
+	ChiakiThreadPoolTask task;
+	TestCtx *ctx;
+	unsigned int id;
+} TestTask;
+
+static void ctx_init(TestCtx *ctx)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	munit_assert_int(chiaki_mutex_init(&ctx->mutex, false), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_cond_init(&ctx->cond), ==, CHIAKI_ERR_SUCCESS);
+}
+
+static void ctx_fini(TestCtx *ctx)
+{
+	chiaki_cond_fini(&ctx->cond);
+	chiaki_mutex_fini(&ctx->mutex);
+}
+
+static bool ctx_done_pred(void *user)
+{
+	TestCtx *ctx = user;
+	return ctx->done == 2;
+}
+
+/**
+ * Wait for two tasks without helping, so only the workers can run them.
+ */
+static void ctx_wait_two(TestCtx *ctx)
+{
+	chiaki_mutex_lock(&ctx->mutex);
+	ChiakiErrorCode err = chiaki_cond_timedwait_pred(&ctx->cond, &ctx->mutex, 5000, ctx_done_pred, ctx);
+	chiaki_mutex_unlock(&ctx->mutex);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+}
+
+static chiaki_atomic_uint32_t counter;
+
+static void count_task(void *user)
+{
+	chiaki_atomic_fetch_add_u32(&counter, 1);
+}
+
+static MunitResult test_group_wait(const MunitParameter params[], void *user)
+{
+	ChiakiThreadPool pool;
+	munit_assert_int(chiaki_thread_pool_init(&pool, 3, NULL), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(pool.workers_count, ==, 3);
+
+	ChiakiThreadPoolGroup group;
+	munit_assert_int(chiaki_thread_pool_group_init(&group), ==, CHIAKI_ERR_SUCCESS);
+
+	static ChiakiThreadPoolTask tasks[TASKS_COUNT];
+	counter = 0;
+	for(size_t i=0; i<TASKS_COUNT; i++)
+	{
+		chiaki_thread_pool_task_init(&tasks[i], count_task, NULL, &group);
+		chiaki_thread_pool_submit(&pool, &tasks[i],
+				i % 2 ? CHIAKI_THREAD_POOL_PRIORITY_HIGH : CHIAKI_THREAD_POOL_PRIORITY_NORMAL,
+				chiaki_thread_pool_affinity(&pool));
+	}
+	chiaki_thread_pool_group_wait(&pool, &group);
+	munit_assert_uint32(chiaki_atomic_load_u32(&counter), ==, TASKS_COUNT);
+
+	// tasks without a group are still all run before fini returns
+	for(size_t i=0; i<TASKS_COUNT; i++)
+	{
+		chiaki_thread_pool_task_init(&tasks[i], count_task, NULL, NULL);
+		chiaki_thread_pool_submit(&pool, &tasks[i], CHIAKI_THREAD_POOL_PRIORITY_NORMAL, 0);
+	}
+	chiaki_thread_pool_group_fini(&group);
+	chiaki_thread_pool_fini(&pool);
+	munit_assert_uint32(chiaki_atomic_load_u32(&counter), ==, 2 * TASKS_COUNT);
+	return MUNIT_OK;
+}
+
+static bool released_pred(void *user)
+{
+	TestCtx *ctx = user;
+	return ctx->released;
+}
+
+static void block_task(void *user)
+{
+	TestTask *task = user;
+	TestCtx *ctx = task->ctx;
+	chiaki_mutex_lock(&ctx->mutex);
+	chiaki_cond_timedwait_pred(&ctx->cond, &ctx->mutex, 5000, released_pred, ctx);
+	chiaki_mutex_unlock(&ctx->mutex);
+}
+
+static void order_task(void *user)
+{
+	TestTask *task = user;
+	TestCtx *ctx = task->ctx;
+	chiaki_mutex_lock(&ctx->mutex);
+	ctx->order[ctx->done++] = task->id;
+	chiaki_cond_broadcast(&ctx->cond);
+	chiaki_mutex_unlock(&ctx->mutex);
+}
+
+static MunitResult test_priority(const MunitParameter params[], void *user)
+{
+	ChiakiThreadPool pool;
+	munit_assert_int(chiaki_thread_pool_init(&pool, 1, NULL), ==, CHIAKI_ERR_SUCCESS);
+	TestCtx ctx;
+	ctx_init(&ctx);
+
+	// keep the only worker busy until both are queued
+	TestTask blocker = { .ctx = &ctx, .id = 0 };
+	chiaki_thread_pool_task_init(&blocker.task, block_task, &blocker, NULL);
+	chiaki_thread_pool_submit(&pool, &blocker.task, CHIAKI_THREAD_POOL_PRIORITY_NORMAL, 0);
+
+	TestTask normal = { .ctx = &ctx, .id = 1 };
+	chiaki_thread_pool_task_init(&normal.task, order_task, &normal, NULL);
+	chiaki_thread_pool_submit(&pool, &normal.task, CHIAKI_THREAD_POOL_PRIORITY_NORMAL, 0);
+	TestTask high = { .ctx = &ctx, .id = 2 };
+	chiaki_thread_pool_task_init(&high.task, order_task, &high, NULL);
+	chiaki_thread_pool_submit(&pool, &high.task, CHIAKI_THREAD_POOL_PRIORITY_HIGH, 0);
+
+	chiaki_mutex_lock(&ctx.mutex);
+	ctx.released = true;
+	chiaki_cond_broadcast(&ctx.cond);
+	chiaki_mutex_unlock(&ctx.mutex);
+
+	ctx_wait_two(&ctx);
+	munit_assert_uint(ctx.order[0], ==, 2);
+	munit_assert_uint(ctx.order[1], ==, 1);
+
+	chiaki_thread_pool_fini(&pool);
+	ctx_fini(&ctx);
+	return MUNIT_OK;
+}
+
+static bool other_started_pred(void *user)
+{
+	TestTask *task = user;
+	return task->ctx->started[!task->id];
+}
+
+static void rendezvous_task(void *user)
+{
+	TestTask *task = user;
+	TestCtx *ctx = task->ctx;
+	chiaki_mutex_lock(&ctx->mutex);
+	ctx->started[task->id] = true;
+	chiaki_cond_broadcast(&ctx->cond);
+	// only returns early if the other one runs at the same time
+	if(chiaki_cond_timedwait_pred(&ctx->cond, &ctx->mutex, 5000, other_started_pred, task) == CHIAKI_ERR_SUCCESS)
+		ctx->order[ctx->done] = task->id;
+	ctx->done++;
+	chiaki_cond_broadcast(&ctx->cond);
+	chiaki_mutex_unlock(&ctx->mutex);
+}
+
+static MunitResult test_steal(const MunitParameter params[], void *user)
+{
+	ChiakiThreadPool pool;
+	munit_assert_int(chiaki_thread_pool_init(&pool, 2, NULL), ==, CHIAKI_ERR_SUCCESS);
+	TestCtx ctx;
+	ctx_init(&ctx);
+
+	// both on the same worker's queue, the other one has to steal for them to meet
+	TestTask tasks[2] = { { .ctx = &ctx, .id = 0 }, { .ctx = &ctx, .id = 1 } };
+	for(size_t i=0; i<2; i++)
+	{
+		chiaki_thread_pool_task_init(&tasks[i].task, rendezvous_task, &tasks[i], NULL);
+		chiaki_thread_pool_submit(&pool, &tasks[i].task, CHIAKI_THREAD_POOL_PRIORITY_NORMAL, 42);
+	}
+
+	ctx_wait_two(&ctx);
+	munit_assert_true(ctx.started[0]);
+	munit_assert_true(ctx.started[1]);
+	munit_assert_uint(ctx.order[0] + ctx.order[1], ==, 1);
+
+	chiaki_thread_pool_fini(&pool);
+	ctx_fini(&ctx);
+	return MUNIT_OK;
+}
+
+static MunitResult test_shared(const MunitParameter params[], void *user)
+{
+	ChiakiThreadPool *a = chiaki_thread_pool_shared_ref();
+	munit_assert_not_null(a);
+	ChiakiThreadPool *b = chiaki_thread_pool_shared_ref();
+	munit_assert_ptr_equal(a, b);
+	munit_assert_size(a->workers_count, ==, chiaki_thread_pool_workers_default());
+	munit_assert_uint32(chiaki_thread_pool_affinity(a) + 1, ==, chiaki_thread_pool_affinity(b));
+	chiaki_thread_pool_shared_unref(b);
+
+	ChiakiThreadPoolGroup group;
+	munit_assert_int(chiaki_thread_pool_group_init(&group), ==, CHIAKI_ERR_SUCCESS);
+	ChiakiThreadPoolTask task;
+	counter = 0;
+	chiaki_thread_pool_task_init(&task, count_task, NULL, &group);
+	chiaki_thread_pool_submit(a, &task, CHIAKI_THREAD_POOL_PRIORITY_HIGH, 0);
+	chiaki_thread_pool_group_wait(a, &group);
+	munit_assert_uint32(chiaki_atomic_load_u32(&counter), ==, 1);
+	chiaki_thread_pool_group_fini(&group);
+	chiaki_thread_pool_shared_unref(a);
+
+	// recreated after the last reference is gone
+	a = chiaki_thread_pool_shared_ref();
+	munit_assert_not_null(a);
+	chiaki_thread_pool_shared_unref(a);
+	return MUNIT_OK;
+}
+
+MunitTest tests_thread_pool[] = {
+	{
+		"/group_wait",
+		test_group_wait,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/priority",
+		test_priority,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/steal",
+		test_steal,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/shared",
+		test_shared,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
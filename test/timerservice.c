@@ -0,0 +1,216 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/timerservice.h>
+#include <chiaki/time.h>
+
+#include <string.h>
+
+#define TIMERS_COUNT 4
+
+typedef struct test_ctx_t
+{
+	ChiakiMutex mutex;
+	ChiakiCond cond;
+	ChiakiTimer timers[TIMERS_COUNT];
+	uint64_t deadlines_us[TIMERS_COUNT];
+	uint64_t fired_us[TIMERS_COUNT];
+	unsigned int order[TIMERS_COUNT];
+	unsigned int fired;
+	unsigned int rearm; // times timer 0 re-arms itself from its callback
+} TestCtx;
+
+typedef struct test_timer_t
+{
+	TestCtx *ctx;
+	unsigned int id;
+} TestTimer;
+
+static TestTimer test_timers[TIMERS_COUNT];
+
+static void timer_cb(void *user)
+{
+	TestTimer *timer = user;
+	TestCtx *ctx = timer->ctx;
+	uint64_t now_us = chiaki_time_now_monotonic_us();
+	chiaki_mutex_lock(&ctx->mutex);
+	if(ctx->fired < TIMERS_COUNT)
+	{
+		ctx->fired_us[ctx->fired] = now_us;
+		ctx->order[ctx->fired] = timer->id;
+	}
+	ctx->fired++;
+	if(timer->id == 0 && ctx->rearm)
+	{
+		ctx->rearm--;
+		chiaki_timer_arm(&ctx->timers[0], now_us + 100);
+	}
+	chiaki_cond_broadcast(&ctx->cond);
+	chiaki_mutex_unlock(&ctx->mutex);
+}
+
+static void ctx_init(TestCtx *ctx, ChiakiTimerService *service)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	munit_assert_int(chiaki_mutex_init(&ctx->mutex, false), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_cond_init(&ctx->cond), ==, CHIAKI_ERR_SUCCESS);
+	for(unsigned int i=0; i<TIMERS_COUNT; i++)
+	{
+		test_timers[i].ctx = ctx;
+		test_timers[i].id = i;
+		chiaki_timer_init(&ctx->timers[i], service, timer_cb, &test_timers[i]);
+	}
+}
+
+static void ctx_fini(TestCtx *ctx)
+{
+	for(unsigned int i=0; i<TIMERS_COUNT; i++)
+		chiaki_timer_cancel(&ctx->timers[i]);
+	chiaki_cond_fini(&ctx->cond);
+	chiaki_mutex_fini(&ctx->mutex);
+}
+
+static TestCtx *pred_ctx;
+static unsigned int pred_fired;
+
+static bool fired_pred(void *user)
+{
+	return pred_ctx->fired >= pred_fired;
+}
+
+static void ctx_wait_fired(TestCtx *ctx, unsigned int fired)
+{
+	pred_ctx = ctx;
+	pred_fired = fired;
+	chiaki_mutex_lock(&ctx->mutex);
+	ChiakiErrorCode err = chiaki_cond_timedwait_pred(&ctx->cond, &ctx->mutex, 5000, fired_pred, NULL);
+	chiaki_mutex_unlock(&ctx->mutex);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+}
+
+static MunitResult test_order(const MunitParameter params[], void *user)
+{
+	ChiakiTimerService service;
+	munit_assert_int(chiaki_timer_service_init(&service), ==, CHIAKI_ERR_SUCCESS);
+	TestCtx ctx;
+	ctx_init(&ctx, &service);
+
+	// armed out of order, with sub-millisecond spacing
+	static const uint64_t offsets_us[TIMERS_COUNT] = { 2600, 400, 1900, 1300 };
+	uint64_t now_us = chiaki_time_now_monotonic_us();
+	for(unsigned int i=0; i<TIMERS_COUNT; i++)
+	{
+		ctx.deadlines_us[i] = now_us + offsets_us[i];
+		munit_assert_int(chiaki_timer_arm(&ctx.timers[i], ctx.deadlines_us[i]), ==, CHIAKI_ERR_SUCCESS);
+	}
+
+	ctx_wait_fired(&ctx, TIMERS_COUNT);
+	static const unsigned int order_expected[TIMERS_COUNT] = { 1, 3, 2, 0 };
+	for(unsigned int i=0; i<TIMERS_COUNT; i++)
+	{
+		munit_assert_uint(ctx.order[i], ==, order_expected[i]);
+		// never early
+		munit_assert_uint64(ctx.fired_us[i], >=, ctx.deadlines_us[ctx.order[i]]);
+	}
+
+	ctx_fini(&ctx);
+	chiaki_timer_service_fini(&service);
+	return MUNIT_OK;
+}
+
+static MunitResult test_rearm(const MunitParameter params[], void *user)
+{
+	ChiakiTimerService service;
+	munit_assert_int(chiaki_timer_service_init(&service), ==, CHIAKI_ERR_SUCCESS);
+	TestCtx ctx;
+	ctx_init(&ctx, &service);
+
+	uint64_t now_us = chiaki_time_now_monotonic_us();
+
+	// a later deadline does not replace an earlier one for arm_earlier
+	munit_assert_int(chiaki_timer_arm(&ctx.timers[1], now_us + 20000), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_timer_arm_earlier(&ctx.timers[1], now_us + 60000000), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_uint64(ctx.timers[1].deadline_us, ==, now_us + 20000);
+
+	// but arm does
+	munit_assert_int(chiaki_timer_arm(&ctx.timers[2], now_us + 500), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_timer_arm(&ctx.timers[2], now_us + 60000000), ==, CHIAKI_ERR_SUCCESS);
+
+	// cancelled, never fires
+	munit_assert_int(chiaki_timer_arm(&ctx.timers[3], now_us + 200), ==, CHIAKI_ERR_SUCCESS);
+	chiaki_timer_cancel(&ctx.timers[3]);
+	munit_assert_uint64(ctx.timers[3].deadline_us, ==, CHIAKI_TIMER_DISARMED);
+
+	ctx_wait_fired(&ctx, 1);
+	munit_assert_uint(ctx.order[0], ==, 1);
+
+	// re-armed from its own callback until it runs out
+	chiaki_mutex_lock(&ctx.mutex);
+	ctx.rearm = 2;
+	chiaki_mutex_unlock(&ctx.mutex);
+	munit_assert_int(chiaki_timer_arm(&ctx.timers[0], chiaki_time_now_monotonic_us()), ==, CHIAKI_ERR_SUCCESS);
+	ctx_wait_fired(&ctx, 4);
+	munit_assert_uint(ctx.order[1], ==, 0);
+	munit_assert_uint(ctx.order[2], ==, 0);
+	munit_assert_uint(ctx.order[3], ==, 0);
+
+	chiaki_mutex_lock(&ctx.mutex);
+	munit_assert_uint(ctx.fired, ==, 4);
+	munit_assert_uint64(ctx.timers[2].deadline_us, ==, now_us + 60000000);
+	chiaki_mutex_unlock(&ctx.mutex);
+
+	ctx_fini(&ctx);
+	chiaki_timer_service_fini(&service);
+	return MUNIT_OK;
+}
+
+static MunitResult test_shared(const MunitParameter params[], void *user)
+{
+	ChiakiTimerService *a = chiaki_timer_service_shared_ref();
+	munit_assert_not_null(a);
+	ChiakiTimerService *b = chiaki_timer_service_shared_ref();
+	munit_assert_ptr_equal(a, b);
+	chiaki_timer_service_shared_unref(b);
+
+	TestCtx ctx;
+	ctx_init(&ctx, a);
+	munit_assert_int(chiaki_timer_arm(&ctx.timers[0], chiaki_time_now_monotonic_us() + 300), ==, CHIAKI_ERR_SUCCESS);
+	ctx_wait_fired(&ctx, 1);
+	ctx_fini(&ctx);
+	chiaki_timer_service_shared_unref(a);
+
+	// recreated after the last reference is gone
+	a = chiaki_timer_service_shared_ref();
+	munit_assert_not_null(a);
+	chiaki_timer_service_shared_unref(a);
+	return MUNIT_OK;
+}
+
+MunitTest tests_timer_service[] = {
+	{
+		"/order",
+		test_order,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/rearm",
+		test_rearm,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/shared",
+		test_shared,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
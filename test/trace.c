@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/trace.h>
+
+#include <stdio.h>
+#include <string.h>
+
+static void push_data(ChiakiTrace *trace, uint32_t seq)
+{
+	ChiakiTraceEvent event = { 0 };
+	event.type = CHIAKI_TRACE_EVENT_DATA;
+	event.seq = seq;
+	event.result = CHIAKI_TRACE_REORDER_IN_ORDER;
+	chiaki_trace_push(trace, &event);
+}
+
+static MunitResult test_disabled(const MunitParameter params[], void *user)
+{
+	ChiakiTrace trace;
+	ChiakiErrorCode err = chiaki_trace_init(&trace, 0);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_false(chiaki_trace_enabled(&trace));
+	munit_assert_false(chiaki_trace_enabled(NULL));
+
+	push_data(&trace, 1);
+	push_data(NULL, 1);
+	munit_assert_size(chiaki_trace_snapshot(&trace, NULL, NULL), ==, 0);
+	munit_assert_int(chiaki_trace_dump_file(&trace, "/nonexistent"), ==, CHIAKI_ERR_UNINITIALIZED);
+
+	chiaki_trace_fini(&trace);
+	return MUNIT_OK;
+}
+
+static MunitResult test_wraparound(const MunitParameter params[], void *user)
+{
+	ChiakiTrace trace;
+	ChiakiErrorCode err = chiaki_trace_init(&trace, 5);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_true(chiaki_trace_enabled(&trace));
+
+	ChiakiTraceEvent events[8];
+	uint64_t overwritten;
+
+	for(uint32_t i=0; i<3; i++)
+		push_data(&trace, i);
+	size_t count = chiaki_trace_snapshot(&trace, events, &overwritten);
+	munit_assert_size(count, ==, 3);
+	munit_assert_uint64(overwritten, ==, 0);
+	for(size_t i=0; i<count; i++)
+		munit_assert_uint32(events[i].seq, ==, i);
+
+	// capacity is rounded up to 8, only the newest 8 of 19 remain
+	for(uint32_t i=3; i<19; i++)
+		push_data(&trace, i);
+	count = chiaki_trace_snapshot(&trace, events, &overwritten);
+	munit_assert_size(count, ==, 8);
+	munit_assert_uint64(overwritten, ==, 11);
+	for(size_t i=0; i<count; i++)
+	{
+		munit_assert_uint32(events[i].seq, ==, 11 + i);
+		munit_assert_uint8(events[i].type, ==, CHIAKI_TRACE_EVENT_DATA);
+		if(i > 0)
+			munit_assert_uint64(events[i].timestamp_us, >=, events[i-1].timestamp_us);
+	}
+
+	chiaki_trace_fini(&trace);
+	return MUNIT_OK;
+}
+
+static MunitResult test_dump(const MunitParameter params[], void *user)
+{
+	ChiakiTrace trace;
+	ChiakiErrorCode err = chiaki_trace_init(&trace, 4);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	for(uint32_t i=0; i<5; i++)
+		push_data(&trace, i);
+	ChiakiTraceEvent event = { 0 };
+	event.type = CHIAKI_TRACE_EVENT_AV_UNIT;
+	event.packet_type = 2;
+	event.key_pos = 0x1122334455667788;
+	event.seq = 0xdeadbeef;
+	event.size = 1400;
+	event.index = 0x0102;
+	event.extra = 0x0304;
+	event.result = 1;
+	chiaki_trace_push(&trace, &event);
+
+	const char *path = "chiaki-trace-test.trace";
+	err = chiaki_trace_dump_file(&trace, path);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	uint8_t buf[40 + 4 * 32 + 1];
+	FILE *f = fopen(path, "rb");
+	munit_assert_not_null(f);
+	size_t size = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+	remove(path);
+
+	munit_assert_size(size, ==, 40 + 4 * 32);
+	munit_assert_memory_equal(8, buf, CHIAKI_TRACE_FILE_MAGIC);
+	static const uint8_t header_expected[] = {
+		1, 0, 0, 0, // version
+		32, 0, 0, 0, // event size
+	};
+	munit_assert_memory_equal(sizeof(header_expected), buf + 8, header_expected);
+	static const uint8_t counts_expected[] = {
+		4, 0, 0, 0, 0, 0, 0, 0, // count
+		2, 0, 0, 0, 0, 0, 0, 0 // overwritten
+	};
+	munit_assert_memory_equal(sizeof(counts_expected), buf + 24, counts_expected);
+
+	// oldest remaining is seq 2
+	munit_assert_uint8(buf[40 + 8 + 8], ==, 2);
+
+	static const uint8_t last_expected[] = {
+		0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11, // key_pos
+		0xef, 0xbe, 0xad, 0xde, // seq
+		0x78, 0x05, 0x00, 0x00, // size
+		0x02, 0x01, // index
+		0x04, 0x03, // extra
+		CHIAKI_TRACE_EVENT_AV_UNIT, 2, 1, 0
+	};
+	munit_assert_memory_equal(sizeof(last_expected), buf + 40 + 3 * 32 + 8, last_expected);
+
+	chiaki_trace_fini(&trace);
+	return MUNIT_OK;
+}
+
+MunitTest tests_trace[] = {
+	{
+		"/disabled",
+		test_disabled,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/wraparound",
+		test_wraparound,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/dump",
+		test_dump,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};